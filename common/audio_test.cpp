@@ -0,0 +1,306 @@
+/*
+ * A simple test for the audio frame reader from audio.c
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "ac3.h"
+#include "accessunit.h"
+#include "adts.h"
+#include "audio.h"
+#include "bitdata.h"
+#include "blockcache.h"
+#include "compat.h"
+#include "compressed.h"
+#include "es.h"
+#include "gop.h"
+#include "h222.h"
+#include "h262.h"
+#include "l2audio.h"
+#include "misc.h"
+#include "nalunit.h"
+#include "pes.h"
+#include "pidint.h"
+#include "printing.h"
+#include "probe.h"
+#include "ps.h"
+#include "reverse.h"
+#include "shmring.h"
+#include "ts.h"
+#include "tswrite.h"
+
+#define TEST_NUM_FRAMES 500
+#define TEST_FRAME_SIZE 576 // MPEG-1 layer 2, 192 kbit/s at 48kHz
+#define TEST_GARBAGE_AFTER 200 // frames
+#define TEST_GARBAGE_SIZE 10000 // bytes
+#define TEST_TRUNCATED_BY 100 // bytes
+#define TEST_MPEG2_L2_FRAME_SIZE 384 // MPEG-2 layer 2, 64 kbit/s at 24kHz
+
+/*
+ * Check that the syncword search finds the same syncword as a simple
+ * byte-by-byte search, at every position in (and around) a vector.
+ */
+static int test_syncword_search(void)
+{
+    static const int types[] = { AUDIO_ADTS, AUDIO_L2, AUDIO_AC3 };
+    byte data[100];
+
+    srand(1);
+    for (int tt = 0; tt < 3; tt++) {
+        for (int trial = 0; trial < 2000; trial++) {
+            int expected = -1;
+            // Mostly bytes that cannot start a syncword, with the odd one that
+            // can, and (usually) one real syncword
+            for (int ii = 0; ii < 100; ii++)
+                data[ii] = (byte)(rand() % 5 == 0 ? 0xFF : rand() % 0x0B);
+            if (trial % 10 != 0) {
+                int posn = rand() % 99;
+                data[posn] = (types[tt] == AUDIO_AC3 ? 0x0B : 0xFF);
+                data[posn + 1] = (types[tt] == AUDIO_AC3 ? 0x77 : 0xF1);
+            }
+            for (int ii = 0; ii < 99 && expected == -1; ii++) {
+                if (types[tt] == AUDIO_AC3)
+                    expected = (data[ii] == 0x0B && data[ii + 1] == 0x77) ? ii : -1;
+                else if (types[tt] == AUDIO_L2)
+                    expected = (data[ii] == 0xFF && (data[ii + 1] & 0xE0) == 0xE0) ? ii : -1;
+                else
+                    expected = (data[ii] == 0xFF && (data[ii + 1] & 0xF0) == 0xF0) ? ii : -1;
+            }
+            int found = find_audio_syncword(data, 100, types[tt]);
+            if (found != expected) {
+                printf("Test failed - %s syncword found at %d, expected %d\n",
+                    AUDIO_STR(types[tt]), found, expected);
+                return 1;
+            }
+        }
+    }
+
+    // A syncword split across the end of the data is not found
+    memset(data, 0, sizeof(data));
+    data[99] = 0xFF;
+    if (find_audio_syncword(data, 100, AUDIO_L2) != -1) {
+        printf("Test failed - found half a syncword at the end of the data\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Write a file of MPEG layer 2 frames with garbage in the middle and a
+ * truncated frame at the end, and check that we read (and index) exactly
+ * the frames that are there.
+ */
+static int test_resync(void)
+{
+    char filename[] = "/tmp/audio_test_XXXXXX";
+    byte frame[TEST_FRAME_SIZE];
+    byte garbage[TEST_GARBAGE_SIZE];
+    audio_reader_p reader = nullptr;
+    audio_frame_p aframe = nullptr;
+    int result = 1;
+    int ii, err;
+
+    int fd = mkstemp(filename);
+    if (fd == -1) {
+        printf("Test failed - creating temporary file\n");
+        return 1;
+    }
+    srand(2);
+    for (ii = 0; ii < TEST_GARBAGE_SIZE; ii++)
+        garbage[ii] = (byte)rand();
+    for (ii = 0; ii < TEST_NUM_FRAMES; ii++) {
+        int len = TEST_FRAME_SIZE;
+        frame[0] = 0xFF;
+        frame[1] = 0xFD; // MPEG-1 layer 2, no CRC
+        frame[2] = 0xA4; // 192 kbit/s, 48kHz
+        frame[3] = 0x44;
+        for (int jj = 4; jj < TEST_FRAME_SIZE; jj++)
+            frame[jj] = (byte)rand();
+        if (ii == TEST_GARBAGE_AFTER
+            && write(fd, garbage, TEST_GARBAGE_SIZE) != TEST_GARBAGE_SIZE) {
+            printf("Test failed - writing temporary file\n");
+            close(fd);
+            goto finish;
+        }
+        if (ii == TEST_NUM_FRAMES - 1)
+            len -= TEST_TRUNCATED_BY;
+        if (write(fd, frame, len) != len) {
+            printf("Test failed - writing temporary file\n");
+            close(fd);
+            goto finish;
+        }
+    }
+    close(fd);
+
+    fd = open_binary_file(filename, false);
+    if (fd == -1)
+        goto finish;
+    if (build_audio_reader(fd, AUDIO_L2, true, &reader)) {
+        close_file(fd);
+        goto finish;
+    }
+    for (;;) {
+        err = get_next_audio_frame(reader, &aframe);
+        if (err == EOF)
+            break;
+        else if (err) {
+            printf("Test failed - reading audio frame %d\n", reader->num_frames);
+            goto close;
+        }
+        if (aframe->data_len != TEST_FRAME_SIZE || aframe->data[0] != 0xFF) {
+            printf("Test failed - audio frame %d is not a frame\n", reader->num_frames);
+            free_audio_frame(&aframe);
+            goto close;
+        }
+        free_audio_frame(&aframe);
+    }
+
+    if (reader->num_frames != TEST_NUM_FRAMES - 1) {
+        printf("Test failed - read %d audio frames, expected %d\n", reader->num_frames,
+            TEST_NUM_FRAMES - 1);
+        goto close;
+    } else if (reader->num_resyncs != 1 || reader->bytes_skipped != TEST_GARBAGE_SIZE) {
+        printf("Test failed - resynchronised %d times, skipping " OFFSET_T_FORMAT
+               " bytes, expected once, skipping %d\n",
+            reader->num_resyncs, reader->bytes_skipped, TEST_GARBAGE_SIZE);
+        goto close;
+    } else if (reader->num_samples != (uint64_t)1152 * (TEST_NUM_FRAMES - 1)) {
+        printf("Test failed - read %d samples\n", (int)reader->num_samples);
+        goto close;
+    }
+    for (ii = 0; ii < (int)reader->index_len; ii++) {
+        offset_t expected = (offset_t)ii * TEST_FRAME_SIZE
+            + (ii >= TEST_GARBAGE_AFTER ? TEST_GARBAGE_SIZE : 0);
+        if (reader->index[ii].posn != expected || reader->index[ii].length != TEST_FRAME_SIZE
+            || reader->index[ii].samples != 1152) {
+            printf("Test failed - index entry %d is at " OFFSET_T_FORMAT
+                   ", expected " OFFSET_T_FORMAT "\n",
+                ii, reader->index[ii].posn, expected);
+            goto close;
+        }
+    }
+    if (reader->index_len != reader->num_frames) {
+        printf("Test failed - index has %d entries\n", reader->index_len);
+        goto close;
+    }
+    result = 0;
+
+close:
+    free_audio_reader(&reader);
+    close_file(fd);
+finish:
+    unlink(filename);
+    return result;
+}
+
+/*
+ * MPEG-2 (low sampling frequency) layer II frames are the same number of
+ * samples as MPEG-1 ones - 1152 - and it is only layer III that has
+ * frames half that length. Check both the header parsing and that the
+ * fd-based reader reads whole frames.
+ */
+static int test_mpeg2_layer2(void)
+{
+    char filename[] = "/tmp/audio_test_XXXXXX";
+    // MPEG-2, no CRC, 64 kbit/s at 24kHz: 144000 * 64 / 24000 bytes
+    static const byte layer2[4] = { 0xFF, 0xF5, 0x84, 0x44 };
+    static const byte layer3[4] = { 0xFF, 0xF3, 0x84, 0x44 };
+    byte frame[TEST_MPEG2_L2_FRAME_SIZE];
+    audio_frame_p aframe = nullptr;
+    int result = 1;
+    int samples;
+    int ii, err;
+
+    if (l2audio_frame_info(layer2, &samples) != TEST_MPEG2_L2_FRAME_SIZE || samples != 1152) {
+        printf("Test failed - MPEG-2 layer II frame is %d bytes, %d samples\n",
+            l2audio_frame_info(layer2, &samples), samples);
+        return 1;
+    }
+    if (l2audio_frame_info(layer3, &samples) != TEST_MPEG2_L2_FRAME_SIZE / 2 || samples != 576) {
+        printf("Test failed - MPEG-2 layer III frame is %d bytes, %d samples\n",
+            l2audio_frame_info(layer3, &samples), samples);
+        return 1;
+    }
+
+    int fd = mkstemp(filename);
+    if (fd == -1) {
+        printf("Test failed - creating temporary file\n");
+        return 1;
+    }
+    memcpy(frame, layer2, sizeof(layer2));
+    memset(frame + sizeof(layer2), 0x55, sizeof(frame) - sizeof(layer2));
+    for (ii = 0; ii < 10; ii++) {
+        if (write(fd, frame, sizeof(frame)) != (ssize_t)sizeof(frame)) {
+            printf("Test failed - writing temporary file\n");
+            close(fd);
+            goto finish;
+        }
+    }
+    close(fd);
+
+    fd = open_binary_file(filename, false);
+    if (fd == -1)
+        goto finish;
+    for (ii = 0;; ii++) {
+        err = read_next_l2audio_frame(fd, &aframe);
+        if (err == EOF)
+            break;
+        else if (err) {
+            printf("Test failed - reading audio frame %d\n", ii);
+            goto close;
+        }
+        if (aframe->data_len != TEST_MPEG2_L2_FRAME_SIZE || memcmp(aframe->data, frame, 4)) {
+            printf("Test failed - audio frame %d is %u bytes\n", ii, aframe->data_len);
+            free_audio_frame(&aframe);
+            goto close;
+        }
+        free_audio_frame(&aframe);
+    }
+    if (ii != 10) {
+        printf("Test failed - read %d audio frames, expected 10\n", ii);
+        goto close;
+    }
+    result = 0;
+
+close:
+    close_file(fd);
+finish:
+    unlink(filename);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    int err;
+
+    printf("Test 1 - looking for audio syncwords\n");
+    err = test_syncword_search();
+    if (err)
+        return 1;
+    printf("Test 1 succeeded\n");
+
+    printf("Test 2 - reading damaged audio\n");
+    err = test_resync();
+    if (err)
+        return 1;
+    printf("Test 2 succeeded\n");
+
+    printf("Test 3 - MPEG-2 layer II frame lengths\n");
+    err = test_mpeg2_layer2();
+    if (err)
+        return 1;
+    printf("Test 3 succeeded\n");
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
@@ -0,0 +1,285 @@
+/*
+ * A simple test for running a batch of files, from batch.h
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "accessunit.h"
+#include "batch.h"
+#include "bitdata.h"
+#include "blockcache.h"
+#include "compat.h"
+#include "compressed.h"
+#include "es.h"
+#include "gop.h"
+#include "h222.h"
+#include "h262.h"
+#include "misc.h"
+#include "nalunit.h"
+#include "pes.h"
+#include "pidint.h"
+#include "printing.h"
+#include "probe.h"
+#include "ps.h"
+#include "reverse.h"
+#include "shmring.h"
+#include "ts.h"
+#include "tswrite.h"
+
+#define TEST_NUM_FILES 20
+#define TEST_PID 0x100
+
+// What the batch reports, one line of JSON per file
+static char reported[64 * 1024];
+static size_t reported_length = 0;
+
+static void report_message(const char* message)
+{
+    size_t length = strlen(message);
+    if (reported_length + length < sizeof(reported)) {
+        memcpy(reported + reported_length, message, length + 1);
+        reported_length += length;
+    }
+}
+static void report_error(const char* message) { printf("%s", message); }
+static void freport_message(const char* format, va_list arg_ptr)
+{
+    char buf[1024];
+    (void)vsnprintf(buf, sizeof(buf), format, arg_ptr);
+    report_message(buf);
+}
+static void freport_error(const char* format, va_list arg_ptr)
+{
+    (void)vprintf(format, arg_ptr);
+}
+static void flush_report(void) { }
+
+/*
+ * Handle a "file" of the batch: its name is its number, and what it does
+ * depends on that. Later files finish sooner, so that the files finish
+ * out of order.
+ */
+static int handle_file(char* filename, void* arg)
+{
+    int which = atoi(filename);
+    (void)arg;
+    usleep((TEST_NUM_FILES - which) * 1000);
+    // Each file should start with the continuity counters as at startup
+    fprint_msg("file %d cc %d\n", which, next_continuity_count(TEST_PID));
+    if (which % 3 == 0)
+        fprint_err("### error in %d\n", which);
+    return which % 3;
+}
+
+/*
+ * Run the batch, and check what it reports.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_run_batch(int unordered)
+{
+    char names[TEST_NUM_FILES][16];
+    char* files[TEST_NUM_FILES];
+    int seen[TEST_NUM_FILES];
+    struct batch_options options = { 4, 2, 0, unordered };
+    char* line;
+    int count = 0;
+
+    for (int ii = 0; ii < TEST_NUM_FILES; ii++) {
+        snprintf(names[ii], sizeof(names[ii]), "%d", ii);
+        files[ii] = names[ii];
+        seen[ii] = false;
+    }
+    reported_length = 0;
+    reported[0] = '\0';
+    if (redirect_output(
+            report_message, report_error, freport_message, freport_error, flush_report)) {
+        printf("Test failed - redirecting output\n");
+        return 1;
+    }
+    int err = run_batch(files, TEST_NUM_FILES, &options, handle_file, nullptr);
+    redirect_output_stdout();
+    if (err) {
+        printf("Test failed - running the batch\n");
+        return 1;
+    }
+
+    line = reported;
+    while (*line != '\0') {
+        char* end = strchr(line, '\n');
+        char expected[256];
+        char errors[64];
+        int which;
+        if (end == nullptr || sscanf(line, "{\"file\":\"%d\"", &which) != 1 || which < 0
+            || which >= TEST_NUM_FILES) {
+            printf("Test failed - unexpected report:\n%s\n", line);
+            return 1;
+        }
+        *end = '\0';
+        if (!unordered && which != count) {
+            printf("Test failed - file %d reported in place of file %d\n", which, count);
+            return 1;
+        }
+        if (seen[which]) {
+            printf("Test failed - file %d reported twice\n", which);
+            return 1;
+        }
+        seen[which] = true;
+        errors[0] = '\0';
+        if (which % 3 == 0)
+            snprintf(errors, sizeof(errors), "### error in %d\\n", which);
+        snprintf(expected, sizeof(expected),
+            "{\"file\":\"%d\",\"status\":%d,\"output\":\"file %d cc 1\\n\",\"errors\":\"%s\"}",
+            which, which % 3, which, errors);
+        if (strcmp(line, expected)) {
+            printf("Test failed - file %d reported as:\n%s\nexpected:\n%s\n", which, line,
+                expected);
+            return 1;
+        }
+        count++;
+        line = end + 1;
+    }
+    if (count != TEST_NUM_FILES) {
+        printf("Test failed - %d of %d files reported\n", count, TEST_NUM_FILES);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Check that `files` holds the names in `expected`.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int check_names(char** files, int num_files, const char* expected[], int num_expected)
+{
+    if (num_files != num_expected) {
+        printf("Test failed - %d names, expected %d\n", num_files, num_expected);
+        return 1;
+    }
+    for (int ii = 0; ii < num_files; ii++) {
+        if (strcmp(files[ii], expected[ii])) {
+            printf("Test failed - name %d is '%s', expected '%s'\n", ii, files[ii], expected[ii]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Read the names in a batch from a list, and from a directory.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_read_batch_list(void)
+{
+    char dirname[100];
+    char listname[100];
+    char path[200];
+    char** files = nullptr;
+    int num_files = 0;
+    int result = 1;
+    FILE* list;
+
+    snprintf(dirname, sizeof(dirname), "/tmp/batch_test_%d", (int)getpid());
+    snprintf(listname, sizeof(listname), "/tmp/batch_test_%d.list", (int)getpid());
+
+    // Blank lines are ignored, and DOS line endings are coped with
+    list = fopen(listname, "w");
+    if (list == nullptr) {
+        printf("Test failed - creating %s\n", listname);
+        return 1;
+    }
+    fprintf(list, "one.ts\n\ntwo.ts\r\nthree four.ts");
+    fclose(list);
+    if (read_batch_list(listname, &files, &num_files)) {
+        printf("Test failed - reading %s\n", listname);
+        goto tidy;
+    }
+    {
+        const char* expected[] = { "one.ts", "two.ts", "three four.ts" };
+        if (check_names(files, num_files, expected, 3))
+            goto tidy;
+    }
+    free_batch_list(&files, num_files);
+
+    // Only the regular files in a directory, in name order
+    if (mkdir(dirname, 0700)) {
+        printf("Test failed - creating %s\n", dirname);
+        goto tidy;
+    }
+    for (const char* name : { "b.ts", "a.ts", "c.ts" }) {
+        snprintf(path, sizeof(path), "%s/%s", dirname, name);
+        list = fopen(path, "w");
+        if (list == nullptr) {
+            printf("Test failed - creating %s\n", path);
+            goto tidy;
+        }
+        fclose(list);
+    }
+    snprintf(path, sizeof(path), "%s/subdirectory", dirname);
+    if (mkdir(path, 0700)) {
+        printf("Test failed - creating %s\n", path);
+        goto tidy;
+    }
+    if (read_batch_list(dirname, &files, &num_files)) {
+        printf("Test failed - reading %s\n", dirname);
+        goto tidy;
+    }
+    {
+        char expected[3][200];
+        const char* expected_p[3];
+        for (int ii = 0; ii < 3; ii++) {
+            snprintf(expected[ii], sizeof(expected[ii]), "%s/%c.ts", dirname, 'a' + ii);
+            expected_p[ii] = expected[ii];
+        }
+        if (check_names(files, num_files, expected_p, 3))
+            goto tidy;
+    }
+    result = 0;
+
+tidy:
+    free_batch_list(&files, num_files);
+    (void)unlink(listname);
+    for (const char* name : { "a.ts", "b.ts", "c.ts" }) {
+        snprintf(path, sizeof(path), "%s/%s", dirname, name);
+        (void)unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/subdirectory", dirname);
+    (void)rmdir(path);
+    (void)rmdir(dirname);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test 1 - reporting on a batch in order\n");
+    if (test_run_batch(false))
+        return 1;
+    printf("Test 1 succeeded\n");
+
+    printf("Test 2 - reporting on a batch as each file finishes\n");
+    if (test_run_batch(true))
+        return 1;
+    printf("Test 2 succeeded\n");
+
+    printf("Test 3 - reading the names of the files in a batch\n");
+    if (test_read_batch_list())
+        return 1;
+    printf("Test 3 succeeded\n");
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
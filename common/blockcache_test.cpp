@@ -0,0 +1,328 @@
+/*
+ * A simple test for the block cache, from blockcache.h, and its use by
+ * the TS reader
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "accessunit.h"
+#include "bitdata.h"
+#include "blockcache.h"
+#include "compat.h"
+#include "compressed.h"
+#include "es.h"
+#include "gop.h"
+#include "h222.h"
+#include "h262.h"
+#include "misc.h"
+#include "nalunit.h"
+#include "pes.h"
+#include "pidint.h"
+#include "printing.h"
+#include "probe.h"
+#include "ps.h"
+#include "reverse.h"
+#include "shmring.h"
+#include "ts.h"
+#include "tswrite.h"
+
+#define TEST_BLOCK_SIZE 100
+#define TEST_NUM_BLOCKS 3
+
+// Enough TS packets that the reader has to read more blocks than it keeps
+#define TEST_NUM_PACKETS ((TS_READ_AHEAD_BLOCKS + 2) * TS_READ_AHEAD_COUNT + 10)
+
+/*
+ * Fill the next block of `cache` as if it had been read from `posn` in
+ * the file.
+ *
+ * Returns the block, or nullptr if something goes wrong.
+ */
+static block_cache_entry_p fill_block(block_cache_p cache, offset_t posn)
+{
+    block_cache_entry_p block = get_block_to_fill(cache, nullptr);
+    if (block == nullptr) {
+        printf("Test failed - getting a block to fill\n");
+        return nullptr;
+    }
+    memset(block->data, (int)(posn / TEST_BLOCK_SIZE), TEST_BLOCK_SIZE);
+    block->posn = posn;
+    block->len = TEST_BLOCK_SIZE;
+    return block;
+}
+
+/*
+ * Look for `posn` in `cache`, and check it is found in `expected` (or not
+ * found at all, if that is nullptr).
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int check_find(
+    block_cache_p cache, offset_t posn, int stride, block_cache_entry_p expected)
+{
+    block_cache_entry_p block = find_cached_block(cache, posn, stride);
+    if (block != expected) {
+        printf("Test failed - position " OFFSET_T_FORMAT " (stride %d) %s\n", posn, stride,
+            (expected == nullptr ? "found, but should not be" : "not found in the right block"));
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Find positions in the blocks we have, and not in those we don't.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_hit(void)
+{
+    block_cache_p cache = nullptr;
+    block_cache_entry_p blocks[TEST_NUM_BLOCKS];
+    int result = 1;
+
+    if (build_block_cache(TEST_NUM_BLOCKS, TEST_BLOCK_SIZE, &cache)) {
+        printf("Test failed - building block cache\n");
+        return 1;
+    }
+    if (check_find(cache, 0, 1, nullptr))
+        goto tidy;
+    for (int ii = 0; ii < TEST_NUM_BLOCKS; ii++) {
+        blocks[ii] = fill_block(cache, ii * TEST_BLOCK_SIZE);
+        if (blocks[ii] == nullptr)
+            goto tidy;
+    }
+    if (check_find(cache, 0, 1, blocks[0]) || check_find(cache, 150, 1, blocks[1])
+        || check_find(cache, 299, 1, blocks[2]) || check_find(cache, 300, 1, nullptr)
+        || check_find(cache, -1, 1, nullptr))
+        goto tidy;
+
+    // Positions must be a whole number of strides into their block
+    if (check_find(cache, 140, 20, blocks[1]) || check_find(cache, 150, 20, nullptr))
+        goto tidy;
+
+    if (cache->hits != 4 || cache->misses != 4) {
+        printf("Test failed - %u hits and %u misses, expected 4 and 4\n", cache->hits,
+            cache->misses);
+        goto tidy;
+    }
+
+    // Forgotten blocks are not found
+    forget_cached_blocks(cache);
+    if (check_find(cache, 150, 1, nullptr))
+        goto tidy;
+    result = 0;
+
+tidy:
+    free_block_cache(&cache);
+    return result;
+}
+
+/*
+ * New data goes into the least recently used block, but never into the
+ * block being kept.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_eviction(void)
+{
+    block_cache_p cache = nullptr;
+    block_cache_entry_p blocks[TEST_NUM_BLOCKS];
+    block_cache_entry_p block;
+    int result = 1;
+
+    if (build_block_cache(TEST_NUM_BLOCKS, TEST_BLOCK_SIZE, &cache)) {
+        printf("Test failed - building block cache\n");
+        return 1;
+    }
+    for (int ii = 0; ii < TEST_NUM_BLOCKS; ii++) {
+        blocks[ii] = fill_block(cache, ii * TEST_BLOCK_SIZE);
+        if (blocks[ii] == nullptr)
+            goto tidy;
+    }
+
+    // Using the first block makes the second the least recently used
+    if (check_find(cache, 50, 1, blocks[0]))
+        goto tidy;
+    block = fill_block(cache, 3 * TEST_BLOCK_SIZE);
+    if (block != blocks[1] || cache->last_read != block) {
+        printf("Test failed - did not refill the least recently used block\n");
+        goto tidy;
+    }
+    if (check_find(cache, 150, 1, nullptr) || check_find(cache, 350, 1, blocks[1])
+        || check_find(cache, 50, 1, blocks[0]) || check_find(cache, 250, 1, blocks[2]))
+        goto tidy;
+
+    // Now the first block is the least recently used, but we want to keep it
+    block = get_block_to_fill(cache, blocks[0]);
+    if (block != blocks[1]) {
+        printf("Test failed - did not keep the block asked for\n");
+        goto tidy;
+    }
+    result = 0;
+
+tidy:
+    free_block_cache(&cache);
+    return result;
+}
+
+/*
+ * Write the test file: TS packets with their index in the first four bytes
+ * of their payload.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int make_test_file(const char* filename)
+{
+    FILE* file = fopen(filename, "wb");
+    if (file == nullptr) {
+        printf("Test failed - creating %s\n", filename);
+        return 1;
+    }
+    for (int ii = 0; ii < TEST_NUM_PACKETS; ii++) {
+        byte packet[TS_PACKET_SIZE];
+        memset(packet, 0xFF, TS_PACKET_SIZE);
+        packet[0] = 0x47;
+        packet[1] = 0x01;
+        packet[2] = 0x00;
+        packet[3] = 0x10 | (ii & 0x0F);
+        packet[4] = (ii >> 24) & 0xFF;
+        packet[5] = (ii >> 16) & 0xFF;
+        packet[6] = (ii >> 8) & 0xFF;
+        packet[7] = ii & 0xFF;
+        if (fwrite(packet, 1, TS_PACKET_SIZE, file) != TS_PACKET_SIZE) {
+            printf("Test failed - writing %s\n", filename);
+            fclose(file);
+            return 1;
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+/*
+ * Read the next `count` packets, and check they are those from `index` on.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int check_packets(TS_reader_p tsreader, int index, int count)
+{
+    for (int ii = index; ii < index + count; ii++) {
+        byte* packet;
+        if (read_next_TS_packet(tsreader, &packet)) {
+            printf("Test failed - reading packet %d\n", ii);
+            return 1;
+        }
+        int got = (packet[4] << 24) | (packet[5] << 16) | (packet[6] << 8) | packet[7];
+        if (packet[0] != 0x47 || got != ii) {
+            printf("Test failed - read packet %d, expected packet %d\n", got, ii);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Seek back into a block the TS reader has already read, without going
+ * back to the file, and read on from it (which does go back to the file).
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_TS_reader(void)
+{
+    char filename[100];
+    TS_reader_p tsreader = nullptr;
+    offset_t file_posn;
+    byte* packet;
+    int result = 1;
+
+    snprintf(filename, sizeof(filename), "/tmp/blockcache_test_%d.ts", (int)getpid());
+    if (make_test_file(filename))
+        return 1;
+    if (open_file_for_TS_read(filename, &tsreader)) {
+        printf("Test failed - opening %s\n", filename);
+        goto tidy;
+    }
+
+    // Read across the boundary between the first two blocks (the first is
+    // bigger, as the reader doesn't yet know how big the packets are)
+    if (check_packets(tsreader, 0, 2 * TS_READ_AHEAD_COUNT + 10))
+        goto tidy;
+    file_posn = lseek(tsreader->file, 0, SEEK_CUR);
+
+    // Seeking back into the first block is satisfied from memory
+    if (seek_using_TS_reader(tsreader, 5 * TS_PACKET_SIZE)) {
+        printf("Test failed - seeking to packet 5\n");
+        goto tidy;
+    }
+    if (tsreader->blocks->hits != 1 || tsreader->blocks->misses != 0) {
+        printf("Test failed - seek back gave %u hits and %u misses\n", tsreader->blocks->hits,
+            tsreader->blocks->misses);
+        goto tidy;
+    }
+    if (check_packets(tsreader, 5, 10))
+        goto tidy;
+    if (lseek(tsreader->file, 0, SEEK_CUR) != file_posn) {
+        printf("Test failed - reading from a cached block moved the file\n");
+        goto tidy;
+    }
+
+    // Reading on past the end of that block goes back to the file for
+    // what follows it, and on to the end
+    if (check_packets(tsreader, 15, TEST_NUM_PACKETS - 15))
+        goto tidy;
+    if (read_next_TS_packet(tsreader, &packet) != EOF) {
+        printf("Test failed - no EOF at the end of %s\n", filename);
+        goto tidy;
+    }
+
+    // A seek to somewhere we've never read (or no longer have) misses
+    if (seek_using_TS_reader(tsreader, 20 * TS_PACKET_SIZE)) {
+        printf("Test failed - seeking to packet 20\n");
+        goto tidy;
+    }
+    if (tsreader->blocks->misses != 1) {
+        printf("Test failed - seek to an evicted block gave %u misses\n",
+            tsreader->blocks->misses);
+        goto tidy;
+    }
+    if (check_packets(tsreader, 20, 10))
+        goto tidy;
+    result = 0;
+
+tidy:
+    if (tsreader != nullptr)
+        (void)close_TS_reader(&tsreader);
+    (void)unlink(filename);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test 1 - finding positions in cached blocks\n");
+    if (test_hit())
+        return 1;
+    printf("Test 1 succeeded\n");
+
+    printf("Test 2 - evicting the least recently used block\n");
+    if (test_eviction())
+        return 1;
+    printf("Test 2 succeeded\n");
+
+    printf("Test 3 - seeking within, and reading across, the TS reader's blocks\n");
+    if (test_TS_reader())
+        return 1;
+    printf("Test 3 succeeded\n");
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
@@ -0,0 +1,173 @@
+/*
+ * A simple test for reading and writing compressed files, from compressed.c
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "accessunit.h"
+#include "bitdata.h"
+#include "blockcache.h"
+#include "compat.h"
+#include "compressed.h"
+#include "es.h"
+#include "gop.h"
+#include "h222.h"
+#include "h262.h"
+#include "misc.h"
+#include "nalunit.h"
+#include "pes.h"
+#include "pidint.h"
+#include "printing.h"
+#include "probe.h"
+#include "ps.h"
+#include "reverse.h"
+#include "shmring.h"
+#include "ts.h"
+#include "tswrite.h"
+
+// Enough for several zstd frames, and several gzip restart points
+#define TEST_DATA_SIZE (3 * COMPRESSED_OUTPUT_FRAME_SIZE + 12345)
+#define TEST_NUM_SEEKS 200
+#define TEST_READ_SIZE 5000
+
+/*
+ * Make up some data that compresses, but not too well.
+ */
+static byte* make_test_data(void)
+{
+    byte* data = (byte*)malloc(TEST_DATA_SIZE);
+    if (data == nullptr) {
+        printf("Test failed - allocating test data\n");
+        return nullptr;
+    }
+    srand(1);
+    for (int ii = 0; ii < TEST_DATA_SIZE; ii++)
+        data[ii] = (byte)((ii / 100) + (rand() % 8));
+    return data;
+}
+
+/*
+ * Write the test data to a file via `fopen_compressed`, then check that
+ * reading it back (in order, and after seeking about) gives the same data.
+ */
+static int test_round_trip(const byte* data, const char* suffix, int expect_format)
+{
+    char filename[100];
+    byte buf[TEST_READ_SIZE];
+    FILE* output;
+    int fd, err;
+    int result = 1;
+
+    snprintf(filename, sizeof(filename), "/tmp/compressed_test_%d.ts%s", (int)getpid(), suffix);
+    output = fopen_compressed(filename, true);
+    if (output == nullptr) {
+        printf("Test failed - creating %s\n", filename);
+        return 1;
+    }
+    // Write in uneven amounts, to cross the frame boundaries untidily
+    for (int posn = 0; posn < TEST_DATA_SIZE;) {
+        int len = 1 + rand() % 70000;
+        if (len > TEST_DATA_SIZE - posn)
+            len = TEST_DATA_SIZE - posn;
+        if (fwrite(data + posn, 1, len, output) != (size_t)len) {
+            printf("Test failed - writing %s\n", filename);
+            (void)fclose(output);
+            goto finish;
+        }
+        posn += len;
+    }
+    if (fclose(output)) {
+        printf("Test failed - closing %s\n", filename);
+        goto finish;
+    }
+
+    fd = open_binary_file(filename, false);
+    if (fd == -1)
+        goto finish;
+    if (!is_compressed_file(fd) || get_compressed_input(fd)->format != expect_format) {
+        printf("Test failed - %s is not recognised as %s\n", filename,
+            COMPRESSED_STR(expect_format));
+        goto close;
+    }
+    if (expect_format == COMPRESSED_ZSTD && !get_compressed_input(fd)->parallel) {
+        printf("Test failed - %s does not have a usable seek table\n", filename);
+        goto close;
+    }
+
+    // All of it, in order
+    for (int posn = 0; posn < TEST_DATA_SIZE; posn += TEST_READ_SIZE) {
+        int len = (TEST_DATA_SIZE - posn < TEST_READ_SIZE ? TEST_DATA_SIZE - posn : TEST_READ_SIZE);
+        err = read_bytes(fd, len, buf);
+        if (err || memcmp(buf, data + posn, len)) {
+            printf("Test failed - reading %d bytes at %d from %s\n", len, posn, filename);
+            goto close;
+        }
+    }
+    if (read_bytes(fd, 1, buf) != EOF) {
+        printf("Test failed - no EOF at the end of %s\n", filename);
+        goto close;
+    }
+
+    // Backwards and forwards
+    for (int ii = 0; ii < TEST_NUM_SEEKS; ii++) {
+        int posn = rand() % (TEST_DATA_SIZE - TEST_READ_SIZE);
+        if (ii % 4 == 1)
+            posn = (int)tell_file(fd) - TEST_READ_SIZE - rand() % 1000; // just before
+        if (posn < 0)
+            posn = 0;
+        if (seek_file(fd, posn) || tell_file(fd) != posn) {
+            printf("Test failed - seeking to %d in %s\n", posn, filename);
+            goto close;
+        }
+        err = read_bytes(fd, TEST_READ_SIZE, buf);
+        if (err || memcmp(buf, data + posn, TEST_READ_SIZE)) {
+            printf("Test failed - reading at %d (seek %d) in %s\n", posn, ii, filename);
+            goto close;
+        }
+    }
+    result = 0;
+
+close:
+    (void)close_file(fd);
+finish:
+    unlink(filename);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    byte* data = make_test_data();
+    int err;
+    if (data == nullptr)
+        return 1;
+
+    printf("Test 1 - gzip files\n");
+    err = test_round_trip(data, ".gz", COMPRESSED_GZIP);
+    if (err)
+        return 1;
+    printf("Test 1 succeeded\n");
+
+#if HAVE_ZSTD
+    printf("Test 2 - zstd files\n");
+    err = test_round_trip(data, ".zst", COMPRESSED_ZSTD);
+    if (err)
+        return 1;
+    printf("Test 2 succeeded\n");
+#else
+    printf("Test 2 skipped - zstd is not supported by this build\n");
+#endif
+    free(data);
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
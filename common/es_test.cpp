@@ -6,11 +6,15 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include "accessunit.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "misc.h"
@@ -18,11 +22,347 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 
+#define TEST_NUM_UNITS 1000
+#define TEST_NUM_PARTS 4
+
+/*
+ * Read the ES units from `es` into `list`, stopping after `max` (if it
+ * is not 0).
+ *
+ * Returns 0 if it reached the end of file, or read `max` units, 1 otherwise.
+ */
+static int read_units(ES_p es, int max, ES_unit_list_p list)
+{
+    struct ES_unit unit;
+    if (setup_ES_unit(&unit))
+        return 1;
+    for (int ii = 0; max == 0 || ii < max; ii++) {
+        int err = find_next_ES_unit(es, &unit);
+        if (err == EOF)
+            break;
+        else if (err || append_to_ES_unit_list(list, &unit)) {
+            clear_ES_unit(&unit);
+            return 1;
+        }
+    }
+    clear_ES_unit(&unit);
+    return 0;
+}
+
+/*
+ * Check that pipelined reading gives the same ES units as direct reading,
+ * including after a seek back into data that has already been read.
+ */
+static int test_pipelining(void)
+{
+    char filename[] = "/tmp/es_test_XXXXXX";
+    ES_unit_list_p direct = nullptr;
+    ES_unit_list_p pipelined = nullptr;
+    ES_p es = nullptr;
+    int result = 1;
+
+    int fd = mkstemp(filename);
+    if (fd == -1) {
+        printf("Test failed - creating temporary file\n");
+        return 1;
+    }
+    // ES units of assorted lengths, with no 00 00 01 within them
+    srand(1);
+    for (int ii = 0; ii < TEST_NUM_UNITS; ii++) {
+        byte data[4 + 3000];
+        int len = 4 + rand() % 3000;
+        data[0] = data[1] = 0x00;
+        data[2] = 0x01;
+        data[3] = (byte)ii;
+        for (int jj = 4; jj < len; jj++)
+            data[jj] = (byte)(1 + rand() % 255);
+        if (write(fd, data, len) != len) {
+            printf("Test failed - writing temporary file\n");
+            close(fd);
+            goto finish;
+        }
+    }
+    close(fd);
+
+    if (build_ES_unit_list(&direct) || build_ES_unit_list(&pipelined))
+        goto finish;
+
+    if (open_elementary_stream(filename, &es))
+        goto finish;
+    if (read_units(es, 0, direct)) {
+        printf("Test failed - reading ES units directly\n");
+        goto finish;
+    }
+    close_elementary_stream(&es);
+    if (direct->length != TEST_NUM_UNITS) {
+        printf("Test failed - read %d ES units, expected %d\n", direct->length, TEST_NUM_UNITS);
+        goto finish;
+    }
+
+    // Read some of the file (so the producer is left running ahead of us),
+    // seek back to the 100th ES unit, and read on from there
+    if (open_elementary_stream(filename, &es))
+        goto finish;
+    if (set_ES_pipelining(es, true)) {
+        printf("Test failed - starting pipelining\n");
+        goto finish;
+    }
+    if (read_units(es, 300, pipelined) || pipelined->length != 300) {
+        printf("Test failed - reading first 300 pipelined ES units\n");
+        goto finish;
+    }
+    reset_ES_unit_list(pipelined);
+    if (seek_ES(es, direct->array[100].start_posn)) {
+        printf("Test failed - seeking to ES unit 100\n");
+        goto finish;
+    }
+    if (read_units(es, 0, pipelined)) {
+        printf("Test failed - reading pipelined ES units\n");
+        goto finish;
+    }
+    if (pipelined->length != TEST_NUM_UNITS - 100) {
+        printf("Test failed - read %d pipelined ES units, expected %d\n", pipelined->length,
+            TEST_NUM_UNITS - 100);
+        goto finish;
+    }
+    for (int ii = 0; ii < pipelined->length; ii++) {
+        ES_unit_p unit1 = &direct->array[100 + ii];
+        ES_unit_p unit2 = &pipelined->array[ii];
+        if (unit1->data_len != unit2->data_len
+            || compare_ES_offsets(unit1->start_posn, unit2->start_posn) != 0
+            || memcmp(unit1->data, unit2->data, unit1->data_len)) {
+            printf("Test failed - pipelined ES unit %d differs\n", 100 + ii);
+            goto finish;
+        }
+    }
+    result = 0;
+
+finish:
+    if (es != nullptr)
+        close_elementary_stream(&es);
+    if (direct != nullptr)
+        free_ES_unit_list(&direct);
+    if (pipelined != nullptr)
+        free_ES_unit_list(&pipelined);
+    (void)unlink(filename);
+    return result;
+}
+
+// Counting the ES units in each part of a partition
+struct part_counts {
+    ES_partition_p partition;
+    int counts[TEST_NUM_PARTS];
+};
+
+static int count_units_in_part(ES_p es, int part, void* arg)
+{
+    struct part_counts* counts = (struct part_counts*)arg;
+    offset_t next_start = -1;
+    struct ES_unit unit;
+    if (part + 1 < counts->partition->num_parts)
+        next_start = counts->partition->parts[part + 1].start;
+    if (setup_ES_unit(&unit))
+        return 1;
+    for (;;) {
+        int err = find_next_ES_unit(es, &unit);
+        if (err == EOF)
+            break;
+        else if (err) {
+            clear_ES_unit(&unit);
+            return 1;
+        }
+        if (next_start != -1 && unit.start_posn.infile >= next_start)
+            break;
+        counts->counts[part]++;
+    }
+    clear_ES_unit(&unit);
+    return 0;
+}
+
+/*
+ * Check that splitting an (H.262-like) ES file into GOPs gives parts that
+ * start at sequence headers, and that reading those parts in parallel
+ * reads each ES unit exactly once.
+ */
+static int test_split_by_GOP(void)
+{
+    char filename[] = "/tmp/es_test_XXXXXX";
+    ES_unit_list_p direct = nullptr;
+    ES_partition_p partition = nullptr;
+    struct part_counts counts;
+    ES_p es = nullptr;
+    int total = 0;
+    int result = 1;
+
+    int fd = mkstemp(filename);
+    if (fd == -1) {
+        printf("Test failed - creating temporary file\n");
+        return 1;
+    }
+    // A sequence header every 50 ES units, and "slices" in between,
+    // making several GOP_MIN_PART_SIZE worth of data
+    srand(2);
+    for (int ii = 0; ii < TEST_NUM_UNITS * 4; ii++) {
+        byte data[4 + 3000];
+        int len = 4 + rand() % 3000;
+        data[0] = data[1] = 0x00;
+        data[2] = 0x01;
+        data[3] = (ii % 50 == 0 ? 0xB3 : 0x01);
+        for (int jj = 4; jj < len; jj++)
+            data[jj] = (byte)(1 + rand() % 255);
+        if (write(fd, data, len) != len) {
+            printf("Test failed - writing temporary file\n");
+            close(fd);
+            goto finish;
+        }
+    }
+    close(fd);
+
+    if (build_ES_unit_list(&direct) || open_elementary_stream(filename, &es))
+        goto finish;
+    if (split_ES_file_by_GOP(es, VIDEO_H262, TEST_NUM_PARTS, &partition)) {
+        printf("Test failed - splitting file into GOPs\n");
+        goto finish;
+    }
+    if (partition->num_parts < 2 || partition->num_parts > TEST_NUM_PARTS) {
+        printf("Test failed - split file into %d parts\n", partition->num_parts);
+        goto finish;
+    }
+    // And we should still be able to read the whole file from the start
+    if (read_units(es, 0, direct) || direct->length != TEST_NUM_UNITS * 4) {
+        printf("Test failed - reading ES units after splitting\n");
+        goto finish;
+    }
+    for (int ii = 0; ii < partition->num_parts; ii++) {
+        int jj;
+        for (jj = 0; jj < direct->length; jj++)
+            if (direct->array[jj].start_posn.infile == partition->parts[ii].start)
+                break;
+        if (jj == direct->length || direct->array[jj].start_code != 0xB3) {
+            printf("Test failed - part %d does not start at a sequence header\n", ii);
+            goto finish;
+        }
+        if (ii > 0 && partition->parts[ii - 1].end != direct->array[jj + 1].start_posn.infile) {
+            printf("Test failed - part %d does not end after the next sequence header\n", ii - 1);
+            goto finish;
+        }
+    }
+
+    counts.partition = partition;
+    memset(counts.counts, 0, sizeof(counts.counts));
+    if (analyse_ES_parts(filename, partition, 3, count_units_in_part, &counts)) {
+        printf("Test failed - reading parts in parallel\n");
+        goto finish;
+    }
+    for (int ii = 0; ii < partition->num_parts; ii++)
+        total += counts.counts[ii];
+    if (total != direct->length) {
+        printf("Test failed - read %d ES units in parts, expected %d\n", total, direct->length);
+        goto finish;
+    }
+    result = 0;
+
+finish:
+    if (es != nullptr)
+        close_elementary_stream(&es);
+    if (direct != nullptr)
+        free_ES_unit_list(&direct);
+    free_ES_partition(&partition);
+    (void)unlink(filename);
+    return result;
+}
+
+/*
+ * Fill in `unit` as a made-up ES unit, whose length and content depend on
+ * `index`.
+ */
+static void make_test_unit(ES_unit_p unit, int index)
+{
+    unit->data_len = 4 + (index * 37) % (ES_UNIT_DATA_START_SIZE - 4);
+    unit->data[0] = 0x00;
+    unit->data[1] = 0x00;
+    unit->data[2] = 0x01;
+    unit->start_code = (byte)index;
+    memset(unit->data + 3, (byte)index, unit->data_len - 3);
+}
+
+/*
+ * Check that a contiguous ES unit list keeps its units' data one after
+ * another in its own buffer, including after that buffer has had to grow.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_contiguous_list(void)
+{
+    ES_unit_list_p list = nullptr;
+    ES_unit_p unit = nullptr;
+    byte* data;
+    uint32_t data_len, offset;
+    int result = 1;
+
+    if (build_contiguous_ES_unit_list(&list) || build_ES_unit(&unit)) {
+        printf("Test failed - constructing list and unit\n");
+        goto free;
+    }
+    // Twice, to check that a reset list can be reused
+    for (int pass = 0; pass < 2; pass++) {
+        for (int ii = 0; ii < TEST_NUM_UNITS; ii++) {
+            make_test_unit(unit, ii);
+            if (append_to_ES_unit_list(list, unit)) {
+                printf("Test failed - appending ES unit %d\n", ii);
+                goto free;
+            }
+        }
+        if (list->data_size <= ES_UNIT_LIST_DATA_START_SIZE) {
+            printf("Test failed - list data never needed to grow\n");
+            goto free;
+        }
+        if (get_ES_unit_list_data(list, &data, &data_len)) {
+            printf("Test failed - getting list data\n");
+            goto free;
+        }
+        offset = 0;
+        for (int ii = 0; ii < TEST_NUM_UNITS; ii++) {
+            ES_unit_p item = &list->array[ii];
+            make_test_unit(unit, ii);
+            if (item->data != data + offset || item->data_size != 0) {
+                printf("Test failed - ES unit %d is not at offset %u in the list data\n", ii,
+                    offset);
+                goto free;
+            }
+            if (item->data_len != unit->data_len || item->start_code != unit->start_code
+                || memcmp(item->data, unit->data, unit->data_len)) {
+                printf("Test failed - ES unit %d does not match what was appended\n", ii);
+                goto free;
+            }
+            offset += item->data_len;
+        }
+        if (data_len != offset) {
+            printf("Test failed - list data is %u bytes, expected %u\n", data_len, offset);
+            goto free;
+        }
+        reset_ES_unit_list(list);
+        if (list->length != 0 || list->data_len != 0) {
+            printf("Test failed - reset list has length %d, data length %u\n", list->length,
+                list->data_len);
+            goto free;
+        }
+    }
+    result = 0;
+
+free:
+    free_ES_unit(&unit);
+    free_ES_unit_list(&list);
+    return result;
+}
+
 int main(int argc, char** argv)
 {
     int err, ii;
@@ -116,5 +456,23 @@ int main(int argc, char** argv)
     free_ES_unit_list(&list);
     free_ES_unit(&unit);
     printf("Test 2 succeeded\n");
+
+    printf("Test 3 - reading ES units in a separate thread\n");
+    err = test_pipelining();
+    if (err)
+        return 1;
+    printf("Test 3 succeeded\n");
+
+    printf("Test 4 - splitting ES files by GOP\n");
+    err = test_split_by_GOP();
+    if (err)
+        return 1;
+    printf("Test 4 succeeded\n");
+
+    printf("Test 5 - keeping ES units in a contiguous list\n");
+    err = test_contiguous_list();
+    if (err)
+        return 1;
+    printf("Test 5 succeeded\n");
     return 0;
 }
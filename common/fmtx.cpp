@@ -11,45 +11,77 @@
 #include "compat.h"
 #include "fmtx.h"
 
-static TCHAR fmtx_buffers[FMTX_BUFFERS_COUNT][FMTX_BUFFER_SIZE];
-static int fmtx_buf_no = 0;
+int frac_27MHz(int64_t n) { return (int)((n < 0 ? -n : n) % 300LL); }
 
-TCHAR* fmtx_alloc()
+/*
+ * Write the decimal digits of `value` to `p`, padded with leading zeroes
+ * to at least `min_digits`, and return a pointer to just after them.
+ */
+static TCHAR* fmtx_put_uint(TCHAR* p, uint64_t value, int min_digits)
 {
-    const int n = fmtx_buf_no++ % FMTX_BUFFERS_COUNT;
-    return fmtx_buffers[n];
+    TCHAR digits[20];
+    int len = 0;
+    do {
+        digits[len++] = (TCHAR)(_T('0') + value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (len < min_digits)
+        digits[len++] = _T('0');
+    while (len > 0)
+        *p++ = digits[--len];
+    return p;
 }
 
-int frac_27MHz(int64_t n) { return (int)((n < 0 ? -n : n) % 300LL); }
+static TCHAR* fmtx_put_int(TCHAR* p, int64_t value)
+{
+    if (value < 0) {
+        *p++ = _T('-');
+        return fmtx_put_uint(p, -(uint64_t)value, 1);
+    }
+    return fmtx_put_uint(p, (uint64_t)value, 1);
+}
+
+static TCHAR* fmtx_put_str(TCHAR* p, const TCHAR* str)
+{
+    while (*str != _T('\0'))
+        *p++ = *str++;
+    return p;
+}
 
-const TCHAR* fmtx_timestamp(int64_t n, unsigned int flags)
+const TCHAR* fmtx_timestamp_r(TCHAR* buf, size_t buf_size, int64_t n, unsigned int flags)
 {
-    TCHAR* buf = fmtx_alloc();
+    // Big enough for any of our formats, whatever the value
+    TCHAR tmp[FMTX_TIMESTAMP_MAX];
+    TCHAR* p = tmp;
     int64_t n27 = n * ((flags & FMTX_TS_N_27MHz) != 0 ? 1LL : 300LL);
 
     switch (flags & FMTX_TS_DISPLAY_MASK) {
     default:
     case FMTX_TS_DISPLAY_90kHz_RAW:
-        _sntprintf(buf, FMTX_BUFFER_SIZE, _T("%") I64FMT _T("dt"), n27 / 300LL);
+        p = fmtx_put_int(p, n27 / 300LL);
+        *p++ = _T('t');
         break;
 
     case FMTX_TS_DISPLAY_27MHz_RAW:
-        _sntprintf(
-            buf, FMTX_BUFFER_SIZE, _T("%") I64FMT _T("d:%03dt"), n27 / 300LL, frac_27MHz(n27));
+        p = fmtx_put_int(p, n27 / 300LL);
+        *p++ = _T(':');
+        p = fmtx_put_uint(p, (uint64_t)frac_27MHz(n27), 3);
+        *p++ = _T('t');
         break;
 
     case FMTX_TS_DISPLAY_90kHz_32BIT: {
         int64_t n90 = n27 / 300LL;
-        TCHAR* p = buf;
         if (n90 < 0)
             *p++ = _T('-');
-        _sntprintf(p, FMTX_BUFFER_SIZE, _T("%ut"), (unsigned int)(n90 < 0 ? -n90 : n90));
+        p = fmtx_put_uint(p, (unsigned int)(n90 < 0 ? -n90 : n90), 1);
+        *p++ = _T('t');
         break;
     }
 
     case FMTX_TS_DISPLAY_ms:
         // No timestamp when converted into ms should exceed 32bits
-        _sntprintf(buf, FMTX_BUFFER_SIZE, _T("%dms"), (int)(n27 / 27000LL));
+        p = fmtx_put_int(p, (int)(n27 / 27000LL));
+        p = fmtx_put_str(p, _T("ms"));
         break;
 
     case FMTX_TS_DISPLAY_HMS: {
@@ -62,11 +94,26 @@ const TCHAR* fmtx_timestamp(int64_t n, unsigned int flags)
         a27 /= I64K(60);
         m = (unsigned int)(a27 % I64K(60));
         h = (unsigned int)(a27 / I64K(60));
-        _sntprintf(buf, FMTX_BUFFER_SIZE, _T("%s%u:%02u:%02u.%04u"), n27 < 0 ? _T("-") : _T(""), h,
-            m, s, f / 1000);
+        if (n27 < 0)
+            *p++ = _T('-');
+        p = fmtx_put_uint(p, h, 1);
+        *p++ = _T(':');
+        p = fmtx_put_uint(p, m, 2);
+        *p++ = _T(':');
+        p = fmtx_put_uint(p, s, 2);
+        *p++ = _T('.');
+        p = fmtx_put_uint(p, f / 1000, 4);
         break;
     }
     }
+
+    if (buf_size == 0)
+        return buf;
+    size_t len = (size_t)(p - tmp);
+    if (len >= buf_size)
+        len = buf_size - 1;
+    memcpy(buf, tmp, len * sizeof(TCHAR));
+    buf[len] = _T('\0');
     return (const TCHAR*)buf;
 }
 
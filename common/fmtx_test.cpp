@@ -0,0 +1,132 @@
+/*
+ * Test the timestamp formatting from fmtx.c
+ *
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "compat.h"
+#include "fmtx.h"
+
+static const unsigned int display_modes[] = { FMTX_TS_DISPLAY_90kHz_RAW,
+    FMTX_TS_DISPLAY_90kHz_32BIT, FMTX_TS_DISPLAY_27MHz_RAW, FMTX_TS_DISPLAY_ms,
+    FMTX_TS_DISPLAY_HMS };
+
+/*
+ * What the formatting used to look like, when done with snprintf
+ */
+static void expected_timestamp(char* buf, size_t buf_size, int64_t n, unsigned int flags)
+{
+    int64_t n27 = n * ((flags & FMTX_TS_N_27MHz) != 0 ? 1LL : 300LL);
+    int frac = (int)((n27 < 0 ? -n27 : n27) % 300LL);
+
+    switch (flags & FMTX_TS_DISPLAY_MASK) {
+    default:
+    case FMTX_TS_DISPLAY_90kHz_RAW:
+        snprintf(buf, buf_size, "%" PRId64 "t", n27 / 300);
+        break;
+    case FMTX_TS_DISPLAY_27MHz_RAW:
+        snprintf(buf, buf_size, "%" PRId64 ":%03dt", n27 / 300, frac);
+        break;
+    case FMTX_TS_DISPLAY_90kHz_32BIT: {
+        int64_t n90 = n27 / 300LL;
+        snprintf(buf, buf_size, "%s%ut", n90 < 0 ? "-" : "",
+            (unsigned int)(n90 < 0 ? -n90 : n90));
+        break;
+    }
+    case FMTX_TS_DISPLAY_ms:
+        snprintf(buf, buf_size, "%dms", (int)(n27 / 27000LL));
+        break;
+    case FMTX_TS_DISPLAY_HMS: {
+        int64_t a27 = (n27 < 0 ? -n27 : n27) / 27;
+        unsigned int f = (unsigned int)(a27 % 1000000);
+        a27 /= 1000000;
+        unsigned int s = (unsigned int)(a27 % 60);
+        a27 /= 60;
+        snprintf(buf, buf_size, "%s%u:%02u:%02u.%04u", n27 < 0 ? "-" : "",
+            (unsigned int)(a27 / 60), (unsigned int)(a27 % 60), s, f / 1000);
+        break;
+    }
+    }
+}
+
+static int check_value(int64_t n)
+{
+    char expected[100];
+    char actual[FMTX_TIMESTAMP_MAX];
+
+    for (unsigned int mode : display_modes) {
+        for (unsigned int units : { FMTX_TS_N_90kHz, FMTX_TS_N_27MHz }) {
+            unsigned int flags = mode | units;
+            expected_timestamp(expected, sizeof(expected), n, flags);
+            fmtx_timestamp_r(actual, sizeof(actual), n, flags);
+            if (strcmp(expected, actual)) {
+                printf("Test failed - %" PRId64 " with flags %#x gave '%s', expected '%s'\n", n,
+                    flags, actual, expected);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    static const int64_t interesting[] = { 0, 1, -1, 299, 300, -299, -300, 90000, -90000,
+        (1LL << 32) - 1, 1LL << 32, (1LL << 33) - 1, 1LL << 33, -(1LL << 33),
+        (1LL << 33) * 300 - 1, 26LL * 3600 * 90000, 1000000LL * 3600 * 90000 };
+    char buf[8];
+
+    printf("Testing timestamp formatting\n");
+    for (int64_t n : interesting) {
+        if (check_value(n) || check_value(-n))
+            return 1;
+    }
+
+    // And a spread of values, small and large
+    int64_t n = 1;
+    for (int ii = 0; ii < 100000; ii++) {
+        if (check_value(n) || check_value(-n))
+            return 1;
+        n = (n * 7 + 12345) % (1LL << 50);
+    }
+
+    printf("Testing truncation\n");
+    fmtx_timestamp_r(buf, sizeof(buf), 123456789, FMTX_TS_DISPLAY_90kHz_RAW);
+    if (strcmp(buf, "1234567")) {
+        printf("Test failed - truncated to '%s', expected '1234567'\n", buf);
+        return 1;
+    }
+
+    printf("Testing formatting in several threads at once\n");
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for (int tt = 0; tt < 4; tt++) {
+        threads.emplace_back([tt, &failures] {
+            int64_t value = tt + 1;
+            for (int ii = 0; ii < 20000; ii++) {
+                if (check_value(value))
+                    failures++;
+                value = (value * 11 + tt) % (1LL << 40);
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    if (failures != 0)
+        return 1;
+
+    printf("Tests passed\n");
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -7,6 +7,7 @@
 #include <cstdio>
 #include <cstdlib>
 
+#include "ethernet.h"
 #include "ipv4.h"
 #include "misc_fns.h"
 
@@ -80,4 +81,90 @@ int ipv4_udp_from_payload(const uint8_t* data, const uint32_t len, ipv4_udp_head
     return 0;
 }
 
+void ipv4_flow_filter_compile(
+    ipv4_flow_filter_t* filter, const uint32_t dest_addr, const uint32_t dest_port)
+{
+    ipv4_flow_test_t* t = filter->tests;
+
+    // Protocol must be UDP
+    *t++ = ipv4_flow_test_t { IPV4_FLOW_BASE_IP, 1, 9, 0xff, 17 };
+
+    if (dest_addr != 0)
+        *t++ = ipv4_flow_test_t { IPV4_FLOW_BASE_IP, 4, 16, 0xffffffff, dest_addr };
+
+    if (dest_port != 0)
+        *t++ = ipv4_flow_test_t { IPV4_FLOW_BASE_UDP, 2, 2, 0xffff, dest_port & 0xffff };
+
+    filter->num_tests = (int)(t - filter->tests);
+}
+
+int ipv4_flow_filter_rejects(
+    const ipv4_flow_filter_t* filter, const uint8_t* frame, const uint32_t len)
+{
+    uint32_t ip_st = 14;
+    uint32_t udp_st;
+    uint16_t typeorlen;
+    int is_fragment;
+    int vlans = 0;
+    int ii;
+
+    if (len < 14)
+        return false;
+
+    // Skip VLAN tags as ethernet_packet_from_pcap() would - anything it
+    // would refuse, or that is not IPv4, can never match
+    typeorlen = uint_16_be(&frame[12]);
+    while (typeorlen == 0x8100) {
+        if (vlans++ >= ETHERNET_VLANS_MAX || ip_st + 4 > len)
+            return true;
+        typeorlen = uint_16_be(&frame[ip_st + 2]);
+        ip_st += 4;
+    }
+    if (typeorlen != 0x800)
+        return true;
+
+    if (ip_st + 20 > len)
+        return true; // ipv4_from_payload() would refuse it
+
+    if ((frame[ip_st] & 0xf) < 5)
+        return false;
+
+    udp_st = ip_st + ((frame[ip_st] & 0xf) << 2);
+    // Either more fragments to come, or a non-zero fragment offset
+    is_fragment = (uint_16_be(&frame[ip_st + 6]) & 0x3fff) != 0;
+
+    for (ii = 0; ii < filter->num_tests; ++ii) {
+        const ipv4_flow_test_t* const t = &filter->tests[ii];
+        uint32_t st;
+        uint32_t val;
+
+        if (t->base == IPV4_FLOW_BASE_UDP) {
+            if (is_fragment)
+                continue;
+            st = udp_st + t->offset;
+        } else {
+            st = ip_st + t->offset;
+        }
+
+        if (st + t->size > len)
+            return false;
+
+        switch (t->size) {
+        case 1:
+            val = frame[st];
+            break;
+        case 2:
+            val = uint_16_be(&frame[st]);
+            break;
+        default:
+            val = uint_32_be(&frame[st]);
+            break;
+        }
+
+        if ((val & t->mask) != t->value)
+            return true;
+    }
+    return false;
+}
+
 /* End file */
@@ -0,0 +1,252 @@
+/*
+ * A simple test for the IPv4 flow filter, from ipv4.h
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "accessunit.h"
+#include "bitdata.h"
+#include "blockcache.h"
+#include "compat.h"
+#include "compressed.h"
+#include "es.h"
+#include "ethernet.h"
+#include "gop.h"
+#include "h222.h"
+#include "h262.h"
+#include "ipv4.h"
+#include "misc.h"
+#include "nalunit.h"
+#include "pes.h"
+#include "pidint.h"
+#include "printing.h"
+#include "probe.h"
+#include "ps.h"
+#include "reverse.h"
+#include "shmring.h"
+#include "ts.h"
+#include "tswrite.h"
+
+#define TEST_DEST_ADDR 0xEF010203 // 239.1.2.3
+#define TEST_DEST_PORT 1234
+
+#define TEST_FRAME_MAX 128
+
+/*
+ * Describes a test frame: ethernet (with `num_vlans` VLAN tags, and then
+ * `ethertype`), IPv4 (with `ihl` words of header, carrying `proto`, and
+ * with the fragment field `frag`), and then a UDP header.
+ */
+struct test_frame {
+    int num_vlans;
+    uint16_t ethertype;
+    int ihl;
+    byte proto;
+    uint16_t frag;
+    uint32_t dest_addr;
+    uint16_t dest_port;
+};
+
+/*
+ * Build the frame described by `desc` into `frame`.
+ *
+ * Returns the length of the frame.
+ */
+static uint32_t make_test_frame(const struct test_frame* desc, byte frame[TEST_FRAME_MAX])
+{
+    uint32_t posn = 12;
+    byte* ip;
+    byte* udp;
+
+    memset(frame, 0, TEST_FRAME_MAX);
+    memset(frame, 0x11, 6); // destination MAC
+    memset(frame + 6, 0x22, 6); // source MAC
+    for (int ii = 0; ii < desc->num_vlans; ii++) {
+        frame[posn] = 0x81;
+        frame[posn + 1] = 0x00;
+        frame[posn + 3] = 10 + ii; // VLAN id
+        posn += 4;
+    }
+    frame[posn++] = desc->ethertype >> 8;
+    frame[posn++] = desc->ethertype & 0xFF;
+
+    ip = frame + posn;
+    ip[0] = 0x40 | desc->ihl;
+    ip[2] = 0;
+    ip[3] = 48;
+    ip[6] = desc->frag >> 8;
+    ip[7] = desc->frag & 0xFF;
+    ip[8] = 64;
+    ip[9] = desc->proto;
+    ip[12] = 10;
+    ip[15] = 1;
+    ip[16] = (desc->dest_addr >> 24) & 0xFF;
+    ip[17] = (desc->dest_addr >> 16) & 0xFF;
+    ip[18] = (desc->dest_addr >> 8) & 0xFF;
+    ip[19] = desc->dest_addr & 0xFF;
+    posn += (desc->ihl < 5 ? 5 : desc->ihl) * 4;
+
+    udp = frame + posn;
+    udp[0] = 0x04;
+    udp[1] = 0x00;
+    udp[2] = desc->dest_port >> 8;
+    udp[3] = desc->dest_port & 0xFF;
+    udp[5] = 28;
+    posn += 28;
+    return posn;
+}
+
+/*
+ * Check that the filter for `dest_addr`:`dest_port` says the (first `len`
+ * bytes of the) frame described by `desc` can be dropped if `rejects`, and
+ * that it must be kept otherwise.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int check_frame(const char* what, uint32_t dest_addr, uint32_t dest_port,
+    const struct test_frame* desc, int len, int rejects)
+{
+    ipv4_flow_filter_t filter;
+    byte frame[TEST_FRAME_MAX];
+    uint32_t frame_len = make_test_frame(desc, frame);
+
+    if (len >= 0 && (uint32_t)len < frame_len)
+        frame_len = len;
+    ipv4_flow_filter_compile(&filter, dest_addr, dest_port);
+    if (ipv4_flow_filter_rejects(&filter, frame, frame_len) != rejects) {
+        printf("Test failed - %s was %s\n", what, (rejects ? "kept" : "dropped"));
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Frames that are (or might be) part of the flow are kept.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_keep(void)
+{
+    struct test_frame desc = { 0, 0x800, 5, 17, 0, TEST_DEST_ADDR, TEST_DEST_PORT };
+    int err = 0;
+
+    err |= check_frame("matching frame", TEST_DEST_ADDR, TEST_DEST_PORT, &desc, -1, false);
+    err |= check_frame("frame with any address", 0, TEST_DEST_PORT, &desc, -1, false);
+    err |= check_frame("frame with any port", TEST_DEST_ADDR, 0, &desc, -1, false);
+    err |= check_frame("frame with any address or port", 0, 0, &desc, -1, false);
+
+    desc.ihl = 6;
+    err |= check_frame("frame with IP options", TEST_DEST_ADDR, TEST_DEST_PORT, &desc, -1, false);
+    desc.ihl = 4;
+    err |= check_frame("frame with a bad IP header length", TEST_DEST_ADDR, TEST_DEST_PORT, &desc,
+        -1, false);
+    desc.ihl = 5;
+
+    // A later fragment has no UDP header, so we cannot tell its port
+    desc.frag = 0x0010;
+    desc.dest_port = TEST_DEST_PORT + 1;
+    err |= check_frame("later fragment", TEST_DEST_ADDR, TEST_DEST_PORT, &desc, -1, false);
+    desc.frag = 0x2000;
+    err |= check_frame("first fragment", TEST_DEST_ADDR, TEST_DEST_PORT, &desc, -1, false);
+    desc.frag = 0;
+
+    // Too short to tell, so leave it for the decoder to report
+    err |= check_frame("frame without a UDP header", TEST_DEST_ADDR, TEST_DEST_PORT, &desc,
+        14 + 20, false);
+    err |= check_frame("frame without an ethertype", TEST_DEST_ADDR, TEST_DEST_PORT, &desc, 13,
+        false);
+    return err;
+}
+
+/*
+ * Frames that cannot be part of the flow are dropped.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_drop(void)
+{
+    struct test_frame desc = { 0, 0x800, 5, 17, 0, TEST_DEST_ADDR, TEST_DEST_PORT };
+    int err = 0;
+
+    err |= check_frame("frame to another port", TEST_DEST_ADDR, TEST_DEST_PORT + 1, &desc, -1,
+        true);
+    err |= check_frame("frame to another address", TEST_DEST_ADDR + 1, TEST_DEST_PORT, &desc, -1,
+        true);
+    desc.proto = 6;
+    err |= check_frame("TCP frame", TEST_DEST_ADDR, TEST_DEST_PORT, &desc, -1, true);
+    err |= check_frame("TCP frame to any address or port", 0, 0, &desc, -1, true);
+    desc.proto = 17;
+
+    // But a fragment still has its IP header to go by
+    desc.frag = 0x0010;
+    err |= check_frame("fragment to another address", TEST_DEST_ADDR + 1, TEST_DEST_PORT, &desc,
+        -1, true);
+    desc.frag = 0;
+
+    err |= check_frame("frame with a short IP header", TEST_DEST_ADDR, TEST_DEST_PORT, &desc,
+        14 + 19, true);
+    return err;
+}
+
+/*
+ * VLAN tags are skipped, as ethernet_packet_from_pcap() does, and anything
+ * that is not IPv4 is dropped.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_vlan_and_ethertype(void)
+{
+    struct test_frame desc = { 1, 0x800, 5, 17, 0, TEST_DEST_ADDR, TEST_DEST_PORT };
+    int err = 0;
+
+    err |= check_frame("VLAN tagged frame", TEST_DEST_ADDR, TEST_DEST_PORT, &desc, -1, false);
+    err |= check_frame("VLAN tagged frame to another port", TEST_DEST_ADDR, TEST_DEST_PORT + 1,
+        &desc, -1, true);
+    desc.num_vlans = ETHERNET_VLANS_MAX;
+    err |= check_frame("frame with most VLAN tags", TEST_DEST_ADDR, TEST_DEST_PORT, &desc, -1,
+        false);
+    desc.num_vlans = ETHERNET_VLANS_MAX + 1;
+    err |= check_frame("frame with too many VLAN tags", TEST_DEST_ADDR, TEST_DEST_PORT, &desc, -1,
+        true);
+    desc.num_vlans = 1;
+    err |= check_frame("frame with a truncated VLAN tag", TEST_DEST_ADDR, TEST_DEST_PORT, &desc,
+        15, true);
+
+    desc.ethertype = 0x86DD;
+    err |= check_frame("VLAN tagged IPv6 frame", 0, 0, &desc, -1, true);
+    desc.num_vlans = 0;
+    err |= check_frame("IPv6 frame", 0, 0, &desc, -1, true);
+    desc.ethertype = 0x806;
+    err |= check_frame("ARP frame", 0, 0, &desc, -1, true);
+    return err;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test 1 - keeping frames that may be in the flow\n");
+    if (test_keep())
+        return 1;
+    printf("Test 1 succeeded\n");
+
+    printf("Test 2 - dropping frames that are not in the flow\n");
+    if (test_drop())
+        return 1;
+    printf("Test 2 succeeded\n");
+
+    printf("Test 3 - VLAN tags and other ethertypes\n");
+    if (test_vlan_and_ethertype())
+        return 1;
+    printf("Test 3 succeeded\n");
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
@@ -13,8 +13,11 @@
 
 #include "accessunit.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "misc.h"
@@ -22,12 +25,159 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
 
+#define TEST_NUM_NALS 200
+
+/*
+ * Build a made-up NAL unit, whose length and content depend on `index`.
+ *
+ * Returns 0 if it succeeds, 1 if some error occurs.
+ */
+static int make_test_nal(nal_unit_p* nal, int index)
+{
+    if (build_nal_unit(nal))
+        return 1;
+    (*nal)->unit.data_len = 4 + (index * 37) % (ES_UNIT_DATA_START_SIZE - 4);
+    (*nal)->unit.data[0] = 0x00;
+    (*nal)->unit.data[1] = 0x00;
+    (*nal)->unit.data[2] = 0x01;
+    memset((*nal)->unit.data + 3, (byte)index, (*nal)->unit.data_len - 3);
+    (*nal)->data = &((*nal)->unit.data[3]);
+    (*nal)->data_len = (*nal)->unit.data_len - 3;
+    return 0;
+}
+
+/*
+ * Check that the NAL units in `access_unit` are indices `first` onwards,
+ * with their data one after another in the access unit's data buffer.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int check_access_unit_layout(access_unit_p access_unit, int first)
+{
+    byte* data;
+    uint32_t data_len, offset = 0;
+
+    if (get_access_unit_data(access_unit, &data, &data_len)) {
+        printf("Test failed - getting access unit data\n");
+        return 1;
+    }
+    for (int ii = 0; ii < access_unit->nal_units->length; ii++) {
+        nal_unit_p nal = access_unit->nal_units->array[ii];
+        int index = first + ii;
+        if (nal->unit.data != data + offset || nal->unit.data_size != 0
+            || nal->data != nal->unit.data + 3) {
+            printf("Test failed - NAL unit %d is not at offset %u in the access unit data\n",
+                index, offset);
+            return 1;
+        }
+        if (nal->unit.data_len != (uint32_t)(4 + (index * 37) % (ES_UNIT_DATA_START_SIZE - 4))
+            || nal->data[0] != (byte)index || nal->unit.data[nal->unit.data_len - 1] != (byte)index) {
+            printf("Test failed - NAL unit %d does not match what was added\n", index);
+            return 1;
+        }
+        offset += nal->unit.data_len;
+    }
+    if (data_len != offset) {
+        printf("Test failed - access unit data is %u bytes, expected %u\n", data_len, offset);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Check that an access unit keeps the data of its NAL units in its own
+ * contiguous buffer, both as NAL units are added (from the pending list,
+ * or directly) and when a second access unit is merged into it.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_access_unit_data(void)
+{
+    access_unit_p access_unit = nullptr;
+    access_unit_p second = nullptr;
+    nal_unit_list_p pending = nullptr;
+    nal_unit_p nal = nullptr;
+    int result = 1;
+    int ii;
+
+    if (build_access_unit(&access_unit, 0) || build_access_unit(&second, 1)
+        || build_nal_unit_list(&pending)) {
+        printf("Test failed - constructing access units\n");
+        goto free;
+    }
+
+    // Some NAL units "pending", and then one to go with them
+    for (ii = 0; ii < 3; ii++) {
+        if (make_test_nal(&nal, ii) || append_to_nal_unit_list(pending, nal)) {
+            printf("Test failed - making pending NAL unit %d\n", ii);
+            free_nal_unit(&nal);
+            goto free;
+        }
+        nal = nullptr;
+    }
+    if (make_test_nal(&nal, ii) || access_unit_append(access_unit, nal, false, pending)) {
+        printf("Test failed - appending NAL unit %d\n", ii);
+        free_nal_unit(&nal);
+        goto free;
+    }
+    reset_nal_unit_list(pending, false); // they now belong to the access unit
+    nal = nullptr;
+
+    // And enough more that the data buffer has to grow
+    for (ii++; ii < TEST_NUM_NALS; ii++) {
+        if (make_test_nal(&nal, ii) || access_unit_append(access_unit, nal, false, nullptr)) {
+            printf("Test failed - appending NAL unit %d\n", ii);
+            free_nal_unit(&nal);
+            goto free;
+        }
+        nal = nullptr;
+    }
+    if (access_unit->data_size <= ACCESS_UNIT_DATA_START_SIZE) {
+        printf("Test failed - access unit data never needed to grow\n");
+        goto free;
+    }
+    if (check_access_unit_layout(access_unit, 0))
+        goto free;
+
+    // A second access unit, to be merged into the first
+    for (; ii < 2 * TEST_NUM_NALS; ii++) {
+        if (make_test_nal(&nal, ii) || access_unit_append(second, nal, false, nullptr)) {
+            printf("Test failed - appending NAL unit %d\n", ii);
+            free_nal_unit(&nal);
+            goto free;
+        }
+        nal = nullptr;
+    }
+    if (check_access_unit_layout(second, TEST_NUM_NALS))
+        goto free;
+    if (merge_access_unit_nals(access_unit, &second)) {
+        printf("Test failed - merging access units\n");
+        goto free;
+    }
+    if (access_unit->nal_units->length != 2 * TEST_NUM_NALS) {
+        printf("Test failed - merged access unit has %d NAL units\n",
+            access_unit->nal_units->length);
+        goto free;
+    }
+    if (check_access_unit_layout(access_unit, 0))
+        goto free;
+    result = 0;
+
+free:
+    free_nal_unit_list(&pending, true);
+    free_access_unit(&second);
+    free_access_unit(&access_unit);
+    return result;
+}
+
 int main(int argc, char** argv)
 {
     int err, ii;
@@ -132,5 +282,10 @@ int main(int argc, char** argv)
     free_nal_unit_list(&list, false); // better only do a shallow free
     free_nal_unit(&unit);
     printf("Test 2 succeeded\n");
+
+    printf("Test 3 - the NAL units of an access unit\n");
+    if (test_access_unit_data())
+        return 1;
+    printf("Test 3 succeeded\n");
     return 0;
 }
@@ -0,0 +1,217 @@
+/*
+ * Test the TS packet, adaptation field and PES header views, and that the
+ * older functions built on them still agree with them
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "accessunit.h"
+#include "bitdata.h"
+#include "blockcache.h"
+#include "compat.h"
+#include "compressed.h"
+#include "dvbsi.h"
+#include "es.h"
+#include "gop.h"
+#include "h222.h"
+#include "h262.h"
+#include "misc.h"
+#include "nalunit.h"
+#include "packet_view_defns.h"
+#include "pes.h"
+#include "pidint.h"
+#include "printing.h"
+#include "probe.h"
+#include "ps.h"
+#include "reverse.h"
+#include "section.h"
+#include "shmring.h"
+#include "ts.h"
+#include "tswrite.h"
+
+// A TS packet on PID 0x101 with a PCR (of 302), starting a PES packet
+constexpr uint8_t ts_packet[TS_PACKET_SIZE] = { 0x47, 0x41, 0x01, 0x37, 7, 0x50, 0, 0, 0, 0,
+    0xFE, 0x02, 0x00, 0x00, 0x01, 0xE0 };
+
+// The start of an H.222.0 PES packet, with a PTS (of 1) and nothing else
+constexpr uint8_t h222_pes[] = { 0x00, 0x00, 0x01, 0xE0, 0x00, 0x00, 0x80, 0x80, 0x05, 0x21,
+    0x00, 0x01, 0x00, 0x03, 0xAA };
+
+// An MPEG-1 PES packet, with stuffing, STD buffer size, PTS (2) and DTS (1)
+constexpr uint8_t mpeg1_pes[] = { 0x00, 0x00, 0x01, 0xE0, 0x00, 0x0F, 0xFF, 0xFF, 0x40, 0x00,
+    0x31, 0x00, 0x01, 0x00, 0x05, 0x11, 0x00, 0x01, 0x00, 0x03, 0xAA };
+
+// These are all worked out at compile time
+constexpr TS_packet_view ts_view = { ts_packet };
+static_assert(ts_view.has_sync_byte() && ts_view.is_valid(), "TS packet is valid");
+static_assert(ts_view.pid() == 0x101 && !ts_view.is_null(), "TS packet PID");
+static_assert(ts_view.payload_unit_start() == 1, "TS packet payload unit start");
+static_assert(ts_view.continuity_counter() == 7, "TS packet continuity counter");
+static_assert(ts_view.adaptation_field_control() == 3, "TS packet adaptation field control");
+static_assert(ts_view.payload_offset() == 12 && ts_view.payload_length() == 176,
+    "TS packet payload position");
+static_assert(ts_view.adaptation_field().random_access(), "adaptation field random access");
+static_assert(!ts_view.adaptation_field().discontinuity(), "adaptation field discontinuity");
+static_assert(ts_view.adaptation_field().has_PCR() && !ts_view.adaptation_field().has_OPCR(),
+    "adaptation field PCR flags");
+static_assert(ts_view.adaptation_field().PCR() == 302, "adaptation field PCR value");
+static_assert(!adaptation_field_view { ts_packet + 5, 6 }.is_valid(), "truncated PCR");
+
+constexpr PES_header_view h222_view = { h222_pes, sizeof(h222_pes) };
+static_assert(h222_view.has_start_code() && h222_view.is_H222(), "H.222.0 PES header");
+static_assert(h222_view.has_optional_header(), "H.222.0 video has optional header");
+static_assert(h222_view.has_PTS() && !h222_view.has_DTS(), "H.222.0 PTS only");
+static_assert(h222_view.PTS() == 1 && h222_view.timestamps_valid(), "H.222.0 PTS value");
+static_assert(h222_view.ES_data_offset() == 14, "H.222.0 ES data offset");
+
+constexpr PES_header_view mpeg1_view = { mpeg1_pes, sizeof(mpeg1_pes) };
+static_assert(!mpeg1_view.is_H222(), "MPEG-1 PES header");
+static_assert(mpeg1_view.MPEG1_flags_offset() == 10, "MPEG-1 flags after stuffing and buffer");
+static_assert(mpeg1_view.PTS_DTS_flags() == 3, "MPEG-1 PTS and DTS");
+static_assert(mpeg1_view.PTS() == 2 && mpeg1_view.DTS() == 1, "MPEG-1 PTS/DTS values");
+static_assert(mpeg1_view.timestamps_valid(), "MPEG-1 PTS/DTS guard and marker bits");
+static_assert(mpeg1_view.ES_data_offset() == 20, "MPEG-1 ES data offset");
+static_assert(PES_header_view { mpeg1_pes, 10 }.PTS_DTS_flags() == 0, "MPEG-1 truncated header");
+
+static int test_split()
+{
+    byte packet[TS_PACKET_SIZE];
+    uint32_t pid;
+    int pusi;
+    byte* adapt;
+    int adapt_len;
+    byte* payload;
+    int payload_len;
+
+    printf("Testing split_TS_packet against TS_packet_view\n");
+    for (int control = 1; control < 4; control++) {
+        memcpy(packet, ts_packet, sizeof(packet));
+        packet[3] = (byte)((control << 4) | 0x07);
+        if (control == 2)
+            packet[4] = 183;
+        const TS_packet_view view = { packet };
+        if (split_TS_packet(packet, &pid, &pusi, &adapt, &adapt_len, &payload, &payload_len)) {
+            printf("Test failed - split_TS_packet rejected control %d\n", control);
+            return 1;
+        }
+        if (pid != view.pid() || pusi != view.payload_unit_start()
+            || adapt_len != view.adaptation_field_length()
+            || payload_len != view.payload_length()
+            || (payload != nullptr) != view.has_payload()
+            || (payload && payload - packet != view.payload_offset())) {
+            printf("Test failed - split_TS_packet and view disagree for control %d\n", control);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int test_find_timestamps()
+{
+    byte pes[sizeof(mpeg1_pes)];
+    int got_pts, got_dts;
+    uint64_t pts, dts;
+
+    printf("Testing find_PTS_DTS_in_PES against PES_header_view\n");
+    memcpy(pes, mpeg1_pes, sizeof(pes));
+    if (find_PTS_DTS_in_PES(pes, sizeof(pes), &got_pts, &pts, &got_dts, &dts) || !got_pts
+        || !got_dts || pts != 2 || dts != 1) {
+        printf("Test failed - MPEG-1 PTS/DTS not found\n");
+        return 1;
+    }
+    if (calc_mpeg1_pes_offset(pes, sizeof(pes)) != 20) {
+        printf("Test failed - MPEG-1 ES data offset\n");
+        return 1;
+    }
+
+    // Padding streams have no PTS, however they look
+    pes[3] = 0xBE;
+    if (find_PTS_DTS_in_PES(pes, sizeof(pes), &got_pts, &pts, &got_dts, &dts) || got_pts) {
+        printf("Test failed - found PTS in padding stream\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Make a TS packet that starts a video PES packet (with a PTS), with the
+ * random_access_indicator set if `rai`, and the ES data starting with a
+ * start code with the given `code` (for H.262) or NAL unit header byte
+ * (for H.264), and check TS_packet_starts_random_access says `expected`.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int check_random_access(const char* what, int stream_type, int rai, byte code, int expected)
+{
+    byte packet[TS_PACKET_SIZE];
+    uint32_t pid;
+    int pusi;
+    byte* adapt;
+    int adapt_len;
+    byte* payload;
+    int payload_len;
+    const byte start_code[] = { 0x00, 0x00, 0x01, code };
+
+    memset(packet, 0xFF, sizeof(packet));
+    memcpy(packet, ts_packet, 4);
+    packet[4] = 1;
+    packet[5] = (rai ? 0x40 : 0x00);
+    memcpy(packet + 6, h222_pes, 14);
+    memcpy(packet + 6 + 14, start_code, sizeof(start_code));
+    if (split_TS_packet(packet, &pid, &pusi, &adapt, &adapt_len, &payload, &payload_len) || !pusi) {
+        printf("Test failed - could not split %s\n", what);
+        return 1;
+    }
+    if (TS_packet_starts_random_access(stream_type, adapt, adapt_len, payload, payload_len)
+        != expected) {
+        printf("Test failed - %s %s a random access point\n", what,
+            (expected ? "is not" : "is"));
+        return 1;
+    }
+    return 0;
+}
+
+static int test_random_access()
+{
+    int err = 0;
+
+    printf("Testing TS_packet_starts_random_access\n");
+    err |= check_random_access("H.262 with RAI", MPEG2_VIDEO_STREAM_TYPE, true, 0x00, true);
+    err |= check_random_access("H.264 with RAI", AVC_VIDEO_STREAM_TYPE, true, 0x41, true);
+
+    err |= check_random_access("H.262 sequence header", MPEG2_VIDEO_STREAM_TYPE, false, 0xB3,
+        true);
+    err |= check_random_access("MPEG-1 sequence header", MPEG1_VIDEO_STREAM_TYPE, false, 0xB3,
+        true);
+    err |= check_random_access("H.262 picture without a sequence header",
+        MPEG2_VIDEO_STREAM_TYPE, false, 0x00, false);
+
+    err |= check_random_access("H.264 IDR slice", AVC_VIDEO_STREAM_TYPE, false, 0x65, true);
+    err |= check_random_access("H.264 SPS", AVC_VIDEO_STREAM_TYPE, false, 0x67, true);
+    err |= check_random_access("H.264 non-IDR slice", AVC_VIDEO_STREAM_TYPE, false, 0x41, false);
+
+    // A sequence header means nothing in H.264, nor an IDR slice in H.262
+    err |= check_random_access("H.262 sequence header as H.264", AVC_VIDEO_STREAM_TYPE, false,
+        0xB3, false);
+    err |= check_random_access("H.264 IDR slice as H.262", MPEG2_VIDEO_STREAM_TYPE, false, 0x65,
+        false);
+    return err;
+}
+
+int main(int argc, char** argv)
+{
+    if (test_split() || test_find_timestamps() || test_random_access())
+        return 1;
+    printf("Tests passed\n");
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
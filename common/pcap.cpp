@@ -431,8 +431,6 @@ static int pcap_read_pktheader(PCAP_reader_p ctx, pcaprec_hdr_t* hdr)
 int pcap_open(PCAP_reader_p* ctx_p, pcap_hdr_t* out_hdr, const char* filename)
 {
     FILE* fptr = (filename ? fopen(filename, "rb") : stdin);
-    PCAP_reader_p ctx;
-    int rv;
 
     (*ctx_p) = nullptr;
 
@@ -440,6 +438,16 @@ int pcap_open(PCAP_reader_p* ctx_p, pcap_hdr_t* out_hdr, const char* filename)
         // Couldn't open the file.
         return -1;
     }
+    return pcap_open_file(ctx_p, out_hdr, fptr);
+}
+
+int pcap_open_file(PCAP_reader_p* ctx_p, pcap_hdr_t* out_hdr, FILE* fptr)
+{
+    PCAP_reader_p ctx;
+    int rv;
+
+    (*ctx_p) = nullptr;
+
     ctx = (PCAP_reader_p)calloc(SIZEOF_PCAP_READER, 1);
     if (!ctx) {
         fclose(fptr);
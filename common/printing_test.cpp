@@ -4,6 +4,8 @@
  */
 
 #include <cstdio>
+#include <cstdlib>
+#include <thread>
 
 #include "printing.h"
 #include "version.h"
@@ -23,6 +25,43 @@
 //    (void)vfprintf(stdout, format, arg_ptr);
 //}
 
+// Counting redirection routines, to check what the asynchronous writer
+// passes on
+
+static int counted_lines = 0;
+static int counted_errors = 0;
+static int lines_out_of_order = 0;
+
+static void count_lines(const char* message, int* count)
+{
+    // Each line is expected to be "<n>\n", with n counting up from 0
+    while (*message != '\0') {
+        int value = atoi(message);
+        if (value != *count)
+            lines_out_of_order++;
+        (*count)++;
+        while (*message != '\0' && *message != '\n')
+            message++;
+        if (*message == '\n')
+            message++;
+    }
+}
+static void count_message(const char* message) { count_lines(message, &counted_lines); }
+static void count_error(const char* message) { count_lines(message, &counted_errors); }
+static void fcount_message(const char* format, va_list arg_ptr)
+{
+    char buf[100];
+    (void)vsnprintf(buf, sizeof(buf), format, arg_ptr);
+    count_message(buf);
+}
+static void fcount_error(const char* format, va_list arg_ptr)
+{
+    char buf[100];
+    (void)vsnprintf(buf, sizeof(buf), format, arg_ptr);
+    count_error(buf);
+}
+static void flush_nothing(void) { }
+
 static void print_usage()
 {
     printf("Usage: test_printing\n"
@@ -70,6 +109,80 @@ int main(int argc, char** argv)
     fprint_msg("3. Printing a formatted '%s'\n", "message");
     fprint_err("4. Printing a formatted '%s'\n", "error");
 
+    printf("--------------------------------------------\n");
+    printf("Choosing 'asynchronous' output and repeating\n");
+    printf("--------------------------------------------\n");
+    if (redirect_output_async()) {
+        printf("Oops -- unable to start asynchronous output\n");
+        return 1;
+    }
+    print_msg("1. Printing a normal message\n");
+    print_err("2. Printing an error message\n");
+    fprint_msg("3. Printing a formatted '%s'\n", "message");
+    fprint_err("4. Printing a formatted '%s'\n", "error");
+    flush_msg();
+    stop_async_output();
+
+    printf("--------------------------------------------\n");
+    printf("Checking asynchronous output keeps its order\n");
+    printf("--------------------------------------------\n");
+    if (redirect_output(count_message, count_error, fcount_message, fcount_error, flush_nothing)) {
+        printf("Oops -- unable to choose counting output\n");
+        return 1;
+    }
+    if (redirect_output_async()) {
+        printf("Oops -- unable to start asynchronous output\n");
+        return 1;
+    }
+    const int num_lines = 200000;
+    for (int ii = 0; ii < num_lines; ii++) {
+        fprint_msg("%d\n", ii);
+        if (ii % 1000 == 0)
+            fprint_err("%d\n", ii / 1000);
+    }
+    flush_msg();
+    int lines_after_flush = counted_lines;
+    stop_async_output();
+    redirect_output_stdout();
+    if (lines_after_flush != num_lines || counted_errors != num_lines / 1000
+        || lines_out_of_order != 0) {
+        printf("Test failed - %d of %d lines, %d of %d errors, %d out of order\n",
+            lines_after_flush, num_lines, counted_errors, num_lines / 1000, lines_out_of_order);
+        return 1;
+    }
+    printf("%d lines and %d errors written in order\n", lines_after_flush, counted_errors);
+
+    printf("------------------------------------------------\n");
+    printf("Checking output is captured for one thread only\n");
+    printf("------------------------------------------------\n");
+    struct print_capture capture[2];
+    memset(capture, 0, sizeof(capture));
+    std::thread capturing([&capture] {
+        for (int which = 0; which < 2; which++) {
+            capture_thread_output(&capture[which]);
+            for (int ii = 0; ii < 1000; ii++)
+                fprint_msg("%d\n", ii);
+            print_err("error\n");
+            capture_thread_output(nullptr);
+        }
+    });
+    capturing.join();
+    print_msg("5. This message should not be captured\n");
+    for (int which = 0; which < 2; which++) {
+        counted_lines = 0;
+        lines_out_of_order = 0;
+        count_message(capture[which].text[0]);
+        if (counted_lines != 1000 || lines_out_of_order != 0
+            || strcmp(capture[which].text[1], "error\n")) {
+            printf("Test failed - capture %d has %d of 1000 lines, %d out of order,"
+                   " and errors '%s'\n",
+                which, counted_lines, lines_out_of_order, capture[which].text[1]);
+            return 1;
+        }
+        free_print_capture(&capture[which]);
+    }
+    printf("Output captured in order\n");
+
     // printf("-----------------------------------------\n");
     // printf("Choosing 'custom functions' and repeating\n");
     // printf("-----------------------------------------\n");
@@ -0,0 +1,215 @@
+/*
+ * A simple test for the reverse data arrays, from reverse.h
+ *
+ */
+
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "accessunit.h"
+#include "bitdata.h"
+#include "blockcache.h"
+#include "compat.h"
+#include "compressed.h"
+#include "es.h"
+#include "gop.h"
+#include "h222.h"
+#include "h262.h"
+#include "misc.h"
+#include "nalunit.h"
+#include "pes.h"
+#include "pidint.h"
+#include "printing.h"
+#include "probe.h"
+#include "ps.h"
+#include "reverse.h"
+#include "shmring.h"
+#include "ts.h"
+#include "tswrite.h"
+
+// Enough entries that the arrays have to be extended a few times
+#define TEST_NUM_ENTRIES (3 * REVERSE_ARRAY_INCREMENT_SIZE + 7)
+#define TEST_SEQ_EVERY 10 // H.262 entries between each sequence header
+
+/*
+ * Work out where entry `ii` of the test data starts, and how long it is
+ */
+static void test_entry(int ii, ES_offset* start_posn, uint32_t* length)
+{
+    start_posn->infile = (offset_t)ii * 1000;
+    start_posn->inpacket = ii % 7;
+    *length = 100 + ii;
+}
+
+/*
+ * Check that the first `num_entries` entries in `reverse_data` are those
+ * we remembered.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int check_entries(reverse_data_p reverse_data, int num_entries)
+{
+    if (reverse_data->length != num_entries) {
+        printf("Test failed - %d entries, expected %d\n", reverse_data->length, num_entries);
+        return 1;
+    }
+    for (int ii = 0; ii < num_entries; ii++) {
+        ES_offset want_posn, got_posn;
+        uint32_t want_length, got_length;
+        uint32_t got_index;
+        byte got_seq_offset;
+        byte got_afd;
+        test_entry(ii, &want_posn, &want_length);
+        if (get_reverse_data(reverse_data, ii, &got_index, &got_posn, &got_length,
+                &got_seq_offset, &got_afd)) {
+            printf("Test failed - getting entry %d\n", ii);
+            return 1;
+        }
+        if (got_posn.infile != want_posn.infile || got_posn.inpacket != want_posn.inpacket
+            || got_length != want_length) {
+            printf("Test failed - entry %d is at " OFFSET_T_FORMAT "/%d for %u bytes\n", ii,
+                got_posn.infile, got_posn.inpacket, got_length);
+            return 1;
+        }
+        if (reverse_data->is_h264) {
+            if (got_index != (uint32_t)ii) {
+                printf("Test failed - entry %d has index %u\n", ii, got_index);
+                return 1;
+            }
+        } else {
+            byte want_seq_offset = ii % TEST_SEQ_EVERY;
+            if (got_seq_offset != want_seq_offset
+                || (want_seq_offset != 0 && (got_index != (uint32_t)ii || got_afd != 0xF8))) {
+                printf("Test failed - entry %d has index %u, sequence offset %d, AFD %#x\n", ii,
+                    got_index, got_seq_offset, got_afd);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Remember enough entries that the arrays must grow, and check that
+ * growing them keeps what was already there.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_growth(int is_h264)
+{
+    reverse_data_p reverse_data = nullptr;
+    int result = 1;
+
+    if (build_reverse_data(&reverse_data, is_h264)) {
+        printf("Test failed - building reverse data\n");
+        return 1;
+    }
+    for (int ii = 0; ii < TEST_NUM_ENTRIES; ii++) {
+        ES_offset start_posn;
+        uint32_t length;
+        int err;
+        test_entry(ii, &start_posn, &length);
+        if (is_h264)
+            err = remember_reverse_h264_data(reverse_data, ii, start_posn, length);
+        else
+            err = remember_reverse_h262_data(
+                reverse_data, ii, start_posn, length, ii % TEST_SEQ_EVERY, 0xF8);
+        if (err) {
+            printf("Test failed - remembering entry %d\n", ii);
+            goto tidy;
+        }
+    }
+    if (reverse_data->size < TEST_NUM_ENTRIES) {
+        printf("Test failed - arrays have room for %d entries\n", reverse_data->size);
+        goto tidy;
+    }
+    result = check_entries(reverse_data, TEST_NUM_ENTRIES);
+
+tidy:
+    free_reverse_data(&reverse_data);
+    return result;
+}
+
+/*
+ * Asking for more room than we can have should fail, but leave the
+ * arrays (and their size) as they were.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_failed_growth(int is_h264)
+{
+    reverse_data_p reverse_data = nullptr;
+    int result = 1;
+    int size;
+
+    if (build_reverse_data(&reverse_data, is_h264)) {
+        printf("Test failed - building reverse data\n");
+        return 1;
+    }
+    for (int ii = 0; ii < TEST_SEQ_EVERY + 3; ii++) {
+        ES_offset start_posn;
+        uint32_t length;
+        int err;
+        test_entry(ii, &start_posn, &length);
+        if (is_h264)
+            err = remember_reverse_h264_data(reverse_data, ii, start_posn, length);
+        else
+            err = remember_reverse_h262_data(
+                reverse_data, ii, start_posn, length, ii % TEST_SEQ_EVERY, 0xF8);
+        if (err) {
+            printf("Test failed - remembering entry %d\n", ii);
+            goto tidy;
+        }
+    }
+    size = reverse_data->size;
+    if (ensure_reverse_data_size(reverse_data, INT_MAX) == 0) {
+        // Not something we can count on failing everywhere
+        printf("(this system can allocate the arrays, so this is not tested)\n");
+        result = 0;
+        goto tidy;
+    }
+    if (reverse_data->size != size) {
+        printf("Test failed - arrays claim room for %d entries after failing to grow\n",
+            reverse_data->size);
+        goto tidy;
+    }
+    result = check_entries(reverse_data, TEST_SEQ_EVERY + 3);
+
+tidy:
+    free_reverse_data(&reverse_data);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test 1 - growing the H.262 reverse data arrays\n");
+    if (test_growth(false))
+        return 1;
+    printf("Test 1 succeeded\n");
+
+    printf("Test 2 - growing the H.264 reverse data arrays\n");
+    if (test_growth(true))
+        return 1;
+    printf("Test 2 succeeded\n");
+
+    printf("Test 3 - failing to grow the H.262 reverse data arrays\n");
+    if (test_failed_growth(false))
+        return 1;
+    printf("Test 3 succeeded\n");
+
+    printf("Test 4 - failing to grow the H.264 reverse data arrays\n");
+    if (test_failed_growth(true))
+        return 1;
+    printf("Test 4 succeeded\n");
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
@@ -0,0 +1,254 @@
+/*
+ * Test the PSI/SI section demultiplexer
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "accessunit.h"
+#include "bitdata.h"
+#include "blockcache.h"
+#include "compat.h"
+#include "compressed.h"
+#include "dvbsi.h"
+#include "es.h"
+#include "gop.h"
+#include "h222.h"
+#include "h262.h"
+#include "misc.h"
+#include "nalunit.h"
+#include "pes.h"
+#include "pidint.h"
+#include "printing.h"
+#include "probe.h"
+#include "ps.h"
+#include "reverse.h"
+#include "section.h"
+#include "shmring.h"
+#include "ts.h"
+#include "tswrite.h"
+
+struct seen {
+    int count;
+    int new_versions;
+    int last_len;
+    byte last_table_id;
+};
+
+static int count_section(
+    void* arg, uint32_t /* pid */, byte* section, int section_len, int new_version)
+{
+    struct seen* seen = (struct seen*)arg;
+    seen->count++;
+    if (new_version)
+        seen->new_versions++;
+    seen->last_len = section_len;
+    seen->last_table_id = section[0];
+    return 0;
+}
+
+/*
+ * Make a long section with the given table id, extension and version,
+ * and `body_len` bytes of body, into `data`. Returns its length.
+ */
+static int make_section(byte* data, byte table_id, uint16_t extension, int version, int body_len)
+{
+    int section_length = 5 + body_len + 4;
+    data[0] = table_id;
+    data[1] = 0xB0 | ((section_length >> 8) & 0x0F);
+    data[2] = section_length & 0xFF;
+    data[3] = extension >> 8;
+    data[4] = extension & 0xFF;
+    data[5] = 0xC1 | ((version & 0x1F) << 1);
+    data[6] = 0;
+    data[7] = 0;
+    for (int ii = 0; ii < body_len; ii++)
+        data[8 + ii] = (byte)ii;
+    uint32_t crc = crc32_block(0xffffffff, data, 8 + body_len);
+    data[8 + body_len] = (byte)(crc >> 24);
+    data[9 + body_len] = (byte)(crc >> 16);
+    data[10 + body_len] = (byte)(crc >> 8);
+    data[11 + body_len] = (byte)crc;
+    return 12 + body_len;
+}
+
+/*
+ * Split `data` into TS payloads of 184 bytes (the first starting with a
+ * zero pointer field, the last padded with stuffing) and feed them to the
+ * demultiplexer.
+ */
+static int feed(section_demux_p demux, uint32_t pid, byte* data, int data_len)
+{
+    byte payload[184];
+    int first = true;
+    while (data_len > 0) {
+        int offset = 0;
+        if (first)
+            payload[offset++] = 0;
+        int count = min(184 - offset, data_len);
+        memcpy(payload + offset, data, count);
+        memset(payload + offset + count, 0xFF, 184 - offset - count);
+        if (section_demux_packet(demux, pid, first, payload, 184))
+            return 1;
+        data += count;
+        data_len -= count;
+        first = false;
+    }
+    return 0;
+}
+
+static int test_crc()
+{
+    byte data[1001];
+    uint32_t expected = 0xffffffff;
+    printf("Testing CRC\n");
+    for (int ii = 0; ii < 1001; ii++)
+        data[ii] = (byte)(ii * 7 + 3);
+    // A bit at a time, the slow way
+    for (int ii = 0; ii < 1001; ii++) {
+        expected ^= (uint32_t)data[ii] << 24;
+        for (int jj = 0; jj < 8; jj++)
+            expected = (expected & 0x80000000) ? (expected << 1) ^ CRC32_POLY : expected << 1;
+    }
+    for (int split = 0; split < 8; split++) {
+        uint32_t crc = crc32_block(0xffffffff, data, split);
+        crc = crc32_block(crc, data + split, 1001 - split);
+        if (crc != expected) {
+            printf("Test failed - CRC %08x, expected %08x (split at %d)\n", crc, expected, split);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int test_demux()
+{
+    section_demux_p demux = nullptr;
+    struct seen sdt = {};
+    struct seen eit = {};
+    struct seen eit_5 = {};
+    byte data[2 * MAX_SECTION_SIZE];
+    int len;
+
+    printf("Testing section demultiplexing\n");
+    if (build_section_demux(&demux))
+        return 1;
+    if (add_section_filter(demux, 0x11, 0x42, 0xFB, 0, 0, SECTION_FILTER_NEW_VERSIONS,
+            count_section, &sdt)
+        || add_section_filter(demux, 0x12, 0x50, 0xF0, 0, 0, SECTION_FILTER_ALL_VERSIONS,
+            count_section, &eit)
+        || add_section_filter(demux, 0x12, 0x50, 0xF0, 0x0005, 0xFFFF,
+            SECTION_FILTER_ALL_VERSIONS, count_section, &eit_5))
+        goto failed;
+
+    if (!section_demux_wants_pid(demux, 0x11) || section_demux_wants_pid(demux, 0x13)) {
+        printf("Test failed - wrong PIDs wanted\n");
+        goto failed;
+    }
+
+    // A section spanning several packets, sent twice - the second time is
+    // not a new version, so is not passed on
+    len = make_section(data, 0x46, 1, 3, 700);
+    if (feed(demux, 0x11, data, len) || feed(demux, 0x11, data, len))
+        goto failed;
+    if (sdt.count != 1 || sdt.last_len != len || sdt.last_table_id != 0x46) {
+        printf("Test failed - multi-packet SDT seen %d times, length %d\n", sdt.count,
+            sdt.last_len);
+        goto failed;
+    }
+    // A new version is
+    len = make_section(data, 0x42, 1, 4, 10);
+    if (feed(demux, 0x11, data, len))
+        goto failed;
+    if (sdt.count != 2) {
+        printf("Test failed - SDT version change not seen\n");
+        goto failed;
+    }
+    // A table id that does not match is not
+    len = make_section(data, 0x4A, 1, 0, 10);
+    if (feed(demux, 0x11, data, len))
+        goto failed;
+    if (sdt.count != 2) {
+        printf("Test failed - BAT passed as SDT\n");
+        goto failed;
+    }
+
+    // Several sections in one packet, the last also continuing into the
+    // next, one with an extension the second filter wants
+    len = make_section(data, 0x50, 5, 0, 20);
+    len += make_section(data + len, 0x51, 6, 0, 20);
+    len += make_section(data + len, 0x52, 7, 0, 300);
+    if (feed(demux, 0x12, data, len))
+        goto failed;
+    if (eit.count != 3 || eit_5.count != 1) {
+        printf("Test failed - EIT seen %d times (expected 3), %d for service 5 (expected 1)\n",
+            eit.count, eit_5.count);
+        goto failed;
+    }
+
+    // A corrupted section is counted, but not passed on
+    len = make_section(data, 0x50, 5, 1, 20);
+    data[10] ^= 0x01;
+    if (feed(demux, 0x12, data, len))
+        goto failed;
+    if (eit.count != 3 || demux->num_crc_errors != 1) {
+        printf("Test failed - bad CRC not detected\n");
+        goto failed;
+    }
+
+    // A section started but not finished is abandoned when the next starts
+    len = make_section(data, 0x50, 8, 0, 300);
+    {
+        byte payload[184];
+        payload[0] = 0;
+        memcpy(payload + 1, data, 183);
+        if (section_demux_packet(demux, 0x12, true, payload, 184))
+            goto failed;
+    }
+    if (feed(demux, 0x12, data, len))
+        goto failed;
+    if (eit.count != 4 || demux->num_broken == 0) {
+        printf("Test failed - unfinished section not abandoned (%d EIT, %u broken)\n", eit.count,
+            demux->num_broken);
+        goto failed;
+    }
+
+    // An EIT too short to hold its transport stream and original network
+    // ids is not passed on, even though its CRC is correct
+    {
+        uint32_t broken = demux->num_broken;
+        len = make_section(data, 0x50, 5, 2, 2);
+        if (feed(demux, 0x12, data, len))
+            goto failed;
+        if (eit.count != 4 || demux->num_broken != broken + 1) {
+            printf("Test failed - short EIT passed on (%d EIT, %u broken)\n", eit.count,
+                demux->num_broken);
+            goto failed;
+        }
+    }
+
+    free_section_demux(&demux);
+    return 0;
+
+failed:
+    free_section_demux(&demux);
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    if (test_crc() || test_demux())
+        return 1;
+    printf("Tests passed\n");
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
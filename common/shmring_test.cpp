@@ -0,0 +1,233 @@
+/*
+ * A simple test for passing data through a shared memory ring, from shmring.c
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "accessunit.h"
+#include "bitdata.h"
+#include "blockcache.h"
+#include "compat.h"
+#include "compressed.h"
+#include "es.h"
+#include "gop.h"
+#include "h222.h"
+#include "h262.h"
+#include "misc.h"
+#include "nalunit.h"
+#include "pes.h"
+#include "pidint.h"
+#include "printing.h"
+#include "probe.h"
+#include "ps.h"
+#include "reverse.h"
+#include "shmring.h"
+#include "ts.h"
+#include "tswrite.h"
+
+// Enough to go round the ring several times
+#define TEST_DATA_SIZE (3 * SHM_RING_SIZE + 12345)
+#define TEST_READ_SIZE 5000
+#define TEST_PROBE_SIZE 100000
+
+/*
+ * Make up some data, the same each time.
+ */
+static byte* make_test_data(void)
+{
+    byte* data = (byte*)malloc(TEST_DATA_SIZE);
+    if (data == nullptr) {
+        printf("Test failed - allocating test data\n");
+        return nullptr;
+    }
+    srand(1);
+    for (int ii = 0; ii < TEST_DATA_SIZE; ii++)
+        data[ii] = (byte)rand();
+    return data;
+}
+
+/*
+ * Write the test data to the ring, in uneven amounts.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int write_test_data(const char* name, const byte* data, int size)
+{
+    shm_ring_p ring = nullptr;
+    int err = open_shm_output(name, &ring);
+    if (err) {
+        printf("Test failed - creating %s\n", name);
+        return 1;
+    }
+    for (int posn = 0; posn < size;) {
+        int len = 1 + rand() % 70000;
+        if (len > size - posn)
+            len = size - posn;
+        err = write_shm_output(ring, data + posn, len);
+        if (err) {
+            printf("Test failed - writing to %s\n", name);
+            (void)close_shm_output(&ring);
+            return 1;
+        }
+        posn += len;
+    }
+    return close_shm_output(&ring);
+}
+
+/*
+ * Read the test data from the ring, as a program probing its input would:
+ * some from the start, then all of it from the start again.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int read_test_data(const char* name, const byte* data, int size)
+{
+    byte buf[TEST_READ_SIZE];
+    byte* probe;
+    int result = 1;
+    int err;
+    int fd = open_binary_file((char*)name, false);
+    if (fd == -1) {
+        printf("Test failed - opening %s\n", name);
+        return 1;
+    }
+    if (!is_shm_file(fd)) {
+        printf("Test failed - %s is not recognised as shared memory\n", name);
+        goto close;
+    }
+
+    probe = (byte*)malloc(TEST_PROBE_SIZE);
+    if (probe == nullptr) {
+        printf("Test failed - allocating probe buffer\n");
+        goto close;
+    }
+    err = read_bytes(fd, TEST_PROBE_SIZE, probe);
+    if (!err)
+        err = memcmp(probe, data, TEST_PROBE_SIZE);
+    free(probe);
+    if (err) {
+        printf("Test failed - reading the start of %s\n", name);
+        goto close;
+    }
+    if (seek_file(fd, 0) || tell_file(fd) != 0) {
+        printf("Test failed - going back to the start of %s\n", name);
+        goto close;
+    }
+
+    for (int posn = 0; posn < size; posn += TEST_READ_SIZE) {
+        int len = (size - posn < TEST_READ_SIZE ? size - posn : TEST_READ_SIZE);
+        err = read_bytes(fd, len, buf);
+        if (err || memcmp(buf, data + posn, len)) {
+            printf("Test failed - reading %d bytes at %d from %s\n", len, posn, name);
+            goto close;
+        }
+    }
+    if (read_bytes(fd, 1, buf) != EOF) {
+        printf("Test failed - no EOF at the end of %s\n", name);
+        goto close;
+    }
+    if (seek_file(fd, 0) == 0) {
+        printf("Test failed - going back to data already given back to the writer\n");
+        goto close;
+    }
+    result = 0;
+
+close:
+    (void)close_file(fd);
+    return result;
+}
+
+/*
+ * Write the test data in another process, whilst reading it in this one.
+ *
+ * - `size` is how much of the test data to use
+ * - if `reader_first`, start reading before the writer has created the ring
+ * - if `writer_first`, let the writer finish before starting to read (so
+ *   `size` must be no more than the ring holds)
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_ring(const byte* data, int size, int reader_first, int writer_first)
+{
+    char name[100];
+    char object[100];
+    int status;
+    int err;
+    pid_t child;
+
+    snprintf(name, sizeof(name), "shm:shmring_test_%d", (int)getpid());
+    snprintf(object, sizeof(object), "/shmring_test_%d", (int)getpid());
+    fflush(stdout);
+    child = fork();
+    if (child == -1) {
+        printf("Test failed - forking writer\n");
+        return 1;
+    } else if (child == 0) {
+        if (reader_first)
+            usleep(200000);
+        _exit(write_test_data(name, data, size));
+    }
+
+    if (writer_first && waitpid(child, &status, 0) == -1) {
+        printf("Test failed - waiting for writer\n");
+        return 1;
+    }
+    err = read_test_data(name, data, size);
+    if (!writer_first && waitpid(child, &status, 0) == -1) {
+        printf("Test failed - waiting for writer\n");
+        return 1;
+    }
+    if (err)
+        return 1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("Test failed - writer did not succeed\n");
+        return 1;
+    }
+    if (shm_open(object, O_RDONLY, 0) != -1 || errno != ENOENT) {
+        printf("Test failed - %s was not removed\n", name);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    byte* data = make_test_data();
+    int err;
+    if (data == nullptr)
+        return 1;
+
+    printf("Test 1 - reading whilst writing\n");
+    err = test_ring(data, TEST_DATA_SIZE, false, false);
+    if (err)
+        return 1;
+    printf("Test 1 succeeded\n");
+
+    printf("Test 2 - reading before the ring is created\n");
+    err = test_ring(data, TEST_DATA_SIZE, true, false);
+    if (err)
+        return 1;
+    printf("Test 2 succeeded\n");
+
+    printf("Test 3 - reading after the writer has finished\n");
+    err = test_ring(data, SHM_RING_SIZE / 2, false, true);
+    if (err)
+        return 1;
+    printf("Test 3 succeeded\n");
+
+    free(data);
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
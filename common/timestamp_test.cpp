@@ -0,0 +1,170 @@
+/*
+ * Test the timestamp arithmetic and restamping
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "compat.h"
+#include "timestamp.h"
+#include "timestamp_defns.h"
+
+// These are all worked out at compile time
+static_assert(pts_add(PTS_MASK, 1) == 0, "PTS wrap on add");
+static_assert(pts_add(0, -1) == PTS_MASK, "PTS wrap on subtract");
+static_assert(pts_signed_diff(5, PTS_MASK) == 6, "PTS difference across wrap");
+static_assert(pts_signed_diff(PTS_MASK, 5) == -6, "PTS negative difference across wrap");
+static_assert(pts_unsigned_diff(5, PTS_MASK) == 6, "PTS unsigned difference across wrap");
+static_assert(pts_abs_diff(PTS_MASK, 5) == 6, "PTS absolute difference across wrap");
+static_assert(pts_before(PTS_MASK, 0), "PTS ordering across wrap");
+static_assert(!pts_before(0, PTS_MASK), "PTS ordering across wrap");
+static_assert(pcr_add(PCR_UNSIGNED_WRAP - 1, 2) == 1, "PCR wrap on add");
+static_assert(pcr_add(1, -2) == PCR_UNSIGNED_WRAP - 1, "PCR wrap on subtract");
+static_assert(pcr_signed_diff(1, PCR_UNSIGNED_WRAP - 1) == 2, "PCR difference across wrap");
+static_assert(
+    pcr_unsigned_diff(1, PCR_UNSIGNED_WRAP - 1) == 2, "PCR unsigned difference across wrap");
+static_assert(pcr_unsigned_diff(12345, 12345) == 0, "PCR unsigned difference of equal values");
+static_assert(pcr_unsigned_diff(PCR_UNSIGNED_WRAP - 1, 0) == PCR_UNSIGNED_WRAP - 1,
+    "PCR unsigned difference at most a whole wrap");
+static_assert(pcr_before(PCR_UNSIGNED_WRAP - 1, 1), "PCR ordering across wrap");
+static_assert(timestamp_to_27MHz(timestamp_90kHz_t { 3 }).ticks == 900, "90kHz to 27MHz");
+static_assert(timestamp_diff(timestamp_90kHz_t { 1 }, timestamp_90kHz_t { PTS_MASK }) == 2,
+    "typed PTS difference across wrap");
+
+static int test_unwrap()
+{
+    timestamp_unwrap_t unwrap = TIMESTAMP_UNWRAP_INIT;
+    uint64_t pts = PTS_MASK - 90000 * 10;
+    int64_t expected = (int64_t)pts;
+
+    printf("Testing unwrapping\n");
+    for (int ii = 0; ii < 20; ii++) {
+        int64_t result = unwrap_pts(&unwrap, pts);
+        if (result != expected) {
+            printf("Test failed - unwrap of PTS %llu gave %lld, expected %lld\n",
+                (unsigned long long)pts, (long long)result, (long long)expected);
+            return 1;
+        }
+        pts = pts_add(pts, 90000);
+        expected += 90000;
+    }
+    // And a small step backwards is still a step backwards
+    if (unwrap_pts(&unwrap, pts_add(pts, -180000)) != expected - 180000) {
+        printf("Test failed - unwrap of a backwards step\n");
+        return 1;
+    }
+
+    unwrap = TIMESTAMP_UNWRAP_INIT;
+    uint64_t pcr = PCR_UNSIGNED_WRAP - 27000000;
+    expected = (int64_t)pcr;
+    for (int ii = 0; ii < 20; ii++) {
+        if (unwrap_pcr(&unwrap, pcr) != expected) {
+            printf("Test failed - unwrap of PCR %llu\n", (unsigned long long)pcr);
+            return 1;
+        }
+        pcr = pcr_add(pcr, 13500000);
+        expected += 13500000;
+    }
+    return 0;
+}
+
+static int test_bytes()
+{
+    byte data[6];
+
+    printf("Testing packed forms\n");
+    for (uint64_t value : { 0ULL, 1ULL, 0x123456789ULL, PTS_MASK }) {
+        memset(data, 0x30, sizeof(data));
+        pts_to_bytes(data, value);
+        if (pts_from_bytes(data) != value || (data[0] & 0xF0) != 0x30) {
+            printf("Test failed - PTS %llx did not round trip\n", (unsigned long long)value);
+            return 1;
+        }
+    }
+    for (uint64_t value :
+        { 0ULL, 299ULL, 300ULL, 0x123456789ULL * 300 + 17, PCR_UNSIGNED_WRAP - 1 }) {
+        memset(data, 0xFF, sizeof(data));
+        pcr_to_bytes(data, value);
+        if (pcr_from_bytes(data) != value || (data[4] & 0x7E) != 0x7E) {
+            printf("Test failed - PCR %llx did not round trip\n", (unsigned long long)value);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int test_restamp()
+{
+    byte packet[TS_PACKET_SIZE];
+    byte* pes;
+
+    printf("Testing restamping\n");
+
+    // A packet with a PCR, starting a video PES packet with PTS and DTS
+    memset(packet, 0xFF, sizeof(packet));
+    packet[0] = 0x47;
+    packet[1] = 0x40 | 0x01;
+    packet[2] = 0x00;
+    packet[3] = 0x30 | 0x0F;
+    packet[4] = 7;
+    packet[5] = 0x10;
+    pcr_to_bytes(packet + 6, PCR_UNSIGNED_WRAP - 300);
+    pes = packet + 12;
+    memset(pes, 0, 19);
+    pes[2] = 1;
+    pes[3] = 0xE0;
+    pes[6] = 0x80;
+    pes[7] = 0xC0;
+    pes[8] = 10;
+    pes[9] = 0x30;
+    pts_to_bytes(pes + 9, PTS_MASK);
+    pes[14] = 0x10;
+    pts_to_bytes(pes + 14, PTS_MASK - 3000);
+
+    if (restamp_TS_packet(packet, 600, 2, 1)) {
+        printf("Test failed - restamp rejected packet\n");
+        return 1;
+    }
+    if ((packet[3] & 0x0F) != 0 || (packet[3] & 0xF0) != 0x30) {
+        printf("Test failed - continuity counter %x\n", packet[3]);
+        return 1;
+    }
+    if (pcr_from_bytes(packet + 6) != 300) {
+        printf("Test failed - PCR %llu, expected 300\n",
+            (unsigned long long)pcr_from_bytes(packet + 6));
+        return 1;
+    }
+    if (pts_from_bytes(pes + 9) != 1 || pts_from_bytes(pes + 14) != PTS_MASK - 2998) {
+        printf("Test failed - PTS/DTS restamped wrongly\n");
+        return 1;
+    }
+    if ((pes[9] & 0xF0) != 0x30 || (pes[14] & 0xF0) != 0x10) {
+        printf("Test failed - PTS/DTS guard bits altered\n");
+        return 1;
+    }
+
+    // And back again
+    if (restamp_TS_packet(packet, -600, -2, -1)
+        || pcr_from_bytes(packet + 6) != PCR_UNSIGNED_WRAP - 300
+        || pts_from_bytes(pes + 9) != PTS_MASK || (packet[3] & 0x0F) != 0x0F) {
+        printf("Test failed - restamp did not reverse\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (test_unwrap() || test_bytes() || test_restamp())
+        return 1;
+    printf("Tests passed\n");
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
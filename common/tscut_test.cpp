@@ -0,0 +1,249 @@
+/*
+ * A simple test for the TS cutter, from tscut.h
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "accessunit.h"
+#include "bitdata.h"
+#include "blockcache.h"
+#include "compat.h"
+#include "compressed.h"
+#include "es.h"
+#include "gop.h"
+#include "h222.h"
+#include "h262.h"
+#include "misc.h"
+#include "nalunit.h"
+#include "packet_view_defns.h"
+#include "pes.h"
+#include "pidint.h"
+#include "printing.h"
+#include "probe.h"
+#include "ps.h"
+#include "reverse.h"
+#include "section.h"
+#include "shmring.h"
+#include "ts.h"
+#include "tscut.h"
+#include "tswrite.h"
+
+#define TEST_PMT_PID 0x1000
+#define TEST_VIDEO_PID 0x100
+#define TEST_NUM_FRAMES 250
+#define TEST_FIRST_PTS 90000
+#define TEST_FRAME_TICKS 3600 // 25 frames a second
+#define TEST_PSI_EVERY 10 // frames between each PAT and PMT
+#define TEST_GOP_LENGTH 25 // frames between each random access point
+
+/*
+ * Write the test stream: H.262 "frames" of one TS packet each, with a
+ * sequence header (and so a random access point) every TEST_GOP_LENGTH,
+ * and a PAT and PMT every TEST_PSI_EVERY. Each frame has a PTS, and a DTS
+ * one frame earlier, which is also its PCR.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int make_test_file(char* filename)
+{
+    TS_writer_p output = nullptr;
+    pmt_p pmt = nullptr;
+    byte frame[100];
+    int err = 0;
+
+    if (tswrite_open_file(filename, true, &output)) {
+        printf("Test failed - creating %s\n", filename);
+        return 1;
+    }
+    pmt = build_pmt(1, 0, TEST_VIDEO_PID);
+    if (pmt == nullptr || add_stream_to_pmt(pmt, TEST_VIDEO_PID, 0x02, 0, nullptr)) {
+        printf("Test failed - building PMT\n");
+        err = 1;
+    }
+
+    for (int ii = 0; ii < TEST_NUM_FRAMES && !err; ii++) {
+        uint64_t pts = TEST_FIRST_PTS + (uint64_t)ii * TEST_FRAME_TICKS;
+        if (ii % TEST_PSI_EVERY == 0) {
+            err = write_single_program_pat(output, 1, 1, TEST_PMT_PID);
+            if (!err)
+                err = write_pmt(output, TEST_PMT_PID, pmt);
+        }
+        memset(frame, 0xAA, sizeof(frame));
+        frame[0] = 0x00;
+        frame[1] = 0x00;
+        frame[2] = 0x01;
+        frame[3] = (ii % TEST_GOP_LENGTH == 0 ? 0xB3 : 0x00);
+        if (!err)
+            err = write_ES_as_TS_PES_packet_with_pts_dts(output, frame, sizeof(frame),
+                TEST_VIDEO_PID, DEFAULT_VIDEO_STREAM_ID, true, pts, true,
+                pts - TEST_FRAME_TICKS);
+        if (err)
+            printf("Test failed - writing frame %d\n", ii);
+    }
+    free_pmt(&pmt);
+    if (tswrite_close(output, true)) {
+        printf("Test failed - closing %s\n", filename);
+        err = 1;
+    }
+    return err;
+}
+
+/*
+ * Check the cut: it starts with a PAT and PMT, the continuity counters on
+ * each PID carry on from one packet to the next, and it has the video
+ * frames from `first_frame` to `last_frame`, with `pts_delta` added to
+ * their PTS. If `first_pcr` is not -1, it is the first PCR we want.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int check_cut(char* name, int first_frame, int last_frame, int64_t pts_delta,
+    int64_t first_pcr)
+{
+    TS_reader_p tsreader = nullptr;
+    int last_cc[3] = { -1, -1, -1 };
+    int frame = first_frame;
+    int result = 1;
+
+    if (open_file_for_TS_read(name, &tsreader)) {
+        printf("Test failed - opening %s\n", name);
+        return 1;
+    }
+    for (int index = 0;; index++) {
+        byte* packet;
+        int err = read_next_TS_packet(tsreader, &packet);
+        if (err == EOF)
+            break;
+        else if (err) {
+            printf("Test failed - reading %s\n", name);
+            goto close;
+        }
+        const TS_packet_view view = { packet };
+        uint32_t pid = view.pid();
+        if ((index == 0 && pid != 0x00) || (index == 1 && pid != TEST_PMT_PID)) {
+            printf("Test failed - %s does not start with a PAT and PMT\n", name);
+            goto close;
+        }
+        int which = (pid == 0x00 ? 0 : pid == TEST_PMT_PID ? 1 : 2);
+        int cc = view.continuity_counter();
+        if (last_cc[which] != -1 && cc != ((last_cc[which] + 1) & 0x0F)) {
+            printf("Test failed - %s packet %d on PID %#x has continuity counter %d after %d\n",
+                name, index, pid, cc, last_cc[which]);
+            goto close;
+        }
+        last_cc[which] = cc;
+        if (pid != TEST_VIDEO_PID)
+            continue;
+
+        // The first video packet should have the first PCR we want
+        if (first_pcr != -1 && frame == first_frame) {
+            const adaptation_field_view field = view.adaptation_field();
+            if (!field.has_PCR() || field.PCR() != (uint64_t)first_pcr) {
+                printf("Test failed - %s does not start with PCR " LLD_FORMAT "\n", name,
+                    first_pcr);
+                goto close;
+            }
+        }
+        const PES_header_view header
+            = { packet + view.payload_offset(), view.payload_length() };
+        uint64_t want_pts = TEST_FIRST_PTS + (uint64_t)frame * TEST_FRAME_TICKS + pts_delta;
+        if (!header.has_PTS() || header.PTS() != want_pts) {
+            printf("Test failed - %s frame %d does not have PTS " LLU_FORMAT "\n", name, frame,
+                want_pts);
+            goto close;
+        }
+        byte* data = packet + view.payload_offset() + header.ES_data_offset();
+        if (frame == first_frame && data[3] != 0xB3) {
+            printf("Test failed - %s does not start with a sequence header\n", name);
+            goto close;
+        }
+        frame++;
+    }
+    if (frame != last_frame + 1) {
+        printf("Test failed - %s ends at frame %d, not %d\n", name, frame - 1, last_frame);
+        goto close;
+    }
+    result = 0;
+
+close:
+    (void)close_TS_reader(&tsreader);
+    return result;
+}
+
+/*
+ * Cut the test stream from `start` to `end` seconds, and check the cut.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_cut(double start, double end, int rebase)
+{
+    char filename[100];
+    char cutname[100];
+    struct TS_cutter cut;
+    TS_reader_p tsreader = nullptr;
+    int result = 1;
+
+    // The cut starts at the random access point at or before the start, and
+    // stops before the first frame decoded (so one frame before it is
+    // presented) at or after the end
+    int first_frame = (int)(start * 90000 / TEST_FRAME_TICKS) / TEST_GOP_LENGTH * TEST_GOP_LENGTH;
+    int last_frame = (int)(end * 90000 / TEST_FRAME_TICKS);
+
+    // When rebasing, the first PCR (the first frame's DTS) becomes zero
+    int64_t pts_delta
+        = (rebase ? -(TEST_FIRST_PTS + (int64_t)(first_frame - 1) * TEST_FRAME_TICKS) : 0);
+
+    snprintf(filename, sizeof(filename), "/tmp/tscut_test_%d.ts", (int)getpid());
+    snprintf(cutname, sizeof(cutname), "/tmp/tscut_test_%d_cut.ts", (int)getpid());
+
+    init_TS_cutter(&cut);
+    cut.start = (int64_t)(start * 90000.0);
+    cut.end = (int64_t)(end * 90000.0);
+    cut.rebase = rebase;
+    cut.quiet = true;
+
+    if (make_test_file(filename))
+        goto tidy;
+    if (open_file_for_TS_read(filename, &tsreader)) {
+        printf("Test failed - opening %s\n", filename);
+        goto tidy;
+    }
+    if (cut_TS(&cut, tsreader, cutname)) {
+        printf("Test failed - cutting %s\n", filename);
+        goto tidy;
+    }
+    result = check_cut(cutname, first_frame, last_frame, pts_delta, (rebase ? 0 : -1));
+
+tidy:
+    clear_TS_cutter(&cut);
+    if (tsreader != nullptr)
+        (void)close_TS_reader(&tsreader);
+    (void)unlink(filename);
+    (void)unlink(cutname);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test 1 - cutting from 2.5 to 5 seconds\n");
+    if (test_cut(2.5, 5.0, false))
+        return 1;
+    printf("Test 1 succeeded\n");
+
+    printf("Test 2 - cutting from 4 to 8 seconds, rebasing the timestamps\n");
+    if (test_cut(4.0, 8.0, true))
+        return 1;
+    printf("Test 2 succeeded\n");
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
@@ -0,0 +1,266 @@
+/*
+ * A simple test for tsplay's in-memory looping, from tsplay.c
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "accessunit.h"
+#include "bitdata.h"
+#include "blockcache.h"
+#include "compat.h"
+#include "compressed.h"
+#include "es.h"
+#include "gop.h"
+#include "h222.h"
+#include "h262.h"
+#include "misc.h"
+#include "nalunit.h"
+#include "pes.h"
+#include "pidint.h"
+#include "printing.h"
+#include "probe.h"
+#include "ps.h"
+#include "reverse.h"
+#include "shmring.h"
+#include "timestamp.h"
+#include "ts.h"
+#include "tsplay.h"
+#include "tswrite.h"
+
+#define TEST_PID 0x100
+#define TEST_NUM_PACKETS 100
+#define TEST_PCR_EVERY 10
+#define TEST_PCR_STEP 27000 // 27MHz ticks from one packet to the next
+#define TEST_FIRST_PTS 9000
+
+/*
+ * Make up TS packet `index` of the test clip: every packet is on TEST_PID,
+ * every TEST_PCR_EVERY'th has a PCR (or, if `constant_pcr`, the same PCR
+ * each time), and the first starts a PES packet with a PTS.
+ */
+static void make_test_packet(byte packet[TS_PACKET_SIZE], int index, int constant_pcr)
+{
+    memset(packet, 0xFF, TS_PACKET_SIZE);
+    packet[0] = 0x47;
+    packet[1] = (index == 0 ? 0x40 : 0x00) | (TEST_PID >> 8);
+    packet[2] = TEST_PID & 0xFF;
+    packet[3] = 0x30 | (index & 0x0F);
+    packet[4] = 7;
+    packet[5] = (index % TEST_PCR_EVERY == 0 ? 0x10 : 0x00);
+    if (index % TEST_PCR_EVERY == 0)
+        pcr_to_bytes(packet + 6, (constant_pcr ? 0 : (uint64_t)index * TEST_PCR_STEP));
+    if (index == 0) {
+        byte* pes = packet + 12;
+        memset(pes, 0, 14);
+        pes[2] = 1;
+        pes[3] = 0xE0;
+        pes[6] = 0x80;
+        pes[7] = 0x80;
+        pes[8] = 5;
+        pts_to_bytes(pes + 9, TEST_FIRST_PTS);
+        pes[9] |= 0x20;
+    }
+}
+
+/*
+ * Write the test clip to a file, with each packet `prefix_len` bytes of
+ * prefix (as M2TS has) before it, and open the file for reading.
+ *
+ * Returns the file descriptor, or -1 if something went wrong.
+ */
+static int make_test_file(const char* filename, int prefix_len, int constant_pcr)
+{
+    FILE* file = fopen(filename, "wb");
+    if (file == nullptr) {
+        printf("Test failed - creating %s\n", filename);
+        return -1;
+    }
+    for (int ii = 0; ii < TEST_NUM_PACKETS; ii++) {
+        byte prefix[4] = { 0, 0, 0, 0 };
+        byte packet[TS_PACKET_SIZE];
+        make_test_packet(packet, ii, constant_pcr);
+        if (fwrite(prefix, 1, prefix_len, file) != (size_t)prefix_len
+            || fwrite(packet, 1, TS_PACKET_SIZE, file) != TS_PACKET_SIZE) {
+            printf("Test failed - writing %s\n", filename);
+            fclose(file);
+            return -1;
+        }
+    }
+    fclose(file);
+    return open_binary_file((char*)filename, false);
+}
+
+/*
+ * Load the test clip (with packets `prefix_len` bytes apart), and check
+ * that going round the loop carries on the PCRs, PTS and continuity
+ * counters from where the clip ended.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_loop(int prefix_len)
+{
+    char filename[100];
+    TS_memory_loop_p loop = nullptr;
+    byte* first;
+    byte* last_pcr_packet;
+    int result = 1;
+    int file;
+
+    snprintf(filename, sizeof(filename), "/tmp/tsplay_test_%d.ts", (int)getpid());
+    file = make_test_file(filename, prefix_len, false);
+    if (file == -1)
+        return 1;
+    if (load_TS_memory_loop(file, 0, 0, true, &loop)) {
+        printf("Test failed - loading the clip\n");
+        goto close;
+    }
+    if (loop->num_packets != TEST_NUM_PACKETS || loop->pcr_pid != TEST_PID) {
+        printf("Test failed - loaded %u packets with PCR PID %#x\n", loop->num_packets,
+            loop->pcr_pid);
+        goto close;
+    }
+    if (loop->clip_size != (size_t)TEST_NUM_PACKETS * TS_PACKET_SIZE) {
+        printf("Test failed - mapped %zu bytes for %d packets\n", loop->clip_size,
+            TEST_NUM_PACKETS);
+        goto close;
+    }
+    if (loop->duration != (uint64_t)TEST_NUM_PACKETS * TEST_PCR_STEP) {
+        printf("Test failed - loop lasts " LLU_FORMAT "\n", loop->duration);
+        goto close;
+    }
+
+    for (uint32_t ii = 0; ii < loop->num_packets; ii++)
+        restamp_TS_memory_loop_packet(loop, ii);
+    first = loop->clip;
+    last_pcr_packet = loop->clip + (TEST_NUM_PACKETS - TEST_PCR_EVERY) * TS_PACKET_SIZE;
+    if ((first[3] & 0x0F) != (TEST_NUM_PACKETS & 0x0F)) {
+        printf("Test failed - continuity counter %d after the loop\n", first[3] & 0x0F);
+        goto close;
+    }
+    if (pcr_from_bytes(first + 6) != (uint64_t)TEST_NUM_PACKETS * TEST_PCR_STEP
+        || pcr_from_bytes(last_pcr_packet + 6)
+            != (uint64_t)(2 * TEST_NUM_PACKETS - TEST_PCR_EVERY) * TEST_PCR_STEP) {
+        printf("Test failed - PCRs after the loop\n");
+        goto close;
+    }
+    if (pts_from_bytes(first + 12 + 9)
+        != TEST_FIRST_PTS + (uint64_t)TEST_NUM_PACKETS * TEST_PCR_STEP / 300) {
+        printf("Test failed - PTS after the loop\n");
+        goto close;
+    }
+    result = 0;
+
+close:
+    free_TS_memory_loop(&loop);
+    (void)close_file(file);
+    (void)unlink(filename);
+    return result;
+}
+
+/*
+ * A clip whose PCRs do not advance cannot be looped.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_constant_pcr(void)
+{
+    char filename[100];
+    TS_memory_loop_p loop = nullptr;
+    int result = 0;
+    int file;
+
+    snprintf(filename, sizeof(filename), "/tmp/tsplay_test_%d.ts", (int)getpid());
+    file = make_test_file(filename, 0, true);
+    if (file == -1)
+        return 1;
+    if (load_TS_memory_loop(file, 0, 0, true, &loop) == 0) {
+        printf("Test failed - loop of %u packets with constant PCRs lasts " LLU_FORMAT "\n",
+            loop->num_packets, loop->duration);
+        free_TS_memory_loop(&loop);
+        result = 1;
+    }
+    (void)close_file(file);
+    (void)unlink(filename);
+    return result;
+}
+
+/*
+ * Shared memory looks like a file to fstat, but cannot be mapped as the
+ * clip, so should be refused rather than looped.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_shared_memory(void)
+{
+    char name[100];
+    shm_ring_p ring = nullptr;
+    TS_memory_loop_p loop = nullptr;
+    int result = 0;
+    int file;
+
+    snprintf(name, sizeof(name), "shm:tsplay_test_%d", (int)getpid());
+    if (open_shm_output(name, &ring)) {
+        printf("Test failed - creating %s\n", name);
+        return 1;
+    }
+    for (int ii = 0; ii < TEST_NUM_PACKETS; ii++) {
+        byte packet[TS_PACKET_SIZE];
+        make_test_packet(packet, ii, false);
+        if (write_shm_output(ring, packet, TS_PACKET_SIZE)) {
+            printf("Test failed - writing to %s\n", name);
+            (void)close_shm_output(&ring);
+            return 1;
+        }
+    }
+    (void)close_shm_output(&ring);
+
+    file = open_binary_file(name, false);
+    if (file == -1) {
+        printf("Test failed - opening %s\n", name);
+        return 1;
+    }
+    if (load_TS_memory_loop(file, 0, 0, true, &loop) == 0) {
+        printf("Test failed - loop of %u packets from shared memory\n", loop->num_packets);
+        free_TS_memory_loop(&loop);
+        result = 1;
+    }
+    (void)close_file(file);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test 1 - looping 188 byte TS packets\n");
+    if (test_loop(0))
+        return 1;
+    printf("Test 1 succeeded\n");
+
+    printf("Test 2 - looping 192 byte M2TS packets\n");
+    if (test_loop(M2TS_HEADER_SIZE))
+        return 1;
+    printf("Test 2 succeeded\n");
+
+    printf("Test 3 - refusing a clip whose PCRs do not advance\n");
+    if (test_constant_pcr())
+        return 1;
+    printf("Test 3 succeeded\n");
+
+    printf("Test 4 - refusing a clip in shared memory\n");
+    if (test_shared_memory())
+        return 1;
+    printf("Test 4 succeeded\n");
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
@@ -0,0 +1,225 @@
+/*
+ * A simple test for the TS segmenter, from tssegment.h
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "accessunit.h"
+#include "bitdata.h"
+#include "blockcache.h"
+#include "compat.h"
+#include "compressed.h"
+#include "es.h"
+#include "gop.h"
+#include "h222.h"
+#include "h262.h"
+#include "misc.h"
+#include "nalunit.h"
+#include "pes.h"
+#include "pidint.h"
+#include "printing.h"
+#include "probe.h"
+#include "ps.h"
+#include "reverse.h"
+#include "section.h"
+#include "shmring.h"
+#include "ts.h"
+#include "tssegment.h"
+#include "tswrite.h"
+
+#define TEST_PMT_PID 0x1000
+#define TEST_VIDEO_PID 0x100
+#define TEST_NUM_FRAMES 250
+#define TEST_FRAME_TICKS 3600 // 25 frames a second
+#define TEST_PSI_EVERY 10 // frames between each PAT and PMT
+#define TEST_GOP_LENGTH 25 // frames between each random access point
+
+/*
+ * Write the test stream: H.262 "frames" of one TS packet each, with a
+ * sequence header (and so a random access point) every TEST_GOP_LENGTH,
+ * and a PAT and PMT every TEST_PSI_EVERY. The PAT and PMT continuity
+ * counters start from `pat_cc` and `pmt_cc`.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int make_test_file(char* filename, int pat_cc, int pmt_cc)
+{
+    TS_writer_p output = nullptr;
+    pmt_p pmt = nullptr;
+    byte frame[100];
+    int err = 0;
+
+    if (tswrite_open_file(filename, true, &output)) {
+        printf("Test failed - creating %s\n", filename);
+        return 1;
+    }
+    pmt = build_pmt(1, 0, TEST_VIDEO_PID);
+    if (pmt == nullptr || add_stream_to_pmt(pmt, TEST_VIDEO_PID, 0x02, 0, nullptr)) {
+        printf("Test failed - building PMT\n");
+        err = 1;
+    }
+    set_continuity_count(0x00, pat_cc - 1);
+    set_continuity_count(TEST_PMT_PID, pmt_cc - 1);
+
+    for (int ii = 0; ii < TEST_NUM_FRAMES && !err; ii++) {
+        if (ii % TEST_PSI_EVERY == 0) {
+            err = write_single_program_pat(output, 1, 1, TEST_PMT_PID);
+            if (!err)
+                err = write_pmt(output, TEST_PMT_PID, pmt);
+        }
+        memset(frame, 0xAA, sizeof(frame));
+        frame[0] = 0x00;
+        frame[1] = 0x00;
+        frame[2] = 0x01;
+        frame[3] = (ii % TEST_GOP_LENGTH == 0 ? 0xB3 : 0x00);
+        if (!err)
+            err = write_ES_as_TS_PES_packet_with_pts_dts(output, frame, sizeof(frame),
+                TEST_VIDEO_PID, DEFAULT_VIDEO_STREAM_ID, true,
+                90000 + (uint64_t)ii * TEST_FRAME_TICKS, false, 0);
+        if (err)
+            printf("Test failed - writing frame %d\n", ii);
+    }
+    free_pmt(&pmt);
+    if (tswrite_close(output, true)) {
+        printf("Test failed - closing %s\n", filename);
+        err = 1;
+    }
+    return err;
+}
+
+/*
+ * Check that, within a segment, the continuity counters on the PAT and
+ * PMT PIDs carry on from those we wrote at its start into the input's own.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int check_segment(char* name)
+{
+    TS_reader_p tsreader = nullptr;
+    int last_cc[2] = { -1, -1 };
+    int count[2] = { 0, 0 };
+    int result = 1;
+
+    if (open_file_for_TS_read(name, &tsreader)) {
+        printf("Test failed - opening %s\n", name);
+        return 1;
+    }
+    for (int index = 0;; index++) {
+        byte* packet;
+        int err = read_next_TS_packet(tsreader, &packet);
+        if (err == EOF)
+            break;
+        else if (err) {
+            printf("Test failed - reading %s\n", name);
+            goto close;
+        }
+        uint32_t pid = ((packet[1] & 0x1F) << 8) | packet[2];
+        if ((index == 0 && pid != 0x00) || (index == 1 && pid != TEST_PMT_PID)) {
+            printf("Test failed - %s does not start with a PAT and PMT\n", name);
+            goto close;
+        }
+        if (pid != 0x00 && pid != TEST_PMT_PID)
+            continue;
+        int which = (pid == 0x00 ? 0 : 1);
+        int cc = packet[3] & 0x0F;
+        if (last_cc[which] != -1 && cc != ((last_cc[which] + 1) & 0x0F)) {
+            printf("Test failed - %s packet %d on PID %#x has continuity counter %d after %d\n",
+                name, index, pid, cc, last_cc[which]);
+            goto close;
+        }
+        last_cc[which] = cc;
+        count[which]++;
+    }
+    // We want to have seen the input's own PAT and PMT follow ours
+    if (count[0] < 2 || count[1] < 2) {
+        printf("Test failed - %s has %d PAT and %d PMT packets\n", name, count[0], count[1]);
+        goto close;
+    }
+    result = 0;
+
+close:
+    (void)close_TS_reader(&tsreader);
+    return result;
+}
+
+/*
+ * Segment the test stream into segments of `seconds`, and check each one.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int test_segment_cc(int seconds, int pat_cc, int pmt_cc)
+{
+    char filename[100];
+    char prefix[100];
+    char playlist[100];
+    struct TS_segmenter seg;
+    TS_reader_p tsreader = nullptr;
+    int result = 1;
+
+    snprintf(filename, sizeof(filename), "/tmp/tssegment_test_%d.ts", (int)getpid());
+    snprintf(prefix, sizeof(prefix), "/tmp/tssegment_test_%d_", (int)getpid());
+    snprintf(playlist, sizeof(playlist), "/tmp/tssegment_test_%d.m3u8", (int)getpid());
+
+    init_TS_segmenter(&seg);
+    seg.prefix = prefix;
+    seg.playlist = playlist;
+    seg.target = (int64_t)seconds * 90000;
+    seg.quiet = true;
+
+    if (make_test_file(filename, pat_cc, pmt_cc))
+        goto tidy;
+    if (open_file_for_TS_read(filename, &tsreader)) {
+        printf("Test failed - opening %s\n", filename);
+        goto tidy;
+    }
+    if (segment_TS(&seg, tsreader, 0)) {
+        printf("Test failed - segmenting %s\n", filename);
+        goto tidy;
+    }
+    if (seg.num_segments != TEST_NUM_FRAMES / TEST_GOP_LENGTH / seconds) {
+        printf("Test failed - %d segments of %ds, expected %d\n", seg.num_segments, seconds,
+            TEST_NUM_FRAMES / TEST_GOP_LENGTH / seconds);
+        goto tidy;
+    }
+    for (int ii = 0; ii < seg.num_segments; ii++) {
+        if (check_segment(segment_name(&seg, ii)))
+            goto tidy;
+    }
+    result = 0;
+
+tidy:
+    for (int ii = 0; ii < seg.num_segments; ii++)
+        (void)unlink(segment_name(&seg, ii));
+    clear_TS_segmenter(&seg);
+    if (tsreader != nullptr)
+        (void)close_TS_reader(&tsreader);
+    (void)unlink(filename);
+    (void)unlink(playlist);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test 1 - continuity counters in 2 second segments\n");
+    if (test_segment_cc(2, 5, 9))
+        return 1;
+    printf("Test 1 succeeded\n");
+
+    printf("Test 2 - continuity counters in 1 second segments, starting at 0\n");
+    if (test_segment_cc(1, 0, 0))
+        return 1;
+    printf("Test 2 succeeded\n");
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
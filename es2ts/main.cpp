@@ -13,8 +13,11 @@
 
 #include "accessunit.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "misc.h"
@@ -22,8 +25,10 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
@@ -308,13 +313,17 @@ int main(int argc, char** argv)
         if (!quiet)
             print_msg("Reading input as ");
     } else {
-        // int video_type;
-        err = decide_ES_file_video_type(es->input, false, verbose, &video_type);
-        if (err) {
+        struct stream_probe probe;
+        init_stream_probe(&probe);
+        err = probe_stream_file(es->input, 0, verbose, &probe);
+        if (err || probe.container != PROBE_CONTAINER_ES) {
             print_err("### es2ts: Error deciding on stream type\n");
+            clear_stream_probe(&probe);
             close_elementary_stream(&es);
             return 1;
         }
+        video_type = probe.video_type;
+        clear_stream_probe(&probe);
         if (!quiet)
             print_msg("Input appears to be ");
     }
@@ -16,8 +16,11 @@
 #include "accessunit.h"
 #include "avs.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "misc.h"
@@ -25,8 +28,10 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
@@ -40,9 +45,11 @@ static inline int umod(unsigned int a, unsigned int b)
 }
 
 /*
- * Print out a single character representative of our item.
+ * Print out a single character representative of an H.262 item, given
+ * its start code and (for a picture) its picture coding type.
  */
-static int h262_item_dot(h262_item_p item, double* delta_gop, int show_gop_time)
+static int h262_item_dot(
+    int start_code, int picture_coding_type, double* delta_gop, int show_gop_time)
 {
     char* str = nullptr;
 
@@ -51,28 +58,28 @@ static int h262_item_dot(h262_item_p item, double* delta_gop, int show_gop_time)
     int pic_coding_type = 0;
 
     // print the time every time we find a random access point (time between two GOPs)
-    if (item->unit.start_code == 0xB3) {
+    if (start_code == 0xB3) {
         *delta_gop = (frames - temp_frames) / frame_rate; // time between two GOPs [in seconds]
         temp_frames = frames;
         if (show_gop_time && temp_frames)
             fprint_msg(": %2.4fs\n", *delta_gop);
     }
 
-    if (item->unit.start_code == 0x00) {
+    if (start_code == 0x00) {
         if (frames % ((int)frame_rate * 60) == 0)
             fprint_msg("\n %d minute%s\n", frames / (int)(frame_rate * 60),
                 (frames / (int)(frame_rate * 60) == 1 ? "" : "s"));
         frames++;
     }
 
-    switch (item->unit.start_code) {
+    switch (start_code) {
     case 0x00:
-        str = (char*)(item->picture_coding_type == 1 ? "i"
-                                                     : item->picture_coding_type == 2
+        str = (char*)(picture_coding_type == 1 ? "i"
+                                               : picture_coding_type == 2
                     ? "p"
-                    : item->picture_coding_type == 3 ? "b"
-                                                     : item->picture_coding_type == 4 ? "d" : "x");
-        pic_coding_type = item->picture_coding_type;
+                    : picture_coding_type == 3 ? "b"
+                                               : picture_coding_type == 4 ? "d" : "x");
+        pic_coding_type = picture_coding_type;
         break;
     case 0xB0:
         str = "R";
@@ -104,7 +111,7 @@ static int h262_item_dot(h262_item_p item, double* delta_gop, int show_gop_time)
 
     default:
         if (str == nullptr) {
-            if (item->unit.start_code >= 0x01 && item->unit.start_code <= 0xAF)
+            if (start_code >= 0x01 && start_code <= 0xAF)
                 return 0; // str = "."; // Don't report slice data explicitly
             else
                 str = "?";
@@ -116,95 +123,64 @@ static int h262_item_dot(h262_item_p item, double* delta_gop, int show_gop_time)
     return pic_coding_type;
 }
 
+// What we keep track of whilst showing H.262 items as dots
+struct h262_dots_totals {
+    int count;
+    double time_gop;
+    int gops;
+    double time_gop_max;
+    double time_gop_min;
+    double time_gop_tot;
+    unsigned long num_i; // number of I frames
+    unsigned long num_p; // number of P frames
+    unsigned long num_b; // number of B frames
+};
+
+static void init_h262_dots_totals(struct h262_dots_totals* totals)
+{
+    memset(totals, 0, sizeof(*totals));
+    totals->time_gop_min = 1000.0;
+}
+
 /*
- * Simply report on the content of an MPEG2 file as single characters
- *
- * - `es` is the input elementary stream
- * - if `max` is non-zero, then reporting will stop after `max` MPEG items
- * - if `verbose` is true, then extra information will be output
- *
- * Returns 0 if it succeeds, 1 if some error occurs.
+ * Show a single H.262 item (other than a slice, which is just counted), and
+ * add it to our totals.
  */
-static int report_h262_file_as_dots(ES_p es, int max, int verbose, int show_gop_time)
+static void add_h262_item_dot(
+    int start_code, int picture_coding_type, int show_gop_time, struct h262_dots_totals* totals)
 {
-    int err;
-    int count = 0;
-    double time_gop = 0.0;
-    int gops = 0;
-    double time_gop_max = 0.0;
-    double time_gop_min = 1000.0;
-    double time_gop_tot = 0.0;
-    int pic_coding_type;
-    unsigned long num_i = 0; // number of I frames
-    unsigned long num_p = 0; // number of P frames
-    unsigned long num_b = 0; // number of B frames
-
-    if (verbose)
-        print_msg("\n"
-                  "Each character represents a single H.262 item\n"
-                  "Pictures are represented according to their picture coding\n"
-                  "type, and the slices within a picture are not shown.\n"
-                  "    i means an I picture\n"
-                  "    p means a  P picture\n"
-                  "    b means a  B picture\n"
-                  "    d means a  D picture (these should not occur in MPEG-2)\n"
-                  "    x means some other picture (such should not occur)\n"
-                  "Other items are represented as follows:\n"
-                  "    [ means a  Sequence header\n"
-                  "    > means a  Group Start header\n"
-                  "    E means an Extension start header\n"
-                  "    U means a  User data header\n"
-                  "    X means a  Sequence Error\n"
-                  "    ] means a  Sequence End\n"
-                  "    R means a  Reserved item\n"
-                  "    ? means something else. This may indicate that the stream\n"
-                  "      is not an ES representing H.262 (it might, for instance\n"
-                  "      be PES)\n"
-                  "\n");
-
-    for (;;) {
-        h262_item_p item;
-        err = find_next_h262_item(es, &item);
-        if (err == EOF)
-            break;
-        else if (err) {
-            print_err("### Error copying NAL units\n");
-            return err;
-        }
-        count++;
-        pic_coding_type = h262_item_dot(item, &time_gop, show_gop_time);
-        switch (pic_coding_type) {
-        case 1:
-            num_i++;
-            break;
-        case 2:
-            num_p++;
-            break;
-        case 3:
-            num_b++;
-            break;
-        default:
-            break;
-        }
-
-        if (item->unit.start_code == 0xB3) {
-            time_gop_max = max(time_gop_max, time_gop);
-            if (gops)
-                time_gop_min = min(time_gop_min, time_gop);
-            gops++;
-            time_gop_tot += time_gop;
-        }
-
-        free_h262_item(&item);
+    int pic_coding_type = h262_item_dot(
+        start_code, picture_coding_type, &totals->time_gop, show_gop_time);
+    switch (pic_coding_type) {
+    case 1:
+        totals->num_i++;
+        break;
+    case 2:
+        totals->num_p++;
+        break;
+    case 3:
+        totals->num_b++;
+        break;
+    default:
+        break;
+    }
 
-        if (max > 0 && count >= max)
-            break;
+    if (start_code == 0xB3) {
+        totals->time_gop_max = max(totals->time_gop_max, totals->time_gop);
+        if (totals->gops)
+            totals->time_gop_min = min(totals->time_gop_min, totals->time_gop);
+        totals->gops++;
+        totals->time_gop_tot += totals->time_gop;
     }
-    fprint_msg("\nFound %d MPEG2 item%s\n", count, (count == 1 ? "" : "s"));
-    fprint_msg("%lu I, %lu P, %lu B\n", num_i, num_p, num_b);
+}
+
+static void print_h262_dots_totals(struct h262_dots_totals* totals)
+{
+    fprint_msg("\nFound %d MPEG2 item%s\n", totals->count, (totals->count == 1 ? "" : "s"));
+    fprint_msg("%lu I, %lu P, %lu B\n", totals->num_i, totals->num_p, totals->num_b);
     fprint_msg("GOP times (s): max=%2.4f, min=%2.4f, mean=%2.6f (frame rate = %2.2f)\n",
-        time_gop_max, time_gop_min, time_gop_tot / (gops - 1), frame_rate);
-    return 0;
+        totals->time_gop_max, totals->time_gop_min, totals->time_gop_tot / (totals->gops - 1),
+        frame_rate);
 }
 
 /*
@@ -332,7 +308,7 @@ static char choose_nal_type(access_unit_p access_unit, int* gop_start_found)
     //        The value recovery_frame_cnt is never considered (as if it was 0).
 
     if (access_unit->primary_start == nullptr)
-        print_msg("_");
+        character_nal_type = '?'; // our caller prefixes this with '_'
     else if (access_unit->primary_start->nal_ref_idc == 0) {
         if (all_slices_I(access_unit))
             character_nal_type = 'i';
@@ -380,31 +356,396 @@ static char choose_nal_type(access_unit_p access_unit, int* gop_start_found)
     return character_nal_type;
 }
 
+// What we keep track of whilst showing H.264 access units as dots
+struct h264_dots_totals {
+    int access_unit_count;
+    int k_frame;
+    int size_gop_max;
+    int size_gop_min;
+    int gops;
+    int size_gop_tot;
+    int is_first_k_frame;
+    unsigned long num_idr;
+    unsigned long num_i;
+    unsigned long num_p;
+    unsigned long num_b;
+};
+
+static void init_h264_dots_totals(struct h264_dots_totals* totals)
+{
+    memset(totals, 0, sizeof(*totals));
+    totals->size_gop_min = 100000;
+    totals->is_first_k_frame = true;
+}
+
+/*
+ * Show a single access unit, given the character chosen for it by
+ * `choose_nal_type`, and add it to our totals.
+ */
+static void add_access_unit_dot(
+    char char_nal_type, int gop_start_found, int show_gop_time, struct h264_dots_totals* totals)
+{
+    // No real gop exists in h.264 but we try to find the distance between two
+    // random access points. These can be: IDR frame or I frame with a
+    // recovery_point in the SEI
+    if (gop_start_found) {
+        if (!totals->is_first_k_frame) {
+            int size_gop = totals->access_unit_count - totals->k_frame;
+            totals->size_gop_max = max(totals->size_gop_max, size_gop);
+            totals->size_gop_min = min(totals->size_gop_min, size_gop);
+            totals->size_gop_tot += size_gop;
+            totals->gops++;
+            if (show_gop_time)
+                fprint_msg(": %2.4f\n",
+                    (double)size_gop / frame_rate); // that's the time duration of a "GOP"
+            // (if the frame rate is 25fps)
+        }
+        totals->is_first_k_frame = false;
+        totals->k_frame = totals->access_unit_count;
+    }
+
+    switch (char_nal_type) {
+    case 'I':
+    case 'i':
+        totals->num_i++;
+        break;
+    case 'D':
+    case 'd':
+        totals->num_idr++;
+        break;
+    case 'P':
+    case 'p':
+        totals->num_p++;
+        break;
+    case 'B':
+    case 'b':
+        totals->num_b++;
+        break;
+    default:
+        break;
+    }
+
+    fprint_msg("%c", char_nal_type);
+    totals->access_unit_count++;
+
+    fflush(stdout);
+}
+
+static void print_h264_dots_totals(int nal_unit_count, struct h264_dots_totals* totals)
+{
+    fprint_msg("\nFound %d NAL unit%s in %d access unit%s\n", nal_unit_count,
+        (nal_unit_count == 1 ? "" : "s"), totals->access_unit_count,
+        (totals->access_unit_count == 1 ? "" : "s"));
+    fprint_msg("%lu IDR, %lu I, %lu P, %lu B access units\n", totals->num_idr, totals->num_i,
+        totals->num_p, totals->num_b);
+
+    if (totals->gops) // only if there is more than 1 gop
+        fprint_msg("GOP size (s): max=%2.4f, min=%2.4f, mean=%2.5f (frame rate = %2.2f)\n",
+            (double)totals->size_gop_max / frame_rate, (double)totals->size_gop_min / frame_rate,
+            (double)totals->size_gop_tot / (frame_rate * totals->gops), frame_rate);
+}
+
+// ------------------------------------------------------------
+// Working out the dots for the GOPs of a file in parallel
+// ------------------------------------------------------------
+// Each thread remembers what it found in each part, as a list of records,
+// and the main thread then shows those in order
+#define DOT_GOP_START 0x01 // H.264: access unit is a random access point
+#define DOT_NO_PRIMARY 0x02 // H.264: access unit has no primary picture
+#define DOT_END_OF_STREAM 0x04 // H.264: access unit was followed by EOS
+
+#define DOT_RECORDS_START_SIZE 1000
+#define DOT_RECORDS_INCREMENT 1000
+
+struct dot_record {
+    byte code; // H.262: the item's start code, H.264: the access unit's character
+    byte type; // H.262: the picture coding type, H.264: DOT_xxx flags
+    int nal_unit_count; // H.264: NAL units read in the part so far
+};
+
+struct dots_part {
+    struct dot_record* records;
+    int length;
+    int size;
+    int count; // H.262: items found (including slices, which aren't recorded)
+    int nal_unit_count; // H.264: NAL units read in the part
+    int error; // True if reading stopped because of an error
+};
+
+struct dots_parts {
+    int video_type;
+    ES_partition_p partition;
+    struct dots_part* parts; // One per part of `partition`
+};
+
+static int add_dot_record(struct dots_part* part, int code, int type, int nal_unit_count)
+{
+    if (part->length == part->size) {
+        int newsize = part->size + DOT_RECORDS_INCREMENT;
+        struct dot_record* records
+            = (struct dot_record*)realloc(part->records, newsize * sizeof(struct dot_record));
+        if (records == nullptr) {
+            print_err("### Unable to extend list of dots\n");
+            return 1;
+        }
+        part->records = records;
+        part->size = newsize;
+    }
+    part->records[part->length].code = (byte)code;
+    part->records[part->length].type = (byte)type;
+    part->records[part->length].nal_unit_count = nal_unit_count;
+    part->length++;
+    return 0;
+}
+
+/*
+ * Find the H.262 items in one part of a file.
+ *
+ * Returns 0 if all goes well, 1 if we run out of memory.
+ */
+static int find_h262_dots_in_part(ES_p es, struct dots_part* part, offset_t next_start)
+{
+    int err;
+    for (;;) {
+        h262_item_p item;
+        err = find_next_h262_item(es, &item);
+        if (err == EOF)
+            break;
+        else if (err) {
+            part->error = true;
+            break;
+        }
+        // The sequence header at the start of the next part is theirs
+        if (next_start != -1 && item->unit.start_posn.infile >= next_start) {
+            free_h262_item(&item);
+            break;
+        }
+        part->count++;
+        if (item->unit.start_code < 0x01 || item->unit.start_code > 0xAF) {
+            err = add_dot_record(
+                part, item->unit.start_code, item->picture_coding_type, 0);
+            if (err) {
+                free_h262_item(&item);
+                return 1;
+            }
+        }
+        free_h262_item(&item);
+    }
+    return 0;
+}
+
+/*
+ * Find the access units in one part of a file.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int find_h264_dots_in_part(ES_p es, struct dots_part* part)
+{
+    int err;
+    access_unit_context_p context;
+
+    err = build_access_unit_context(es, &context);
+    if (err)
+        return 1;
+
+    for (;;) {
+        access_unit_p access_unit;
+        int gop_start_found = false;
+        int flags = 0;
+        char char_nal_type;
+
+        err = get_next_h264_frame(context, true, false, &access_unit);
+        if (err == EOF)
+            break;
+        else if (err) {
+            part->error = true;
+            break;
+        }
+
+        char_nal_type = choose_nal_type(access_unit, &gop_start_found);
+        if (gop_start_found)
+            flags |= DOT_GOP_START;
+        if (access_unit->primary_start == nullptr)
+            flags |= DOT_NO_PRIMARY;
+        free_access_unit(&access_unit);
+
+        // Whether we stop at an EOS is decided when the dots are shown
+        if (context->end_of_stream) {
+            flags |= DOT_END_OF_STREAM;
+            context->end_of_stream = 0;
+            context->no_more_data = false;
+        }
+
+        err = add_dot_record(part, char_nal_type, flags, context->nac->count);
+        if (err) {
+            free_access_unit_context(&context);
+            return 1;
+        }
+    }
+    part->nal_unit_count = context->nac->count;
+    free_access_unit_context(&context);
+    return 0;
+}
+
+static int find_dots_in_part(ES_p es, int part, void* arg)
+{
+    struct dots_parts* parts = (struct dots_parts*)arg;
+    if (parts->video_type == VIDEO_H262) {
+        offset_t next_start = -1;
+        if (part + 1 < parts->partition->num_parts)
+            next_start = parts->partition->parts[part + 1].start;
+        return find_h262_dots_in_part(es, &parts->parts[part], next_start);
+    } else
+        return find_h264_dots_in_part(es, &parts->parts[part]);
+}
+
+/*
+ * Find the dots for each part of a file, in parallel.
+ *
+ * - `filename` is the name of the file.
+ * - `video_type` is VIDEO_H262 or VIDEO_H264.
+ * - `partition` says how the file is split into GOPs.
+ * - `num_threads` is the number of threads to use.
+ * - `parts` is the new array of what was found in each part, to be freed
+ *   with `free_dots_parts`.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int find_dots_by_GOP(char* filename, int video_type, ES_partition_p partition,
+    int num_threads, struct dots_parts* parts)
+{
+    int err;
+    parts->video_type = video_type;
+    parts->partition = partition;
+    parts->parts = (struct dots_part*)calloc(partition->num_parts, sizeof(struct dots_part));
+    if (parts->parts == nullptr) {
+        print_err("### Unable to allocate dots for each part of the input\n");
+        return 1;
+    }
+    err = analyse_ES_parts(filename, partition, num_threads, find_dots_in_part, parts);
+    if (err)
+        print_err("### Error finding dots in parallel\n");
+    return err;
+}
+
+static void free_dots_parts(struct dots_parts* parts)
+{
+    int ii;
+    if (parts->parts == nullptr)
+        return;
+    for (ii = 0; ii < parts->partition->num_parts; ii++)
+        free(parts->parts[ii].records);
+    free(parts->parts);
+    parts->parts = nullptr;
+}
+
+/*
+ * Simply report on the content of an MPEG2 file as single characters
+ *
+ * - `es` is the input elementary stream
+ * - if `max` is non-zero, then reporting will stop after `max` MPEG items
+ * - if `verbose` is true, then extra information will be output
+ * - if `partition` is not nullptr, then the file (whose name is `filename`)
+ *   will be read in those parts, using `num_threads` threads.
+ *
+ * Returns 0 if it succeeds, 1 if some error occurs.
+ */
+static int report_h262_file_as_dots(ES_p es, int max, int verbose, int show_gop_time,
+    char* filename, ES_partition_p partition, int num_threads)
+{
+    int err;
+    struct h262_dots_totals totals;
+
+    init_h262_dots_totals(&totals);
+
+    if (verbose)
+        print_msg("\n"
+                  "Each character represents a single H.262 item\n"
+                  "Pictures are represented according to their picture coding\n"
+                  "type, and the slices within a picture are not shown.\n"
+                  "    i means an I picture\n"
+                  "    p means a  P picture\n"
+                  "    b means a  B picture\n"
+                  "    d means a  D picture (these should not occur in MPEG-2)\n"
+                  "    x means some other picture (such should not occur)\n"
+                  "Other items are represented as follows:\n"
+                  "    [ means a  Sequence header\n"
+                  "    > means a  Group Start header\n"
+                  "    E means an Extension start header\n"
+                  "    U means a  User data header\n"
+                  "    X means a  Sequence Error\n"
+                  "    ] means a  Sequence End\n"
+                  "    R means a  Reserved item\n"
+                  "    ? means something else. This may indicate that the stream\n"
+                  "      is not an ES representing H.262 (it might, for instance\n"
+                  "      be PES)\n"
+                  "\n");
+
+    if (partition != nullptr) {
+        struct dots_parts parts;
+        int ii, jj;
+        err = find_dots_by_GOP(filename, VIDEO_H262, partition, num_threads, &parts);
+        for (ii = 0; ii < partition->num_parts && !err; ii++) {
+            struct dots_part* part = &parts.parts[ii];
+            for (jj = 0; jj < part->length; jj++)
+                add_h262_item_dot(
+                    part->records[jj].code, part->records[jj].type, show_gop_time, &totals);
+            totals.count += part->count;
+            if (part->error) {
+                print_err("### Error copying NAL units\n");
+                err = 1;
+            }
+        }
+        free_dots_parts(&parts);
+        if (err)
+            return err;
+        print_h262_dots_totals(&totals);
+        return 0;
+    }
+
+    for (;;) {
+        h262_item_p item;
+        err = find_next_h262_item(es, &item);
+        if (err == EOF)
+            break;
+        else if (err) {
+            print_err("### Error copying NAL units\n");
+            return err;
+        }
+        totals.count++;
+        add_h262_item_dot(
+            item->unit.start_code, item->picture_coding_type, show_gop_time, &totals);
+
+        free_h262_item(&item);
+
+        if (max > 0 && totals.count >= max)
+            break;
+    }
+    print_h262_dots_totals(&totals);
+    return 0;
+}
+
 /*
  * Report on data by access unit, as single characters
  * (access unit here means frame or coupled fields)
+ *
+ * If `partition` is not nullptr, then the file (whose name is `filename`)
+ * will be read in those parts, using `num_threads` threads.
+ *
  * Returns 0 if all went well, 1 if something went wrong.
  */
-static int dots_by_access_unit(ES_p es, int max, int verbose, int hash_eos, int show_gop_time)
+static int dots_by_access_unit(ES_p es, int max, int verbose, int hash_eos, int show_gop_time,
+    char* filename, ES_partition_p partition, int num_threads)
 {
 
     int err = 0;
-    int access_unit_count = 0;
     access_unit_context_p context;
 
     int gop_start_found = false;
-    int k_frame = 0;
-    int size_gop;
-    int size_gop_max = 0;
-    int size_gop_min = 100000;
-    int gops = 0;
-    int size_gop_tot = 0;
-    int is_first_k_frame = true;
     char char_nal_type = 'a';
-    unsigned long num_idr = 0;
-    unsigned long num_i = 0;
-    unsigned long num_p = 0;
-    unsigned long num_b = 0;
+    struct h264_dots_totals totals;
+
+    init_h264_dots_totals(&totals);
 
     if (verbose)
         print_msg("\n"
@@ -424,6 +765,44 @@ static int dots_by_access_unit(ES_p es, int max, int verbose, int hash_eos, int
                   "    # means an EOS (end-of-stream) NAL unit.\n"
                   "\n");
 
+    if (partition != nullptr) {
+        struct dots_parts parts;
+        int nal_unit_count = 0;
+        int stopped = false;
+        int ii, jj;
+        err = find_dots_by_GOP(filename, VIDEO_H264, partition, num_threads, &parts);
+        for (ii = 0; ii < partition->num_parts && !err; ii++) {
+            struct dots_part* part = &parts.parts[ii];
+            for (jj = 0; jj < part->length; jj++) {
+                struct dot_record* record = &part->records[jj];
+                if (record->type & DOT_NO_PRIMARY)
+                    print_msg("_");
+                add_access_unit_dot(
+                    record->code, record->type & DOT_GOP_START, show_gop_time, &totals);
+                if (record->type & DOT_END_OF_STREAM) {
+                    if (hash_eos)
+                        print_msg("#");
+                    else {
+                        print_msg("\nStopping because found end-of-stream NAL unit\n");
+                        nal_unit_count += record->nal_unit_count;
+                        stopped = true;
+                        break;
+                    }
+                }
+            }
+            if (stopped)
+                break;
+            else if (part->error)
+                err = 1;
+            nal_unit_count += part->nal_unit_count;
+        }
+        free_dots_parts(&parts);
+        if (err)
+            return err;
+        print_h264_dots_totals(nal_unit_count, &totals);
+        return 0;
+    }
+
     err = build_access_unit_context(es, &context);
     if (err)
         return err;
@@ -441,51 +820,10 @@ static int dots_by_access_unit(ES_p es, int max, int verbose, int hash_eos, int
         }
 
         char_nal_type = choose_nal_type(access_unit, &gop_start_found);
+        if (access_unit->primary_start == nullptr)
+            print_msg("_");
+        add_access_unit_dot(char_nal_type, gop_start_found, show_gop_time, &totals);
 
-        // No real gop exists in h.264 but we try to find the distance between two
-        // random access points. These can be: IDR frame or I frame with a
-        // recovery_point in the SEI
-        if (gop_start_found) {
-            if (!is_first_k_frame) {
-                size_gop = access_unit_count - k_frame;
-                size_gop_max = max(size_gop_max, size_gop);
-                size_gop_min = min(size_gop_min, size_gop);
-                size_gop_tot += size_gop;
-                gops++;
-                if (show_gop_time)
-                    fprint_msg(": %2.4f\n",
-                        (double)size_gop / frame_rate); // that's the time duration of a "GOP"
-                // (if the frame rate is 25fps)
-            }
-            is_first_k_frame = false;
-            k_frame = access_unit_count;
-        }
-
-        switch (char_nal_type) {
-        case 'I':
-        case 'i':
-            num_i++;
-            break;
-        case 'D':
-        case 'd':
-            num_idr++;
-            break;
-        case 'P':
-        case 'p':
-            num_p++;
-            break;
-        case 'B':
-        case 'b':
-            num_b++;
-            break;
-        default:
-            break;
-        }
-
-        fprint_msg("%c", char_nal_type);
-        access_unit_count++;
-
-        fflush(stdout);
         free_access_unit(&access_unit);
 
         // Did the logical stream end after the last access unit?
@@ -507,15 +845,7 @@ static int dots_by_access_unit(ES_p es, int max, int verbose, int hash_eos, int
         }
     }
 
-    fprint_msg("\nFound %d NAL unit%s in %d access unit%s\n", context->nac->count,
-        (context->nac->count == 1 ? "" : "s"), access_unit_count,
-        (access_unit_count == 1 ? "" : "s"));
-    fprint_msg("%lu IDR, %lu I, %lu P, %lu B access units\n", num_idr, num_i, num_p, num_b);
-
-    if (gops) // only if there is more than 1 gop
-        fprint_msg("GOP size (s): max=%2.4f, min=%2.4f, mean=%2.5f (frame rate = %2.2f)\n",
-            (double)size_gop_max / frame_rate, (double)size_gop_min / frame_rate,
-            (double)size_gop_tot / (frame_rate * gops), frame_rate);
+    print_h264_dots_totals(context->nac->count, &totals);
     free_access_unit_context(&context);
     return 0;
 }
@@ -746,6 +1076,8 @@ static void print_usage()
               "  -gop              Show the duration of each GOP (for MPEG-2 steams)\n"
               "                    OR the distance between random access points (H.264)\n"
               "  -fr               Set the video frame rate (default = 25 fps)\n"
+              "  -threads <n>      Split the file into GOPs, and find the entities in\n"
+              "                    them using <n> threads. The output is the same.\n"
               "\n"
               "Stream type:\n"
               "  If input is from a file, then the program will look at the start of\n"
@@ -787,6 +1119,9 @@ int main(int argc, char** argv)
     int want_ES = false;
     int show_gop_time = false;
 
+    int num_threads = 1;
+    ES_partition_p partition = nullptr;
+
     if (argc < 2) {
         print_usage();
         return 0;
@@ -840,6 +1175,14 @@ int main(int argc, char** argv)
                 use_pes = true;
             else if (!strcmp("-gop", argv[ii]))
                 show_gop_time = true;
+            else if (!strcmp("-threads", argv[ii])) {
+                CHECKARG("esdots", ii);
+                err = int_value_in_range(
+                    "esdots", argv[ii], argv[ii + 1], 1, 256, 10, &num_threads);
+                if (err)
+                    return 1;
+                ii++;
+            }
             else if (!strcmp("-fr", argv[ii])) {
                 CHECKARG("esdots", ii);
                 err = double_value("esdots", argv[ii], argv[ii + 1], true, &frame_rate);
@@ -876,18 +1219,33 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    if (num_threads > 1) {
+        if (use_stdin || use_pes || want_ES || max > 0
+            || (is_data != VIDEO_H262 && is_data != VIDEO_H264))
+            print_err("!!! esdots: -threads only applies to H.262 or H.264 ES files"
+                      " (without -es or -max),\n"
+                      "    so ignoring it\n");
+        else if (split_ES_file_by_GOP(
+                     es, is_data, num_threads * GOP_PARTS_PER_THREAD, &partition))
+            print_err("!!! esdots: Unable to split input into GOPs, reading it in one go\n");
+    }
+
     if (want_ES)
         err = report_file_as_ES_dots(es, is_data, max, verbose);
     else if (is_data == VIDEO_H262)
-        err = report_h262_file_as_dots(es, max, verbose, show_gop_time);
+        err = report_h262_file_as_dots(
+            es, max, verbose, show_gop_time, input_name, partition, num_threads);
     else if (is_data == VIDEO_H264)
-        err = dots_by_access_unit(es, max, verbose, hash_eos, show_gop_time);
+        err = dots_by_access_unit(
+            es, max, verbose, hash_eos, show_gop_time, input_name, partition, num_threads);
     else if (is_data == VIDEO_AVS)
         err = report_avs_file_as_dots(es, max, verbose);
     else {
         print_err("### esdots: Unexpected type of video data\n");
     }
 
+    free_ES_partition(&partition);
+
     if (err) {
         print_err("### esdots: Error producing 'dots'\n");
         (void)close_input_as_ES(input_name, &es);
@@ -16,9 +16,12 @@
 #include "accessunit.h"
 #include "avs.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
 #include "filter.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "misc.h"
@@ -26,8 +29,10 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
@@ -690,6 +695,8 @@ static void print_usage()
               "                    (the default is as Elementary Stream)\n"
               "  -pes, -ts         The input file is TS or PS, to be read via the\n"
               "                    PES->ES reading mechanisms. Not allowed with -stdin.\n"
+              "  -pipeline         Read the input and find the ES units in it in a\n"
+              "                    separate thread, overlapping with the filtering.\n"
               "\n"
               "Stream type:\n"
               "  If input is from a file, then the program will look at the start of\n"
@@ -727,6 +734,7 @@ int main(int argc, char** argv)
     int frequency = 8; // The default as stated in the usage
     int quiet = false;
     int verbose = false;
+    int pipeline = false;
     int ii = 1;
 
     int use_pes = false;
@@ -806,6 +814,8 @@ int main(int argc, char** argv)
                 quiet = true;
             } else if (!strcmp("-allref", argv[ii])) {
                 keep_all_ref = true;
+            } else if (!strcmp("-pipeline", argv[ii])) {
+                pipeline = true;
             } else if (!strcmp("-max", argv[ii]) || !strcmp("-m", argv[ii])) {
                 CHECKARG("esfilter", ii);
                 err = int_value("esfilter", argv[ii], argv[ii + 1], true, 10, &max);
@@ -872,6 +882,12 @@ int main(int argc, char** argv)
     if (use_pes)
         set_PES_reader_video_only(es->reader, true);
 
+    if (pipeline && set_ES_pipelining(es, true)) {
+        print_err("### esfilter: Unable to read input in a separate thread\n");
+        (void)close_input_as_ES(input_name, &es);
+        return 1;
+    }
+
     if (is_data == VIDEO_H262)
         stream_type = MPEG2_VIDEO_STREAM_TYPE;
     else if (is_data == VIDEO_H264)
@@ -17,9 +17,12 @@
 #include "audio.h"
 #include "avs.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
 #include "filter.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "l2audio.h"
@@ -28,8 +31,10 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
@@ -131,9 +136,9 @@ static int is_I_or_IDR_frame(access_unit_p frame)
  *
  * Returns 0 if all goes well, 1 if something goes wrong.
  */
-static int merge_with_avs(avs_context_p video_context, int audio_file, TS_writer_p output,
-    int audio_type, int audio_samples_per_frame, int audio_sample_rate, double video_frame_rate,
-    int pat_pmt_freq, int quiet, int verbose, int debugging)
+static int merge_with_avs(avs_context_p video_context, audio_reader_p audio_reader,
+    TS_writer_p output, int audio_type, int audio_samples_per_frame, int audio_sample_rate,
+    double video_frame_rate, int pat_pmt_freq, int quiet, int verbose, int debugging)
 {
     int ii;
     int err;
@@ -235,7 +240,7 @@ static int merge_with_avs(avs_context_p video_context, int audio_file, TS_writer
 
         if (got_video) {
             video_time = video_frame_count / video_frame_rate;
-            video_pts += video_pts_increment;
+            video_pts = pts_add(video_pts, video_pts_increment);
             video_frame_count++;
             if (verbose)
                 fprint_msg("\n%s video frame %5d (@ %.2fs, " LLU_FORMAT ")\n",
@@ -270,7 +275,7 @@ static int merge_with_avs(avs_context_p video_context, int audio_file, TS_writer
             // easier just to add a delay to allow for progress through the decoder)
             if (is_avs_I_frame(avs_frame))
                 err = write_avs_frame_as_TS_with_pts_dts(avs_frame, output, DEFAULT_VIDEO_PID,
-                    true, video_pts + 30000, true, video_pts);
+                    true, pts_add(video_pts, 30000), true, video_pts);
             else
                 err = write_avs_frame_as_TS_with_PCR(
                     avs_frame, output, DEFAULT_VIDEO_PID, video_pts, 0);
@@ -286,8 +291,8 @@ static int merge_with_avs(avs_context_p video_context, int audio_file, TS_writer
             continue;
 
         // Then output enough audio frames to make up to a similar time
-        while (audio_pts < video_pts || !got_video) {
-            err = read_next_audio_frame(audio_file, audio_type, &aframe);
+        while (pts_before(audio_pts, video_pts) || !got_video) {
+            err = get_next_audio_frame(audio_reader, &aframe);
             if (err == EOF) {
                 if (verbose)
                     print_msg("EOF: no more audio data\n");
@@ -297,7 +302,7 @@ static int merge_with_avs(avs_context_p video_context, int audio_file, TS_writer
                 return 1;
 
             audio_time = audio_frame_count * audio_samples_per_frame / (double)audio_sample_rate;
-            audio_pts += audio_pts_increment;
+            audio_pts = pts_add(audio_pts, audio_pts_increment);
             audio_frame_count++;
             if (verbose)
                 fprint_msg("** audio frame %5d (@ %.2fs, " LLU_FORMAT ")\n", audio_frame_count,
@@ -324,6 +329,11 @@ static int merge_with_avs(avs_context_p video_context, int audio_file, TS_writer
         fprint_msg("Read %d audio frame%s, %.2fs elapsed (%dm %.2fs)\n", audio_frame_count,
             (audio_frame_count == 1 ? "" : "s"), audio_elapsed / 100.0, audio_elapsed / 6000,
             (audio_elapsed % 6000) / 100.0);
+        if (audio_reader->num_resyncs > 0)
+            fprint_msg("Lost audio synchronisation %u time%s, skipping " OFFSET_T_FORMAT
+                       " byte%s\n",
+                audio_reader->num_resyncs, (audio_reader->num_resyncs == 1 ? "" : "s"),
+                audio_reader->bytes_skipped, (audio_reader->bytes_skipped == 1 ? "" : "s"));
     }
 
     return 0;
@@ -334,9 +344,9 @@ static int merge_with_avs(avs_context_p video_context, int audio_file, TS_writer
  *
  * Returns 0 if all goes well, 1 if something goes wrong.
  */
-static int merge_with_h264(access_unit_context_p video_context, int audio_file, TS_writer_p output,
-    int audio_type, int audio_samples_per_frame, int audio_sample_rate, int video_frame_rate,
-    int pat_pmt_freq, int quiet, int verbose, int debugging)
+static int merge_with_h264(access_unit_context_p video_context, audio_reader_p audio_reader,
+    TS_writer_p output, int audio_type, int audio_samples_per_frame, int audio_sample_rate,
+    int video_frame_rate, int pat_pmt_freq, int quiet, int verbose, int debugging)
 {
     int ii;
     int err;
@@ -423,7 +433,7 @@ static int merge_with_h264(access_unit_context_p video_context, int audio_file,
 
         if (got_video) {
             video_time = video_frame_count / (double)video_frame_rate;
-            video_pts += video_pts_increment;
+            video_pts = pts_add(video_pts, video_pts_increment);
             video_frame_count++;
             if (verbose)
                 fprint_msg("\n%s video frame %5d (@ %.2fs, " LLU_FORMAT ")\n",
@@ -454,7 +464,7 @@ static int merge_with_h264(access_unit_context_p video_context, int audio_file,
             // but might as well only do it on index frames.
             if (is_I_or_IDR_frame(access_unit))
                 err = write_access_unit_as_TS_with_pts_dts(access_unit, video_context, output,
-                    DEFAULT_VIDEO_PID, true, video_pts + 45000, true, video_pts);
+                    DEFAULT_VIDEO_PID, true, pts_add(video_pts, 45000), true, video_pts);
             else
                 err = write_access_unit_as_TS_with_PCR(
                     access_unit, video_context, output, DEFAULT_VIDEO_PID, video_pts, 0);
@@ -477,8 +487,8 @@ static int merge_with_h264(access_unit_context_p video_context, int audio_file,
             continue;
 
         // Then output enough audio frames to make up to a similar time
-        while (audio_pts < video_pts || !got_video) {
-            err = read_next_audio_frame(audio_file, audio_type, &aframe);
+        while (pts_before(audio_pts, video_pts) || !got_video) {
+            err = get_next_audio_frame(audio_reader, &aframe);
             if (err == EOF) {
                 if (verbose)
                     print_msg("EOF: no more audio data\n");
@@ -488,7 +498,7 @@ static int merge_with_h264(access_unit_context_p video_context, int audio_file,
                 return 1;
 
             audio_time = audio_frame_count * audio_samples_per_frame / (double)audio_sample_rate;
-            audio_pts += audio_pts_increment;
+            audio_pts = pts_add(audio_pts, audio_pts_increment);
             audio_frame_count++;
             if (verbose)
                 fprint_msg("** audio frame %5d (@ %.2fs, " LLU_FORMAT ")\n", audio_frame_count,
@@ -515,6 +525,11 @@ static int merge_with_h264(access_unit_context_p video_context, int audio_file,
         fprint_msg("Read %d audio frame%s, %.2fs elapsed (%dm %.2fs)\n", audio_frame_count,
             (audio_frame_count == 1 ? "" : "s"), audio_elapsed / 100.0, audio_elapsed / 6000,
             (audio_elapsed % 6000) / 100.0);
+        if (audio_reader->num_resyncs > 0)
+            fprint_msg("Lost audio synchronisation %u time%s, skipping " OFFSET_T_FORMAT
+                       " byte%s\n",
+                audio_reader->num_resyncs, (audio_reader->num_resyncs == 1 ? "" : "s"),
+                audio_reader->bytes_skipped, (audio_reader->bytes_skipped == 1 ? "" : "s"));
     }
 
     return 0;
@@ -583,6 +598,7 @@ int main(int argc, char** argv)
     access_unit_context_p h264_video_context = nullptr;
     avs_context_p avs_video_context = nullptr;
     int audio_file = -1;
+    audio_reader_p audio_reader = nullptr;
     TS_writer_p output = nullptr;
     int quiet = false;
     int verbose = false;
@@ -743,6 +759,17 @@ int main(int argc, char** argv)
         free_avs_context(&avs_video_context);
         return 1;
     }
+    err = build_audio_reader(audio_file, audio_type, false, &audio_reader);
+    if (err) {
+        print_err("### esmerge: "
+                  "Problem setting up to read audio file - abandoning reading\n");
+        close_elementary_stream(&video_es);
+        free_audio_reader(&audio_reader);
+        close_file(audio_file);
+        free_access_unit_context(&h264_video_context);
+        free_avs_context(&avs_video_context);
+        return 1;
+    }
 
     err = tswrite_open(TS_W_FILE, output_name, nullptr, 0, quiet, &output);
     if (err) {
@@ -750,6 +777,7 @@ int main(int argc, char** argv)
                    "Problem opening output file %s - abandoning reading\n",
             output_name);
         close_elementary_stream(&video_es);
+        free_audio_reader(&audio_reader);
         close_file(audio_file);
         free_access_unit_context(&h264_video_context);
         free_avs_context(&avs_video_context);
@@ -782,11 +810,11 @@ int main(int argc, char** argv)
     }
 
     if (video_type == VIDEO_H264)
-        err = merge_with_h264(h264_video_context, audio_file, output, audio_type,
+        err = merge_with_h264(h264_video_context, audio_reader, output, audio_type,
             audio_samples_per_frame, audio_sample_rate, video_frame_rate, pat_pmt_freq, quiet,
             verbose, debugging);
     else if (video_type == VIDEO_AVS)
-        err = merge_with_avs(avs_video_context, audio_file, output, audio_type,
+        err = merge_with_avs(avs_video_context, audio_reader, output, audio_type,
             audio_samples_per_frame, audio_sample_rate, video_frame_rate, pat_pmt_freq, quiet,
             verbose, debugging);
     else {
@@ -796,6 +824,7 @@ int main(int argc, char** argv)
     if (err) {
         print_err("### esmerge: Error merging video and audio streams\n");
         close_elementary_stream(&video_es);
+        free_audio_reader(&audio_reader);
         close_file(audio_file);
         free_access_unit_context(&h264_video_context);
         free_avs_context(&avs_video_context);
@@ -804,6 +833,7 @@ int main(int argc, char** argv)
     }
 
     close_elementary_stream(&video_es);
+    free_audio_reader(&audio_reader);
     close_file(audio_file);
     free_access_unit_context(&h264_video_context);
     free_avs_context(&avs_video_context);
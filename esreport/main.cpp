@@ -17,10 +17,14 @@
 #include "adts.h"
 #include "audio.h"
 #include "avs.h"
+#include "batch.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
 #include "filter.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "l2audio.h"
@@ -29,8 +33,10 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
@@ -288,38 +294,55 @@ static void find_h262_fields(ES_p es, int max, int verbose)
         num_sequence_ends, (num_sequence_ends == 1 ? "" : "s"));
 }
 
-/*
- * Report on the content of an MPEG2 file
- *
- * - `es` is the input elementary stream
- * - if `max` is non-zero, then reporting will stop after `max` MPEG items
- * - if `verbose` is true, then extra information will be output
- * - if `quiet` is true, then only errors will be reported
- * - if `count_sizes` is true, then a summary of frame sizes will be kept
- */
-static void report_h262_frames(ES_p es, int max, int verbose, int quiet, int count_sizes)
-{
-    int err;
-    int count = 0;
-    int num_frames = 0;
-    int num_sequence_headers = 0;
-    int num_sequence_ends = 0;
+// What we gather when reporting on the frames in (part of) an MPEG2 file
+struct h262_frame_stats {
+    int count;
+    int num_frames;
+    int num_sequence_headers;
+    int num_sequence_ends;
 
-    uint32_t min_frame_size = 1000000;
-    uint32_t max_frame_size = 0;
-    uint32_t sum_frame_size = 0;
+    uint32_t min_frame_size;
+    uint32_t max_frame_size;
+    uint32_t sum_frame_size;
 
     // I=1, P=2, B=3, D=4 -- so subtract one before using the picture coding type
     // as an index into the arrays...
-    uint32_t min_x_frame_size[4] = { 1000000, 1000000, 1000000, 1000000 };
-    uint32_t max_x_frame_size[4] = { 0, 0, 0, 0 };
-    uint32_t sum_x_frame_size[4] = { 0, 0, 0, 0 };
-    int num_x_frames[4] = { 0, 0, 0, 0 };
+    uint32_t min_x_frame_size[4];
+    uint32_t max_x_frame_size[4];
+    uint32_t sum_x_frame_size[4];
+    int num_x_frames[4];
 
-    uint32_t min_seq_hdr_size = 1000000;
-    uint32_t max_seq_hdr_size = 0;
-    uint32_t sum_seq_hdr_size = 0;
+    uint32_t min_seq_hdr_size;
+    uint32_t max_seq_hdr_size;
+    uint32_t sum_seq_hdr_size;
+
+    int stopped_early; // True if we stopped before the end of the data
+};
 
+static void init_h262_frame_stats(struct h262_frame_stats* stats)
+{
+    int ii;
+    memset(stats, 0, sizeof(*stats));
+    stats->min_frame_size = 1000000;
+    stats->min_seq_hdr_size = 1000000;
+    for (ii = 0; ii < 4; ii++)
+        stats->min_x_frame_size[ii] = 1000000;
+}
+
+/*
+ * Count the frames (and sizes thereof) in an MPEG2 file, or part thereof
+ *
+ * Arguments are as for `report_h262_frames`, plus:
+ *
+ * - `stats` is the statistics to add to, which should have been set up
+ *   with `init_h262_frame_stats`.
+ *
+ * Returns 0 if all goes well, 1 if the H.262 reader could not be built.
+ */
+static int count_h262_frames(
+    ES_p es, int max, int verbose, int quiet, int count_sizes, struct h262_frame_stats* stats)
+{
+    int err;
     ES_offset start;
     uint32_t length;
 
@@ -328,7 +351,7 @@ static void report_h262_frames(ES_p es, int max, int verbose, int quiet, int cou
     err = build_h262_context(es, &h262);
     if (err) {
         print_err("### Error trying to build H.262 reader from ES reader\n");
-        return;
+        return 1;
     }
 
     for (;;) {
@@ -339,9 +362,10 @@ static void report_h262_frames(ES_p es, int max, int verbose, int quiet, int cou
             break;
         else if (err) {
             print_err("### Error getting next H.262 picture\n");
+            stats->stopped_early = true;
             break;
         }
-        count++;
+        stats->count++;
 
         if (!quiet)
             report_h262_picture(picture, false);
@@ -351,62 +375,105 @@ static void report_h262_frames(ES_p es, int max, int verbose, int quiet, int cou
         if (picture->is_picture) {
             if (count_sizes) {
                 err = get_ES_unit_list_bounds(picture->list, &start, &length);
-                if (err)
+                if (err) {
+                    stats->stopped_early = true;
                     break;
-                if (min_frame_size > length)
-                    min_frame_size = length;
-                if (max_frame_size < length)
-                    max_frame_size = length;
-                sum_frame_size += length;
+                }
+                if (stats->min_frame_size > length)
+                    stats->min_frame_size = length;
+                if (stats->max_frame_size < length)
+                    stats->max_frame_size = length;
+                stats->sum_frame_size += length;
                 if (picture->picture_coding_type < 5
                     && picture->picture_coding_type > 0) // paranoia - check for array bounds
                 {
                     // I, P, B or D frame
                     int ii = picture->picture_coding_type - 1;
-                    if (min_x_frame_size[ii] > length)
-                        min_x_frame_size[ii] = length;
-                    if (max_x_frame_size[ii] < length)
-                        max_x_frame_size[ii] = length;
-                    sum_x_frame_size[ii] += length;
+                    if (stats->min_x_frame_size[ii] > length)
+                        stats->min_x_frame_size[ii] = length;
+                    if (stats->max_x_frame_size[ii] < length)
+                        stats->max_x_frame_size[ii] = length;
+                    stats->sum_x_frame_size[ii] += length;
                 }
             }
-            num_frames++;
+            stats->num_frames++;
             if (picture->picture_coding_type < 5
                 && picture->picture_coding_type > 0) // paranoia - check for array bounds
-                num_x_frames[picture->picture_coding_type - 1]++;
+                stats->num_x_frames[picture->picture_coding_type - 1]++;
         } else if (picture->is_sequence_header) {
             if (count_sizes) {
                 err = get_ES_unit_list_bounds(picture->list, &start, &length);
-                if (err)
+                if (err) {
+                    stats->stopped_early = true;
                     break;
-                if (min_seq_hdr_size > length)
-                    min_seq_hdr_size = length;
-                if (max_seq_hdr_size < length)
-                    max_seq_hdr_size = length;
-                sum_seq_hdr_size += length;
+                }
+                if (stats->min_seq_hdr_size > length)
+                    stats->min_seq_hdr_size = length;
+                if (stats->max_seq_hdr_size < length)
+                    stats->max_seq_hdr_size = length;
+                stats->sum_seq_hdr_size += length;
             }
-            num_sequence_headers++;
+            stats->num_sequence_headers++;
         } else
-            num_sequence_ends++;
+            stats->num_sequence_ends++;
 
         free_h262_picture(&picture);
 
-        if (max > 0 && count >= max)
+        if (max > 0 && stats->count >= max) {
+            stats->stopped_early = true;
             break;
+        }
     }
     free_h262_context(&h262);
+    return 0;
+}
+
+/*
+ * Add the statistics for one part of an MPEG2 file to those for the
+ * parts before it.
+ */
+static void merge_h262_frame_stats(struct h262_frame_stats* dst, struct h262_frame_stats* src)
+{
+    int ii;
+    dst->count += src->count;
+    dst->num_frames += src->num_frames;
+    dst->num_sequence_headers += src->num_sequence_headers;
+    dst->num_sequence_ends += src->num_sequence_ends;
+    if (dst->min_frame_size > src->min_frame_size)
+        dst->min_frame_size = src->min_frame_size;
+    if (dst->max_frame_size < src->max_frame_size)
+        dst->max_frame_size = src->max_frame_size;
+    dst->sum_frame_size += src->sum_frame_size;
+    for (ii = 0; ii < 4; ii++) {
+        if (dst->min_x_frame_size[ii] > src->min_x_frame_size[ii])
+            dst->min_x_frame_size[ii] = src->min_x_frame_size[ii];
+        if (dst->max_x_frame_size[ii] < src->max_x_frame_size[ii])
+            dst->max_x_frame_size[ii] = src->max_x_frame_size[ii];
+        dst->sum_x_frame_size[ii] += src->sum_x_frame_size[ii];
+        dst->num_x_frames[ii] += src->num_x_frames[ii];
+    }
+    if (dst->min_seq_hdr_size > src->min_seq_hdr_size)
+        dst->min_seq_hdr_size = src->min_seq_hdr_size;
+    if (dst->max_seq_hdr_size < src->max_seq_hdr_size)
+        dst->max_seq_hdr_size = src->max_seq_hdr_size;
+    dst->sum_seq_hdr_size += src->sum_seq_hdr_size;
+    dst->stopped_early = src->stopped_early;
+}
 
+static void print_h262_frame_stats(struct h262_frame_stats* stats, int count_sizes)
+{
     fprint_msg("Found %d MPEG-2 'picture'%s:\n"
                "   %5d frame%s (%d I, %d P, %d B, %d D)\n"
                "   %5d sequence header%s\n"
                "   %5d sequence end%s\n",
-        count, (count == 1 ? "" : "s"), num_frames, (num_frames == 1 ? "" : "s"), num_x_frames[0],
-        num_x_frames[1], num_x_frames[2], num_x_frames[3], num_sequence_headers,
-        (num_sequence_headers == 1 ? "" : "s"), num_sequence_ends,
-        (num_sequence_ends == 1 ? "" : "s"));
+        stats->count, (stats->count == 1 ? "" : "s"), stats->num_frames,
+        (stats->num_frames == 1 ? "" : "s"), stats->num_x_frames[0], stats->num_x_frames[1],
+        stats->num_x_frames[2], stats->num_x_frames[3], stats->num_sequence_headers,
+        (stats->num_sequence_headers == 1 ? "" : "s"), stats->num_sequence_ends,
+        (stats->num_sequence_ends == 1 ? "" : "s"));
 
     {
-        double total_seconds = num_frames / (double)FRAMES_PER_SECOND;
+        double total_seconds = stats->num_frames / (double)FRAMES_PER_SECOND;
         int minutes = (int)(total_seconds / 60);
         double seconds = total_seconds - 60 * minutes;
         fprint_msg(
@@ -415,26 +482,46 @@ static void report_h262_frames(ES_p es, int max, int verbose, int quiet, int cou
 
     if (count_sizes) {
         int ii;
-        if (num_frames > 0)
-            fprint_msg("Frame sizes ranged from %5u to %7u bytes, mean %9.2f\n", min_frame_size,
-                max_frame_size, sum_frame_size / (double)num_frames);
+        if (stats->num_frames > 0)
+            fprint_msg("Frame sizes ranged from %5u to %7u bytes, mean %9.2f\n",
+                stats->min_frame_size, stats->max_frame_size,
+                stats->sum_frame_size / (double)stats->num_frames);
         for (ii = 0; ii < 4; ii++) {
-            if (num_x_frames[ii] > 0)
+            if (stats->num_x_frames[ii] > 0)
                 fprint_msg("          %s frames from %5u to %7u bytes, mean %9.2f\n",
-                    H262_PICTURE_CODING_STR(ii), min_x_frame_size[ii], max_x_frame_size[ii],
-                    sum_x_frame_size[ii] / (double)num_x_frames[ii]);
+                    H262_PICTURE_CODING_STR(ii), stats->min_x_frame_size[ii],
+                    stats->max_x_frame_size[ii],
+                    stats->sum_x_frame_size[ii] / (double)stats->num_x_frames[ii]);
         }
-        if (num_sequence_headers > 0) {
-            if (min_seq_hdr_size == max_seq_hdr_size)
-                fprint_msg("Sequence headers were all %u bytes\n", min_seq_hdr_size);
+        if (stats->num_sequence_headers > 0) {
+            if (stats->min_seq_hdr_size == stats->max_seq_hdr_size)
+                fprint_msg("Sequence headers were all %u bytes\n", stats->min_seq_hdr_size);
             else
                 fprint_msg("Sequence headers    from %5u to %7u bytes, mean %9.2f\n",
-                    min_seq_hdr_size, max_seq_hdr_size,
-                    sum_seq_hdr_size / (double)num_sequence_headers);
+                    stats->min_seq_hdr_size, stats->max_seq_hdr_size,
+                    stats->sum_seq_hdr_size / (double)stats->num_sequence_headers);
         }
     }
 }
 
+/*
+ * Report on the content of an MPEG2 file
+ *
+ * - `es` is the input elementary stream
+ * - if `max` is non-zero, then reporting will stop after `max` MPEG items
+ * - if `verbose` is true, then extra information will be output
+ * - if `quiet` is true, then only errors will be reported
+ * - if `count_sizes` is true, then a summary of frame sizes will be kept
+ */
+static void report_h262_frames(ES_p es, int max, int verbose, int quiet, int count_sizes)
+{
+    struct h262_frame_stats stats;
+    init_h262_frame_stats(&stats);
+    if (count_h262_frames(es, max, verbose, quiet, count_sizes, &stats))
+        return;
+    print_h262_frame_stats(&stats, count_sizes);
+}
+
 /*
  * Report on changes in AFD in an MPEG2 file
  *
@@ -676,22 +763,6 @@ static void find_h264_fields(ES_p es, int max, int quiet, int verbose, int show_
     free_access_unit_context(&context);
 }
 
-/*
- * Report on data by access unit.
- */
-static void report_h264_frames(ES_p es, int max, int quiet, int verbose, int show_nal_details,
-    int count_sizes, int count_types)
-{
-    int err = 0;
-    int access_unit_count = 0;
-    access_unit_context_p context;
-
-    uint32_t min_frame_size = 1000000;
-    uint32_t max_frame_size = 0;
-    uint32_t sum_frame_size = 0;
-
-    uint32_t num_with_PTS = 0;
-
 #define I_NON_REF 0
 #define I_REF_IDR 1
 #define I_REF_NON_IDR 2
@@ -700,15 +771,56 @@ static void report_h264_frames(ES_p es, int max, int quiet, int verbose, int sho
 #define I_SLICE_P 1
 #define I_SLICE_B 2
 #define I_SLICE_MIX 3
-    uint32_t slice_types[3][4] = { { 0 }, { 0 } };
-    uint32_t slice_categories[4] = { 0 };
+
+// What we gather when reporting on the access units in (part of) an H.264 file
+struct h264_frame_stats {
+    int access_unit_count;
+    int nal_unit_count;
+
+    uint32_t min_frame_size;
+    uint32_t max_frame_size;
+    uint32_t sum_frame_size;
+
+    uint32_t num_with_PTS;
+
+    uint32_t slice_types[3][4];
+    uint32_t slice_categories[4];
+
+    // Note that `access_unit_count` includes the attempt to read an access
+    // unit that found the end of the data (or an error), and that
+    int read_past_end; // is true if that happened
+    int stopped_early; // True if we stopped before the end of the data
+};
+
+static void init_h264_frame_stats(struct h264_frame_stats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->min_frame_size = 1000000;
+}
+
+/*
+ * Count the access units (and sizes and types thereof) in an H.264 file,
+ * or part thereof
+ *
+ * Arguments are as for `report_h264_frames`, plus:
+ *
+ * - `stats` is the statistics to add to, which should have been set up
+ *   with `init_h264_frame_stats`.
+ *
+ * Returns 0 if all goes well, 1 if the access unit reader could not be built.
+ */
+static int count_h264_frames(ES_p es, int max, int quiet, int verbose, int show_nal_details,
+    int count_sizes, int count_types, struct h264_frame_stats* stats)
+{
+    int err = 0;
+    access_unit_context_p context;
 
     ES_offset start;
     uint32_t length;
 
     err = build_access_unit_context(es, &context);
     if (err)
-        return;
+        return 1;
 
     if (show_nal_details)
         set_show_nal_reading_details(context->nac, true);
@@ -716,64 +828,62 @@ static void report_h264_frames(ES_p es, int max, int quiet, int verbose, int sho
     for (;;) {
         access_unit_p access_unit;
 
-        access_unit_count++;
+        stats->access_unit_count++;
 
         err = get_next_h264_frame(context, quiet, verbose, &access_unit);
-        if (err)
+        if (err) {
+            stats->read_past_end = true;
+            if (err != EOF)
+                stats->stopped_early = true;
             break;
+        }
 
         if (!quiet)
             report_access_unit(access_unit);
 
         if (count_sizes) {
             err = get_access_unit_bounds(access_unit, &start, &length);
-            if (err)
+            if (err) {
+                stats->stopped_early = true;
                 break;
-            if (min_frame_size > length)
-                min_frame_size = length;
-            if (max_frame_size < length)
-                max_frame_size = length;
-            sum_frame_size += length;
+            }
+            if (stats->min_frame_size > length)
+                stats->min_frame_size = length;
+            if (stats->max_frame_size < length)
+                stats->max_frame_size = length;
+            stats->sum_frame_size += length;
         }
 
         if (count_types && access_unit->primary_start != nullptr) {
+            uint32_t* slice_types;
             if (access_unit->primary_start->nal_ref_idc == 0) {
-                slice_categories[I_NON_REF]++;
-                if (all_slices_I(access_unit))
-                    slice_types[I_NON_REF][I_SLICE_I]++;
-                else if (all_slices_P(access_unit))
-                    slice_types[I_NON_REF][I_SLICE_P]++;
-                else if (all_slices_B(access_unit))
-                    slice_types[I_NON_REF][I_SLICE_B]++;
-                else
-                    slice_types[I_NON_REF][I_SLICE_MIX]++;
+                stats->slice_categories[I_NON_REF]++;
+                slice_types = stats->slice_types[I_NON_REF];
             } else if (access_unit->primary_start->nal_unit_type == NAL_IDR) {
                 // Yes, I know that only I and SI frames should be allowed for IDR
-                slice_categories[I_REF_IDR]++;
-                if (all_slices_I(access_unit))
-                    slice_types[I_REF_IDR][I_SLICE_I]++;
-                else if (all_slices_P(access_unit))
-                    slice_types[I_REF_IDR][I_SLICE_P]++;
-                else if (all_slices_B(access_unit))
-                    slice_types[I_REF_IDR][I_SLICE_B]++;
-                else
-                    slice_types[I_REF_IDR][I_SLICE_MIX]++;
+                stats->slice_categories[I_REF_IDR]++;
+                slice_types = stats->slice_types[I_REF_IDR];
             } else if (access_unit->primary_start->nal_unit_type == NAL_NON_IDR) {
-                slice_categories[I_REF_NON_IDR]++;
-                if (all_slices_I(access_unit))
-                    slice_types[I_REF_NON_IDR][I_SLICE_I]++;
-                else if (all_slices_P(access_unit))
-                    slice_types[I_REF_NON_IDR][I_SLICE_P]++;
-                else if (all_slices_B(access_unit))
-                    slice_types[I_REF_NON_IDR][I_SLICE_B]++;
-                else
-                    slice_types[I_REF_NON_IDR][I_SLICE_MIX]++;
-            } else
-                slice_categories[I_OTHER]++;
+                stats->slice_categories[I_REF_NON_IDR]++;
+                slice_types = stats->slice_types[I_REF_NON_IDR];
+            } else {
+                stats->slice_categories[I_OTHER]++;
+                slice_types = nullptr;
+            }
+            if (slice_types == nullptr)
+                ;
+            else if (all_slices_I(access_unit))
+                slice_types[I_SLICE_I]++;
+            else if (all_slices_P(access_unit))
+                slice_types[I_SLICE_P]++;
+            else if (all_slices_B(access_unit))
+                slice_types[I_SLICE_B]++;
+            else
+                slice_types[I_SLICE_MIX]++;
         }
 
         if (access_unit_has_PTS(access_unit))
-            num_with_PTS++;
+            stats->num_with_PTS++;
 
         free_access_unit(&access_unit);
 
@@ -781,59 +891,80 @@ static void report_h264_frames(ES_p es, int max, int quiet, int verbose, int sho
         if (context->end_of_stream) {
             if (!quiet)
                 print_msg("Found End-of-stream NAL unit\n");
+            stats->stopped_early = true;
             break;
         }
 
-        if (max > 0 && access_unit_count >= max) {
-            fprint_msg(
-                "\nStopping because (at least) %d frames have been read\n", access_unit_count);
+        if (max > 0 && stats->access_unit_count >= max) {
+            fprint_msg("\nStopping because (at least) %d frames have been read\n",
+                stats->access_unit_count);
+            stats->stopped_early = true;
             break;
         }
     }
+    stats->nal_unit_count += context->nac->count;
+    free_access_unit_context(&context);
+    return 0;
+}
 
-    fprint_msg("Found %d frame%s (%d NAL unit%s)\n", access_unit_count,
-        (access_unit_count == 1 ? "" : "s"), context->nac->count,
-        (context->nac->count == 1 ? "" : "s"));
+/*
+ * Add the statistics for one part of an H.264 file to those for the
+ * parts before it.
+ */
+static void merge_h264_frame_stats(struct h264_frame_stats* dst, struct h264_frame_stats* src)
+{
+    int ii, jj;
+    // Only the last part gets to count its attempt to read past its end
+    if (dst->read_past_end)
+        dst->access_unit_count--;
+    dst->access_unit_count += src->access_unit_count;
+    dst->read_past_end = src->read_past_end;
+    dst->nal_unit_count += src->nal_unit_count;
+    if (dst->min_frame_size > src->min_frame_size)
+        dst->min_frame_size = src->min_frame_size;
+    if (dst->max_frame_size < src->max_frame_size)
+        dst->max_frame_size = src->max_frame_size;
+    dst->sum_frame_size += src->sum_frame_size;
+    dst->num_with_PTS += src->num_with_PTS;
+    for (ii = 0; ii < 3; ii++)
+        for (jj = 0; jj < 4; jj++)
+            dst->slice_types[ii][jj] += src->slice_types[ii][jj];
+    for (ii = 0; ii < 4; ii++)
+        dst->slice_categories[ii] += src->slice_categories[ii];
+    dst->stopped_early = src->stopped_early;
+}
 
-    if (count_types) {
-        if (slice_categories[I_NON_REF] > 0) {
-            print_msg("Non-reference frames:\n");
-            if (slice_types[I_NON_REF][I_SLICE_I] != 0)
-                fprint_msg("   I frames    %7d\n", slice_types[I_NON_REF][I_SLICE_I]);
-            if (slice_types[I_NON_REF][I_SLICE_P] != 0)
-                fprint_msg("   P frames    %7d\n", slice_types[I_NON_REF][I_SLICE_P]);
-            if (slice_types[I_NON_REF][I_SLICE_B] != 0)
-                fprint_msg("   B frames    %7d\n", slice_types[I_NON_REF][I_SLICE_B]);
-            if (slice_types[I_NON_REF][I_SLICE_MIX] != 0)
-                fprint_msg("   Mixed/other %7d\n", slice_types[I_NON_REF][I_SLICE_MIX]);
-        }
+static void print_h264_slice_types(const char* what, uint32_t* slice_types)
+{
+    print_msg(what);
+    if (slice_types[I_SLICE_I] != 0)
+        fprint_msg("   I frames    %7d\n", slice_types[I_SLICE_I]);
+    if (slice_types[I_SLICE_P] != 0)
+        fprint_msg("   P frames    %7d\n", slice_types[I_SLICE_P]);
+    if (slice_types[I_SLICE_B] != 0)
+        fprint_msg("   B frames    %7d\n", slice_types[I_SLICE_B]);
+    if (slice_types[I_SLICE_MIX] != 0)
+        fprint_msg("   Mixed/other %7d\n", slice_types[I_SLICE_MIX]);
+}
 
-        if (slice_categories[I_REF_IDR] > 0) {
-            print_msg("IDR frames\n");
-            if (slice_types[I_REF_IDR][I_SLICE_I] != 0)
-                fprint_msg("   I frames    %7d\n", slice_types[I_REF_IDR][I_SLICE_I]);
-            if (slice_types[I_REF_IDR][I_SLICE_P] != 0)
-                fprint_msg("   P frames    %7d\n", slice_types[I_REF_IDR][I_SLICE_P]);
-            if (slice_types[I_REF_IDR][I_SLICE_B] != 0)
-                fprint_msg("   B frames    %7d\n", slice_types[I_REF_IDR][I_SLICE_B]);
-            if (slice_types[I_REF_IDR][I_SLICE_MIX] != 0)
-                fprint_msg("   Mixed/other %7d\n", slice_types[I_REF_IDR][I_SLICE_MIX]);
-        }
+static void print_h264_frame_stats(struct h264_frame_stats* stats, int count_sizes, int count_types)
+{
+    int access_unit_count = stats->access_unit_count;
 
-        if (slice_categories[I_REF_NON_IDR] > 0) {
-            print_msg("Non-IDR reference frames:\n");
-            if (slice_types[I_REF_NON_IDR][I_SLICE_I] != 0)
-                fprint_msg("   I frames    %7d\n", slice_types[I_REF_NON_IDR][I_SLICE_I]);
-            if (slice_types[I_REF_NON_IDR][I_SLICE_P] != 0)
-                fprint_msg("   P frames    %7d\n", slice_types[I_REF_NON_IDR][I_SLICE_P]);
-            if (slice_types[I_REF_NON_IDR][I_SLICE_B] != 0)
-                fprint_msg("   B frames    %7d\n", slice_types[I_REF_NON_IDR][I_SLICE_B]);
-            if (slice_types[I_REF_NON_IDR][I_SLICE_MIX] != 0)
-                fprint_msg("   Mixed/other %7d\n", slice_types[I_REF_NON_IDR][I_SLICE_MIX]);
-        }
+    fprint_msg("Found %d frame%s (%d NAL unit%s)\n", access_unit_count,
+        (access_unit_count == 1 ? "" : "s"), stats->nal_unit_count,
+        (stats->nal_unit_count == 1 ? "" : "s"));
 
-        if (slice_categories[I_OTHER] > 0)
-            fprint_msg("Other frame types: %d\n", slice_categories[I_OTHER]);
+    if (count_types) {
+        if (stats->slice_categories[I_NON_REF] > 0)
+            print_h264_slice_types("Non-reference frames:\n", stats->slice_types[I_NON_REF]);
+        if (stats->slice_categories[I_REF_IDR] > 0)
+            print_h264_slice_types("IDR frames\n", stats->slice_types[I_REF_IDR]);
+        if (stats->slice_categories[I_REF_NON_IDR] > 0)
+            print_h264_slice_types(
+                "Non-IDR reference frames:\n", stats->slice_types[I_REF_NON_IDR]);
+        if (stats->slice_categories[I_OTHER] > 0)
+            fprint_msg("Other frame types: %d\n", stats->slice_categories[I_OTHER]);
     }
 
     {
@@ -845,12 +976,128 @@ static void report_h264_frames(ES_p es, int max, int quiet, int verbose, int sho
     }
 
     if (count_sizes && access_unit_count > 0)
-        fprint_msg("Frame sizes ranged from %u to %u bytes, mean %.2f\n", min_frame_size,
-            max_frame_size, sum_frame_size / (double)access_unit_count);
+        fprint_msg("Frame sizes ranged from %u to %u bytes, mean %.2f\n", stats->min_frame_size,
+            stats->max_frame_size, stats->sum_frame_size / (double)access_unit_count);
 
-    fprint_msg("Frames with PTS associated: %u\n", num_with_PTS);
+    fprint_msg("Frames with PTS associated: %u\n", stats->num_with_PTS);
+}
 
-    free_access_unit_context(&context);
+/*
+ * Report on data by access unit.
+ */
+static void report_h264_frames(ES_p es, int max, int quiet, int verbose, int show_nal_details,
+    int count_sizes, int count_types)
+{
+    struct h264_frame_stats stats;
+    init_h264_frame_stats(&stats);
+    if (count_h264_frames(
+            es, max, quiet, verbose, show_nal_details, count_sizes, count_types, &stats))
+        return;
+    print_h264_frame_stats(&stats, count_sizes, count_types);
+}
+
+// What the threads counting frames in the parts of a file share
+struct frame_count_parts {
+    int video_type;
+    int count_sizes;
+    int count_types;
+    struct h262_frame_stats* h262; // One per part, for H.262
+    struct h264_frame_stats* h264; // One per part, for H.264
+};
+
+static int count_frames_in_part(ES_p es, int part, void* arg)
+{
+    struct frame_count_parts* parts = (struct frame_count_parts*)arg;
+    if (parts->video_type == VIDEO_H262)
+        return count_h262_frames(es, 0, false, true, parts->count_sizes, &parts->h262[part]);
+    else
+        return count_h264_frames(es, 0, true, false, false, parts->count_sizes,
+            parts->count_types, &parts->h264[part]);
+}
+
+/*
+ * Report (quietly) on the frames in an H.262 or H.264 file, splitting it
+ * into GOPs and counting them in parallel.
+ *
+ * - `es` is the input elementary stream, which must be reading a file
+ *   directly. It is only used to find where the GOPs start.
+ * - `filename` is the name of that file.
+ * - `video_type` is VIDEO_H262 or VIDEO_H264.
+ * - `num_threads` is the number of threads to use.
+ * - `count_sizes` and `count_types` are as for `report_h264_frames`
+ *   (`count_types` is ignored for H.262).
+ *
+ * The output is the same as from `report_h262_frames` or
+ * `report_h264_frames` with `quiet` true.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int report_frames_by_GOP(ES_p es, char* filename, int video_type, int num_threads,
+    int count_sizes, int count_types)
+{
+    int err;
+    int ii;
+    ES_partition_p partition = nullptr;
+    struct frame_count_parts parts;
+
+    err = split_ES_file_by_GOP(es, video_type, num_threads * GOP_PARTS_PER_THREAD, &partition);
+    if (err) {
+        print_err("!!! esreport: Unable to split input into GOPs, reading it in one go\n");
+        if (video_type == VIDEO_H262)
+            report_h262_frames(es, 0, false, true, count_sizes);
+        else
+            report_h264_frames(es, 0, true, false, false, count_sizes, count_types);
+        return 0;
+    }
+
+    parts.video_type = video_type;
+    parts.count_sizes = count_sizes;
+    parts.count_types = count_types;
+    parts.h262 = nullptr;
+    parts.h264 = nullptr;
+    if (video_type == VIDEO_H262)
+        parts.h262 = (struct h262_frame_stats*)malloc(
+            (partition->num_parts + 1) * sizeof(struct h262_frame_stats));
+    else
+        parts.h264 = (struct h264_frame_stats*)malloc(
+            (partition->num_parts + 1) * sizeof(struct h264_frame_stats));
+    if (parts.h262 == nullptr && parts.h264 == nullptr) {
+        print_err("### esreport: Unable to allocate frame statistics\n");
+        free_ES_partition(&partition);
+        return 1;
+    }
+    // The extra entry, at the end, is for the totals
+    for (ii = 0; ii <= partition->num_parts; ii++) {
+        if (video_type == VIDEO_H262)
+            init_h262_frame_stats(&parts.h262[ii]);
+        else
+            init_h264_frame_stats(&parts.h264[ii]);
+    }
+
+    err = analyse_ES_parts(filename, partition, num_threads, count_frames_in_part, &parts);
+    if (err)
+        print_err("### esreport: Error counting frames in parallel\n");
+    else if (video_type == VIDEO_H262) {
+        struct h262_frame_stats* total = &parts.h262[partition->num_parts];
+        for (ii = 0; ii < partition->num_parts; ii++) {
+            merge_h262_frame_stats(total, &parts.h262[ii]);
+            if (total->stopped_early)
+                break;
+        }
+        print_h262_frame_stats(total, count_sizes);
+    } else {
+        struct h264_frame_stats* total = &parts.h264[partition->num_parts];
+        for (ii = 0; ii < partition->num_parts; ii++) {
+            merge_h264_frame_stats(total, &parts.h264[ii]);
+            if (total->stopped_early)
+                break;
+        }
+        print_h264_frame_stats(total, count_sizes, count_types);
+    }
+    free(parts.h262);
+    free(parts.h264);
+    free_ES_partition(&partition);
+    return err;
 }
 
 static void print_usage()
@@ -891,6 +1138,14 @@ static void print_usage()
               "  -quiet, -q        Only output summary information (i.e., the number\n"
               "                    of entities in the file, statistics, etc.)\n"
               "  -x                Show details of each NAL unit as it is read.\n"
+              "  -async            Write output from a background thread. This makes\n"
+              "                    -verbose and -x much faster when writing to a terminal\n"
+              "                    or pipe.\n"
+              "  -pipeline         Read the input and find the ES units in it in a\n"
+              "                    separate thread, overlapping with their analysis.\n"
+              "  -threads <n>      When reporting quietly on the frames in an H.262 or\n"
+              "                    H.264 file, split it into GOPs and count them using\n"
+              "                    <n> threads. The output is the same.\n"
               "  -stdin            Take input from <stdin>, instead of a named file\n"
               "  -max <n>, -m <n>  Maximum number of NAL units/MPEG-2 items/AVS frames/ES units\n"
               "                    to read. If -frames, then the program will stop after\n"
@@ -913,7 +1168,131 @@ static void print_usage()
               "\n"
               "  -h264, -avc       Force the program to treat the input as MPEG-4/AVC.\n"
               "  -h262             Force the program to treat the input as MPEG-2.\n"
-              "  -avs              Force the program to treat the input as AVS.\n");
+              "  -avs              Force the program to treat the input as AVS.\n"
+              "\n"
+              "Batches:\n"
+              "  -batch <list>     Report on each of the files named in <list> (one per\n"
+              "                    line, or '-' for standard input), or in the directory\n"
+              "                    <list>, instead of <infile>. The report for each file\n"
+              "                    is output as a line of JSON. Cannot be used with\n"
+              "                    -stdin, -pipeline or -threads.\n"
+              "  -jobs <n>         Report on <n> files at once. Defaults to one per CPU.\n"
+              "  -io <n>           Read ahead <n> files at once. Defaults to 4.\n"
+              "  -unordered        Output each report as soon as it is ready, rather than\n"
+              "                    in the order of the files.\n");
+}
+
+// How to report on each file - shared by all the files in a batch
+struct esreport_settings {
+    int use_pes;
+    int quiet;
+    int verbose;
+    int max;
+    int by_frame;
+    int find_fields;
+    int show_nal_details;
+    int give_pes_info;
+    int report_afds;
+    int report_framesize;
+    int report_frametype;
+    int report_pes_headers;
+    int report_ES;
+    int pipeline;
+    int num_threads;
+    int force_stream_type;
+    int want_data;
+};
+
+/*
+ * Report on a single file, or standard input if `input_name` is nullptr.
+ *
+ * Returns 0 if all went well, 1 if something went wrong.
+ */
+static int report_file(char* input_name, void* arg)
+{
+    struct esreport_settings* settings = (struct esreport_settings*)arg;
+    ES_p es = nullptr;
+    int is_data;
+    int by_GOP = false;
+    int err;
+
+    err = open_input_as_ES(input_name, settings->use_pes, settings->quiet,
+        settings->force_stream_type, settings->want_data, &is_data, &es);
+    if (err) {
+        print_err("### esreport: Error opening input file\n");
+        return 1;
+    }
+
+    if (settings->report_pes_headers) {
+        es->reader->debug_read_packets = true;
+    }
+
+    if (settings->give_pes_info) {
+        es->reader->give_info = true;
+    }
+
+    if (settings->pipeline && set_ES_pipelining(es, true)) {
+        print_err("### esreport: Unable to read input in a separate thread\n");
+        (void)close_input_as_ES(input_name, &es);
+        return 1;
+    }
+
+    if (settings->num_threads > 1) {
+        if (input_name == nullptr || settings->use_pes || settings->report_ES
+            || settings->find_fields || !settings->by_frame || !settings->quiet
+            || settings->verbose || settings->show_nal_details || settings->max > 0
+            || (is_data != VIDEO_H262 && is_data != VIDEO_H264))
+            print_err("!!! esreport: -threads only applies to -frames -quiet on H.262 or H.264"
+                      " ES files\n"
+                      "    (without -max, -verbose or -x), so ignoring it\n");
+        else
+            by_GOP = true;
+    }
+
+    if (by_GOP) {
+        err = report_frames_by_GOP(es, input_name, is_data, settings->num_threads,
+            settings->report_framesize, settings->report_frametype);
+        if (err) {
+            (void)close_input_as_ES(input_name, &es);
+            return 1;
+        }
+    } else if (settings->report_ES) {
+        report_ES_units(es, settings->max, settings->verbose, settings->quiet);
+    } else if (is_data == VIDEO_H262) {
+        if (settings->find_fields)
+            find_h262_fields(es, settings->max, settings->verbose);
+        else if (settings->by_frame)
+            report_h262_frames(es, settings->max, settings->verbose, settings->quiet,
+                settings->report_framesize);
+        else if (settings->report_afds)
+            report_h262_afds(es, settings->max, settings->verbose, settings->quiet);
+        else
+            report_h262_items(es, settings->max, settings->verbose, settings->quiet);
+    } else if (is_data == VIDEO_AVS) {
+        report_avs_frames(
+            es, settings->max, settings->verbose, settings->quiet, settings->report_framesize);
+    } else if (is_data == VIDEO_H264) {
+        if (settings->find_fields)
+            find_h264_fields(
+                es, settings->max, settings->quiet, settings->verbose, settings->show_nal_details);
+        else if (settings->by_frame)
+            report_h264_frames(es, settings->max, settings->quiet, settings->verbose,
+                settings->show_nal_details, settings->report_framesize,
+                settings->report_frametype);
+        else
+            report_by_nal_unit(es, settings->max, settings->quiet, settings->show_nal_details);
+    } else {
+        print_err("### esreport: Unexpected type of video data\n");
+        (void)close_input_as_ES(input_name, &es);
+        return 1;
+    }
+
+    err = close_input_as_ES(input_name, &es);
+    if (err) {
+        print_err("### esreport: Error closing input file\n");
+        return 1;
+    }
+    return 0;
 }
 
 int main(int argc, char** argv)
@@ -922,7 +1301,6 @@ int main(int argc, char** argv)
     int had_input_name = false;
     int use_stdin = false;
     int err = 0;
-    ES_p es = nullptr;
     int max = 0;
     int by_frame = false;
     int find_fields = false;
@@ -935,14 +1313,20 @@ int main(int argc, char** argv)
     int report_frametype = false;
     int report_pes_headers = false;
     int report_ES = false;
+    int async_output = false;
+    int pipeline = false;
+    int num_threads = 1;
     int ii = 1;
 
     int use_pes = false;
 
     int want_data = VIDEO_H262;
-    int is_data;
     int force_stream_type = false;
 
+    char* batch_name = nullptr;
+    struct batch_options batch = { 0, BATCH_DEFAULT_IO_JOBS, 0, false };
+    struct esreport_settings settings;
+
     if (argc < 2) {
         print_usage();
         return 0;
@@ -997,6 +1381,17 @@ int main(int argc, char** argv)
                 verbose = true;
             } else if (!strcmp("-quiet", argv[ii]) || !strcmp("-q", argv[ii])) {
                 quiet = true;
+            } else if (!strcmp("-async", argv[ii])) {
+                async_output = true;
+            } else if (!strcmp("-pipeline", argv[ii])) {
+                pipeline = true;
+            } else if (!strcmp("-threads", argv[ii])) {
+                CHECKARG("esreport", ii);
+                err = int_value_in_range(
+                    "esreport", argv[ii], argv[ii + 1], 1, 256, 10, &num_threads);
+                if (err)
+                    return 1;
+                ii++;
             } else if (!strcmp("-x", argv[ii])) {
                 show_nal_details = true;
             } else if (!strcmp("-max", argv[ii]) || !strcmp("-m", argv[ii])) {
@@ -1014,6 +1409,24 @@ int main(int argc, char** argv)
             } else if (!strcmp("-pesinfo", argv[ii])) {
                 give_pes_info = true;
                 use_pes = true;
+            } else if (!strcmp("-batch", argv[ii])) {
+                CHECKARG("esreport", ii);
+                batch_name = argv[ii + 1];
+                ii++;
+            } else if (!strcmp("-jobs", argv[ii])) {
+                CHECKARG("esreport", ii);
+                err = int_value("esreport", argv[ii], argv[ii + 1], true, 10, &batch.jobs);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-io", argv[ii])) {
+                CHECKARG("esreport", ii);
+                err = int_value("esreport", argv[ii], argv[ii + 1], true, 10, &batch.io_jobs);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-unordered", argv[ii])) {
+                batch.unordered = true;
             } else {
                 fprint_err("### esreport: "
                            "Unrecognised command line switch '%s'\n",
@@ -1032,56 +1445,58 @@ int main(int argc, char** argv)
         ii++;
     }
 
-    if (!had_input_name) {
-        print_err("### esreport: No input file specified\n");
-        return 1;
+    settings.use_pes = use_pes;
+    settings.quiet = quiet;
+    settings.verbose = verbose;
+    settings.max = max;
+    settings.by_frame = by_frame;
+    settings.find_fields = find_fields;
+    settings.show_nal_details = show_nal_details;
+    settings.give_pes_info = give_pes_info;
+    settings.report_afds = report_afds;
+    settings.report_framesize = report_framesize;
+    settings.report_frametype = report_frametype;
+    settings.report_pes_headers = report_pes_headers;
+    settings.report_ES = report_ES;
+    settings.pipeline = pipeline;
+    settings.num_threads = num_threads;
+    settings.force_stream_type = force_stream_type;
+    settings.want_data = want_data;
+
+    if (batch_name != nullptr) {
+        char** files = nullptr;
+        int num_files = 0;
+        if (had_input_name) {
+            print_err("### esreport: Cannot specify both an input file and -batch\n");
+            return 1;
+        }
+        // Anything printed from threads of their own would not be kept with
+        // the report for its file, and -jobs does the same job across files
+        if (pipeline || num_threads > 1) {
+            print_err("### esreport: Cannot use -pipeline or -threads with -batch\n");
+            return 1;
+        }
+        if (async_output && redirect_output_async()) {
+            print_err("### esreport: Unable to start background output thread\n");
+            return 1;
+        }
+        err = read_batch_list(batch_name, &files, &num_files);
+        if (err)
+            return 1;
+        err = run_batch(files, num_files, &batch, report_file, &settings);
+        free_batch_list(&files, num_files);
+        return (err ? 1 : 0);
     }
 
-    err = open_input_as_ES((use_stdin ? nullptr : input_name), use_pes, quiet, force_stream_type,
-        want_data, &is_data, &es);
-    if (err) {
-        print_err("### esreport: Error opening input file\n");
+    if (!had_input_name) {
+        print_err("### esreport: No input file specified\n");
         return 1;
     }
 
-    if (report_pes_headers) {
-        es->reader->debug_read_packets = true;
-    }
-
-    if (give_pes_info) {
-        es->reader->give_info = true;
-    }
-
-    if (report_ES) {
-        report_ES_units(es, max, verbose, quiet);
-    } else if (is_data == VIDEO_H262) {
-        if (find_fields)
-            find_h262_fields(es, max, verbose);
-        else if (by_frame)
-            report_h262_frames(es, max, verbose, quiet, report_framesize);
-        else if (report_afds)
-            report_h262_afds(es, max, verbose, quiet);
-        else
-            report_h262_items(es, max, verbose, quiet);
-    } else if (is_data == VIDEO_AVS) {
-        report_avs_frames(es, max, verbose, quiet, report_framesize);
-    } else if (is_data == VIDEO_H264) {
-        if (find_fields)
-            find_h264_fields(es, max, quiet, verbose, show_nal_details);
-        else if (by_frame)
-            report_h264_frames(
-                es, max, quiet, verbose, show_nal_details, report_framesize, report_frametype);
-        else
-            report_by_nal_unit(es, max, quiet, show_nal_details);
-    } else {
-        print_err("### esreport: Unexpected type of video data\n");
+    if (async_output && redirect_output_async()) {
+        print_err("### esreport: Unable to start background output thread\n");
         return 1;
     }
 
-    err = close_input_as_ES(input_name, &es);
-    if (err) {
-        print_err("### esreport: Error closing input file\n");
-        return 1;
-    }
-    return 0;
+    return report_file(use_stdin ? nullptr : input_name, &settings);
 }
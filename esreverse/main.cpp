@@ -44,9 +44,12 @@
 #include "audio.h"
 #include "avs.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
 #include "filter.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "l2audio.h"
@@ -55,8 +58,10 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
@@ -47,6 +47,36 @@ static const unsigned int // Table 5.18, frame sizes
           { 640, 696, 960 }, { 768, 835, 1152 }, { 896, 975, 1344 }, { 1024, 1114, 1536 },
           { 1152, 1253, 1728 }, { 1280, 1393, 1920 } };
 
+#define SYNCINFO_SIZE 5
+
+/*
+ * Work out the length of an AC3 frame from its syncinfo, without reporting
+ * any problems - for use when looking for the start of a frame.
+ *
+ * - `header` is (at least) the first 5 bytes of the frame
+ * - `samples` is returned as the number of samples in the frame
+ *
+ * Returns the length of the frame in bytes, or -1 if `header` is not a
+ * plausible AC3 syncinfo.
+ */
+int ac3_frame_info(const byte* header, int* samples)
+{
+    int fscod, frmsizecod, frame_length;
+
+    if (header[0] != 0x0b || header[1] != 0x77)
+        return -1;
+    fscod = header[4] >> 6;
+    frmsizecod = header[4] & 0x3f;
+    if (fscod == 3 || frmsizecod > 37)
+        return -1;
+
+    frame_length = l_frmsizecod[frmsizecod >> 1][fscod];
+    if (fscod == 1)
+        frame_length += frmsizecod & 1;
+    *samples = 6 * 256; // six audio blocks of 256 samples each
+    return frame_length << 1; // Convert from 16-bit words to bytes
+}
+
 /*
  * Read the next AC3 frame.
  *
@@ -59,8 +89,6 @@ static const unsigned int // Table 5.18, frame sizes
  * Returns 0 if all goes well, EOF if end-of-file is read, and 1 if something
  * goes wrong.
  */
-#define SYNCINFO_SIZE 5
-
 int read_next_ac3_frame(int file, audio_frame_p* frame)
 {
     int i, err;
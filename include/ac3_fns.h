@@ -44,3 +44,15 @@
  * goes wrong.
  */
 int read_next_ac3_frame(int file, audio_frame_p* frame);
+
+/*
+ * Work out the length of an AC3 frame from its syncinfo, without reporting
+ * any problems - for use when looking for the start of a frame.
+ *
+ * - `header` is (at least) the first 5 bytes of the frame
+ * - `samples` is returned as the number of samples in the frame
+ *
+ * Returns the length of the frame in bytes, or -1 if `header` is not a
+ * plausible AC3 syncinfo.
+ */
+int ac3_frame_info(const byte* header, int* samples);
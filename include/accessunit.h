@@ -29,6 +29,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include "accessunit_fns.h"
 #include "compat.h"
@@ -68,6 +69,9 @@ static inline int build_access_unit(access_unit_p* acc_unit, uint32_t index)
 
     new2->frame_num = new2->field_pic_flag = new2->bottom_field_flag = 0;
 
+    new2->data = nullptr;
+    new2->data_len = new2->data_size = 0;
+
     *acc_unit = new2;
     return 0;
 }
@@ -82,6 +86,11 @@ static inline void clear_access_unit(access_unit_p acc_unit, int deep)
 {
     free_nal_unit_list(&(acc_unit->nal_units), deep);
     acc_unit->primary_start = nullptr;
+    if (acc_unit->data != nullptr) {
+        free(acc_unit->data);
+        acc_unit->data = nullptr;
+    }
+    acc_unit->data_len = acc_unit->data_size = 0;
 }
 
 /*
@@ -279,6 +288,78 @@ int all_slices_B(access_unit_p access_unit)
     return true;
 }
 
+/*
+ * Make room for (at least) `extra` more bytes in an access unit's data buffer.
+ *
+ * Returns 0 if it succeeds, 1 if some error occurs.
+ */
+static int extend_access_unit_data(access_unit_p access_unit, uint32_t extra)
+{
+    uint32_t newsize = access_unit->data_size ? access_unit->data_size
+                                              : ACCESS_UNIT_DATA_START_SIZE;
+    uint32_t offset = 0;
+    byte* new_data;
+    int ii;
+
+    if (access_unit->data_len + extra <= access_unit->data_size)
+        return 0;
+
+    while (newsize < access_unit->data_len + extra)
+        newsize *= 2;
+    new_data = (byte*)realloc(access_unit->data, newsize);
+    if (new_data == nullptr) {
+        print_err("### Unable to extend access unit data buffer\n");
+        return 1;
+    }
+    access_unit->data = new_data;
+    access_unit->data_size = newsize;
+
+    // Our NAL units need to follow their data. Each NAL unit's data directly
+    // follows that of the one before it, so we can work out where it now is
+    // without reference to the old (freed) buffer
+    for (ii = 0; ii < access_unit->nal_units->length; ii++) {
+        nal_unit_p nal = access_unit->nal_units->array[ii];
+        nal->unit.data = access_unit->data + offset;
+        if (nal->data != nullptr)
+            nal->data = &(nal->unit.data[3]);
+        offset += nal->unit.data_len;
+    }
+    return 0;
+}
+
+/*
+ * Add a NAL unit to the end of an access unit's list of NAL units.
+ *
+ * The NAL unit's data is moved into the access unit's data buffer (so the
+ * NAL unit no longer has a buffer of its own), and the NAL unit itself is
+ * then owned by the access unit.
+ *
+ * Returns 0 if it succeeds, 1 if some error occurs.
+ */
+static int access_unit_add_nal(access_unit_p access_unit, nal_unit_p nal)
+{
+    byte* data;
+    int err;
+
+    err = extend_access_unit_data(access_unit, nal->unit.data_len);
+    if (err)
+        return err;
+    err = append_to_nal_unit_list(access_unit->nal_units, nal);
+    if (err)
+        return err;
+
+    data = access_unit->data + access_unit->data_len;
+    memcpy(data, nal->unit.data, nal->unit.data_len);
+    access_unit->data_len += nal->unit.data_len;
+    if (nal->unit.data_size != 0)
+        free(nal->unit.data);
+    nal->unit.data = data;
+    nal->unit.data_size = 0; // we don't own it
+    if (nal->data != nullptr)
+        nal->data = &(nal->unit.data[3]);
+    return 0;
+}
+
 /*
  * Append a NAL unit to the list of NAL units for this access unit
  *
@@ -308,7 +389,7 @@ static int access_unit_append(
     if (pending != nullptr && pending->length > 0) {
         int ii;
         for (ii = 0; ii < pending->length; ii++) {
-            err = append_to_nal_unit_list(access_unit->nal_units, pending->array[ii]);
+            err = access_unit_add_nal(access_unit, pending->array[ii]);
             if (err) {
                 fprint_err("### Error extending access unit %d\n", access_unit->index);
                 return err;
@@ -317,7 +398,7 @@ static int access_unit_append(
     }
 
     if (nal != nullptr) {
-        err = append_to_nal_unit_list(access_unit->nal_units, nal);
+        err = access_unit_add_nal(access_unit, nal);
         if (err) {
             fprint_err("### Error extending access unit %d\n", access_unit->index);
             return err;
@@ -337,8 +418,7 @@ static int merge_access_unit_nals(access_unit_p access_unit1, access_unit_p* acc
     int err, ii;
 
     for (ii = 0; ii < (*access_unit2)->nal_units->length; ii++) {
-        err = append_to_nal_unit_list(
-            access_unit1->nal_units, (*access_unit2)->nal_units->array[ii]);
+        err = access_unit_add_nal(access_unit1, (*access_unit2)->nal_units->array[ii]);
         if (err) {
             print_err("### Error merging two access units\n");
             return err;
@@ -453,9 +533,29 @@ static int write_access_unit_trailer_as_TS(
     return 0;
 }
 
+/*
+ * Retrieve the data of all of the NAL units in an access unit, as a single
+ * contiguous buffer.
+ *
+ * - `access_unit` is the access unit in question
+ * - `data` is returned as the start of the data, which remains owned by
+ *   the access unit (and is only valid until it is next altered)
+ * - `data_len` is returned as its length
+ *
+ * Returns 0 if it succeeds, 1 if some error occurs.
+ */
+int get_access_unit_data(access_unit_p access_unit, byte** data, uint32_t* data_len)
+{
+    *data = access_unit->data;
+    *data_len = access_unit->data_len;
+    return 0;
+}
+
 /*
  * Write out an access unit as TS.
  *
+ * The whole access unit is written as a single PES packet.
+ *
  * Also writes out any end of sequence or end of stream NAL unit found in the
  * `context` (since they are assumed to have immediately followed this access
  * unit).
@@ -471,16 +571,18 @@ static int write_access_unit_trailer_as_TS(
 int write_access_unit_as_TS(access_unit_p access_unit, access_unit_context_p context,
     TS_writer_p tswriter, uint32_t video_pid)
 {
-    int ii, err;
-
-    for (ii = 0; ii < access_unit->nal_units->length; ii++) {
-        nal_unit_p nal = access_unit->nal_units->array[ii];
+    byte* data;
+    uint32_t data_len;
+    int err;
 
+    err = get_access_unit_data(access_unit, &data, &data_len);
+    if (err)
+        return err;
+    if (data_len > 0) {
         err = write_ES_as_TS_PES_packet(
-            tswriter, nal->unit.data, nal->unit.data_len, video_pid, DEFAULT_VIDEO_STREAM_ID);
+            tswriter, data, data_len, video_pid, DEFAULT_VIDEO_STREAM_ID);
         if (err) {
-            print_err("### Error writing NAL unit ");
-            report_nal(false, nal);
+            fprint_err("### Error writing access unit %u\n", access_unit->index);
             return err;
         }
     }
@@ -488,9 +590,11 @@ int write_access_unit_as_TS(access_unit_p access_unit, access_unit_context_p con
 }
 
 /*
- * Write out an access unit as TS, with PTS timing in the first PES packet
+ * Write out an access unit as TS, with PTS timing in its PES packet
  * (and PCR timing in the first TS of the frame).
  *
+ * The whole access unit is written as a single PES packet.
+ *
  * Also writes out any end of sequence or end of stream NAL unit found in the
  * `context` (since they are assumed to have immediately followed this access
  * unit).
@@ -513,22 +617,18 @@ int write_access_unit_as_TS(access_unit_p access_unit, access_unit_context_p con
 int write_access_unit_as_TS_with_pts_dts(access_unit_p access_unit, access_unit_context_p context,
     TS_writer_p tswriter, uint32_t video_pid, int got_pts, uint64_t pts, int got_dts, uint64_t dts)
 {
-    int ii, err;
-
-    for (ii = 0; ii < access_unit->nal_units->length; ii++) {
-        nal_unit_p nal = access_unit->nal_units->array[ii];
+    byte* data;
+    uint32_t data_len;
+    int err;
 
-        // Only write the first PES packet out with PTS
-        if (ii == 0)
-            err = write_ES_as_TS_PES_packet_with_pts_dts(tswriter, nal->unit.data,
-                nal->unit.data_len, video_pid, DEFAULT_VIDEO_STREAM_ID, got_pts, pts, got_dts,
-                dts);
-        else
-            err = write_ES_as_TS_PES_packet(
-                tswriter, nal->unit.data, nal->unit.data_len, video_pid, DEFAULT_VIDEO_STREAM_ID);
+    err = get_access_unit_data(access_unit, &data, &data_len);
+    if (err)
+        return err;
+    if (data_len > 0) {
+        err = write_ES_as_TS_PES_packet_with_pts_dts(tswriter, data, data_len, video_pid,
+            DEFAULT_VIDEO_STREAM_ID, got_pts, pts, got_dts, dts);
         if (err) {
-            print_err("### Error writing NAL unit ");
-            report_nal(false, nal);
+            fprint_err("### Error writing access unit %u\n", access_unit->index);
             return err;
         }
     }
@@ -539,6 +639,8 @@ int write_access_unit_as_TS_with_pts_dts(access_unit_p access_unit, access_unit_
  * Write out an access unit as TS, with PCR timing in the first TS of the
  * frame.
  *
+ * The whole access unit is written as a single PES packet.
+ *
  * Also writes out any end of sequence or end of stream NAL unit found in the
  * `context` (since they are assumed to have immediately followed this access
  * unit).
@@ -555,21 +657,18 @@ int write_access_unit_as_TS_with_pts_dts(access_unit_p access_unit, access_unit_
 int write_access_unit_as_TS_with_PCR(access_unit_p access_unit, access_unit_context_p context,
     TS_writer_p tswriter, uint32_t video_pid, uint64_t pcr_base, uint32_t pcr_extn)
 {
-    int ii, err;
-
-    for (ii = 0; ii < access_unit->nal_units->length; ii++) {
-        nal_unit_p nal = access_unit->nal_units->array[ii];
+    byte* data;
+    uint32_t data_len;
+    int err;
 
-        // Only write the first PES packet out with PCR
-        if (ii == 0)
-            err = write_ES_as_TS_PES_packet_with_pcr(tswriter, nal->unit.data, nal->unit.data_len,
-                video_pid, DEFAULT_VIDEO_STREAM_ID, pcr_base, pcr_extn);
-        else
-            err = write_ES_as_TS_PES_packet(
-                tswriter, nal->unit.data, nal->unit.data_len, video_pid, DEFAULT_VIDEO_STREAM_ID);
+    err = get_access_unit_data(access_unit, &data, &data_len);
+    if (err)
+        return err;
+    if (data_len > 0) {
+        err = write_ES_as_TS_PES_packet_with_pcr(tswriter, data, data_len, video_pid,
+            DEFAULT_VIDEO_STREAM_ID, pcr_base, pcr_extn);
         if (err) {
-            print_err("### Error writing NAL unit ");
-            report_nal(false, nal);
+            fprint_err("### Error writing access unit %u\n", access_unit->index);
             return err;
         }
     }
@@ -965,6 +1064,7 @@ int get_next_access_unit(
                     if (access_unit->nal_units->length > 0) {
                         report_nal_unit_list(false, "    ", access_unit->nal_units);
                         reset_nal_unit_list(access_unit->nal_units, true);
+                        access_unit->data_len = 0;
                     }
                     if (context->pending_list->length > 0) {
                         report_nal_unit_list(false, "    ", context->pending_list);
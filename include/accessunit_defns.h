@@ -67,10 +67,22 @@ struct access_unit {
     // (After merging two field access units into a single frame,
     // `field_pic_flag` will be set to 0, to "pretend" that we have a
     // "proper" frame access unit)
+
+    // The data of all of our NAL units, one after another, so that we can
+    // be written out in one go (see `get_access_unit_data`). Each NAL unit's
+    // data is moved into here as the NAL unit is added to us, after which
+    // its `unit.data` points into this buffer (and its `unit.data_size` is 0,
+    // since it does not own it).
+    byte* data;
+    uint32_t data_len; // How much of it there is
+    uint32_t data_size; // How big the buffer is
 };
 typedef struct access_unit* access_unit_p;
 #define SIZEOF_ACCESS_UNIT sizeof(struct access_unit)
 
+// Initial size of an access unit's data buffer (it doubles thereafter)
+#define ACCESS_UNIT_DATA_START_SIZE 0x10000
+
 // ------------------------------------------------------------
 // Context for looping over the access units in an elementary stream
 struct access_unit_context {
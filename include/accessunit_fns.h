@@ -129,9 +129,23 @@ int all_slices_B(access_unit_p access_unit);
  */
 int write_access_unit_as_ES(
     access_unit_p access_unit, access_unit_context_p context, FILE* output);
+/*
+ * Retrieve the data of all of the NAL units in an access unit, as a single
+ * contiguous buffer.
+ *
+ * - `access_unit` is the access unit in question
+ * - `data` is returned as the start of the data, which remains owned by
+ *   the access unit (and is only valid until it is next altered)
+ * - `data_len` is returned as its length
+ *
+ * Returns 0 if it succeeds, 1 if some error occurs.
+ */
+int get_access_unit_data(access_unit_p access_unit, byte** data, uint32_t* data_len);
 /*
  * Write out an access unit as TS.
  *
+ * The whole access unit is written as a single PES packet.
+ *
  * Also writes out any end of sequence or end of stream NAL unit found in the
  * `context` (since they are assumed to have immediately followed this access
  * unit).
@@ -147,9 +161,11 @@ int write_access_unit_as_ES(
 int write_access_unit_as_TS(access_unit_p access_unit, access_unit_context_p context,
     TS_writer_p tswriter, uint32_t video_pid);
 /*
- * Write out an access unit as TS, with PTS timing in the first PES packet
+ * Write out an access unit as TS, with PTS timing in its PES packet
  * (and PCR timing in the first TS of the frame).
  *
+ * The whole access unit is written as a single PES packet.
+ *
  * Also writes out any end of sequence or end of stream NAL unit found in the
  * `context` (since they are assumed to have immediately followed this access
  * unit).
@@ -170,6 +186,8 @@ int write_access_unit_as_TS_with_pts_dts(access_unit_p access_unit, access_unit_
  * Write out an access unit as TS, with PCR timing in the first TS of the
  * frame.
  *
+ * The whole access unit is written as a single PES packet.
+ *
  * Also writes out any end of sequence or end of stream NAL unit found in the
  * `context` (since they are assumed to have immediately followed this access
  * unit).
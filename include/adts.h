@@ -40,6 +40,42 @@
 
 #define DEBUG 0
 
+/*
+ * Work out the length of an ADTS frame from its header, without reporting
+ * any problems - for use when looking for the start of a frame.
+ *
+ * - `header` is (at least) the first ADTS_HEADER_SIZE bytes of the frame
+ * - `flags` is as for `read_next_adts_frame`
+ * - `samples` is returned as the number of samples in the frame
+ *
+ * Returns the length of the frame in bytes, or -1 if `header` is not a
+ * plausible ADTS header.
+ */
+int adts_frame_info(const byte* header, unsigned int flags, int* samples)
+{
+    int id, has_emphasis, frame_length;
+
+    if (header[0] != 0xFF || (header[1] & 0xF0) != 0xF0)
+        return -1;
+    if (((header[2] >> 2) & 0x0F) > 12) // sampling frequency index
+        return -1;
+
+    // The length is found as in `read_next_adts_frame`
+    id = (header[1] & 0x08) >> 3;
+    has_emphasis
+        = (flags & ADTS_FLAG_NO_EMPHASIS) ? 0 : ((flags & ADTS_FLAG_FORCE_EMPHASIS) || !id);
+    if (!has_emphasis)
+        frame_length
+            = ((header[3] & 0x03) << 11) | (header[4] << 3) | ((unsigned)(header[5] & 0xE0) >> 5);
+    else
+        frame_length = (header[4] << 5) | ((unsigned)(header[5] & 0xF8) >> 3);
+    if (frame_length < ADTS_HEADER_SIZE)
+        return -1;
+
+    *samples = ADTS_SAMPLES_PER_BLOCK * ((header[6] & 0x03) + 1);
+    return frame_length;
+}
+
 /*
  * Read the next ADTS frame.
  *
@@ -31,6 +31,12 @@
 #include "audio_defns.h"
 // AAC ADTS provides audio in frames of constant time
 
+// The length of an ADTS header (without its CRC)
+#define ADTS_HEADER_SIZE 7
+
+// Each raw data block in an ADTS frame is 1024 samples
+#define ADTS_SAMPLES_PER_BLOCK 1024
+
 // Flags for ``read_next_adts_frame``
 //
 // Specify this flag to indicate that there is no emphasis field in the ADTS
@@ -61,3 +61,16 @@
  * goes wrong.
  */
 int read_next_adts_frame(int file, audio_frame_p* frame, unsigned int flags);
+
+/*
+ * Work out the length of an ADTS frame from its header, without reporting
+ * any problems - for use when looking for the start of a frame.
+ *
+ * - `header` is (at least) the first ADTS_HEADER_SIZE bytes of the frame
+ * - `flags` is as for `read_next_adts_frame`
+ * - `samples` is returned as the number of samples in the frame
+ *
+ * Returns the length of the frame in bytes, or -1 if `header` is not a
+ * plausible ADTS header.
+ */
+int adts_frame_info(const byte* header, unsigned int flags, int* samples);
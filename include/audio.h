@@ -32,12 +32,18 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "ac3_fns.h"
 #include "adts_fns.h"
 #include "audio_fns.h"
 #include "compat.h"
 #include "l2audio_fns.h"
+#include "misc_fns.h"
 #include "printing_fns.h"
 
 /*
@@ -112,3 +118,426 @@ int read_next_audio_frame(int file, int audio_type, audio_frame_p* frame)
         return 1;
     }
 }
+
+/*
+ * Work out the length of an audio frame from its header, without reporting
+ * any problems.
+ *
+ * - `header` is (at least) the first AUDIO_HEADER_SIZE bytes of the frame
+ * - `audio_type` indicates what type of audio - e.g., AUDIO_ADTS
+ * - `samples` is returned as the number of samples in the frame
+ *
+ * Returns the length of the frame in bytes, or -1 if `header` is not a
+ * plausible header for that type of audio.
+ */
+int audio_frame_info(const byte* header, int audio_type, int* samples)
+{
+    switch (audio_type) {
+    case AUDIO_ADTS_MPEG2:
+        return adts_frame_info(header, ADTS_FLAG_NO_EMPHASIS, samples);
+    case AUDIO_ADTS_MPEG4:
+        return adts_frame_info(header, ADTS_FLAG_FORCE_EMPHASIS, samples);
+    case AUDIO_ADTS:
+        return adts_frame_info(header, 0, samples);
+    case AUDIO_L2:
+        return l2audio_frame_info(header, samples);
+    case AUDIO_AC3:
+        return ac3_frame_info(header, samples);
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Find the first thing that looks like the syncword for the given type of
+ * audio.
+ *
+ * All of the syncwords we know about are a particular first byte followed
+ * by a second byte which matches a value under a mask, so we look for
+ * both together, sixteen positions at a time where SSE2 is available.
+ *
+ * - `data` and `data_len` are the bytes to look through
+ * - `audio_type` indicates what type of audio - e.g., AUDIO_ADTS
+ *
+ * Returns the offset of the syncword in `data`, or -1 if there is none
+ * (a syncword must lie entirely within `data`).
+ */
+int find_audio_syncword(const byte* data, int data_len, int audio_type)
+{
+    byte first, mask, second;
+    int posn = 0;
+
+    switch (audio_type) {
+    case AUDIO_ADTS_MPEG2:
+    case AUDIO_ADTS_MPEG4:
+    case AUDIO_ADTS:
+        first = 0xFF; // 1111 1111 1111
+        mask = 0xF0;
+        second = 0xF0;
+        break;
+    case AUDIO_L2:
+        first = 0xFF; // 1111 1111 111
+        mask = 0xE0;
+        second = 0xE0;
+        break;
+    case AUDIO_AC3:
+        first = 0x0B; // 0000 1011 0111 0111
+        mask = 0xFF;
+        second = 0x77;
+        break;
+    default:
+        return -1;
+    }
+
+#if defined(__SSE2__)
+    {
+        const __m128i want_first = _mm_set1_epi8((char)first);
+        const __m128i want_mask = _mm_set1_epi8((char)mask);
+        const __m128i want_second = _mm_set1_epi8((char)second);
+
+        // Each iteration looks at 17 bytes, as the pairs starting at 16 positions
+        for (; posn + 17 <= data_len; posn += 16) {
+            __m128i here = _mm_loadu_si128((const __m128i*)(data + posn));
+            __m128i next = _mm_loadu_si128((const __m128i*)(data + posn + 1));
+            __m128i hits = _mm_and_si128(_mm_cmpeq_epi8(here, want_first),
+                _mm_cmpeq_epi8(_mm_and_si128(next, want_mask), want_second));
+            int bits = _mm_movemask_epi8(hits);
+            if (bits != 0) {
+                while ((bits & 1) == 0) {
+                    bits >>= 1;
+                    posn++;
+                }
+                return posn;
+            }
+        }
+    }
+#endif
+
+    // Otherwise (or for what is left), let memchr find each possible first byte
+    while (posn < data_len - 1) {
+        const byte* ptr = (const byte*)memchr(data + posn, first, data_len - 1 - posn);
+        if (ptr == nullptr)
+            break;
+        posn = (int)(ptr - data);
+        if ((data[posn + 1] & mask) == second)
+            return posn;
+        posn++;
+    }
+    return -1;
+}
+
+/*
+ * Build a reader for the audio frames in a file
+ *
+ * - `file` is the file descriptor of the audio file to read from
+ * - `audio_type` indicates what type of audio - e.g., AUDIO_ADTS
+ * - if `want_index` is true, remember the position, length and number of
+ *   samples of each frame returned
+ * - `reader` is the new reader
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int build_audio_reader(int file, int audio_type, int want_index, audio_reader_p* reader)
+{
+    audio_reader_p new2;
+
+    switch (audio_type) {
+    case AUDIO_ADTS_MPEG2:
+    case AUDIO_ADTS_MPEG4:
+    case AUDIO_ADTS:
+    case AUDIO_L2:
+    case AUDIO_AC3:
+        break;
+    default:
+        fprint_err("### Unrecognised audio type %d - cannot read audio frames\n", audio_type);
+        return 1;
+    }
+
+    new2 = (audio_reader_p)malloc(SIZEOF_AUDIO_READER);
+    if (new2 == nullptr) {
+        print_err("### Unable to allocate audio reader datastructure\n");
+        return 1;
+    }
+    new2->buffer = (byte*)malloc(AUDIO_BUFFER_SIZE);
+    if (new2->buffer == nullptr) {
+        print_err("### Unable to allocate audio reader buffer\n");
+        free(new2);
+        return 1;
+    }
+    new2->file = file;
+    new2->audio_type = audio_type;
+    new2->start = new2->end = 0;
+    new2->buffer_posn = 0;
+    new2->eof = false;
+
+    new2->in_sync = false;
+    new2->num_frames = 0;
+    new2->num_samples = 0;
+    new2->num_resyncs = 0;
+    new2->bytes_skipped = 0;
+
+    new2->want_index = want_index;
+    new2->index = nullptr;
+    new2->index_len = new2->index_size = 0;
+
+    *reader = new2;
+    return 0;
+}
+
+/*
+ * Tidy up and free an audio reader when we've finished with it
+ *
+ * Does not close the file. Sets `reader` to nullptr. If `reader` is already
+ * nullptr, does nothing.
+ */
+void free_audio_reader(audio_reader_p* reader)
+{
+    if (*reader == nullptr)
+        return;
+    free((*reader)->buffer);
+    free((*reader)->index);
+    free(*reader);
+    *reader = nullptr;
+}
+
+/*
+ * Make sure that (if the file is long enough) there are at least `wanted`
+ * unused bytes in the reader's buffer.
+ *
+ * Returns 0 if all goes well (including if end-of-file stopped us getting
+ * all we wanted), 1 if something goes wrong.
+ */
+static int fill_audio_buffer(audio_reader_p reader, uint32_t wanted)
+{
+    while (!reader->eof && reader->end - reader->start < wanted) {
+        ssize_t len;
+
+        // Move what we've still to use to the start of the buffer, if we
+        // would otherwise not have room to read a useful amount
+        if (reader->end + AUDIO_READ_AHEAD_SIZE > AUDIO_BUFFER_SIZE) {
+            uint32_t used = reader->end - reader->start;
+            memmove(reader->buffer, reader->buffer + reader->start, used);
+            reader->buffer_posn += reader->start;
+            reader->start = 0;
+            reader->end = used;
+        }
+
+        // As for ES files, we don't mind if we get a "short" read
+        len = read_file(reader->file, reader->buffer + reader->end, AUDIO_READ_AHEAD_SIZE);
+        if (len == 0)
+            reader->eof = true;
+        else if (len == -1) {
+            if (errno == EINTR)
+                continue;
+            fprint_err("### Error reading audio data: %s\n", strerror(errno));
+            return 1;
+        } else
+            reader->end += (uint32_t)len;
+    }
+    return 0;
+}
+
+/*
+ * Decide if there is a believable frame at the start of the reader's unused
+ * data: that is, one that is followed by AUDIO_SYNC_FRAMES more frames, or
+ * by a chain of frames that ends exactly at the end of the file.
+ *
+ * Returns 1 if there is, 0 if there is not, and -1 if something goes wrong.
+ */
+static int audio_chain_is_valid(audio_reader_p reader)
+{
+    uint32_t offset = 0;
+    int ii, samples;
+
+    for (ii = 0; ii <= AUDIO_SYNC_FRAMES; ii++) {
+        int length;
+        if (fill_audio_buffer(reader, offset + AUDIO_HEADER_SIZE))
+            return -1;
+        if (reader->end - reader->start < offset + AUDIO_HEADER_SIZE)
+            // If we've run out of file, we're happy only if there was no more
+            return (ii > 0 && reader->end - reader->start == offset);
+        length = audio_frame_info(
+            reader->buffer + reader->start + offset, reader->audio_type, &samples);
+        if (length < 1)
+            return 0;
+        offset += length;
+    }
+    return 1;
+}
+
+/*
+ * Find the next believable frame, after losing synchronisation (or at the
+ * start of the file), and report what we had to skip to get there.
+ *
+ * Returns 0 if all goes well, EOF if there are no more frames, and 1 if
+ * something goes wrong.
+ */
+static int resync_audio_reader(audio_reader_p reader)
+{
+    offset_t lost_at = reader->buffer_posn + reader->start;
+    int skipped = 0;
+    int err = 0;
+
+    for (;;) {
+        int avail, posn, valid;
+
+        if (fill_audio_buffer(reader, AUDIO_HEADER_SIZE))
+            return 1;
+        avail = reader->end - reader->start;
+        if (avail < AUDIO_HEADER_SIZE) {
+            // Not enough left to be a frame
+            skipped += avail;
+            reader->start = reader->end;
+            err = EOF;
+            break;
+        }
+
+        posn = find_audio_syncword(reader->buffer + reader->start, avail, reader->audio_type);
+        if (posn == -1) {
+            // Keep the last byte, which might be the start of a syncword
+            skipped += avail - 1;
+            reader->start = reader->end - 1;
+            if (reader->eof) {
+                skipped++;
+                reader->start = reader->end;
+                err = EOF;
+                break;
+            }
+            continue;
+        }
+        skipped += posn;
+        reader->start += posn;
+
+        valid = audio_chain_is_valid(reader);
+        if (valid == -1)
+            return 1;
+        else if (valid)
+            break;
+        skipped++;
+        reader->start++;
+    }
+
+    if (skipped > 0) {
+        reader->num_resyncs++;
+        reader->bytes_skipped += skipped;
+        if (err == EOF)
+            fprint_err("!!! Skipped %d byte%s of %s audio data at " OFFSET_T_FORMAT
+                       " with no frame in them\n",
+                skipped, (skipped == 1 ? "" : "s"), AUDIO_STR(reader->audio_type), lost_at);
+        else
+            fprint_err("!!! Lost %s audio synchronisation at " OFFSET_T_FORMAT
+                       ", resuming after %d skipped byte%s\n",
+                AUDIO_STR(reader->audio_type), lost_at, skipped, (skipped == 1 ? "" : "s"));
+    }
+    if (err == 0)
+        reader->in_sync = true;
+    return err;
+}
+
+/*
+ * Remember a frame in the reader's index
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int index_audio_frame(audio_reader_p reader, offset_t posn, uint32_t length, int samples)
+{
+    if (reader->index_len == reader->index_size) {
+        uint32_t new_size = (reader->index_size == 0 ? 1024 : reader->index_size * 2);
+        audio_index_entry_p new_index = (audio_index_entry_p)realloc(
+            reader->index, new_size * SIZEOF_AUDIO_INDEX_ENTRY);
+        if (new_index == nullptr) {
+            print_err("### Unable to extend audio frame index\n");
+            return 1;
+        }
+        reader->index = new_index;
+        reader->index_size = new_size;
+    }
+    reader->index[reader->index_len].posn = posn;
+    reader->index[reader->index_len].length = length;
+    reader->index[reader->index_len].samples = samples;
+    reader->index_len++;
+    return 0;
+}
+
+/*
+ * Read the next audio frame.
+ *
+ * Unlike `read_next_audio_frame`, this does not need the input to be
+ * synchronised: if a frame header is not where it is expected, the reader
+ * looks for the next syncword that is followed by a chain of valid frames,
+ * and reports how many bytes were skipped to get there. A truncated frame
+ * at the end of the file is reported and ignored.
+ *
+ * - `reader` is the audio reader
+ * - `frame` is the audio frame that is read
+ *
+ * Returns 0 if all goes well, EOF if end-of-file is read, and 1 if something
+ * goes wrong.
+ */
+int get_next_audio_frame(audio_reader_p reader, audio_frame_p* frame)
+{
+    int err, length, samples, avail;
+    offset_t posn;
+    byte* data;
+
+    for (;;) {
+        if (!reader->in_sync) {
+            err = resync_audio_reader(reader);
+            if (err)
+                return err;
+        }
+
+        if (fill_audio_buffer(reader, AUDIO_HEADER_SIZE))
+            return 1;
+        if (reader->end == reader->start)
+            return EOF;
+        posn = reader->buffer_posn + reader->start;
+        avail = reader->end - reader->start;
+        if (avail < AUDIO_HEADER_SIZE) {
+            fprint_err("!!! Ignoring %d byte%s of %s audio data at end of file\n", avail,
+                (avail == 1 ? "" : "s"), AUDIO_STR(reader->audio_type));
+            reader->start = reader->end;
+            return EOF;
+        }
+
+        length = audio_frame_info(reader->buffer + reader->start, reader->audio_type, &samples);
+        if (length > 0)
+            break;
+        reader->in_sync = false;
+    }
+
+    if (fill_audio_buffer(reader, length))
+        return 1;
+    avail = reader->end - reader->start;
+    if (avail < length) {
+        fprint_err("!!! Ignoring truncated %s audio frame at " OFFSET_T_FORMAT
+                   " (%d of %d bytes present)\n",
+            AUDIO_STR(reader->audio_type), posn, avail, length);
+        reader->start = reader->end;
+        return EOF;
+    }
+
+    data = (byte*)malloc(length);
+    if (data == nullptr) {
+        print_err("### Unable to allocate data buffer for audio frame\n");
+        return 1;
+    }
+    memcpy(data, reader->buffer + reader->start, length);
+    reader->start += length;
+
+    err = build_audio_frame(frame);
+    if (err) {
+        free(data);
+        return 1;
+    }
+    (*frame)->data = data;
+    (*frame)->data_len = length;
+
+    reader->num_frames++;
+    reader->num_samples += samples;
+    if (reader->want_index && index_audio_frame(reader, posn, length, samples)) {
+        free_audio_frame(frame);
+        return 1;
+    }
+    return 0;
+}
@@ -28,6 +28,7 @@
  * ***** END LICENSE BLOCK *****
  */
 
+#include "compat.h"
 #include "h222_defns.h"
 
 #include <cctype>
@@ -60,3 +61,55 @@ typedef struct audio_frame* audio_frame_p;
                                                                         : (x) == AUDIO_ADTS_MPEG4 \
                         ? "ADTS-MPEG4"                                                            \
                         : (x) == AUDIO_L2 ? "MPEG2" : (x) == AUDIO_AC3 ? "ATSC-AC3" : "???")
+
+// ------------------------------------------------------------
+// A buffered reader for audio elementary stream files, which finds frames
+// by their syncwords, and so can recover from damaged or concatenated input
+
+// How much we try to read from the file at a time
+#define AUDIO_READ_AHEAD_SIZE (64 * 1024)
+// No audio frame we understand is longer than this (ADTS has a 13 bit length)
+#define AUDIO_MAX_FRAME_SIZE 8192
+// The number of bytes we need to see to know a frame's length
+#define AUDIO_HEADER_SIZE 7
+// A candidate syncword is only believed if the next AUDIO_SYNC_FRAMES frames
+// follow on from it (or it leads exactly to the end of the file)
+#define AUDIO_SYNC_FRAMES 3
+
+// The buffer must be able to hold a whole chain of frames being validated
+#define AUDIO_BUFFER_SIZE                                                                          \
+    (AUDIO_READ_AHEAD_SIZE + (AUDIO_SYNC_FRAMES + 1) * AUDIO_MAX_FRAME_SIZE)
+
+// An entry in the index of the frames read
+struct audio_index_entry {
+    offset_t posn; // Where the frame starts in the file
+    uint32_t length; // Its length in bytes
+    uint32_t samples; // And the number of samples it contains
+};
+typedef struct audio_index_entry* audio_index_entry_p;
+#define SIZEOF_AUDIO_INDEX_ENTRY sizeof(struct audio_index_entry)
+
+struct audio_reader {
+    int file; // The file we are reading from
+    int audio_type; // What sort of audio it contains
+
+    byte* buffer; // Data read from the file
+    uint32_t start; // The offset of the next unused byte in the buffer
+    uint32_t end; // And of the byte after the last valid byte
+    offset_t buffer_posn; // Where buffer[0] is in the file
+    int eof; // Have we read to the end of the file?
+
+    int in_sync; // Is `start` at the start of a frame?
+    uint32_t num_frames; // How many frames we have returned
+    uint64_t num_samples; // And how many samples they held
+    uint32_t num_resyncs; // How many times we had to look for a syncword
+    offset_t bytes_skipped; // And how many bytes we skipped doing so
+
+    // If an index is wanted, one entry for each frame returned
+    int want_index;
+    audio_index_entry_p index;
+    uint32_t index_len;
+    uint32_t index_size;
+};
+typedef struct audio_reader* audio_reader_p;
+#define SIZEOF_AUDIO_READER sizeof(struct audio_reader)
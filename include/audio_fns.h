@@ -59,3 +59,66 @@ void free_audio_frame(audio_frame_p* frame);
  * goes wrong.
  */
 int read_next_audio_frame(int file, int audio_type, audio_frame_p* frame);
+
+/*
+ * Work out the length of an audio frame from its header, without reporting
+ * any problems.
+ *
+ * - `header` is (at least) the first AUDIO_HEADER_SIZE bytes of the frame
+ * - `audio_type` indicates what type of audio - e.g., AUDIO_ADTS
+ * - `samples` is returned as the number of samples in the frame
+ *
+ * Returns the length of the frame in bytes, or -1 if `header` is not a
+ * plausible header for that type of audio.
+ */
+int audio_frame_info(const byte* header, int audio_type, int* samples);
+
+/*
+ * Find the first thing that looks like the syncword for the given type of
+ * audio.
+ *
+ * - `data` and `data_len` are the bytes to look through
+ * - `audio_type` indicates what type of audio - e.g., AUDIO_ADTS
+ *
+ * Returns the offset of the syncword in `data`, or -1 if there is none
+ * (a syncword must lie entirely within `data`).
+ */
+int find_audio_syncword(const byte* data, int data_len, int audio_type);
+
+/*
+ * Build a reader for the audio frames in a file
+ *
+ * - `file` is the file descriptor of the audio file to read from
+ * - `audio_type` indicates what type of audio - e.g., AUDIO_ADTS
+ * - if `want_index` is true, remember the position, length and number of
+ *   samples of each frame returned
+ * - `reader` is the new reader
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int build_audio_reader(int file, int audio_type, int want_index, audio_reader_p* reader);
+
+/*
+ * Tidy up and free an audio reader when we've finished with it
+ *
+ * Does not close the file. Sets `reader` to nullptr. If `reader` is already
+ * nullptr, does nothing.
+ */
+void free_audio_reader(audio_reader_p* reader);
+
+/*
+ * Read the next audio frame.
+ *
+ * Unlike `read_next_audio_frame`, this does not need the input to be
+ * synchronised: if a frame header is not where it is expected, the reader
+ * looks for the next syncword that is followed by a chain of valid frames,
+ * and reports how many bytes were skipped to get there. A truncated frame
+ * at the end of the file is reported and ignored.
+ *
+ * - `reader` is the audio reader
+ * - `frame` is the audio frame that is read
+ *
+ * Returns 0 if all goes well, EOF if end-of-file is read, and 1 if something
+ * goes wrong.
+ */
+int get_next_audio_frame(audio_reader_p reader, audio_frame_p* frame);
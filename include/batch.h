@@ -0,0 +1,437 @@
+/*
+ * Running a tool over a batch of input files, several at a time.
+ *
+ */
+
+#ifndef _batch_h
+#define _batch_h
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mutex>
+#include <new>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "batch_fns.h"
+#include "compat.h"
+#include "printing_fns.h"
+#include "ts_fns.h"
+
+// The size of the buffer each I/O thread reads into
+#define BATCH_READ_SIZE (1024 * 1024)
+
+static int compare_batch_names(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/*
+ * Add a (copy of a) name to a list of names, growing it as necessary.
+ *
+ * Returns 0 if all goes well, 1 if we run out of memory.
+ */
+static int add_batch_name(char*** files, int* num_files, int* size, const char* name)
+{
+    if (*num_files == *size) {
+        int new_size = (*size == 0) ? 64 : *size * 2;
+        char** new_files = (char**)realloc(*files, new_size * sizeof(char*));
+        if (new_files == nullptr)
+            return 1;
+        *files = new_files;
+        *size = new_size;
+    }
+    char* copy = strdup(name);
+    if (copy == nullptr)
+        return 1;
+    (*files)[(*num_files)++] = copy;
+    return 0;
+}
+
+/*
+ * Read the names of the files in a batch.
+ *
+ * - `name` is either a directory, in which case the batch is the regular
+ *   files within it (in name order), or a file listing the names, one per
+ *   line. A `name` of "-" reads the list from standard input.
+ * - `files` is the new array of names, and `num_files` how many there are.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int read_batch_list(const char* name, char*** files, int* num_files)
+{
+    struct stat info;
+    int size = 0;
+    int err = 0;
+
+    *files = nullptr;
+    *num_files = 0;
+
+    if (strcmp(name, "-") && stat(name, &info) == 0 && S_ISDIR(info.st_mode)) {
+        DIR* dir = opendir(name);
+        struct dirent* entry;
+        if (dir == nullptr) {
+            fprint_err("### Unable to read directory %s: %s\n", name, strerror(errno));
+            return 1;
+        }
+        while (!err && (entry = readdir(dir)) != nullptr) {
+            size_t length = strlen(name) + strlen(entry->d_name) + 2;
+            char* path = (char*)malloc(length);
+            if (path == nullptr) {
+                err = 1;
+                break;
+            }
+            snprintf(path, length, "%s/%s", name, entry->d_name);
+            if (stat(path, &info) == 0 && S_ISREG(info.st_mode))
+                err = add_batch_name(files, num_files, &size, path);
+            free(path);
+        }
+        closedir(dir);
+        if (!err && *num_files > 1)
+            qsort(*files, *num_files, sizeof(char*), compare_batch_names);
+    } else {
+        FILE* list = strcmp(name, "-") ? fopen(name, "r") : stdin;
+        char* line = nullptr;
+        size_t line_size = 0;
+        ssize_t length;
+        if (list == nullptr) {
+            fprint_err("### Unable to open batch list %s: %s\n", name, strerror(errno));
+            return 1;
+        }
+        while (!err && (length = getline(&line, &line_size, list)) != -1) {
+            while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+                line[--length] = '\0';
+            if (length > 0)
+                err = add_batch_name(files, num_files, &size, line);
+        }
+        free(line);
+        if (list != stdin)
+            fclose(list);
+    }
+    if (err) {
+        print_err("### Out of memory reading the names of the files in the batch\n");
+        free_batch_list(files, *num_files);
+        *num_files = 0;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Free a list of names made by `read_batch_list`, and set `files` to nullptr.
+ */
+void free_batch_list(char*** files, int num_files)
+{
+    if (*files == nullptr)
+        return;
+    for (int ii = 0; ii < num_files; ii++)
+        free((*files)[ii]);
+    free(*files);
+    *files = nullptr;
+}
+
+// What the threads handling a batch share
+struct batch_work {
+    struct batch_file* files;
+    int num_files;
+    struct batch_options* options;
+    batch_fn fn;
+    void* arg;
+    std::mutex lock; // protects everything below, and the output
+    std::condition_variable changed;
+    int io_jobs; // how many I/O threads are actually running
+    int next_prefetch; // the next file to be read ahead
+    int next_job; // the next file to be handled
+    int next_report; // the next file to be reported, when in order
+    char* line; // for building the JSON for a file
+    size_t line_length;
+    size_t line_size;
+};
+
+/*
+ * Add text to the JSON line being built, as a JSON string if `quote`.
+ *
+ * Returns 0 if all goes well, 1 if we run out of memory.
+ */
+static int batch_append(struct batch_work* work, const char* text, int quote)
+{
+    // At worst every character becomes a six character \u escape
+    size_t wanted = work->line_length + 6 * strlen(text) + 3;
+    if (wanted > work->line_size) {
+        size_t new_size = (work->line_size == 0) ? 4096 : work->line_size;
+        while (new_size < wanted)
+            new_size *= 2;
+        char* new_line = (char*)realloc(work->line, new_size);
+        if (new_line == nullptr)
+            return 1;
+        work->line = new_line;
+        work->line_size = new_size;
+    }
+    char* p = work->line + work->line_length;
+    if (!quote) {
+        strcpy(p, text);
+        work->line_length += strlen(text);
+        return 0;
+    }
+    *p++ = '"';
+    for (; *text != '\0'; text++) {
+        unsigned char ch = (unsigned char)*text;
+        if (ch == '"' || ch == '\\') {
+            *p++ = '\\';
+            *p++ = ch;
+        } else if (ch == '\n') {
+            *p++ = '\\';
+            *p++ = 'n';
+        } else if (ch == '\t') {
+            *p++ = '\\';
+            *p++ = 't';
+        } else if (ch < 0x20) {
+            p += sprintf(p, "\\u%04x", ch);
+        } else {
+            *p++ = ch;
+        }
+    }
+    *p++ = '"';
+    *p = '\0';
+    work->line_length = p - work->line;
+    return 0;
+}
+
+/*
+ * Report on a file that has been handled, as a line of JSON, and release
+ * what it printed. Call with the lock held.
+ */
+static void report_batch_file(struct batch_work* work, struct batch_file* file)
+{
+    char status[16];
+    int err;
+
+    snprintf(status, sizeof(status), "%d", file->status);
+    work->line_length = 0;
+    err = batch_append(work, "{\"file\":", false);
+    if (!err)
+        err = batch_append(work, file->name, true);
+    if (!err)
+        err = batch_append(work, ",\"status\":", false);
+    if (!err)
+        err = batch_append(work, status, false);
+    if (!err)
+        err = batch_append(work, ",\"output\":", false);
+    if (!err)
+        err = batch_append(work, file->capture.length[0] ? file->capture.text[0] : "", true);
+    if (!err)
+        err = batch_append(work, ",\"errors\":", false);
+    if (!err)
+        err = batch_append(work, file->capture.length[1] ? file->capture.text[1] : "", true);
+    if (!err)
+        err = batch_append(work, "}\n", false);
+    if (err)
+        fprint_err("### Out of memory reporting on %s\n", file->name);
+    else
+        print_msg(work->line);
+    free_print_capture(&file->capture);
+}
+
+/*
+ * Read (up to the prefetch size of) a file, so that it is in the page
+ * cache by the time a worker gets to it. Errors are ignored - the worker
+ * will find them for itself.
+ */
+static void prefetch_batch_file(const char* name, offset_t prefetch, byte* buffer)
+{
+    offset_t total = 0;
+    int fd = open(name, O_RDONLY);
+    if (fd == -1)
+        return;
+    while (prefetch == 0 || total < prefetch) {
+        ssize_t length = read(fd, buffer, BATCH_READ_SIZE);
+        if (length <= 0)
+            break;
+        total += length;
+    }
+    close(fd);
+}
+
+static void batch_io_worker(struct batch_work* work)
+{
+    // Don't get further ahead of the workers than this
+    int window = work->options->jobs + work->options->io_jobs;
+    byte* buffer = (byte*)malloc(BATCH_READ_SIZE);
+    std::unique_lock<std::mutex> guard(work->lock);
+    for (;;) {
+        work->changed.wait(guard, [work, window] {
+            return work->next_prefetch >= work->num_files
+                || work->next_prefetch < work->next_job + window;
+        });
+        if (work->next_prefetch >= work->num_files)
+            break;
+        int which = work->next_prefetch++;
+        guard.unlock();
+        if (buffer != nullptr)
+            prefetch_batch_file(work->files[which].name, work->options->prefetch, buffer);
+        guard.lock();
+        work->files[which].prefetched = true;
+        work->changed.notify_all();
+    }
+    free(buffer);
+}
+
+static void batch_worker(struct batch_work* work)
+{
+    std::unique_lock<std::mutex> guard(work->lock);
+    for (;;) {
+        if (work->next_job >= work->num_files)
+            break;
+        struct batch_file* file = &work->files[work->next_job++];
+        work->changed.notify_all();
+        if (work->io_jobs > 0)
+            work->changed.wait(guard, [file] { return file->prefetched; });
+        guard.unlock();
+
+        // Each file starts afresh, whatever this thread handled before
+        reset_continuity_counts();
+        capture_thread_output(&file->capture);
+        int status = work->fn(file->name, work->arg);
+        capture_thread_output(nullptr);
+
+        guard.lock();
+        file->status = status;
+        file->done = true;
+        if (work->options->unordered) {
+            report_batch_file(work, file);
+        } else {
+            while (work->next_report < work->num_files && work->files[work->next_report].done)
+                report_batch_file(work, &work->files[work->next_report++]);
+        }
+        flush_msg();
+    }
+}
+
+/*
+ * Start up to `num_threads` threads running `worker`.
+ *
+ * Returns the number actually started.
+ */
+static int start_batch_threads(
+    std::thread* threads, int num_threads, void (*worker)(struct batch_work*), struct batch_work* work)
+{
+    int num_started = 0;
+    for (int ii = 0; ii < num_threads; ii++) {
+        try {
+            threads[ii] = std::thread(worker, work);
+        } catch (...) {
+            break;
+        }
+        num_started++;
+    }
+    return num_started;
+}
+
+/*
+ * Run `fn` over each of the named files, several at once.
+ *
+ * - `files` and `num_files` are the files to handle.
+ * - `options` says how many files to work on at once, and how many to
+ *   read ahead of that (and how much of each). The reading ahead is done
+ *   by a separate set of threads, so that the number of files being read
+ *   from disk is limited independently of the number being worked on.
+ * - `fn` is called for each file, with `arg`, on one of the worker
+ *   threads. It must not use any state that it shares with the other
+ *   calls, other than read-only settings in `arg`. The (per-thread) TS
+ *   continuity counters are reset before each call.
+ *
+ * What each call of `fn` prints is captured, and reported as a single line
+ * of JSON, of the form:
+ *
+ *   {"file":"<name>","status":<n>,"output":"<text>","errors":"<text>"}
+ *
+ * in the order of `files`, or if `options->unordered`, as each finishes.
+ *
+ * Returns 0 if all goes well, 1 if the batch could not be run.
+ */
+int run_batch(char** files, int num_files, struct batch_options* options, batch_fn fn, void* arg)
+{
+    struct batch_work work;
+    int num_io_started;
+    int num_started;
+    int ii;
+
+    if (options->jobs <= 0) {
+        options->jobs = (int)std::thread::hardware_concurrency();
+        if (options->jobs <= 0)
+            options->jobs = 1;
+    }
+    if (options->jobs > num_files)
+        options->jobs = num_files;
+    if (options->io_jobs > num_files)
+        options->io_jobs = num_files;
+    if (options->io_jobs < 0)
+        options->io_jobs = 0;
+
+    work.files = (struct batch_file*)calloc(num_files ? num_files : 1, sizeof(struct batch_file));
+    if (work.files == nullptr) {
+        print_err("### Unable to allocate datastructure for batch\n");
+        return 1;
+    }
+    for (ii = 0; ii < num_files; ii++)
+        work.files[ii].name = files[ii];
+    work.num_files = num_files;
+    work.options = options;
+    work.fn = fn;
+    work.arg = arg;
+    work.next_prefetch = 0;
+    work.next_job = 0;
+    work.next_report = 0;
+    work.line = nullptr;
+    work.line_length = work.line_size = 0;
+
+    std::thread* io_threads = new (std::nothrow) std::thread[options->io_jobs + 1];
+    std::thread* threads = new (std::nothrow) std::thread[options->jobs + 1];
+
+    // The workers only wait for reading ahead if someone is doing it
+    num_io_started = 0;
+    if (io_threads != nullptr)
+        num_io_started = start_batch_threads(io_threads, options->io_jobs, batch_io_worker, &work);
+    {
+        std::lock_guard<std::mutex> guard(work.lock);
+        work.io_jobs = num_io_started;
+    }
+
+    num_started = 0;
+    if (threads != nullptr)
+        num_started = start_batch_threads(threads, options->jobs, batch_worker, &work);
+    // If we couldn't start any threads, we can at least do the work ourselves
+    if (num_started == 0)
+        batch_worker(&work);
+    for (ii = 0; ii < num_started; ii++)
+        threads[ii].join();
+
+    {
+        // Stop any reading ahead that has not happened yet
+        std::lock_guard<std::mutex> guard(work.lock);
+        work.next_prefetch = num_files;
+        work.changed.notify_all();
+    }
+    for (ii = 0; ii < num_io_started; ii++)
+        io_threads[ii].join();
+
+    delete[] threads;
+    delete[] io_threads;
+    free(work.line);
+    free(work.files);
+    return 0;
+}
+
+#endif // _batch_h
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,50 @@
+/*
+ * Datastructures for running a tool over a batch of input files, several
+ * at a time.
+ *
+ */
+
+#ifndef _batch_defns
+#define _batch_defns
+
+#include "compat.h"
+#include "printing_defns.h"
+
+// How much of each file the I/O threads read ahead of the workers, by
+// default, if the tool does not know how much it is going to read
+#define BATCH_DEFAULT_PREFETCH (4 * 1024 * 1024)
+
+// The default number of files being read ahead at once
+#define BATCH_DEFAULT_IO_JOBS 4
+
+// How the batch is to be run
+struct batch_options {
+    int jobs; // how many files to work on at once (0 means one per CPU)
+    int io_jobs; // how many files to read ahead at once (0 means none)
+    offset_t prefetch; // how much of each file to read ahead (0 means all)
+    int unordered; // report files as they finish, rather than in order
+};
+
+// The function called to handle one file of the batch, with `arg` as
+// given to `run_batch`. Everything it prints is captured and reported
+// in the file's result, along with what it returns, which is the exit
+// status the tool would have had for just that file.
+typedef int (*batch_fn)(char* filename, void* arg);
+
+// A file in a batch, and what happened to it
+struct batch_file {
+    char* name;
+    int prefetched; // has it been read ahead?
+    int done; // has it been handled?
+    int status; // what `batch_fn` returned
+    struct print_capture capture; // what it printed
+};
+
+#endif // _batch_defns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,61 @@
+/*
+ * Functions for running a tool over a batch of input files, several at a
+ * time.
+ *
+ */
+
+#ifndef _batch_fns
+#define _batch_fns
+
+#include "batch_defns.h"
+#include "compat.h"
+
+/*
+ * Read the names of the files in a batch.
+ *
+ * - `name` is either a directory, in which case the batch is the regular
+ *   files within it (in name order), or a file listing the names, one per
+ *   line. A `name` of "-" reads the list from standard input.
+ * - `files` is the new array of names, and `num_files` how many there are.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int read_batch_list(const char* name, char*** files, int* num_files);
+
+/*
+ * Free a list of names made by `read_batch_list`, and set `files` to nullptr.
+ */
+void free_batch_list(char*** files, int num_files);
+
+/*
+ * Run `fn` over each of the named files, several at once.
+ *
+ * - `files` and `num_files` are the files to handle.
+ * - `options` says how many files to work on at once, and how many to
+ *   read ahead of that (and how much of each). The reading ahead is done
+ *   by a separate set of threads, so that the number of files being read
+ *   from disk is limited independently of the number being worked on.
+ * - `fn` is called for each file, with `arg`, on one of the worker
+ *   threads. It must not use any state that it shares with the other
+ *   calls, other than read-only settings in `arg`. The (per-thread) TS
+ *   continuity counters are reset before each call.
+ *
+ * What each call of `fn` prints is captured, and reported as a single line
+ * of JSON, of the form:
+ *
+ *   {"file":"<name>","status":<n>,"output":"<text>","errors":"<text>"}
+ *
+ * in the order of `files`, or if `options->unordered`, as each finishes.
+ *
+ * Returns 0 if all goes well, 1 if the batch could not be run.
+ */
+int run_batch(char** files, int num_files, struct batch_options* options, batch_fn fn, void* arg);
+
+#endif // _batch_fns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,165 @@
+#pragma once
+
+/*
+ * Keeping recently read blocks of a file in memory, so that seeks to
+ * nearby positions need not go back to the file.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "blockcache_fns.h"
+#include "compat.h"
+#include "printing_fns.h"
+
+/*
+ * Build a block cache.
+ *
+ * - `num_blocks` is how many blocks to keep (at least one)
+ * - `block_size` is the size of each block
+ * - `cache` is the new block cache
+ *
+ * The blocks themselves are not allocated until they are first needed.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int build_block_cache(int num_blocks, int32_t block_size, block_cache_p* cache)
+{
+    if (num_blocks < 1)
+        num_blocks = 1;
+    block_cache_p new2 = (block_cache_p)calloc(1, SIZEOF_BLOCK_CACHE);
+    if (new2 == nullptr) {
+        print_err("### Unable to allocate block cache\n");
+        return 1;
+    }
+    new2->blocks
+        = (struct block_cache_entry*)calloc(num_blocks, sizeof(struct block_cache_entry));
+    if (new2->blocks == nullptr) {
+        print_err("### Unable to allocate block cache entries\n");
+        free(new2);
+        return 1;
+    }
+    new2->num_blocks = num_blocks;
+    new2->block_size = block_size;
+    for (int ii = 0; ii < num_blocks; ii++)
+        new2->blocks[ii].posn = -1;
+    *cache = new2;
+    return 0;
+}
+
+/*
+ * Free a block cache, and set `cache` to nullptr.
+ */
+void free_block_cache(block_cache_p* cache)
+{
+    if (*cache == nullptr)
+        return;
+    for (int ii = 0; ii < (*cache)->num_blocks; ii++)
+        free((*cache)->blocks[ii].data);
+    free((*cache)->blocks);
+    free(*cache);
+    *cache = nullptr;
+}
+
+/*
+ * Choose a block to read new data into.
+ *
+ * This is the least recently used block other than `keep` (which is
+ * normally the block currently being read from, whose data may still be
+ * needed). If there is only one block, then that is used regardless.
+ *
+ * The chosen block is marked as empty (with position -1), and remembered
+ * as the block most recently read from the file. The caller should set
+ * its `posn` and `len` once it has been filled.
+ *
+ * Returns the block, or nullptr if it could not be allocated.
+ */
+block_cache_entry_p get_block_to_fill(block_cache_p cache, block_cache_entry_p keep)
+{
+    block_cache_entry_p block = nullptr;
+    for (int ii = 0; ii < cache->num_blocks; ii++) {
+        block_cache_entry_p this_block = &cache->blocks[ii];
+        if (this_block == keep && cache->num_blocks > 1)
+            continue;
+        if (block == nullptr || this_block->posn == -1
+            || (block->posn != -1 && this_block->last_used < block->last_used))
+            block = this_block;
+        if (block->posn == -1)
+            break;
+    }
+    if (block->data == nullptr) {
+        block->data = (byte*)malloc(cache->block_size);
+        if (block->data == nullptr) {
+            print_err("### Unable to allocate block for block cache\n");
+            return nullptr;
+        }
+    }
+    block->posn = -1;
+    block->len = 0;
+    block->last_used = ++cache->clock;
+    cache->last_read = block;
+    return block;
+}
+
+/*
+ * Look for a block containing the given position in the file.
+ *
+ * - `posn` is the position wanted
+ * - `stride` is the granularity of the data within a block. The offset of
+ *   `posn` from the start of the block must be a multiple of this (so
+ *   that, for instance, TS packet boundaries are kept). Use 1 for none.
+ *
+ * Counts a hit or miss accordingly.
+ *
+ * Returns the block (marked as used), or nullptr if there is none.
+ */
+block_cache_entry_p find_cached_block(block_cache_p cache, offset_t posn, int stride)
+{
+    for (int ii = 0; ii < cache->num_blocks; ii++) {
+        block_cache_entry_p block = &cache->blocks[ii];
+        if (block->posn == -1 || posn < block->posn || posn >= block->posn + block->len)
+            continue;
+        if (stride > 1 && (posn - block->posn) % stride != 0)
+            continue;
+        block->last_used = ++cache->clock;
+        cache->hits++;
+        return block;
+    }
+    cache->misses++;
+    return nullptr;
+}
+
+/*
+ * Forget the content of all the blocks in a block cache (for instance,
+ * because the file has been changed underneath us).
+ */
+void forget_cached_blocks(block_cache_p cache)
+{
+    for (int ii = 0; ii < cache->num_blocks; ii++) {
+        cache->blocks[ii].posn = -1;
+        cache->blocks[ii].len = 0;
+    }
+}
+
+/*
+ * Report on the seek statistics of a block cache.
+ *
+ * - if `is_msg` then print as a message, otherwise as an error
+ * - `name` says what the cache is for
+ */
+void report_block_cache(int is_msg, const char* name, block_cache_p cache)
+{
+    uint32_t total = cache->hits + cache->misses;
+    fprint_msg_or_err(is_msg, "%s: %u seek%s, %u satisfied from %d cached block%s (%u%%)\n", name,
+        total, (total == 1 ? "" : "s"), cache->hits, cache->num_blocks,
+        (cache->num_blocks == 1 ? "" : "s"), (total == 0 ? 0 : cache->hits * 100 / total));
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,51 @@
+/*
+ * Datastructures for keeping recently read blocks of a file in memory
+ *
+ * The TS, PS and ES readers read their input a block at a time. Rather
+ * than throwing each block away when the next is read, they keep the last
+ * few in a block cache, so that a seek to somewhere they have recently
+ * read can be satisfied by pointing into a block, instead of by seeking in
+ * (and re-reading) the file.
+ *
+ */
+
+#ifndef _blockcache_defns
+#define _blockcache_defns
+
+#include "compat.h"
+
+struct block_cache_entry {
+    offset_t posn; // Where this block's data came from in the file, or -1
+    int32_t len; // How much of `data` is valid
+    uint32_t last_used; // For choosing the least recently used block
+    byte* data; // The block itself (allocated when first needed)
+};
+typedef struct block_cache_entry* block_cache_entry_p;
+
+struct block_cache {
+    int num_blocks;
+    int32_t block_size;
+    struct block_cache_entry* blocks;
+    uint32_t clock; // Ticks each time a block is used
+
+    // The block most recently filled from the file. The file's read
+    // position is just after this block's data (and possibly after some
+    // more data kept by the reader), so no seek is needed to read on
+    // from the end of it.
+    block_cache_entry_p last_read;
+
+    // Statistics on seeks
+    uint32_t hits; // satisfied from a block in memory
+    uint32_t misses; // which had to go to the file
+};
+typedef struct block_cache* block_cache_p;
+#define SIZEOF_BLOCK_CACHE sizeof(struct block_cache)
+
+#endif // _blockcache_defns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,75 @@
+/*
+ * Functions for keeping recently read blocks of a file in memory
+ *
+ */
+
+#ifndef _blockcache_fns
+#define _blockcache_fns
+
+#include "blockcache_defns.h"
+#include "compat.h"
+
+/*
+ * Build a block cache.
+ *
+ * - `num_blocks` is how many blocks to keep (at least one)
+ * - `block_size` is the size of each block
+ * - `cache` is the new block cache
+ *
+ * The blocks themselves are not allocated until they are first needed.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int build_block_cache(int num_blocks, int32_t block_size, block_cache_p* cache);
+/*
+ * Free a block cache, and set `cache` to nullptr.
+ */
+void free_block_cache(block_cache_p* cache);
+/*
+ * Choose a block to read new data into.
+ *
+ * This is the least recently used block other than `keep` (which is
+ * normally the block currently being read from, whose data may still be
+ * needed). If there is only one block, then that is used regardless.
+ *
+ * The chosen block is marked as empty (with position -1), and remembered
+ * as the block most recently read from the file. The caller should set
+ * its `posn` and `len` once it has been filled.
+ *
+ * Returns the block, or nullptr if it could not be allocated.
+ */
+block_cache_entry_p get_block_to_fill(block_cache_p cache, block_cache_entry_p keep);
+/*
+ * Look for a block containing the given position in the file.
+ *
+ * - `posn` is the position wanted
+ * - `stride` is the granularity of the data within a block. The offset of
+ *   `posn` from the start of the block must be a multiple of this (so
+ *   that, for instance, TS packet boundaries are kept). Use 1 for none.
+ *
+ * Counts a hit or miss accordingly.
+ *
+ * Returns the block (marked as used), or nullptr if there is none.
+ */
+block_cache_entry_p find_cached_block(block_cache_p cache, offset_t posn, int stride);
+/*
+ * Forget the content of all the blocks in a block cache (for instance,
+ * because the file has been changed underneath us).
+ */
+void forget_cached_blocks(block_cache_p cache);
+/*
+ * Report on the seek statistics of a block cache.
+ *
+ * - if `is_msg` then print as a message, otherwise as an error
+ * - `name` says what the cache is for
+ */
+void report_block_cache(int is_msg, const char* name, block_cache_p cache);
+
+#endif // _blockcache_fns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,284 @@
+#pragma once
+
+/*
+ * Codec traits, giving a single view of the H.262 and H.264 stream,
+ * picture, filtering and reversing functions.
+ *
+ * Code that works the same way for each codec (for instance, the play,
+ * filter and reverse loops in tsserve and reverse.h) is written as a
+ * template over one of these traits types. The choice of codec is then made
+ * once, when the template is instantiated for a stream, rather than by
+ * testing an `is_h262` flag for every picture, and each instantiation calls
+ * the codec's own functions directly.
+ *
+ * Each traits type provides:
+ *
+ * - `context_p`, `filter_context_p` and `picture_p`, the codec's types for
+ *   reading pictures, filtering them, and a picture itself
+ * - `name`, for use in messages
+ * - `has_sequence_headers`, true if the stream has (H.262 style) sequence
+ *   headers, which are read as if they were pictures, and remembered for
+ *   reversing as separate entries
+ * - `picture_ends_at_next_item`, true if reading a picture always reads the
+ *   ES unit after it (so if there is no such unit, nothing has been read)
+ * - `reverse_reads_pictures`, true if reversing re-reads each picture (so
+ *   that it can be given an AFD), rather than just copying its bytes
+ * - the static functions below, each named after the generic operation
+ *
+ * To support another codec, write another traits type with the same
+ * members.
+ */
+
+#include "accessunit_fns.h"
+#include "compat.h"
+#include "es_fns.h"
+#include "filter_fns.h"
+#include "h262_fns.h"
+#include "nalunit_defns.h"
+#include "printing_fns.h"
+#include "reverse_fns.h"
+#include "tswrite_defns.h"
+
+struct h262_traits {
+    typedef h262_context_p context_p;
+    typedef h262_filter_context_p filter_context_p;
+    typedef h262_picture_p picture_p;
+
+    static constexpr const char* name = "H.262";
+    static constexpr int has_sequence_headers = true;
+    static constexpr int picture_ends_at_next_item = true;
+    static constexpr int reverse_reads_pictures = true;
+
+    // The stream
+    static inline int build_context(ES_p es, context_p* context)
+    {
+        return build_h262_context(es, context);
+    }
+    static inline void free_context(context_p* context) { free_h262_context(context); }
+    static inline ES_p es(context_p context) { return context->es; }
+    static inline int rewind(context_p context) { return rewind_h262_context(context); }
+    // Forget any ES unit read ahead of the last picture
+    static inline void reset(context_p context)
+    {
+        if (context->last_item)
+            free_h262_item(&context->last_item);
+    }
+    // The ES unit read after the last picture, or nullptr
+    static inline ES_unit_p next_unit(context_p context)
+    {
+        return (context->last_item == nullptr ? nullptr : &context->last_item->unit);
+    }
+    // Go to `where` in the stream (the start of a sequence header), forgetting
+    // any ES unit read ahead of the last picture
+    static inline int seek(context_p context, ES_offset where)
+    {
+        reset(context);
+        context->count_since_seq_hdr = 0;
+        return seek_ES(context->es, where);
+    }
+
+    // Pictures
+    static inline int get_next_picture(context_p context, int verbose, int quiet, picture_p* picture)
+    {
+        return get_next_h262_frame(context, verbose, quiet, picture);
+    }
+    static inline void free_picture(picture_p* picture) { free_h262_picture(picture); }
+    // A sequence header (or end) is read as a "picture", but is not a frame
+    static inline int is_non_frame(picture_p picture) { return !picture->is_picture; }
+    static inline int is_reference_picture(picture_p picture)
+    {
+        return picture->is_picture
+            && (picture->picture_coding_type == 1 || picture->picture_coding_type == 2);
+    }
+    static inline int is_I_or_IDR_picture(picture_p picture)
+    {
+        return picture->is_picture && picture->picture_coding_type == 1;
+    }
+    static inline void print_picture(picture_p picture)
+    {
+        if (!picture->is_picture)
+            print_msg("sequence header");
+        else
+            fprint_msg("%s picture", H262_PICTURE_CODING_STR(picture->picture_coding_type));
+    }
+    static inline int write_picture_as_TS(
+        context_p context, TS_writer_p output, picture_p picture, uint32_t pid)
+    {
+        return write_h262_picture_as_TS(output, picture, pid);
+    }
+
+    // Filtering
+    static inline int build_filter_context(
+        filter_context_p* fcontext, context_p context, int is_strip, int frequency)
+    {
+        if (is_strip)
+            return build_h262_filter_context_strip(fcontext, context, true);
+        else
+            return build_h262_filter_context(fcontext, context, frequency);
+    }
+    static inline void free_filter_context(filter_context_p* fcontext)
+    {
+        free_h262_filter_context(fcontext);
+    }
+    static inline void reset_filter_context(filter_context_p fcontext, int frequency)
+    {
+        reset_h262_filter_context(fcontext);
+        fcontext->freq = frequency;
+    }
+    static inline int get_next_stripped(filter_context_p fcontext, int verbose, int quiet,
+        picture_p* seq_hdr, picture_p* picture, int* delta_pictures_seen)
+    {
+        return get_next_stripped_h262_frame(
+            fcontext, verbose, quiet, seq_hdr, picture, delta_pictures_seen);
+    }
+    static inline int get_next_filtered(filter_context_p fcontext, int verbose, int quiet,
+        picture_p* seq_hdr, picture_p* picture, int* delta_pictures_seen)
+    {
+        return get_next_filtered_h262_frame(
+            fcontext, verbose, quiet, seq_hdr, picture, delta_pictures_seen);
+    }
+
+    // Reversing
+    static inline int add_reverse_context(context_p context, reverse_data_p reverse_data)
+    {
+        return add_h262_reverse_context(context, reverse_data);
+    }
+    static inline reverse_data_p reverse_data(context_p context) { return context->reverse_data; }
+    static inline context_p reverse_context(reverse_data_p reverse_data)
+    {
+        return reverse_data->h262;
+    }
+    static inline int collect_reverse(context_p context, int max, int verbose, int quiet)
+    {
+        return collect_reverse_h262(context, max, verbose, quiet);
+    }
+    // Tell the stream which picture (by index) was the last output
+    static inline uint32_t picture_index(context_p context) { return context->picture_index; }
+    static inline void set_picture_index(context_p context, uint32_t index)
+    {
+        context->picture_index = index;
+    }
+};
+
+struct h264_traits {
+    typedef access_unit_context_p context_p;
+    typedef h264_filter_context_p filter_context_p;
+    typedef access_unit_p picture_p;
+
+    static constexpr const char* name = "H.264";
+    static constexpr int has_sequence_headers = false;
+    static constexpr int picture_ends_at_next_item = false;
+    static constexpr int reverse_reads_pictures = false;
+
+    // The stream
+    static inline int build_context(ES_p es, context_p* context)
+    {
+        return build_access_unit_context(es, context);
+    }
+    static inline void free_context(context_p* context) { free_access_unit_context(context); }
+    static inline ES_p es(context_p context) { return context->nac->es; }
+    static inline int rewind(context_p context) { return rewind_access_unit_context(context); }
+    static inline void reset(context_p context) { reset_access_unit_context(context); }
+    static inline ES_unit_p next_unit(context_p context)
+    {
+        return (context->pending_nal == nullptr ? nullptr : &context->pending_nal->unit);
+    }
+    static inline int seek(context_p context, ES_offset where)
+    {
+        reset_access_unit_context(context);
+        return seek_ES(context->nac->es, where);
+    }
+
+    // Pictures
+    static inline int get_next_picture(context_p context, int verbose, int quiet, picture_p* picture)
+    {
+        return get_next_h264_frame(context, quiet, verbose, picture);
+    }
+    static inline void free_picture(picture_p* picture) { free_access_unit(picture); }
+    static inline int is_non_frame(picture_p picture) { return false; }
+    static inline int is_reference_picture(picture_p picture)
+    {
+        return (picture->primary_start != nullptr && picture->primary_start->nal_ref_idc != 0);
+    }
+    static inline int is_I_or_IDR_picture(picture_p picture)
+    {
+        return (picture->primary_start != nullptr && picture->primary_start->nal_ref_idc != 0
+            && (picture->primary_start->nal_unit_type == NAL_IDR || all_slices_I(picture)));
+    }
+    static inline void print_picture(picture_p picture)
+    {
+        if (picture->primary_start == nullptr)
+            print_msg("<null>");
+        else
+            fprint_msg("idc %d/type %d (%s)", picture->primary_start->nal_ref_idc,
+                picture->primary_start->nal_unit_type,
+                NAL_UNIT_TYPE_STR(picture->primary_start->nal_unit_type));
+    }
+    static inline int write_picture_as_TS(
+        context_p context, TS_writer_p output, picture_p picture, uint32_t pid)
+    {
+        return write_access_unit_as_TS(picture, context, output, pid);
+    }
+
+    // Filtering
+    static inline int build_filter_context(
+        filter_context_p* fcontext, context_p context, int is_strip, int frequency)
+    {
+        if (is_strip)
+            return build_h264_filter_context_strip(fcontext, context, true);
+        else
+            return build_h264_filter_context(fcontext, context, frequency);
+    }
+    static inline void free_filter_context(filter_context_p* fcontext)
+    {
+        free_h264_filter_context(fcontext);
+    }
+    static inline void reset_filter_context(filter_context_p fcontext, int frequency)
+    {
+        reset_h264_filter_context(fcontext);
+        fcontext->freq = frequency;
+    }
+    // There are no sequence headers, so `seq_hdr` is always left nullptr
+    static inline int get_next_stripped(filter_context_p fcontext, int verbose, int quiet,
+        picture_p* seq_hdr, picture_p* picture, int* delta_pictures_seen)
+    {
+        *seq_hdr = nullptr;
+        return get_next_stripped_h264_frame(fcontext, verbose, quiet, picture, delta_pictures_seen);
+    }
+    static inline int get_next_filtered(filter_context_p fcontext, int verbose, int quiet,
+        picture_p* seq_hdr, picture_p* picture, int* delta_pictures_seen)
+    {
+        *seq_hdr = nullptr;
+        return get_next_filtered_h264_frame(fcontext, verbose, quiet, picture, delta_pictures_seen);
+    }
+
+    // Reversing
+    static inline int add_reverse_context(context_p context, reverse_data_p reverse_data)
+    {
+        return add_access_unit_reverse_context(context, reverse_data);
+    }
+    static inline reverse_data_p reverse_data(context_p context) { return context->reverse_data; }
+    static inline context_p reverse_context(reverse_data_p reverse_data)
+    {
+        return reverse_data->h264;
+    }
+    static inline int collect_reverse(context_p context, int max, int verbose, int quiet)
+    {
+        return collect_reverse_access_units(context, max, verbose, quiet);
+    }
+    static inline uint32_t picture_index(context_p context)
+    {
+        return context->access_unit_index;
+    }
+    static inline void set_picture_index(context_p context, uint32_t index)
+    {
+        context->access_unit_index = index;
+    }
+};
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
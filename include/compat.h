@@ -74,6 +74,11 @@ typedef off_t offset_t;
 #define LLD_FORMAT_STUMP "lld"
 #define LLU_FORMAT_STUMP "llu"
 
+// The C++ standard library headers declare members called min() and max(),
+// which the macros below would break. So pull in the ones we use first.
+#include <atomic>
+#include <thread>
+
 // Useful macros, but not side-effect free
 #define max(i, j) ((i) > (j) ? (i) : (j))
 #define min(i, j) ((i) < (j) ? (i) : (j))
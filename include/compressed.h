@@ -0,0 +1,1308 @@
+#pragma once
+
+/*
+ * Reading and writing compressed (gzip or zstd) files as if they were not.
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compat.h"
+#include "compressed_fns.h"
+#include "misc_fns.h"
+#include "printing_fns.h"
+
+// The compressed input (if any) for each file descriptor
+static std::atomic<compressed_input_p> compressed_inputs[COMPRESSED_MAX_FILES];
+
+static inline uint32_t compressed_uint32_le(const byte* data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static inline void compressed_put_uint32_le(byte* data, uint32_t value)
+{
+    data[0] = value & 0xFF;
+    data[1] = (value >> 8) & 0xFF;
+    data[2] = (value >> 16) & 0xFF;
+    data[3] = (value >> 24) & 0xFF;
+}
+
+/*
+ * Read exactly `num_bytes` from `file` at `posn`, without moving its
+ * position (so that more than one thread may do so at once).
+ *
+ * Returns the number of bytes read (fewer than asked for only at
+ * end-of-file), or -1 if something goes wrong.
+ */
+static ssize_t compressed_pread(int file, byte* data, size_t num_bytes, offset_t posn)
+{
+    size_t total = 0;
+    while (total < num_bytes) {
+        ssize_t length = pread(file, data + total, num_bytes - total, posn + total);
+        if (length == 0)
+            break;
+        else if (length == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        total += length;
+    }
+    return total;
+}
+
+/*
+ * Look at the start of a file to see how (if at all) it is compressed.
+ *
+ * Returns COMPRESSED_NONE, COMPRESSED_GZIP or COMPRESSED_ZSTD.
+ */
+int compression_of_file(int filedes)
+{
+    byte magic[4];
+    if (compressed_pread(filedes, magic, 4, 0) != 4)
+        return COMPRESSED_NONE;
+    if (magic[0] == 0x1F && magic[1] == 0x8B)
+        return COMPRESSED_GZIP;
+    if (compressed_uint32_le(magic) == 0xFD2FB528)
+        return COMPRESSED_ZSTD;
+    return COMPRESSED_NONE;
+}
+
+/*
+ * Work out how a file of the given name should be compressed when it is
+ * written, from its extension.
+ *
+ * Returns COMPRESSED_NONE, COMPRESSED_GZIP or COMPRESSED_ZSTD.
+ */
+int compression_for_name(const char* filename)
+{
+    size_t len = strlen(filename);
+    if (len > 3 && !strcmp(filename + len - 3, ".gz"))
+        return COMPRESSED_GZIP;
+    if (len > 4 && !strcmp(filename + len - 4, ".zst"))
+        return COMPRESSED_ZSTD;
+    return COMPRESSED_NONE;
+}
+
+/*
+ * Remember a point from which decompression may be restarted, if it is
+ * after the last one we know about.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int add_compressed_frame(compressed_input_p input, offset_t in_posn, offset_t out_posn,
+    uint32_t in_len, uint32_t out_len)
+{
+    if (input->num_frames > 0 && input->frames[input->num_frames - 1].in_posn >= in_posn)
+        return 0;
+    if (input->num_frames == input->frames_size) {
+        int new_size = (input->frames_size == 0 ? 64 : input->frames_size * 2);
+        compressed_frame_p new_frames = (compressed_frame_p)realloc(
+            input->frames, new_size * sizeof(struct compressed_frame));
+        if (new_frames == nullptr) {
+            print_err("### Unable to extend list of compressed frames\n");
+            return 1;
+        }
+        input->frames = new_frames;
+        input->frames_size = new_size;
+    }
+    input->frames[input->num_frames].in_posn = in_posn;
+    input->frames[input->num_frames].out_posn = out_posn;
+    input->frames[input->num_frames].in_len = in_len;
+    input->frames[input->num_frames].out_len = out_len;
+    input->frames[input->num_frames].window = nullptr;
+    input->frames[input->num_frames].window_len = 0;
+    input->frames[input->num_frames].bits = 0;
+    input->num_frames++;
+    return 0;
+}
+
+/*
+ * Remember a point within a gzip member from which decompression may be
+ * restarted, if it is after the last one we know about.
+ *
+ * - `window` is the (up to) COMPRESSED_WINDOW_SIZE bytes of data that came
+ *   before it in the member, which is copied.
+ * - `bits` is how many bits of the byte before `in_posn` remain to be
+ *   decompressed.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int add_gzip_checkpoint(compressed_input_p input, offset_t in_posn, int bits,
+    offset_t out_posn, const byte* window, uint32_t window_len)
+{
+    int num_frames = input->num_frames;
+    byte* copy;
+    if (add_compressed_frame(input, in_posn, out_posn, 0, 0))
+        return 1;
+    else if (input->num_frames == num_frames)
+        return 0;
+    copy = (byte*)malloc(window_len);
+    if (copy == nullptr) {
+        // We'll just have to manage without this one
+        input->num_frames--;
+        return 0;
+    }
+    memcpy(copy, window, window_len);
+    input->frames[num_frames].window = copy;
+    input->frames[num_frames].window_len = window_len;
+    input->frames[num_frames].bits = bits;
+    return 0;
+}
+
+/*
+ * Read the seek table at the end of a zstd file in the seekable format,
+ * if there is one, and replace our list of frames with it.
+ *
+ * Returns 0 if all goes well (whether or not there was a seek table), 1 if
+ * something goes wrong.
+ */
+static int read_zstd_seek_table(compressed_input_p input)
+{
+    struct stat statbuf;
+    byte footer[ZSTD_SEEK_TABLE_FOOTER_SIZE];
+    byte* table;
+    uint32_t num_frames, entry_size, table_size;
+    offset_t in_posn = 0, out_posn = 0;
+
+    if (fstat(input->file, &statbuf) || statbuf.st_size < ZSTD_SEEK_TABLE_FOOTER_SIZE + 8)
+        return 0;
+    if (compressed_pread(input->file, footer, ZSTD_SEEK_TABLE_FOOTER_SIZE,
+            statbuf.st_size - ZSTD_SEEK_TABLE_FOOTER_SIZE)
+            != ZSTD_SEEK_TABLE_FOOTER_SIZE
+        || compressed_uint32_le(footer + 5) != ZSTD_SEEKABLE_MAGIC || (footer[4] & 0x7C) != 0)
+        return 0;
+
+    num_frames = compressed_uint32_le(footer);
+    entry_size = (footer[4] & 0x80) ? 12 : 8; // with or without checksums
+    if (num_frames == 0 || num_frames > statbuf.st_size / entry_size)
+        return 0;
+    table_size = 8 + num_frames * entry_size + ZSTD_SEEK_TABLE_FOOTER_SIZE;
+    if ((offset_t)table_size > statbuf.st_size)
+        return 0;
+
+    table = (byte*)malloc(table_size);
+    if (table == nullptr) {
+        print_err("### Unable to allocate buffer for zstd seek table\n");
+        return 1;
+    }
+    if (compressed_pread(input->file, table, table_size, statbuf.st_size - table_size)
+            != table_size
+        || compressed_uint32_le(table) != ZSTD_SEEK_TABLE_MAGIC
+        || compressed_uint32_le(table + 4) != table_size - 8) {
+        free(table);
+        return 0;
+    }
+
+    input->num_frames = 0;
+    for (uint32_t ii = 0; ii < num_frames; ii++) {
+        uint32_t in_len = compressed_uint32_le(table + 8 + ii * entry_size);
+        uint32_t out_len = compressed_uint32_le(table + 8 + ii * entry_size + 4);
+        if (add_compressed_frame(input, in_posn, out_posn, in_len, out_len)) {
+            free(table);
+            return 1;
+        }
+        in_posn += in_len;
+        out_posn += out_len;
+    }
+    free(table);
+
+    if (in_posn + table_size != statbuf.st_size) {
+        // It doesn't describe this file - ignore it
+        input->num_frames = 0;
+        return add_compressed_frame(input, 0, 0, 0, 0);
+    }
+    input->have_seek_table = true;
+    input->length = out_posn;
+    return 0;
+}
+
+/*
+ * Should the frames of this input be decompressed in parallel?
+ */
+static int can_decompress_in_parallel(compressed_input_p input)
+{
+    if (!input->have_seek_table || input->num_frames < 2)
+        return false;
+    for (int ii = 0; ii < input->num_frames; ii++)
+        if (input->frames[ii].out_len > COMPRESSED_MAX_FRAME_SIZE)
+            return false;
+    return true;
+}
+
+// ------------------------------------------------------------
+// Decompressing in order
+
+// The state of a single thread decompressing in order
+struct compressed_stream {
+    compressed_input_p input;
+    byte* in_buf; // Compressed data read from the file
+    size_t in_len; // How much of it there is
+    size_t in_used; // And how much has been decompressed
+    offset_t in_posn; // Where in_buf[0] came from in the file
+    offset_t out_posn; // The position in the decompressed data we have reached
+    int at_frame_start; // True if we're between gzip members or zstd frames
+    z_stream gzip;
+    int raw; // True if we restarted within a gzip member (so have no header)
+    uint32_t trailer_left; // And how much of its trailer we have yet to skip
+    byte* window; // The last COMPRESSED_WINDOW_SIZE bytes of the member
+    uint32_t window_len;
+    offset_t last_checkpoint; // The out_posn of the last restart point
+#if HAVE_ZSTD
+    ZSTD_DStream* zstd;
+#endif
+};
+
+/*
+ * Make sure there is some compressed data to work on.
+ *
+ * Returns 0 if there is, EOF if we've reached the end of the file, 1 if
+ * something goes wrong.
+ */
+static int refill_compressed_stream(struct compressed_stream* stream)
+{
+    ssize_t length;
+    if (stream->in_used < stream->in_len)
+        return 0;
+    stream->in_posn += stream->in_len;
+    stream->in_len = stream->in_used = 0;
+    length = compressed_pread(stream->input->file, stream->in_buf, COMPRESSED_READ_SIZE,
+        stream->in_posn);
+    if (length == -1) {
+        fprint_err("### Error reading compressed file %s: %s\n", stream->input->name,
+            strerror(errno));
+        return 1;
+    } else if (length == 0)
+        return EOF;
+    stream->in_len = length;
+    return 0;
+}
+
+/*
+ * Remember the last COMPRESSED_WINDOW_SIZE bytes of decompressed data.
+ */
+static void update_gzip_window(struct compressed_stream* stream, const byte* data, uint32_t length)
+{
+    if (length >= COMPRESSED_WINDOW_SIZE) {
+        memcpy(stream->window, data + length - COMPRESSED_WINDOW_SIZE, COMPRESSED_WINDOW_SIZE);
+        stream->window_len = COMPRESSED_WINDOW_SIZE;
+        return;
+    }
+    if (stream->window_len + length > COMPRESSED_WINDOW_SIZE) {
+        uint32_t drop = stream->window_len + length - COMPRESSED_WINDOW_SIZE;
+        memmove(stream->window, stream->window + drop, stream->window_len - drop);
+        stream->window_len -= drop;
+    }
+    memcpy(stream->window + stream->window_len, data, length);
+    stream->window_len += length;
+}
+
+/*
+ * Inflate some gzip data into `data`, which already has `got` bytes in it.
+ *
+ * Every so often, at the end of a deflate block, remember a restart point.
+ *
+ * Returns 0 if all goes well, EOF if the end of the data has been reached,
+ * 1 if something goes wrong.
+ */
+static int inflate_some(struct compressed_stream* stream, byte* data, uint32_t data_size,
+    uint32_t* got)
+{
+    compressed_input_p input = stream->input;
+    int ret;
+
+    if (stream->trailer_left > 0) {
+        // Skip the CRC and length at the end of a member we restarted in
+        size_t skip = stream->in_len - stream->in_used;
+        if (skip > stream->trailer_left)
+            skip = stream->trailer_left;
+        stream->in_used += skip;
+        stream->trailer_left -= (uint32_t)skip;
+        stream->at_frame_start = (stream->trailer_left == 0);
+        return 0;
+    }
+    if (stream->at_frame_start) {
+        if (stream->in_buf[stream->in_used] != 0x1F) {
+            // Not another member, so (as gzip does) ignore it
+            if (!input->said_trailing)
+                fprint_err("!!! Ignoring data after the end of compressed file %s\n",
+                    input->name);
+            input->said_trailing = true;
+            return EOF;
+        }
+        {
+            // A new member - remember where it starts
+            std::lock_guard<std::mutex> guard(input->lock);
+            if (add_compressed_frame(
+                    input, stream->in_posn + stream->in_used, stream->out_posn + *got, 0, 0))
+                return 1;
+        }
+        inflateReset2(&stream->gzip, 15 + 32);
+        stream->raw = stream->at_frame_start = false;
+        stream->window_len = 0;
+        stream->last_checkpoint = stream->out_posn + *got;
+    }
+
+    stream->gzip.next_in = stream->in_buf + stream->in_used;
+    stream->gzip.avail_in = (uInt)(stream->in_len - stream->in_used);
+    stream->gzip.next_out = data + *got;
+    stream->gzip.avail_out = data_size - *got;
+    ret = inflate(&stream->gzip, Z_BLOCK);
+    stream->in_used = stream->in_len - stream->gzip.avail_in;
+    update_gzip_window(stream, data + *got, data_size - stream->gzip.avail_out - *got);
+    *got = data_size - stream->gzip.avail_out;
+
+    if (ret == Z_STREAM_END) {
+        if (stream->raw)
+            stream->trailer_left = 8;
+        else
+            stream->at_frame_start = true;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        fprint_err("### Error decompressing %s: %s\n", input->name,
+            (stream->gzip.msg ? stream->gzip.msg : "corrupt data"));
+        return 1;
+    } else if ((stream->gzip.data_type & 128) && !(stream->gzip.data_type & 64)
+        && stream->out_posn + *got - stream->last_checkpoint >= COMPRESSED_CHECKPOINT_SPACING) {
+        // At the end of a deflate block that is not the last
+        std::lock_guard<std::mutex> guard(input->lock);
+        stream->last_checkpoint = stream->out_posn + *got;
+        if (add_gzip_checkpoint(input, stream->in_posn + stream->in_used,
+                stream->gzip.data_type & 7, stream->last_checkpoint, stream->window,
+                stream->window_len))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Decompress up to `data_size` bytes into `data`.
+ *
+ * Returns 0 if all goes well, EOF if the end of the compressed data has been
+ * reached (in which case `data_len` may still be more than 0), 1 if
+ * something goes wrong.
+ */
+static int decompress_in_order(
+    struct compressed_stream* stream, byte* data, uint32_t data_size, uint32_t* data_len)
+{
+    compressed_input_p input = stream->input;
+    uint32_t got = 0;
+    int err = 0;
+
+    while (got < data_size) {
+        err = refill_compressed_stream(stream);
+        if (err == EOF && !stream->at_frame_start) {
+            fprint_err("### Compressed file %s is truncated\n", input->name);
+            err = 1;
+        }
+        if (err)
+            break;
+
+        if (input->format == COMPRESSED_GZIP) {
+            err = inflate_some(stream, data, data_size, &got);
+            if (err)
+                break;
+        } else {
+#if HAVE_ZSTD
+            if (stream->at_frame_start) {
+                // A new frame - remember where it starts
+                std::lock_guard<std::mutex> guard(input->lock);
+                err = add_compressed_frame(
+                    input, stream->in_posn + stream->in_used, stream->out_posn + got, 0, 0);
+                if (err)
+                    break;
+            }
+            ZSTD_inBuffer in = { stream->in_buf, stream->in_len, stream->in_used };
+            ZSTD_outBuffer out = { data, data_size, got };
+            size_t ret = ZSTD_decompressStream(stream->zstd, &out, &in);
+            if (ZSTD_isError(ret)) {
+                fprint_err(
+                    "### Error decompressing %s: %s\n", input->name, ZSTD_getErrorName(ret));
+                err = 1;
+                break;
+            }
+            stream->in_used = in.pos;
+            got = (uint32_t)out.pos;
+            stream->at_frame_start = (ret == 0);
+#endif
+        }
+    }
+    stream->out_posn += got;
+    *data_len = got;
+    return err;
+}
+
+/*
+ * The thread that decompresses in order, filling each block of the ring
+ * in turn.
+ *
+ * It starts from the restart point itself, rather than the position the
+ * reader wants, so that the reader can then move back as far as the restart
+ * point (as esreverse does, a picture at a time) without starting again.
+ */
+static void compressed_stream_producer(compressed_input_p input)
+{
+    struct compressed_stream stream;
+    compressed_frame_p frame = &input->frames[input->first_frame];
+    int err = 0;
+
+    memset(&stream, 0, sizeof(stream));
+    stream.input = input;
+    stream.in_posn = frame->in_posn;
+    stream.out_posn = frame->out_posn;
+    stream.at_frame_start = true;
+    stream.in_buf = (byte*)malloc(COMPRESSED_READ_SIZE);
+    if (stream.in_buf == nullptr) {
+        print_err("### Unable to allocate buffer for compressed data\n");
+        err = 1;
+    } else if (input->format == COMPRESSED_GZIP) {
+        stream.window = (byte*)malloc(COMPRESSED_WINDOW_SIZE);
+        if (stream.window == nullptr
+            || inflateInit2(&stream.gzip, (frame->window != nullptr ? -15 : 15 + 32)) != Z_OK) {
+            print_err("### Unable to start gzip decompression\n");
+            err = 1;
+        } else if (frame->window != nullptr) {
+            // Restart part way through a member, as zlib's examples/zran.c does
+            byte prev;
+            stream.raw = true;
+            stream.at_frame_start = false;
+            stream.last_checkpoint = frame->out_posn;
+            if (frame->bits != 0) {
+                if (compressed_pread(input->file, &prev, 1, frame->in_posn - 1) != 1) {
+                    fprint_err("### Error reading compressed file %s\n", input->name);
+                    err = 1;
+                } else
+                    inflatePrime(&stream.gzip, frame->bits, prev >> (8 - frame->bits));
+            }
+            inflateSetDictionary(&stream.gzip, frame->window, frame->window_len);
+            update_gzip_window(&stream, frame->window, frame->window_len);
+        }
+    } else {
+#if HAVE_ZSTD
+        stream.zstd = ZSTD_createDStream();
+        if (stream.zstd == nullptr) {
+            print_err("### Unable to start zstd decompression\n");
+            err = 1;
+        }
+#endif
+    }
+
+    for (;;) {
+        struct compressed_block* block;
+        uint32_t seq;
+        {
+            std::unique_lock<std::mutex> guard(input->lock);
+            while (!input->stopping && input->tail - input->head >= COMPRESSED_RING_SIZE)
+                input->emptied.wait(guard);
+            if (input->stopping)
+                break;
+            seq = input->tail++;
+        }
+        block = &input->blocks[seq % COMPRESSED_RING_SIZE];
+        if (!err && block->data_size < COMPRESSED_BLOCK_SIZE) {
+            byte* data = (byte*)realloc(block->data, COMPRESSED_BLOCK_SIZE);
+            if (data == nullptr) {
+                print_err("### Unable to allocate block for decompressed data\n");
+                err = 1;
+            } else {
+                block->data = data;
+                block->data_size = COMPRESSED_BLOCK_SIZE;
+            }
+        }
+        block->posn = stream.out_posn;
+        block->data_len = 0;
+        if (!err)
+            err = decompress_in_order(
+                &stream, block->data, COMPRESSED_BLOCK_SIZE, &block->data_len);
+        {
+            std::lock_guard<std::mutex> guard(input->lock);
+            block->seq = seq;
+            block->err = err;
+            block->ready = true;
+        }
+        input->filled.notify_all();
+        if (err)
+            break;
+    }
+
+    free(stream.in_buf);
+    free(stream.window);
+    if (input->format == COMPRESSED_GZIP)
+        inflateEnd(&stream.gzip);
+#if HAVE_ZSTD
+    else
+        ZSTD_freeDStream(stream.zstd);
+#endif
+}
+
+// ------------------------------------------------------------
+// Decompressing frames in parallel
+
+#if HAVE_ZSTD
+/*
+ * A thread that decompresses whole zstd frames (as described by the seek
+ * table) into the ring, taking the next frame each time.
+ */
+static void compressed_frame_worker(compressed_input_p input)
+{
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    byte* in_buf = nullptr;
+    uint32_t in_size = 0;
+
+    for (;;) {
+        struct compressed_block* block;
+        compressed_frame_p frame;
+        uint32_t seq;
+        int err = 0;
+        {
+            std::unique_lock<std::mutex> guard(input->lock);
+            while (!input->stopping && input->tail - input->head >= COMPRESSED_RING_SIZE
+                && input->first_frame + (int)input->tail < input->num_frames)
+                input->emptied.wait(guard);
+            if (input->stopping || input->first_frame + (int)input->tail >= input->num_frames)
+                break;
+            seq = input->tail++;
+        }
+        block = &input->blocks[seq % COMPRESSED_RING_SIZE];
+        frame = &input->frames[input->first_frame + seq];
+        block->posn = frame->out_posn;
+        block->data_len = 0;
+
+        if (dctx == nullptr) {
+            print_err("### Unable to start zstd decompression\n");
+            err = 1;
+        } else if (in_size < frame->in_len || block->data_size < frame->out_len) {
+            byte* new_in = (in_size < frame->in_len ? (byte*)realloc(in_buf, frame->in_len)
+                                                     : in_buf);
+            byte* new_out = (block->data_size < frame->out_len
+                    ? (byte*)realloc(block->data, frame->out_len)
+                    : block->data);
+            if (new_in != nullptr) {
+                in_buf = new_in;
+                in_size = (in_size > frame->in_len ? in_size : frame->in_len);
+            }
+            if (new_out != nullptr) {
+                block->data = new_out;
+                block->data_size
+                    = (block->data_size > frame->out_len ? block->data_size : frame->out_len);
+            }
+            if (new_in == nullptr || new_out == nullptr) {
+                print_err("### Unable to allocate buffers for zstd frame\n");
+                err = 1;
+            }
+        }
+        if (!err) {
+            ssize_t length = compressed_pread(input->file, in_buf, frame->in_len, frame->in_posn);
+            if (length != (ssize_t)frame->in_len) {
+                fprint_err("### Error reading compressed file %s: %s\n", input->name,
+                    (length == -1 ? strerror(errno) : "unexpected end of file"));
+                err = 1;
+            }
+        }
+        if (!err && frame->out_len > 0) {
+            size_t ret
+                = ZSTD_decompressDCtx(dctx, block->data, frame->out_len, in_buf, frame->in_len);
+            if (ZSTD_isError(ret) || ret != frame->out_len) {
+                fprint_err("### Error decompressing %s: %s\n", input->name,
+                    (ZSTD_isError(ret) ? ZSTD_getErrorName(ret) : "frame has the wrong length"));
+                err = 1;
+            } else
+                block->data_len = frame->out_len;
+        }
+        {
+            std::lock_guard<std::mutex> guard(input->lock);
+            block->seq = seq;
+            block->err = err;
+            block->ready = true;
+        }
+        input->filled.notify_all();
+    }
+    free(in_buf);
+    ZSTD_freeDCtx(dctx);
+}
+#endif
+
+// ------------------------------------------------------------
+/*
+ * Stop the decompression threads (if they are running), and forget anything
+ * they have decompressed.
+ */
+static void halt_compressed_input(compressed_input_p input)
+{
+    if (!input->running)
+        return;
+    {
+        std::lock_guard<std::mutex> guard(input->lock);
+        input->stopping = true;
+    }
+    input->emptied.notify_all();
+    for (int ii = 0; ii < input->num_threads; ii++)
+        input->threads[ii].join();
+    for (int ii = 0; ii < COMPRESSED_RING_SIZE; ii++)
+        input->blocks[ii].ready = false;
+    input->running = false;
+}
+
+/*
+ * Start the decompression threads, from the last restart point at or
+ * before our current position.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int start_compressed_input(compressed_input_p input)
+{
+    int parallel = input->parallel;
+    int wanted = 1;
+    int ff = 0;
+
+    // The frames are in order, so look for the last that starts in time
+    for (int lo = 0, hi = input->num_frames - 1; lo <= hi;) {
+        int mid = (lo + hi) / 2;
+        if (input->frames[mid].out_posn <= input->posn) {
+            ff = mid;
+            lo = mid + 1;
+        } else
+            hi = mid - 1;
+    }
+    // A zero length frame at our position is of no use to us
+    while (parallel && ff < input->num_frames - 1
+        && input->frames[ff].out_posn + input->frames[ff].out_len <= input->posn)
+        ff++;
+
+    input->first_frame = ff;
+    input->head = input->tail = 0;
+    input->stopping = false;
+    if (parallel) {
+        wanted = (int)std::thread::hardware_concurrency();
+        if (wanted > COMPRESSED_MAX_THREADS)
+            wanted = COMPRESSED_MAX_THREADS;
+        else if (wanted < 1)
+            wanted = 1;
+    }
+
+    input->num_threads = 0;
+    for (int ii = 0; ii < wanted; ii++) {
+        try {
+#if HAVE_ZSTD
+            if (parallel)
+                input->threads[ii] = std::thread(compressed_frame_worker, input);
+            else
+#endif
+                input->threads[ii] = std::thread(compressed_stream_producer, input);
+            input->num_threads++;
+        } catch (...) {
+            break;
+        }
+    }
+    if (input->num_threads == 0) {
+        print_err("### Unable to start thread to decompress input\n");
+        return 1;
+    }
+    input->running = true;
+    return 0;
+}
+
+/*
+ * Read decompressed data.
+ *
+ * This is the equivalent of `read` for a compressed input.
+ *
+ * Returns the number of bytes read, 0 at end-of-file, or -1 if something
+ * goes wrong (in which case a message will already have been output).
+ */
+ssize_t read_compressed_input(compressed_input_p input, byte* data, size_t num_bytes)
+{
+    size_t total = 0;
+
+    if (!input->running && start_compressed_input(input)) {
+        errno = EIO;
+        return -1;
+    }
+
+    while (total < num_bytes) {
+        struct compressed_block* block = &input->blocks[input->head % COMPRESSED_RING_SIZE];
+        uint32_t offset, count;
+
+        if (input->parallel && input->first_frame + (int)input->head >= input->num_frames)
+            break; // no more frames
+        {
+            std::unique_lock<std::mutex> guard(input->lock);
+            while (!(block->ready && block->seq == input->head))
+                input->filled.wait(guard);
+        }
+
+        offset = (uint32_t)(input->posn - block->posn);
+        if (input->posn < block->posn + block->data_len) {
+            count = block->data_len - offset;
+            if (count > num_bytes - total)
+                count = (uint32_t)(num_bytes - total);
+            memcpy(data + total, block->data + offset, count);
+            total += count;
+            input->posn += count;
+        }
+        if (input->posn < block->posn + block->data_len)
+            break; // we've read all we were asked for
+        if (block->err) {
+            // We've read everything there is - leave this block here, so
+            // that we say so again if asked
+            if (block->err == EOF || total > 0)
+                break;
+            errno = EIO;
+            return -1;
+        }
+        {
+            std::lock_guard<std::mutex> guard(input->lock);
+            block->ready = false;
+            input->head++;
+        }
+        input->emptied.notify_all();
+    }
+    return total;
+}
+
+/*
+ * Move to a new position in the decompressed data.
+ *
+ * This is the equivalent of `lseek` (with SEEK_SET) for a compressed input.
+ *
+ * Moving forwards (a short way, or at all if we have no seek table) just
+ * reads on. Moving backwards within the block we're reading from costs
+ * nothing, but otherwise means starting decompression again from the last
+ * restart point before the new position.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int seek_compressed_input(compressed_input_p input, offset_t posn)
+{
+    if (posn < 0) {
+        fprint_err("### Cannot seek to " OFFSET_T_FORMAT " in %s\n", posn, input->name);
+        return 1;
+    }
+    if (input->running) {
+        struct compressed_block* block = &input->blocks[input->head % COMPRESSED_RING_SIZE];
+        int ready;
+        {
+            std::lock_guard<std::mutex> guard(input->lock);
+            ready = (block->ready && block->seq == input->head);
+        }
+        if (posn >= input->posn
+            && (!input->parallel || posn - input->posn < COMPRESSED_SEEK_AHEAD)) {
+            input->posn = posn;
+            return 0;
+        } else if (ready && posn >= block->posn && posn <= input->posn) {
+            input->posn = posn;
+            return 0;
+        }
+        halt_compressed_input(input);
+    }
+    input->posn = posn;
+    return 0;
+}
+
+/*
+ * If a file descriptor is for a compressed file that we are decompressing,
+ * return its compressed input, otherwise nullptr.
+ */
+compressed_input_p get_compressed_input(int filedes)
+{
+    if (filedes < 0 || filedes >= COMPRESSED_MAX_FILES)
+        return nullptr;
+    return compressed_inputs[filedes].load(std::memory_order_acquire);
+}
+
+/*
+ * Is a file descriptor for a compressed file that we are decompressing?
+ */
+int is_compressed_file(int filedes)
+{
+    return get_compressed_input(filedes) != nullptr;
+}
+
+/*
+ * Tidy up and free a compressed input (but do not close its file).
+ */
+static void free_compressed_input(compressed_input_p* input)
+{
+    if (*input == nullptr)
+        return;
+    halt_compressed_input(*input);
+    for (int ii = 0; ii < COMPRESSED_RING_SIZE; ii++)
+        free((*input)->blocks[ii].data);
+    for (int ii = 0; ii < (*input)->num_frames; ii++)
+        free((*input)->frames[ii].window);
+    free((*input)->frames);
+    free((*input)->name);
+    delete *input;
+    *input = nullptr;
+}
+
+/*
+ * Build a compressed input for a file that we know to be compressed.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int build_compressed_input(
+    int filedes, const char* filename, int format, compressed_input_p* input)
+{
+    compressed_input_p new2 = new (std::nothrow) struct compressed_input;
+    if (new2 == nullptr) {
+        print_err("### Unable to allocate compressed input datastructure\n");
+        return 1;
+    }
+    new2->file = filedes;
+    new2->format = format;
+    new2->name = strdup(filename);
+    new2->posn = 0;
+    new2->frames = nullptr;
+    new2->num_frames = new2->frames_size = 0;
+    new2->have_seek_table = new2->parallel = false;
+    new2->said_trailing = false;
+    new2->length = -1;
+    for (int ii = 0; ii < COMPRESSED_RING_SIZE; ii++) {
+        new2->blocks[ii].data = nullptr;
+        new2->blocks[ii].data_len = new2->blocks[ii].data_size = 0;
+        new2->blocks[ii].ready = false;
+    }
+    new2->head = new2->tail = 0;
+    new2->running = new2->stopping = false;
+    new2->num_threads = 0;
+
+    if (new2->name == nullptr || add_compressed_frame(new2, 0, 0, 0, 0)
+        || (format == COMPRESSED_ZSTD && read_zstd_seek_table(new2))) {
+        free_compressed_input(&new2);
+        return 1;
+    }
+    new2->parallel = can_decompress_in_parallel(new2);
+    *input = new2;
+    return 0;
+}
+
+/*
+ * If a newly opened file is compressed, arrange for reads from it (via
+ * `read_file`, `read_bytes`, `seek_file` and `tell_file`) to return the
+ * decompressed data instead.
+ *
+ * - `filedes` is the file, which must be open for reading and seekable (if
+ *   it is not, it is left alone)
+ * - `filename` is its name, for messages
+ *
+ * Returns 0 if all goes well (whether or not the file was compressed), 1 if
+ * something goes wrong.
+ */
+int setup_compressed_input(int filedes, const char* filename)
+{
+    compressed_input_p input = nullptr;
+    struct stat statbuf;
+    int format;
+
+    if (fstat(filedes, &statbuf) || !S_ISREG(statbuf.st_mode))
+        return 0;
+    format = compression_of_file(filedes);
+    if (format == COMPRESSED_NONE)
+        return 0;
+#if !HAVE_ZSTD
+    if (format == COMPRESSED_ZSTD) {
+        fprint_err("### %s is compressed with zstd, which is not supported by this build\n",
+            filename);
+        return 1;
+    }
+#endif
+    if (filedes >= COMPRESSED_MAX_FILES) {
+        fprint_err("### Too many files open to decompress %s\n", filename);
+        return 1;
+    }
+    if (build_compressed_input(filedes, filename, format, &input))
+        return 1;
+    compressed_inputs[filedes].store(input, std::memory_order_release);
+    return 0;
+}
+
+/*
+ * Stop decompressing a file, because it is about to be closed.
+ *
+ * Does nothing if the file is not one we are decompressing.
+ */
+void finish_compressed_input(int filedes)
+{
+    compressed_input_p input = get_compressed_input(filedes);
+    if (input == nullptr)
+        return;
+    compressed_inputs[filedes].store(nullptr, std::memory_order_release);
+    free_compressed_input(&input);
+}
+
+// ------------------------------------------------------------
+// Reading a compressed file via stdio
+
+static ssize_t compressed_cookie_read(void* cookie, char* buf, size_t size)
+{
+    return read_compressed_input((compressed_input_p)cookie, (byte*)buf, size);
+}
+
+static int compressed_cookie_seek(void* cookie, off64_t* offset, int whence)
+{
+    compressed_input_p input = (compressed_input_p)cookie;
+    offset_t posn;
+    if (whence == SEEK_SET)
+        posn = *offset;
+    else if (whence == SEEK_CUR)
+        posn = input->posn + *offset;
+    else {
+        errno = EINVAL; // we don't necessarily know where the end is
+        return -1;
+    }
+    if (seek_compressed_input(input, posn)) {
+        errno = EINVAL;
+        return -1;
+    }
+    *offset = posn;
+    return 0;
+}
+
+static int compressed_cookie_close_input(void* cookie)
+{
+    compressed_input_p input = (compressed_input_p)cookie;
+    int file = input->file;
+    free_compressed_input(&input);
+    return close(file);
+}
+
+// ------------------------------------------------------------
+// Writing a compressed file via stdio
+
+/*
+ * Write out the compressed data in our buffer.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int flush_compressed_output(compressed_output_p output, size_t length)
+{
+    size_t done = 0;
+    while (done < length) {
+        ssize_t written = write(output->file, output->buffer + done, length - done);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            fprint_err("### Error writing compressed output: %s\n", strerror(errno));
+            return 1;
+        }
+        done += written;
+    }
+#if HAVE_ZSTD
+    output->written += length;
+#endif
+    return 0;
+}
+
+#if HAVE_ZSTD
+/*
+ * Compress some data with zstd, ending the current frame if `end` is true.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int compress_zstd(compressed_output_p output, const byte* data, size_t length, int end)
+{
+    ZSTD_inBuffer in = { data, length, 0 };
+    for (;;) {
+        ZSTD_outBuffer out = { output->buffer, output->buffer_size, 0 };
+        size_t left = ZSTD_compressStream2(
+            output->zstd, &out, &in, (end ? ZSTD_e_end : ZSTD_e_continue));
+        if (ZSTD_isError(left)) {
+            fprint_err("### Error compressing output: %s\n", ZSTD_getErrorName(left));
+            return 1;
+        }
+        if (flush_compressed_output(output, out.pos))
+            return 1;
+        if (end ? left == 0 : in.pos == in.size)
+            break;
+    }
+    output->frame_in += (uint32_t)length;
+    if (end) {
+        // Remember the frame for the seek table
+        if (output->num_seek_frames == output->seek_table_size) {
+            int new_size = (output->seek_table_size == 0 ? 64 : output->seek_table_size * 2);
+            uint32_t* new_table
+                = (uint32_t*)realloc(output->seek_table, new_size * 2 * sizeof(uint32_t));
+            if (new_table == nullptr) {
+                print_err("### Unable to extend zstd seek table\n");
+                return 1;
+            }
+            output->seek_table = new_table;
+            output->seek_table_size = new_size;
+        }
+        output->seek_table[2 * output->num_seek_frames]
+            = (uint32_t)(output->written - output->frame_start);
+        output->seek_table[2 * output->num_seek_frames + 1] = output->frame_in;
+        output->num_seek_frames++;
+        output->frame_start = output->written;
+        output->frame_in = 0;
+    }
+    return 0;
+}
+
+/*
+ * Write the zstd seek table, so that the file can be read in parallel.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int write_zstd_seek_table(compressed_output_p output)
+{
+    size_t table_size = 8 + output->num_seek_frames * 8 + ZSTD_SEEK_TABLE_FOOTER_SIZE;
+    byte* table = (byte*)malloc(table_size);
+    int err;
+    if (table == nullptr) {
+        print_err("### Unable to allocate zstd seek table\n");
+        return 1;
+    }
+    compressed_put_uint32_le(table, ZSTD_SEEK_TABLE_MAGIC);
+    compressed_put_uint32_le(table + 4, (uint32_t)(table_size - 8));
+    for (int ii = 0; ii < output->num_seek_frames; ii++) {
+        compressed_put_uint32_le(table + 8 + ii * 8, output->seek_table[2 * ii]);
+        compressed_put_uint32_le(table + 12 + ii * 8, output->seek_table[2 * ii + 1]);
+    }
+    compressed_put_uint32_le(table + table_size - 9, output->num_seek_frames);
+    table[table_size - 5] = 0; // no checksums
+    compressed_put_uint32_le(table + table_size - 4, ZSTD_SEEKABLE_MAGIC);
+
+    byte* buffer = output->buffer;
+    output->buffer = table;
+    err = flush_compressed_output(output, table_size);
+    output->buffer = buffer;
+    free(table);
+    return err;
+}
+#endif
+
+static ssize_t compressed_cookie_write(void* cookie, const char* buf, size_t size)
+{
+    compressed_output_p output = (compressed_output_p)cookie;
+    const byte* data = (const byte*)buf;
+
+    if (output->format == COMPRESSED_GZIP) {
+        output->gzip.next_in = (Bytef*)data;
+        output->gzip.avail_in = (uInt)size;
+        while (output->gzip.avail_in > 0) {
+            output->gzip.next_out = output->buffer;
+            output->gzip.avail_out = (uInt)output->buffer_size;
+            deflate(&output->gzip, Z_NO_FLUSH);
+            if (flush_compressed_output(output, output->buffer_size - output->gzip.avail_out))
+                return -1;
+        }
+        return size;
+    }
+#if HAVE_ZSTD
+    size_t done = 0;
+    while (done < size) {
+        // End each frame after COMPRESSED_OUTPUT_FRAME_SIZE bytes
+        size_t room = COMPRESSED_OUTPUT_FRAME_SIZE - output->frame_in;
+        size_t length = (size - done < room ? size - done : room);
+        if (compress_zstd(output, data + done, length, length == room))
+            return -1;
+        done += length;
+    }
+#endif
+    return size;
+}
+
+/*
+ * Tidy up and free a compressed output (but do not close its file).
+ */
+static void free_compressed_output(compressed_output_p* output)
+{
+    if (*output == nullptr)
+        return;
+    if ((*output)->format == COMPRESSED_GZIP)
+        deflateEnd(&(*output)->gzip);
+#if HAVE_ZSTD
+    else {
+        ZSTD_freeCCtx((*output)->zstd);
+        free((*output)->seek_table);
+    }
+#endif
+    free((*output)->buffer);
+    free(*output);
+    *output = nullptr;
+}
+
+static int compressed_cookie_close_output(void* cookie)
+{
+    compressed_output_p output = (compressed_output_p)cookie;
+    int file = output->file;
+    int err = 0;
+
+    if (output->format == COMPRESSED_GZIP) {
+        int ret;
+        output->gzip.next_in = nullptr;
+        output->gzip.avail_in = 0;
+        do {
+            output->gzip.next_out = output->buffer;
+            output->gzip.avail_out = (uInt)output->buffer_size;
+            ret = deflate(&output->gzip, Z_FINISH);
+            err = flush_compressed_output(output, output->buffer_size - output->gzip.avail_out);
+        } while (ret == Z_OK && !err);
+    }
+#if HAVE_ZSTD
+    else {
+        if (output->frame_in > 0 || output->num_seek_frames == 0)
+            err = compress_zstd(output, nullptr, 0, true);
+        if (!err)
+            err = write_zstd_seek_table(output);
+    }
+#endif
+    free_compressed_output(&output);
+    if (close(file))
+        err = 1;
+    if (err) {
+        errno = EIO;
+        return EOF;
+    }
+    return 0;
+}
+
+/*
+ * Build a compressed output writing to the given file.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int build_compressed_output(int filedes, int format, compressed_output_p* output)
+{
+    compressed_output_p new2 = (compressed_output_p)calloc(1, sizeof(struct compressed_output));
+    if (new2 == nullptr) {
+        print_err("### Unable to allocate compressed output datastructure\n");
+        return 1;
+    }
+    new2->file = filedes;
+    new2->format = format;
+    new2->buffer_size = COMPRESSED_READ_SIZE;
+    new2->buffer = (byte*)malloc(new2->buffer_size);
+    if (new2->buffer == nullptr) {
+        print_err("### Unable to allocate buffer for compressed output\n");
+        free(new2);
+        return 1;
+    }
+    if (format == COMPRESSED_GZIP) {
+        if (deflateInit2(&new2->gzip, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                Z_DEFAULT_STRATEGY)
+            != Z_OK) {
+            print_err("### Unable to start gzip compression\n");
+            free(new2->buffer);
+            free(new2);
+            return 1;
+        }
+    }
+#if HAVE_ZSTD
+    else {
+        int threads = (int)std::thread::hardware_concurrency();
+        new2->zstd = ZSTD_createCCtx();
+        if (new2->zstd == nullptr) {
+            print_err("### Unable to start zstd compression\n");
+            free(new2->buffer);
+            free(new2);
+            return 1;
+        }
+        // If this libzstd can't use threads, it will just say so
+        if (threads > 1)
+            (void)ZSTD_CCtx_setParameter(new2->zstd, ZSTD_c_nbWorkers,
+                (threads > COMPRESSED_MAX_THREADS ? COMPRESSED_MAX_THREADS : threads));
+    }
+#endif
+    *output = new2;
+    return 0;
+}
+
+/*
+ * Open a file as a stdio stream, compressed or decompressed as appropriate.
+ *
+ * - `filename` is the name of the file to open
+ * - if `for_write` is true, the file is created (or truncated). If its name
+ *   ends in ".gz" or ".zst", what is written to the stream is compressed
+ *   accordingly.
+ * - otherwise, the file is opened for read. If it is compressed (with gzip
+ *   or zstd), what is read from the stream is the decompressed data.
+ *
+ * Returns the stream, or nullptr if something went wrong (in which case
+ * `errno` says why).
+ */
+FILE* fopen_compressed(const char* filename, int for_write)
+{
+    int format;
+    int filedes;
+    FILE* stream;
+
+    if (for_write) {
+        format = compression_for_name(filename);
+        if (format == COMPRESSED_NONE)
+            return fopen(filename, "wb");
+#if !HAVE_ZSTD
+        if (format == COMPRESSED_ZSTD) {
+            fprint_err("### Cannot write %s, as zstd is not supported by this build\n", filename);
+            errno = ENOTSUP;
+            return nullptr;
+        }
+#endif
+        filedes = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 00666);
+        if (filedes == -1)
+            return nullptr;
+        compressed_output_p output = nullptr;
+        if (build_compressed_output(filedes, format, &output)) {
+            close(filedes);
+            errno = ENOMEM;
+            return nullptr;
+        }
+        cookie_io_functions_t fns = { nullptr, compressed_cookie_write, nullptr,
+            compressed_cookie_close_output };
+        stream = fopencookie(output, "wb", fns);
+        if (stream == nullptr) {
+            free_compressed_output(&output);
+            close(filedes);
+        }
+        return stream;
+    }
+
+    filedes = open(filename, O_RDONLY);
+    if (filedes == -1)
+        return nullptr;
+    format = compression_of_file(filedes);
+    if (format == COMPRESSED_NONE) {
+        stream = fdopen(filedes, "rb");
+        if (stream == nullptr)
+            close(filedes);
+        return stream;
+    }
+#if !HAVE_ZSTD
+    if (format == COMPRESSED_ZSTD) {
+        fprint_err("### %s is compressed with zstd, which is not supported by this build\n",
+            filename);
+        close(filedes);
+        errno = ENOTSUP;
+        return nullptr;
+    }
+#endif
+    compressed_input_p input = nullptr;
+    if (build_compressed_input(filedes, filename, format, &input)) {
+        close(filedes);
+        errno = ENOMEM;
+        return nullptr;
+    }
+    cookie_io_functions_t fns = { compressed_cookie_read, nullptr, compressed_cookie_seek,
+        compressed_cookie_close_input };
+    stream = fopencookie(input, "rb", fns);
+    if (stream == nullptr) {
+        free_compressed_input(&input);
+        close(filedes);
+    }
+    return stream;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
@@ -0,0 +1,168 @@
+/*
+ * Datastructures for reading and writing compressed files
+ *
+ * Input files that are compressed with gzip or zstd are recognised when they
+ * are opened (by `open_binary_file`), and thereafter reading from (and
+ * seeking within, and telling the position in) their file descriptor gives
+ * the decompressed data, as if the file had been decompressed to disk first.
+ *
+ * Decompression is done by other threads, which run ahead of the reader
+ * filling a ring of blocks of decompressed data:
+ *
+ * - If a zstd file has a seek table (the zstd "seekable format"), then its
+ *   frames are decompressed in parallel, one per block, and a seek goes
+ *   straight to the frame containing the position wanted.
+ * - Otherwise (gzip, or zstd without a seek table), a single thread
+ *   decompresses the data in order. The start of each gzip member or zstd
+ *   frame is remembered as it is passed, so that a seek backwards need only
+ *   restart decompression from the nearest such point before it.
+ *
+ * Output files whose names end in ".gz" or ".zst" are compressed on the fly
+ * (zstd using several threads, and writing a seek table at the end, so
+ * that the result can itself be read in parallel).
+ *
+ */
+
+#ifndef _compressed_defns
+#define _compressed_defns
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "compat.h"
+
+#include <zlib.h>
+#if defined(__has_include)
+#if __has_include(<zstd.h>)
+#define HAVE_ZSTD 1
+#include <zstd.h>
+#endif
+#endif
+
+// The compression formats we know about
+#define COMPRESSED_NONE 0
+#define COMPRESSED_GZIP 1
+#define COMPRESSED_ZSTD 2
+
+#define COMPRESSED_STR(x)                                                                         \
+    ((x) == COMPRESSED_NONE ? "none" : (x) == COMPRESSED_GZIP ? "gzip" : "zstd")
+
+// How many blocks of decompressed data may be waiting to be read
+#define COMPRESSED_RING_SIZE 8
+// How big a block is, when decompressing in order
+#define COMPRESSED_BLOCK_SIZE (1024 * 1024)
+// How much compressed data to read at a time
+#define COMPRESSED_READ_SIZE (256 * 1024)
+// The most threads to decompress zstd frames in parallel with
+#define COMPRESSED_MAX_THREADS 4
+// We won't decompress a zstd frame bigger than this in one go (larger frames
+// are still read, but in order)
+#define COMPRESSED_MAX_FRAME_SIZE (64 * 1024 * 1024)
+// A seek forwards by less than this just reads on, rather than restarting
+#define COMPRESSED_SEEK_AHEAD (4 * 1024 * 1024)
+// When decompressing gzip, remember a restart point this often (it costs
+// COMPRESSED_WINDOW_SIZE bytes each time)
+#define COMPRESSED_CHECKPOINT_SPACING (1024 * 1024)
+// The most history that a deflate stream may refer back to
+#define COMPRESSED_WINDOW_SIZE 32768
+// We can only recognise compressed input on file descriptors less than this
+#define COMPRESSED_MAX_FILES 1024
+
+// When writing zstd, how much data to put in each frame of the seek table
+#define COMPRESSED_OUTPUT_FRAME_SIZE (4 * 1024 * 1024)
+
+// The zstd seekable format's seek table is a skippable frame at the end of
+// the file, which ends with its own magic number
+#define ZSTD_SEEKABLE_MAGIC 0x8F92EAB1
+#define ZSTD_SEEK_TABLE_MAGIC 0x184D2A5E
+#define ZSTD_SEEK_TABLE_FOOTER_SIZE 9
+
+// A point from which decompression can (re)start - the start of a gzip
+// member or zstd frame, or a deflate block boundary within a gzip member
+struct compressed_frame {
+    offset_t in_posn; // Where it starts in the compressed file
+    offset_t out_posn; // And where its data starts in the decompressed data
+    uint32_t in_len; // Its compressed length and decompressed length,
+    uint32_t out_len; // if known from a seek table (otherwise 0)
+    // For a point within a gzip member, the data that came just before it
+    // (which it may refer back to), and how many bits of the byte before
+    // `in_posn` are still to be decompressed. Otherwise nullptr and 0.
+    byte* window;
+    uint32_t window_len;
+    int bits;
+};
+typedef struct compressed_frame* compressed_frame_p;
+
+// A block in the ring of decompressed data
+struct compressed_block {
+    byte* data;
+    uint32_t data_len; // How much of `data` is used
+    uint32_t data_size; // And how big it is
+    offset_t posn; // Where data[0] is in the decompressed data
+    uint32_t seq; // Which block (counting from when the threads were started)
+    int ready; // True when it has been filled
+    int err; // 0, or the EOF or 1 that ended decompression
+};
+
+struct compressed_input {
+    int file; // The compressed file
+    int format; // COMPRESSED_GZIP or COMPRESSED_ZSTD
+    char* name; // Its name, for messages
+
+    offset_t posn; // The position of the next byte to be read
+
+    // The known restart points, in order
+    compressed_frame_p frames;
+    int num_frames;
+    int frames_size;
+    int have_seek_table; // True if `frames` describes the whole file
+    int parallel; // True if its frames are decompressed in parallel
+    offset_t length; // The decompressed length, if known (otherwise -1)
+    int said_trailing; // True if we've complained about trailing garbage
+
+    // The ring of decompressed blocks, and the threads filling it. The
+    // block with sequence number N is in blocks[N % COMPRESSED_RING_SIZE].
+    struct compressed_block blocks[COMPRESSED_RING_SIZE];
+    uint32_t head; // The next block for the reader
+    uint32_t tail; // The next block to be claimed by a thread
+    int first_frame; // The frame that block 0 is (or starts within)
+    int running; // True if the threads have been started
+    int stopping; // Asks the threads to stop
+    int num_threads;
+    std::thread threads[COMPRESSED_MAX_THREADS];
+    std::mutex lock; // Protects everything above that the threads use
+    std::condition_variable filled; // A block has been filled
+    std::condition_variable emptied; // A block has been read (or we're stopping)
+};
+typedef struct compressed_input* compressed_input_p;
+
+// A compressed output file, written via a stdio stream
+struct compressed_output {
+    int file;
+    int format;
+    byte* buffer; // Compressed data waiting to be written
+    size_t buffer_size;
+    z_stream gzip;
+#if HAVE_ZSTD
+    ZSTD_CCtx* zstd;
+    uint32_t frame_in; // How much data has gone into the current frame
+    offset_t frame_start; // How much compressed data came before it
+    offset_t written; // How much compressed data has been written in all
+    // The seek table being built up
+    uint32_t* seek_table; // pairs of compressed and decompressed frame sizes
+    int num_seek_frames;
+    int seek_table_size;
+#endif
+};
+typedef struct compressed_output* compressed_output_p;
+
+#endif // _compressed_defns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
@@ -0,0 +1,101 @@
+/*
+ * Functions for reading and writing compressed (gzip or zstd) files as if
+ * they were not.
+ *
+ */
+
+#ifndef _compressed_fns
+#define _compressed_fns
+
+#include <cstdio>
+#include <sys/types.h>
+
+#include "compat.h"
+#include "compressed_defns.h"
+
+/*
+ * Look at the start of a file to see how (if at all) it is compressed.
+ *
+ * Returns COMPRESSED_NONE, COMPRESSED_GZIP or COMPRESSED_ZSTD.
+ */
+int compression_of_file(int filedes);
+/*
+ * Work out how a file of the given name should be compressed when it is
+ * written, from its extension.
+ *
+ * Returns COMPRESSED_NONE, COMPRESSED_GZIP or COMPRESSED_ZSTD.
+ */
+int compression_for_name(const char* filename);
+/*
+ * If a newly opened file is compressed, arrange for reads from it (via
+ * `read_file`, `read_bytes`, `seek_file` and `tell_file`) to return the
+ * decompressed data instead.
+ *
+ * - `filedes` is the file, which must be open for reading and seekable (if
+ *   it is not, it is left alone)
+ * - `filename` is its name, for messages
+ *
+ * Returns 0 if all goes well (whether or not the file was compressed), 1 if
+ * something goes wrong.
+ */
+int setup_compressed_input(int filedes, const char* filename);
+/*
+ * Stop decompressing a file, because it is about to be closed.
+ *
+ * Does nothing if the file is not one we are decompressing.
+ */
+void finish_compressed_input(int filedes);
+/*
+ * If a file descriptor is for a compressed file that we are decompressing,
+ * return its compressed input, otherwise nullptr.
+ */
+compressed_input_p get_compressed_input(int filedes);
+/*
+ * Is a file descriptor for a compressed file that we are decompressing?
+ */
+int is_compressed_file(int filedes);
+/*
+ * Read decompressed data.
+ *
+ * This is the equivalent of `read` for a compressed input.
+ *
+ * Returns the number of bytes read, 0 at end-of-file, or -1 if something
+ * goes wrong (in which case a message will already have been output).
+ */
+ssize_t read_compressed_input(compressed_input_p input, byte* data, size_t num_bytes);
+/*
+ * Move to a new position in the decompressed data.
+ *
+ * This is the equivalent of `lseek` (with SEEK_SET) for a compressed input.
+ *
+ * Moving forwards (a short way, or at all if we have no seek table) just
+ * reads on. Moving backwards within the block we're reading from costs
+ * nothing, but otherwise means starting decompression again from the last
+ * restart point before the new position.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int seek_compressed_input(compressed_input_p input, offset_t posn);
+/*
+ * Open a file as a stdio stream, compressed or decompressed as appropriate.
+ *
+ * - `filename` is the name of the file to open
+ * - if `for_write` is true, the file is created (or truncated). If its name
+ *   ends in ".gz" or ".zst", what is written to the stream is compressed
+ *   accordingly.
+ * - otherwise, the file is opened for read. If it is compressed (with gzip
+ *   or zstd), what is read from the stream is the decompressed data.
+ *
+ * Returns the stream, or nullptr if something went wrong (in which case
+ * `errno` says why).
+ */
+FILE* fopen_compressed(const char* filename, int for_write);
+
+#endif // _compressed_fns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
@@ -0,0 +1,406 @@
+#pragma once
+
+/*
+ * Reporting on DVB Service Information tables (ETSI EN 300 468): the NIT,
+ * SDT, EIT, TDT and TOT.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "compat.h"
+#include "dvbsi_fns.h"
+#include "misc_fns.h"
+#include "printing_fns.h"
+#include "section_fns.h"
+#include "ts_fns.h"
+
+static const char* dvb_running_status_str(int status)
+{
+    switch (status) {
+    case 0:
+        return "undefined";
+    case 1:
+        return "not running";
+    case 2:
+        return "starts soon";
+    case 3:
+        return "pausing";
+    case 4:
+        return "running";
+    case 5:
+        return "off-air";
+    default:
+        return "reserved";
+    }
+}
+
+static const char* dvb_service_type_str(int service_type)
+{
+    switch (service_type) {
+    case 0x01:
+        return "digital television";
+    case 0x02:
+        return "digital radio";
+    case 0x03:
+        return "teletext";
+    case 0x0A:
+        return "advanced codec digital radio";
+    case 0x0C:
+        return "data broadcast";
+    case 0x11:
+        return "MPEG-2 HD digital television";
+    case 0x16:
+        return "advanced codec SD digital television";
+    case 0x19:
+        return "advanced codec HD digital television";
+    case 0x1F:
+        return "HEVC digital television";
+    default:
+        return "other";
+    }
+}
+
+/*
+ * Print a DVB text string, ignoring any character table selection at its
+ * start, and any control codes within it
+ */
+static void print_dvb_text(int is_msg, byte* text, int text_len)
+{
+    int start = 0;
+    if (text_len > 0 && text[0] < 0x20) {
+        if (text[0] == 0x10)
+            start = 3;
+        else if (text[0] == 0x1F)
+            start = 2;
+        else
+            start = 1;
+    }
+    fprint_msg_or_err(is_msg, "\"");
+    for (int ii = start; ii < text_len; ii++) {
+        if (text[ii] >= 0x20 && (text[ii] < 0x80 || text[ii] >= 0xA0))
+            fprint_msg_or_err(is_msg, "%c", text[ii]);
+    }
+    fprint_msg_or_err(is_msg, "\"");
+}
+
+/*
+ * Print a DVB UTC time -- 16 bits of Modified Julian Date, followed by
+ * 24 bits of BCD hours, minutes and seconds
+ */
+static void print_dvb_utc_time(int is_msg, byte* data)
+{
+    int mjd = (data[0] << 8) | data[1];
+    if (mjd == 0xFFFF) {
+        fprint_msg_or_err(is_msg, "(undefined)");
+        return;
+    }
+    // See EN 300 468 Annex C
+    int yy = (int)((mjd - 15078.2) / 365.25);
+    int mm = (int)((mjd - 14956.1 - (int)(yy * 365.25)) / 30.6001);
+    int dd = mjd - 14956 - (int)(yy * 365.25) - (int)(mm * 30.6001);
+    int kk = (mm == 14 || mm == 15) ? 1 : 0;
+    yy += kk + 1900;
+    mm -= 1 + kk * 12;
+    fprint_msg_or_err(
+        is_msg, "%04d-%02d-%02d %02x:%02x:%02x", yy, mm, dd, data[2], data[3], data[4]);
+}
+
+/*
+ * Print the descriptors in a DVB SI descriptor loop, explaining those
+ * we know about
+ */
+static int print_dvb_descriptors(int is_msg, const char* leader, byte* data, int data_len)
+{
+    while (data_len >= 2) {
+        byte tag = data[0];
+        int length = data[1];
+        if (length + 2 > data_len) {
+            fprint_msg_or_err(is_msg, "%sDescriptor %02x says length %d, but only %d bytes left\n",
+                leader, tag, length, data_len - 2);
+            return 1;
+        }
+        byte* body = data + 2;
+        if (tag == 0x40) {
+            fprint_msg_or_err(is_msg, "%sNetwork name ", leader);
+            print_dvb_text(is_msg, body, length);
+            fprint_msg_or_err(is_msg, "\n");
+        } else if (tag == 0x48 && length >= 3) {
+            int provider_len = body[1];
+            int name_len = (provider_len + 3 <= length) ? body[2 + provider_len] : 0;
+            if (provider_len + name_len + 3 > length) {
+                fprint_msg_or_err(is_msg, "%sService descriptor is malformed\n", leader);
+            } else {
+                fprint_msg_or_err(is_msg, "%sService %02x (%s) provider ", leader, body[0],
+                    dvb_service_type_str(body[0]));
+                print_dvb_text(is_msg, body + 2, provider_len);
+                fprint_msg_or_err(is_msg, " name ");
+                print_dvb_text(is_msg, body + 3 + provider_len, name_len);
+                fprint_msg_or_err(is_msg, "\n");
+            }
+        } else if (tag == 0x4D && length >= 5) {
+            int name_len = body[3];
+            int text_len = (name_len + 5 <= length) ? body[4 + name_len] : 0;
+            if (name_len + text_len + 5 > length) {
+                fprint_msg_or_err(is_msg, "%sShort event descriptor is malformed\n", leader);
+            } else {
+                fprint_msg_or_err(
+                    is_msg, "%sEvent [%c%c%c] ", leader, body[0], body[1], body[2]);
+                print_dvb_text(is_msg, body + 4, name_len);
+                if (text_len > 0) {
+                    fprint_msg_or_err(is_msg, " ");
+                    print_dvb_text(is_msg, body + 5 + name_len, text_len);
+                }
+                fprint_msg_or_err(is_msg, "\n");
+            }
+        } else if (tag == 0x58) {
+            for (int ii = 0; ii + 13 <= length; ii += 13) {
+                byte* offset = body + ii;
+                fprint_msg_or_err(is_msg, "%sLocal time offset [%c%c%c] %c%02x:%02x", leader,
+                    offset[0], offset[1], offset[2], (offset[3] & 0x01) ? '-' : '+', offset[4],
+                    offset[5]);
+                fprint_msg_or_err(is_msg, " changing at ");
+                print_dvb_utc_time(is_msg, offset + 6);
+                fprint_msg_or_err(is_msg, " to %02x:%02x\n", offset[11], offset[12]);
+            }
+        } else if (length + 2 <= 255) {
+            // The generic descriptor printer can't cope with more than this
+            print_descriptors(is_msg, (char*)leader, nullptr, data, length + 2);
+        } else {
+            fprint_msg_or_err(is_msg, "%sDescriptor %02x, %d bytes\n", leader, tag, length);
+        }
+        data += length + 2;
+        data_len -= length + 2;
+    }
+    return 0;
+}
+
+static int report_NIT_section(int is_msg, byte* section, int section_len)
+{
+    int end = section_len - 4; // the CRC
+    int network_id = (section[3] << 8) | section[4];
+    fprint_msg_or_err(is_msg, "NIT (%s) network %04x (%d) version %d section %d of %d\n",
+        section[0] == DVB_NIT_ACTUAL_TID ? "actual" : "other", network_id, network_id,
+        (section[5] & 0x3E) >> 1, section[6], section[7]);
+
+    int offset = 8;
+    if (offset + 2 > end)
+        return 1;
+    int desc_len = ((section[offset] & 0x0F) << 8) | section[offset + 1];
+    offset += 2;
+    if (offset + desc_len + 2 > end)
+        return 1;
+    print_dvb_descriptors(is_msg, "  ", section + offset, desc_len);
+    offset += desc_len;
+
+    int loop_len = ((section[offset] & 0x0F) << 8) | section[offset + 1];
+    offset += 2;
+    if (offset + loop_len > end)
+        return 1;
+    int loop_end = offset + loop_len;
+    while (offset + 6 <= loop_end) {
+        int ts_id = (section[offset] << 8) | section[offset + 1];
+        int onid = (section[offset + 2] << 8) | section[offset + 3];
+        desc_len = ((section[offset + 4] & 0x0F) << 8) | section[offset + 5];
+        offset += 6;
+        if (offset + desc_len > loop_end)
+            return 1;
+        fprint_msg_or_err(is_msg, "  Transport stream %04x (%d), original network %04x (%d)\n",
+            ts_id, ts_id, onid, onid);
+        print_dvb_descriptors(is_msg, "    ", section + offset, desc_len);
+        offset += desc_len;
+    }
+    return 0;
+}
+
+static int report_SDT_section(int is_msg, byte* section, int section_len)
+{
+    int end = section_len - 4;
+    if (section_len < 15)
+        return 1;
+    int ts_id = (section[3] << 8) | section[4];
+    int onid = (section[8] << 8) | section[9];
+    fprint_msg_or_err(is_msg,
+        "SDT (%s) transport stream %04x (%d) original network %04x (%d)"
+        " version %d section %d of %d\n",
+        section[0] == DVB_SDT_ACTUAL_TID ? "actual" : "other", ts_id, ts_id, onid, onid,
+        (section[5] & 0x3E) >> 1, section[6], section[7]);
+
+    int offset = 11;
+    while (offset + 5 <= end) {
+        int service_id = (section[offset] << 8) | section[offset + 1];
+        int flags = section[offset + 2];
+        int running_status = section[offset + 3] >> 5;
+        int free_ca = (section[offset + 3] & 0x10) != 0;
+        int desc_len = ((section[offset + 3] & 0x0F) << 8) | section[offset + 4];
+        offset += 5;
+        if (offset + desc_len > end)
+            return 1;
+        fprint_msg_or_err(is_msg, "  Service %04x (%d) %s%s%s%s\n", service_id, service_id,
+            dvb_running_status_str(running_status), free_ca ? ", scrambled" : "",
+            (flags & 0x02) ? ", EIT schedule" : "", (flags & 0x01) ? ", EIT p/f" : "");
+        print_dvb_descriptors(is_msg, "    ", section + offset, desc_len);
+        offset += desc_len;
+    }
+    return 0;
+}
+
+static int report_EIT_section(int is_msg, byte* section, int section_len)
+{
+    int end = section_len - 4;
+    if (section_len < 18)
+        return 1;
+    int tid = section[0];
+    int service_id = (section[3] << 8) | section[4];
+    int ts_id = (section[8] << 8) | section[9];
+    int onid = (section[10] << 8) | section[11];
+    fprint_msg_or_err(is_msg,
+        "EIT (%s, %s) service %04x (%d) transport stream %04x original network %04x"
+        " version %d section %d of %d\n",
+        (tid == 0x4E || tid == 0x4F) ? "p/f" : "schedule",
+        (tid == 0x4E || (tid >= 0x50 && tid <= 0x5F)) ? "actual" : "other", service_id,
+        service_id, ts_id, onid, (section[5] & 0x3E) >> 1, section[6], section[7]);
+
+    int offset = 14;
+    while (offset + 12 <= end) {
+        byte* event = section + offset;
+        int event_id = (event[0] << 8) | event[1];
+        int running_status = event[10] >> 5;
+        int desc_len = ((event[10] & 0x0F) << 8) | event[11];
+        offset += 12;
+        if (offset + desc_len > end)
+            return 1;
+        fprint_msg_or_err(is_msg, "  Event %04x (%d) at ", event_id, event_id);
+        print_dvb_utc_time(is_msg, event + 2);
+        fprint_msg_or_err(is_msg, " for %02x:%02x:%02x %s%s\n", event[7], event[8], event[9],
+            dvb_running_status_str(running_status), (event[10] & 0x10) ? ", scrambled" : "");
+        print_dvb_descriptors(is_msg, "    ", section + offset, desc_len);
+        offset += desc_len;
+    }
+    return 0;
+}
+
+static int report_TDT_section(int is_msg, byte* section, int section_len)
+{
+    if (section_len < 8)
+        return 1;
+    fprint_msg_or_err(is_msg, "%s UTC ", section[0] == DVB_TDT_TID ? "TDT" : "TOT");
+    print_dvb_utc_time(is_msg, section + 3);
+    fprint_msg_or_err(is_msg, "\n");
+    if (section[0] == DVB_TOT_TID) {
+        if (section_len < 14)
+            return 1;
+        int desc_len = ((section[8] & 0x0F) << 8) | section[9];
+        if (10 + desc_len > section_len - 4)
+            return 1;
+        print_dvb_descriptors(is_msg, "  ", section + 10, desc_len);
+    }
+    return 0;
+}
+
+/*
+ * Report on a DVB SI section (NIT, SDT, EIT, TDT or TOT).
+ *
+ * - if `is_msg` then print as a message, otherwise as an error
+ * - `pid` is the PID it came from
+ * - `section` is the whole section, starting with its table_id, and
+ *   `section_len` is its length
+ *
+ * Sections of other sorts are just noted as such.
+ *
+ * Returns 0 if all goes well, 1 if the section is malformed.
+ */
+int report_dvb_si_section(int is_msg, uint32_t pid, byte* section, int section_len)
+{
+    int err;
+    byte tid = section[0];
+    int is_long = (section[1] & 0x80) != 0;
+    if (is_long && section_len < 12) {
+        fprint_msg_or_err(is_msg, "!!! Section with table id %02x on PID %04x is too short\n",
+            tid, pid);
+        return 1;
+    }
+    if (tid == DVB_NIT_ACTUAL_TID || tid == DVB_NIT_OTHER_TID)
+        err = report_NIT_section(is_msg, section, section_len);
+    else if (tid == DVB_SDT_ACTUAL_TID || tid == DVB_SDT_OTHER_TID)
+        err = report_SDT_section(is_msg, section, section_len);
+    else if (tid >= DVB_EIT_FIRST_TID && tid <= DVB_EIT_LAST_TID)
+        err = report_EIT_section(is_msg, section, section_len);
+    else if (tid == DVB_TDT_TID || tid == DVB_TOT_TID)
+        err = report_TDT_section(is_msg, section, section_len);
+    else {
+        fprint_msg_or_err(is_msg, "Section with table id %02x on PID %04x (%d), %d bytes\n", tid,
+            pid, pid, section_len);
+        return 0;
+    }
+    if (err)
+        fprint_msg_or_err(is_msg, "!!! Section with table id %02x on PID %04x is malformed\n",
+            tid, pid);
+    return err;
+}
+
+/*
+ * The section handler for `add_dvb_si_filters`. A malformed section is
+ * reported, but is not a reason to stop.
+ */
+static int dvb_si_section_handler(
+    void* arg, uint32_t pid, byte* section, int section_len, int new_version)
+{
+    (void)report_dvb_si_section(true, pid, section, section_len);
+    return 0;
+}
+
+/*
+ * Add filters to a section demultiplexer to report on DVB SI tables.
+ *
+ * - `tables` says which to report, as a combination of DVB_SI_NIT,
+ *   DVB_SI_SDT, DVB_SI_EIT and DVB_SI_TDT
+ * - if `all_versions`, then report every section, not just those that
+ *   are new or have changed version (the TDT and TOT are always reported,
+ *   since they have no version)
+ *
+ * Reports are output as messages.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int add_dvb_si_filters(section_demux_p demux, int tables, int all_versions)
+{
+    int err = 0;
+    int flags = all_versions ? SECTION_FILTER_ALL_VERSIONS : SECTION_FILTER_NEW_VERSIONS;
+    // 0x40 and 0x41 differ only in the bottom bit, and 0x42 and 0x46 only
+    // in the third
+    if (!err && (tables & DVB_SI_NIT))
+        err = add_section_filter(
+            demux, DVB_NIT_PID, 0x40, 0xFE, 0, 0, flags, dvb_si_section_handler, nullptr);
+    if (!err && (tables & DVB_SI_SDT))
+        err = add_section_filter(
+            demux, DVB_SDT_PID, 0x42, 0xFB, 0, 0, flags, dvb_si_section_handler, nullptr);
+    if (!err && (tables & DVB_SI_EIT)) {
+        // 0x4E and 0x4F for present/following, then 0x50 to 0x6F
+        err = add_section_filter(
+            demux, DVB_EIT_PID, 0x4E, 0xFE, 0, 0, flags, dvb_si_section_handler, nullptr);
+        if (!err)
+            err = add_section_filter(
+                demux, DVB_EIT_PID, 0x50, 0xF0, 0, 0, flags, dvb_si_section_handler, nullptr);
+        if (!err)
+            err = add_section_filter(
+                demux, DVB_EIT_PID, 0x60, 0xF0, 0, 0, flags, dvb_si_section_handler, nullptr);
+    }
+    if (!err && (tables & DVB_SI_TDT)) {
+        err = add_section_filter(demux, DVB_TDT_PID, DVB_TDT_TID, 0xFF, 0, 0, flags,
+            dvb_si_section_handler, nullptr);
+        if (!err)
+            err = add_section_filter(demux, DVB_TDT_PID, DVB_TOT_TID, 0xFF, 0, 0, flags,
+                dvb_si_section_handler, nullptr);
+    }
+    return err;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,39 @@
+/*
+ * Definitions for DVB Service Information (ETSI EN 300 468)
+ *
+ */
+
+#ifndef _dvbsi_defns
+#define _dvbsi_defns
+
+// The PIDs the DVB SI tables are carried on
+#define DVB_NIT_PID 0x10
+#define DVB_SDT_PID 0x11 // also the BAT
+#define DVB_EIT_PID 0x12
+#define DVB_TDT_PID 0x14 // also the TOT
+
+// Their table ids
+#define DVB_NIT_ACTUAL_TID 0x40
+#define DVB_NIT_OTHER_TID 0x41
+#define DVB_SDT_ACTUAL_TID 0x42
+#define DVB_SDT_OTHER_TID 0x46
+#define DVB_EIT_FIRST_TID 0x4E // present/following, actual
+#define DVB_EIT_LAST_TID 0x6F // schedule, other
+#define DVB_TDT_TID 0x70
+#define DVB_TOT_TID 0x73
+
+// Which tables to report, for `add_dvb_si_filters`
+#define DVB_SI_NIT 0x01
+#define DVB_SI_SDT 0x02
+#define DVB_SI_EIT 0x04
+#define DVB_SI_TDT 0x08 // and the TOT
+#define DVB_SI_ALL (DVB_SI_NIT | DVB_SI_SDT | DVB_SI_EIT | DVB_SI_TDT)
+
+#endif // _dvbsi_defns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,48 @@
+/*
+ * Functions for reporting on DVB Service Information
+ *
+ */
+
+#ifndef _dvbsi_fns
+#define _dvbsi_fns
+
+#include "compat.h"
+#include "dvbsi_defns.h"
+#include "section_defns.h"
+
+/*
+ * Report on a DVB SI section (NIT, SDT, EIT, TDT or TOT).
+ *
+ * - if `is_msg` then print as a message, otherwise as an error
+ * - `pid` is the PID it came from
+ * - `section` is the whole section, starting with its table_id, and
+ *   `section_len` is its length
+ *
+ * Sections of other sorts are just noted as such.
+ *
+ * Returns 0 if all goes well, 1 if the section is malformed.
+ */
+int report_dvb_si_section(int is_msg, uint32_t pid, byte* section, int section_len);
+/*
+ * Add filters to a section demultiplexer to report on DVB SI tables.
+ *
+ * - `tables` says which to report, as a combination of DVB_SI_NIT,
+ *   DVB_SI_SDT, DVB_SI_EIT and DVB_SI_TDT
+ * - if `all_versions`, then report every section, not just those that
+ *   are new or have changed version (the TDT and TOT are always reported,
+ *   since they have no version)
+ *
+ * Reports are output as messages.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int add_dvb_si_filters(section_demux_p demux, int tables, int all_versions);
+
+#endif // _dvbsi_fns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
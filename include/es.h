@@ -32,8 +32,10 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <new>
 #include <unistd.h>
 
+#include "blockcache_fns.h"
 #include "compat.h"
 #include "es_fns.h"
 #include "misc_fns.h"
@@ -87,8 +89,11 @@ static int setup_readahead(ES_p es)
 {
     int err;
 
+    es->read_ahead_block = nullptr;
+    es->read_ahead = nullptr;
     es->read_ahead_len = 0;
     es->read_ahead_posn = 0;
+    es->reposition = -1;
 
     es->data = nullptr;
     es->data_end = nullptr;
@@ -151,6 +156,13 @@ int build_elementary_stream_file(int input, ES_p* es)
     new2->reading_ES = true;
     new2->input = input;
     new2->reader = nullptr;
+    new2->pipeline = nullptr;
+    new2->limit = -1;
+
+    if (build_block_cache(ES_READ_AHEAD_BLOCKS, ES_READ_AHEAD_SIZE, &new2->blocks)) {
+        free(new2);
+        return 1;
+    }
 
     setup_readahead(new2);
 
@@ -182,6 +194,9 @@ int build_elementary_stream_PES(PES_reader_p reader, ES_p* es)
     new2->reading_ES = false;
     new2->input = -1;
     new2->reader = reader;
+    new2->blocks = nullptr;
+    new2->pipeline = nullptr;
+    new2->limit = -1;
 
     setup_readahead(new2);
 
@@ -203,7 +218,9 @@ int build_elementary_stream_PES(PES_reader_p reader, ES_p* es)
  */
 void free_elementary_stream(ES_p* es)
 {
+    (void)set_ES_pipelining(*es, false);
     (*es)->input = -1; // "forget" our input
+    free_block_cache(&(*es)->blocks);
     free(*es);
     *es = nullptr;
 }
@@ -439,9 +456,23 @@ static inline int get_next_pes_packet(ES_p es)
 static inline int get_more_data(ES_p es)
 {
     if (es->reading_ES) {
+        // If we've moved within the file, make the file match
+        if (es->reposition != -1) {
+            if (seek_file(es->input, es->reposition)) {
+                print_err("### Error seeking within ES file\n");
+                return 1;
+            }
+            es->reposition = -1;
+        }
+
+        // Leave the blocks we've read recently alone, in case we seek back
+        block_cache_entry_p block = get_block_to_fill(es->blocks, es->read_ahead_block);
+        if (block == nullptr)
+            return 1;
+
         // Call `read` directly - we don't particularly mind if we get a "short"
         // read, since we'll just catch up later on
-        ssize_t len = read(es->input, &es->read_ahead, ES_READ_AHEAD_SIZE);
+        ssize_t len = read_file(es->input, block->data, ES_READ_AHEAD_SIZE);
         if (len == 0)
             return EOF;
         else if (len == -1) {
@@ -450,6 +481,10 @@ static inline int get_more_data(ES_p es)
         }
         es->read_ahead_posn += es->read_ahead_len; // length of the *last* buffer
         es->read_ahead_len = len;
+        block->posn = es->read_ahead_posn;
+        block->len = len;
+        es->read_ahead_block = block;
+        es->read_ahead = block->data;
         es->data = es->read_ahead; // should be done in the setup function
         es->data_end = es->data + len; // one beyond the last byte
         es->data_ptr = es->data;
@@ -623,19 +658,12 @@ static int find_ES_unit_end(ES_p es, ES_unit_p unit)
 }
 
 /*
- * Find and read in the next ES unit.
- *
- * In general, unless there are compelling reasons, use
- * `find_and_build_next_ES_unit()` instead.
- *
- * - `es` is the elementary stream we're reading from.
- * - `unit` is the datastructure into which to read the ES unit
- *   - any previous content will be lost.
+ * Find and read in the next ES unit, directly from our input.
  *
  * Returns 0 if it succeeds, EOF if the end-of-file is read (i.e., there
  * is no next ES unit), otherwise 1 if some error occurs.
  */
-int find_next_ES_unit(ES_p es, ES_unit_p unit)
+static int read_next_ES_unit(ES_p es, ES_unit_p unit)
 {
     int err;
 
@@ -643,6 +671,9 @@ int find_next_ES_unit(ES_p es, ES_unit_p unit)
     if (err)
         return err; // 1 or EOF
 
+    if (es->limit != -1 && es->reading_ES && unit->start_posn.infile >= es->limit)
+        return EOF;
+
     err = find_ES_unit_end(es, unit);
     if (err)
         return err;
@@ -654,6 +685,233 @@ int find_next_ES_unit(ES_p es, ES_unit_p unit)
     return 0;
 }
 
+// ------------------------------------------------------------
+// Reading ES units in a separate thread
+// ------------------------------------------------------------
+/*
+ * The producer thread - reads ES units into the pipeline's queue until
+ * it reaches the end of the data (or an error), or is asked to stop.
+ */
+static void ES_pipeline_producer(ES_p es)
+{
+    ES_pipeline_p pipeline = es->pipeline;
+    uint32_t tail = pipeline->tail.load(std::memory_order_relaxed);
+    for (;;) {
+        struct ES_pipeline_slot* slot;
+
+        // If the queue is full, wait until it is half empty, so that we
+        // don't wake up for every ES unit our consumer takes
+        uint32_t head = pipeline->head.load(std::memory_order_acquire);
+        if (tail - head >= ES_PIPELINE_QUEUE_SIZE) {
+            while (tail - head > ES_PIPELINE_QUEUE_SIZE / 2) {
+                if (pipeline->stopping.load(std::memory_order_acquire))
+                    return;
+                pipeline->head.wait(head, std::memory_order_acquire);
+                head = pipeline->head.load(std::memory_order_acquire);
+            }
+        }
+        if (pipeline->stopping.load(std::memory_order_acquire))
+            return;
+
+        slot = &pipeline->slots[tail & (ES_PIPELINE_QUEUE_SIZE - 1)];
+        slot->err = read_next_ES_unit(es, &slot->unit);
+        pipeline->tail.store(++tail, std::memory_order_release);
+        // Similarly, only wake our consumer for each half queue (or at the end)
+        if (slot->err || tail % (ES_PIPELINE_QUEUE_SIZE / 2) == 0)
+            pipeline->tail.notify_one();
+        if (slot->err)
+            return; // our consumer will be told when it gets this far
+    }
+}
+
+/*
+ * Stop the producer thread (if it is running), and discard anything it
+ * has queued.
+ *
+ * Afterwards, the ES reader is positioned after the last ES unit that the
+ * producer read, which is *not* the last ES unit that was taken from the
+ * queue, so this should normally be followed by a seek.
+ */
+static void halt_ES_pipeline(ES_p es)
+{
+    ES_pipeline_p pipeline = es->pipeline;
+    if (pipeline == nullptr || !pipeline->running)
+        return;
+    pipeline->stopping.store(true, std::memory_order_release);
+    // Wake the producer if it is waiting for room (any change will do,
+    // since the queue is about to be discarded)
+    pipeline->head.fetch_add(1, std::memory_order_release);
+    pipeline->head.notify_one();
+    pipeline->producer.join();
+    pipeline->running = false;
+}
+
+/*
+ * Take the next ES unit from the producer thread, starting it if
+ * necessary.
+ *
+ * Returns 0 if it succeeds, EOF if the end-of-file is read (i.e., there
+ * is no next ES unit), otherwise 1 if some error occurs.
+ */
+static int take_pipelined_ES_unit(ES_p es, ES_unit_p unit)
+{
+    ES_pipeline_p pipeline = es->pipeline;
+    struct ES_pipeline_slot* slot;
+    uint32_t head;
+    int waited = false;
+    int err;
+
+    if (!pipeline->running) {
+        pipeline->head.store(0, std::memory_order_relaxed);
+        pipeline->tail.store(0, std::memory_order_relaxed);
+        pipeline->stopping.store(false, std::memory_order_relaxed);
+        try {
+            pipeline->producer = std::thread(ES_pipeline_producer, es);
+        } catch (...) {
+            print_err("### Unable to start thread to read ES units\n");
+            return 1;
+        }
+        pipeline->running = true;
+    }
+
+    // If the queue is empty, wait until it is half full (or the producer
+    // has finished)
+    head = pipeline->head.load(std::memory_order_relaxed);
+    for (;;) {
+        uint32_t tail = pipeline->tail.load(std::memory_order_acquire);
+        if (tail != head) {
+            if (tail - head >= ES_PIPELINE_QUEUE_SIZE / 2 || !waited)
+                break;
+            if (pipeline->slots[(tail - 1) & (ES_PIPELINE_QUEUE_SIZE - 1)].err)
+                break;
+        }
+        pipeline->tail.wait(tail, std::memory_order_acquire);
+        waited = true;
+    }
+
+    slot = &pipeline->slots[head & (ES_PIPELINE_QUEUE_SIZE - 1)];
+    err = slot->err;
+    if (!err) {
+        // Rather than copy the data, swap data buffers with the slot
+        byte* data = unit->data;
+        uint32_t data_size = unit->data_size;
+        unit->data = slot->unit.data;
+        unit->data_size = slot->unit.data_size;
+        unit->data_len = slot->unit.data_len;
+        unit->start_posn = slot->unit.start_posn;
+        unit->start_code = slot->unit.start_code;
+        if (!es->reading_ES)
+            unit->PES_had_PTS = slot->unit.PES_had_PTS;
+        slot->unit.data = data;
+        slot->unit.data_size = data_size;
+    }
+    pipeline->head.store(++head, std::memory_order_release);
+    if (head % (ES_PIPELINE_QUEUE_SIZE / 2) == 0)
+        pipeline->head.notify_one();
+
+    if (err) {
+        // The producer has finished
+        pipeline->producer.join();
+        pipeline->running = false;
+    }
+    return err;
+}
+
+/*
+ * Choose whether ES units are to be read by a separate (producer) thread.
+ *
+ * If `pipelined` is true, then the reading of the underlying data (ES
+ * file, or TS/PS and PES packets) and the scanning for start codes is done
+ * in a separate thread, which runs ahead of `find_next_ES_unit` (by up to
+ * ES_PIPELINE_QUEUE_SIZE ES units). The ES units returned are exactly as
+ * they would otherwise be. Seeking (including via `read_ES_data` or a
+ * rewind) stops the thread, which is restarted by the next
+ * `find_next_ES_unit`.
+ *
+ * Whilst the producer is running, it owns the ES reader and its PES
+ * reader, so the caller should not look inside either of them (for
+ * instance, at `posn_of_next_byte`), and `get_end_of_underlying_PES_packet`
+ * may not be used.
+ *
+ * If `pipelined` is false, any producer thread is stopped, and ES units
+ * are read directly again (from wherever the producer had got to).
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int set_ES_pipelining(ES_p es, int pipelined)
+{
+    if (pipelined) {
+        if (es->pipeline != nullptr)
+            return 0;
+        ES_pipeline_p new2 = new (std::nothrow) struct ES_pipeline;
+        if (new2 == nullptr) {
+            print_err("### Unable to allocate ES pipeline datastructure\n");
+            return 1;
+        }
+        for (int ii = 0; ii < ES_PIPELINE_QUEUE_SIZE; ii++) {
+            if (setup_ES_unit(&new2->slots[ii].unit)) {
+                for (int jj = 0; jj < ii; jj++)
+                    clear_ES_unit(&new2->slots[jj].unit);
+                delete new2;
+                return 1;
+            }
+            new2->slots[ii].err = 0;
+        }
+        new2->head.store(0);
+        new2->tail.store(0);
+        new2->stopping.store(false);
+        new2->running = false;
+        es->pipeline = new2;
+    } else if (es->pipeline != nullptr) {
+        halt_ES_pipeline(es);
+        for (int ii = 0; ii < ES_PIPELINE_QUEUE_SIZE; ii++)
+            clear_ES_unit(&es->pipeline->slots[ii].unit);
+        delete es->pipeline;
+        es->pipeline = nullptr;
+    }
+    return 0;
+}
+
+/*
+ * Pretend that a "bare" ES file ends before the first ES unit that starts
+ * at or after `limit`. This allows part of a file to be read as if it
+ * were the whole of it (having sought to its start).
+ *
+ * If `limit` is -1, then the whole file is read again.
+ *
+ * Returns 0 if all goes well, 1 if the ES is being read from PES.
+ */
+int set_ES_limit(ES_p es, offset_t limit)
+{
+    if (!es->reading_ES) {
+        print_err("### Cannot limit ES data that is being read from PES\n");
+        return 1;
+    }
+    es->limit = limit;
+    return 0;
+}
+
+/*
+ * Find and read in the next ES unit.
+ *
+ * In general, unless there are compelling reasons, use
+ * `find_and_build_next_ES_unit()` instead.
+ *
+ * - `es` is the elementary stream we're reading from.
+ * - `unit` is the datastructure into which to read the ES unit
+ *   - any previous content will be lost.
+ *
+ * Returns 0 if it succeeds, EOF if the end-of-file is read (i.e., there
+ * is no next ES unit), otherwise 1 if some error occurs.
+ */
+int find_next_ES_unit(ES_p es, ES_unit_p unit)
+{
+    if (es->pipeline != nullptr)
+        return take_pipelined_ES_unit(es, unit);
+    else
+        return read_next_ES_unit(es, unit);
+}
+
 /*
  * Find and read the next ES unit into a new datastructure.
  *
@@ -767,9 +1025,11 @@ static inline void deduce_correct_position(ES_p es)
 
     if (es->reading_ES) {
         // For ES data, we want to force new data to be read in from the file
+        // (from wherever we are now, which may not be where the file is)
         es->data_ptr = es->data_end = nullptr;
         es->read_ahead_len = 0; // to stop the read ahead posn being incremented
         es->read_ahead_posn = es->posn_of_next_byte.infile;
+        es->reposition = es->posn_of_next_byte.infile;
     } else {
         // For PES data, we have whatever is left in the current packet
         PES_packet_data_p packet = es->reader->packet;
@@ -794,12 +1054,15 @@ static inline void deduce_correct_position(ES_p es)
 int seek_ES(ES_p es, ES_offset where)
 {
     int err;
+    block_cache_entry_p block = nullptr;
+
+    // Anything read ahead by a producer thread is no longer wanted
+    halt_ES_pipeline(es);
+
     if (es->reading_ES) {
-        err = seek_file(es->input, where.infile);
-        if (err) {
-            print_err("### Error seeking within ES file\n");
-            return 1;
-        }
+        // The file itself is only repositioned when we next need to read
+        // from it, which we may not if we've read this part of it recently
+        block = find_cached_block(es->blocks, where.infile, 1);
     } else {
         err = seek_in_PES(es, where);
         if (err) {
@@ -812,9 +1075,53 @@ int seek_ES(ES_p es, ES_offset where)
     // And make it look as if we reached this position sensibly
     es->posn_of_next_byte = where;
     deduce_correct_position(es);
+
+    if (block != nullptr) {
+        // Only the block we last read from the file leaves the file
+        // positioned after it
+        if (block == es->blocks->last_read)
+            es->reposition = -1;
+        else
+            es->reposition = block->posn + block->len;
+        es->read_ahead_block = block;
+        es->read_ahead = block->data;
+        es->read_ahead_posn = block->posn;
+        es->read_ahead_len = block->len;
+        es->data = block->data;
+        es->data_ptr = block->data + (where.infile - block->posn);
+        es->data_end = block->data + block->len;
+    }
     return 0;
 }
 
+/*
+ * Retrieve ES bytes from a "bare" ES file as requested, using whatever
+ * data we already have in hand first.
+ *
+ * Returns 0 if all goes well, EOF if there is not enough data, 1 if
+ * something goes wrong.
+ */
+static int read_bytes_from_ES_file(ES_p es, byte* data, uint32_t num_bytes)
+{
+    uint32_t offset = 0;
+    if (es->data_ptr != nullptr && es->data_ptr < es->data_end) {
+        offset = min(num_bytes, (uint32_t)(es->data_end - es->data_ptr));
+        memcpy(data, es->data_ptr, offset);
+        if (offset == num_bytes)
+            return 0;
+    }
+    if (es->reposition != -1) {
+        if (seek_file(es->input, es->reposition)) {
+            print_err("### Error seeking within ES file\n");
+            return 1;
+        }
+        es->reposition = -1;
+    }
+    // The file is no longer just after any block we've read
+    es->blocks->last_read = nullptr;
+    return read_bytes(es->input, num_bytes - offset, data + offset);
+}
+
 /*
  * Retrieve ES bytes from PES as requested
  *
@@ -899,7 +1206,7 @@ int read_ES_data(
     if (err)
         return err;
     if (es->reading_ES) {
-        err = read_bytes(es->input, num_bytes, *data);
+        err = read_bytes_from_ES_file(es, *data, num_bytes);
         if (err) {
             if (err == EOF) {
                 fprint_err("### Error (EOF) reading %d bytes\n", num_bytes);
@@ -951,6 +1258,11 @@ int get_end_of_underlying_PES_packet(ES_p es, byte** data, int* data_len)
                    " is direct ES, not ES read from PES\n");
         return 1;
     }
+    if (es->pipeline != nullptr && es->pipeline->running) {
+        fprint_err("### Cannot retrieve end of PES packet - the ES data"
+                   " is being read ahead in another thread\n");
+        return 1;
+    }
     if (es->reader->packet == nullptr) {
         // This is naughty, but we'll pretend to cope
         *data = nullptr;
@@ -1028,10 +1340,90 @@ int build_ES_unit_list(ES_unit_list_p* list)
         print_err("### Unable to allocate array in ES unit list datastructure\n");
         return 1;
     }
+    new2->contiguous = false;
+    new2->data = nullptr;
+    new2->data_len = 0;
+    new2->data_size = 0;
     *list = new2;
     return 0;
 }
 
+/*
+ * Build a new list-of-ES-units datastructure, which keeps the data for all
+ * of its units in a single buffer.
+ *
+ * This means that appending a unit does not need its own allocation, and
+ * that the whole of the list's data can be retrieved (for instance, to
+ * write it out) with `get_ES_unit_list_data`.
+ *
+ * Returns 0 if it succeeds, 1 if some error occurs.
+ */
+int build_contiguous_ES_unit_list(ES_unit_list_p* list)
+{
+    int err = build_ES_unit_list(list);
+    if (err)
+        return 1;
+    (*list)->contiguous = true;
+    return 0;
+}
+
+/*
+ * Retrieve the data for all of the units in a contiguous ES unit list.
+ *
+ * - `list` is the list, which must have been built with
+ *   `build_contiguous_ES_unit_list`
+ * - `data` is returned as the start of the data (nullptr if there is none),
+ *   which remains owned by the list
+ * - `data_len` is returned as its length
+ *
+ * Returns 0 if it succeeds, 1 if the list is not contiguous.
+ */
+int get_ES_unit_list_data(ES_unit_list_p list, byte** data, uint32_t* data_len)
+{
+    if (!list->contiguous) {
+        print_err("### Cannot get contiguous data from a non-contiguous ES unit list\n");
+        return 1;
+    }
+    *data = list->data;
+    *data_len = list->data_len;
+    return 0;
+}
+
+/*
+ * Make room for (at least) `extra` more bytes in a contiguous ES unit list.
+ *
+ * Returns 0 if it succeeds, 1 if some error occurs.
+ */
+static int extend_ES_unit_list_data(ES_unit_list_p list, uint32_t extra)
+{
+    uint32_t newsize = list->data_size ? list->data_size : ES_UNIT_LIST_DATA_START_SIZE;
+    uint32_t offset = 0;
+    byte* new_data;
+    int ii;
+
+    if (list->data_len + extra <= list->data_size)
+        return 0;
+
+    while (newsize < list->data_len + extra)
+        newsize *= 2;
+    new_data = (byte*)realloc(list->data, newsize);
+    if (new_data == nullptr) {
+        print_err("### Unable to extend ES unit list data buffer\n");
+        return 1;
+    }
+    list->data = new_data;
+    list->data_size = newsize;
+
+    // The units already in the list need to follow their data. Since each
+    // unit's data directly follows that of the unit before it, we can work
+    // out where it now is without reference to the old (freed) buffer
+    for (ii = 0; ii < list->length; ii++) {
+        list->array[ii].data = list->data + offset;
+        offset += list->array[ii].data_len;
+    }
+    return 0;
+}
+
 /*
  * Add a copy of an ES unit to the end of the ES unit list
  *
@@ -1052,6 +1444,18 @@ int append_to_ES_unit_list(ES_unit_list_p list, ES_unit_p unit)
         }
         list->size = newsize;
     }
+    if (list->contiguous) {
+        if (extend_ES_unit_list_data(list, unit->data_len))
+            return 1;
+        ptr = &list->array[list->length++];
+        *ptr = *unit;
+        ptr->data = list->data + list->data_len;
+        ptr->data_size = 0; // we don't own it
+        memcpy(ptr->data, unit->data, unit->data_len);
+        list->data_len += unit->data_len;
+        return 0;
+    }
+
     ptr = &list->array[list->length++];
     // Some things can be copied directly
     *ptr = *unit;
@@ -1073,14 +1477,20 @@ static inline void clear_ES_unit_list(ES_unit_list_p list)
 {
     if (list->array != nullptr) {
         int ii;
-        for (ii = 0; ii < list->length; ii++) {
+        for (ii = 0; ii < list->length && !list->contiguous; ii++) {
             clear_ES_unit(&list->array[ii]);
         }
         free(list->array);
         list->array = nullptr;
     }
+    if (list->data != nullptr) {
+        free(list->data);
+        list->data = nullptr;
+    }
     list->length = 0;
     list->size = 0;
+    list->data_len = 0;
+    list->data_size = 0;
 }
 
 /*
@@ -1090,13 +1500,14 @@ void reset_ES_unit_list(ES_unit_list_p list)
 {
     if (list->array != nullptr) {
         int ii;
-        for (ii = 0; ii < list->length; ii++) {
+        for (ii = 0; ii < list->length && !list->contiguous; ii++) {
             clear_ES_unit(&list->array[ii]);
         }
         // We *could* also shrink it - as it is, it will never get smaller
         // than its maximum size. Is that likely to be a problem?
     }
     list->length = 0;
+    list->data_len = 0;
 }
 
 /*
@@ -1334,6 +1745,36 @@ static int try_to_guess_video_type(
     return 0;
 }
 
+/*
+ * Given what `try_to_guess_video_type` has ruled out so far, have we decided?
+ *
+ * Returns true if only one video type is left, in which case `video_type`
+ * is set to it.
+ */
+static int decide_from_video_type_guesses(
+    int show_reasoning, int maybe_h264, int maybe_h262, int maybe_avs, int* video_type)
+{
+    if (maybe_h264 && !maybe_h262 && !maybe_avs) {
+        if (show_reasoning)
+            print_msg("  Which leaves only H.264\n");
+        *video_type = VIDEO_H264;
+        return true;
+    } else if (!maybe_h264 && maybe_h262 && !maybe_avs) {
+        if (show_reasoning)
+            print_msg("  Which leaves only H.262\n");
+        *video_type = VIDEO_H262;
+        return true;
+    } else if (!maybe_h264 && !maybe_h262 && maybe_avs) {
+        if (show_reasoning)
+            print_msg("  Which leaves only AVS\n");
+        *video_type = VIDEO_AVS;
+        return true;
+    }
+    if (show_reasoning)
+        print_msg("  It is not possible to decide from that start code\n");
+    return false;
+}
+
 /*
  * Look at the start of an elementary stream to try to determine its
  * video type.
@@ -1414,25 +1855,8 @@ int decide_ES_video_type(ES_p es, int print_dots, int show_reasoning, int* video
             return 1;
         }
 
-        if (maybe_h264 && !maybe_h262 && !maybe_avs) {
-            if (show_reasoning)
-                print_msg("  Which leaves only H.264\n");
-            *video_type = VIDEO_H264;
-            decided = true;
-        } else if (!maybe_h264 && maybe_h262 && !maybe_avs) {
-            if (show_reasoning)
-                print_msg("  Which leaves only H.262\n");
-            *video_type = VIDEO_H262;
-            decided = true;
-        } else if (!maybe_h264 && !maybe_h262 && maybe_avs) {
-            if (show_reasoning)
-                print_msg("  Which leaves only AVS\n");
-            *video_type = VIDEO_AVS;
-            decided = true;
-        } else {
-            if (show_reasoning)
-                print_msg("  It is not possible to decide from that start code\n");
-        }
+        decided = decide_from_video_type_guesses(
+            show_reasoning, maybe_h264, maybe_h262, maybe_avs, video_type);
         if (decided)
             break;
     }
@@ -1442,6 +1866,57 @@ int decide_ES_video_type(ES_p es, int print_dots, int show_reasoning, int* video
     return 0;
 }
 
+/*
+ * Look at some elementary stream data, already in memory, to try to
+ * determine its video type.
+ *
+ * This makes the same decision as `decide_ES_video_type`, but works
+ * directly on the bytes, without needing an ES reader (or any file
+ * access), and looks at up to the first 1000 start codes.
+ *
+ * - `data` is the start of the elementary stream, and `data_len` its length
+ * - if `show_reasoning` is true, then output messages explaining how the
+ *   decision is being made
+ * - `video_type` is the final decision -- one of VIDEO_H264, VIDEO_H262,
+ *   VIDEO_AVS, or VIDEO_UNKNOWN.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong (for instance,
+ * the data looks like PES rather than ES)
+ */
+int decide_ES_data_video_type(
+    const byte data[], uint32_t data_len, int show_reasoning, int* video_type)
+{
+    int maybe_h262 = true;
+    int maybe_h264 = true;
+    int maybe_avs = true;
+    int count = 0;
+    uint32_t posn;
+    struct ES_unit unit;
+
+    *video_type = VIDEO_UNKNOWN;
+    memset(&unit, 0, sizeof(unit));
+
+    for (posn = 0; posn + 3 < data_len && count < 1000; posn++) {
+        if (data[posn] != 0 || data[posn + 1] != 0 || data[posn + 2] != 1)
+            continue;
+
+        // Only the start code is needed to make a guess
+        unit.start_code = data[posn + 3];
+        count++;
+        if (show_reasoning)
+            fprint_msg("%d: ", count);
+        if (try_to_guess_video_type(&unit, show_reasoning, &maybe_h264, &maybe_h262, &maybe_avs)) {
+            print_err("### Whilst trying to work out video_type\n");
+            return 1;
+        }
+        if (decide_from_video_type_guesses(
+                show_reasoning, maybe_h264, maybe_h262, maybe_avs, video_type))
+            break;
+        posn += 3;
+    }
+    return 0;
+}
+
 /*
  * Look at the start of an elementary stream to try to determine it's
  * video type.
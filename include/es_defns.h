@@ -29,6 +29,7 @@
 #ifndef _es_defns
 #define _es_defns
 
+#include "blockcache_defns.h"
 #include "compat.h"
 #include "pes_defns.h"
 #include <stdio.h>
@@ -49,6 +50,8 @@ typedef struct _ES_offset* ES_offset_p;
 // The number of bytes to "read ahead" when reading directly from an
 // elementary stream
 #define ES_READ_AHEAD_SIZE 1000
+// And the number of such blocks to keep
+#define ES_READ_AHEAD_BLOCKS 16
 
 // ------------------------------------------------------------
 // A datastructure to represent our input elementary stream (ES)
@@ -59,10 +62,17 @@ struct elementary_stream {
     // If we're reading from an elementary data stream directly, then
     // we use the input directly
     int input;
-    // And maintain a buffer of "read ahead" bytes
-    byte read_ahead[ES_READ_AHEAD_SIZE];
+    // And maintain a buffer of "read ahead" bytes, which is one of a small
+    // cache of recently read blocks (so that seeking back into one of them
+    // need not re-read the file)
+    block_cache_p blocks;
+    block_cache_entry_p read_ahead_block;
+    byte* read_ahead;
     offset_t read_ahead_posn; // location of this data in the file
     int32_t read_ahead_len; // actual number of bytes in the buffer
+    // If the file is not positioned just after `read_ahead`, where to seek
+    // to before reading any more (otherwise -1)
+    offset_t reposition;
 
     // And the next byte to be read is specified by its offset in said
     // data stream. For "bare" ES data, the `infile` value is used to
@@ -73,6 +83,10 @@ struct elementary_stream {
     // (this is, in fact, more used by tsserve than by anything else)
     ES_offset posn_of_next_byte;
 
+    // If this is not -1, then (when reading ES data directly) we pretend
+    // that the file ends at the ES unit that starts at or after it
+    offset_t limit;
+
     // If we're reading from PES packets (from either a PS or TS file),
     // then we need to remember our PES reader
     PES_reader_p reader;
@@ -88,6 +102,10 @@ struct elementary_stream {
     byte cur_byte; // The current (last read) byte
     byte prev1_byte; // The previous byte
     byte prev2_byte; // The byte before *that*
+
+    // If we've been asked to read ahead in a separate thread, the
+    // datastructure that hands ES units over from it (otherwise nullptr)
+    struct ES_pipeline* pipeline;
 };
 typedef struct elementary_stream* ES_p;
 #define SIZEOF_ES sizeof(struct elementary_stream)
@@ -130,6 +148,15 @@ struct ES_unit_list {
     struct ES_unit* array; // The current array of ES units
     int length; // How many there are
     int size; // How big the array is
+
+    // If `contiguous`, the list owns a single buffer, `data`, and the data of
+    // each unit is copied into it, one after another, as the unit is appended.
+    // Each unit's `data` then points into that buffer (and its `data_size` is
+    // 0, since it does not own it). Otherwise, each unit has its own copy.
+    int contiguous;
+    byte* data; // All of the units' data, in order
+    uint32_t data_len; // How much of it there is
+    uint32_t data_size; // How big the buffer is
 };
 typedef struct ES_unit_list* ES_unit_list_p;
 #define SIZEOF_ES_UNIT_LIST sizeof(struct ES_unit_list)
@@ -137,6 +164,40 @@ typedef struct ES_unit_list* ES_unit_list_p;
 #define ES_UNIT_LIST_START_SIZE 20
 #define ES_UNIT_LIST_INCREMENT 20
 
+// Initial size of the buffer for a contiguous ES unit list (it doubles
+// thereafter)
+#define ES_UNIT_LIST_DATA_START_SIZE 0x10000
+
+// ------------------------------------------------------------
+// Reading ES units in a separate thread
+//
+// When an ES reader is "pipelined", a producer thread does the reading
+// (of the file, or of the TS/PS and PES packets) and the start code
+// scanning, and hands each complete ES unit over through a bounded
+// single-producer/single-consumer queue. The thread calling
+// `find_next_ES_unit` just takes the next unit from the queue.
+//
+// The producer is started by the first `find_next_ES_unit` after the
+// pipeline is enabled (or after a seek), and is stopped (and anything it
+// has queued is discarded) by any seek.
+
+#define ES_PIPELINE_QUEUE_SIZE 64 // must be a power of two
+
+struct ES_pipeline_slot {
+    struct ES_unit unit;
+    int err; // 0, or the EOF or 1 that ended the producer
+};
+
+struct ES_pipeline {
+    struct ES_pipeline_slot slots[ES_PIPELINE_QUEUE_SIZE];
+    std::atomic<uint32_t> head; // number of slots taken by the consumer
+    std::atomic<uint32_t> tail; // number of slots filled by the producer
+    std::atomic<int> stopping; // asks the producer to stop
+    int running; // true if the producer thread has been started
+    std::thread producer;
+};
+typedef struct ES_pipeline* ES_pipeline_p;
+
 #endif // _es_defns
 
 // Local Variables:
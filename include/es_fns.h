@@ -188,6 +188,40 @@ void report_ES_unit(int is_msg, ES_unit_p unit);
  */
 int get_end_of_underlying_PES_packet(ES_p es, byte** data, int* data_len);
 
+/*
+ * Choose whether ES units are to be read by a separate (producer) thread.
+ *
+ * If `pipelined` is true, then the reading of the underlying data (ES
+ * file, or TS/PS and PES packets) and the scanning for start codes is done
+ * in a separate thread, which runs ahead of `find_next_ES_unit` (by up to
+ * ES_PIPELINE_QUEUE_SIZE ES units). The ES units returned are exactly as
+ * they would otherwise be. Seeking (including via `read_ES_data` or a
+ * rewind) stops the thread, which is restarted by the next
+ * `find_next_ES_unit`.
+ *
+ * Whilst the producer is running, it owns the ES reader and its PES
+ * reader, so the caller should not look inside either of them (for
+ * instance, at `posn_of_next_byte`), and `get_end_of_underlying_PES_packet`
+ * may not be used.
+ *
+ * If `pipelined` is false, any producer thread is stopped, and ES units
+ * are read directly again (from wherever the producer had got to).
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int set_ES_pipelining(ES_p es, int pipelined);
+
+/*
+ * Pretend that a "bare" ES file ends before the first ES unit that starts
+ * at or after `limit`. This allows part of a file to be read as if it
+ * were the whole of it (having sought to its start).
+ *
+ * If `limit` is -1, then the whole file is read again.
+ *
+ * Returns 0 if all goes well, 1 if the ES is being read from PES.
+ */
+int set_ES_limit(ES_p es, offset_t limit);
+
 /*
  * Find and read in the next ES unit.
  *
@@ -288,6 +322,31 @@ int read_ES_data(
  */
 int build_ES_unit_list(ES_unit_list_p* list);
 
+/*
+ * Build a new list-of-ES-units datastructure, which keeps the data for all
+ * of its units in a single buffer.
+ *
+ * This means that appending a unit does not need its own allocation, and
+ * that the whole of the list's data can be retrieved (for instance, to
+ * write it out) with `get_ES_unit_list_data`.
+ *
+ * Returns 0 if it succeeds, 1 if some error occurs.
+ */
+int build_contiguous_ES_unit_list(ES_unit_list_p* list);
+
+/*
+ * Retrieve the data for all of the units in a contiguous ES unit list.
+ *
+ * - `list` is the list, which must have been built with
+ *   `build_contiguous_ES_unit_list`
+ * - `data` is returned as the start of the data (nullptr if there is none),
+ *   which remains owned by the list
+ * - `data_len` is returned as its length
+ *
+ * Returns 0 if it succeeds, 1 if the list is not contiguous.
+ */
+int get_ES_unit_list_data(ES_unit_list_p list, byte** data, uint32_t* data_len);
+
 /*
  * Add a copy of an ES unit to the end of the ES unit list
  *
@@ -371,6 +430,25 @@ int compare_ES_offsets(ES_offset offset1, ES_offset offset2);
  * Returns 0 if all goes well, 1 if something goes wrong
  */
 int decide_ES_video_type(ES_p es, int print_dots, int show_reasoning, int* video_type);
+/*
+ * Look at some elementary stream data, already in memory, to try to
+ * determine its video type.
+ *
+ * This makes the same decision as `decide_ES_video_type`, but works
+ * directly on the bytes, without needing an ES reader (or any file
+ * access), and looks at up to the first 1000 start codes.
+ *
+ * - `data` is the start of the elementary stream, and `data_len` its length
+ * - if `show_reasoning` is true, then output messages explaining how the
+ *   decision is being made
+ * - `video_type` is the final decision -- one of VIDEO_H264, VIDEO_H262,
+ *   VIDEO_AVS, or VIDEO_UNKNOWN.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong (for instance,
+ * the data looks like PES rather than ES)
+ */
+int decide_ES_data_video_type(
+    const byte data[], uint32_t data_len, int show_reasoning, int* video_type);
 /*
  * Look at the start of an elementary stream to try to determine it's
  * video type.
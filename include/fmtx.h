@@ -26,8 +26,12 @@
  * ***** END LICENSE BLOCK *****
  */
 
-#define FMTX_BUFFERS_COUNT 8
-#define FMTX_BUFFER_SIZE 128
+#include <cstdio>
+#include <cstdint>
+
+// The longest timestamp `fmtx_timestamp_r` produces, including the
+// terminating null
+#define FMTX_TIMESTAMP_MAX 32
 
 typedef char TCHAR;
 #define _T(x) x
@@ -48,5 +52,14 @@ typedef char TCHAR;
 #define FMTX_TS_DISPLAY_ms 0x30
 #define FMTX_TS_DISPLAY_HMS 0x40
 
-const TCHAR* fmtx_timestamp(int64_t n, unsigned int flags);
+/*
+ * Format a timestamp `n` as text, according to `flags`, into `buf`, which
+ * is `buf_size` characters long. A buffer of FMTX_TIMESTAMP_MAX characters
+ * is always big enough; if `buf` is shorter, the text is truncated.
+ *
+ * This does not allocate, and is safe to call from any thread.
+ *
+ * Returns `buf`.
+ */
+const TCHAR* fmtx_timestamp_r(TCHAR* buf, size_t buf_size, int64_t n, unsigned int flags);
 int fmtx_str_to_timestamp_flags(const TCHAR* arg_str);
@@ -0,0 +1,318 @@
+#pragma once
+
+/*
+ * Splitting an elementary stream into parts that can be analysed
+ * independently (and thus in parallel).
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <sys/stat.h>
+
+#include "compat.h"
+#include "compressed_fns.h"
+#include "es_fns.h"
+#include "gop_fns.h"
+#include "nalunit_defns.h"
+#include "printing_fns.h"
+#include "shmring_fns.h"
+#include "video_defns.h"
+
+/*
+ * Find the start of the first GOP that starts at or after `from`.
+ *
+ * For H.262, that is a sequence header.
+ *
+ * For H.264, it is the first of the NAL units that precede an IDR slice
+ * (and that make an access unit start there), as long as those include a
+ * sequence parameter set and a picture parameter set, so that the GOP can
+ * be decoded without anything that came before it. We must also have seen
+ * a slice before them, so that we know we have seen all of them.
+ *
+ * `start` is returned as -1 if there is no such GOP.
+ *
+ * `end` is returned as where reading the part before the GOP should stop
+ * (see `struct ES_part`). For H.262, this is the ES unit after the sequence
+ * header, since the H.262 reader needs to see the start of the next
+ * sequence header to know that the picture before it is complete. For
+ * H.264, it is the same as `start`.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int find_GOP_start(
+    ES_p es, int video_type, offset_t from, offset_t* start, offset_t* end)
+{
+    int err;
+    ES_offset where = { from, 0 };
+    struct ES_unit unit;
+    offset_t group_start = -1; // the first NAL unit after the last slice
+    int group_ok = false;
+    int had_seq_param_set = false;
+    int had_pic_param_set = false;
+    int had_slice = false;
+
+    *start = *end = -1;
+    err = seek_ES(es, where);
+    if (err)
+        return 1;
+    err = setup_ES_unit(&unit);
+    if (err)
+        return 1;
+
+    for (;;) {
+        err = find_next_ES_unit(es, &unit);
+        if (err == EOF)
+            break;
+        else if (err) {
+            clear_ES_unit(&unit);
+            return 1;
+        }
+
+        if (video_type == VIDEO_H262) {
+            if (*start != -1) {
+                *end = unit.start_posn.infile;
+                break;
+            } else if (unit.start_code == 0xB3)
+                *start = unit.start_posn.infile;
+            continue;
+        }
+
+        int nal_unit_type = unit.start_code & 0x1F;
+        if (nal_unit_type >= NAL_NON_IDR && nal_unit_type <= NAL_IDR) {
+            // An IDR slice with first_mb_in_slice 0 starts a new picture
+            if (nal_unit_type == NAL_IDR && had_slice && group_ok && had_seq_param_set
+                && had_pic_param_set && unit.data_len > 4 && (unit.data[4] & 0x80)) {
+                *start = *end = group_start;
+                break;
+            }
+            had_slice = true;
+            group_start = -1;
+        } else if (nal_unit_type == NAL_ACCESS_UNIT_DELIM) {
+            // This must come first in an access unit, or things get confusing
+            group_ok = (group_start == -1);
+            if (group_start == -1)
+                group_start = unit.start_posn.infile;
+        } else if (nal_unit_type == NAL_SEI || nal_unit_type == NAL_SEQ_PARAM_SET
+            || nal_unit_type == NAL_PIC_PARAM_SET || (nal_unit_type >= 13 && nal_unit_type <= 18)) {
+            if (group_start == -1) {
+                group_start = unit.start_posn.infile;
+                group_ok = true;
+            }
+            if (nal_unit_type == NAL_SEQ_PARAM_SET)
+                had_seq_param_set = true;
+            else if (nal_unit_type == NAL_PIC_PARAM_SET)
+                had_pic_param_set = true;
+            continue;
+        } else if (nal_unit_type == NAL_END_OF_SEQ || nal_unit_type == NAL_END_OF_STREAM) {
+            // These end the access unit we are in (and, in the access unit
+            // reader, discard anything that came between them and the
+            // last slice)
+            group_start = -1;
+        } else
+            continue; // ignored (by the access unit reader) wherever it is
+
+        had_seq_param_set = had_pic_param_set = false;
+    }
+    clear_ES_unit(&unit);
+    return 0;
+}
+
+/*
+ * Split a (bare) ES file into (up to) `num_parts` parts, each starting at
+ * the start of a GOP.
+ *
+ * - `es` is the ES to split, which must be reading a file directly (not
+ *   via PES, and not from standard input).
+ * - `video_type` is VIDEO_H262 or VIDEO_H264.
+ * - `num_parts` is the number of parts wanted. Fewer may be produced if
+ *   the file is small (see GOP_MIN_PART_SIZE), or if its GOPs are long.
+ * - `partition` is the new partition.
+ *
+ * Only the starts of the GOPs near to each nominal split point are
+ * looked for, so this only reads a small part of the file.
+ *
+ * Afterwards, `es` is positioned at the start of the file again.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int split_ES_file_by_GOP(ES_p es, int video_type, int num_parts, ES_partition_p* partition)
+{
+    int err;
+    struct stat statbuf;
+    offset_t size;
+    ES_offset start_of_file = { 0, 0 };
+    int ii, nn;
+
+    if (!es->reading_ES) {
+        print_err("### Cannot split ES data that is being read from PES into GOPs\n");
+        return 1;
+    } else if (video_type != VIDEO_H262 && video_type != VIDEO_H264) {
+        print_err("### Can only split H.262 or H.264 data into GOPs\n");
+        return 1;
+    } else if (fstat(es->input, &statbuf) || !S_ISREG(statbuf.st_mode)) {
+        print_err("### Can only split ES data in a file into GOPs\n");
+        return 1;
+    } else if (is_compressed_file(es->input)) {
+        print_err("### Cannot split compressed ES data into GOPs\n");
+        return 1;
+    } else if (is_shm_file(es->input)) {
+        print_err("### Cannot split ES data from shared memory into GOPs\n");
+        return 1;
+    }
+    size = statbuf.st_size;
+    if (num_parts > size / GOP_MIN_PART_SIZE)
+        num_parts = (int)(size / GOP_MIN_PART_SIZE);
+    if (num_parts < 1)
+        num_parts = 1;
+
+    ES_partition_p new2 = (ES_partition_p)malloc(SIZEOF_ES_PARTITION);
+    if (new2 == nullptr) {
+        print_err("### Unable to allocate ES partition datastructure\n");
+        return 1;
+    }
+    new2->parts = (struct ES_part*)malloc(num_parts * sizeof(struct ES_part));
+    if (new2->parts == nullptr) {
+        print_err("### Unable to allocate ES partition array\n");
+        free(new2);
+        return 1;
+    }
+
+    nn = 0;
+    new2->parts[0].start = 0;
+    for (ii = 1; ii < num_parts; ii++) {
+        offset_t start, end;
+        err = find_GOP_start(es, video_type, size / num_parts * ii, &start, &end);
+        if (err) {
+            print_err("### Error looking for start of GOP\n");
+            free_ES_partition(&new2);
+            return 1;
+        }
+        if (start == -1)
+            break; // There are no more GOPs
+        else if (start <= new2->parts[nn].start)
+            continue; // This GOP is longer than a part
+        new2->parts[nn].end = end;
+        nn++;
+        new2->parts[nn].start = start;
+    }
+    new2->parts[nn].end = -1;
+    new2->num_parts = nn + 1;
+
+    err = seek_ES(es, start_of_file);
+    if (err) {
+        free_ES_partition(&new2);
+        return 1;
+    }
+    *partition = new2;
+    return 0;
+}
+
+/*
+ * Free a partition, and set `partition` to nullptr.
+ */
+void free_ES_partition(ES_partition_p* partition)
+{
+    if (*partition == nullptr)
+        return;
+    free((*partition)->parts);
+    free(*partition);
+    *partition = nullptr;
+}
+
+// What the threads analysing the parts share
+struct ES_part_work {
+    char* filename;
+    ES_partition_p partition;
+    ES_part_fn fn;
+    void* arg;
+    std::atomic<int> next_part; // the next part to be analysed
+    std::atomic<int> failed;
+};
+
+static void ES_part_worker(struct ES_part_work* work)
+{
+    ES_p es = nullptr;
+    int err = open_elementary_stream(work->filename, &es);
+    if (err) {
+        work->failed.store(true);
+        return;
+    }
+    for (;;) {
+        int part = work->next_part.fetch_add(1);
+        if (part >= work->partition->num_parts)
+            break;
+        ES_offset start = { work->partition->parts[part].start, 0 };
+        err = set_ES_limit(es, work->partition->parts[part].end);
+        if (!err)
+            err = seek_ES(es, start);
+        if (!err)
+            err = work->fn(es, part, work->arg);
+        if (err) {
+            fprint_err("### Error analysing ES from " OFFSET_T_FORMAT "\n", start.infile);
+            work->failed.store(true);
+        }
+    }
+    close_elementary_stream(&es);
+}
+
+/*
+ * Analyse the parts of an ES file in parallel.
+ *
+ * - `filename` is the name of the file. Each thread opens it for itself.
+ * - `partition` says how it is split up.
+ * - `num_threads` is how many threads to use.
+ * - `fn` is called for each part, with its own ES reader positioned at the
+ *   start of the part (and which will act as if the file ends at the end
+ *   of the part), the index of the part, and `arg`.
+ *
+ * The parts are handed out to the threads in order, but are (of course)
+ * not analysed in order, so `fn` should save what it finds for each part
+ * (in `arg`) rather than reporting it, so that the results can be merged
+ * in order afterwards.
+ *
+ * Returns 0 if all goes well, 1 if any of the parts could not be analysed.
+ */
+int analyse_ES_parts(
+    char* filename, ES_partition_p partition, int num_threads, ES_part_fn fn, void* arg)
+{
+    struct ES_part_work work;
+    int num_started = 0;
+    int ii;
+
+    work.filename = filename;
+    work.partition = partition;
+    work.fn = fn;
+    work.arg = arg;
+    work.next_part.store(0);
+    work.failed.store(false);
+
+    if (num_threads > partition->num_parts)
+        num_threads = partition->num_parts;
+    std::thread* threads = new (std::nothrow) std::thread[num_threads];
+    if (threads != nullptr) {
+        for (ii = 0; ii < num_threads; ii++) {
+            try {
+                threads[ii] = std::thread(ES_part_worker, &work);
+            } catch (...) {
+                break;
+            }
+            num_started++;
+        }
+    }
+    // If we couldn't start any threads, we can at least do the work ourselves
+    if (num_started == 0)
+        ES_part_worker(&work);
+    for (ii = 0; ii < num_started; ii++)
+        threads[ii].join();
+    delete[] threads;
+    return work.failed.load() ? 1 : 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
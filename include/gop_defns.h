@@ -0,0 +1,59 @@
+/*
+ * Datastructures for splitting an elementary stream into parts that
+ * can be analysed independently (and thus in parallel).
+ *
+ * Each part starts at the start of a GOP - that is, for H.262, at a
+ * sequence header, and for H.264, at the first NAL unit of an IDR access
+ * unit that carries its own sequence and picture parameter sets. Reading
+ * a part from its start with a new context therefore gives the same
+ * pictures/access units as reading through the whole file would.
+ *
+ */
+
+#ifndef _gop_defns
+#define _gop_defns
+
+#include "compat.h"
+#include "es_defns.h"
+
+// We don't bother splitting a file into parts smaller than this
+#define GOP_MIN_PART_SIZE (1024 * 1024)
+
+// We aim for this many parts per thread, so that one part taking longer
+// than the others does not leave the other threads idle at the end
+#define GOP_PARTS_PER_THREAD 4
+
+// A part of a (bare) ES file
+struct ES_part {
+    offset_t start; // The offset of its first ES unit
+    // Where to stop reading the part - the offset of the first ES unit that
+    // should not be read, or -1 for the end of the file. This is normally
+    // the start of the next part, but for H.262 it is the ES unit after the
+    // sequence header that starts it, so that the last picture of this
+    // part is seen to be complete. Items read from the next part should be
+    // ignored.
+    offset_t end;
+};
+
+struct ES_partition {
+    int num_parts;
+    struct ES_part* parts;
+};
+typedef struct ES_partition* ES_partition_p;
+#define SIZEOF_ES_PARTITION sizeof(struct ES_partition)
+
+// The function called to analyse a part. `es` is positioned at the start
+// of the part, and returns EOF at its end. `part` is the index of the part
+// in the partition, and `arg` is as given to `analyse_ES_parts`.
+// It should return 0 if all goes well, 1 if it could not analyse the part
+// at all.
+typedef int (*ES_part_fn)(ES_p es, int part, void* arg);
+
+#endif // _gop_defns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,66 @@
+/*
+ * Functions for splitting an elementary stream into parts that can be
+ * analysed independently (and thus in parallel).
+ *
+ */
+
+#ifndef _gop_fns
+#define _gop_fns
+
+#include "compat.h"
+#include "es_defns.h"
+#include "gop_defns.h"
+
+/*
+ * Split a (bare) ES file into (up to) `num_parts` parts, each starting at
+ * the start of a GOP.
+ *
+ * - `es` is the ES to split, which must be reading a file directly (not
+ *   via PES, and not from standard input).
+ * - `video_type` is VIDEO_H262 or VIDEO_H264.
+ * - `num_parts` is the number of parts wanted. Fewer may be produced if
+ *   the file is small (see GOP_MIN_PART_SIZE), or if its GOPs are long.
+ * - `partition` is the new partition.
+ *
+ * Only the starts of the GOPs near to each nominal split point are
+ * looked for, so this only reads a small part of the file.
+ *
+ * Afterwards, `es` is positioned at the start of the file again.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int split_ES_file_by_GOP(ES_p es, int video_type, int num_parts, ES_partition_p* partition);
+
+/*
+ * Free a partition, and set `partition` to nullptr.
+ */
+void free_ES_partition(ES_partition_p* partition);
+
+/*
+ * Analyse the parts of an ES file in parallel.
+ *
+ * - `filename` is the name of the file. Each thread opens it for itself.
+ * - `partition` says how it is split up.
+ * - `num_threads` is how many threads to use.
+ * - `fn` is called for each part, with its own ES reader positioned at the
+ *   start of the part (and which will act as if the file ends at the end
+ *   of the part), the index of the part, and `arg`.
+ *
+ * The parts are handed out to the threads in order, but are (of course)
+ * not analysed in order, so `fn` should save what it finds for each part
+ * (in `arg`) rather than reporting it, so that the results can be merged
+ * in order afterwards.
+ *
+ * Returns 0 if all goes well, 1 if any of the parts could not be analysed.
+ */
+int analyse_ES_parts(
+    char* filename, ES_partition_p partition, int num_threads, ES_part_fn fn, void* arg);
+
+#endif // _gop_fns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
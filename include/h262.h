@@ -393,7 +393,7 @@ static int build_h262_picture(h262_context_p context, h262_picture_p* picture, h
         return 1;
     }
 
-    err = build_ES_unit_list(&(new2->list));
+    err = build_contiguous_ES_unit_list(&(new2->list));
     if (err) {
         print_err("### Unable to allocate internal list for H.262 picture\n");
         free(new2);
@@ -455,31 +455,29 @@ static int build_h262_picture(h262_context_p context, h262_picture_p* picture, h
 static int append_fake_afd(h262_picture_p picture, byte afd)
 {
     int err;
-    static h262_item_p item = nullptr;
+    h262_item_p item = nullptr;
 
-    if (item == nullptr) {
-        err = build_h262_item(&item);
-        if (err) {
-            print_err("### Error building 'fake' AFD for H.262 picture\n");
-            return 1;
-        }
-        item->unit.data[0] = 0x00;
-        item->unit.data[1] = 0x00;
-        item->unit.data[2] = 0x01;
-        item->unit.data[3] = 0xb2;
-        item->unit.data[4] = 0x44;
-        item->unit.data[5] = 0x54;
-        item->unit.data[6] = 0x47;
-        item->unit.data[7] = 0x31;
-        item->unit.data[8] = 0x41;
-        item->unit.data[9] = afd;
-        item->unit.data_len = 10;
-        item->unit.start_code = 0xb2;
-    } else
-        item->unit.data[9] = afd;
-
-    // Remember, this *copies* the item, so we can use it again later on
+    err = build_h262_item(&item);
+    if (err) {
+        print_err("### Error building 'fake' AFD for H.262 picture\n");
+        return 1;
+    }
+    item->unit.data[0] = 0x00;
+    item->unit.data[1] = 0x00;
+    item->unit.data[2] = 0x01;
+    item->unit.data[3] = 0xb2;
+    item->unit.data[4] = 0x44;
+    item->unit.data[5] = 0x54;
+    item->unit.data[6] = 0x47;
+    item->unit.data[7] = 0x31;
+    item->unit.data[8] = 0x41;
+    item->unit.data[9] = afd;
+    item->unit.data_len = 10;
+    item->unit.start_code = 0xb2;
+
+    // This *copies* the item, so we are done with it afterwards
     err = append_to_h262_picture(picture, item);
+    free_h262_item(&item);
     if (err) {
         print_err("### Error appending 'fake' AFD to H.262 picture\n");
         return 1;
@@ -1030,6 +1028,17 @@ int write_h262_picture_as_TS(TS_writer_p tswriter, h262_picture_p picture, uint3
 
     list = picture->list;
 
+    // If we have the whole picture in one place, it can go as one PES packet
+    if (list->contiguous) {
+        if (list->data_len == 0)
+            return 0;
+        int err = write_ES_as_TS_PES_packet(
+            tswriter, list->data, list->data_len, pid, DEFAULT_VIDEO_STREAM_ID);
+        if (err)
+            print_err("### Error writing out picture to TS\n");
+        return err;
+    }
+
     for (ii = 0; ii < list->length; ii++) {
         int err;
         ES_unit_p unit = &(list->array[ii]);
@@ -1062,6 +1071,14 @@ int write_h262_picture_as_ES(FILE* output, h262_picture_p picture)
 
     list = picture->list;
 
+    if (list->contiguous) {
+        if (list->data_len > 0 && fwrite(list->data, list->data_len, 1, output) != 1) {
+            fprint_err("### Error writing out picture to ES: %s\n", strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+
     for (ii = 0; ii < list->length; ii++) {
         int err;
         ES_unit_p unit = &(list->array[ii]);
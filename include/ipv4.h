@@ -112,6 +112,53 @@ typedef struct ipv4_udp_header_s {
 int ipv4_udp_from_payload(const uint8_t* data, const uint32_t len, ipv4_udp_header_t* out_hdr,
     uint32_t* out_st, uint32_t* out_len);
 
+/*! Which header an ipv4_flow_test_t offset is relative to */
+#define IPV4_FLOW_BASE_IP 0
+#define IPV4_FLOW_BASE_UDP 1
+
+/*! One test in a flow filter: the big-endian value of `size` (1, 2 or 4)
+ *  bytes at `offset` into the header named by `base`, ANDed with `mask`,
+ *  must equal `value`.
+ */
+typedef struct ipv4_flow_test_s {
+    uint8_t base;
+    uint8_t size;
+    uint16_t offset;
+    uint32_t mask;
+    uint32_t value;
+} ipv4_flow_test_t;
+
+#define IPV4_FLOW_TESTS_MAX 4
+
+/*! A flow filter, compiled once and then run against raw ethernet frames
+ *  before they are decoded, so that traffic for other flows can be dropped
+ *  without building any headers for it.
+ */
+typedef struct ipv4_flow_filter_s {
+    int num_tests;
+    ipv4_flow_test_t tests[IPV4_FLOW_TESTS_MAX];
+} ipv4_flow_filter_t;
+
+/*!
+ * Compile a filter for UDP over IPv4 to the given destination. A zero
+ * address or port matches any.
+ */
+void ipv4_flow_filter_compile(
+    ipv4_flow_filter_t* filter, const uint32_t dest_addr, const uint32_t dest_port);
+
+/*!
+ * Run a compiled filter over a raw ethernet frame (as read from pcap).
+ *
+ * This only answers "can this frame be ignored?": anything the filter cannot
+ * judge cheaply (frames too short to hold the headers tested, IP options
+ * shorter than the minimum header, or IP fragments, whose UDP header may be
+ * elsewhere) is passed on to be decoded in full.
+ *
+ * \return true if the frame cannot belong to the flow, false otherwise.
+ */
+int ipv4_flow_filter_rejects(
+    const ipv4_flow_filter_t* filter, const uint8_t* frame, const uint32_t len);
+
 #endif
 
 /* End file */
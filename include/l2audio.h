@@ -99,10 +99,20 @@ const unsigned int aud_frame_rate_n[16]
 /*
  * Look at a frame header and try to deduce the length of the frame.
  *
+ * - `header` is the first four bytes of the frame (the syncword need not
+ *   be checked)
+ * - `samples` is returned as the number of samples in the frame
+ * - if `quiet`, don't report what is wrong with the header
+ *
+ * Layer II frames are 1152 samples long in MPEG-2 (and 2.5) as well as in
+ * MPEG-1 - only layer III uses the half-length 576 sample frames. This
+ * matters to `read_next_l2audio_frame` too, which reads MPEG-2 layer II
+ * frames using the length worked out here.
+ *
  * Returns the frame length deduced therefrom, or -1 if it finds something
  * wrong with the header data.
  */
-static int peek_frame_header(const uint32_t header)
+static int peek_frame_header(const uint32_t header, int* samples, int quiet)
 {
     unsigned int version, layer, padding;
     //  byte 		protected, private;
@@ -121,7 +131,8 @@ static int peek_frame_header(const uint32_t header)
     //   11 - MPEG Version 1 (ISO/IEC 11172-3)
     version = (header >> 19) & 0x03;
     if (version == 1) {
-        print_err("### Illegal version (1) in MPEG layer 2 audio header\n");
+        if (!quiet)
+            print_err("### Illegal version (1) in MPEG layer 2 audio header\n");
         return -1;
     }
     version = (version == 3) ? 1 : (version == 2) ? 2 : 3;
@@ -133,7 +144,8 @@ static int peek_frame_header(const uint32_t header)
     //   11 - Layer 1
     layer = (header >> 17) & 0x03;
     if (layer == 0) {
-        print_err("### Illegal layer (0) in MPEG layer 2 audio header\n");
+        if (!quiet)
+            print_err("### Illegal layer (0) in MPEG layer 2 audio header\n");
         return -1;
     }
     layer = 4 - layer;
@@ -144,22 +156,25 @@ static int peek_frame_header(const uint32_t header)
     // bitrate field, whose meaning is dependent on version and layer
     bitrate_enc = (header >> 12) & 0x0f;
     if (bitrate_enc == 0x0f) {
-        print_err("### Illegal bitrate_enc (0x0f) in MPEG layer 2 audio header\n");
+        if (!quiet)
+            print_err("### Illegal bitrate_enc (0x0f) in MPEG layer 2 audio header\n");
         return -1;
     }
 
     bitrate = (bitrate_table[version - 1][layer - 1])[bitrate_enc];
     if (bitrate == 0) // bitrate now in kbits per channel
     {
-        print_err("### Illegal bitrate (0 kbits/channel) in MPEG level 2"
-                  " audio header\n");
+        if (!quiet)
+            print_err("### Illegal bitrate (0 kbits/channel) in MPEG level 2"
+                      " audio header\n");
         return -1;
     }
 
     // sample rate field, whose meaning is dependent on version
     sampling_enc = (header >> 10) & 0x03;
     if (sampling_enc == 3) {
-        print_err("### Illegal sampleing_enc (3) in MPEG layer 2 audio header\n");
+        if (!quiet)
+            print_err("### Illegal sampleing_enc (3) in MPEG layer 2 audio header\n");
         return -1;
     }
     //  sampling = sampling_table[version-1][sampling_enc];
@@ -186,20 +201,37 @@ static int peek_frame_header(const uint32_t header)
     //  emphasis  = (header >> 0) & 0x03;
 
     // generate framesize and frame length
-    // (for the moment, we only *use* the frame length)
     if (layer == 1) {
-        //    framesize = 384; // samples
+        *samples = 384;
         framelen = (12000 * bitrate / aud_frame_rate_n[rate] + padding) * 4;
-    } else if (version == 1) {
-        //    framesize = 1152; // samples
+    } else if (version == 1 || layer == 2) {
+        // (Layer II in MPEG-2 and 2.5 is the same length as in MPEG-1)
+        *samples = 1152;
         framelen = (144000 * bitrate / aud_frame_rate_n[rate] + padding);
     } else {
-        //    framesize = 576; // samples
+        *samples = 576;
         framelen = (72000 * bitrate / aud_frame_rate_n[rate] + padding);
     }
     return framelen;
 }
 
+/*
+ * Work out the length of an MPEG audio frame from its header, without
+ * reporting any problems - for use when looking for the start of a frame.
+ *
+ * - `header` is (at least) the first 4 bytes of the frame
+ * - `samples` is returned as the number of samples in the frame
+ *
+ * Returns the length of the frame in bytes, or -1 if `header` is not a
+ * plausible MPEG audio header.
+ */
+int l2audio_frame_info(const byte* header, int* samples)
+{
+    if (header[0] != 0xFF || (header[1] & 0xE0) != 0xE0)
+        return -1;
+    return peek_frame_header((header[1] << 16) | (header[2] << 8) | header[3], samples, true);
+}
+
 /*
  * Read the next audio frame.
  *
@@ -220,6 +252,7 @@ int read_next_l2audio_frame(int file, audio_frame_p* frame)
     byte header[JUST_ENOUGH];
     byte* data = nullptr;
     int frame_length; // XXXX Really 626.94 on average
+    int samples;
 
     offset_t posn = tell_file(file);
 #if DEBUG
@@ -266,7 +299,8 @@ int read_next_l2audio_frame(int file, audio_frame_p* frame)
         fprint_err("#################### Resuming after %d skipped bytes\n", skip);
     }
 
-    frame_length = peek_frame_header((header[1] << 16) | (header[2] << 8) | header[3]);
+    frame_length
+        = peek_frame_header((header[1] << 16) | (header[2] << 8) | header[3], &samples, false);
     if (frame_length < 1) {
         print_err("### Bad MPEG layer 2 audio header\n");
         return 1;
@@ -61,6 +61,18 @@ void free_audio_frame(audio_frame_p* frame);
  * goes wrong.
  */
 int read_next_l2audio_frame(int file, audio_frame_p* frame);
+
+/*
+ * Work out the length of an MPEG audio frame from its header, without
+ * reporting any problems - for use when looking for the start of a frame.
+ *
+ * - `header` is (at least) the first 4 bytes of the frame
+ * - `samples` is returned as the number of samples in the frame
+ *
+ * Returns the length of the frame in bytes, or -1 if `header` is not a
+ * plausible MPEG audio header.
+ */
+int l2audio_frame_info(const byte* header, int* samples);
 #endif // _l2audio_fns
 
 // Local Variables:
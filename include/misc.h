@@ -36,6 +36,7 @@
 #include <climits>
 #include <cstring>
 #include <fcntl.h> // O_... flags
+#include <mutex>
 
 //#include <cmath>
 
@@ -50,10 +51,13 @@
 #include <unistd.h> // open, close
 
 #include "compat.h"
+#include "compressed_fns.h"
 #include "es_fns.h"
 #include "misc_fns.h"
 #include "pes_fns.h"
 #include "printing_fns.h"
+#include "probe_fns.h"
+#include "shmring_fns.h"
 
 #define DEBUG_SEEK 1
 
@@ -61,32 +65,40 @@
 // CRC calculation
 // ============================================================
 
-static uint32_t crc_table[256];
+// One table per byte position within a 32-bit word, so that we can
+// consume four bytes at a time ("slicing by four"). The first is the
+// conventional byte-at-a-time table.
+static uint32_t crc_table[4][256];
 
 /*
- * Populate the (internal) CRC table. May safely be called more than once.
+ * Populate the (internal) CRC tables. May safely be called more than once,
+ * and from more than one thread.
  */
 static void make_crc_table(void)
 {
-    int i, j;
-    int already_done = 0;
-    uint32_t crc;
-
-    if (already_done)
-        return;
-    else
-        already_done = 1;
-
-    for (i = 0; i < 256; i++) {
-        crc = i << 24;
-        for (j = 0; j < 8; j++) {
-            if (crc & 0x80000000L)
-                crc = (crc << 1) ^ CRC32_POLY;
-            else
-                crc = (crc << 1);
+    static std::once_flag done;
+
+    std::call_once(done, [] {
+        int i, j;
+        uint32_t crc;
+
+        for (i = 0; i < 256; i++) {
+            crc = i << 24;
+            for (j = 0; j < 8; j++) {
+                if (crc & 0x80000000L)
+                    crc = (crc << 1) ^ CRC32_POLY;
+                else
+                    crc = (crc << 1);
+            }
+            crc_table[0][i] = crc;
         }
-        crc_table[i] = crc;
-    }
+        for (i = 0; i < 256; i++) {
+            for (j = 1; j < 4; j++) {
+                crc = crc_table[j - 1][i];
+                crc_table[j][i] = (crc << 8) ^ crc_table[0][crc >> 24];
+            }
+        }
+    });
 }
 
 /*
@@ -100,15 +112,19 @@ static void make_crc_table(void)
  */
 uint32_t crc32_block(uint32_t crc, byte* pData, int blk_len)
 {
-    static int table_made = false;
-    int i, j;
+    int i;
 
-    if (!table_made)
-        make_crc_table();
+    make_crc_table();
 
-    for (j = 0; j < blk_len; j++) {
+    for (; blk_len >= 4; blk_len -= 4, pData += 4) {
+        crc ^= ((uint32_t)pData[0] << 24) | ((uint32_t)pData[1] << 16)
+            | ((uint32_t)pData[2] << 8) | pData[3];
+        crc = crc_table[3][crc >> 24] ^ crc_table[2][(crc >> 16) & 0xff]
+            ^ crc_table[1][(crc >> 8) & 0xff] ^ crc_table[0][crc & 0xff];
+    }
+    for (; blk_len > 0; blk_len--) {
         i = ((crc >> 24) ^ *pData++) & 0xff;
-        crc = (crc << 8) ^ crc_table[i];
+        crc = (crc << 8) ^ crc_table[0][i];
     }
     return crc;
 }
@@ -213,11 +229,30 @@ double log2(double x)
 // ============================================================
 // Simple file I/O utilities
 // ============================================================
+/*
+ * Read some bytes from a file.
+ *
+ * This is a jacket for `read`, which reads the decompressed data instead
+ * if the file is compressed (see `setup_compressed_input`), and the data in
+ * the ring if it is shared memory (see `open_shm_input`).
+ *
+ * Returns what `read` would.
+ */
+ssize_t read_file(int filedes, byte* data, size_t num_bytes)
+{
+    compressed_input_p compressed = get_compressed_input(filedes);
+    if (compressed != nullptr)
+        return read_compressed_input(compressed, data, num_bytes);
+    shm_ring_p shm = get_shm_input(filedes);
+    if (shm != nullptr)
+        return read_shm_input(shm, data, num_bytes);
+    return read(filedes, data, num_bytes);
+}
+
 /*
  * Read a given number of bytes from a file.
  *
- * This is a jacket for `read`, allowing for the future possibility of
- * buffered input, and simplifying error handling.
+ * This is a jacket for `read_file`, simplifying error handling.
  *
  * - `input` is the file descriptor for the file
  * - `num_bytes` is how many bytes to read
@@ -235,7 +270,7 @@ int read_bytes(int input, int num_bytes, byte* data)
     // Make some allowance for short reads - for instance, if we're reading
     // from a pipe and going just a bit faster than the sender
     while (total < num_bytes) {
-        length = read(input, &(data[total]), num_bytes - total);
+        length = read_file(input, &(data[total]), num_bytes - total);
         if (length == 0)
             return EOF;
         else if (length == -1) {
@@ -264,6 +299,13 @@ int read_bytes(int input, int num_bytes, byte* data)
  */
 int seek_file(int filedes, offset_t posn)
 {
+    compressed_input_p compressed = get_compressed_input(filedes);
+    if (compressed != nullptr)
+        return seek_compressed_input(compressed, posn);
+    shm_ring_p shm = get_shm_input(filedes);
+    if (shm != nullptr)
+        return seek_shm_input(shm, posn);
+
     offset_t newposn = lseek(filedes, posn, SEEK_SET);
     if (newposn == -1) {
         fprint_err("### Error moving (seeking) to position " OFFSET_T_FORMAT " in file: %s\n",
@@ -293,6 +335,13 @@ int seek_file(int filedes, offset_t posn)
  */
 offset_t tell_file(int filedes)
 {
+    compressed_input_p compressed = get_compressed_input(filedes);
+    if (compressed != nullptr)
+        return compressed->posn;
+    shm_ring_p shm = get_shm_input(filedes);
+    if (shm != nullptr)
+        return (offset_t)shm->posn;
+
     offset_t newposn = lseek(filedes, 0, SEEK_CUR);
     if (newposn == -1)
         fprint_err("### Error determining current position in file: %s\n", strerror(errno));
@@ -312,6 +361,11 @@ offset_t tell_file(int filedes)
  *   opened with flag O_RDONLY. In both cases, on Windows the flag
  *   O_BINARY will also be set.
  *
+ * A file opened for read that is compressed with gzip or zstd is read
+ * (via `read_file`, `read_bytes`, `seek_file` and `tell_file`) as its
+ * decompressed data. A name starting "shm:" is opened for read as a
+ * shared memory ring (see `open_shm_input`).
+ *
  * Returns the file descriptor for the file, or -1 if it failed to open
  * the file.
  */
@@ -319,6 +373,8 @@ int open_binary_file(char* filename, int for_write)
 {
     int flags = 0;
     int filedes;
+    if (!for_write && is_shm_name(filename))
+        return open_shm_input(filename);
     if (for_write) {
         flags = flags | O_WRONLY | O_CREAT | O_TRUNC;
         filedes = open(filename, flags, 00777);
@@ -329,6 +385,10 @@ int open_binary_file(char* filename, int for_write)
     if (filedes == -1)
         fprint_err("### Error opening file %s for %s: %s\n", filename,
             (for_write ? "write" : "read"), strerror(errno));
+    else if (!for_write && setup_compressed_input(filedes, filename)) {
+        (void)close(filedes);
+        return -1;
+    }
     return filedes;
 }
 
@@ -346,6 +406,8 @@ int close_file(int filedes)
     if (filedes == -1 || filedes == STDIN_FILENO)
         return 0;
 
+    finish_compressed_input(filedes);
+    finish_shm_input(filedes);
     err = close(filedes);
     if (err) {
         fprint_err("### Error closing file: %s\n", strerror(errno));
@@ -408,6 +470,7 @@ static int open_input_as_ES_direct(
     int err;
     int use_stdin = (name == nullptr);
     int input = -1;
+    struct stream_probe probe;
 
     if (use_stdin) {
         input = STDIN_FILENO;
@@ -417,9 +480,27 @@ static int open_input_as_ES_direct(
             return 1;
     }
 
+    // Decide what we've got before we start reading it properly, so that
+    // we don't need to "unread" what we looked at
+    init_stream_probe(&probe);
+    if (!force_stream_type && !use_stdin) {
+        err = probe_stream_file(input, 0, false, &probe);
+        if (!err
+            && (probe.container == PROBE_CONTAINER_TS || probe.container == PROBE_CONTAINER_PS))
+            fprint_err("### File %s appears to be %s, not ES\n", name,
+                probe.container == PROBE_CONTAINER_TS ? "Transport Stream" : "Program Stream");
+        if (err || probe.container != PROBE_CONTAINER_ES) {
+            fprint_err("### Error deciding on stream type for file %s\n", name);
+            clear_stream_probe(&probe);
+            (void)close_file(input);
+            return 1;
+        }
+    }
+
     err = build_elementary_stream_file(input, es);
     if (err) {
         fprint_err("### Error building elementary stream for %s\n", use_stdin ? "<stdin>" : name);
+        clear_stream_probe(&probe);
         if (!use_stdin)
             (void)close_file(input);
         return 1;
@@ -440,34 +521,7 @@ static int open_input_as_ES_direct(
                         : *is_data == VIDEO_H264 ? "MPEG-4/AVC (H.264)"
                                                  : *is_data == VIDEO_AVS ? "AVS" : "???"));
     } else {
-        int video_type;
-        err = decide_ES_video_type(*es, false, false, &video_type);
-        if (err) {
-            fprint_err("### Error deciding on stream type for file %s\n", name);
-            close_elementary_stream(es);
-            return 1;
-        }
-
-        // We want to rewind, to "unread" the bytes we read to decide our filetype.
-        // The easiest way to do that and return to our initial conditions is to
-        // recreate our ES context
-        free_elementary_stream(es);
-
-        err = seek_file(input, 0);
-        if (err) {
-            print_err("### Error returning to start position in file after"
-                      " working out video type\n");
-            (void)close_file(input);
-            return 1;
-        }
-
-        err = build_elementary_stream_file(input, es);
-        if (err) {
-            fprint_err("### Error (re)building elementary stream for %s\n", name);
-            return 1;
-        }
-
-        *is_data = video_type;
+        *is_data = probe.video_type;
         if (!quiet)
             fprint_msg("Input appears to be %s\n",
                 (*is_data == VIDEO_H262 ? "MPEG-2 (H.262)"
@@ -476,6 +530,7 @@ static int open_input_as_ES_direct(
                                 ? "AVS"
                                 : *is_data == VIDEO_UNKNOWN ? "Unknown" : "???"));
     }
+    clear_stream_probe(&probe);
     return 0;
 }
 
@@ -537,6 +592,8 @@ int open_input_as_ES(char* name, int use_pes, int quiet, int force_stream_type,
  */
 int close_input_as_ES(char* name, ES_p* es)
 {
+    // Stop any thread reading ahead before its PES reader goes away
+    (void)set_ES_pipelining(*es, false);
     if (!(*es)->reading_ES) {
         int err = close_PES_reader(&(*es)->reader);
         if (err) {
@@ -906,6 +963,89 @@ int connect_socket(char* hostname, int port, int use_tcpip, char* multicast_ifad
     return output;
 }
 
+/*
+ * Open a UDP socket to receive datagrams on.
+ *
+ * - `hostname` is the address to listen on. If it is a multicast group,
+ *   the socket binds to the group's port and joins the group, otherwise it
+ *   binds to that (local) address.
+ * - `port` is the port to use
+ * - If `multicast_ifaddr` is supplied, the group is joined on the network
+ *   interface with that IP address. It may be nullptr to use the default,
+ *   or for non-multicast cases.
+ * - If `rcvbuf_size` is greater than zero, the socket's receive buffer is
+ *   asked to be that many bytes. Live streams arrive in bursts, and the
+ *   default buffer is often too small to ride them out.
+ *
+ * A socket opened via this function must be closed with disconnect_socket().
+ *
+ * Returns a positive integer (the file descriptor for the socket) if it
+ * succeeds, or -1 if it fails, in which case it will have complained on
+ * stderr.
+ */
+int listen_socket(char* hostname, int port, char* multicast_ifaddr, int rcvbuf_size)
+{
+    int input;
+    int result;
+    int one = 1;
+    struct hostent* hp;
+    struct sockaddr_in ipaddr;
+
+    input = socket(AF_INET, SOCK_DGRAM, 0);
+    if (input == -1) {
+        fprint_err("### Unable to create socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    hp = gethostbyname(hostname);
+    if (hp == nullptr) {
+        fprint_err("### Unable to resolve host %s: %s\n", hostname, hstrerror(h_errno));
+        close(input);
+        return -1;
+    }
+    memset(&ipaddr, 0, sizeof(ipaddr));
+    memcpy(&ipaddr.sin_addr.s_addr, hp->h_addr, hp->h_length);
+    ipaddr.sin_family = hp->h_addrtype;
+    ipaddr.sin_port = htons(port);
+
+    // So that more than one of us can listen to the same group
+    (void)setsockopt(input, SOL_SOCKET, SO_REUSEADDR, (char*)&one, sizeof(one));
+
+    if (rcvbuf_size > 0) {
+        // SO_RCVBUFFORCE may exceed rmem_max, but only if we're privileged
+        result = setsockopt(input, SOL_SOCKET, SO_RCVBUFFORCE, (char*)&rcvbuf_size,
+            sizeof(rcvbuf_size));
+        if (result < 0)
+            (void)setsockopt(input, SOL_SOCKET, SO_RCVBUF, (char*)&rcvbuf_size,
+                sizeof(rcvbuf_size));
+    }
+
+    result = bind(input, (struct sockaddr*)&ipaddr, sizeof(ipaddr));
+    if (result < 0) {
+        fprint_err("### Unable to bind to %s:%d: %s\n", hostname, port, strerror(errno));
+        close(input);
+        return -1;
+    }
+
+    if (IN_CLASSD(ntohl(ipaddr.sin_addr.s_addr))) {
+        struct ip_mreq mreq;
+        mreq.imr_multiaddr = ipaddr.sin_addr;
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (multicast_ifaddr && !inet_aton(multicast_ifaddr, &mreq.imr_interface)) {
+            fprint_err("### Multicast interface address %s is not valid\n", multicast_ifaddr);
+            close(input);
+            return -1;
+        }
+        result = setsockopt(input, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char*)&mreq, sizeof(mreq));
+        if (result < 0) {
+            fprint_err("### Unable to join multicast group %s: %s\n", hostname, strerror(errno));
+            close(input);
+            return -1;
+        }
+    }
+    return input;
+}
+
 /*
  * Disconnect from a socket (close it).
  *
@@ -6,8 +6,10 @@
  */
 #include "es_defns.h"
 #include "misc_defns.h"
+#include "timestamp_defns.h"
 
 #include <cstdint>
+#include <sys/types.h>
 
 #define CRC32_POLY 0x04c11db7L
 
@@ -68,11 +70,20 @@ double log2(double x);
 // ============================================================
 // Simple file I/O utilities
 // ============================================================
+/*
+ * Read some bytes from a file.
+ *
+ * This is a jacket for `read`, which reads the decompressed data instead
+ * if the file is compressed (see `setup_compressed_input`), and the data in
+ * the ring if it is shared memory (see `open_shm_input`).
+ *
+ * Returns what `read` would.
+ */
+ssize_t read_file(int filedes, byte* data, size_t num_bytes);
 /*
  * Read a given number of bytes from a file.
  *
- * This is a jacket for `read`, allowing for the future possibility of
- * buffered input, and simplifying error handling.
+ * This is a jacket for `read_file`, simplifying error handling.
  *
  * - `input` is the file descriptor for the file
  * - `num_bytes` is how many bytes to read
@@ -126,6 +137,11 @@ offset_t tell_file(int filedes);
  *   opened with flag O_RDONLY. In both cases, on Windows the flag
  *   O_BINARY will also be set.
  *
+ * A file opened for read that is compressed with gzip or zstd is read
+ * (via `read_file`, `read_bytes`, `seek_file` and `tell_file`) as its
+ * decompressed data. A name starting "shm:" is opened for read as a
+ * shared memory ring (see `open_shm_input`).
+ *
  * Returns the file descriptor for the file, or -1 if it failed to open
  * the file.
  */
@@ -311,6 +327,27 @@ int host_value(const char* prefix, const char* cmd, const char* arg, char** host
  */
 int connect_socket(char* hostname, int port, int use_tcpip, char* multicast_ifaddr);
 
+/*
+ * Open a UDP socket to receive datagrams on.
+ *
+ * - `hostname` is the address to listen on. If it is a multicast group,
+ *   the socket binds to the group's port and joins the group, otherwise it
+ *   binds to that (local) address.
+ * - `port` is the port to use
+ * - If `multicast_ifaddr` is supplied, the group is joined on the network
+ *   interface with that IP address. It may be nullptr to use the default,
+ *   or for non-multicast cases.
+ * - If `rcvbuf_size` is greater than zero, the socket's receive buffer is
+ *   asked to be that many bytes.
+ *
+ * A socket opened via this function must be closed with disconnect_socket().
+ *
+ * Returns a positive integer (the file descriptor for the socket) if it
+ * succeeds, or -1 if it fails, in which case it will have complained on
+ * stderr.
+ */
+int listen_socket(char* hostname, int port, char* multicast_ifaddr, int rcvbuf_size);
+
 /*
  * Disconnect from a socket (close it).
  *
@@ -349,39 +386,3 @@ inline uint16_t uint_16_le(const uint8_t* const p)
 {
     return (((int)p[0] & 0xff) | ((int)p[1] & 0xff) << 8);
 }
-
-// ============================================================
-// Time diffs
-// ============================================================
-
-#define PCR_UNSIGNED_WRAP (300ULL * (1ULL << 33))
-
-// (x - y) with allowance for PCR wrap - unsigned version
-inline uint64_t pcr_unsigned_diff(uint64_t x, uint64_t y)
-{
-    return x > y ? x - y : 300ULL * (1ULL << 33) - (y - x);
-}
-
-#define PCR_SIGNED_WRAP (300LL * (1LL << 33))
-#define PCR_SIGNED_MAX (PCR_SIGNED_WRAP / 2LL - 1LL)
-#define PCR_SIGNED_MIN (-PCR_SIGNED_WRAP / 2LL)
-
-// (x - y) with allowance for PCR wrap - signed version
-inline int64_t pcr_signed_diff(uint64_t x, uint64_t y)
-{
-    int64_t r = x - y;
-
-    return r < PCR_SIGNED_MIN ? r + PCR_SIGNED_WRAP : r > PCR_SIGNED_MAX ? r - PCR_SIGNED_WRAP : r;
-}
-
-// Deal with simple overflow
-inline uint64_t pcr_unsigned_wrap(uint64_t x)
-{
-    return x >= PCR_UNSIGNED_WRAP ? x - PCR_UNSIGNED_WRAP : x;
-}
-
-inline int64_t pts_signed_diff(uint64_t x, uint64_t y)
-{
-    int64_t r = x - y;
-    return (r << 31) >> 31;
-}
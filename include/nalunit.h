@@ -175,7 +175,12 @@ int build_nal_unit(nal_unit_p* nal)
  */
 static inline void clear_nal_unit(nal_unit_p nal)
 {
-    clear_ES_unit(&(nal->unit));
+    if (nal->unit.data_size == 0) {
+        // Our data belongs to the access unit we are in, which will free it
+        nal->unit.data = nullptr;
+        nal->unit.data_len = 0;
+    } else
+        clear_ES_unit(&(nal->unit));
     nal->data = nullptr;
     nal->data_len = 0;
     if (nal->rbsp != nullptr) {
@@ -1270,7 +1275,8 @@ int setup_NAL_data(int verbose, nal_unit_p nal)
  */
 int find_next_NAL_unit(nal_unit_context_p context, int verbose, nal_unit_p* nal)
 {
-    static int need_first_seq_param_set = true;
+    // (several threads may be reading different parts of the same file)
+    static std::atomic<int> need_first_seq_param_set(true);
     int err;
 
     err = build_nal_unit(nal);
@@ -1299,10 +1305,8 @@ int find_next_NAL_unit(nal_unit_context_p context, int verbose, nal_unit_p* nal)
     // decide whether the data matches what we claim to support.
     // That also serves to bootstrap the decoding of other items
     if (nal_is_seq_param_set(*nal)) {
-        if (need_first_seq_param_set) {
+        if (need_first_seq_param_set.exchange(false))
             check_profile(*nal, context->show_nal_details);
-            need_first_seq_param_set = false;
-        }
     }
 
     // Once we know we've got the first sequence parameter set in hand
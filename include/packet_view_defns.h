@@ -0,0 +1,223 @@
+/*
+ * Typed, read only views onto the headers of TS packets, adaptation fields
+ * and PES packets.
+ *
+ * A view is just a pointer (and, where the header is of variable length, a
+ * byte count) onto data that is owned by someone else, so it is free to make
+ * and to copy. Each accessor decodes its field directly from the bytes, and
+ * nothing is checked unless it is asked for (with `is_valid` and friends),
+ * so reading a field costs no more than the equivalent hand-written bit
+ * twiddling - which is what the rest of the code used to do.
+ *
+ * Everything here is constexpr, so may be used in constant expressions.
+ *
+ */
+
+#ifndef _packet_view_defns
+#define _packet_view_defns
+
+#include <cstdint>
+
+#include "timestamp_defns.h"
+#include "ts_defns.h"
+
+// ============================================================
+// Adaptation field
+// ============================================================
+
+/*
+ * The adaptation field of a TS packet, *not* including its length byte
+ * (which is to say, the `adapt` and `adapt_len` returned by
+ * `split_TS_packet`). A `length` of 0 means there is no adaptation field,
+ * or that it is empty.
+ */
+struct adaptation_field_view {
+    const uint8_t* data;
+    int length;
+
+    constexpr int flags() const { return length > 0 ? data[0] : 0; }
+    constexpr bool discontinuity() const { return flags() & 0x80; }
+    constexpr bool random_access() const { return flags() & 0x40; }
+    constexpr bool has_PCR() const { return flags() & 0x10; }
+    constexpr bool has_OPCR() const { return flags() & 0x08; }
+
+    // The PCR, in 27MHz units. Only meaningful if `has_PCR()`
+    constexpr uint64_t PCR() const { return pcr_from_bytes(data + 1); }
+
+    // The OPCR, which follows any PCR. Only meaningful if `has_OPCR()`
+    constexpr uint64_t OPCR() const { return pcr_from_bytes(data + (has_PCR() ? 7 : 1)); }
+
+    // True if the flagged PCR and OPCR actually fit in the field
+    constexpr bool is_valid() const
+    {
+        return length == 0 || 1 + (has_PCR() ? 6 : 0) + (has_OPCR() ? 6 : 0) <= length;
+    }
+};
+
+// ============================================================
+// TS packet
+// ============================================================
+
+/*
+ * A (188 byte) TS packet
+ */
+struct TS_packet_view {
+    const uint8_t* data;
+
+    constexpr bool has_sync_byte() const { return data[0] == 0x47; }
+    constexpr bool transport_error() const { return data[1] & 0x80; }
+    constexpr int payload_unit_start() const { return (data[1] & 0x40) >> 6; }
+    constexpr uint32_t pid() const { return ((data[1] & 0x1F) << 8) | data[2]; }
+    constexpr bool is_null() const { return pid() == 0x1FFF; }
+    constexpr int adaptation_field_control() const { return (data[3] & 0x30) >> 4; }
+    constexpr int continuity_counter() const { return data[3] & 0x0F; }
+    constexpr bool has_adaptation_field() const { return data[3] & 0x20; }
+    constexpr bool has_payload() const { return data[3] & 0x10; }
+
+    // The length of the adaptation field, not counting its length byte
+    constexpr int adaptation_field_length() const
+    {
+        return has_adaptation_field() ? data[4] : 0;
+    }
+    constexpr adaptation_field_view adaptation_field() const
+    {
+        return { data + 5, adaptation_field_length() };
+    }
+
+    // Where the payload starts, and how much of it there is
+    constexpr int payload_offset() const { return has_adaptation_field() ? 5 + data[4] : 4; }
+    constexpr int payload_length() const
+    {
+        return has_payload() ? TS_PACKET_SIZE - payload_offset() : 0;
+    }
+
+    // True if the packet is in sync, has a permitted adaptation field
+    // control, and its adaptation field (and the content thereof) fits
+    constexpr bool is_valid() const
+    {
+        return has_sync_byte() && adaptation_field_control() != 0
+            && payload_offset() <= TS_PACKET_SIZE && adaptation_field().is_valid();
+    }
+};
+
+// ============================================================
+// PES packet header
+// ============================================================
+
+/*
+ * The start of a PES packet, i.e., data starting "00 00 01 <stream_id>
+ * <packet_length>".
+ *
+ * `length` is the number of bytes of the packet that are available. It
+ * bounds the search through an MPEG-1 header (which is of unknown length
+ * until it has been searched), but an H.222.0 header is taken on trust, as
+ * it says how long it is.
+ */
+struct PES_header_view {
+    const uint8_t* data;
+    int length;
+
+    constexpr bool has_start_code() const { return data[0] == 0 && data[1] == 0 && data[2] == 1; }
+    constexpr int stream_id() const { return data[3]; }
+    constexpr int packet_length() const { return (data[4] << 8) | data[5]; }
+
+    // Most streams have the "optional" header, with PTS/DTS and so on.
+    // See H.222.0 Table 2-18 for those that do not
+    constexpr bool has_optional_header() const
+    {
+        switch (stream_id()) {
+        case 0xBC: // program stream map
+        case 0xBE: // padding stream
+        case 0xBF: // private stream 2
+        case 0xF0: // ECM
+        case 0xF1: // EMM
+        case 0xF2: // DSMCC
+        case 0xF8: // H.222.1 type E
+        case 0xFF: // program stream directory
+            return false;
+        default:
+            return true;
+        }
+    }
+
+    // H.222.0 (13818-1) rather than MPEG-1 (11172-1). The same as IS_H222_PES
+    constexpr bool is_H222() const { return (data[6] & 0xC0) == 0x80; }
+
+    // For MPEG-1, the offset of the byte that says whether PTS and DTS
+    // follow - i.e., after any stuffing and the STD buffer size. This is
+    // `length` if there is no such byte.
+    constexpr int MPEG1_flags_offset() const
+    {
+        int posn = 6;
+        while (posn < length && data[posn] == 0xFF) // ignore padding bytes
+            posn++;
+        if (posn < length && (data[posn] & 0xC0) == 0x40) // ignore buffer scale/size
+            posn += 2;
+        return posn < length ? posn : length;
+    }
+
+    // 2 for a PTS alone, 3 for PTS and DTS, otherwise 0 (or, for H.222.0,
+    // the forbidden value 1)
+    constexpr int PTS_DTS_flags() const
+    {
+        if (is_H222())
+            return (data[7] & 0xC0) >> 6;
+        int posn = MPEG1_flags_offset();
+        if (posn == length)
+            return 0;
+        int marker = (data[posn] & 0xF0) >> 4;
+        return marker == 2 || marker == 3 ? marker : 0;
+    }
+
+    // The offset of the PTS, if there is one, with any DTS 5 bytes later
+    constexpr int timestamp_offset() const { return is_H222() ? 9 : MPEG1_flags_offset(); }
+
+    constexpr bool has_PTS() const { return PTS_DTS_flags() & 2; }
+    constexpr bool has_DTS() const { return PTS_DTS_flags() == 3; }
+    constexpr uint64_t PTS() const { return pts_from_bytes(data + timestamp_offset()); }
+    constexpr uint64_t DTS() const { return pts_from_bytes(data + timestamp_offset() + 5); }
+
+    // True if any PTS and DTS have the right guard and marker bits (which
+    // is what `decode_pts_dts` complains about)
+    constexpr bool timestamps_valid() const
+    {
+        int flags = PTS_DTS_flags();
+        const uint8_t* ts = data + timestamp_offset();
+        if (flags & 2) {
+            if ((ts[0] >> 4) != flags || !(ts[0] & ts[2] & ts[4] & 1))
+                return false;
+        }
+        if (flags == 3) {
+            if ((ts[5] >> 4) != 1 || !(ts[5] & ts[7] & ts[9] & 1))
+                return false;
+        }
+        return true;
+    }
+
+    // The offset of the ES data in the packet
+    constexpr int ES_data_offset() const
+    {
+        if (is_H222())
+            return 9 + data[8]; // the fixed header, plus PES_header_data_length bytes
+        int posn = MPEG1_flags_offset();
+        if (posn == length)
+            return posn;
+        switch ((data[posn] & 0xF0) >> 4) {
+        case 2:
+            return posn + 5; // PTS
+        case 3:
+            return posn + 10; // PTS and DTS
+        default:
+            return posn + 1; // 0x0F, or something we can't interpret
+        }
+    }
+};
+
+#endif // _packet_view_defns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
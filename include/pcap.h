@@ -134,6 +134,14 @@ typedef struct _pcap_io_ctx* PCAP_reader_p;
  */
 int pcap_open(PCAP_reader_p* ctx_p, pcap_hdr_t* out_hdr, const char* filename);
 
+/*! As pcap_open(), but read from a file that is already open - for
+ *  instance, one opened with fopen_compressed(). The file is closed by
+ *  pcap_close(), or here if we fail.
+ *
+ * \return 0 on success, non-zero on failure (as pcap_open(), but never -1).
+ */
+int pcap_open_file(PCAP_reader_p* ctx_p, pcap_hdr_t* out_hdr, FILE* file);
+
 /*! Read the next packet from a pcap file. The returned data is
  *  malloc()d and must be free()d. If we fail, returned data will
  *  be nullptr.
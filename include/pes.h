@@ -33,13 +33,16 @@
 #include <cstdlib>
 #include <cstring>
 
+#include "blockcache_fns.h"
 #include "compat.h"
 #include "es_fns.h"
 #include "h262_fns.h"
 #include "misc_fns.h"
+#include "packet_view_defns.h"
 #include "pes_fns.h"
 #include "pidint_fns.h"
 #include "printing_fns.h"
+#include "probe_fns.h"
 #include "ps_fns.h"
 #include "ts_fns.h"
 #include "tswrite_fns.h"
@@ -135,10 +138,12 @@ static inline int extend_PES_packet_data(PES_packet_data_p data, byte bytes[], i
 }
 
 /*
- * Build a dummy PES packet datastructure.
+ * Build a dummy PES packet datastructure, or update an existing one.
  *
- * - `data` is the "new" dummy PES packet. Do not free this,
- *   as it is remembered statically inside the function.
+ * - `data` is the dummy PES packet. If it is nullptr, a new one is
+ *   built, and otherwise it is reused (and extended if necessary).
+ *   Either way, it should be freed (with `free_PES_packet_data`) when it
+ *   is finished with.
  * - `data_len` is the required (total) size of the dummy PES packet
  *
  * Returns 0 if all goes well, 1 if something goes wrong
@@ -146,7 +151,7 @@ static inline int extend_PES_packet_data(PES_packet_data_p data, byte bytes[], i
 static inline int build_dummy_PES_packet_data(PES_packet_data_p* data, int data_len)
 {
     int err;
-    static PES_packet_data_p local_data = nullptr;
+    PES_packet_data_p local_data = *data;
     if (local_data == nullptr) {
         err = build_PES_packet_data(&local_data);
         if (err) {
@@ -154,6 +159,7 @@ static inline int build_dummy_PES_packet_data(PES_packet_data_p* data, int data_
             return 1;
         }
         local_data->is_video = false;
+        *data = local_data;
     }
     if (local_data->data == nullptr) {
         local_data->data = (byte*)malloc(data_len);
@@ -187,7 +193,6 @@ static inline int build_dummy_PES_packet_data(PES_packet_data_p* data, int data_
         }
         local_data->data_len = data_len;
     }
-    *data = local_data;
     return 0;
 }
 
@@ -818,7 +823,7 @@ static int find_first_PAT(PES_reader_p reader)
 
     if (prog_list->length == 0) {
         fprint_err("### No programs defined in first PAT (at " OFFSET_T_FORMAT ")\n",
-            reader->tsreader->posn - TS_PACKET_SIZE);
+            reader->tsreader->posn - reader->tsreader->packet_size);
         free_pidint_list(&prog_list);
         return 1;
     } else if (prog_list->length > 1 && reader->give_info)
@@ -839,7 +844,7 @@ static int find_first_PAT(PES_reader_p reader)
         }
         if (!got_program) {
             fprint_err("### Program %d not found in first PAT at " OFFSET_T_FORMAT "\n",
-                reader->program_number, reader->tsreader->posn - TS_PACKET_SIZE);
+                reader->program_number, reader->tsreader->posn - reader->tsreader->packet_size);
             return 1;
         }
     }
@@ -1274,8 +1279,12 @@ static int read_next_PES_packet_from_TS(PES_reader_p reader, PES_packet_data_p*
 #endif
 
         // If we're writing out TS packets directly to a client, then this
-        // is probably a sensible place to do it.
-        if (reader->write_TS_packets && reader->tswriter != nullptr && !reader->suppress_writing) {
+        // is probably a sensible place to do it (unless it has already been
+        // sent this packet some other way).
+        if (reader->posn >= reader->resume_writing_at)
+            reader->resume_writing_at = 0;
+        if (reader->write_TS_packets && reader->tswriter != nullptr && !reader->suppress_writing
+            && reader->resume_writing_at == 0) {
             err = tswrite_write(reader->tswriter, ts_packet, pid, false, 0);
             if (err) {
                 fprint_err("### Error writing TS packet (PID %04x) at " OFFSET_T_FORMAT "\n", pid,
@@ -1405,7 +1414,9 @@ static int read_next_PES_packet_from_TS(PES_reader_p reader, PES_packet_data_p*
  *
  * The file is assumed to be Transport Stream if it starts with 0x47 as
  * the first byte, and 0x47 recurs at 188 byte intervals (in other words,
- * it appears to start with several TS packets).
+ * it appears to start with several TS packets). TS packets stored 192
+ * bytes apart (M2TS, with the 0x47 four bytes in) or 204 bytes apart
+ * (with Reed-Solomon parity) are also recognised.
  *
  * - `input` is the file to check
  * - `is_TS` is true if it looks like TS, as described above.
@@ -1415,24 +1426,27 @@ static int read_next_PES_packet_from_TS(PES_reader_p reader, PES_packet_data_p*
 int determine_if_TS_file(int input, int* is_TS)
 {
     int err;
-    int ii;
-    byte buf[TS_PACKET_SIZE];
-
-    *is_TS = true;
-
-    for (ii = 0; ii < 100; ii++) {
-        err = read_bytes(input, TS_PACKET_SIZE, buf);
-        if (err == EOF)
+    ssize_t total = 0;
+    ssize_t length;
+    int packet_size, packet_offset;
+    byte buf[TS_STRIDE_CHECK_COUNT * MAX_TS_PACKET_STRIDE];
+
+    while (total < (ssize_t)sizeof(buf)) {
+        length = read_file(input, &buf[total], sizeof(buf) - total);
+        if (length == 0)
             break;
-        else if (err) {
-            print_err("### Error trying to check if file is TS\n");
+        else if (length == -1) {
+            fprint_err("### Error trying to check if file is TS: %s\n", strerror(errno));
             return 1;
         }
-        if (buf[0] != 0x47) {
-            *is_TS = false;
-            break;
-        }
+        total += length;
     }
+
+    if (total == 0)
+        *is_TS = true; // for want of anything better
+    else
+        *is_TS = determine_TS_packet_size(buf, (int)total, &packet_size, &packet_offset);
+
     err = seek_file(input, 0);
     if (err) {
         print_err("### Error rewinding file after determining if it is TS\n");
@@ -1541,9 +1555,11 @@ static int build_PES_reader_datastructure(int give_info, int give_warnings, PES_
     new2->tswriter = nullptr;
     new2->write_PES_packets = false;
     new2->write_TS_packets = false;
+    new2->resume_writing_at = 0;
     new2->suppress_writing = true;
     new2->dont_write_current_packet = false;
     new2->pes_padding = 0;
+    new2->dummy_packet = nullptr;
 
     new2->debug_read_packets = false;
 
@@ -1685,6 +1701,110 @@ int build_PES_reader(int input, int is_TS, int give_info, int give_warnings,
     return 0;
 }
 
+/*
+ * Build a PES reader datastructure, using what a probe has already
+ * decided about the file.
+ *
+ * This is equivalent to `build_PES_reader`, except that the file is not
+ * looked at again to find its TS packet size, its program information
+ * (if the probe found the PMT for the program wanted) or, for PS, its
+ * video type (if the probe decided it).
+ *
+ * - `input` is the file to read the PES data from
+ * - `probe` is the result of calling `probe_stream_file` on it, and must
+ *   have decided the data is TS or PS.
+ * - `give_info` is true if information about program data, etc., should be
+ *   output (to stdout).
+ * - `give_warnings` is true if warnings (starting with "!!!") should be
+ *   output (to stderr), false if they should be suppressed.
+ * - `program_number` is only used for TS data, and identifies which program
+ *   to read. If this is 0 then the first program encountered in the first PAT
+ *   will be read.
+ * - `reader` is the resulting PES reader
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int build_PES_reader_from_probe(int input, stream_probe_p probe, int give_info,
+    int give_warnings, uint16_t program_number, PES_reader_p* reader)
+{
+    int err;
+
+    if (probe->container == PROBE_CONTAINER_TS) {
+        TS_reader_p tsreader;
+        err = build_TS_reader(input, &tsreader);
+        if (err) {
+            print_err("### Error building TS specific reader\n");
+            return 1;
+        }
+        (void)set_TS_reader_packet_size(tsreader, probe->packet_size);
+
+        if (probe->pmt_data == nullptr
+            || (program_number != 0 && program_number != probe->program_number)) {
+            // The probe didn't find what we want, so look for ourselves
+            err = build_TS_PES_reader(tsreader, give_info, give_warnings, program_number, reader);
+            if (err) {
+                print_err("### Error building TS specific reader\n");
+                free_TS_reader(&tsreader);
+                return 1;
+            }
+            return 0;
+        }
+
+        err = build_PES_reader_datastructure(give_info, give_warnings, reader);
+        if (err) {
+            free_TS_reader(&tsreader);
+            return 1;
+        }
+        (*reader)->is_TS = true;
+        (*reader)->tsreader = tsreader;
+        (*reader)->program_number = probe->program_number;
+        (*reader)->output_program_number = program_number;
+        (*reader)->pmt_pid = probe->pmt_pid;
+        if (give_info)
+            fprint_msg("Found PAT and PMT with PID %04x (%d) in first %u bytes\n",
+                probe->pmt_pid, probe->pmt_pid, probe->bytes_probed);
+        if (probe->num_programs > 1 && give_info)
+            print_msg("Multiple programs in PAT - using the first\n\n");
+
+        err = extract_and_refine_TS_program_info(
+            *reader, probe->pmt_pid, probe->pmt_data, probe->pmt_data_len);
+        if (err || !(*reader)->got_program_data) {
+            print_err("### Error determining TS program information from probe\n");
+            (void)free_PES_reader(reader);
+            return 1;
+        }
+    } else if (probe->container == PROBE_CONTAINER_PS) {
+        PS_reader_p ps;
+        err = build_PS_reader(input, !give_info, &ps);
+        if (err) {
+            print_err("### Error building PS specific reader\n");
+            return 1;
+        }
+        if (probe->video_type == VIDEO_UNKNOWN) {
+            err = build_PS_PES_reader(ps, give_info, give_warnings, reader);
+            if (err) {
+                print_err("### Error building PS specific reader\n");
+                free_PS_reader(&ps);
+                return 1;
+            }
+            return 0;
+        }
+        err = build_PES_reader_datastructure(give_info, give_warnings, reader);
+        if (err) {
+            free_PS_reader(&ps);
+            return 1;
+        }
+        (*reader)->is_TS = false;
+        (*reader)->psreader = ps;
+        (*reader)->video_type = probe->video_type;
+        (*reader)->is_h264 = (probe->video_type == VIDEO_H264);
+    } else {
+        print_err("### Cannot build a PES reader for data that is not TS or PS\n");
+        return 1;
+    }
+    return 0;
+}
+
 /*
  * Open a Transport Stream file for PES packet reading
  *
@@ -1788,22 +1908,28 @@ int open_PES_reader(char* filename, int give_info, int give_warnings, PES_reader
 {
     int err;
     int input;
-    int is_TS;
+    struct stream_probe probe;
 
     input = open_binary_file(filename, false);
     if (input == -1) {
         fprint_err("### Unable to open input file %s\n", filename);
         return 1;
     }
-    err = determine_if_TS_file(input, &is_TS);
+    init_stream_probe(&probe);
+    err = probe_stream_file(input, 0, false, &probe);
     if (err) {
         (void)close_file(input);
         return 1;
     }
-    if (is_TS)
-        return build_PES_reader(input, true, give_info, give_warnings, 0, reader);
-    else
-        return build_PES_reader(input, false, give_info, give_warnings, 0, reader);
+    // Anything that isn't recognised is assumed to be PS, as it always was
+    // (but if the probe knows it is PS, it may also know its video type)
+    if (probe.container != PROBE_CONTAINER_TS && probe.container != PROBE_CONTAINER_PS) {
+        clear_stream_probe(&probe);
+        probe.container = PROBE_CONTAINER_PS;
+    }
+    err = build_PES_reader_from_probe(input, &probe, give_info, give_warnings, 0, reader);
+    clear_stream_probe(&probe);
+    return err;
 }
 
 /*
@@ -1999,6 +2125,21 @@ int set_PES_reader_position(PES_reader_p reader, offset_t posn)
     return 0;
 }
 
+/*
+ * Report how many of the seeks made through a PES reader were satisfied
+ * from data its TS or PS reader already had in memory.
+ *
+ * - if `is_msg` then print as a message, otherwise as an error
+ * - `reader` is the PES reader context
+ */
+void report_PES_reader_seeks(int is_msg, PES_reader_p reader)
+{
+    if (reader->is_TS)
+        report_block_cache(is_msg, "TS reader", reader->tsreader->blocks);
+    else
+        report_block_cache(is_msg, "PS reader", reader->psreader->blocks);
+}
+
 /*
  * Free a PES reader, and the relevant datastructures. Does not close
  * the underlying file.
@@ -2016,6 +2157,8 @@ int free_PES_reader(PES_reader_p* reader)
         return 0;
     if ((*reader)->packet != nullptr)
         free_PES_packet_data(&(*reader)->packet);
+    if ((*reader)->dummy_packet != nullptr)
+        free_PES_packet_data(&(*reader)->dummy_packet);
 
     // Forget any file
     (*reader)->tsreader = nullptr;
@@ -2135,9 +2278,10 @@ int read_next_PES_packet(PES_reader_p reader)
                 // Add some "dummy" PES packets to bulk out our output
                 int ii;
                 PES_packet_data_p dummy;
-                err = build_dummy_PES_packet_data(&dummy, reader->packet->data_len);
+                err = build_dummy_PES_packet_data(&reader->dummy_packet, reader->packet->data_len);
                 if (err)
                     return 1;
+                dummy = reader->dummy_packet;
                 for (ii = 0; ii < reader->pes_padding; ii++) {
                     err = write_PES_as_TS_PES_packet(reader->tswriter, dummy->data,
                         dummy->data_len, pid, STREAM_ID_PADDING_STREAM, false, 0, 0);
@@ -2189,29 +2333,14 @@ int read_next_PES_packet(PES_reader_p reader)
  */
 int calc_mpeg1_pes_offset(byte* data, int data_len)
 {
-    int posn = 6;
-
-    while (posn < data_len && data[posn] == 0xFF) // ignore padding bytes
-        posn++; // (should be <= 16, but...)
-
-    if (posn < data_len) {
-        if ((data[posn] & 0xC0) == 0x40) // ignore buffer scale/size
-            posn += 2;
-
-        if ((data[posn] & 0xF0) == 0x20) // ignore PTS
-            posn += 5;
-        else if ((data[posn] & 0xF0) == 0x30) // ignore PTS and DTS
-            posn += 10;
-        else if (data[posn] == 0x0F) // check for paranoia
-            posn++;
-        else {
-            fprint_err("### MPEG-1 PES packet has 0x%1xX"
-                       " instead of 0x40, 0x2X, 0x3X or 0x0F\n",
-                (data[posn] & 0xF0) >> 4);
-            posn++; // what else can we do?
-        }
-    }
-    return posn;
+    const PES_header_view header = { data, data_len };
+    int posn = header.MPEG1_flags_offset();
+
+    if (posn < data_len && header.PTS_DTS_flags() == 0 && data[posn] != 0x0F)
+        fprint_err("### MPEG-1 PES packet has 0x%1xX"
+                   " instead of 0x40, 0x2X, 0x3X or 0x0F\n",
+            (data[posn] & 0xF0) >> 4);
+    return header.ES_data_offset();
 }
 /*
  * Set up ES data access for this PES packet - i.e., set up the `es_data`
@@ -2273,8 +2402,7 @@ static inline void setup_PES_as_ES(PES_packet_data_p packet)
         //   * 1 byte  of PES_header_data_length  -- i.e., 9 bytes thus far
         //   * PES_header_data_length bytes of PES header data
         // before we get to our ES data
-        int PES_header_data_length = packet->data[8];
-        offset = 9 + PES_header_data_length;
+        offset = PES_header_view { packet->data, packet->data_len }.ES_data_offset();
         // The data alignment indicator seems like a sensible thing to remember
         packet->data_alignment_indicator = (packet->data[6] & 0x04) >> 2;
     } else {
@@ -2422,9 +2550,7 @@ void encode_pts_dts(byte data[], int guard_bits, uint64_t value)
 
     if (value > MAX_PTS_VALUE) {
         char* what;
-        uint64_t temp = value;
-        while (temp > MAX_PTS_VALUE)
-            temp -= MAX_PTS_VALUE;
+        uint64_t temp = pts_wrap(value);
         switch (guard_bits) {
         case 2:
             what = "PTS alone";
@@ -2946,75 +3072,30 @@ void report_PES_data_array2(int stream_type, byte* payload, int payload_len, int
  */
 int find_PTS_in_PES(byte data[], int32_t data_len, int* got_pts, uint64_t* pts)
 {
-    byte stream_id;
-    int packet_length;
-    byte* bytes;
-
+    // An MPEG-1 header is searched no further than the packet says it is long
+    const PES_header_view header = { data, ((data[4] << 8) | data[5]) + 6 };
     int PTS_DTS_flags;
+    int err;
 
     *got_pts = false; // pessimistic
 
-    if (data[0] != 0 || data[1] != 0 || data[2] != 1) {
+    if (!header.has_start_code()) {
         fprint_err("### find_PTS_in_PES:"
                    " PES packet start code prefix is %02x %02x %02x, not 00 00 01\n",
             data[0], data[1], data[2]);
         return 1;
     }
 
-    stream_id = data[3];
-    packet_length = (data[4] << 8) | data[5];
-
-    // if (packet_length == 0)  // Elementary video data of unspecified length
-    //   return 0;
-
-    switch (stream_id) {
-    case STREAM_ID_PROGRAM_STREAM_MAP:
-    case STREAM_ID_PRIVATE_STREAM_2:
-    case STREAM_ID_ECM_STREAM:
-    case STREAM_ID_EMM_STREAM:
-    case STREAM_ID_PROGRAM_STREAM_DIRECTORY:
-    case STREAM_ID_DSMCC_STREAM:
-    case STREAM_ID_H222_E_STREAM:
-        return 0; // Just data bytes
-    case STREAM_ID_PADDING_STREAM:
-        return 0; // Just padding bytes
-    default:
-        break; // Some sort of data we might be interested in dissecting
-    }
-
-    bytes = data + 6;
-    if (IS_H222_PES(data)) {
-        // Yes, it's H.222.0
-        PTS_DTS_flags = (bytes[1] & 0xC0) >> 6;
+    // Some streams are just data (or padding) bytes, without PTS/DTS
+    if (!header.has_optional_header())
+        return 0;
 
-        if (PTS_DTS_flags == 2 || PTS_DTS_flags == 3) {
-            int err = decode_pts_dts(&bytes[3], PTS_DTS_flags, pts);
-            if (err)
-                return 1;
-            *got_pts = true;
-        }
-    } else {
-        int posn = 0;
-        int marker;
-        // We assume it's MPEG-1
-        // Ignore any up-front padding bytes
-        while (posn < packet_length && bytes[posn] == 0xFF)
-            posn++;
-        if (posn < packet_length) {
-            if ((bytes[posn] & 0xC0) == 0x40) // ignore buffer scale/size
-                posn += 2;
-            if (posn == packet_length)
-                return 0; // no space for PTS/DTS
-            marker = (bytes[posn] & 0xF0) >> 4;
-            if (marker == 2 || // PTS
-                marker == 3) // PTS and DTS
-            {
-                int err = decode_pts_dts(&bytes[posn], marker, pts);
-                if (err)
-                    return 1;
-                *got_pts = true;
-            }
-        }
+    PTS_DTS_flags = header.PTS_DTS_flags();
+    if (PTS_DTS_flags == 2 || PTS_DTS_flags == 3) {
+        err = decode_pts_dts(data + header.timestamp_offset(), PTS_DTS_flags, pts);
+        if (err)
+            return 1;
+        *got_pts = true;
     }
     return 0;
 }
@@ -3031,74 +3112,30 @@ int find_PTS_in_PES(byte data[], int32_t data_len, int* got_pts, uint64_t* pts)
  */
 int find_DTS_in_PES(byte data[], int32_t data_len, int* got_dts, uint64_t* dts)
 {
-    byte stream_id;
-    int packet_length;
-    byte* bytes;
-
+    // An MPEG-1 header is searched no further than the packet says it is long
+    const PES_header_view header = { data, ((data[4] << 8) | data[5]) + 6 };
     int PTS_DTS_flags;
+    int err;
 
     *got_dts = false; // pessimistic
 
-    if (data[0] != 0 || data[1] != 0 || data[2] != 1) {
+    if (!header.has_start_code()) {
         fprint_err("### find_DTS_in_PES:"
                    " PES packet start code prefix is %02x %02x %02x, not 00 00 01\n",
             data[0], data[1], data[2]);
         return 1;
     }
 
-    stream_id = data[3];
-    packet_length = (data[4] << 8) | data[5];
-
-    // if (packet_length == 0)  // Elementary video data of unspecified length
-    //   return 0;
-
-    switch (stream_id) {
-    case STREAM_ID_PROGRAM_STREAM_MAP:
-    case STREAM_ID_PRIVATE_STREAM_2:
-    case STREAM_ID_ECM_STREAM:
-    case STREAM_ID_EMM_STREAM:
-    case STREAM_ID_PROGRAM_STREAM_DIRECTORY:
-    case STREAM_ID_DSMCC_STREAM:
-    case STREAM_ID_H222_E_STREAM:
-        return 0; // Just data bytes
-    case STREAM_ID_PADDING_STREAM:
-        return 0; // Just padding bytes
-    default:
-        break; // Some sort of data we might be interested in dissecting
-    }
-
-    bytes = data + 6;
-    if (IS_H222_PES(data)) {
-        // Yes, it's H.222.0
-        PTS_DTS_flags = (bytes[1] & 0xC0) >> 6;
-
-        if (PTS_DTS_flags == 3) {
-            // err = decode_pts_dts(&bytes[3],3,&pts);
-            int err = decode_pts_dts(&bytes[8], 1, dts);
-            if (err)
-                return 1;
-            *got_dts = true;
-        }
-    } else {
-        int posn = 0;
-        // We assume it's MPEG-1
-        // Ignore any up-front padding bytes
-        while (posn < packet_length && bytes[posn] == 0xFF)
-            posn++;
-        if (posn < packet_length) {
-            if ((bytes[posn] & 0xC0) == 0x40) // ignore buffer scale/size
-                posn += 2;
-            if (posn == packet_length)
-                return 0; // no space for PTS/DTS
+    // Some streams are just data (or padding) bytes, without PTS/DTS
+    if (!header.has_optional_header())
+        return 0;
 
-            if ((bytes[posn] & 0xF0) == 0x30) // PTS and DTS
-            {
-                int err = decode_pts_dts(&bytes[posn + 5], 1, dts);
-                if (err)
-                    return 1;
-                *got_dts = true;
-            }
-        }
+    PTS_DTS_flags = header.PTS_DTS_flags();
+    if (PTS_DTS_flags == 3) {
+        err = decode_pts_dts(data + header.timestamp_offset() + 5, 1, dts);
+        if (err)
+            return 1;
+        *got_dts = true;
     }
     return 0;
 }
@@ -3118,90 +3155,37 @@ int find_DTS_in_PES(byte data[], int32_t data_len, int* got_dts, uint64_t* dts)
 int find_PTS_DTS_in_PES(
     byte data[], int32_t data_len, int* got_pts, uint64_t* pts, int* got_dts, uint64_t* dts)
 {
-    byte stream_id;
-    int packet_length;
-    byte* bytes;
-
+    // An MPEG-1 header is searched no further than the packet says it is long
+    const PES_header_view header = { data, ((data[4] << 8) | data[5]) + 6 };
     int PTS_DTS_flags;
+    int err;
 
     *got_pts = false; // pessimistic
     *got_dts = false;
 
-    if (data[0] != 0 || data[1] != 0 || data[2] != 1) {
-        fprint_err("### find_PTS_DTS_in_PES"
-                   ": PES packet start code prefix is %02x %02x %02x, not 00 00 01\n",
+    if (!header.has_start_code()) {
+        fprint_err("### find_PTS_DTS_in_PES:"
+                   " PES packet start code prefix is %02x %02x %02x, not 00 00 01\n",
             data[0], data[1], data[2]);
         return 1;
     }
 
-    stream_id = data[3];
-    packet_length = (data[4] << 8) | data[5];
-
-    // if (packet_length == 0)  // Elementary video data of unspecified length
-    //   return 0;
+    // Some streams are just data (or padding) bytes, without PTS/DTS
+    if (!header.has_optional_header())
+        return 0;
 
-    switch (stream_id) {
-    case STREAM_ID_PROGRAM_STREAM_MAP:
-    case STREAM_ID_PRIVATE_STREAM_2:
-    case STREAM_ID_ECM_STREAM:
-    case STREAM_ID_EMM_STREAM:
-    case STREAM_ID_PROGRAM_STREAM_DIRECTORY:
-    case STREAM_ID_DSMCC_STREAM:
-    case STREAM_ID_H222_E_STREAM:
-        return 0; // Just data bytes
-    case STREAM_ID_PADDING_STREAM:
-        return 0; // Just padding bytes
-    default:
-        break; // Some sort of data we might be interested in dissecting
+    PTS_DTS_flags = header.PTS_DTS_flags();
+    if (PTS_DTS_flags == 2 || PTS_DTS_flags == 3) {
+        err = decode_pts_dts(data + header.timestamp_offset(), PTS_DTS_flags, pts);
+        if (err)
+            return 1;
+        *got_pts = true;
     }
-
-    bytes = data + 6;
-    if (IS_H222_PES(data)) {
-        // Yes, it's H.222.0
-        PTS_DTS_flags = (bytes[1] & 0xC0) >> 6;
-
-        if (PTS_DTS_flags == 2 || PTS_DTS_flags == 3) {
-            int err = decode_pts_dts(&bytes[3], PTS_DTS_flags, pts);
-            if (err)
-                return 1;
-            *got_pts = true;
-        }
-        if (PTS_DTS_flags == 3) {
-            // err = decode_pts_dts(&bytes[3],3,&pts);
-            int err = decode_pts_dts(&bytes[8], 1, dts);
-            if (err)
-                return 1;
-            *got_dts = true;
-        }
-    } else {
-        int posn = 0;
-        int marker;
-        // We assume it's MPEG-1
-        // Ignore any up-front padding bytes
-        while (posn < packet_length && bytes[posn] == 0xFF)
-            posn++;
-        if (posn < packet_length) {
-            if ((bytes[posn] & 0xC0) == 0x40) // ignore buffer scale/size
-                posn += 2;
-            if (posn == packet_length)
-                return 0; // no space for PTS/DTS
-            marker = (bytes[posn] & 0xF0) >> 4;
-            if (marker == 2 || // PTS
-                marker == 3) // PTS and DTS
-            {
-                int err = decode_pts_dts(&bytes[posn], marker, pts);
-                if (err)
-                    return 1;
-                *got_pts = true;
-            }
-            if (marker == 3) // PTS and DTS
-            {
-                int err = decode_pts_dts(&bytes[posn + 5], 1, dts);
-                if (err)
-                    return 1;
-                *got_dts = true;
-            }
-        }
+    if (PTS_DTS_flags == 3) {
+        err = decode_pts_dts(data + header.timestamp_offset() + 5, 1, dts);
+        if (err)
+            return 1;
+        *got_dts = true;
     }
 
     // If we have no DTS then it is the same as PTS
@@ -3350,6 +3334,20 @@ void stop_server_output(PES_reader_p reader)
     return;
 }
 
+/*
+ * When TS packets are being written out to a TS writer, don't write those
+ * before `posn` in the file, because they have already been sent some other
+ * way. Packets from `posn` onwards are written as normal.
+ *
+ * If `reader` is nullptr, nothing is done.
+ */
+void resume_server_output_at(PES_reader_p reader, offset_t posn)
+{
+    if (reader != nullptr)
+        reader->resume_writing_at = posn;
+    return;
+}
+
 /*
  * When outputting PES packets in "normal play" mode, add ``extra`` PES
  * packets (of the same size as each real packet) to the output. This
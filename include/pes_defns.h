@@ -196,6 +196,7 @@ struct PES_reader {
     // same size as the real one) will be output for each real PES packet (but
     // with an irrelevant stream id).
     int pes_padding;
+    PES_packet_data_p dummy_packet; // the "dummy" PES packet, once built
 
     // If the original data is TS, and we want to send *all* of said data
     // to the server, it is sensible to write the *TS packets* as a side
@@ -207,6 +208,10 @@ struct PES_reader {
     // In either case, sometimes it is useful to suppress writing packets
     // out for a while
     int suppress_writing;
+    // And when writing TS packets, those before this position in the file
+    // have already been sent some other way, so are not written (this is
+    // reset to 0 once it is reached)
+    offset_t resume_writing_at;
 
     // Debugging: if this is set, and the appropriate code is compiled into
     // pes.c (see DEBUG_READ_PACKETS), then report on each PES packet read
@@ -31,6 +31,7 @@
 
 #include "es_defns.h"
 #include "pes_defns.h"
+#include "probe_defns.h"
 
 /*
  * Free a PES packet datastructure
@@ -45,7 +46,9 @@ void free_PES_packet_data(PES_packet_data_p* data);
  *
  * The file is assumed to be Transport Stream if it starts with 0x47 as
  * the first byte, and 0x47 recurs at 188 byte intervals (in other words,
- * it appears to start with several TS packets).
+ * it appears to start with several TS packets). TS packets stored 192
+ * bytes apart (M2TS, with the 0x47 four bytes in) or 204 bytes apart
+ * (with Reed-Solomon parity) are also recognised.
  *
  * - `input` is the file to check
  * - `is_TS` is true if it looks like TS, as described above.
@@ -101,6 +104,31 @@ int build_TS_PES_reader(TS_reader_p tsreader, int give_info, int give_warnings,
  */
 int build_PES_reader(int input, int is_TS, int give_info, int give_warnings,
     uint16_t program_number, PES_reader_p* reader);
+/*
+ * Build a PES reader datastructure, using what a probe has already
+ * decided about the file.
+ *
+ * This is equivalent to `build_PES_reader`, except that the file is not
+ * looked at again to find its TS packet size, its program information
+ * (if the probe found the PMT for the program wanted) or, for PS, its
+ * video type (if the probe decided it).
+ *
+ * - `input` is the file to read the PES data from
+ * - `probe` is the result of calling `probe_stream_file` on it, and must
+ *   have decided the data is TS or PS.
+ * - `give_info` is true if information about program data, etc., should be
+ *   output (to stdout).
+ * - `give_warnings` is true if warnings (starting with "!!!") should be
+ *   output (to stderr), false if they should be suppressed.
+ * - `program_number` is only used for TS data, and identifies which program
+ *   to read. If this is 0 then the first program encountered in the first PAT
+ *   will be read.
+ * - `reader` is the resulting PES reader
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int build_PES_reader_from_probe(int input, stream_probe_p probe, int give_info,
+    int give_warnings, uint16_t program_number, PES_reader_p* reader);
 /*
  * Open a Transport Stream file for PES packet reading
  *
@@ -259,6 +287,14 @@ void set_PES_reader_dolby_stream_type(PES_reader_p reader, int is_dvb);
  * Returns 0 if all goes well, 1 if something goes wrong.
  */
 int set_PES_reader_position(PES_reader_p reader, offset_t posn);
+/*
+ * Report how many of the seeks made through a PES reader were satisfied
+ * from data its TS or PS reader already had in memory.
+ *
+ * - if `is_msg` then print as a message, otherwise as an error
+ * - `reader` is the PES reader context
+ */
+void report_PES_reader_seeks(int is_msg, PES_reader_p reader);
 /*
  * Free a PES reader, and the relevant datastructures. Does not close
  * the underlying file.
@@ -460,6 +496,14 @@ void start_server_output(PES_reader_p reader);
  * If `reader` is nullptr, nothing is done.
  */
 void stop_server_output(PES_reader_p reader);
+/*
+ * When TS packets are being written out to a TS writer, don't write those
+ * before `posn` in the file, because they have already been sent some other
+ * way. Packets from `posn` onwards are written as normal.
+ *
+ * If `reader` is nullptr, nothing is done.
+ */
+void resume_server_output_at(PES_reader_p reader, offset_t posn);
 /*
  * When outputting PES packets in "normal play" mode, add ``extra`` PES
  * packets (of the same size as each real packet) to the output. This
@@ -29,8 +29,13 @@
  * ***** END LICENSE BLOCK *****
  */
 
+#include <atomic>
 #include <cstdarg>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
 
 #include "compat.h"
 #include "printing_fns.h"
@@ -96,6 +101,57 @@ static void report_fns(const char* why)
 }
 #endif
 
+// ============================================================
+// Support for capturing the output of a single thread
+// ============================================================
+
+// If set, everything printed by this thread goes here instead
+static thread_local struct print_capture* thread_capture = nullptr;
+
+/*
+ * Make sure there is room for `size` more characters (and a '\0') in
+ * the captured text for the given stream.
+ *
+ * Returns 0 if all goes well, 1 if we run out of memory.
+ */
+static int capture_reserve(struct print_capture* capture, int which, size_t size)
+{
+    size_t wanted = capture->length[which] + size + 1;
+    if (wanted <= capture->size[which])
+        return 0;
+    size_t new_size = capture->size[which] == 0 ? 1024 : capture->size[which];
+    while (new_size < wanted)
+        new_size *= 2;
+    char* new_text = (char*)realloc(capture->text[which], new_size);
+    if (new_text == nullptr)
+        return 1;
+    capture->text[which] = new_text;
+    capture->size[which] = new_size;
+    return 0;
+}
+
+static void capture_print(int is_err, const char* message)
+{
+    size_t length = strlen(message);
+    if (capture_reserve(thread_capture, is_err, length))
+        return;
+    memcpy(thread_capture->text[is_err] + thread_capture->length[is_err], message, length + 1);
+    thread_capture->length[is_err] += length;
+}
+
+static void capture_fprint(int is_err, const char* format, va_list arg_ptr)
+{
+    va_list arg_copy;
+    va_copy(arg_copy, arg_ptr);
+    int length = vsnprintf(nullptr, 0, format, arg_copy);
+    va_end(arg_copy);
+    if (length < 0 || capture_reserve(thread_capture, is_err, (size_t)length))
+        return;
+    (void)vsnprintf(thread_capture->text[is_err] + thread_capture->length[is_err],
+        (size_t)length + 1, format, arg_ptr);
+    thread_capture->length[is_err] += length;
+}
+
 // ============================================================
 // Functions for printing
 // ============================================================
@@ -108,7 +164,10 @@ void print_msg(const char* text)
     printf("m:%p %s", fns.print_message_fn, text);
     report_fns("m");
 #endif
-    fns.print_message_fn(text);
+    if (thread_capture != nullptr)
+        capture_print(false, text);
+    else
+        fns.print_message_fn(text);
 }
 
 /*
@@ -120,7 +179,10 @@ void print_err(const char* text)
     printf("e:%p %s", fns.print_error_fn, text);
     report_fns("e");
 #endif
-    fns.print_error_fn(text);
+    if (thread_capture != nullptr)
+        capture_print(true, text);
+    else
+        fns.print_error_fn(text);
 }
 
 /*
@@ -134,7 +196,10 @@ void fprint_msg(const char* format, ...)
     printf("fm:%p %s", fns.fprint_message_fn, format);
     report_fns("fm");
 #endif
-    fns.fprint_message_fn(format, va_arg);
+    if (thread_capture != nullptr)
+        capture_fprint(false, format, va_arg);
+    else
+        fns.fprint_message_fn(format, va_arg);
     va_end(va_arg);
 }
 
@@ -149,7 +214,10 @@ void fprint_err(const char* format, ...)
     printf("fe:%p %s", fns.fprint_error_fn, format);
     report_fns("fe");
 #endif
-    fns.fprint_error_fn(format, va_arg);
+    if (thread_capture != nullptr)
+        capture_fprint(true, format, va_arg);
+    else
+        fns.fprint_error_fn(format, va_arg);
     va_end(va_arg);
 }
 
@@ -161,7 +229,9 @@ void fprint_msg_or_err(int is_msg, const char* format, ...)
 {
     va_list va_arg;
     va_start(va_arg, format);
-    if (is_msg) {
+    if (thread_capture != nullptr) {
+        capture_fprint(!is_msg, format, va_arg);
+    } else if (is_msg) {
 #if DEBUG
         printf("?m:%p %s", fns.fprint_message_fn, format);
         report_fns("?m");
@@ -177,9 +247,13 @@ void fprint_msg_or_err(int is_msg, const char* format, ...)
     va_end(va_arg);
 }
 /*
- * Prints the given string, as a normal message.
+ * Flush the message output
  */
-void flush_msg(void) { fns.flush_message_fn(); }
+void flush_msg(void)
+{
+    if (thread_capture == nullptr)
+        fns.flush_message_fn();
+}
 
 // ============================================================
 // Choosing what the printing functions do
@@ -192,6 +266,7 @@ void flush_msg(void) { fns.flush_message_fn(); }
  */
 void redirect_output_stderr(void)
 {
+    stop_async_output();
     fns.print_message_fn = &print_message_to_stdout;
     fns.print_error_fn = &print_message_to_stderr;
     fns.fprint_message_fn = &fprint_message_to_stdout;
@@ -211,6 +286,7 @@ void redirect_output_stderr(void)
  */
 void redirect_output_stdout(void)
 {
+    stop_async_output();
     fns.print_message_fn = &print_message_to_stdout;
     fns.print_error_fn = &print_message_to_stdout;
     fns.fprint_message_fn = &fprint_message_to_stdout;
@@ -253,6 +329,8 @@ int redirect_output(void (*new_print_message_fn)(const char* message),
         || new_flush_msg_fn == nullptr)
         return 1;
 
+    stop_async_output();
+
     fns.print_message_fn = new_print_message_fn;
     fns.print_error_fn = new_print_error_fn;
     fns.fprint_message_fn = new_fprint_message_fn;
@@ -266,6 +344,428 @@ int redirect_output(void (*new_print_message_fn)(const char* message),
     return 0;
 }
 
+// ============================================================
+// Asynchronous buffered output
+// ============================================================
+//
+// Messages are formatted by the calling thread into a per-thread block.
+// Full blocks (and blocks that are followed by output to the other
+// stream) are handed over to a single background writer thread through
+// a bounded lock-free queue. The writer passes each block, in order, to
+// the print functions that were in force when the asynchronous output
+// was started.
+//
+// Output from any one thread is therefore kept in order. Output from
+// different threads is interleaved a block at a time.
+
+#define ASYNC_BLOCK_SIZE (64 * 1024)
+#define ASYNC_QUEUE_SIZE 64 // must be a power of two
+
+struct async_block {
+    int is_err; // which of the downstream print functions it is for
+    size_t length; // of the text in `data`
+    size_t size; // of `data`, not counting the terminating '\0'
+    char* data;
+};
+
+struct async_slot {
+    std::atomic<size_t> sequence;
+    async_block* block;
+};
+
+// A bounded multi-producer/multi-consumer queue of blocks
+struct async_queue {
+    async_slot slots[ASYNC_QUEUE_SIZE];
+    std::atomic<size_t> head; // next slot to take from
+    std::atomic<size_t> tail; // next slot to put into
+};
+
+static struct {
+    struct print_fns downstream; // where the writer sends its output
+    async_queue full; // blocks waiting to be written
+    async_queue free; // written blocks waiting to be reused
+    std::atomic<uint32_t> signal; // bumped on every submission and on stop
+    std::atomic<uint32_t> submitted; // number of blocks submitted
+    std::atomic<uint32_t> written; // number of blocks written
+    std::atomic<int> stopping;
+    int running;
+    int atexit_registered;
+    std::thread writer;
+} async_output;
+
+static void async_queue_init(async_queue* queue)
+{
+    for (size_t ii = 0; ii < ASYNC_QUEUE_SIZE; ii++) {
+        queue->slots[ii].sequence.store(ii, std::memory_order_relaxed);
+        queue->slots[ii].block = nullptr;
+    }
+    queue->head.store(0, std::memory_order_relaxed);
+    queue->tail.store(0, std::memory_order_relaxed);
+}
+
+/*
+ * Add a block to the end of a queue.
+ *
+ * Returns true if it was added, false if the queue was full.
+ */
+static int async_queue_push(async_queue* queue, async_block* block)
+{
+    size_t posn = queue->tail.load(std::memory_order_relaxed);
+    async_slot* slot;
+    for (;;) {
+        slot = &queue->slots[posn & (ASYNC_QUEUE_SIZE - 1)];
+        size_t seq = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)posn;
+        if (diff == 0) {
+            if (queue->tail.compare_exchange_weak(posn, posn + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0)
+            return false;
+        else
+            posn = queue->tail.load(std::memory_order_relaxed);
+    }
+    slot->block = block;
+    slot->sequence.store(posn + 1, std::memory_order_release);
+    return true;
+}
+
+/*
+ * Take a block from the start of a queue.
+ *
+ * Returns true if a block was taken, false if the queue was empty.
+ */
+static int async_queue_pop(async_queue* queue, async_block** block)
+{
+    size_t posn = queue->head.load(std::memory_order_relaxed);
+    async_slot* slot;
+    for (;;) {
+        slot = &queue->slots[posn & (ASYNC_QUEUE_SIZE - 1)];
+        size_t seq = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(posn + 1);
+        if (diff == 0) {
+            if (queue->head.compare_exchange_weak(posn, posn + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0)
+            return false;
+        else
+            posn = queue->head.load(std::memory_order_relaxed);
+    }
+    *block = slot->block;
+    slot->sequence.store(posn + ASYNC_QUEUE_SIZE, std::memory_order_release);
+    return true;
+}
+
+/*
+ * Get an empty block with room for at least `size` characters.
+ *
+ * Returns nullptr if we run out of memory.
+ */
+static async_block* async_get_block(size_t size)
+{
+    async_block* block = nullptr;
+    if (size <= ASYNC_BLOCK_SIZE && async_queue_pop(&async_output.free, &block)) {
+        block->length = 0;
+        return block;
+    }
+    if (size < ASYNC_BLOCK_SIZE)
+        size = ASYNC_BLOCK_SIZE;
+    block = (async_block*)malloc(sizeof(async_block) + size + 1);
+    if (block == nullptr)
+        return nullptr;
+    block->is_err = false;
+    block->length = 0;
+    block->size = size;
+    block->data = (char*)(block + 1);
+    return block;
+}
+
+static void async_release_block(async_block* block)
+{
+    if (block->size != ASYNC_BLOCK_SIZE || !async_queue_push(&async_output.free, block))
+        free(block);
+}
+
+static void async_write_block(async_block* block)
+{
+    if (block->length == 0)
+        return;
+    block->data[block->length] = '\0';
+    if (block->is_err)
+        async_output.downstream.print_error_fn(block->data);
+    else
+        async_output.downstream.print_message_fn(block->data);
+}
+
+/*
+ * Hand a block over to the writer thread.
+ *
+ * If the writer is not running (we are shutting down), the block is
+ * written out directly instead.
+ */
+static void async_submit_block(async_block* block)
+{
+    if (!async_output.running || async_output.stopping.load(std::memory_order_acquire)) {
+        async_write_block(block);
+        async_release_block(block);
+        return;
+    }
+    while (!async_queue_push(&async_output.full, block)) {
+        // The writer is behind - wait for it to catch up
+        async_output.signal.fetch_add(1, std::memory_order_release);
+        async_output.signal.notify_one();
+        std::this_thread::yield();
+    }
+    async_output.submitted.fetch_add(1, std::memory_order_release);
+    async_output.signal.fetch_add(1, std::memory_order_release);
+    async_output.signal.notify_one();
+}
+
+// Each thread formats into its own block, which is submitted when it is
+// full, when the thread flushes, or when the thread exits
+static thread_local async_block* async_current = nullptr;
+
+struct async_thread_exit {
+    ~async_thread_exit()
+    {
+        if (async_current != nullptr) {
+            async_submit_block(async_current);
+            async_current = nullptr;
+        }
+    }
+};
+static thread_local async_thread_exit async_exit_hook;
+
+/*
+ * Return this thread's current block, making sure it is for the right
+ * stream and has room for `size` more characters.
+ */
+static async_block* async_reserve(int is_err, size_t size)
+{
+    async_block* block = async_current;
+    (void)&async_exit_hook; // make sure it is there to submit at thread exit
+    if (block != nullptr
+        && (block->is_err != is_err || block->length + size > block->size)) {
+        async_submit_block(block);
+        block = nullptr;
+    }
+    if (block == nullptr) {
+        block = async_get_block(size);
+        if (block != nullptr)
+            block->is_err = is_err;
+    }
+    async_current = block;
+    return block;
+}
+
+static void async_print(int is_err, const char* message)
+{
+    size_t length = strlen(message);
+    async_block* block = async_reserve(is_err, length);
+    if (block == nullptr) {
+        // Out of memory - fall back to writing it directly
+        if (is_err)
+            async_output.downstream.print_error_fn(message);
+        else
+            async_output.downstream.print_message_fn(message);
+        return;
+    }
+    memcpy(block->data + block->length, message, length);
+    block->length += length;
+}
+
+static void async_fprint(int is_err, const char* format, va_list arg_ptr)
+{
+    va_list arg_copy;
+    async_block* block = async_reserve(is_err, 0);
+    if (block == nullptr) {
+        if (is_err)
+            async_output.downstream.fprint_error_fn(format, arg_ptr);
+        else
+            async_output.downstream.fprint_message_fn(format, arg_ptr);
+        return;
+    }
+
+    // Most messages fit in what is left of the current block
+    va_copy(arg_copy, arg_ptr);
+    size_t room = block->size - block->length;
+    int length = vsnprintf(block->data + block->length, room + 1, format, arg_copy);
+    va_end(arg_copy);
+    if (length < 0)
+        return;
+    if ((size_t)length <= room) {
+        block->length += length;
+        return;
+    }
+
+    // Otherwise start a new block big enough to hold it
+    block = async_reserve(is_err, (size_t)length);
+    if (block == nullptr) {
+        if (is_err)
+            async_output.downstream.fprint_error_fn(format, arg_ptr);
+        else
+            async_output.downstream.fprint_message_fn(format, arg_ptr);
+        return;
+    }
+    (void)vsnprintf(block->data + block->length, (size_t)length + 1, format, arg_ptr);
+    block->length += length;
+}
+
+static void print_message_async(const char* message) { async_print(false, message); }
+static void print_error_async(const char* message) { async_print(true, message); }
+static void fprint_message_async(const char* format, va_list arg_ptr)
+{
+    async_fprint(false, format, arg_ptr);
+}
+static void fprint_error_async(const char* format, va_list arg_ptr)
+{
+    async_fprint(true, format, arg_ptr);
+}
+
+/*
+ * Submit this thread's output, and wait until everything submitted so
+ * far has been written out.
+ */
+static void flush_async(void)
+{
+    if (async_current != nullptr) {
+        async_submit_block(async_current);
+        async_current = nullptr;
+    }
+    uint32_t target = async_output.submitted.load(std::memory_order_acquire);
+    for (;;) {
+        uint32_t written = async_output.written.load(std::memory_order_acquire);
+        if ((int32_t)(target - written) <= 0 || !async_output.running)
+            break;
+        async_output.written.wait(written, std::memory_order_acquire);
+    }
+    async_output.downstream.flush_message_fn();
+}
+
+static void async_writer(void)
+{
+    uint32_t seen = async_output.signal.load(std::memory_order_acquire);
+    for (;;) {
+        async_block* block;
+        int wrote = false;
+        while (async_queue_pop(&async_output.full, &block)) {
+            async_write_block(block);
+            async_release_block(block);
+            wrote = true;
+            async_output.written.fetch_add(1, std::memory_order_release);
+            async_output.written.notify_all();
+        }
+        // Don't leave the last of a burst sitting in a stdio buffer
+        if (wrote)
+            async_output.downstream.flush_message_fn();
+        if (async_output.stopping.load(std::memory_order_acquire))
+            break;
+        async_output.signal.wait(seen, std::memory_order_acquire);
+        seen = async_output.signal.load(std::memory_order_acquire);
+    }
+}
+
+/*
+ * Flush any output, stop the writer thread, and go back to printing
+ * directly with the functions that were in force before
+ * `redirect_output_async` was called.
+ *
+ * This is called automatically on exit, and does nothing if
+ * asynchronous output is not running.
+ */
+void stop_async_output(void)
+{
+    if (!async_output.running)
+        return;
+    flush_async();
+    async_output.stopping.store(true, std::memory_order_release);
+    async_output.signal.fetch_add(1, std::memory_order_release);
+    async_output.signal.notify_one();
+    async_output.writer.join();
+
+    // Anything that has crept in since (from other threads) is written now
+    async_block* block;
+    while (async_queue_pop(&async_output.full, &block)) {
+        async_write_block(block);
+        free(block);
+    }
+    while (async_queue_pop(&async_output.free, &block))
+        free(block);
+    async_output.running = false;
+    fns = async_output.downstream;
+    fns.flush_message_fn();
+}
+
+/*
+ * Calling this causes all output to be formatted into buffers by the
+ * calling thread, and written out by a background thread using the
+ * printing functions currently in force. So call it *after* choosing
+ * where errors go (with `redirect_output_stderr`, etc.).
+ *
+ * `flush_msg` waits until everything printed so far has been written.
+ * Output is also flushed at exit, or when any other redirection is
+ * chosen.
+ *
+ * Returns 0 if all goes well, 1 if the writer thread cannot be started.
+ */
+int redirect_output_async(void)
+{
+    if (async_output.running)
+        return 0;
+
+    async_output.downstream = fns;
+    async_queue_init(&async_output.full);
+    async_queue_init(&async_output.free);
+    async_output.submitted.store(0);
+    async_output.written.store(0);
+    async_output.stopping.store(false);
+    try {
+        async_output.writer = std::thread(async_writer);
+    } catch (...) {
+        return 1;
+    }
+    async_output.running = true;
+    if (!async_output.atexit_registered) {
+        (void)atexit(stop_async_output);
+        async_output.atexit_registered = true;
+    }
+
+    fns.print_message_fn = &print_message_async;
+    fns.print_error_fn = &print_error_async;
+    fns.fprint_message_fn = &fprint_message_async;
+    fns.fprint_error_fn = &fprint_error_async;
+    fns.flush_message_fn = &flush_async;
+
+#if DEBUG
+    report_fns("async");
+#endif
+
+    return 0;
+}
+
+// ============================================================
+// Capturing the output of a single thread
+// ============================================================
+/*
+ * Calling this causes everything printed by the calling thread (and only
+ * that thread) to be appended to `capture`, normal messages and error
+ * messages separately, until it is called again with nullptr. Other
+ * threads carry on printing as before.
+ *
+ * `capture` should start out zeroed, and its text be released with
+ * `free_print_capture` when it is no longer wanted.
+ */
+void capture_thread_output(struct print_capture* capture) { thread_capture = capture; }
+
+/*
+ * Free the text held by a print capture, and zero it.
+ */
+void free_print_capture(struct print_capture* capture)
+{
+    free(capture->text[0]);
+    free(capture->text[1]);
+    memset(capture, 0, sizeof(*capture));
+}
+
 void test_C_printing(void)
 {
     print_msg("C Message\n");
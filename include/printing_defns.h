@@ -33,6 +33,15 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+// Output captured from a single thread, as text that is always '\0'
+// terminated once anything has been captured. Index 0 holds the normal
+// messages and index 1 the error messages.
+struct print_capture {
+    char* text[2];
+    size_t length[2];
+    size_t size[2];
+};
+
 #endif // _printing_defns
 
 // Local Variables:
@@ -101,6 +101,46 @@ int redirect_output(void (*new_print_message_fn)(const char* message),
     void (*new_fprint_message_fn)(const char* format, va_list arg_ptr),
     void (*new_fprint_error_fn)(const char* format, va_list arg_ptr),
     void (*new_flush_msg_fn)(void));
+/*
+ * Calling this causes all output to be formatted into buffers by the
+ * calling thread, and written out by a background thread using the
+ * printing functions currently in force. So call it *after* choosing
+ * where errors go (with `redirect_output_stderr`, etc.).
+ *
+ * `flush_msg` waits until everything printed so far has been written.
+ * Output is also flushed at exit, or when any other redirection is
+ * chosen.
+ *
+ * Returns 0 if all goes well, 1 if the writer thread cannot be started.
+ */
+int redirect_output_async(void);
+/*
+ * Flush any output, stop the writer thread, and go back to printing
+ * directly with the functions that were in force before
+ * `redirect_output_async` was called.
+ *
+ * This is called automatically on exit, and does nothing if
+ * asynchronous output is not running.
+ */
+void stop_async_output(void);
+
+// ============================================================
+// Capturing the output of a single thread
+// ============================================================
+/*
+ * Calling this causes everything printed by the calling thread (and only
+ * that thread) to be appended to `capture`, normal messages and error
+ * messages separately, until it is called again with nullptr. Other
+ * threads carry on printing as before.
+ *
+ * `capture` should start out zeroed, and its text be released with
+ * `free_print_capture` when it is no longer wanted.
+ */
+void capture_thread_output(struct print_capture* capture);
+/*
+ * Free the text held by a print capture, and zero it.
+ */
+void free_print_capture(struct print_capture* capture);
 
 // Just for the moment
 void test_C_printing(void);
@@ -0,0 +1,589 @@
+#pragma once
+
+/*
+ * Probing the start of an input stream, to decide what it is.
+ *
+ * This replaces looking at the start of a file several times over (is it
+ * TS? is it PS? what sort of video does it contain?) with a single bounded
+ * read, all the decisions then being made from the data in memory.
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "compat.h"
+#include "es_fns.h"
+#include "h222_fns.h"
+#include "misc_fns.h"
+#include "pidint_fns.h"
+#include "printing_fns.h"
+#include "probe_fns.h"
+#include "ts_fns.h"
+#include "video_defns.h"
+
+/*
+ * Initialise a stream probe datastructure, ready for use.
+ */
+void init_stream_probe(stream_probe_p probe)
+{
+    memset(probe, 0, SIZEOF_STREAM_PROBE);
+    probe->container = PROBE_CONTAINER_UNKNOWN;
+    probe->packet_size = TS_PACKET_SIZE;
+    probe->video_type = VIDEO_UNKNOWN;
+    probe->profile = -1;
+    probe->level = -1;
+}
+
+/*
+ * Tidy up a stream probe datastructure after we've finished with it.
+ *
+ * This frees any data it holds, and leaves it as if it had just been
+ * initialised.
+ */
+void clear_stream_probe(stream_probe_p probe)
+{
+    if (probe->pmt_data != nullptr)
+        free(probe->pmt_data);
+    init_stream_probe(probe);
+}
+
+/*
+ * Add some video data to the buffer we're gathering, if there's room
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int append_probe_video_data(
+    byte** video, uint32_t* video_len, uint32_t* video_size, const byte* data, int data_len)
+{
+    if (data_len <= 0 || *video_len >= PROBE_MAX_VIDEO_DATA)
+        return 0;
+    if ((uint32_t)data_len > PROBE_MAX_VIDEO_DATA - *video_len)
+        data_len = (int)(PROBE_MAX_VIDEO_DATA - *video_len);
+    if (*video_len + data_len > *video_size) {
+        uint32_t newsize = *video_size ? *video_size : 0x4000;
+        while (newsize < *video_len + data_len)
+            newsize *= 2;
+        byte* newdata = (byte*)realloc(*video, newsize);
+        if (newdata == nullptr) {
+            print_err("### Unable to extend probe video data buffer\n");
+            return 1;
+        }
+        *video = newdata;
+        *video_size = newsize;
+    }
+    memcpy(*video + *video_len, data, data_len);
+    *video_len += data_len;
+    return 0;
+}
+
+/*
+ * Look for the profile and level in some video elementary stream data.
+ *
+ * Sets `probe->profile` and `probe->level` if they are found.
+ *
+ * Returns true if the sequence header (or parameter set) that would hold
+ * them was found (MPEG-1 sequence headers don't have them), false if
+ * looking at more data might help.
+ */
+static int probe_video_profile(const byte data[], uint32_t data_len, stream_probe_p probe)
+{
+    uint32_t posn;
+    int had_sequence_header = false;
+
+    for (posn = 0; posn + 6 < data_len; posn++) {
+        if (data[posn] != 0 || data[posn + 1] != 0 || data[posn + 2] != 1)
+            continue;
+        const byte* unit = &data[posn + 3];
+        switch (probe->video_type) {
+        case VIDEO_H262:
+            // The sequence extension has profile_and_level_indication
+            if (unit[0] == 0xB3)
+                had_sequence_header = true;
+            else if (unit[0] == 0xB5 && (unit[1] >> 4) == 1) {
+                int profile_and_level = ((unit[1] & 0x0F) << 4) | (unit[2] >> 4);
+                probe->profile = (profile_and_level >> 4) & 0x07;
+                probe->level = profile_and_level & 0x0F;
+                return true;
+            }
+            break;
+        case VIDEO_H264:
+            // The sequence parameter set starts profile_idc, flags, level_idc
+            if ((unit[0] & 0x1F) == 7) {
+                probe->profile = unit[1];
+                probe->level = unit[3];
+                return true;
+            }
+            break;
+        case VIDEO_AVS:
+            // As does the AVS sequence header
+            if (unit[0] == 0xB0) {
+                probe->profile = unit[1];
+                probe->level = unit[2];
+                return true;
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+    return had_sequence_header;
+}
+
+/*
+ * Work out the program information (and video) from TS data
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int probe_TS_data(const byte data[], uint32_t data_len, stream_probe_p probe)
+{
+    int err;
+    int pass;
+    uint32_t posn;
+    byte* pat_data = nullptr;
+    int pat_data_len = 0, pat_data_used = 0;
+    byte* pmt_data = nullptr;
+    int pmt_data_len = 0, pmt_data_used = 0;
+    int got_pat = false;
+    byte* video = nullptr;
+    uint32_t video_len = 0, video_size = 0;
+    int in_video = false;
+    int had_profile = false;
+
+    // The first pass looks for the PAT and PMT, the second (once we know
+    // which PID it is on) for the start of the video
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1 && probe->video_pid == 0)
+            break;
+        for (posn = probe->packet_offset; posn + TS_PACKET_SIZE <= data_len;
+             posn += probe->packet_size) {
+            byte* packet = (byte*)&data[posn];
+            uint32_t pid;
+            int pusi, adapt_len, payload_len;
+            byte *adapt, *payload;
+
+            if (packet[0] != 0x47)
+                continue;
+            err = split_TS_packet(packet, &pid, &pusi, &adapt, &adapt_len, &payload, &payload_len);
+            if (err || payload_len == 0)
+                continue;
+
+            if (pass == 1) {
+                if (pid != probe->video_pid)
+                    continue;
+                if (pusi) {
+                    // Skip the PES header
+                    int header_len = 9 + (payload_len > 8 ? payload[8] : 0);
+                    if (payload_len < 9 || header_len > payload_len)
+                        continue;
+                    in_video = true;
+                    payload += header_len;
+                    payload_len -= header_len;
+                }
+                if (in_video) {
+                    err = append_probe_video_data(
+                        &video, &video_len, &video_size, payload, payload_len);
+                    if (err) {
+                        free(video);
+                        return 1;
+                    }
+                    if (video_len >= PROBE_MAX_VIDEO_DATA)
+                        break;
+                }
+                continue;
+            }
+
+            if (pid == 0x0000 && !got_pat) {
+                if (pusi && pat_data != nullptr) {
+                    free(pat_data);
+                    pat_data = nullptr;
+                } else if (!pusi && pat_data == nullptr)
+                    continue;
+                err = build_psi_data(
+                    false, payload, payload_len, pid, &pat_data, &pat_data_len, &pat_data_used);
+                if (err) {
+                    pat_data = nullptr;
+                    continue;
+                }
+                if (pat_data_used == pat_data_len) {
+                    pidint_list_p prog_list = nullptr;
+                    err = extract_prog_list_from_pat(false, pat_data, pat_data_len, &prog_list);
+                    free(pat_data);
+                    pat_data = nullptr;
+                    if (err)
+                        continue;
+                    probe->num_programs = prog_list->length;
+                    if (prog_list->length > 0) {
+                        got_pat = true;
+                        probe->program_number = (uint16_t)prog_list->number[0];
+                        probe->pmt_pid = prog_list->pid[0];
+                    }
+                    free_pidint_list(&prog_list);
+                }
+            } else if (got_pat && probe->pmt_data == nullptr && pid == probe->pmt_pid) {
+                if (pusi && pmt_data != nullptr) {
+                    free(pmt_data);
+                    pmt_data = nullptr;
+                } else if (!pusi && pmt_data == nullptr)
+                    continue;
+                err = build_psi_data(
+                    false, payload, payload_len, pid, &pmt_data, &pmt_data_len, &pmt_data_used);
+                if (err) {
+                    pmt_data = nullptr;
+                    continue;
+                }
+                if (pmt_data_used == pmt_data_len) {
+                    pmt_p pmt = nullptr;
+                    int ii;
+                    err = extract_pmt(false, pmt_data, pmt_data_len, pid, &pmt);
+                    if (err || pmt->program_number != probe->program_number) {
+                        if (!err)
+                            free_pmt(&pmt);
+                        free(pmt_data);
+                        pmt_data = nullptr;
+                        continue;
+                    }
+                    // We keep the PMT data, so that readers can build their
+                    // own copy of the PMT from it
+                    probe->pmt_data = pmt_data;
+                    probe->pmt_data_len = pmt_data_len;
+                    pmt_data = nullptr;
+                    probe->pcr_pid = pmt->PCR_pid;
+                    for (ii = 0; ii < pmt->num_streams; ii++) {
+                        int stream_type = pmt->streams[ii].stream_type;
+                        if (probe->video_pid == 0 && IS_VIDEO_STREAM_TYPE(stream_type)) {
+                            probe->video_pid = pmt->streams[ii].elementary_PID;
+                            if (stream_type == VIDEO_H262 || stream_type == VIDEO_H264
+                                || stream_type == VIDEO_AVS)
+                                probe->video_type = stream_type;
+                        } else if (probe->audio_pid == 0 && IS_AUDIO_STREAM_TYPE(stream_type)) {
+                            probe->audio_pid = pmt->streams[ii].elementary_PID;
+                            probe->audio_stream_type = stream_type;
+                        }
+                    }
+                    free_pmt(&pmt);
+                    break;
+                }
+            }
+        }
+    }
+    if (pat_data != nullptr)
+        free(pat_data);
+    if (pmt_data != nullptr)
+        free(pmt_data);
+
+    if (video != nullptr) {
+        had_profile = probe_video_profile(video, video_len, probe);
+        free(video);
+    }
+    probe->complete = probe->pmt_data != nullptr
+        && (probe->video_type == VIDEO_UNKNOWN || had_profile);
+    return 0;
+}
+
+/*
+ * Work out the video type from PS data
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int probe_PS_data(
+    const byte data[], uint32_t data_len, int show_reasoning, stream_probe_p probe)
+{
+    int err;
+    uint32_t posn = 0;
+    byte* video = nullptr;
+    uint32_t video_len = 0, video_size = 0;
+    int video_stream_id = 0;
+    int had_profile = false;
+
+    probe->is_mpeg1 = (data[4] & 0xF0) == 0x20;
+
+    while (posn + 6 <= data_len && video_len < PROBE_MAX_VIDEO_DATA) {
+        const byte* packet = &data[posn];
+        byte stream_id;
+        uint32_t packet_len;
+
+        if (packet[0] != 0 || packet[1] != 0 || packet[2] != 1) {
+            posn++; // resynchronise
+            continue;
+        }
+        stream_id = packet[3];
+        if (stream_id == 0xB9) // MPEG_program_end_code
+            break;
+        else if (stream_id == 0xBA) {
+            if ((packet[4] & 0xF0) == 0x20)
+                packet_len = 12;
+            else if (posn + 14 <= data_len)
+                packet_len = 14 + (packet[13] & 0x07);
+            else
+                break;
+            posn += packet_len;
+            continue;
+        } else if (stream_id < 0xBB) {
+            posn++; // not a PES packet, so resynchronise
+            continue;
+        }
+
+        packet_len = 6 + ((packet[4] << 8) | packet[5]);
+        if ((stream_id & 0xF0) == 0xE0 && (video_stream_id == 0 || stream_id == video_stream_id)) {
+            uint32_t start = 6;
+            uint32_t end = packet_len;
+            if (posn + end > data_len)
+                end = data_len - posn;
+            if ((packet[6] & 0xC0) == 0x80) // H.222 PES header
+                start = 9 + (end > 8 ? packet[8] : 0);
+            else {
+                // MPEG-1: stuffing, then STD buffer, then PTS/DTS
+                while (start < end && packet[start] == 0xFF)
+                    start++;
+                if (start < end && (packet[start] & 0xC0) == 0x40)
+                    start += 2;
+                if (start < end && (packet[start] & 0xF0) == 0x20)
+                    start += 5;
+                else if (start < end && (packet[start] & 0xF0) == 0x30)
+                    start += 10;
+                else
+                    start += 1;
+            }
+            video_stream_id = stream_id;
+            if (start < end) {
+                err = append_probe_video_data(
+                    &video, &video_len, &video_size, packet + start, (int)(end - start));
+                if (err) {
+                    free(video);
+                    return 1;
+                }
+            }
+        }
+        posn += packet_len;
+    }
+
+    if (video != nullptr) {
+        err = decide_ES_data_video_type(video, video_len, show_reasoning, &probe->video_type);
+        if (!err)
+            had_profile = probe_video_profile(video, video_len, probe);
+        free(video);
+    }
+    probe->complete = probe->video_type != VIDEO_UNKNOWN && had_profile;
+    return 0;
+}
+
+/*
+ * Decide what a stream is, from the data at its start.
+ *
+ * - `data` is the start of the stream, and `data_len` its length
+ * - if `show_reasoning` is true, then output messages explaining how the
+ *   decision is being made
+ * - `probe` is the (initialised) probe datastructure to fill in. Any data
+ *   it already holds is discarded first.
+ *
+ * If the data does not look like TS or PS, it is assumed to be ES, and
+ * `probe->video_type` will be VIDEO_UNKNOWN if we can't tell what sort.
+ * If it looks like PES, rather than ES, then the container is returned
+ * as PROBE_CONTAINER_UNKNOWN.
+ *
+ * `probe->complete` is returned true if everything was found that could
+ * be (so that looking at more data will not help).
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int probe_stream_data(
+    const byte data[], uint32_t data_len, int show_reasoning, stream_probe_p probe)
+{
+    int err;
+
+    clear_stream_probe(probe);
+    probe->bytes_probed = data_len;
+
+    if (show_reasoning)
+        print_msg("Is it Transport Stream?\n");
+    if (data_len > 0
+        && determine_TS_packet_size(
+            data, (int)data_len, &probe->packet_size, &probe->packet_offset)) {
+        if (show_reasoning)
+            fprint_msg("  Found TS packets %d bytes apart - looks like TS\n", probe->packet_size);
+        probe->container = PROBE_CONTAINER_TS;
+        return probe_TS_data(data, data_len, probe);
+    } else if (show_reasoning)
+        print_msg("  No run of TS packets at the start, so it is not\n");
+
+    if (show_reasoning)
+        print_msg("Is it Program Stream?\n");
+    if (data_len >= 12 && data[0] == 0 && data[1] == 0 && data[2] == 1 && data[3] == 0xBA) {
+        if (show_reasoning)
+            print_msg("  Starts with a pack header - looks like PS\n");
+        probe->container = PROBE_CONTAINER_PS;
+        return probe_PS_data(data, data_len, show_reasoning, probe);
+    } else if (show_reasoning)
+        print_msg("  Does not start 00 00 01 BA, so it is not\n");
+
+    if (show_reasoning)
+        print_msg("Is it an Elementary Stream we recognise?\n");
+    err = decide_ES_data_video_type(data, data_len, show_reasoning, &probe->video_type);
+    if (err) {
+        // It is presumably PES of some sort
+        probe->container = PROBE_CONTAINER_UNKNOWN;
+        probe->complete = true;
+        return 0;
+    }
+    probe->container = PROBE_CONTAINER_ES;
+    probe->complete
+        = probe->video_type != VIDEO_UNKNOWN && probe_video_profile(data, data_len, probe);
+    return 0;
+}
+
+/*
+ * Decide what a file is, by reading (once) a bounded amount of its start.
+ *
+ * The data is read in increasing chunks, starting at PROBE_START_SIZE, and
+ * stopping as soon as the decision is complete (so probing a simple file
+ * does not read anywhere near `max_bytes` of it).
+ *
+ * - `input` is the file to probe. This must be seekable (so not standard
+ *   input). The probe always starts at the beginning of the file, but
+ *   afterwards the file is returned to wherever it was.
+ * - `max_bytes` is the most of it to read (0 means DEFAULT_PROBE_SIZE)
+ * - if `show_reasoning` is true, then output messages explaining how the
+ *   decision is being made
+ * - `probe` is the (initialised) probe datastructure to fill in. Call
+ *   `clear_stream_probe` when finished with it.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int probe_stream_file(int input, uint32_t max_bytes, int show_reasoning, stream_probe_p probe)
+{
+    int err;
+    byte* data = nullptr;
+    uint32_t data_len = 0;
+    uint32_t data_size;
+    int had_eof = false;
+    offset_t start_posn;
+
+    if (input == STDIN_FILENO) {
+        print_err("### Cannot probe standard input, as it cannot be rewound\n");
+        return 1;
+    }
+    if (max_bytes == 0)
+        max_bytes = DEFAULT_PROBE_SIZE;
+
+    start_posn = tell_file(input);
+    if (start_posn == -1) {
+        print_err("### Error remembering position in file before probing it\n");
+        return 1;
+    }
+    err = seek_file(input, 0);
+    if (err) {
+        print_err("### Error rewinding file before probing it\n");
+        return 1;
+    }
+
+    data_size = max_bytes < PROBE_START_SIZE ? max_bytes : PROBE_START_SIZE;
+    for (;;) {
+        byte* newdata = (byte*)realloc(data, data_size);
+        if (newdata == nullptr) {
+            print_err("### Unable to allocate buffer to probe file\n");
+            err = 1;
+            break;
+        }
+        data = newdata;
+
+        while (data_len < data_size) {
+            ssize_t length = read_file(input, data + data_len, data_size - data_len);
+            if (length == 0) {
+                had_eof = true;
+                break;
+            } else if (length == -1) {
+                if (errno == EINTR)
+                    continue;
+                fprint_err("### Error reading file to probe it: %s\n", strerror(errno));
+                err = 1;
+                break;
+            }
+            data_len += (uint32_t)length;
+        }
+        if (err)
+            break;
+
+        err = probe_stream_data(data, data_len, false, probe);
+        if (err || probe->complete || had_eof || data_size >= max_bytes)
+            break;
+        data_size = (data_size > max_bytes / 2) ? max_bytes : data_size * 2;
+    }
+
+    // Only explain ourselves on the data we finally decided with
+    if (!err && show_reasoning)
+        err = probe_stream_data(data, data_len, true, probe);
+    free(data);
+
+    // Whatever happened, leave the file where we found it
+    if (seek_file(input, start_posn)) {
+        print_err("### Error returning to position in file after probing it\n");
+        return 1;
+    }
+    return err ? 1 : 0;
+}
+
+/*
+ * Report on what a probe decided.
+ *
+ * - if `is_msg` is true, then print as a message, otherwise as an error
+ * - `probe` is the probe to report on
+ */
+void report_stream_probe(int is_msg, stream_probe_p probe)
+{
+    fprint_msg_or_err(is_msg, "Probed %u bytes: ", probe->bytes_probed);
+    switch (probe->container) {
+    case PROBE_CONTAINER_TS:
+        fprint_msg_or_err(is_msg, "Transport Stream, %d byte packets", probe->packet_size);
+        if (probe->packet_offset)
+            fprint_msg_or_err(is_msg, " (TS packet at offset %d)", probe->packet_offset);
+        fprint_msg_or_err(is_msg, "\n");
+        if (probe->program_number == 0)
+            fprint_msg_or_err(is_msg, "  No PAT found\n");
+        else {
+            fprint_msg_or_err(is_msg, "  %d program%s, first is %d with PMT PID %04x\n",
+                probe->num_programs, probe->num_programs == 1 ? "" : "s",
+                probe->program_number, probe->pmt_pid);
+            if (probe->pmt_data == nullptr)
+                fprint_msg_or_err(is_msg, "  No PMT found for it\n");
+            else {
+                fprint_msg_or_err(is_msg, "  PCR PID %04x", probe->pcr_pid);
+                if (probe->video_pid)
+                    fprint_msg_or_err(is_msg, ", video PID %04x", probe->video_pid);
+                if (probe->audio_pid)
+                    fprint_msg_or_err(is_msg, ", audio PID %04x (%s)", probe->audio_pid,
+                        h222_stream_type_str(probe->audio_stream_type));
+                fprint_msg_or_err(is_msg, "\n");
+            }
+        }
+        break;
+    case PROBE_CONTAINER_PS:
+        fprint_msg_or_err(
+            is_msg, "Program Stream (%s)\n", probe->is_mpeg1 ? "MPEG-1" : "H.222.0/MPEG-2");
+        break;
+    case PROBE_CONTAINER_ES:
+        fprint_msg_or_err(is_msg, "Elementary Stream\n");
+        break;
+    default:
+        fprint_msg_or_err(is_msg, "not recognised\n");
+        return;
+    }
+    fprint_msg_or_err(is_msg, "  Video is %s",
+        probe->video_type == VIDEO_H262       ? "MPEG-2 (H.262)"
+            : probe->video_type == VIDEO_H264 ? "MPEG-4/AVC (H.264)"
+            : probe->video_type == VIDEO_AVS  ? "AVS"
+                                              : "unknown");
+    if (probe->profile != -1)
+        fprint_msg_or_err(is_msg, ", profile %d, level %d", probe->profile, probe->level);
+    fprint_msg_or_err(is_msg, "\n");
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
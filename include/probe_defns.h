@@ -0,0 +1,70 @@
+/*
+ * Datastructures for probing the start of an input stream
+ *
+ * A probe reads a bounded amount of the start of a file (once), and works
+ * out from that what sort of data it is (TS, PS or ES), how it is laid out,
+ * and what it contains. The readers can then be built from that verdict,
+ * instead of each re-reading the start of the file to find out for
+ * themselves.
+ *
+ */
+
+#ifndef _probe_defns
+#define _probe_defns
+
+#include "compat.h"
+
+// What the data is held in
+#define PROBE_CONTAINER_UNKNOWN 0
+#define PROBE_CONTAINER_TS 1
+#define PROBE_CONTAINER_PS 2
+#define PROBE_CONTAINER_ES 3
+
+// By default, we look at (up to) this much of a file
+#define DEFAULT_PROBE_SIZE (4 * 1024 * 1024)
+
+// We read in chunks of this size (doubling each time), stopping as soon
+// as we have decided everything we can, so that small decisions only cost
+// small reads
+#define PROBE_START_SIZE 0x10000
+
+// The most video data we gather (from TS or PS) to decide on its type
+#define PROBE_MAX_VIDEO_DATA 0x40000
+
+struct stream_probe {
+    int container; // One of PROBE_CONTAINER_xxx
+    uint32_t bytes_probed; // How much of the file we looked at
+    int complete; // True if we decided everything we wanted to
+
+    // For TS (see `determine_TS_packet_size`)
+    int packet_size; // Distance from one TS packet to the next
+    int packet_offset; // Offset of the TS packet proper therein
+    int num_programs; // Number of programs in the first PAT
+    uint16_t program_number; // The first program therein (0 if none)
+    uint32_t pmt_pid; // and the PID of its PMT
+    byte* pmt_data; // The first PMT for that program, as assembled by
+    int pmt_data_len; // `build_psi_data`, or nullptr if none found
+    uint32_t pcr_pid; // From that PMT
+    uint32_t video_pid; // The first video stream therein (0 if none)
+    uint32_t audio_pid; // The first audio stream therein (0 if none)
+    int audio_stream_type; // and its stream type (0 if none)
+
+    // For PS
+    int is_mpeg1; // True if the pack header is MPEG-1 style
+
+    // For all
+    int video_type; // VIDEO_H262, VIDEO_H264, VIDEO_AVS or VIDEO_UNKNOWN
+    int profile; // The video profile (profile_idc, etc.), -1 if not found
+    int level; // The video level, -1 if not found
+};
+typedef struct stream_probe* stream_probe_p;
+#define SIZEOF_STREAM_PROBE sizeof(struct stream_probe)
+
+#endif // _probe_defns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
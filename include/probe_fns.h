@@ -0,0 +1,78 @@
+/*
+ * Functions for probing the start of an input stream
+ *
+ */
+
+#ifndef _probe_fns
+#define _probe_fns
+
+#include "compat.h"
+#include "probe_defns.h"
+
+/*
+ * Initialise a stream probe datastructure, ready for use.
+ */
+void init_stream_probe(stream_probe_p probe);
+/*
+ * Tidy up a stream probe datastructure after we've finished with it.
+ *
+ * This frees any data it holds, and leaves it as if it had just been
+ * initialised.
+ */
+void clear_stream_probe(stream_probe_p probe);
+/*
+ * Decide what a stream is, from the data at its start.
+ *
+ * - `data` is the start of the stream, and `data_len` its length
+ * - if `show_reasoning` is true, then output messages explaining how the
+ *   decision is being made
+ * - `probe` is the (initialised) probe datastructure to fill in. Any data
+ *   it already holds is discarded first.
+ *
+ * If the data does not look like TS or PS, it is assumed to be ES, and
+ * `probe->video_type` will be VIDEO_UNKNOWN if we can't tell what sort.
+ * If it looks like PES, rather than ES, then the container is returned
+ * as PROBE_CONTAINER_UNKNOWN.
+ *
+ * `probe->complete` is returned true if everything was found that could
+ * be (so that looking at more data will not help).
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int probe_stream_data(
+    const byte data[], uint32_t data_len, int show_reasoning, stream_probe_p probe);
+/*
+ * Decide what a file is, by reading (once) a bounded amount of its start.
+ *
+ * The data is read in increasing chunks, starting at PROBE_START_SIZE, and
+ * stopping as soon as the decision is complete (so probing a simple file
+ * does not read anywhere near `max_bytes` of it).
+ *
+ * - `input` is the file to probe. This must be seekable (so not standard
+ *   input). The probe always starts at the beginning of the file, but
+ *   afterwards the file is returned to wherever it was.
+ * - `max_bytes` is the most of it to read (0 means DEFAULT_PROBE_SIZE)
+ * - if `show_reasoning` is true, then output messages explaining how the
+ *   decision is being made
+ * - `probe` is the (initialised) probe datastructure to fill in. Call
+ *   `clear_stream_probe` when finished with it.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int probe_stream_file(int input, uint32_t max_bytes, int show_reasoning, stream_probe_p probe);
+/*
+ * Report on what a probe decided.
+ *
+ * - if `is_msg` is true, then print as a message, otherwise as an error
+ * - `probe` is the probe to report on
+ */
+void report_stream_probe(int is_msg, stream_probe_p probe);
+
+#endif // _probe_fns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
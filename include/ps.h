@@ -36,6 +36,7 @@
 
 #include <unistd.h>
 
+#include "blockcache_fns.h"
 #include "compat.h"
 #include "misc_fns.h"
 #include "pes_fns.h"
@@ -94,9 +95,24 @@ struct program_data {
  */
 static inline int get_more_data(PS_reader_p ps)
 {
+    // If we've been reading from an older block, the file is not where we
+    // want to read from
+    if (ps->reposition != -1) {
+        if (seek_file(ps->input, ps->reposition)) {
+            print_err("### Error returning to the end of the PS data read so far\n");
+            return 1;
+        }
+        ps->reposition = -1;
+    }
+
+    // Leave the blocks we've read recently alone, in case we seek back
+    block_cache_entry_p block = get_block_to_fill(ps->blocks, ps->data_block);
+    if (block == nullptr)
+        return 1;
+
     // Call `read` directly - we don't particularly mind if we get a "short"
     // read, since we'll just catch up later on
-    ssize_t len = read(ps->input, &ps->data, PS_READ_AHEAD_SIZE);
+    ssize_t len = read_file(ps->input, block->data, PS_READ_AHEAD_SIZE);
     if (len == 0)
         return EOF;
     else if (len == -1) {
@@ -105,6 +121,10 @@ static inline int get_more_data(PS_reader_p ps)
     }
     ps->data_posn += ps->data_len; // length of the *last* buffer
     ps->data_len = len;
+    block->posn = ps->data_posn;
+    block->len = len;
+    ps->data_block = block;
+    ps->data = block->data;
     ps->data_end = ps->data + len; // one beyond the last byte
     ps->data_ptr = ps->data; // start at the beginning
     return 0;
@@ -130,14 +150,23 @@ int build_PS_reader(int input, int quiet, PS_reader_p* ps)
     }
 
     new2->input = input;
+    new2->data_block = nullptr;
+    new2->data = new2->data_end = new2->data_ptr = nullptr;
     new2->data_posn = 0;
     new2->data_len = 0;
+    new2->reposition = -1;
     new2->start = 0;
 
+    err = build_block_cache(PS_READ_AHEAD_BLOCKS, PS_READ_AHEAD_SIZE, &new2->blocks);
+    if (err) {
+        free(new2);
+        return 1;
+    }
+
     err = get_more_data(new2);
     if (err) {
         print_err("### Unable to start reading from new PS read context\n");
-        free(new2);
+        free_PS_reader(&new2);
         return 1;
     }
 
@@ -147,7 +176,7 @@ int build_PS_reader(int input, int quiet, PS_reader_p* ps)
         fprint_err("### File does not appear to be PS\n"
                    "    Cannot find PS pack header in first %d bytes of file\n",
             PACK_HEADER_SEARCH_DISTANCE);
-        free(new2);
+        free_PS_reader(&new2);
         return 1;
     }
 
@@ -157,7 +186,7 @@ int build_PS_reader(int input, int quiet, PS_reader_p* ps)
         err = seek_using_PS_reader(new2, new2->start);
         if (err) {
             print_err("### Error seeking to start of first pack header\n");
-            free(new2);
+            free_PS_reader(&new2);
             return 1;
         }
     }
@@ -185,6 +214,7 @@ void free_PS_reader(PS_reader_p* ps)
 {
     if (*ps != nullptr) {
         (*ps)->input = -1; // "forget" our input
+        free_block_cache(&(*ps)->blocks);
         free(*ps);
         *ps = nullptr;
     }
@@ -327,6 +357,9 @@ int determine_PS_video_type(PS_reader_p ps, int* video_type)
  * then `rewind_program_stream` should be used instead, as offset 0 is
  * not necessarily the same as the start of the program stream.
  *
+ * If that part of the file has been read recently, then the reader just
+ * moves to it within the blocks it has kept, without touching the file.
+ *
  * - `ps` is the PS read-ahead context
  * - `posn` is the file offset to seek to
  *
@@ -334,10 +367,30 @@ int determine_PS_video_type(PS_reader_p ps, int* video_type)
  */
 int seek_using_PS_reader(PS_reader_p ps, offset_t posn)
 {
+    // If we've read that part of the file recently, just move to it
+    block_cache_entry_p block = find_cached_block(ps->blocks, posn, 1);
+    if (block != nullptr) {
+        // Only the block we last read from the file leaves the file
+        // positioned after it
+        if (block != ps->blocks->last_read)
+            ps->reposition = block->posn + block->len;
+        else
+            ps->reposition = -1;
+        ps->data_block = block;
+        ps->data = block->data;
+        ps->data_posn = block->posn;
+        ps->data_len = block->len;
+        ps->data_end = ps->data + block->len;
+        ps->data_ptr = ps->data + (posn - block->posn);
+        return 0;
+    }
+
     int err = seek_file(ps->input, posn);
     if (err)
         return 1;
 
+    ps->reposition = -1;
+    ps->blocks->last_read = nullptr; // the file is no longer after it
     ps->data_posn = posn;
     ps->data_len = 0;
 
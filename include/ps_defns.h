@@ -30,6 +30,7 @@
 #ifndef _ps_defns
 #define _ps_defns
 
+#include "blockcache_defns.h"
 #include "compat.h"
 #include "h222_defns.h"
 #include "tswrite_defns.h"
@@ -38,16 +39,22 @@
 // A program stream context, used to read PS and manage a read-ahead cache
 
 #define PS_READ_AHEAD_SIZE 5000 // The number of bytes to read ahead
+#define PS_READ_AHEAD_BLOCKS 16 // The number of such reads to keep in hand
 
 struct ps_reader {
     int input; // where we're reading from
     offset_t start; // the offset at which our data starts
 
-    byte data[PS_READ_AHEAD_SIZE];
+    block_cache_p blocks; // recently read blocks, so we can seek back into them
+    block_cache_entry_p data_block; // the one we are reading from
+    byte* data; // and its data
     offset_t data_posn; // location of this data in the file
     int32_t data_len; // actual number of bytes in the buffer
     byte* data_end; // off the end of `data`
     byte* data_ptr; // which byte we're interested in (next)
+    // If we have moved into a block other than the last one read from the
+    // file, where to seek to before reading any more (otherwise -1)
+    offset_t reposition;
 };
 typedef struct ps_reader* PS_reader_p;
 #define SIZEOF_PS_READER sizeof(struct ps_reader)
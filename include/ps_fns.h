@@ -115,6 +115,9 @@ int determine_PS_video_type(PS_reader_p ps, int* video_type);
  * then `rewind_program_stream` should be used instead, as offset 0 is
  * not necessarily the same as the start of the program stream.
  *
+ * If that part of the file has been read recently, then the reader just
+ * moves to it within the blocks it has kept, without touching the file.
+ *
  * - `ps` is the PS read-ahead context
  * - `posn` is the file offset to seek to
  *
@@ -54,8 +54,12 @@
 #include <cstring>
 
 #include <ctime>
+#if defined(__linux__)
+#include <sys/resource.h>
+#endif
 
 #include "accessunit_fns.h"
+#include "codec_traits.h"
 #include "compat.h"
 #include "es_fns.h"
 #include "h262_fns.h"
@@ -70,8 +74,10 @@
 
 // ------------------------------------------------------------
 // A useful macro to tell us if the `idx` entry in the reverse_data
-// structure `rev` is a sequence header or not (or did you guess?)
-#define SEQUENCE_HEADER_ENTRY(rev, idx) (!(rev)->is_h264 && (rev)->seq_offset[idx] == 0)
+// structure `rev`, for a stream described by the codec traits `Codec`, is a
+// sequence header or not (or did you guess?)
+#define SEQUENCE_HEADER_ENTRY(Codec, rev, idx)                                                     \
+    (Codec::has_sequence_headers && (rev)->seq_offset[idx] == 0)
 
 // ============================================================
 // Remembering start/length information for reversing video sequences
@@ -175,6 +181,7 @@ int build_reverse_data(reverse_data_p* reverse_data, int is_h264)
 
     new2->pid = DEFAULT_VIDEO_PID;
     new2->stream_id = DEFAULT_VIDEO_STREAM_ID;
+    new2->indexer = nullptr;
 
     *reverse_data = new2;
     return 0;
@@ -243,6 +250,8 @@ void free_reverse_data(reverse_data_p* reverse_data)
     if (this2 == nullptr)
         return;
 
+    stop_reverse_indexer(this2);
+
     if (this2->seq_offset != nullptr) {
         free(this2->seq_offset);
         this2->seq_offset = nullptr;
@@ -323,6 +332,63 @@ static void debug_reverse_data_problem(
     }
 }
 
+/*
+ * Make sure the reverse data arrays can hold at least `size` entries
+ *
+ * Each array is only replaced once it has been successfully extended, and
+ * `size` is only updated once they all have been, so if this fails the
+ * arrays (and their existing entries) are still usable at their old size.
+ *
+ * Returns 0 if it succeeds, 1 if some error occurs.
+ */
+static int ensure_reverse_data_size(reverse_data_p reverse_data, int size)
+{
+    if (reverse_data->size >= size)
+        return 0;
+
+    uint32_t* index = (uint32_t*)realloc(reverse_data->index, size * sizeof(uint32_t));
+    if (index == nullptr) {
+        print_err("### Unable to extend reverse data array (index)\n");
+        return 1;
+    }
+    reverse_data->index = index;
+    offset_t* start_file = (offset_t*)realloc(reverse_data->start_file, size * sizeof(offset_t));
+    if (start_file == nullptr) {
+        print_err("### Unable to extend reverse data array (start_file)\n");
+        return 1;
+    }
+    reverse_data->start_file = start_file;
+    int32_t* start_pkt = (int32_t*)realloc(reverse_data->start_pkt, size * sizeof(int32_t));
+    if (start_pkt == nullptr) {
+        print_err("### Unable to extend reverse data array (start_pkt)\n");
+        return 1;
+    }
+    reverse_data->start_pkt = start_pkt;
+    int32_t* data_len = (int32_t*)realloc(reverse_data->data_len, size * sizeof(int32_t));
+    if (data_len == nullptr) {
+        print_err("### Unable to extend reverse data array (length)\n");
+        return 1;
+    }
+    reverse_data->data_len = data_len;
+
+    if (!reverse_data->is_h264) {
+        byte* seq_offset = (byte*)realloc(reverse_data->seq_offset, size);
+        if (seq_offset == nullptr) {
+            print_err("### Unable to extend reverse data array (seq offset)\n");
+            return 1;
+        }
+        reverse_data->seq_offset = seq_offset;
+        byte* afd_byte = (byte*)realloc(reverse_data->afd_byte, size);
+        if (afd_byte == nullptr) {
+            print_err("### Unable to extend reverse data array (AFD)\n");
+            return 1;
+        }
+        reverse_data->afd_byte = afd_byte;
+    }
+    reverse_data->size = size;
+    return 0;
+}
+
 /*
  * Remember video sequence bounds for H.262 data
  *
@@ -373,43 +439,8 @@ int remember_reverse_h262_data(reverse_data_p reverse_data, uint32_t index, ES_o
 
     if (reverse_data->size == reverse_data->length) {
         int newsize = reverse_data->size + REVERSE_ARRAY_INCREMENT_SIZE;
-        reverse_data->index = (uint32_t*)realloc(reverse_data->index, newsize * sizeof(uint32_t));
-        if (reverse_data->index == nullptr) {
-            print_err("### Unable to extend reverse data array (index)\n");
+        if (ensure_reverse_data_size(reverse_data, newsize))
             return 1;
-        }
-        reverse_data->start_file
-            = (offset_t*)realloc(reverse_data->start_file, newsize * sizeof(offset_t));
-        if (reverse_data->start_file == nullptr) {
-            print_err("### Unable to extend reverse data array (start_file)\n");
-            return 1;
-        }
-        reverse_data->start_pkt
-            = (int32_t*)realloc(reverse_data->start_pkt, newsize * sizeof(int32_t));
-        if (reverse_data->start_pkt == nullptr) {
-            print_err("### Unable to extend reverse data array (start_pkt)\n");
-            return 1;
-        }
-        reverse_data->data_len
-            = (int32_t*)realloc(reverse_data->data_len, newsize * sizeof(int32_t));
-        if (reverse_data->data_len == nullptr) {
-            print_err("### Unable to extend reverse data array (length)\n");
-            return 1;
-        }
-
-        if (!reverse_data->is_h264) {
-            reverse_data->seq_offset = (byte*)realloc(reverse_data->seq_offset, newsize);
-            if (reverse_data->seq_offset == nullptr) {
-                print_err("### Unable to extend reverse data array (seq offset)\n");
-                return 1;
-            }
-            reverse_data->afd_byte = (byte*)realloc(reverse_data->afd_byte, newsize);
-            if (reverse_data->afd_byte == nullptr) {
-                print_err("### Unable to extend reverse data array (AFD)\n");
-                return 1;
-            }
-        }
-        reverse_data->size = newsize;
     }
 
     // If we're not an H.262 sequence header, remember our index
@@ -479,30 +510,8 @@ int remember_reverse_h264_data(
 
     if (reverse_data->size == reverse_data->length) {
         int newsize = reverse_data->size + REVERSE_ARRAY_INCREMENT_SIZE;
-        reverse_data->index = (uint32_t*)realloc(reverse_data->index, newsize * sizeof(uint32_t));
-        if (reverse_data->index == nullptr) {
-            print_err("### Unable to extend reverse data array (index)\n");
-            return 1;
-        }
-        reverse_data->start_file
-            = (offset_t*)realloc(reverse_data->start_file, newsize * sizeof(offset_t));
-        if (reverse_data->start_file == nullptr) {
-            print_err("### Unable to extend reverse data array (start_file)\n");
-            return 1;
-        }
-        reverse_data->start_pkt
-            = (int32_t*)realloc(reverse_data->start_pkt, newsize * sizeof(int32_t));
-        if (reverse_data->start_pkt == nullptr) {
-            print_err("### Unable to extend reverse data array (start_pkt)\n");
+        if (ensure_reverse_data_size(reverse_data, newsize))
             return 1;
-        }
-        reverse_data->data_len
-            = (int32_t*)realloc(reverse_data->data_len, newsize * sizeof(int32_t));
-        if (reverse_data->data_len == nullptr) {
-            print_err("### Unable to extend reverse data array (length)\n");
-            return 1;
-        }
-        reverse_data->size = newsize;
     }
 
     reverse_data->num_pictures++;
@@ -576,6 +585,226 @@ int get_reverse_data(reverse_data_p reverse_data, int which, uint32_t* index,
     return 0;
 }
 
+// ============================================================
+// Building the reverse data in the background
+// ============================================================
+/*
+ * The body of the reverse indexer thread. Reads pictures until it reaches
+ * the end of the input (or an error), or is asked to stop.
+ */
+template <typename Codec>
+static void reverse_indexer_thread(reverse_indexer_p indexer, typename Codec::context_p context)
+{
+#if defined(__linux__)
+    // On Linux, this only changes the priority of the calling thread
+    (void)setpriority(PRIO_PROCESS, 0, REVERSE_INDEXER_NICENESS);
+#endif
+    while (!indexer->stopping.load(std::memory_order_acquire)) {
+        typename Codec::picture_p picture = nullptr;
+        int err;
+        {
+            std::lock_guard<std::mutex> guard(indexer->lock);
+            err = Codec::get_next_picture(context, false, true, &picture);
+        }
+        if (err)
+            break; // EOF, or an error (which has been reported)
+        Codec::free_picture(&picture);
+    }
+    indexer->finished.store(true, std::memory_order_release);
+}
+
+/*
+ * Build the picture context and reverse data for an indexer, and start
+ * its thread.
+ *
+ * Returns 0 if all went well, 1 if something went wrong.
+ */
+template <typename Codec> static int start_indexer_thread(reverse_indexer_p indexer)
+{
+    typename Codec::context_p context;
+    int err;
+
+    err = Codec::build_context(indexer->es, &context);
+    if (err) {
+        fprint_err("### Error building %s context for reverse indexer\n", Codec::name);
+        return 1;
+    }
+    if constexpr (Codec::has_sequence_headers)
+        indexer->h262 = context;
+    else
+        indexer->h264 = context;
+
+    err = build_reverse_data(&indexer->reverse_data, !Codec::has_sequence_headers);
+    if (err) {
+        print_err("### Unable to build reverse data for reverse indexer\n");
+        return 1;
+    }
+    Codec::add_reverse_context(context, indexer->reverse_data);
+
+    try {
+        indexer->thread = std::thread(reverse_indexer_thread<Codec>, indexer, context);
+    } catch (...) {
+        print_err("### Unable to start reverse indexer thread\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Start building reverse data for `reverse_data` in the background.
+ *
+ * - `reverse_data` is the reverse data used when playing the input
+ * - `es` is a second ES reader for the same input (and the same video
+ *   stream therein), positioned at its start. It is used only by the
+ *   indexer, but is not closed by it.
+ *
+ * Use `update_from_reverse_indexer` to copy over what the indexer has found.
+ * The indexer is stopped by `stop_reverse_indexer` or `free_reverse_data`,
+ * and `es` must not be closed until then.
+ *
+ * Returns 0 if all went well, 1 if something went wrong.
+ */
+int start_reverse_indexer(reverse_data_p reverse_data, ES_p es)
+{
+    reverse_indexer_p indexer;
+    int err;
+
+    if (reverse_data->indexer != nullptr) {
+        print_err("### Reverse data already has a reverse indexer\n");
+        return 1;
+    }
+
+    indexer = new (std::nothrow) struct reverse_indexer;
+    if (indexer == nullptr) {
+        print_err("### Unable to allocate reverse indexer\n");
+        return 1;
+    }
+    indexer->es = es;
+    indexer->h262 = nullptr;
+    indexer->h264 = nullptr;
+    indexer->reverse_data = nullptr;
+    indexer->stopping.store(false);
+    indexer->finished.store(false);
+
+    if (reverse_data->is_h264)
+        err = start_indexer_thread<h264_traits>(indexer);
+    else
+        err = start_indexer_thread<h262_traits>(indexer);
+    reverse_data->indexer = indexer;
+    if (err) {
+        stop_reverse_indexer(reverse_data);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Stop any reverse indexer for `reverse_data`, and free it.
+ *
+ * Entries already copied over from the indexer are kept.
+ */
+void stop_reverse_indexer(reverse_data_p reverse_data)
+{
+    reverse_indexer_p indexer = reverse_data->indexer;
+    if (indexer == nullptr)
+        return;
+
+    indexer->stopping.store(true, std::memory_order_release);
+    if (indexer->thread.joinable())
+        indexer->thread.join();
+
+    free_reverse_data(&indexer->reverse_data);
+    free_h262_context(&indexer->h262);
+    free_access_unit_context(&indexer->h264);
+    delete indexer;
+    reverse_data->indexer = nullptr;
+}
+
+/*
+ * Copy over any entries that the reverse indexer for `reverse_data` has
+ * found beyond those that `reverse_data` already has.
+ *
+ * Does nothing if there is no indexer. If the indexer's entries turn out
+ * not to match those in `reverse_data` (which should not happen), the
+ * indexer is stopped, and no longer used.
+ *
+ * Returns 0 if all went well, 1 if something went wrong.
+ */
+int update_from_reverse_indexer(reverse_data_p reverse_data)
+{
+    reverse_indexer_p indexer = reverse_data->indexer;
+    reverse_data_p found;
+    int from = reverse_data->length;
+    int err = 0;
+    int ii;
+
+    // Until something has been remembered, `last_posn_added` cannot say that
+    // nothing has been played yet, so wait until play has started
+    if (indexer == nullptr || from == 0)
+        return 0;
+
+    indexer->lock.lock();
+    found = indexer->reverse_data;
+    if (found->length <= from) {
+        // We're ahead of the indexer, so there's nothing new to learn
+        indexer->lock.unlock();
+        return 0;
+    }
+    if (found->start_file[from - 1] != reverse_data->start_file[from - 1]
+        || found->start_pkt[from - 1] != reverse_data->start_pkt[from - 1]) {
+        indexer->lock.unlock();
+        fprint_err("!!! Reverse indexer entry %d is at " OFFSET_T_FORMAT "/%d, not " OFFSET_T_FORMAT
+                   "/%d\n    No longer using the reverse indexer\n",
+            from - 1, found->start_file[from - 1], found->start_pkt[from - 1],
+            reverse_data->start_file[from - 1], reverse_data->start_pkt[from - 1]);
+        stop_reverse_indexer(reverse_data);
+        return 0;
+    }
+
+    err = ensure_reverse_data_size(reverse_data, found->length);
+    if (!err) {
+        for (ii = from; ii < found->length; ii++) {
+            reverse_data->index[ii] = found->index[ii];
+            reverse_data->start_file[ii] = found->start_file[ii];
+            reverse_data->start_pkt[ii] = found->start_pkt[ii];
+            reverse_data->data_len[ii] = found->data_len[ii];
+            if (reverse_data->is_h264) {
+                reverse_data->num_pictures++;
+            } else {
+                reverse_data->seq_offset[ii] = found->seq_offset[ii];
+                reverse_data->afd_byte[ii] = found->afd_byte[ii];
+                if (found->seq_offset[ii] != 0)
+                    reverse_data->num_pictures++;
+            }
+        }
+        // Note that `last_posn_added` stays where it was, as that is where
+        // we have played up to
+        reverse_data->length = found->length;
+    }
+    indexer->lock.unlock();
+    return err;
+}
+
+/*
+ * Find the first picture (not an H.262 sequence header) after the current
+ * position in the reverse data (i.e., after `last_posn_added`) whose
+ * picture index is at least `index`.
+ *
+ * Returns its position in the reverse data arrays, or -1 if there is no
+ * such picture (yet).
+ */
+int32_t find_reverse_data_picture(reverse_data_p reverse_data, uint32_t index)
+{
+    int ii = (reverse_data->length == 0 ? 0 : reverse_data->last_posn_added + 1);
+    for (; ii < reverse_data->length; ii++) {
+        if (!reverse_data->is_h264 && reverse_data->seq_offset[ii] == 0)
+            continue;
+        if (reverse_data->index[ii] >= index)
+            return ii;
+    }
+    return -1;
+}
+
 // ============================================================
 // Collecting pictures
 // ============================================================
@@ -865,14 +1094,18 @@ static int output_sequence_header(ES_p es, WRITER output, int as_TS, int verbose
  *   and so on. Sequence headers do not count for this purpose.
  * - `reverse_data` is the reverse data context.
  *
+ * `Codec` is the codec traits type for the data being reversed (see
+ * codec_traits.h).
+ *
  * Returns 0 if all went well, or 1 if something went wrong.
  */
+template <typename Codec>
 static int output_from_reverse_data(ES_p es, WRITER output, int as_TS, int verbose, int quiet,
     uint32_t offset, reverse_data_p reverse_data)
 {
-    int with_sequence_headers = (!reverse_data->is_h264 && reverse_data->output_sequence_headers);
+    int with_sequence_headers
+        = (Codec::has_sequence_headers && reverse_data->output_sequence_headers);
     uint32_t which = reverse_data->length - 1; // the maximum picture index
-    int is_h262 = !reverse_data->is_h264;
     int err;
     uint32_t index;
     ES_offset start_posn;
@@ -890,7 +1123,7 @@ static int output_from_reverse_data(ES_p es, WRITER output, int as_TS, int verbo
         return 0;
 
     // Start with the last non-sequence header, and work backwards
-    if (which > 0 && SEQUENCE_HEADER_ENTRY(reverse_data, which))
+    if (which > 0 && SEQUENCE_HEADER_ENTRY(Codec, reverse_data, which))
         which--;
 
     if (verbose)
@@ -899,7 +1132,7 @@ static int output_from_reverse_data(ES_p es, WRITER output, int as_TS, int verbo
     for (uu = 0; uu < offset; uu++) {
         if (which > 1) {
             which--;
-            if (SEQUENCE_HEADER_ENTRY(reverse_data, which))
+            if (SEQUENCE_HEADER_ENTRY(Codec, reverse_data, which))
                 which--;
         }
         if (verbose)
@@ -928,7 +1161,7 @@ static int output_from_reverse_data(ES_p es, WRITER output, int as_TS, int verbo
         }
     }
 
-    if (is_h262) {
+    if constexpr (Codec::reverse_reads_pictures) {
         h262_picture_p picture;
         err = read_h262_picture(reverse_data->h262, start_posn, afd, verbose, &picture);
         if (err) {
@@ -964,10 +1197,7 @@ static int output_from_reverse_data(ES_p es, WRITER output, int as_TS, int verbo
 
     // And let our "outer" contexts know which picture that *is* in the
     // sequence of pictures
-    if (reverse_data->is_h264)
-        reverse_data->h264->access_unit_index = reverse_data->index[which];
-    else
-        reverse_data->h262->picture_index = reverse_data->index[which];
+    Codec::set_picture_index(Codec::reverse_context(reverse_data), reverse_data->index[which]);
 
     // Remember that we are now that bit further "back" in the reverse data
     // arrays, for when we come to move forwards again
@@ -1004,7 +1234,12 @@ int output_from_reverse_data_as_TS(ES_p es, TS_writer_p tswriter, int verbose, i
 {
     WRITER writer;
     writer.ts_output = tswriter;
-    return output_from_reverse_data(es, writer, true, verbose, quiet, offset, reverse_data);
+    if (reverse_data->is_h264)
+        return output_from_reverse_data<h264_traits>(
+            es, writer, true, verbose, quiet, offset, reverse_data);
+    else
+        return output_from_reverse_data<h262_traits>(
+            es, writer, true, verbose, quiet, offset, reverse_data);
 }
 
 /*
@@ -1034,7 +1269,12 @@ int output_from_reverse_data_as_ES(
 {
     WRITER writer;
     writer.es_output = output;
-    return output_from_reverse_data(es, writer, false, verbose, quiet, offset, reverse_data);
+    if (reverse_data->is_h264)
+        return output_from_reverse_data<h264_traits>(
+            es, writer, false, verbose, quiet, offset, reverse_data);
+    else
+        return output_from_reverse_data<h262_traits>(
+            es, writer, false, verbose, quiet, offset, reverse_data);
 }
 
 /*
@@ -1059,9 +1299,14 @@ int output_from_reverse_data_as_ES(
  *   pictures have been reversed past.
  * - `reverse_data` contains the list of pictures/access units to reverse.
  *
+ * `Codec` is the codec traits type for the data being reversed (see
+ * codec_traits.h), so that the choice between H.262 and H.264 is made once,
+ * by our caller, rather than for each picture.
+ *
  * Returns 0 if all went well, COMMAND_RETURN_CODE if the current "command"
  * has changed, or 1 if something went wrong.
  */
+template <typename Codec>
 static int output_in_reverse(ES_p es, WRITER output, int as_TS, int frequency, int verbose,
     int quiet, int32_t start_with, int max, reverse_data_p reverse_data)
 {
@@ -1073,7 +1318,6 @@ static int output_in_reverse(ES_p es, WRITER output, int as_TS, int frequency, i
     uint32_t last_seq_index = reverse_data->length; // impossible value
     int max_pic_index = reverse_data->length - 1;
     int first_actual_picture_index = 0; // the first *actual* picture
-    int is_h262 = !reverse_data->is_h264;
 
     uint32_t start_index;
     uint32_t final_index;
@@ -1095,7 +1339,7 @@ static int output_in_reverse(ES_p es, WRITER output, int as_TS, int frequency, i
     }
 
     // What's the earliest *actual* picture (not a sequence header)?
-    while (SEQUENCE_HEADER_ENTRY(reverse_data, first_actual_picture_index))
+    while (SEQUENCE_HEADER_ENTRY(Codec, reverse_data, first_actual_picture_index))
         first_actual_picture_index++;
 
     // Where did the user ask us to start?
@@ -1109,7 +1353,7 @@ static int output_in_reverse(ES_p es, WRITER output, int as_TS, int frequency, i
         start_index = start_with;
 
     // Check that's not a sequence header - if it is, go back one
-    while (start_index > 0 && SEQUENCE_HEADER_ENTRY(reverse_data, start_index))
+    while (start_index > 0 && SEQUENCE_HEADER_ENTRY(Codec, reverse_data, start_index))
         start_index--;
 
     // If that means there's nothing to output, then so be it
@@ -1171,7 +1415,7 @@ static int output_in_reverse(ES_p es, WRITER output, int as_TS, int frequency, i
                        "/%d, num bytes %d, seq offset %d\n",
                 ii, ii, index, start_posn.infile, start_posn.inpacket, num_bytes, seq_offset);
             print_err("    Ignoring item\n");
-        } else if (is_h262 && seq_offset == 0) {
+        } else if (Codec::has_sequence_headers && seq_offset == 0) {
             // Sequence headers get output (if at all) when their pictures
             // are written out
             if (verbose)
@@ -1192,7 +1436,7 @@ static int output_in_reverse(ES_p es, WRITER output, int as_TS, int frequency, i
                                " -> repeat = %d\n",
                         pictures_seen, pictures_wanted, reverse_data->pictures_written, repeat);
                 if (repeat > 0
-                    && ((is_h262 && picture != nullptr) || (!is_h262 && data != nullptr))) {
+                    && (Codec::reverse_reads_pictures ? picture != nullptr : data != nullptr)) {
                     int jj;
                     if (verbose) {
                         if (repeat == 1)
@@ -1201,7 +1445,7 @@ static int output_in_reverse(ES_p es, WRITER output, int as_TS, int frequency, i
                             fprint_msg(">> repeating last picture %d times\n", repeat);
                     }
                     for (jj = 0; jj < repeat; jj++) {
-                        if (is_h262)
+                        if constexpr (Codec::reverse_reads_pictures)
                             err = write_picture_data(output, as_TS, picture, reverse_data->pid);
                         else
                             err = write_packet_data(output, as_TS, data, last_num_bytes,
@@ -1258,7 +1502,7 @@ static int output_in_reverse(ES_p es, WRITER output, int as_TS, int frequency, i
                 fprint_msg("Writing picture [%03d] %4d from " OFFSET_T_FORMAT_08 "/%04d for %5d\n",
                     ii, index, start_posn.infile, start_posn.inpacket, num_bytes);
 
-            if (is_h262) {
+            if constexpr (Codec::reverse_reads_pictures) {
                 if (picture != nullptr)
                     free_h262_picture(&picture);
                 err = read_h262_picture(reverse_data->h262, start_posn, afd, verbose, &picture);
@@ -1300,10 +1544,7 @@ static int output_in_reverse(ES_p es, WRITER output, int as_TS, int frequency, i
 
             // And let our "outer" contexts know which picture that *is* in the
             // sequence of pictures
-            if (reverse_data->is_h264)
-                reverse_data->h264->access_unit_index = reverse_data->index[ii];
-            else
-                reverse_data->h262->picture_index = reverse_data->index[ii];
+            Codec::set_picture_index(Codec::reverse_context(reverse_data), reverse_data->index[ii]);
             // Remember that we are now that bit further "back" in the reverse data
             // arrays, for when we come to move forwards again
             // (we only do this for pictures that have actually been *read*, since
@@ -1362,8 +1603,12 @@ int output_in_reverse_as_TS(ES_p es, TS_writer_p tswriter, int frequency, int ve
 {
     WRITER writer;
     writer.ts_output = tswriter;
-    return output_in_reverse(
-        es, writer, true, frequency, verbose, quiet, start_with, max, reverse_data);
+    if (reverse_data->is_h264)
+        return output_in_reverse<h264_traits>(
+            es, writer, true, frequency, verbose, quiet, start_with, max, reverse_data);
+    else
+        return output_in_reverse<h262_traits>(
+            es, writer, true, frequency, verbose, quiet, start_with, max, reverse_data);
 }
 
 /*
@@ -1397,6 +1642,10 @@ int output_in_reverse_as_ES(ES_p es, FILE* output, int frequency, int verbose, i
 {
     WRITER writer;
     writer.es_output = output;
-    return output_in_reverse(
-        es, writer, false, frequency, verbose, quiet, start_with, max, reverse_data);
+    if (reverse_data->is_h264)
+        return output_in_reverse<h264_traits>(
+            es, writer, false, frequency, verbose, quiet, start_with, max, reverse_data);
+    else
+        return output_in_reverse<h262_traits>(
+            es, writer, false, frequency, verbose, quiet, start_with, max, reverse_data);
 }
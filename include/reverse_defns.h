@@ -28,6 +28,8 @@
 #ifndef _reverse_defns
 #define _reverse_defns
 
+#include <mutex>
+
 #include "compat.h"
 #include "es_defns.h"
 
@@ -35,6 +37,7 @@
 // *they* refer to reverse_data, we need to break the circular referencing
 // at some point
 typedef struct reverse_data* reverse_data_p;
+typedef struct reverse_indexer* reverse_indexer_p;
 #include "accessunit_defns.h"
 #include "h262_defns.h"
 
@@ -104,6 +107,10 @@ struct reverse_data {
     uint32_t pid;
     byte stream_id;
 
+    // If the input is also being indexed in the background (see below),
+    // then this is the indexer, otherwise nullptr
+    reverse_indexer_p indexer;
+
     // When a function (output_in_reverse_as_XX) is called to output
     // reversed data, some statistics are maintained by the call.
     // Despite saying "picture", these also apply to H.264 access units as well
@@ -123,6 +130,34 @@ struct reverse_data {
 #define REVERSE_ARRAY_START_SIZE 1000
 #define REVERSE_ARRAY_INCREMENT_SIZE 500
 
+// ------------------------------------------------------------
+// Building the reverse data in the background
+//
+// Left to itself, the reverse data only knows about the pictures that have
+// been read forwards. A reverse indexer reads the same input, with its own
+// ES reader and picture context, in a low priority thread, remembering
+// pictures in its own reverse data as it goes. Whoever is playing then
+// copies over the entries beyond its own (with
+// `update_from_reverse_indexer`), and can thus skip straight to pictures it
+// has not yet played. Since entries are always added in file order, the
+// entries that are copied are exactly the ones that would have been
+// remembered when playing that far, and playing forwards over them again
+// just checks them.
+struct reverse_indexer {
+    ES_p es; // The indexer's own view of the input (not ours to close)
+    h262_context_p h262; // Its picture context, for H.262
+    access_unit_context_p h264; // or for H.264
+    reverse_data_p reverse_data; // And what it has remembered so far
+
+    std::mutex lock; // Held whilst `reverse_data` is being extended or read
+    std::atomic<int> stopping; // Asks the thread to stop
+    std::atomic<int> finished; // The thread has reached the end of the input
+    std::thread thread;
+};
+
+// How much lower than normal a priority the indexer thread runs at
+#define REVERSE_INDEXER_NICENESS 10
+
 #endif // _reverse_defns
 
 // Local Variables:
@@ -80,6 +80,47 @@ int add_access_unit_reverse_context(access_unit_context_p context, reverse_data_
  * Sets `reverse_data` to nullptr.
  */
 void free_reverse_data(reverse_data_p* reverse_data);
+/*
+ * Start building reverse data for `reverse_data` in the background.
+ *
+ * - `reverse_data` is the reverse data used when playing the input
+ * - `es` is a second ES reader for the same input (and the same video
+ *   stream therein), positioned at its start. It is used only by the
+ *   indexer, but is not closed by it.
+ *
+ * Use `update_from_reverse_indexer` to copy over what the indexer has found.
+ * The indexer is stopped by `stop_reverse_indexer` or `free_reverse_data`,
+ * and `es` must not be closed until then.
+ *
+ * Returns 0 if all went well, 1 if something went wrong.
+ */
+int start_reverse_indexer(reverse_data_p reverse_data, ES_p es);
+/*
+ * Stop any reverse indexer for `reverse_data`, and free it.
+ *
+ * Entries already copied over from the indexer are kept.
+ */
+void stop_reverse_indexer(reverse_data_p reverse_data);
+/*
+ * Copy over any entries that the reverse indexer for `reverse_data` has
+ * found beyond those that `reverse_data` already has.
+ *
+ * Does nothing if there is no indexer. If the indexer's entries turn out
+ * not to match those in `reverse_data` (which should not happen), the
+ * indexer is stopped, and no longer used.
+ *
+ * Returns 0 if all went well, 1 if something went wrong.
+ */
+int update_from_reverse_indexer(reverse_data_p reverse_data);
+/*
+ * Find the first picture (not an H.262 sequence header) after the current
+ * position in the reverse data (i.e., after `last_posn_added`) whose
+ * picture index is at least `index`.
+ *
+ * Returns its position in the reverse data arrays, or -1 if there is no
+ * such picture (yet).
+ */
+int32_t find_reverse_data_picture(reverse_data_p reverse_data, uint32_t index);
 /*
  * Remember video sequence bounds for H.262 data
  *
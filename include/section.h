@@ -0,0 +1,426 @@
+#pragma once
+
+/*
+ * Demultiplexing PSI/SI sections from TS packets.
+ *
+ * This reassembles sections for any number of PIDs in a single pass over
+ * the packets, checks each one's CRC, and hands those that match the
+ * filters to their handlers, noting which are new versions.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "compat.h"
+#include "misc_fns.h"
+#include "printing_fns.h"
+#include "section_fns.h"
+
+// Version number (5 bits) that marks an empty slot in the version table
+#define SECTION_VERSION_EMPTY 0xFF
+
+/*
+ * Build a new section demultiplexer, with no filters.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int build_section_demux(section_demux_p* demux)
+{
+    section_demux_p new_demux = (section_demux_p)calloc(1, SIZEOF_SECTION_DEMUX);
+    if (new_demux == nullptr) {
+        print_err("### Unable to allocate section demultiplexer\n");
+        return 1;
+    }
+    new_demux->filters = (struct section_filter*)malloc(
+        SECTION_FILTERS_START_SIZE * sizeof(struct section_filter));
+    new_demux->versions = (struct section_version*)malloc(
+        SECTION_VERSIONS_START_SIZE * sizeof(struct section_version));
+    if (new_demux->filters == nullptr || new_demux->versions == nullptr) {
+        print_err("### Unable to allocate section demultiplexer tables\n");
+        free_section_demux(&new_demux);
+        return 1;
+    }
+    new_demux->filters_size = SECTION_FILTERS_START_SIZE;
+    new_demux->versions_size = SECTION_VERSIONS_START_SIZE;
+    reset_section_versions(new_demux);
+    *demux = new_demux;
+    return 0;
+}
+
+/*
+ * Free a section demultiplexer, and set `demux` to nullptr.
+ */
+void free_section_demux(section_demux_p* demux)
+{
+    section_demux_p old = *demux;
+    if (old == nullptr)
+        return;
+    for (int ii = 0; ii < old->num_assemblies; ii++)
+        free(old->assemblies[ii]);
+    free(old->assemblies);
+    free(old->filters);
+    free(old->versions);
+    free(old);
+    *demux = nullptr;
+}
+
+/*
+ * Find (or, if `create`, make) the assembly state for a PID
+ */
+static struct section_assembly* find_section_assembly(
+    section_demux_p demux, uint32_t pid, int create)
+{
+    for (int ii = 0; ii < demux->num_assemblies; ii++)
+        if (demux->assemblies[ii]->pid == pid)
+            return demux->assemblies[ii];
+    if (!create)
+        return nullptr;
+
+    struct section_assembly** new_list = (struct section_assembly**)realloc(
+        demux->assemblies, (demux->num_assemblies + 1) * sizeof(struct section_assembly*));
+    if (new_list == nullptr)
+        return nullptr;
+    demux->assemblies = new_list;
+    struct section_assembly* assembly
+        = (struct section_assembly*)malloc(sizeof(struct section_assembly));
+    if (assembly == nullptr)
+        return nullptr;
+    assembly->pid = pid;
+    assembly->data_len = 0;
+    demux->assemblies[demux->num_assemblies++] = assembly;
+    return assembly;
+}
+
+/*
+ * Add a filter to a section demultiplexer.
+ *
+ * - `pid` is the PID to look for sections on
+ * - a section matches if its table_id, masked by `table_id_mask`, is
+ *   `table_id` (likewise masked)
+ * - and, if `extension_mask` is non-zero, if it is a long section and its
+ *   table_id_extension, masked by `extension_mask`, is `extension`
+ *   (likewise masked)
+ * - `flags` is SECTION_FILTER_ALL_VERSIONS or SECTION_FILTER_NEW_VERSIONS
+ * - `handler` is called for each matching section, with `handler_arg`
+ *
+ * A section that matches more than one filter is passed to each in turn,
+ * in the order they were added.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int add_section_filter(section_demux_p demux, uint32_t pid, byte table_id, byte table_id_mask,
+    uint16_t extension, uint16_t extension_mask, int flags, section_handler_fn handler,
+    void* handler_arg)
+{
+    if (pid > 0x1FFF) {
+        fprint_err("### Cannot filter sections on PID %04x, which is out of range\n", pid);
+        return 1;
+    }
+    if (demux->num_filters == demux->filters_size) {
+        int new_size = demux->filters_size * 2;
+        struct section_filter* new_filters = (struct section_filter*)realloc(
+            demux->filters, new_size * sizeof(struct section_filter));
+        if (new_filters == nullptr) {
+            print_err("### Unable to extend section filter list\n");
+            return 1;
+        }
+        demux->filters = new_filters;
+        demux->filters_size = new_size;
+    }
+    if (find_section_assembly(demux, pid, true) == nullptr) {
+        print_err("### Unable to allocate section assembly buffer\n");
+        return 1;
+    }
+
+    struct section_filter* filter = &demux->filters[demux->num_filters++];
+    filter->pid = pid;
+    filter->table_id = table_id & table_id_mask;
+    filter->table_id_mask = table_id_mask;
+    filter->extension = extension & extension_mask;
+    filter->extension_mask = extension_mask;
+    filter->flags = flags;
+    filter->handler = handler;
+    filter->handler_arg = handler_arg;
+    demux->pid_wanted[pid >> 3] |= (byte)(1 << (pid & 7));
+    return 0;
+}
+
+/*
+ * Is the section demultiplexer interested in this PID?
+ */
+int section_demux_wants_pid(section_demux_p demux, uint32_t pid)
+{
+    return pid <= 0x1FFF && (demux->pid_wanted[pid >> 3] & (1 << (pid & 7))) != 0;
+}
+
+/*
+ * Forget all section versions seen so far, so that every section is
+ * treated as new again (for instance, after rewinding the input).
+ */
+void reset_section_versions(section_demux_p demux)
+{
+    for (int ii = 0; ii < demux->versions_size; ii++)
+        demux->versions[ii].version_number = SECTION_VERSION_EMPTY;
+    demux->num_versions = 0;
+}
+
+/*
+ * Find the slot for a given key in the version table
+ */
+static struct section_version* find_section_version(
+    struct section_version* versions, int versions_size, uint64_t key, uint32_t extra)
+{
+    uint64_t hash = (key ^ extra) * 0x9E3779B97F4A7C15ULL;
+    int index = (int)(hash >> 40) & (versions_size - 1);
+    for (;;) {
+        struct section_version* slot = &versions[index];
+        if (slot->version_number == SECTION_VERSION_EMPTY
+            || (slot->key == key && slot->extra == extra))
+            return slot;
+        index = (index + 1) & (versions_size - 1);
+    }
+}
+
+/*
+ * The shortest that a section with table id `table_id` can be, including
+ * its CRC (if it has one).
+ */
+static int min_section_length(byte table_id, int is_long)
+{
+    if (table_id >= 0x4E && table_id <= 0x6F)
+        return 18; // EIT: the long header, ids up to last_table_id, and CRC
+    else if (is_long)
+        return 12; // the long header and CRC
+    else if (table_id == 0x73)
+        return 14; // TOT: UTC time, descriptors_loop_length and CRC
+    return 3;
+}
+
+/*
+ * Note the version of a long section, which must be at least
+ * `min_section_length` bytes long.
+ *
+ * Returns 1 if it is new (or changed), 0 if we have seen it before,
+ * and -1 if something went wrong.
+ */
+static int note_section_version(section_demux_p demux, uint32_t pid, byte* section)
+{
+    uint16_t extension = (section[3] << 8) | section[4];
+    byte version_number = (section[5] & 0x3E) >> 1;
+    byte section_number = section[6];
+    byte table_id = section[0];
+    uint64_t key = ((uint64_t)pid << 32) | ((uint32_t)table_id << 24)
+        | ((uint32_t)extension << 8) | section_number;
+    // An EIT is only identified by its service_id *and* its transport
+    // stream and original network ids
+    uint32_t extra = 0;
+    if (table_id >= 0x4E && table_id <= 0x6F)
+        extra = ((uint32_t)section[8] << 24) | (section[9] << 16) | (section[10] << 8)
+            | section[11];
+
+    struct section_version* slot
+        = find_section_version(demux->versions, demux->versions_size, key, extra);
+    if (slot->version_number == version_number)
+        return 0;
+    if (slot->version_number != SECTION_VERSION_EMPTY) {
+        slot->version_number = version_number;
+        return 1;
+    }
+
+    // A new entry. Keep the table no more than half full.
+    if ((demux->num_versions + 1) * 2 > demux->versions_size) {
+        int new_size = demux->versions_size * 2;
+        struct section_version* new_versions
+            = (struct section_version*)malloc(new_size * sizeof(struct section_version));
+        if (new_versions == nullptr) {
+            print_err("### Unable to extend section version table\n");
+            return -1;
+        }
+        for (int ii = 0; ii < new_size; ii++)
+            new_versions[ii].version_number = SECTION_VERSION_EMPTY;
+        for (int ii = 0; ii < demux->versions_size; ii++) {
+            struct section_version* old = &demux->versions[ii];
+            if (old->version_number != SECTION_VERSION_EMPTY)
+                *find_section_version(new_versions, new_size, old->key, old->extra) = *old;
+        }
+        free(demux->versions);
+        demux->versions = new_versions;
+        demux->versions_size = new_size;
+        slot = find_section_version(demux->versions, demux->versions_size, key, extra);
+    }
+    slot->key = key;
+    slot->extra = extra;
+    slot->version_number = version_number;
+    demux->num_versions++;
+    return 1;
+}
+
+/*
+ * Check a complete section, and pass it to whichever filters want it
+ */
+static int dispatch_section(section_demux_p demux, uint32_t pid, byte* section, int section_len)
+{
+    int is_long = (section[1] & 0x80) != 0;
+    byte table_id = section[0];
+
+    // Long sections, and the TOT (which is short but still has one) end
+    // with a CRC, which self-cancels if all is well
+    if (section_len < min_section_length(table_id, is_long)) {
+        demux->num_broken++;
+        return 0;
+    }
+    if (is_long || table_id == 0x73) {
+        if (crc32_block(0xffffffff, section, section_len) != 0) {
+            demux->num_crc_errors++;
+            return 0;
+        }
+    }
+    demux->num_sections++;
+
+    int new_version = -2; // i.e., not yet worked out
+    uint16_t extension = is_long ? (section[3] << 8) | section[4] : 0;
+    for (int ii = 0; ii < demux->num_filters; ii++) {
+        struct section_filter* filter = &demux->filters[ii];
+        if (filter->pid != pid || (table_id & filter->table_id_mask) != filter->table_id)
+            continue;
+        if (filter->extension_mask != 0
+            && (!is_long || (extension & filter->extension_mask) != filter->extension))
+            continue;
+        if (new_version == -2) {
+            new_version = is_long ? note_section_version(demux, pid, section) : 1;
+            if (new_version < 0)
+                return 1;
+        }
+        if ((filter->flags & SECTION_FILTER_NEW_VERSIONS) && !new_version)
+            continue;
+        int err = filter->handler(filter->handler_arg, pid, section, section_len, new_version);
+        if (err)
+            return err;
+    }
+    return 0;
+}
+
+/*
+ * Add (up to `len`) bytes to the section being assembled, dispatching it
+ * if it is completed.
+ *
+ * Returns the number of bytes used (or -1 if a handler failed).
+ */
+static int add_section_bytes(
+    section_demux_p demux, struct section_assembly* assembly, byte* data, int len)
+{
+    int used = 0;
+    for (;;) {
+        int want = 3; // until we know the section_length
+        if (assembly->data_len >= 3) {
+            want = 3 + (((assembly->data[1] & 0x0F) << 8) | assembly->data[2]);
+            if (want > MAX_SECTION_SIZE) {
+                // Not something we can believe in -- drop it (and the rest
+                // of this packet's payload with it)
+                demux->num_broken++;
+                assembly->data_len = 0;
+                return len;
+            }
+            if (assembly->data_len == want) {
+                assembly->data_len = 0;
+                if (dispatch_section(demux, assembly->pid, assembly->data, want))
+                    return -1;
+                break;
+            }
+        }
+        if (used == len)
+            break;
+        int count = min(want - assembly->data_len, len - used);
+        memcpy(assembly->data + assembly->data_len, data + used, count);
+        assembly->data_len += count;
+        used += count;
+    }
+    return used;
+}
+
+/*
+ * Give the payload of a TS packet to a section demultiplexer.
+ *
+ * - `pid` is the TS packet's PID. Packets for PIDs that no filter is
+ *   interested in are ignored.
+ * - `pusi` is its payload_unit_start_indicator
+ * - `payload` is its payload, and `payload_len` the length thereof
+ *
+ * Any sections completed by this packet are passed to the handlers of
+ * the filters they match.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong (including if
+ * a handler returns an error).
+ */
+int section_demux_packet(
+    section_demux_p demux, uint32_t pid, int pusi, byte* payload, int payload_len)
+{
+    if (!section_demux_wants_pid(demux, pid) || payload == nullptr || payload_len < 1)
+        return 0;
+    struct section_assembly* assembly = find_section_assembly(demux, pid, false);
+    if (assembly == nullptr)
+        return 0;
+
+    if (!pusi) {
+        // A continuation of whatever we were assembling (if anything). No
+        // new section may start in this packet, so anything after the end
+        // of the current section is stuffing.
+        if (assembly->data_len > 0 && add_section_bytes(demux, assembly, payload, payload_len) < 0)
+            return 1;
+        return 0;
+    }
+
+    int pointer = payload[0];
+    byte* data = payload + 1;
+    int len = payload_len - 1;
+    if (pointer > len) {
+        demux->num_broken++;
+        assembly->data_len = 0;
+        return 0;
+    }
+    // The bytes before the pointer finish the previous section
+    if (assembly->data_len > 0) {
+        int used = add_section_bytes(demux, assembly, data, pointer);
+        if (used < 0)
+            return 1;
+        if (assembly->data_len > 0) {
+            demux->num_broken++;
+            assembly->data_len = 0;
+        }
+    }
+    data += pointer;
+    len -= pointer;
+
+    // And then there may be any number of sections, possibly followed by
+    // stuffing, and the last of which may continue into the next packet
+    while (len > 0 && data[0] != 0xFF) {
+        int used = add_section_bytes(demux, assembly, data, len);
+        if (used < 0)
+            return 1;
+        data += used;
+        len -= used;
+        if (assembly->data_len > 0)
+            break;
+    }
+    return 0;
+}
+
+/*
+ * Report the statistics of a section demultiplexer.
+ *
+ * - if `is_msg` then print as a message, otherwise as an error
+ */
+void report_section_demux(int is_msg, section_demux_p demux)
+{
+    fprint_msg_or_err(is_msg, "Sections: %u good, %u with bad CRC, %u broken, %d versions seen\n",
+        demux->num_sections, demux->num_crc_errors, demux->num_broken, demux->num_versions);
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,100 @@
+/*
+ * Datastructures for demultiplexing PSI/SI sections from TS packets
+ *
+ * A section demultiplexer reassembles sections (which may span several TS
+ * packets, and of which there may be several in one TS packet) for any
+ * number of PIDs at once, checks their CRCs, and passes those that match
+ * its filters on to the appropriate handler.
+ *
+ */
+
+#ifndef _section_defns
+#define _section_defns
+
+#include "compat.h"
+
+// The most a (private) section may be, including its three byte header
+#define MAX_SECTION_SIZE 4096
+
+// Flags for a section filter
+#define SECTION_FILTER_ALL_VERSIONS 0 // Pass on every (good) section
+#define SECTION_FILTER_NEW_VERSIONS 1 // Only pass on sections whose version
+                                      // has not been seen before
+
+/*
+ * A section handler is called with each complete section that matches a
+ * filter.
+ *
+ * - `arg` is the argument given when the filter was added
+ * - `pid` is the PID the section came from
+ * - `section` is the section data, starting with its table_id, and
+ *   `section_len` is its length (including any CRC)
+ * - `new_version` is true if this section (as identified by PID, table_id,
+ *   table_id_extension and section_number) has not been seen before, or
+ *   has changed its version_number. It is always true for short sections
+ *   (those without a version_number).
+ *
+ * It should return 0 if all goes well, 1 if something goes wrong (in which
+ * case demultiplexing stops and that error is returned).
+ */
+typedef int (*section_handler_fn)(
+    void* arg, uint32_t pid, byte* section, int section_len, int new_version);
+
+struct section_filter {
+    uint32_t pid;
+    byte table_id; // The section's table_id must match this
+    byte table_id_mask; // in the bits set here
+    uint16_t extension; // and (for long sections) its table_id_extension
+    uint16_t extension_mask; // this, in the bits set here
+    int flags; // SECTION_FILTER_xxx
+    section_handler_fn handler;
+    void* handler_arg;
+};
+
+// Where we are in reassembling a section on a particular PID
+struct section_assembly {
+    uint32_t pid;
+    byte data[MAX_SECTION_SIZE];
+    int data_len; // How much we have so far (0 if not within a section)
+};
+
+// The last version seen of a particular section
+struct section_version {
+    uint64_t key; // PID, table_id, table_id_extension, section_number
+    uint32_t extra; // For EIT, transport_stream_id and original_network_id
+    byte version_number;
+};
+
+struct section_demux {
+    byte pid_wanted[0x2000 / 8]; // A bit for each PID we have a filter for
+
+    struct section_filter* filters;
+    int num_filters;
+    int filters_size;
+
+    struct section_assembly** assemblies; // One for each PID filtered
+    int num_assemblies;
+
+    struct section_version* versions; // Open hash table
+    int num_versions;
+    int versions_size; // Always a power of two
+
+    // Statistics
+    uint32_t num_sections; // Complete sections with good CRC
+    uint32_t num_crc_errors; // Complete sections with bad CRC (ignored)
+    uint32_t num_broken; // Sections abandoned part way through, or too short
+};
+typedef struct section_demux* section_demux_p;
+#define SIZEOF_SECTION_DEMUX sizeof(struct section_demux)
+
+#define SECTION_FILTERS_START_SIZE 8
+#define SECTION_VERSIONS_START_SIZE 256
+
+#endif // _section_defns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,81 @@
+/*
+ * Functions for demultiplexing PSI/SI sections from TS packets
+ *
+ */
+
+#ifndef _section_fns
+#define _section_fns
+
+#include "compat.h"
+#include "section_defns.h"
+
+/*
+ * Build a new section demultiplexer, with no filters.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int build_section_demux(section_demux_p* demux);
+/*
+ * Free a section demultiplexer, and set `demux` to nullptr.
+ */
+void free_section_demux(section_demux_p* demux);
+/*
+ * Add a filter to a section demultiplexer.
+ *
+ * - `pid` is the PID to look for sections on
+ * - a section matches if its table_id, masked by `table_id_mask`, is
+ *   `table_id` (likewise masked)
+ * - and, if `extension_mask` is non-zero, if it is a long section and its
+ *   table_id_extension, masked by `extension_mask`, is `extension`
+ *   (likewise masked)
+ * - `flags` is SECTION_FILTER_ALL_VERSIONS or SECTION_FILTER_NEW_VERSIONS
+ * - `handler` is called for each matching section, with `handler_arg`
+ *
+ * A section that matches more than one filter is passed to each in turn,
+ * in the order they were added.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int add_section_filter(section_demux_p demux, uint32_t pid, byte table_id, byte table_id_mask,
+    uint16_t extension, uint16_t extension_mask, int flags, section_handler_fn handler,
+    void* handler_arg);
+/*
+ * Is the section demultiplexer interested in this PID?
+ */
+int section_demux_wants_pid(section_demux_p demux, uint32_t pid);
+/*
+ * Give the payload of a TS packet to a section demultiplexer.
+ *
+ * - `pid` is the TS packet's PID. Packets for PIDs that no filter is
+ *   interested in are ignored.
+ * - `pusi` is its payload_unit_start_indicator
+ * - `payload` is its payload, and `payload_len` the length thereof
+ *
+ * Any sections completed by this packet are passed to the handlers of
+ * the filters they match.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong (including if
+ * a handler returns an error).
+ */
+int section_demux_packet(
+    section_demux_p demux, uint32_t pid, int pusi, byte* payload, int payload_len);
+/*
+ * Forget all section versions seen so far, so that every section is
+ * treated as new again (for instance, after rewinding the input).
+ */
+void reset_section_versions(section_demux_p demux);
+/*
+ * Report the statistics of a section demultiplexer.
+ *
+ * - if `is_msg` then print as a message, otherwise as an error
+ */
+void report_section_demux(int is_msg, section_demux_p demux);
+
+#endif // _section_fns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,574 @@
+#pragma once
+
+/*
+ * Passing TS data between local programs through a ring buffer in shared
+ * memory.
+ *
+ */
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "compat.h"
+#include "misc_fns.h"
+#include "printing_fns.h"
+#include "shmring_fns.h"
+
+// The ring's data starts this far into the shared memory, after the header
+#define SHM_RING_DATA_OFFSET 4096
+
+static_assert(sizeof(struct shm_ring_header) <= SHM_RING_DATA_OFFSET,
+    "shared memory ring header is too big");
+static_assert(std::atomic<uint64_t>::is_always_lock_free
+        && sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+    "shared memory ring needs lock free atomics");
+
+// The shared memory input (if any) for each file descriptor
+static std::atomic<shm_ring_p> shm_inputs[SHM_MAX_FILES];
+
+/*
+ * Does a name mean a shared memory ring (i.e., does it start "shm:")?
+ */
+int is_shm_name(const char* name)
+{
+    return name != nullptr && !strncmp(name, SHM_NAME_PREFIX, SHM_NAME_PREFIX_LEN);
+}
+
+/*
+ * Sleep until `word` is changed from `seen` (by `shm_wake`), or for
+ * SHM_RING_WAIT_MS, whichever is sooner.
+ */
+static void shm_wait(std::atomic<uint32_t>* word, uint32_t seen)
+{
+    struct timespec timeout = { 0, SHM_RING_WAIT_MS * 1000000L };
+    // Not FUTEX_PRIVATE_FLAG, since the other end is another process
+    (void)syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, seen, &timeout,
+        nullptr, 0);
+}
+
+/*
+ * Wake whoever is waiting on `word`.
+ */
+static void shm_wake(std::atomic<uint32_t>* word)
+{
+    word->fetch_add(1);
+    (void)syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, nullptr,
+        nullptr, 0);
+}
+
+/*
+ * Is the process at one end of a ring still there?
+ */
+static int shm_process_alive(int32_t pid)
+{
+    return pid != 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+/*
+ * Make a new ring datastructure (not yet connected to anything).
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int build_shm_ring(const char* name, int for_write, shm_ring_p* ring)
+{
+    const char* object = name + SHM_NAME_PREFIX_LEN;
+    shm_ring_p new2;
+
+    if (object[0] == '\0' || strchr(object, '/') != nullptr) {
+        fprint_err("### Shared memory name '%s' should be '" SHM_NAME_PREFIX "<name>', with no"
+                   " '/' in the <name>\n",
+            name);
+        return 1;
+    }
+    new2 = (shm_ring_p)calloc(1, sizeof(*new2));
+    if (new2 == nullptr) {
+        print_err("### Unable to allocate shared memory ring datastructure\n");
+        return 1;
+    }
+    new2->name = (char*)malloc(strlen(object) + 2);
+    if (new2->name == nullptr) {
+        print_err("### Unable to allocate shared memory ring datastructure\n");
+        free(new2);
+        return 1;
+    }
+    sprintf(new2->name, "/%s", object);
+    new2->file = -1;
+    new2->for_write = for_write;
+    *ring = new2;
+    return 0;
+}
+
+/*
+ * Unmap, close and free a ring datastructure. Sets `ring` to nullptr.
+ */
+static void free_shm_ring(shm_ring_p* ring)
+{
+    if (*ring == nullptr)
+        return;
+    if ((*ring)->header != nullptr)
+        (void)munmap((*ring)->header, (*ring)->map_size);
+    if ((*ring)->for_write && (*ring)->file != -1)
+        (void)close((*ring)->file); // a reader's file is closed by `close_file`
+    free((*ring)->name);
+    free(*ring);
+    *ring = nullptr;
+}
+
+/*
+ * Map a ring's shared memory, whose header says how big it is.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int map_shm_ring(shm_ring_p ring)
+{
+    size_t map_size = SHM_RING_DATA_OFFSET + (size_t)ring->header->size;
+
+    (void)munmap(ring->header, ring->map_size);
+    ring->header = (struct shm_ring_header*)mmap(
+        nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->file, 0);
+    if (ring->header == MAP_FAILED) {
+        fprint_err("### Unable to map shared memory %s: %s\n", ring->name, strerror(errno));
+        ring->header = nullptr;
+        return 1;
+    }
+    ring->map_size = map_size;
+    ring->size = ring->header->size;
+    ring->data = (byte*)ring->header + SHM_RING_DATA_OFFSET;
+    return 0;
+}
+
+/*
+ * Map just the header of a ring's shared memory.
+ *
+ * Returns 0 if all goes well, 1 if the shared memory is not (yet) big
+ * enough to have a header, or something else goes wrong.
+ */
+static int map_shm_ring_header(shm_ring_p ring)
+{
+    struct stat statbuf;
+    if (fstat(ring->file, &statbuf) || statbuf.st_size < SHM_RING_DATA_OFFSET)
+        return 1;
+    ring->header = (struct shm_ring_header*)mmap(
+        nullptr, SHM_RING_DATA_OFFSET, PROT_READ | PROT_WRITE, MAP_SHARED, ring->file, 0);
+    if (ring->header == MAP_FAILED) {
+        ring->header = nullptr;
+        return 1;
+    }
+    ring->map_size = SHM_RING_DATA_OFFSET;
+    return 0;
+}
+
+/*
+ * Remove a ring's name, unless it has been reused for a newer ring.
+ */
+static void unlink_shm_ring(shm_ring_p ring)
+{
+    struct stat ours, named;
+    int file = shm_open(ring->name, O_RDONLY, 0);
+    if (file == -1)
+        return; // someone else got there first
+    if (!fstat(ring->file, &ours) && !fstat(file, &named) && ours.st_ino == named.st_ino
+        && ours.st_dev == named.st_dev)
+        (void)shm_unlink(ring->name);
+    (void)close(file);
+}
+
+/*
+ * Copy data into or out of the ring, at `posn` in the data, allowing for it
+ * going round the end.
+ */
+static inline void shm_copy(shm_ring_p ring, uint64_t posn, byte* data, size_t len, int into)
+{
+    size_t start = (size_t)(posn % ring->size);
+    size_t first = (len < ring->size - start ? len : (size_t)(ring->size - start));
+    if (into) {
+        memcpy(ring->data + start, data, first);
+        memcpy(ring->data, data + first, len - first);
+    } else {
+        memcpy(data, ring->data + start, first);
+        memcpy(data + first, ring->data, len - first);
+    }
+}
+
+// ============================================================
+// Writing
+// ============================================================
+/*
+ * Create a shared memory ring to write to.
+ *
+ * - `name` is its name, starting "shm:"
+ * - `ring` is the new ring, which should be closed with `close_shm_output`
+ *
+ * If a ring of that name already exists, but its writer has gone, it is
+ * replaced. If its writer is still running, that is an error.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int open_shm_output(const char* name, shm_ring_p* ring)
+{
+    shm_ring_p new2;
+    struct shm_ring_header* header;
+    int err = build_shm_ring(name, true, &new2);
+    if (err)
+        return 1;
+
+    for (;;) {
+        new2->file = shm_open(new2->name, O_RDWR | O_CREAT | O_EXCL, 0666);
+        if (new2->file != -1)
+            break;
+        else if (errno != EEXIST) {
+            fprint_err("### Unable to create shared memory %s: %s\n", name, strerror(errno));
+            free_shm_ring(&new2);
+            return 1;
+        }
+
+        // There's one already - is it still being written?
+        new2->file = shm_open(new2->name, O_RDWR, 0);
+        if (new2->file != -1 && !map_shm_ring_header(new2)) {
+            int busy = (new2->header->magic.load() == SHM_RING_MAGIC
+                && !new2->header->writer_closed.load()
+                && shm_process_alive(new2->header->writer_pid.load()));
+            (void)munmap(new2->header, new2->map_size);
+            new2->header = nullptr;
+            if (busy) {
+                fprint_err("### Shared memory %s is already being written to\n", name);
+                free_shm_ring(&new2);
+                return 1;
+            }
+        }
+        if (new2->file != -1)
+            (void)close(new2->file);
+        // It's left over from before, so replace it
+        (void)shm_unlink(new2->name);
+    }
+
+    if (ftruncate(new2->file, SHM_RING_DATA_OFFSET + SHM_RING_SIZE)) {
+        fprint_err("### Unable to size shared memory %s: %s\n", name, strerror(errno));
+        (void)shm_unlink(new2->name);
+        free_shm_ring(&new2);
+        return 1;
+    }
+    // Map the header first, so that we can say how big the rest is
+    err = map_shm_ring_header(new2);
+    if (!err) {
+        header = new2->header;
+        header->header_size = sizeof(struct shm_ring_header);
+        header->size = SHM_RING_SIZE;
+        header->writer_pid.store(getpid());
+        err = map_shm_ring(new2);
+    }
+    if (err) {
+        fprint_err("### Unable to map shared memory %s\n", name);
+        (void)shm_unlink(new2->name);
+        free_shm_ring(&new2);
+        return 1;
+    }
+    // And now a reader may use it
+    new2->header->magic.store(SHM_RING_MAGIC, std::memory_order_release);
+    *ring = new2;
+    return 0;
+}
+
+/*
+ * Write data to a shared memory ring.
+ *
+ * Waits for room in the ring if it is full.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong (including the
+ * reader having gone away).
+ */
+int write_shm_output(shm_ring_p ring, const byte* data, size_t data_len)
+{
+    struct shm_ring_header* header = ring->header;
+
+    while (data_len > 0) {
+        uint64_t tail = header->tail.load(std::memory_order_acquire);
+        uint64_t room = ring->size - (ring->posn - tail);
+        size_t count;
+
+        if (header->reader_closed.load()) {
+            fprint_err("### Reader of shared memory %s has gone away\n", ring->name + 1);
+            return 1;
+        } else if (room == 0) {
+            // Wait until there's a reasonable amount of room
+            uint32_t seen = header->tail_futex.load();
+            uint64_t wake = (ring->size < SHM_RING_WAKE_SIZE ? ring->size : SHM_RING_WAKE_SIZE);
+            header->writer_wants.store(ring->posn - ring->size + wake);
+            if (header->tail.load() == tail) {
+                int32_t pid = header->reader_pid.load();
+                shm_wait(&header->tail_futex, seen);
+                if (pid != 0 && !shm_process_alive(pid) && header->tail.load() == tail) {
+                    fprint_err("### Reader of shared memory %s has gone away without closing it\n",
+                        ring->name + 1);
+                    return 1;
+                }
+            }
+            header->writer_wants.store(0);
+            continue;
+        }
+
+        count = (data_len < room ? data_len : (size_t)room);
+        shm_copy(ring, ring->posn, (byte*)data, count, true);
+        ring->posn += count;
+        header->head.store(ring->posn);
+        data += count;
+        data_len -= count;
+
+        uint64_t wants = header->reader_wants.load();
+        if (wants != 0 && ring->posn >= wants
+            && header->reader_wants.compare_exchange_strong(wants, 0))
+            shm_wake(&header->head_futex);
+    }
+    return 0;
+}
+
+/*
+ * Close a shared memory ring that we were writing to, so that its reader
+ * gets end-of-file once it has read what is left. Sets `ring` to nullptr.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int close_shm_output(shm_ring_p* ring)
+{
+    if (*ring == nullptr)
+        return 0;
+    (*ring)->header->writer_closed.store(true);
+    shm_wake(&(*ring)->header->head_futex);
+    // If there is no reader (yet), leave the data for one
+    if ((*ring)->header->reader_closed.load())
+        unlink_shm_ring(*ring);
+    free_shm_ring(ring);
+    return 0;
+}
+
+// ============================================================
+// Reading
+// ============================================================
+/*
+ * If a file descriptor is for a shared memory ring we are reading from,
+ * return the ring, otherwise nullptr.
+ */
+shm_ring_p get_shm_input(int filedes)
+{
+    if (filedes < 0 || filedes >= SHM_MAX_FILES)
+        return nullptr;
+    return shm_inputs[filedes].load(std::memory_order_acquire);
+}
+
+/*
+ * Is a file descriptor for a shared memory ring we are reading from?
+ */
+int is_shm_file(int filedes)
+{
+    return get_shm_input(filedes) != nullptr;
+}
+
+/*
+ * Open a shared memory ring to read from, waiting for its writer to create
+ * it if necessary.
+ *
+ * - `name` is its name, starting "shm:"
+ *
+ * Returns the file descriptor, or -1 if something goes wrong.
+ */
+int open_shm_input(const char* name)
+{
+    shm_ring_p new2;
+    int32_t reader;
+    int err = build_shm_ring(name, false, &new2);
+    if (err)
+        return -1;
+
+    for (;;) {
+        new2->file = shm_open(new2->name, O_RDWR, 0);
+        if (new2->file == -1 && errno != ENOENT) {
+            fprint_err("### Unable to open shared memory %s: %s\n", name, strerror(errno));
+            free_shm_ring(&new2);
+            return -1;
+        } else if (new2->file != -1 && !map_shm_ring_header(new2)) {
+            if (new2->header->magic.load(std::memory_order_acquire) == SHM_RING_MAGIC)
+                break;
+            (void)munmap(new2->header, new2->map_size);
+            new2->header = nullptr;
+        }
+        // Either there's no writer yet, or it's still setting up
+        if (new2->file != -1)
+            (void)close(new2->file);
+        usleep(SHM_RING_WAIT_MS * 1000);
+    }
+
+    if (new2->file >= SHM_MAX_FILES) {
+        fprint_err("### Too many files open to read shared memory %s\n", name);
+        err = 1;
+    } else if (new2->header->header_size != sizeof(struct shm_ring_header)) {
+        fprint_err("### Shared memory %s was set up by an incompatible program\n", name);
+        err = 1;
+    }
+    reader = new2->header->reader_pid.load();
+    if (!err && shm_process_alive(reader)) {
+        fprint_err("### Shared memory %s is already being read from\n", name);
+        err = 1;
+    }
+    if (!err && !new2->header->reader_pid.compare_exchange_strong(reader, getpid())) {
+        fprint_err("### Shared memory %s is already being read from\n", name);
+        err = 1;
+    }
+    if (!err)
+        err = map_shm_ring(new2);
+    if (err) {
+        (void)close(new2->file);
+        free_shm_ring(&new2);
+        return -1;
+    }
+    new2->posn = new2->header->tail.load();
+    shm_inputs[new2->file].store(new2, std::memory_order_release);
+    return new2->file;
+}
+
+/*
+ * Hand the data we've read back to the writer, except that we keep the
+ * start of the data until we've read past it, in case we're asked to go
+ * back to the start.
+ */
+static void release_shm_input(shm_ring_p ring)
+{
+    struct shm_ring_header* header = ring->header;
+    uint64_t tail = header->tail.load(std::memory_order_relaxed);
+
+    if (ring->posn < SHM_RING_REWIND_SIZE || ring->posn <= tail)
+        return;
+    header->tail.store(ring->posn);
+    uint64_t wants = header->writer_wants.load();
+    if (wants != 0 && ring->posn >= wants && header->writer_wants.compare_exchange_strong(wants, 0))
+        shm_wake(&header->tail_futex);
+}
+
+/*
+ * Wait until there is some data to read.
+ *
+ * Returns how much there is, or 0 at end-of-file.
+ */
+static uint64_t wait_for_shm_input(shm_ring_p ring)
+{
+    struct shm_ring_header* header = ring->header;
+
+    for (;;) {
+        uint64_t head = header->head.load(std::memory_order_acquire);
+        if (head > ring->posn)
+            return head - ring->posn;
+        if (header->writer_closed.load(std::memory_order_acquire)) {
+            head = header->head.load(std::memory_order_acquire);
+            return head - ring->posn;
+        }
+
+        // Wait until there's a reasonable amount to read
+        uint32_t seen = header->head_futex.load();
+        header->reader_wants.store(ring->posn + SHM_RING_WAKE_SIZE);
+        if (header->head.load() == head && !header->writer_closed.load()) {
+            shm_wait(&header->head_futex, seen);
+            if (!shm_process_alive(header->writer_pid.load()) && header->head.load() == head
+                && !header->writer_closed.load()) {
+                if (!ring->said_gone)
+                    fprint_err("!!! Writer of shared memory %s went away without closing it\n",
+                        ring->name + 1);
+                ring->said_gone = true;
+                header->reader_wants.store(0);
+                return 0;
+            }
+        }
+        header->reader_wants.store(0);
+    }
+}
+
+/*
+ * Read data from a shared memory ring.
+ *
+ * This is the equivalent of `read` for a shared memory input: it waits until
+ * there is some data, and then returns as much as it can.
+ *
+ * Returns the number of bytes read, 0 at end-of-file, or -1 if something
+ * goes wrong (in which case a message will already have been output).
+ */
+ssize_t read_shm_input(shm_ring_p ring, byte* data, size_t num_bytes)
+{
+    uint64_t available;
+
+    if (num_bytes == 0)
+        return 0;
+    available = wait_for_shm_input(ring);
+    if (available == 0)
+        return 0;
+    if (available > num_bytes)
+        available = num_bytes;
+    shm_copy(ring, ring->posn, data, (size_t)available, false);
+    ring->posn += available;
+    release_shm_input(ring);
+    return (ssize_t)available;
+}
+
+/*
+ * Move to a new position in the data from a shared memory ring.
+ *
+ * Moving forwards waits for (and discards) the data in between.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int seek_shm_input(shm_ring_p ring, offset_t posn)
+{
+    if (posn < 0 || (uint64_t)posn < ring->header->tail.load()) {
+        fprint_err("### Cannot move back to " OFFSET_T_FORMAT " in shared memory %s, as that"
+                   " data has been passed back to the writer\n",
+            posn, ring->name + 1);
+        return 1;
+    }
+    while (ring->posn < (uint64_t)posn) {
+        uint64_t available = wait_for_shm_input(ring);
+        if (available == 0) {
+            fprint_err("### Cannot move to " OFFSET_T_FORMAT " in shared memory %s, as the"
+                       " data ends at " OFFSET_T_FORMAT "\n",
+                posn, ring->name + 1, (offset_t)ring->posn);
+            return 1;
+        }
+        if (available > (uint64_t)posn - ring->posn)
+            available = (uint64_t)posn - ring->posn;
+        ring->posn += available;
+        release_shm_input(ring);
+    }
+    ring->posn = (uint64_t)posn;
+    return 0;
+}
+
+/*
+ * Stop reading from a shared memory ring, because its file descriptor is
+ * about to be closed. This removes the ring.
+ *
+ * Does nothing if the file is not a shared memory ring we are reading from.
+ */
+void finish_shm_input(int filedes)
+{
+    shm_ring_p ring = get_shm_input(filedes);
+    if (ring == nullptr)
+        return;
+    shm_inputs[filedes].store(nullptr, std::memory_order_release);
+    ring->header->reader_closed.store(true);
+    shm_wake(&ring->header->tail_futex);
+    unlink_shm_ring(ring);
+    free_shm_ring(&ring);
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
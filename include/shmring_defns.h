@@ -0,0 +1,104 @@
+/*
+ * Datastructures for passing TS data between local programs through a ring
+ * buffer in shared memory
+ *
+ * Naming a file "shm:<name>" (as TS output, or as input) connects one
+ * writer and one reader through a named POSIX shared memory object
+ * (/dev/shm/<name>) holding a ring buffer, rather than through a pipe or a
+ * socket. Data is copied into the ring by the writer and out of it by the
+ * reader, with no system calls at all whilst neither of them has to wait.
+ * When one does (because the ring is empty, or full), it sleeps on a futex
+ * in the shared memory, and the other wakes it once there is a reasonable
+ * amount to do.
+ *
+ * - The writer creates the ring. A reader that starts first waits for it.
+ * - The writer blocks when the ring is full, so a slow reader slows it down,
+ *   and fails if the reader goes away (as with a broken pipe).
+ * - When the writer closes the ring, the reader reads what is left and then
+ *   gets end-of-file. If the writer goes away without closing it, the
+ *   reader gets end-of-file as well, but complains.
+ * - The ring is removed when the reader closes it, or when the writer
+ *   closes it if the reader has already gone. So if the writer finishes
+ *   before a reader arrives, the data waits for one.
+ *
+ */
+
+#ifndef _shmring_defns
+#define _shmring_defns
+
+#include <atomic>
+#include <sys/types.h>
+
+#include "compat.h"
+
+// What a name must start with to mean a shared memory ring
+#define SHM_NAME_PREFIX "shm:"
+#define SHM_NAME_PREFIX_LEN 4
+
+// Identifies (the version of) our layout of the shared memory
+#define SHM_RING_MAGIC 0x54534D31 // "TSM1"
+
+// How much data the ring holds
+#define SHM_RING_SIZE (16 * 1024 * 1024)
+// A waiting writer or reader is woken when there is this much room or data
+// for it (or when the other end closes)...
+#define SHM_RING_WAKE_SIZE (64 * 1024)
+// ...and otherwise wakes up this often, to see if it can get on anyway
+#define SHM_RING_WAIT_MS 10
+// The reader keeps this much of the start of the data until it has read
+// past it, so that it can go back to the start after probing what it is
+// (this is DEFAULT_PROBE_SIZE)
+#define SHM_RING_REWIND_SIZE (4 * 1024 * 1024)
+// We can only recognise shared memory input on file descriptors less than this
+#define SHM_MAX_FILES 1024
+
+// The start of the shared memory. The ring's data follows it.
+//
+// `head` and `tail` count bytes since the ring was created, so the data
+// between them is at `head % size` and `tail % size` in the ring. They are
+// kept on separate cache lines, as each is written by a different process.
+struct shm_ring_header {
+    std::atomic<uint32_t> magic; // SHM_RING_MAGIC once the ring is set up
+    uint32_t header_size; // sizeof(struct shm_ring_header)
+    uint64_t size; // How big the ring is
+
+    std::atomic<int32_t> writer_pid; // 0 if there is no writer (yet)
+    std::atomic<int32_t> reader_pid; // 0 if there is no reader (yet)
+    std::atomic<uint32_t> writer_closed; // True at end-of-file
+    std::atomic<uint32_t> reader_closed; // True if the reader has gone
+
+    // Written by the writer
+    alignas(64) std::atomic<uint64_t> head; // The data written so far
+    std::atomic<uint32_t> head_futex; // Changed to wake the reader
+    std::atomic<uint64_t> writer_wants; // If non-zero, wake the writer when
+                                        // `tail` reaches this
+
+    // Written by the reader
+    alignas(64) std::atomic<uint64_t> tail; // The data finished with so far
+    std::atomic<uint32_t> tail_futex; // Changed to wake the writer
+    std::atomic<uint64_t> reader_wants; // If non-zero, wake the reader when
+                                        // `head` reaches this
+};
+
+// One end of a ring
+struct shm_ring {
+    char* name; // The name of the shared memory object ("/<name>")
+    int file; // Its file descriptor
+    int for_write; // True for the writer, false for the reader
+    struct shm_ring_header* header;
+    byte* data; // The ring itself
+    uint64_t size; // and its size
+    size_t map_size; // The size of the mapping (header and ring)
+    uint64_t posn; // The position of the next byte to write (or read)
+    int said_gone; // True if we've complained the writer went away
+};
+typedef struct shm_ring* shm_ring_p;
+
+#endif // _shmring_defns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
@@ -0,0 +1,104 @@
+/*
+ * Functions for passing TS data between local programs through a ring
+ * buffer in shared memory.
+ *
+ */
+
+#ifndef _shmring_fns
+#define _shmring_fns
+
+#include <sys/types.h>
+
+#include "compat.h"
+#include "shmring_defns.h"
+
+/*
+ * Does a name mean a shared memory ring (i.e., does it start "shm:")?
+ */
+int is_shm_name(const char* name);
+/*
+ * Create a shared memory ring to write to.
+ *
+ * - `name` is its name, starting "shm:"
+ * - `ring` is the new ring, which should be closed with `close_shm_output`
+ *
+ * If a ring of that name already exists, but its writer has gone, it is
+ * replaced. If its writer is still running, that is an error.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int open_shm_output(const char* name, shm_ring_p* ring);
+/*
+ * Write data to a shared memory ring.
+ *
+ * Waits for room in the ring if it is full.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong (including the
+ * reader having gone away).
+ */
+int write_shm_output(shm_ring_p ring, const byte* data, size_t data_len);
+/*
+ * Close a shared memory ring that we were writing to, so that its reader
+ * gets end-of-file once it has read what is left. Sets `ring` to nullptr.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int close_shm_output(shm_ring_p* ring);
+/*
+ * Open a shared memory ring to read from, waiting for its writer to create
+ * it if necessary.
+ *
+ * - `name` is its name, starting "shm:"
+ *
+ * Thereafter reading from the returned file descriptor via `read_file`,
+ * `read_bytes`, `seek_file` and `tell_file` reads the data from the ring,
+ * and `close_file` closes it. Only seeking forwards, or back to positions
+ * that have not yet been handed back to the writer (which includes the
+ * start of the data until it has been read past), is possible.
+ *
+ * Returns the file descriptor, or -1 if something goes wrong.
+ */
+int open_shm_input(const char* name);
+/*
+ * If a file descriptor is for a shared memory ring we are reading from,
+ * return the ring, otherwise nullptr.
+ */
+shm_ring_p get_shm_input(int filedes);
+/*
+ * Is a file descriptor for a shared memory ring we are reading from?
+ */
+int is_shm_file(int filedes);
+/*
+ * Read data from a shared memory ring.
+ *
+ * This is the equivalent of `read` for a shared memory input: it waits until
+ * there is some data, and then returns as much as it can.
+ *
+ * Returns the number of bytes read, 0 at end-of-file, or -1 if something
+ * goes wrong (in which case a message will already have been output).
+ */
+ssize_t read_shm_input(shm_ring_p ring, byte* data, size_t num_bytes);
+/*
+ * Move to a new position in the data from a shared memory ring.
+ *
+ * Moving forwards waits for (and discards) the data in between.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int seek_shm_input(shm_ring_p ring, offset_t posn);
+/*
+ * Stop reading from a shared memory ring, because its file descriptor is
+ * about to be closed. This removes the ring.
+ *
+ * Does nothing if the file is not a shared memory ring we are reading from.
+ */
+void finish_shm_input(int filedes);
+
+#endif // _shmring_fns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 4
+// End:
+// vim: set tabstop=8 shiftwidth=4 expandtab:
@@ -0,0 +1,87 @@
+#pragma once
+
+/*
+ * Altering the timestamps in TS packets.
+ *
+ */
+
+#include "compat.h"
+#include "packet_view_defns.h"
+#include "timestamp_defns.h"
+#include "ts_defns.h"
+
+/*
+ * Restamp a TS packet in place.
+ *
+ * Adds `pcr_delta` to any PCR and OPCR in the adaptation field, and
+ * `pts_delta` to any PTS and DTS in a PES header that starts in this packet,
+ * and `cc_delta` to the continuity counter. All of these wrap as they
+ * should. Null packets are left alone.
+ *
+ * This works directly on the packet bytes, and does not report anything,
+ * so is suitable for use on every packet of a high bitrate stream.
+ *
+ * - `packet` is the (188 byte) TS packet
+ * - `pcr_delta` is the amount (in 27MHz units) to add to PCRs. It may be
+ *   negative.
+ * - `pts_delta` is the amount (in 90kHz units) to add to PTS/DTS. It may be
+ *   negative.
+ * - `cc_delta` is the amount to add to the continuity counter
+ *
+ * Returns 0 if all went well, 1 if the packet is not a TS packet (in which
+ * case it is not altered).
+ */
+static inline int restamp_TS_packet(byte packet[TS_PACKET_SIZE], int64_t pcr_delta,
+    int64_t pts_delta, int cc_delta)
+{
+    const TS_packet_view view = { packet };
+    byte* payload;
+
+    if (!view.has_sync_byte())
+        return 1;
+    if (view.is_null())
+        return 0;
+
+    packet[3] = (packet[3] & 0xF0) | ((packet[3] + cc_delta) & 0x0F);
+
+    if (view.has_adaptation_field()) {
+        const adaptation_field_view field = view.adaptation_field();
+        int pcr_len = field.has_PCR() ? 6 : 0;
+        if (field.length > TS_PACKET_SIZE - 5)
+            return 1;
+        if (field.length >= 7 && field.has_PCR())
+            pcr_to_bytes(packet + 6, pcr_add(field.PCR(), pcr_delta));
+        if (field.length >= 7 + pcr_len && field.has_OPCR()) // OPCR follows any PCR
+            pcr_to_bytes(packet + 6 + pcr_len, pcr_add(field.OPCR(), pcr_delta));
+    }
+    if (!view.has_payload())
+        return 0;
+    payload = packet + view.payload_offset();
+
+    // Only PES packets with the "optional" header carry PTS/DTS
+    const PES_header_view header = { payload, view.payload_length() };
+    if (!view.payload_unit_start() || header.length < 14 || !header.has_start_code()
+        || !header.has_optional_header())
+        return 0;
+    if (!header.is_H222())
+        return 0; // MPEG-1 PES header, which we don't try to alter
+
+    switch (header.PTS_DTS_flags()) {
+    case 2:
+        pts_to_bytes(payload + 9, pts_add(header.PTS(), pts_delta));
+        break;
+    case 3:
+        pts_to_bytes(payload + 9, pts_add(header.PTS(), pts_delta));
+        if (header.length >= 19)
+            pts_to_bytes(payload + 14, pts_add(header.DTS(), pts_delta));
+        break;
+    }
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,254 @@
+/*
+ * Datastructures and arithmetic for MPEG timestamps.
+ *
+ * PTS, DTS and the PCR base are 33 bit counts of a 90kHz clock, and a full
+ * PCR is that times 300 plus a 9 bit extension, i.e., a count of a 27MHz
+ * clock. All of them wrap (roughly every 26.5 hours), so differences and
+ * comparisons must be done modulo the wrap, and never with plain arithmetic.
+ *
+ * Everything here is constexpr, so may be used in constant expressions.
+ *
+ */
+
+#ifndef _timestamp_defns
+#define _timestamp_defns
+
+#include <cstdint>
+
+#define PTS_WRAP (1ULL << 33)
+#define PTS_MASK (PTS_WRAP - 1ULL)
+
+#define PCR_UNSIGNED_WRAP (300ULL * (1ULL << 33))
+
+#define PCR_SIGNED_WRAP (300LL * (1LL << 33))
+#define PCR_SIGNED_MAX (PCR_SIGNED_WRAP / 2LL - 1LL)
+#define PCR_SIGNED_MIN (-PCR_SIGNED_WRAP / 2LL)
+
+// A timestamp in units of the 90kHz clock (PTS, DTS or PCR base)
+struct _timestamp_90kHz {
+    uint64_t ticks;
+};
+typedef struct _timestamp_90kHz timestamp_90kHz_t;
+
+// A timestamp in units of the 27MHz clock (PCR)
+struct _timestamp_27MHz {
+    uint64_t ticks;
+};
+typedef struct _timestamp_27MHz timestamp_27MHz_t;
+
+// ============================================================
+// 90kHz (33 bit) arithmetic
+// ============================================================
+
+// Reduce to 33 bits
+constexpr inline uint64_t pts_wrap(uint64_t x) { return x & PTS_MASK; }
+
+// (x + delta) with allowance for PTS wrap. `delta` may be negative.
+constexpr inline uint64_t pts_add(uint64_t x, int64_t delta) { return (x + delta) & PTS_MASK; }
+
+// (x - y) with allowance for PTS wrap - unsigned version
+constexpr inline uint64_t pts_unsigned_diff(uint64_t x, uint64_t y) { return (x - y) & PTS_MASK; }
+
+// (x - y) with allowance for PTS wrap - signed version, in [-2^32, 2^32)
+constexpr inline int64_t pts_signed_diff(uint64_t x, uint64_t y)
+{
+    return (int64_t)((x - y) << 31) >> 31;
+}
+
+// |x - y| with allowance for PTS wrap
+constexpr inline int64_t pts_abs_diff(uint64_t x, uint64_t y)
+{
+    return pts_signed_diff(x, y) < 0 ? -pts_signed_diff(x, y) : pts_signed_diff(x, y);
+}
+
+// True if `x` is before `y`, allowing for PTS wrap
+constexpr inline bool pts_before(uint64_t x, uint64_t y) { return pts_signed_diff(x, y) < 0; }
+
+// ============================================================
+// 27MHz arithmetic
+// ============================================================
+
+// Deal with simple overflow
+constexpr inline uint64_t pcr_unsigned_wrap(uint64_t x)
+{
+    return x >= PCR_UNSIGNED_WRAP ? x - PCR_UNSIGNED_WRAP : x;
+}
+
+// (x + delta) with allowance for PCR wrap. `delta` may be negative.
+constexpr inline uint64_t pcr_add(uint64_t x, int64_t delta)
+{
+    return (uint64_t)(((int64_t)(x % PCR_UNSIGNED_WRAP) + delta % PCR_SIGNED_WRAP
+                          + PCR_SIGNED_WRAP)
+        % PCR_SIGNED_WRAP);
+}
+
+// (x - y) with allowance for PCR wrap - unsigned version, in [0, 2^33 * 300)
+constexpr inline uint64_t pcr_unsigned_diff(uint64_t x, uint64_t y)
+{
+    return x >= y ? x - y : PCR_UNSIGNED_WRAP - (y - x);
+}
+
+// (x - y) with allowance for PCR wrap - signed version
+constexpr inline int64_t pcr_signed_diff(uint64_t x, uint64_t y)
+{
+    int64_t r = x - y;
+
+    return r < PCR_SIGNED_MIN ? r + PCR_SIGNED_WRAP : r > PCR_SIGNED_MAX ? r - PCR_SIGNED_WRAP : r;
+}
+
+// True if `x` is before `y`, allowing for PCR wrap
+constexpr inline bool pcr_before(uint64_t x, uint64_t y) { return pcr_signed_diff(x, y) < 0; }
+
+// ============================================================
+// Typed timestamps
+// ============================================================
+
+constexpr inline timestamp_27MHz_t timestamp_to_27MHz(timestamp_90kHz_t t)
+{
+    return timestamp_27MHz_t { t.ticks * 300 };
+}
+
+constexpr inline timestamp_90kHz_t timestamp_to_90kHz(timestamp_27MHz_t t)
+{
+    return timestamp_90kHz_t { t.ticks / 300 };
+}
+
+constexpr inline timestamp_90kHz_t timestamp_add(timestamp_90kHz_t t, int64_t delta)
+{
+    return timestamp_90kHz_t { pts_add(t.ticks, delta) };
+}
+
+constexpr inline timestamp_27MHz_t timestamp_add(timestamp_27MHz_t t, int64_t delta)
+{
+    return timestamp_27MHz_t { pcr_add(t.ticks, delta) };
+}
+
+constexpr inline int64_t timestamp_diff(timestamp_90kHz_t x, timestamp_90kHz_t y)
+{
+    return pts_signed_diff(x.ticks, y.ticks);
+}
+
+constexpr inline int64_t timestamp_diff(timestamp_27MHz_t x, timestamp_27MHz_t y)
+{
+    return pcr_signed_diff(x.ticks, y.ticks);
+}
+
+constexpr inline bool timestamp_before(timestamp_90kHz_t x, timestamp_90kHz_t y)
+{
+    return pts_before(x.ticks, y.ticks);
+}
+
+constexpr inline bool timestamp_before(timestamp_27MHz_t x, timestamp_27MHz_t y)
+{
+    return pcr_before(x.ticks, y.ticks);
+}
+
+// ============================================================
+// Unwrapping onto a 64 bit timeline
+// ============================================================
+
+/*
+ * Context for turning a sequence of wrapping timestamps into a continuous
+ * 64 bit timeline. Each value is taken to be the nearest (modulo the wrap)
+ * to the one before, so the sequence may step backwards, but not by more
+ * than half the wrap. Initialise with `TIMESTAMP_UNWRAP_INIT`.
+ */
+struct _timestamp_unwrap {
+    int64_t last; // the last value returned
+    bool started; // false until the first value has been seen
+};
+typedef struct _timestamp_unwrap timestamp_unwrap_t;
+typedef struct _timestamp_unwrap* timestamp_unwrap_p;
+
+#define TIMESTAMP_UNWRAP_INIT { 0, false }
+
+// Unwrap a 33 bit PTS/DTS (or PCR base)
+constexpr inline int64_t unwrap_pts(timestamp_unwrap_p unwrap, uint64_t pts)
+{
+    if (!unwrap->started) {
+        unwrap->started = true;
+        unwrap->last = (int64_t)pts_wrap(pts);
+    } else
+        unwrap->last += pts_signed_diff(pts, (uint64_t)unwrap->last);
+    return unwrap->last;
+}
+
+// Unwrap a 27MHz PCR
+constexpr inline int64_t unwrap_pcr(timestamp_unwrap_p unwrap, uint64_t pcr)
+{
+    if (!unwrap->started) {
+        unwrap->started = true;
+        unwrap->last = (int64_t)(pcr % PCR_UNSIGNED_WRAP);
+    } else {
+        int64_t last_pcr = unwrap->last % PCR_SIGNED_WRAP;
+        if (last_pcr < 0)
+            last_pcr += PCR_SIGNED_WRAP;
+        unwrap->last += pcr_signed_diff(pcr % PCR_UNSIGNED_WRAP, (uint64_t)last_pcr);
+    }
+    return unwrap->last;
+}
+
+// ============================================================
+// Packed forms
+// ============================================================
+
+/*
+ * Read the 33 bit value from the 5 byte PTS/DTS form used in PES headers
+ * (the guard bits and marker bits are not checked - see `decode_pts_dts`
+ * for that).
+ */
+constexpr inline uint64_t pts_from_bytes(const uint8_t data[5])
+{
+    return ((uint64_t)(data[0] & 0x0E) << 29) | ((uint64_t)data[1] << 22)
+        | ((uint64_t)(data[2] & 0xFE) << 14) | ((uint64_t)data[3] << 7) | (data[4] >> 1);
+}
+
+/*
+ * Overwrite the 33 bit value in the 5 byte PTS/DTS form, leaving its guard
+ * bits as they were (and setting the marker bits).
+ */
+constexpr inline void pts_to_bytes(uint8_t data[5], uint64_t value)
+{
+    value = pts_wrap(value);
+    data[0] = (uint8_t)((data[0] & 0xF0) | ((value >> 29) & 0x0E) | 1);
+    data[1] = (uint8_t)(value >> 22);
+    data[2] = (uint8_t)(((value >> 14) & 0xFE) | 1);
+    data[3] = (uint8_t)(value >> 7);
+    data[4] = (uint8_t)(((value << 1) & 0xFE) | 1);
+}
+
+/*
+ * Read the 27MHz value from the 6 byte PCR form used in adaptation fields
+ */
+constexpr inline uint64_t pcr_from_bytes(const uint8_t data[6])
+{
+    return (((uint64_t)data[0] << 25) | ((uint64_t)data[1] << 17) | ((uint64_t)data[2] << 9)
+               | ((uint64_t)data[3] << 1) | (data[4] >> 7))
+        * 300
+        + (((data[4] & 1) << 8) | data[5]);
+}
+
+/*
+ * Overwrite the 6 byte PCR form with a 27MHz value, leaving its reserved
+ * bits as they were.
+ */
+constexpr inline void pcr_to_bytes(uint8_t data[6], uint64_t value)
+{
+    uint64_t base = (value % PCR_UNSIGNED_WRAP) / 300;
+    unsigned int extn = (unsigned int)(value % 300);
+    data[0] = (uint8_t)(base >> 25);
+    data[1] = (uint8_t)(base >> 17);
+    data[2] = (uint8_t)(base >> 9);
+    data[3] = (uint8_t)(base >> 1);
+    data[4] = (uint8_t)(((base & 1) << 7) | (data[4] & 0x7E) | (extn >> 8));
+    data[5] = (uint8_t)(extn & 0xFF);
+}
+
+#endif // _timestamp_defns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -35,8 +35,10 @@
 #include <cstring>
 #include <unistd.h>
 
+#include "blockcache_fns.h"
 #include "compat.h"
 #include "misc_fns.h"
+#include "packet_view_defns.h"
 #include "pes_fns.h"
 #include "pidint_fns.h"
 #include "printing_fns.h"
@@ -57,11 +59,11 @@ static int report_bad_reserved_bits = false;
 // Suppport for the creation of Transport Streams.
 // ============================================================
 
-// Remember the continuity counter value for each/any PID
-// (do I really want to have an array of size 8191+1?
-//  and do I want it static? not if this ever becomes a
-//  library module...)
-static int continuity_counter[0x1fff + 1] = { 0 };
+// Remember the continuity counter value for each/any PID. Each thread
+// has its own, so that (for instance) the files of a batch can be
+// handled in parallel without disturbing one another's counts, and
+// `reset_continuity_counts` starts them again for each new file.
+static thread_local int continuity_counter[0x1fff + 1] = { 0 };
 
 /*
  * Return the next value of continuity_counter for the given pid
@@ -73,6 +75,27 @@ static inline int next_continuity_count(uint32_t pid)
     return next;
 }
 
+/*
+ * Set the continuity counter for the given pid, so that the next packet
+ * written on it follows on from one with continuity counter `last`.
+ *
+ * This is for when the packets we write are to be mixed with packets on
+ * the same PID from elsewhere.
+ */
+void set_continuity_count(uint32_t pid, int last)
+{
+    continuity_counter[pid] = last & 0x0f;
+}
+
+/*
+ * Forget the continuity counters (for this thread), so that the packets
+ * written next on each PID start from 0 again, as at startup.
+ */
+void reset_continuity_counts(void)
+{
+    memset(continuity_counter, 0, sizeof(continuity_counter));
+}
+
 /*
  * Create a PES header for our data.
  *
@@ -1074,6 +1097,20 @@ static int new_TS_reader(TS_reader_p* tsreader)
     memset(new2, '\0', SIZEOF_TS_READER);
 
     new2->file = -1;
+    new2->reposition = -1;
+
+    if (build_block_cache(TS_READ_AHEAD_BLOCKS, TS_READ_AHEAD_MAX_BYTES, &new2->blocks)) {
+        free(new2);
+        return 1;
+    }
+    // Start with a buffer to hand, for `read_rest_of_first_TS_packet`
+    new2->read_ahead_block = get_block_to_fill(new2->blocks, nullptr);
+    if (new2->read_ahead_block == nullptr) {
+        free_block_cache(&new2->blocks);
+        free(new2);
+        return 1;
+    }
+    new2->read_ahead = new2->read_ahead_block->data;
 
     *tsreader = new2;
     return 0;
@@ -1162,6 +1199,7 @@ void free_TS_reader(TS_reader_p* tsreader)
     if (*tsreader != nullptr) {
         if ((*tsreader)->pcrbuf != nullptr)
             free((*tsreader)->pcrbuf);
+        free_block_cache(&(*tsreader)->blocks);
         (*tsreader)->file = -1;
         free(*tsreader);
         *tsreader = nullptr;
@@ -1188,24 +1226,198 @@ int close_TS_reader(TS_reader_p* tsreader)
     return err;
 }
 
+/*
+ * Work out how TS packets are stored in some data from the start of a file
+ * (or any other point at which a stored packet starts).
+ *
+ * - `data` is the data to look at, and `data_len` its length. Up to
+ *   TS_STRIDE_CHECK_COUNT packets are checked, so there is no point in
+ *   this being longer than TS_STRIDE_CHECK_COUNT * MAX_TS_PACKET_STRIDE.
+ * - `packet_size` is returned as the distance from one packet to the next
+ *   (TS_PACKET_SIZE, M2TS_PACKET_SIZE or RS_TS_PACKET_SIZE).
+ * - `packet_offset` is returned as the offset of the TS packet proper
+ *   within that (M2TS_HEADER_SIZE for M2TS, 0 otherwise).
+ *
+ * Returns true if the data looks like TS in one of those layouts, false if
+ * it does not (in which case the plain TS layout is returned).
+ */
+int determine_TS_packet_size(const byte* data, int data_len, int* packet_size, int* packet_offset)
+{
+    static const struct {
+        int size;
+        int offset;
+    } layouts[] = { { TS_PACKET_SIZE, 0 }, { M2TS_PACKET_SIZE, M2TS_HEADER_SIZE },
+        { RS_TS_PACKET_SIZE, 0 } };
+    int ii;
+
+    for (ii = 0; ii < (int)(sizeof(layouts) / sizeof(layouts[0])); ii++) {
+        int count = 0;
+        int posn;
+        for (posn = layouts[ii].offset;
+             posn + TS_PACKET_SIZE <= data_len && count < TS_STRIDE_CHECK_COUNT;
+             posn += layouts[ii].size, count++) {
+            if (data[posn] != 0x47)
+                break;
+        }
+        // Insist on all the packets we have, and at least one of them
+        if (count > 0
+            && (count == TS_STRIDE_CHECK_COUNT || posn + TS_PACKET_SIZE > data_len)) {
+            *packet_size = layouts[ii].size;
+            *packet_offset = layouts[ii].offset;
+            return true;
+        }
+    }
+    *packet_size = TS_PACKET_SIZE;
+    *packet_offset = 0;
+    return false;
+}
+
+/*
+ * Tell the TS reader how its packets are stored, rather than letting it
+ * work it out from the data.
+ *
+ * - `packet_size` is the distance from one packet to the next
+ *   (TS_PACKET_SIZE, M2TS_PACKET_SIZE or RS_TS_PACKET_SIZE), or 0 to
+ *   work it out from the data again.
+ *
+ * This should be called before any packets are read.
+ *
+ * Returns 0 if all goes well, 1 if `packet_size` is not one we know.
+ */
+int set_TS_reader_packet_size(TS_reader_p tsreader, int packet_size)
+{
+    switch (packet_size) {
+    case 0:
+    case TS_PACKET_SIZE:
+    case RS_TS_PACKET_SIZE:
+        tsreader->packet_offset = 0;
+        break;
+    case M2TS_PACKET_SIZE:
+        tsreader->packet_offset = M2TS_HEADER_SIZE;
+        break;
+    default:
+        fprint_err("### TS packets cannot be stored %d bytes apart"
+                   " (only %d, %d or %d)\n",
+            packet_size, TS_PACKET_SIZE, M2TS_PACKET_SIZE, RS_TS_PACKET_SIZE);
+        return 1;
+    }
+    tsreader->packet_size = packet_size;
+    return 0;
+}
+
+/*
+ * Find the extra bytes stored with a TS packet.
+ *
+ * - `tsreader` is the TS packet reading context
+ * - `packet` is a TS packet returned by `read_next_TS_packet` - it must
+ *   still be in the read-ahead buffer. If it is nullptr, the packet most
+ *   recently read (for instance, by `get_next_TS_packet`) is used.
+ * - `header` is returned pointing to the bytes stored before the packet,
+ *   and `header_len` is how many there are (0 if there are none).
+ * - `trailer` is returned pointing to the bytes stored after the packet,
+ *   and `trailer_len` is how many there are (0 if there are none).
+ *
+ * No data is copied - these point into the read-ahead buffer.
+ */
+void get_TS_packet_extras(TS_reader_p tsreader, byte* packet, byte** header, int* header_len,
+    byte** trailer, int* trailer_len)
+{
+    if (packet == nullptr)
+        packet = tsreader->read_ahead_ptr - tsreader->packet_size + tsreader->packet_offset;
+    *header = packet - tsreader->packet_offset;
+    *header_len = tsreader->packet_offset;
+    *trailer = packet + TS_PACKET_SIZE;
+    *trailer_len = tsreader->packet_size == 0
+        ? 0
+        : tsreader->packet_size - tsreader->packet_offset - TS_PACKET_SIZE;
+}
+
+/*
+ * Retrieve the arrival timestamp from the header of an M2TS (or TTS)
+ * packet.
+ *
+ * - `tsreader` is the TS packet reading context
+ * - `packet` is a TS packet returned by `read_next_TS_packet` - it must
+ *   still be in the read-ahead buffer. If it is nullptr, the packet most
+ *   recently read (for instance, by `get_next_TS_packet`) is used.
+ * - `arrival_time` is the 30 bit arrival timestamp, in 27MHz units
+ *
+ * Returns true if the packet has an arrival timestamp, false if the
+ * packets are not stored with one.
+ */
+int get_TS_packet_arrival_time(TS_reader_p tsreader, byte* packet, uint32_t* arrival_time)
+{
+    if (tsreader->packet_offset != M2TS_HEADER_SIZE)
+        return false;
+    if (packet == nullptr)
+        packet = tsreader->read_ahead_ptr - tsreader->packet_size + tsreader->packet_offset;
+    byte* header = packet - M2TS_HEADER_SIZE;
+    *arrival_time = (((uint32_t)header[0] & 0x3F) << 24) | ((uint32_t)header[1] << 16)
+        | ((uint32_t)header[2] << 8) | header[3];
+    return true;
+}
+
+/*
+ * If the TS reader's packets are not stored in the plain 188 byte layout,
+ * say how they are stored.
+ *
+ * This should be called after at least one packet has been read.
+ */
+void report_TS_packet_layout(TS_reader_p tsreader)
+{
+    if (tsreader->packet_size == M2TS_PACKET_SIZE)
+        fprint_msg("TS packets are stored %d bytes apart, each with a %d byte"
+                   " M2TS timestamp header\n",
+            tsreader->packet_size, M2TS_HEADER_SIZE);
+    else if (tsreader->packet_size == RS_TS_PACKET_SIZE)
+        fprint_msg("TS packets are stored %d bytes apart, each followed by %d bytes"
+                   " of Reed-Solomon parity\n",
+            tsreader->packet_size, RS_TS_PACKET_SIZE - TS_PACKET_SIZE);
+}
+
 /*
  * Seek to a given offset in the TS reader's file
  *
  * (This should be used in preference to just seeking on the "bare" file
- * since it also unsets the read-ahead buffer. However, it is still just
- * a wrapper around `seek_file`.)
+ * since it also unsets the read-ahead buffer.)
+ *
+ * If the TS packet at that offset is in one of the blocks the reader has
+ * recently read, then the reader just moves to it within that block, and
+ * the file itself is not touched until more data is needed.
  *
  * It is assumed (but not checked) that the seek will end up at an appropriate
  * offset for reading a TS packet - i.e., presumably some multiple of
- * TS_PACKET_SIZE.
+ * the size the packets are stored in (normally TS_PACKET_SIZE).
  *
  * Returns 0 if all goes well, 1 if something goes wrong
  */
 int seek_using_TS_reader(TS_reader_p tsreader, offset_t posn)
 {
+    block_cache_entry_p block = nullptr;
+    if (tsreader->packet_size > 0)
+        block = find_cached_block(tsreader->blocks, posn, tsreader->packet_size);
+    if (block != nullptr) {
+        // Only the block we last read from the file leaves the file
+        // positioned after it (and any partial packet after that is only
+        // good while we're still reading on from it)
+        if (block != tsreader->blocks->last_read || tsreader->reposition != -1) {
+            tsreader->read_ahead_carry = 0;
+            tsreader->reposition = block->posn + block->len;
+        }
+        tsreader->read_ahead_block = block;
+        tsreader->read_ahead = block->data;
+        tsreader->read_ahead_ptr = block->data + (posn - block->posn);
+        tsreader->read_ahead_end = block->data + block->len;
+        tsreader->posn = posn;
+        return 0;
+    }
+
     tsreader->read_ahead_ptr = nullptr;
     tsreader->read_ahead_end = nullptr;
+    tsreader->read_ahead_carry = 0;
+    tsreader->reposition = -1;
     tsreader->posn = posn;
+    tsreader->blocks->last_read = nullptr; // the file is no longer after it
 
     if (tsreader->seek_fn) {
         return tsreader->seek_fn(tsreader->handle, posn);
@@ -1235,19 +1447,59 @@ static int read_next_TS_packets(TS_reader_p tsreader, int start_len, byte* packe
 {
     ssize_t total = start_len;
     ssize_t length;
+    ssize_t wanted;
+    int packet_size;
 
     // If we exit with an error make sure we don't return anything valid here!
     *packet = nullptr;
 
     if (tsreader->read_ahead_ptr == tsreader->read_ahead_end) {
+        block_cache_entry_p block;
+
+        // If we've been reading from an older block, the file is not
+        // where we want to read from
+        if (tsreader->reposition != -1) {
+            int err;
+            if (tsreader->seek_fn)
+                err = tsreader->seek_fn(tsreader->handle, tsreader->reposition);
+            else
+                err = seek_file(tsreader->file, tsreader->reposition);
+            if (err) {
+                print_err("### Error returning to the end of the TS data read so far\n");
+                return 1;
+            }
+            tsreader->reposition = -1;
+        }
+
+        // Read into the least recently used block, leaving the blocks we've
+        // read recently alone in case we seek back into them
+        block = get_block_to_fill(tsreader->blocks, tsreader->read_ahead_block);
+        if (block == nullptr)
+            return 1;
+
+        // Keep any partial packet left over from last time (or the start of
+        // the packet that we were given)
+        if (tsreader->read_ahead_carry > 0) {
+            memmove(block->data, tsreader->read_ahead_end, tsreader->read_ahead_carry);
+            total = tsreader->read_ahead_carry;
+            tsreader->read_ahead_carry = 0;
+        } else if (start_len > 0 && block->data != tsreader->read_ahead) {
+            memcpy(block->data, tsreader->read_ahead, start_len);
+        }
+        tsreader->read_ahead_block = block;
+        tsreader->read_ahead = block->data;
+
+        // Until we know how big the packets are, read enough for the largest
+        wanted = TS_READ_AHEAD_COUNT
+            * (tsreader->packet_size == 0 ? MAX_TS_PACKET_STRIDE : tsreader->packet_size);
+
         // Try to allow for partial reads
-        while (total < TS_READ_AHEAD_BYTES) {
+        while (total < wanted) {
             if (tsreader->read_fn)
                 length = tsreader->read_fn(
-                    tsreader->handle, &(tsreader->read_ahead[total]), TS_READ_AHEAD_BYTES - total);
+                    tsreader->handle, &(tsreader->read_ahead[total]), wanted - total);
             else
-                length = read(
-                    tsreader->file, &(tsreader->read_ahead[total]), TS_READ_AHEAD_BYTES - total);
+                length = read_file(tsreader->file, &(tsreader->read_ahead[total]), wanted - total);
 
             if (length == 0) // EOF - no more data to read
                 break;
@@ -1264,22 +1516,35 @@ static int read_next_TS_packets(TS_reader_p tsreader, int start_len, byte* packe
         if (total == 0)
             return EOF;
 
-        if (total % TS_PACKET_SIZE != 0) {
+        if (tsreader->packet_size == 0) {
+            (void)determine_TS_packet_size(tsreader->read_ahead, (int)total,
+                &tsreader->packet_size, &tsreader->packet_offset);
+        }
+        packet_size = tsreader->packet_size;
+
+        if (total < wanted && total % packet_size != 0) {
             fprint_err("!!! %d byte%s ignored at end of file - not enough"
                        " to make a TS packet\n",
-                (int)(total % TS_PACKET_SIZE), (total % TS_PACKET_SIZE == 1 ? "" : "s"));
+                (int)(total % packet_size), (total % packet_size == 1 ? "" : "s"));
             // Retain whatever full packets we *do* have
-            total = total - (total % TS_PACKET_SIZE);
+            total = total - (total % packet_size);
             if (total == 0)
                 return EOF;
+        } else if (total % packet_size != 0) {
+            // We read enough for bigger packets than we have - keep the
+            // part packet at the end for next time
+            tsreader->read_ahead_carry = (int)(total % packet_size);
+            total -= tsreader->read_ahead_carry;
         }
+        block->posn = tsreader->posn;
+        block->len = (int32_t)total;
         tsreader->read_ahead_ptr = tsreader->read_ahead;
         tsreader->read_ahead_end = tsreader->read_ahead + total;
     }
 
-    *packet = tsreader->read_ahead_ptr;
-    tsreader->read_ahead_ptr += TS_PACKET_SIZE; // ready for next time
-    tsreader->posn += TS_PACKET_SIZE; // ditto
+    *packet = tsreader->read_ahead_ptr + tsreader->packet_offset;
+    tsreader->read_ahead_ptr += tsreader->packet_size; // ready for next time
+    tsreader->posn += tsreader->packet_size; // ditto
     return 0;
 }
 
@@ -1581,8 +1846,8 @@ int read_next_TS_packet_from_buffer(
         // Why, this is the very packet with its own PCR
         *pcr = tsreader->pcrbuf->TS_buffer_end_pcr;
     } else {
-        *pcr = pcr_unsigned_wrap(tsreader->pcrbuf->TS_buffer_prev_pcr
-            + tsreader->pcrbuf->TS_buffer_time_per_TS * tsreader->pcrbuf->TS_buffer_next);
+        *pcr = pcr_add(tsreader->pcrbuf->TS_buffer_prev_pcr,
+            tsreader->pcrbuf->TS_buffer_time_per_TS * tsreader->pcrbuf->TS_buffer_next);
     }
     return 0;
 }
@@ -1704,22 +1969,11 @@ int read_buffered_TS_packet(TS_reader_p tsreader, uint32_t* count, byte* data[TS
  */
 void get_PCR_from_adaptation_field(byte adapt[], int adapt_len, int* got_pcr, uint64_t* pcr)
 {
-    if (adapt_len == 0 || adapt == nullptr)
-        *got_pcr = false;
-    else if (adapt[0] & 0x10) // We have a PCR
-    {
-        *got_pcr = true;
-        // The program_clock_reference_base
-        // NB: Force the first byte to be unsigned 64 bit, or else on Windows
-        // it tends to get shifted as a signed integer, and sign-extended,
-        // before it gets turned unsigned (which is probably the "correct"
-        // behaviour according to the standard. oh well).
-        *pcr = ((uint64_t)adapt[1] << 25) | (adapt[2] << 17) | (adapt[3] << 9) | (adapt[4] << 1)
-            | (adapt[5] >> 7);
-        // Plus the program clock reference extension
-        *pcr = ((*pcr) * 300) + ((adapt[5] & 1) << 8) + adapt[6];
-    } else
-        *got_pcr = false;
+    const adaptation_field_view field = { adapt, adapt == nullptr ? 0 : adapt_len };
+
+    *got_pcr = field.has_PCR();
+    if (*got_pcr)
+        *pcr = field.PCR();
     return;
 }
 
@@ -3185,18 +3439,23 @@ int extract_stream_list_from_pmt(int verbose, byte payload[MAX_TS_PAYLOAD_SIZE],
 int split_TS_packet(byte buf[TS_PACKET_SIZE], uint32_t* pid, int* payload_unit_start_indicator,
     byte* adapt[], int* adapt_len, byte* payload[], int* payload_len)
 {
-    int adaptation_field_control;
+    const TS_packet_view packet = { buf };
 
-    if (buf[0] != 0x47) {
+    if (!packet.has_sync_byte()) {
         fprint_err("### TS packet starts %02x, not %02x\n", buf[0], 0x47);
         return 1;
     }
-    *payload_unit_start_indicator = (buf[1] & 0x40) >> 6;
-    *pid = ((buf[1] & 0x1f) << 8) | buf[2];
-
-    if (*pid == 0x1FFF) {
-        // Null packets don't contain any data, so let's not allow "spurious"
-        // interpretation of their innards
+    *payload_unit_start_indicator = packet.payload_unit_start();
+    *pid = packet.pid();
+
+    // Null packets don't contain any data, so let's not allow "spurious"
+    // interpretation of their innards. And an adaptation field control of 0
+    // is a reserved value, meaning neither payload nor adaptation field
+    if (packet.is_null() || packet.adaptation_field_control() == 0) {
+        if (!packet.is_null())
+            fprint_err("### Packet PID %04x has adaptation field control = 0\n"
+                       "    which is a reserved value (no payload, no adaptation field)\n",
+                *pid);
         *adapt = nullptr;
         *adapt_len = 0;
         *payload = nullptr;
@@ -3204,50 +3463,10 @@ int split_TS_packet(byte buf[TS_PACKET_SIZE], uint32_t* pid, int* payload_unit_s
         return 0;
     }
 
-    adaptation_field_control = (buf[3] & 0x30) >> 4;
-    switch (adaptation_field_control) {
-    case 0:
-        fprint_err("### Packet PID %04x has adaptation field control = 0\n"
-                   "    which is a reserved value (no payload, no adaptation field)\n",
-            *pid);
-        *adapt = nullptr;
-        *adapt_len = 0;
-        *payload = nullptr;
-        *payload_len = 0;
-        break;
-    case 1:
-        // Payload only
-        *adapt = nullptr;
-        *adapt_len = 0;
-        *payload = buf + 4;
-        *payload_len = TS_PACKET_SIZE - 4;
-        break;
-    case 2:
-        // Adaptation field only
-        *adapt_len = buf[4];
-        if (*adapt_len == 0)
-            *adapt = nullptr;
-        else
-            *adapt = buf + 5;
-        *payload = nullptr;
-        *payload_len = 0;
-        break;
-    case 3:
-        // Payload and adaptation field
-        *adapt_len = buf[4];
-        if (*adapt_len == 0)
-            *adapt = nullptr;
-        else
-            *adapt = buf + 5;
-        *payload = buf + 5 + buf[4];
-        *payload_len = TS_PACKET_SIZE - 5 - buf[4];
-        break;
-    default:
-        // How this might occur, other than via program error, I can't think.
-        fprint_err("### Packet PID %04x has adaptation field control %x\n", *pid,
-            adaptation_field_control);
-        return 1;
-    }
+    *adapt_len = packet.adaptation_field_length();
+    *adapt = *adapt_len == 0 ? nullptr : buf + 5;
+    *payload_len = packet.payload_length();
+    *payload = packet.has_payload() ? buf + packet.payload_offset() : nullptr;
     return 0;
 }
 
@@ -3295,6 +3514,51 @@ int get_next_TS_packet(TS_reader_p tsreader, uint32_t* pid, int* payload_unit_st
         packet, pid, payload_unit_start_indicator, adapt, adapt_len, payload, payload_len);
 }
 
+/*
+ * Does a video PES packet that starts in this TS packet start at a random
+ * access point?
+ *
+ * Only this (the first) TS packet of the PES packet is looked at, and so
+ * only the start of its access unit. The random_access_indicator in the
+ * adaptation field says yes, as does an H.262 sequence header, or an H.264
+ * IDR slice or sequence parameter set.
+ *
+ * - `stream_type` is the stream type of the video, from the PMT
+ * - `adapt`, `adapt_len`, `payload` and `payload_len` are as returned by
+ *   `split_TS_packet`
+ *
+ * Returns true if it does, false if it does not (or we cannot tell).
+ */
+int TS_packet_starts_random_access(
+    int stream_type, byte* adapt, int adapt_len, byte* payload, int payload_len)
+{
+    int ii;
+
+    if (adapt_len > 0 && (adapt[0] & 0x40))
+        return true;
+    if (payload_len < 9 || payload[0] != 0 || payload[1] != 0 || payload[2] != 1)
+        return false;
+
+    for (ii = 9 + payload[8]; ii + 3 < payload_len; ii++) {
+        if (payload[ii] != 0 || payload[ii + 1] != 0 || payload[ii + 2] != 1)
+            continue;
+        if (stream_type == AVC_VIDEO_STREAM_TYPE) {
+            int nal_unit_type = payload[ii + 3] & 0x1F;
+            if (nal_unit_type == 5 || nal_unit_type == 7) // IDR slice, sequence parameter set
+                return true;
+            else if (nal_unit_type >= 1 && nal_unit_type <= 4) // some other slice
+                return false;
+        } else if (stream_type == MPEG2_VIDEO_STREAM_TYPE
+            || stream_type == MPEG1_VIDEO_STREAM_TYPE) {
+            if (payload[ii + 3] == 0xB3)
+                return true;
+            else if (payload[ii + 3] == 0x00)
+                return false; // the picture header, with no sequence header before it
+        }
+    }
+    return false;
+}
+
 /*
  * Find the first (next) PAT.
  *
@@ -29,11 +29,24 @@
 #ifndef _ts_defns
 #define _ts_defns
 
+#include "blockcache_defns.h"
 #include "compat.h"
 
 // Transport Stream packets are always the same size
 #define TS_PACKET_SIZE 188
 
+// ...but they are not always stored back-to-back. M2TS (Blu-ray) and TTS
+// files put a 4 byte header, containing an arrival timestamp, before each
+// packet, and DVB-ASI captures may keep the 16 byte Reed-Solomon parity
+// after each packet
+#define M2TS_PACKET_SIZE 192
+#define M2TS_HEADER_SIZE 4
+#define RS_TS_PACKET_SIZE 204
+#define MAX_TS_PACKET_STRIDE RS_TS_PACKET_SIZE
+
+// How many packets to look at when deciding which of those we have
+#define TS_STRIDE_CHECK_COUNT 16
+
 // When we are putting data into a TS packet, we need the first four
 // bytes for heading information, which means that we will have at most
 // 184 bytes for our payload
@@ -95,12 +108,26 @@ typedef struct _ts_pcr_buffer* TS_pcr_buffer_p;
 #define TS_READ_AHEAD_COUNT 1024 // aim for multiple of block boundary -- used to be 50
 // Thus the number of bytes to read ahead
 #define TS_READ_AHEAD_BYTES TS_READ_AHEAD_COUNT* TS_PACKET_SIZE
+// Which is bigger if the packets are stored with extra bytes
+#define TS_READ_AHEAD_MAX_BYTES (TS_READ_AHEAD_COUNT * MAX_TS_PACKET_STRIDE)
+// The number of read-ahead buffers to keep, so that seeks back into
+// recently read data need not re-read it
+#define TS_READ_AHEAD_BLOCKS 4
 
 // A read-ahead buffer for reading TS packets.
 //
 // Note that `posn` always gives the file position of the *next* TS packet to
 // be read from the file (so after reading a TS packet with
-// `read_next_TS_packet`, the position of said packet is `posn`-TS_PACKET_SIZE)
+// `read_next_TS_packet`, the position of said packet is `posn`-`packet_size`)
+//
+// Packets may be stored with extra bytes before or after them (see
+// M2TS_PACKET_SIZE, etc.). The packet pointers we return always point to
+// the TS packet proper (its 0x47 sync byte), and positions in the file
+// always refer to the start of the stored packet, including any header.
+//
+// The read-ahead buffer is one of a small cache of blocks, each holding
+// the (whole) packets from one read. A seek to a packet in one of those
+// blocks just moves our pointer into it.
 struct _ts_reader {
     int file; // the file to read from
     offset_t posn; // the position of the next-to-be-read TS packet
@@ -111,9 +138,23 @@ struct _ts_reader {
     int (*read_fn)(void*, byte*, size_t);
     int (*seek_fn)(void*, offset_t);
 
-    byte read_ahead[TS_READ_AHEAD_COUNT * TS_PACKET_SIZE];
+    block_cache_p blocks; // recently read blocks, including...
+    block_cache_entry_p read_ahead_block; // the one we are reading from
+    byte* read_ahead; // and its data
     byte* read_ahead_ptr; // location of next packet in said array
     byte* read_ahead_end; // pointer just after the end of `read_ahead`
+    int read_ahead_carry; // bytes after `read_ahead_end` not yet used
+    // If we have moved into a block other than the last one read from the
+    // file, where to seek to before reading any more (otherwise -1)
+    offset_t reposition;
+
+    // The distance from the start of one stored packet to the next
+    // (TS_PACKET_SIZE, M2TS_PACKET_SIZE or RS_TS_PACKET_SIZE), or 0 if we
+    // have not yet worked it out from the data
+    int packet_size;
+    // And where the TS packet itself starts within that
+    // (M2TS_HEADER_SIZE for M2TS, 0 otherwise)
+    int packet_offset;
 
     // If we are doing PCR read-ahead (so we have exact PCR values for our
     // TS packets), then we also need:
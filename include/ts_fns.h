@@ -40,6 +40,21 @@
 // Writing a Transport Stream
 // ============================================================
 
+/*
+ * Set the continuity counter for the given pid, so that the next packet
+ * written on it follows on from one with continuity counter `last`.
+ *
+ * This is for when the packets we write are to be mixed with packets on
+ * the same PID from elsewhere.
+ */
+void set_continuity_count(uint32_t pid, int last);
+
+/*
+ * Forget the continuity counters (for this thread), so that the packets
+ * written next on each PID start from 0 again, as at startup.
+ */
+void reset_continuity_counts(void);
+
 /*
  * Write out a Transport Stream PAT and PMT.
  *
@@ -283,16 +298,85 @@ int close_TS_reader(TS_reader_p* tsreader);
  * Seek to a given offset in the TS reader's file
  *
  * (This should be used in preference to just seeking on the "bare" file
- * since it also unsets the read-ahead buffer. However, it is still just
- * a wrapper around `seek_file`.)
+ * since it also unsets the read-ahead buffer.)
+ *
+ * If the TS packet at that offset is in one of the blocks the reader has
+ * recently read, then the reader just moves to it within that block, and
+ * the file itself is not touched until more data is needed.
  *
  * It is assumed (but not checked) that the seek will end up at an appropriate
  * offset for reading a TS packet - i.e., presumably some multiple of
- * TS_PACKET_SIZE.
+ * the size the packets are stored in (normally TS_PACKET_SIZE).
  *
  * Returns 0 if all goes well, 1 if something goes wrong
  */
 int seek_using_TS_reader(TS_reader_p tsreader, offset_t posn);
+/*
+ * Work out how TS packets are stored in some data from the start of a file
+ * (or any other point at which a stored packet starts).
+ *
+ * - `data` is the data to look at, and `data_len` its length. Up to
+ *   TS_STRIDE_CHECK_COUNT packets are checked, so there is no point in
+ *   this being longer than TS_STRIDE_CHECK_COUNT * MAX_TS_PACKET_STRIDE.
+ * - `packet_size` is returned as the distance from one packet to the next
+ *   (TS_PACKET_SIZE, M2TS_PACKET_SIZE or RS_TS_PACKET_SIZE).
+ * - `packet_offset` is returned as the offset of the TS packet proper
+ *   within that (M2TS_HEADER_SIZE for M2TS, 0 otherwise).
+ *
+ * Returns true if the data looks like TS in one of those layouts, false if
+ * it does not (in which case the plain TS layout is returned).
+ */
+int determine_TS_packet_size(const byte* data, int data_len, int* packet_size, int* packet_offset);
+/*
+ * Tell the TS reader how its packets are stored, rather than letting it
+ * work it out from the data.
+ *
+ * - `packet_size` is the distance from one packet to the next
+ *   (TS_PACKET_SIZE, M2TS_PACKET_SIZE or RS_TS_PACKET_SIZE), or 0 to
+ *   work it out from the data again.
+ *
+ * This should be called before any packets are read.
+ *
+ * Returns 0 if all goes well, 1 if `packet_size` is not one we know.
+ */
+int set_TS_reader_packet_size(TS_reader_p tsreader, int packet_size);
+/*
+ * Find the extra bytes stored with a TS packet.
+ *
+ * - `tsreader` is the TS packet reading context
+ * - `packet` is a TS packet returned by `read_next_TS_packet` - it must
+ *   still be in the read-ahead buffer. If it is nullptr, the packet most
+ *   recently read (for instance, by `get_next_TS_packet`) is used.
+ * - `header` is returned pointing to the bytes stored before the packet,
+ *   and `header_len` is how many there are (0 if there are none).
+ * - `trailer` is returned pointing to the bytes stored after the packet,
+ *   and `trailer_len` is how many there are (0 if there are none).
+ *
+ * No data is copied - these point into the read-ahead buffer.
+ */
+void get_TS_packet_extras(TS_reader_p tsreader, byte* packet, byte** header, int* header_len,
+    byte** trailer, int* trailer_len);
+/*
+ * Retrieve the arrival timestamp from the header of an M2TS (or TTS)
+ * packet.
+ *
+ * - `tsreader` is the TS packet reading context
+ * - `packet` is a TS packet returned by `read_next_TS_packet` - it must
+ *   still be in the read-ahead buffer. If it is nullptr, the packet most
+ *   recently read (for instance, by `get_next_TS_packet`) is used.
+ * - `arrival_time` is the 30 bit arrival timestamp, in 27MHz units
+ *
+ * Returns true if the packet has an arrival timestamp, false if the
+ * packets are not stored with one.
+ */
+int get_TS_packet_arrival_time(TS_reader_p tsreader, byte* packet, uint32_t* arrival_time);
+/*
+ * If the TS reader's packets are not stored in the plain 188 byte layout,
+ * say how they are stored.
+ *
+ * This should be called after at least one packet has been read.
+ */
+void report_TS_packet_layout(TS_reader_p tsreader);
 /*
  * Read the (rest of the) first TS packet, given its first four bytes
  *
@@ -612,6 +696,23 @@ int split_TS_packet(byte buf[TS_PACKET_SIZE], uint32_t* pid, int* payload_unit_s
  */
 int get_next_TS_packet(TS_reader_p tsreader, uint32_t* pid, int* payload_unit_start_indicator,
     byte* adapt[], int* adapt_len, byte* payload[], int* payload_len);
+/*
+ * Does a video PES packet that starts in this TS packet start at a random
+ * access point?
+ *
+ * Only this (the first) TS packet of the PES packet is looked at, and so
+ * only the start of its access unit. The random_access_indicator in the
+ * adaptation field says yes, as does an H.262 sequence header, or an H.264
+ * IDR slice or sequence parameter set.
+ *
+ * - `stream_type` is the stream type of the video, from the PMT
+ * - `adapt`, `adapt_len`, `payload` and `payload_len` are as returned by
+ *   `split_TS_packet`
+ *
+ * Returns true if it does, false if it does not (or we cannot tell).
+ */
+int TS_packet_starts_random_access(
+    int stream_type, byte* adapt, int adapt_len, byte* payload, int payload_len);
 /*
  * Find the first (next) PAT.
  *
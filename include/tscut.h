@@ -0,0 +1,619 @@
+#pragma once
+
+/*
+ * Cutting a time range out of a Transport Stream, by copying its TS packets.
+ *
+ * The cut starts at the last video random access point at or before the
+ * start time, which is found by bisecting the file on its video PTS, so
+ * only the data in (and just before) the range is ever read. The TS packets
+ * of the program's elementary streams are then copied unchanged (apart from
+ * any rebasing of their timestamps), up to the first video PES packet to be
+ * decoded at or after the end time.
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+#include "compat.h"
+#include "compressed_fns.h"
+#include "fmtx.h"
+#include "misc_fns.h"
+#include "pes_fns.h"
+#include "pidint_fns.h"
+#include "printing_fns.h"
+#include "section_fns.h"
+#include "shmring_fns.h"
+#include "timestamp.h"
+#include "ts_fns.h"
+#include "tscut_fns.h"
+#include "tswrite_fns.h"
+
+/*
+ * Work out how long after the first video PTS `pts` is, in 90kHz ticks.
+ */
+static int64_t relative_time(TS_cutter_p cut, uint64_t pts)
+{
+    int64_t offset = (int64_t)pts_unsigned_diff(pts, cut->first_pts);
+    if (offset > (int64_t)PTS_WRAP - CUT_NEGATIVE_SLACK)
+        offset -= PTS_WRAP;
+    return offset;
+}
+
+static int handle_cut_pat(void* arg, uint32_t pid, byte* section, int section_len, int new_version)
+{
+    TS_cutter_p cut = (TS_cutter_p)arg;
+    pidint_list_p prog_list = nullptr;
+    int err;
+    int ii;
+
+    err = extract_prog_list_from_pat(cut->verbose, section, section_len, &prog_list);
+    if (err)
+        return 0; // ignore bad PATs
+    for (ii = 0; ii < prog_list->length; ii++) {
+        if (prog_list->number[ii] == 0)
+            continue; // the network PID
+        if (cut->want_program == -1 || prog_list->number[ii] == cut->want_program)
+            break;
+    }
+    if (ii < prog_list->length) {
+        cut->transport_stream_id = (section[3] << 8) | section[4];
+        if (prog_list->pid[ii] != cut->pmt_pid) {
+            cut->program_number = prog_list->number[ii];
+            cut->pmt_pid = prog_list->pid[ii];
+            cut->pmt_pid_changed = true;
+        }
+    }
+    free_pidint_list(&prog_list);
+    return 0;
+}
+
+static int handle_cut_pmt(void* arg, uint32_t pid, byte* section, int section_len, int new_version)
+{
+    TS_cutter_p cut = (TS_cutter_p)arg;
+    pmt_p pmt = nullptr;
+    int err;
+    int ii;
+
+    if (pid != cut->pmt_pid)
+        return 0; // an old PMT PID
+    err = extract_pmt(cut->verbose, section, section_len, pid, &pmt);
+    if (err)
+        return 0; // ignore bad PMTs
+    if (pmt->program_number != cut->program_number) {
+        free_pmt(&pmt);
+        return 0;
+    }
+    if (cut->pmt != nullptr)
+        free_pmt(&cut->pmt);
+    cut->pmt = pmt;
+
+    for (ii = 0; ii < pmt->num_streams; ii++) {
+        if (IS_VIDEO_STREAM_TYPE(pmt->streams[ii].stream_type)) {
+            if (cut->video_pid != 0 && cut->video_pid != pmt->streams[ii].elementary_PID)
+                fprint_err("!!! tscut: Video PID changed from %#x to %#x\n", cut->video_pid,
+                    pmt->streams[ii].elementary_PID);
+            if (!cut->quiet && cut->video_pid != pmt->streams[ii].elementary_PID)
+                fprint_msg("Program %d, video PID %#x, stream type %#x\n", cut->program_number,
+                    pmt->streams[ii].elementary_PID, pmt->streams[ii].stream_type);
+            cut->video_pid = pmt->streams[ii].elementary_PID;
+            cut->video_stream_type = pmt->streams[ii].stream_type;
+            return 0;
+        }
+    }
+    print_err("!!! tscut: Program has no video stream\n");
+    return 0;
+}
+
+/*
+ * Read the next TS packet, and split it up.
+ *
+ * - `posn` is where the packet was in the input
+ * - the other values are as for `split_TS_packet`
+ *
+ * Returns 0 if all goes well, EOF at the end of the input, 1 if something
+ * goes wrong.
+ */
+static int next_packet(TS_cutter_p cut, byte** packet, offset_t* posn, uint32_t* pid,
+    int* pusi, byte** adapt, int* adapt_len, byte** payload, int* payload_len)
+{
+    int err;
+
+    err = read_next_TS_packet(cut->tsreader, packet);
+    if (err == EOF)
+        return EOF;
+    else if (err) {
+        print_err("### tscut: Error reading TS packet\n");
+        return 1;
+    }
+    if (cut->tsreader->packet_size != TS_PACKET_SIZE) {
+        print_err("### tscut: Can only cut 188 byte TS packets\n");
+        return 1;
+    }
+    *posn = cut->tsreader->posn - TS_PACKET_SIZE;
+    err = split_TS_packet(*packet, pid, pusi, adapt, adapt_len, payload, payload_len);
+    if (err) {
+        fprint_err("### tscut: TS packet at " OFFSET_T_FORMAT " is not in sync\n", *posn);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Read from the start of the input until we know which program we are
+ * cutting, and the first PTS of its video.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int find_program(TS_cutter_p cut)
+{
+    for (;;) {
+        byte *packet, *adapt, *payload;
+        offset_t posn;
+        uint32_t pid;
+        int pusi, adapt_len, payload_len;
+        int err;
+
+        err = next_packet(
+            cut, &packet, &posn, &pid, &pusi, &adapt, &adapt_len, &payload, &payload_len);
+        if (err == EOF) {
+            print_err("### tscut: Did not find a program with video and a PTS in it\n");
+            return 1;
+        } else if (err)
+            return 1;
+
+        if (section_demux_wants_pid(cut->demux, pid)) {
+            err = section_demux_packet(cut->demux, pid, pusi, payload, payload_len);
+            if (err)
+                return 1;
+            if (cut->pmt_pid_changed) {
+                // Filters can't be added whilst the demux is calling us
+                err = add_section_filter(cut->demux, cut->pmt_pid, 0x02, 0xFF, 0, 0,
+                    SECTION_FILTER_NEW_VERSIONS, handle_cut_pmt, cut);
+                if (err)
+                    return 1;
+                cut->pmt_pid_changed = false;
+            }
+        }
+
+        if (pid != cut->video_pid || !pusi || cut->pmt == nullptr)
+            continue;
+
+        uint64_t pts;
+        int got_pts;
+        err = find_PTS_in_PES(payload, payload_len, &got_pts, &pts);
+        if (err || !got_pts)
+            continue;
+        cut->first_pts = pts;
+        return 0;
+    }
+}
+
+/*
+ * Find the PTS of the first video PES packet to start at or after TS
+ * packet number `index` in the input.
+ *
+ * Returns 0 if all goes well, EOF if there is no such PES packet (or not
+ * soon enough), 1 if something goes wrong.
+ */
+static int probe_video_pts(TS_cutter_p cut, offset_t index, uint64_t* pts)
+{
+    int err = seek_using_TS_reader(cut->tsreader, index * TS_PACKET_SIZE);
+    if (err) {
+        fprint_err("### tscut: Unable to seek to TS packet " OFFSET_T_FORMAT "\n", index);
+        return 1;
+    }
+    for (int count = 0; count < CUT_PROBE_LIMIT; count++) {
+        byte *packet, *adapt, *payload;
+        offset_t posn;
+        uint32_t pid;
+        int pusi, adapt_len, payload_len, got_pts;
+
+        err = next_packet(
+            cut, &packet, &posn, &pid, &pusi, &adapt, &adapt_len, &payload, &payload_len);
+        if (err)
+            return err;
+        if (pid != cut->video_pid || !pusi)
+            continue;
+        err = find_PTS_in_PES(payload, payload_len, &got_pts, pts);
+        if (!err && got_pts)
+            return 0;
+    }
+    return EOF;
+}
+
+/*
+ * Find the last TS packet in the input whose next video PTS is no later
+ * than `target` (which is relative to the first video PTS).
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int bisect(TS_cutter_p cut, int64_t target, offset_t* index)
+{
+    offset_t lo = 0; // we know the PTS here is the first, so no later
+    offset_t hi = cut->num_packets;
+    int probes = 0;
+
+    while (hi - lo > 1) {
+        offset_t mid = lo + (hi - lo) / 2;
+        uint64_t pts;
+        int err = probe_video_pts(cut, mid, &pts);
+        if (err == 1)
+            return 1;
+        probes++;
+        if (err == EOF || relative_time(cut, pts) > target)
+            hi = mid;
+        else
+            lo = mid;
+    }
+    if (cut->verbose) {
+        TCHAR time_buf[FMTX_TIMESTAMP_MAX];
+        fprint_msg("Found TS packet " OFFSET_T_FORMAT " for %s with %d probes\n", lo,
+            fmtx_timestamp_r(time_buf, sizeof(time_buf), target, FMTX_TS_DISPLAY_HMS), probes);
+    }
+    *index = lo;
+    return 0;
+}
+
+/*
+ * Find the random access point at which to start the cut - the last one
+ * whose PTS is no later than the start time or, if there is none such,
+ * the first one.
+ *
+ * - `posn` is where its TS packet is in the input
+ * - `pts` is its PTS, and `dts` its DTS (or PTS if it has no DTS)
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int find_start(TS_cutter_p cut, offset_t* posn, uint64_t* pts, uint64_t* dts)
+{
+    int64_t margin = CUT_SEARCH_MARGIN;
+
+    for (;;) {
+        offset_t index;
+        int found = false;
+        int err;
+
+        err = bisect(cut, cut->start - margin, &index);
+        if (err)
+            return 1;
+        err = seek_using_TS_reader(cut->tsreader, index * TS_PACKET_SIZE);
+        if (err) {
+            fprint_err("### tscut: Unable to seek to TS packet " OFFSET_T_FORMAT "\n", index);
+            return 1;
+        }
+
+        for (;;) {
+            byte *packet, *adapt, *payload;
+            offset_t this_posn;
+            uint32_t pid;
+            int pusi, adapt_len, payload_len, got_pts, got_dts;
+            uint64_t this_pts, this_dts;
+
+            err = next_packet(cut, &packet, &this_posn, &pid, &pusi, &adapt, &adapt_len,
+                &payload, &payload_len);
+            if (err == EOF)
+                break;
+            else if (err)
+                return 1;
+            if (pid != cut->video_pid || !pusi)
+                continue;
+            err = find_PTS_DTS_in_PES(
+                payload, payload_len, &got_pts, &this_pts, &got_dts, &this_dts);
+            if (err || !got_pts)
+                continue;
+            if (!TS_packet_starts_random_access(
+                    cut->video_stream_type, adapt, adapt_len, payload, payload_len))
+                continue;
+            if (cut->verbose) {
+                TCHAR time_buf[FMTX_TIMESTAMP_MAX];
+                fprint_msg("Random access point at " OFFSET_T_FORMAT ", PTS %s\n", this_posn,
+                    fmtx_timestamp_r(
+                        time_buf, sizeof(time_buf), this_pts, FMTX_TS_DISPLAY_90kHz_32BIT));
+            }
+            // Once we've got one, we're only interested in later ones up to
+            // the start time
+            if (found && relative_time(cut, this_pts) > cut->start)
+                break;
+            found = true;
+            *posn = this_posn;
+            *pts = this_pts;
+            *dts = got_dts ? this_dts : this_pts;
+            if (relative_time(cut, this_pts) > cut->start)
+                break;
+        }
+
+        if (found && (relative_time(cut, *pts) <= cut->start || index == 0))
+            return 0;
+        if (index == 0) {
+            print_err("### tscut: No random access points found in the video\n");
+            return 1;
+        }
+        margin *= 2; // and try again from further back
+    }
+}
+
+/*
+ * Find the first PCR for the program at or after `posn` in the input.
+ *
+ * Returns 0 if all goes well, EOF if there isn't one (soon enough), 1 if
+ * something goes wrong.
+ */
+static int find_pcr(TS_cutter_p cut, offset_t posn, uint64_t* pcr)
+{
+    int err = seek_using_TS_reader(cut->tsreader, posn);
+    if (err) {
+        fprint_err("### tscut: Unable to seek to " OFFSET_T_FORMAT "\n", posn);
+        return 1;
+    }
+    for (int count = 0; count < CUT_PROBE_LIMIT; count++) {
+        byte *packet, *adapt, *payload;
+        offset_t this_posn;
+        uint32_t pid;
+        int pusi, adapt_len, payload_len;
+
+        err = next_packet(
+            cut, &packet, &this_posn, &pid, &pusi, &adapt, &adapt_len, &payload, &payload_len);
+        if (err)
+            return err;
+        const adaptation_field_view field = { adapt, adapt_len };
+        if (pid == cut->pmt->PCR_pid && field.has_PCR() && field.is_valid()) {
+            *pcr = field.PCR();
+            return 0;
+        }
+    }
+    return EOF;
+}
+
+/*
+ * Write out the TS packets we have collected.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int flush_output(TS_cutter_p cut)
+{
+    int err;
+    if (cut->out_count == 0)
+        return 0;
+    err = tswrite_write_packets(cut->output, cut->out, (size_t)cut->out_count * TS_PACKET_SIZE);
+    if (err) {
+        print_err("### tscut: Error writing output\n");
+        return 1;
+    }
+    cut->written += cut->out_count;
+    cut->out_count = 0;
+    return 0;
+}
+
+/*
+ * Write out a PAT and PMT for our program, which will be the only one in
+ * the output. We write our own, rather than copying those in the input,
+ * so that they come first and their continuity counters are continuous.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int write_cut_program_data(TS_cutter_p cut)
+{
+    int err = flush_output(cut);
+    if (!err)
+        err = write_single_program_pat(
+            cut->output, cut->transport_stream_id, cut->program_number, cut->pmt_pid);
+    if (!err)
+        err = write_pmt(cut->output, cut->pmt_pid, cut->pmt);
+    if (err) {
+        print_err("### tscut: Error writing PAT/PMT\n");
+        return 1;
+    }
+    cut->written += 2;
+    return 0;
+}
+
+/*
+ * Copy the TS packets from `posn` to the end of the cut.
+ *
+ * - `pts_delta` is the amount to add to each PTS and DTS, and 300 times it
+ *   the amount to add to each PCR
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int copy_packets(TS_cutter_p cut, offset_t posn, int64_t pts_delta)
+{
+    int err;
+
+    err = seek_using_TS_reader(cut->tsreader, posn);
+    if (err) {
+        fprint_err("### tscut: Unable to seek to " OFFSET_T_FORMAT "\n", posn);
+        return 1;
+    }
+    err = write_cut_program_data(cut);
+    if (err)
+        return 1;
+
+    for (;;) {
+        byte *packet, *adapt, *payload;
+        offset_t this_posn;
+        uint32_t pid;
+        int pusi, adapt_len, payload_len;
+
+        err = next_packet(
+            cut, &packet, &this_posn, &pid, &pusi, &adapt, &adapt_len, &payload, &payload_len);
+        if (err == EOF)
+            break;
+        else if (err)
+            return 1;
+
+        if (section_demux_wants_pid(cut->demux, pid)) {
+            // Keep track of any changes to the program, and replace each
+            // PAT in the input with our own PAT and PMT
+            err = section_demux_packet(cut->demux, pid, pusi, payload, payload_len);
+            if (err)
+                return 1;
+            if (pid == 0x00 && pusi) {
+                err = write_cut_program_data(cut);
+                if (err)
+                    return 1;
+            }
+            continue;
+        }
+
+        if (!pid_in_pmt(cut->pmt, pid) && pid != cut->pmt->PCR_pid)
+            continue;
+
+        if (pid == cut->video_pid && pusi && cut->end != -1) {
+            // Stop at the first picture to be decoded at or after the end.
+            // Since a picture is always decoded no later than it is
+            // presented, all the pictures presented before the end are in
+            uint64_t pts, dts;
+            int got_pts, got_dts;
+            err = find_PTS_DTS_in_PES(payload, payload_len, &got_pts, &pts, &got_dts, &dts);
+            if (!err && got_pts && relative_time(cut, got_dts ? dts : pts) >= cut->end)
+                break;
+        }
+
+        // Each elementary stream starts with its first whole PES packet
+        if (!cut->started[pid] && payload != nullptr) {
+            if (!pusi)
+                continue;
+            cut->started[pid] = true;
+        }
+
+        byte* out = cut->out + cut->out_count * TS_PACKET_SIZE;
+        memcpy(out, packet, TS_PACKET_SIZE);
+        if (pts_delta != 0)
+            (void)restamp_TS_packet(out, pts_delta * 300, pts_delta, 0);
+        cut->out_count++;
+        if (cut->out_count == CUT_OUTPUT_PACKETS) {
+            err = flush_output(cut);
+            if (err)
+                return 1;
+        }
+    }
+    return flush_output(cut);
+}
+
+/*
+ * Set up a cutter with the default settings: cutting all of the first
+ * program in the PAT, without rebasing its timestamps.
+ *
+ * The caller may then change `start`, `end`, `rebase`, `want_program`,
+ * `quiet` and `verbose`.
+ */
+void init_TS_cutter(TS_cutter_p cut)
+{
+    memset(cut, 0, sizeof(*cut));
+    cut->end = -1;
+    cut->want_program = -1;
+}
+
+/*
+ * Free anything a cutter has allocated.
+ */
+void clear_TS_cutter(TS_cutter_p cut)
+{
+    if (cut->output != nullptr) {
+        (void)tswrite_close(cut->output, true);
+        cut->output = nullptr;
+    }
+    free_section_demux(&cut->demux);
+    if (cut->pmt != nullptr)
+        free_pmt(&cut->pmt);
+    free(cut->out);
+    cut->out = nullptr;
+}
+
+/*
+ * Cut the time range asked for out of the TS read by `tsreader`.
+ *
+ * - `cut` is the cutter, as set up by `init_TS_cutter`
+ * - `tsreader` is the input, which must be a file (or a compressed file
+ *   with a seek table) of 188 byte TS packets, since we seek within it
+ * - `output_name` is the file to write the cut to, or nullptr for
+ *   standard output
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int cut_TS(TS_cutter_p cut, TS_reader_p tsreader, char* output_name)
+{
+    struct stat statbuf;
+    offset_t posn = 0;
+    uint64_t rap_pts = 0, rap_dts = 0;
+    int64_t pts_delta = 0;
+    int err = 0;
+
+    cut->tsreader = tsreader;
+    compressed_input_p compressed = get_compressed_input(tsreader->file);
+    if (fstat(tsreader->file, &statbuf) != 0 || !S_ISREG(statbuf.st_mode)
+        || is_shm_file(tsreader->file) || (compressed != nullptr && compressed->length < 0)) {
+        // A compressed file is only any good if it has a seek table, and
+        // shared memory (which fstat calls a file) cannot be seeked in
+        print_err("### tscut: Input is not a file we can seek in\n");
+        return 1;
+    }
+    cut->num_packets
+        = (compressed != nullptr ? compressed->length : statbuf.st_size) / TS_PACKET_SIZE;
+
+    cut->out = (byte*)malloc(CUT_OUTPUT_PACKETS * TS_PACKET_SIZE);
+    if (cut->out == nullptr) {
+        print_err("### tscut: Unable to allocate output buffer\n");
+        return 1;
+    }
+
+    err = build_section_demux(&cut->demux);
+    if (!err)
+        err = add_section_filter(cut->demux, 0x00, 0x00, 0xFF, 0, 0,
+            SECTION_FILTER_NEW_VERSIONS, handle_cut_pat, cut);
+    if (!err)
+        err = find_program(cut);
+    if (!err)
+        err = find_start(cut, &posn, &rap_pts, &rap_dts);
+
+    if (!err && cut->rebase) {
+        // Every timestamp should be no earlier than the PCR that precedes
+        // it, so making the first PCR zero keeps them all non-negative
+        uint64_t pcr;
+        int found = find_pcr(cut, posn, &pcr);
+        if (found == 1)
+            err = 1;
+        else if (found == 0)
+            pts_delta = -(int64_t)(pcr / 300);
+        else {
+            print_err("!!! tscut: No PCR found, rebasing on the first picture's DTS\n");
+            pts_delta = -(int64_t)rap_dts;
+        }
+    }
+
+    if (!err && !cut->quiet) {
+        TCHAR time_buf[FMTX_TIMESTAMP_MAX];
+        fprint_msg("Cutting from " OFFSET_T_FORMAT ", at %.3fs (PTS %s)\n", posn,
+            relative_time(cut, rap_pts) / 90000.0,
+            fmtx_timestamp_r(time_buf, sizeof(time_buf), rap_pts, FMTX_TS_DISPLAY_90kHz_32BIT));
+    }
+
+    if (!err) {
+        err = tswrite_open_file(output_name, cut->quiet, &cut->output);
+        if (err)
+            fprint_err("### tscut: Unable to open %s\n",
+                (output_name == nullptr ? "<stdout>" : output_name));
+    }
+    if (!err)
+        err = copy_packets(cut, posn, pts_delta);
+
+    if (cut->output != nullptr) {
+        if (tswrite_close(cut->output, cut->quiet)) {
+            print_err("### tscut: Error closing output\n");
+            err = 1;
+        }
+        cut->output = nullptr;
+    }
+    return err;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,77 @@
+/*
+ * Datastructures for cutting a time range out of a Transport Stream
+ *
+ * The cut is made by copying the original TS packets, so nothing is
+ * demultiplexed or remultiplexed - only a PAT and PMT are written at its
+ * start (and wherever the input has a PAT).
+ *
+ */
+
+#ifndef _tscut_defns
+#define _tscut_defns
+
+#include <cstdint>
+
+#include "compat.h"
+#include "pidint_defns.h"
+#include "section_defns.h"
+#include "ts_defns.h"
+#include "tswrite_defns.h"
+
+// How far before the start time we first look for a random access point.
+// If there isn't one between there and the start time, we double it and
+// look again
+#define CUT_SEARCH_MARGIN (2 * 90000)
+
+// How many TS packets we will read looking for a PTS (or PCR) before
+// deciding there isn't one to be found
+#define CUT_PROBE_LIMIT 100000
+
+// Timestamps up to this much before the first video PTS count as negative,
+// rather than as nearly a whole wrap (26.5 hours) after it
+#define CUT_NEGATIVE_SLACK (60 * 90000)
+
+// How many TS packets we collect before writing them out
+#define CUT_OUTPUT_PACKETS 1024
+
+struct TS_cutter {
+    // What we were asked to do
+    int64_t start; // in 90kHz ticks after the first video PTS
+    int64_t end; // likewise, or -1 for the end of the input
+    int rebase; // make the output's timestamps start at (about) zero?
+    int want_program; // the program we want, or -1 for the first
+    int quiet;
+    int verbose;
+
+    // Where the data comes from
+    TS_reader_p tsreader;
+    offset_t num_packets; // how many TS packets there are in it
+
+    // What the data contains
+    section_demux_p demux;
+    uint32_t transport_stream_id;
+    int program_number;
+    uint32_t pmt_pid; // 0 if not yet known
+    int pmt_pid_changed; // true if we need to start looking for a new PMT
+    pmt_p pmt;
+    uint32_t video_pid; // 0 if not yet known
+    int video_stream_type;
+    uint64_t first_pts; // the first video PTS in the input
+
+    // Where the data goes
+    TS_writer_p output;
+    byte* out; // TS packets waiting to be written
+    int out_count;
+    offset_t written; // TS packets written
+    byte started[0x2000]; // true once a PID's first whole PES packet is reached
+};
+typedef struct TS_cutter* TS_cutter_p;
+
+#endif // _tscut_defns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
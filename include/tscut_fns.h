@@ -0,0 +1,45 @@
+/*
+ * Functions for cutting a time range out of a Transport Stream
+ *
+ */
+
+#ifndef _tscut_fns
+#define _tscut_fns
+
+#include "compat.h"
+#include "ts_defns.h"
+#include "tscut_defns.h"
+
+/*
+ * Set up a cutter with the default settings: cutting all of the first
+ * program in the PAT, without rebasing its timestamps.
+ *
+ * The caller may then change `start`, `end`, `rebase`, `want_program`,
+ * `quiet` and `verbose`.
+ */
+void init_TS_cutter(TS_cutter_p cut);
+/*
+ * Free anything a cutter has allocated.
+ */
+void clear_TS_cutter(TS_cutter_p cut);
+/*
+ * Cut the time range asked for out of the TS read by `tsreader`.
+ *
+ * - `cut` is the cutter, as set up by `init_TS_cutter`
+ * - `tsreader` is the input, which must be a file (or a compressed file
+ *   with a seek table) of 188 byte TS packets, since we seek within it
+ * - `output_name` is the file to write the cut to, or nullptr for
+ *   standard output
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int cut_TS(TS_cutter_p cut, TS_reader_p tsreader, char* output_name);
+
+#endif // _tscut_fns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
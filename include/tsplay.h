@@ -36,16 +36,23 @@
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <ctime> // Sleeping and timing
 
 #include "compat.h"
+#include "compressed_fns.h"
+#include "fmtx.h"
 #include "misc_fns.h"
+#include "packet_view_defns.h"
 #include "pes_fns.h"
 #include "pidint_fns.h"
 #include "printing_fns.h"
 #include "ps_fns.h"
+#include "shmring_fns.h"
+#include "timestamp.h"
 #include "ts_fns.h"
 #include "tsplay_fns.h"
 #include "tswrite_fns.h"
@@ -133,6 +140,18 @@ static int read_TS_packet(TS_reader_p tsreader, uint32_t* count, byte* data[TS_P
     return 0;
 }
 
+/*
+ * Work out where TS packet `count` is in the input, given that packet
+ * `start_count` is at `start_posn` (packets are not always TS_PACKET_SIZE
+ * bytes apart, for instance in M2TS).
+ */
+static offset_t TS_packet_posn(
+    TS_reader_p tsreader, offset_t start_posn, uint32_t start_count, uint32_t count)
+{
+    int packet_size = (tsreader->packet_size == 0 ? TS_PACKET_SIZE : tsreader->packet_size);
+    return start_posn + (offset_t)(count - start_count) * packet_size;
+}
+
 /*
  * Read TS packets until we have found the PCR PID for our program stream,
  * outputting packets (without using their PCR) as we go.
@@ -395,16 +414,16 @@ static int play_buffered_TS_packets(TS_reader_p tsreader, TS_writer_p tswriter,
         }
     }
 
+    // Remember the location of the first packet of (probable) data - if
+    // we're looping, there's not much point rewinding before that point.
+    // The reader knows where that is, whatever size the packets are stored in
+    start_posn = tsreader->posn;
+
     // Once we've found that, we're ready to play our data
     err = prime_read_buffered_TS_packet(tsreader, pcr_pid);
     if (err)
         return 1;
 
-    // If we're looping, remember the location of the first packet of (probable)
-    // data - there's not much point rewinding before that point
-    if (loop)
-        start_posn = start_count * TS_PACKET_SIZE;
-
     count = start_count;
     for (;;) {
         err = read_buffered_TS_packet(
@@ -413,8 +432,8 @@ static int play_buffered_TS_packets(TS_reader_p tsreader, TS_writer_p tswriter,
             break;
         else if (err) {
             if (tsreader->file != STDIN_FILENO) {
-                fprint_err("### Last TS packet read was at " LLU_FORMAT "\n",
-                    (uint64_t)count * TS_PACKET_SIZE);
+                fprint_err("### Last TS packet read was at " OFFSET_T_FORMAT "\n",
+                    TS_packet_posn(tsreader, start_posn, start_count, count));
             }
             return 1;
         }
@@ -443,6 +462,328 @@ static int play_buffered_TS_packets(TS_reader_p tsreader, TS_writer_p tswriter,
     return 0;
 }
 
+// ============================================================
+// In-memory looping
+// ============================================================
+/*
+ * Free an in-memory loop, and set `loop` to nullptr.
+ */
+void free_TS_memory_loop(TS_memory_loop_p* loop)
+{
+    if (*loop == nullptr)
+        return;
+    if ((*loop)->clip != nullptr)
+        (void)munmap((*loop)->clip, (*loop)->clip_size);
+    free((*loop)->cc_info);
+    free(*loop);
+    *loop = nullptr;
+}
+
+/*
+ * Read (the start of) a TS file into (locked) memory, ready to be played
+ * out repeatedly.
+ *
+ * The input must be a plain file (we need to know how big it is), and must
+ * contain at least two PCRs on the PCR PID, which must advance, so that we
+ * can tell how long the clip lasts.
+ *
+ * - `input` is the input file (descriptor) to read
+ * - if `override_pcr_pid` is non-zero, then it is the PID to use for PCRs,
+ *   otherwise the first PID found with a PCR is used
+ * - if `max` is greater than zero, then at most `max` TS packets will be
+ *   read into memory
+ * - if `quiet` is true, then only error messages should be written out
+ * - `loop` is the new in-memory loop
+ *
+ * Returns 0 if all went well, 1 if something went wrong.
+ */
+int load_TS_memory_loop(
+    int input, uint32_t override_pcr_pid, int max, int quiet, TS_memory_loop_p* loop)
+{
+    int err;
+    TS_reader_p tsreader;
+    struct stat statbuf;
+    byte probe[TS_STRIDE_CHECK_COUNT * MAX_TS_PACKET_STRIDE];
+    ssize_t probe_len;
+    offset_t start;
+    int packet_size = TS_PACKET_SIZE;
+    int packet_offset = 0;
+    uint32_t capacity;
+    uint32_t last_pcr_index = 0;
+    uint64_t last_pcr = 0;
+    int num_pcrs = 0;
+    TS_memory_loop_p new2;
+
+    *loop = nullptr;
+    if (fstat(input, &statbuf) || !S_ISREG(statbuf.st_mode)) {
+        print_err("### Looping in memory requires the input to be a file\n");
+        return 1;
+    } else if (is_compressed_file(input)) {
+        print_err("### Looping in memory requires the input to be uncompressed\n");
+        return 1;
+    } else if (is_shm_file(input)) {
+        print_err("### Looping in memory requires the input to be a file, not shared memory\n");
+        return 1;
+    }
+
+    // The TS reader works out how far apart the packets are (188, 192 or
+    // 204 bytes) from the start of the data, so we do the same to tell how
+    // many of them there can be
+    start = lseek(input, 0, SEEK_CUR);
+    if (start == -1)
+        start = 0;
+    probe_len = pread(input, probe, sizeof(probe), start);
+    if (probe_len > 0)
+        (void)determine_TS_packet_size(probe, (int)probe_len, &packet_size, &packet_offset);
+    capacity = (uint32_t)((statbuf.st_size - start) / packet_size);
+    if (max > 0 && (uint32_t)max < capacity)
+        capacity = max;
+    if (capacity == 0) {
+        print_err("### No TS packets to loop\n");
+        return 1;
+    }
+
+    new2 = (TS_memory_loop_p)calloc(1, sizeof(struct TS_memory_loop));
+    if (new2 == nullptr) {
+        print_err("### Unable to allocate in-memory loop\n");
+        return 1;
+    }
+    new2->pcr_pid = override_pcr_pid ? override_pcr_pid : ~0U;
+    new2->clip_size = (size_t)capacity * TS_PACKET_SIZE;
+    new2->clip = (byte*)mmap(
+        nullptr, new2->clip_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (new2->clip == MAP_FAILED) {
+        fprint_err("### Unable to allocate " LLU_FORMAT " bytes for in-memory loop: %s\n",
+            (uint64_t)new2->clip_size, strerror(errno));
+        new2->clip = nullptr;
+        free_TS_memory_loop(&new2);
+        return 1;
+    }
+    if (mlock(new2->clip, new2->clip_size) && !quiet)
+        fprint_msg("!!! Unable to lock in-memory loop into memory: %s\n", strerror(errno));
+
+    new2->cc_info = (struct _tsplay_cc_info*)calloc(0x2000, sizeof(struct _tsplay_cc_info));
+    if (new2->cc_info == nullptr) {
+        print_err("### Unable to allocate continuity counter table\n");
+        free_TS_memory_loop(&new2);
+        return 1;
+    }
+
+    err = build_TS_reader(input, &tsreader);
+    if (err) {
+        free_TS_memory_loop(&new2);
+        return 1;
+    }
+
+    // Read the clip, noting its PCRs and continuity counters as we go
+    while (new2->num_packets < capacity) {
+        byte* data;
+        byte* packet = new2->clip + (size_t)new2->num_packets * TS_PACKET_SIZE;
+        uint32_t pid;
+        int pusi;
+        byte* adapt;
+        int adapt_len;
+        byte* payload;
+        int payload_len;
+        int got_pcr;
+        uint64_t pcr;
+
+        err = read_next_TS_packet(tsreader, &data);
+        if (err == EOF)
+            break;
+        else if (err) {
+            fprint_err("### Error reading TS packet %u into memory\n", new2->num_packets);
+            break;
+        }
+        memcpy(packet, data, TS_PACKET_SIZE);
+
+        err = split_TS_packet(packet, &pid, &pusi, &adapt, &adapt_len, &payload, &payload_len);
+        if (err) {
+            fprint_err("### Error splitting TS packet %u\n", new2->num_packets);
+            break;
+        }
+
+        get_PCR_from_adaptation_field(adapt, adapt_len, &got_pcr, &pcr);
+        if (got_pcr && new2->pcr_pid == ~0U)
+            new2->pcr_pid = pid;
+        if (got_pcr && pid == new2->pcr_pid) {
+            if (num_pcrs == 0) {
+                new2->first_pcr_index = new2->num_packets;
+                new2->first_pcr = pcr;
+            }
+            last_pcr_index = new2->num_packets;
+            last_pcr = pcr;
+            num_pcrs++;
+        }
+
+        if (payload_len > 0) {
+            const TS_packet_view view = { packet };
+            if (!new2->cc_info[pid].got_payload)
+                new2->cc_info[pid].first_cc = view.continuity_counter();
+            new2->cc_info[pid].last_cc = view.continuity_counter();
+            new2->cc_info[pid].got_payload = true;
+        }
+        new2->num_packets++;
+    }
+    free_TS_reader(&tsreader);
+    if (err && err != EOF) {
+        free_TS_memory_loop(&new2);
+        return 1;
+    }
+
+    if (num_pcrs < 2) {
+        fprint_err("### Need at least two PCRs on PID %#x to loop in memory, found %d\n",
+            new2->pcr_pid, num_pcrs);
+        free_TS_memory_loop(&new2);
+        return 1;
+    }
+
+    // The clip lasts as long as its PCRs say, extrapolated to the whole clip,
+    // rounded to a whole number of 90kHz ticks so PTS/DTS stay exact
+    new2->duration = pcr_unsigned_diff(last_pcr, new2->first_pcr) * new2->num_packets
+        / (last_pcr_index - new2->first_pcr_index);
+    new2->duration = (new2->duration + 150) / 300 * 300;
+    if (new2->duration == 0) {
+        print_err("### PCRs do not advance, so cannot tell how long the loop lasts\n");
+        free_TS_memory_loop(&new2);
+        return 1;
+    }
+
+    // When we go round again, each PID's CC must follow on from its last one
+    for (int pid = 0; pid < 0x1FFF; pid++) {
+        struct _tsplay_cc_info* info = &new2->cc_info[pid];
+        if (info->got_payload)
+            info->increment = (info->last_cc + 1 - info->first_cc) & 0x0F;
+    }
+    *loop = new2;
+    return 0;
+}
+
+/*
+ * Restamp TS packet `index` of an in-memory loop, ready for its next time
+ * round: its PCR, PTS and DTS move on by the length of the loop, and its
+ * continuity counter follows on from that of the last packet of its PID.
+ */
+void restamp_TS_memory_loop_packet(TS_memory_loop_p loop, uint32_t index)
+{
+    byte* packet = loop->clip + (size_t)index * TS_PACKET_SIZE;
+    const TS_packet_view view = { packet };
+
+    (void)restamp_TS_packet(packet, loop->duration, loop->duration / 300,
+        loop->cc_info[view.pid()].increment);
+}
+
+/*
+ * Read (the start of) a TS file into memory, and then play it out
+ * repeatedly, adjusting PCR, PTS, DTS and continuity counters each time
+ * round so that the output is a single continuous stream.
+ *
+ * The input must be a file (we need to know how big it is), and must
+ * contain at least two PCRs on the PCR PID, so that we can tell how long
+ * the clip lasts.
+ *
+ * - `input` is the input file (descriptor) to read
+ * - `tswriter` is our (maybe buffered) writer
+ * - `pace_mode` is the pacing mode that was requested. In PCR1 mode, every
+ *   packet is given an interpolated PCR, otherwise only the PCRs actually
+ *   present in the data are used.
+ * - if `pid_to_ignore` is non-zero, then any TS packets with that PID
+ *   will not be written out (note: any PCR information in them may still
+ *   be used)
+ * - if `override_pcr_pid` is non-zero, then it is the PID to use for PCRs,
+ *   otherwise the first PID found with a PCR is used
+ * - if `max` is greater than zero, then at most `max` TS packets will be
+ *   read into memory (and thus form the clip that is repeated)
+ * - if `quiet` is true, then only error messages should be written out
+ * - if `verbose` is true, then give extra progress messages
+ *
+ * Returns 0 if all went well, 1 if something went wrong.
+ */
+int play_TS_stream_from_memory(int input, TS_writer_p tswriter,
+    const tsplay_output_pace_mode pace_mode, uint32_t pid_to_ignore, uint32_t override_pcr_pid,
+    int max, int quiet, int verbose)
+{
+    int err;
+    TS_memory_loop_p loop;
+    uint64_t loop_start_pcr;
+    int total = 0;
+
+    err = load_TS_memory_loop(input, override_pcr_pid, max, quiet, &loop);
+    if (err)
+        return 1;
+
+    if (!quiet) {
+        TCHAR time_buf[FMTX_TIMESTAMP_MAX];
+        fprint_msg("Looping %u TS packets from memory, using PCRs on PID %#x (%d)\n",
+            loop->num_packets, loop->pcr_pid, loop->pcr_pid);
+        fprint_msg("Each loop lasts %s\n",
+            fmtx_timestamp_r(
+                time_buf, sizeof(time_buf), loop->duration, FMTX_TS_N_27MHz | FMTX_TS_DISPLAY_HMS));
+    }
+
+    err = 0;
+    loop_start_pcr = loop->first_pcr;
+    for (uint32_t loop_count = 0;; loop_count++) {
+        for (uint32_t ii = 0; ii < loop->num_packets; ii++) {
+            byte* packet = loop->clip + (size_t)ii * TS_PACKET_SIZE;
+            const TS_packet_view view = { packet };
+            uint32_t pid = view.pid();
+            int got_pcr;
+            uint64_t pcr = 0;
+
+            if (loop_count > 0)
+                restamp_TS_memory_loop_packet(loop, ii);
+
+            // These packets were all split successfully as they were read in,
+            // so we can just look at the (possibly restamped) PCR directly
+            got_pcr = pid == loop->pcr_pid && view.adaptation_field().has_PCR();
+            if (got_pcr)
+                pcr = view.adaptation_field().PCR();
+
+            if (pace_mode == TSPLAY_OUTPUT_PACE_PCR1) {
+                // Interpolate (and extrapolate) across the clip as a whole
+                int64_t offset = (int64_t)ii - (int64_t)loop->first_pcr_index;
+                pcr = pcr_add(loop_start_pcr,
+                    offset * (int64_t)loop->duration / (int64_t)loop->num_packets);
+                got_pcr = true;
+            }
+
+            if (pid_to_ignore != 0 && pid == pid_to_ignore) {
+                // As in play_TS_packets, keep any timing but lose the data
+                byte null_packet[TS_PACKET_SIZE];
+                if (!got_pcr)
+                    continue;
+                memcpy(null_packet, packet, TS_PACKET_SIZE);
+                null_packet[2] = 0xFF;
+                null_packet[1] |= 0x1F;
+                err = tswrite_write(tswriter, null_packet, pid, got_pcr, pcr);
+            } else
+                err = tswrite_write(tswriter, packet, pid, got_pcr, pcr);
+            if (err == EOF)
+                break;
+            else if (err) {
+                fprint_err("### Error writing TS packet %d to circular buffer\n", total);
+                free_TS_memory_loop(&loop);
+                return 1;
+            }
+
+            total++;
+            if (!quiet && verbose && total % TSPLAY_REPORT_EVERY == 0)
+                fprint_msg("Transferred %d TS packets\n", total);
+        }
+        if (err == EOF)
+            break;
+        loop_start_pcr = pcr_add(loop_start_pcr, loop->duration);
+        if (!quiet && verbose)
+            fprint_msg("Completed loop %u, continuing from memory\n", loop_count + 1);
+    }
+
+    if (!quiet)
+        fprint_msg("Transferred %d TS packet%s in total\n", total, (total == 1 ? "" : "s"));
+    free_TS_memory_loop(&loop);
+    return 0;
+}
+
 /*
  * Read TS packets and then output them.
  *
@@ -488,10 +829,9 @@ static int play_TS_packets(TS_reader_p tsreader, TS_writer_p tswriter,
 
         // Once we've found that, we're ready to play our data
 
-        // If we're looping, remember the location of the first packet of (probable)
-        // data - there's not much point rewinding before that point
-        if (loop)
-            start_posn = start_count * TS_PACKET_SIZE;
+        // Remember the location of the first packet of (probable) data - if
+        // we're looping, there's not much point rewinding before that point
+        start_posn = tsreader->posn;
     }
 
     count = start_count;
@@ -508,8 +848,8 @@ static int play_TS_packets(TS_reader_p tsreader, TS_writer_p tswriter,
             break;
         else if (err) {
             if (tsreader->file != STDIN_FILENO) {
-                fprint_err("### Last TS packet read was at " LLU_FORMAT "\n",
-                    (uint64_t)count * TS_PACKET_SIZE);
+                fprint_err("### Last TS packet read was at " OFFSET_T_FORMAT "\n",
+                    TS_packet_posn(tsreader, start_posn, start_count, count));
             }
             return 1;
         }
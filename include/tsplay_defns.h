@@ -31,6 +31,11 @@
 #ifndef _tsplay_defns
 #define _tsplay_defns
 
+#include <cstddef>
+#include <cstdint>
+
+#include "compat.h"
+
 // If not being quiet, report progress every TSPLAY_REPORT_EVERY packets read
 #define TSPLAY_REPORT_EVERY 10000
 
@@ -41,6 +46,27 @@ typedef enum tsplay_output_pace_mode_e {
     TSPLAY_OUTPUT_PACE_PCR2_PMT // write buffer timing = look up PCR PID in PMT
 } tsplay_output_pace_mode;
 
+// Per-PID continuity counter information for an in-memory loop
+struct _tsplay_cc_info {
+    int got_payload; // true if this PID has any packets with payload
+    int first_cc; // the CC of the first packet with payload
+    int last_cc; // the CC of the last packet with payload
+    int increment; // how much the CC must advance each time round
+};
+
+// A clip of TS packets held in memory, to be played out repeatedly
+struct TS_memory_loop {
+    byte* clip; // the TS packets, TS_PACKET_SIZE bytes each
+    size_t clip_size; // the size of the memory mapped for them
+    uint32_t num_packets; // how many TS packets there are
+    uint32_t pcr_pid; // the PID whose PCRs time the clip
+    uint32_t first_pcr_index; // the first packet with a PCR on that PID
+    uint64_t first_pcr; // and its PCR, as read in
+    uint64_t duration; // how long the clip lasts, in 27MHz ticks
+    struct _tsplay_cc_info* cc_info; // indexed by PID
+};
+typedef struct TS_memory_loop* TS_memory_loop_p;
+
 #endif // tsplay_defns
 
 // Local Variables:
@@ -61,6 +61,69 @@
 int play_TS_stream(int input, TS_writer_p tswriter, const tsplay_output_pace_mode pace_mode,
     uint32_t pid_to_ignore, uint32_t override_pcr_pid, int max, int loop, int quiet, int verbose);
 
+/*
+ * Free an in-memory loop, and set `loop` to nullptr.
+ */
+void free_TS_memory_loop(TS_memory_loop_p* loop);
+
+/*
+ * Read (the start of) a TS file into (locked) memory, ready to be played
+ * out repeatedly.
+ *
+ * The input must be a plain file (we need to know how big it is), and must
+ * contain at least two PCRs on the PCR PID, which must advance, so that we
+ * can tell how long the clip lasts.
+ *
+ * - `input` is the input file (descriptor) to read
+ * - if `override_pcr_pid` is non-zero, then it is the PID to use for PCRs,
+ *   otherwise the first PID found with a PCR is used
+ * - if `max` is greater than zero, then at most `max` TS packets will be
+ *   read into memory
+ * - if `quiet` is true, then only error messages should be written out
+ * - `loop` is the new in-memory loop
+ *
+ * Returns 0 if all went well, 1 if something went wrong.
+ */
+int load_TS_memory_loop(
+    int input, uint32_t override_pcr_pid, int max, int quiet, TS_memory_loop_p* loop);
+
+/*
+ * Restamp TS packet `index` of an in-memory loop, ready for its next time
+ * round: its PCR, PTS and DTS move on by the length of the loop, and its
+ * continuity counter follows on from that of the last packet of its PID.
+ */
+void restamp_TS_memory_loop_packet(TS_memory_loop_p loop, uint32_t index);
+
+/*
+ * Read (the start of) a TS file into memory, and then play it out
+ * repeatedly, adjusting PCR, PTS, DTS and continuity counters each time
+ * round so that the output is a single continuous stream.
+ *
+ * The input must be a file (we need to know how big it is), and must
+ * contain at least two PCRs on the PCR PID, so that we can tell how long
+ * the clip lasts.
+ *
+ * - `input` is the input file (descriptor) to read
+ * - `tswriter` is our (maybe buffered) writer
+ * - `pace_mode` is the pacing mode that was requested. In PCR1 mode, every
+ *   packet is given an interpolated PCR, otherwise only the PCRs actually
+ *   present in the data are used.
+ * - if `pid_to_ignore` is non-zero, then any TS packets with that PID
+ *   will not be written out (note: any PCR information in them may still
+ *   be used)
+ * - if `override_pcr_pid` is non-zero, then it is the PID to use for PCRs,
+ *   otherwise the first PID found with a PCR is used
+ * - if `max` is greater than zero, then at most `max` TS packets will be
+ *   read into memory (and thus form the clip that is repeated)
+ * - if `quiet` is true, then only error messages should be written out
+ * - if `verbose` is true, then give extra progress messages
+ *
+ * Returns 0 if all went well, 1 if something went wrong.
+ */
+int play_TS_stream_from_memory(int input, TS_writer_p tswriter,
+    const tsplay_output_pace_mode pace_mode, uint32_t pid_to_ignore, uint32_t override_pcr_pid,
+    int max, int quiet, int verbose);
+
 /*
  * Read PS packets and then output them as TS.
  *
@@ -0,0 +1,546 @@
+#pragma once
+
+/*
+ * Splitting a Transport Stream into segments, each starting at a random
+ * access point in its video, and writing an HLS style playlist for them.
+ *
+ * The segments are made by copying the original TS packets, so nothing is
+ * demultiplexed or remultiplexed - each segment just has a PAT and PMT
+ * written at its start.
+ *
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+#include "compat.h"
+#include "compressed_fns.h"
+#include "misc_fns.h"
+#include "pes_fns.h"
+#include "pidint_fns.h"
+#include "printing_fns.h"
+#include "section_fns.h"
+#include "shmring_fns.h"
+#include "timestamp.h"
+#include "ts_fns.h"
+#include "tssegment_fns.h"
+#include "tswrite_fns.h"
+
+
+/*
+ * Build the name of a segment file. Returns a pointer to a static buffer.
+ */
+static char* segment_name(TS_segmenter_p seg, int number)
+{
+    static char name[1024];
+    snprintf(name, sizeof(name), "%s%05d.ts", seg->prefix, number);
+    return name;
+}
+
+/*
+ * Write out the playlist, listing the segments written so far.
+ *
+ * - `finished` is true if there will be no more segments
+ *
+ * The playlist is written to a temporary file and then renamed, so that
+ * anyone reading it (whilst we are still segmenting) always sees a whole
+ * playlist.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int write_playlist(TS_segmenter_p seg, int finished)
+{
+    char temp_name[1024];
+    FILE* file;
+    int first = 0;
+    int target_duration;
+    int ii;
+
+    if (seg->window > 0 && seg->num_segments > seg->window)
+        first = seg->num_segments - seg->window;
+
+    // Every segment's duration, rounded, must be no more than the target
+    target_duration = (int)ceil(seg->target / 90000.0);
+    for (ii = first; ii < seg->num_segments; ii++) {
+        int duration = (int)lround(seg->durations[ii]);
+        if (duration > target_duration)
+            target_duration = duration;
+    }
+
+    snprintf(temp_name, sizeof(temp_name), "%s.tmp", seg->playlist);
+    file = fopen(temp_name, "w");
+    if (file == nullptr) {
+        fprint_err("### tssegment: Unable to open playlist %s: %s\n", temp_name, strerror(errno));
+        return 1;
+    }
+    fprintf(file, "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:%d\n", target_duration);
+    fprintf(file, "#EXT-X-MEDIA-SEQUENCE:%d\n", first);
+    for (ii = first; ii < seg->num_segments; ii++) {
+        // The playlist lives alongside the segments, so refers to them
+        // without any directory
+        char* name = segment_name(seg, ii);
+        char* base = strrchr(name, '/');
+        fprintf(file, "#EXTINF:%.3f,\n%s\n", seg->durations[ii], (base ? base + 1 : name));
+    }
+    if (finished)
+        fprintf(file, "#EXT-X-ENDLIST\n");
+    if (fclose(file)) {
+        fprint_err("### tssegment: Error writing playlist %s: %s\n", temp_name, strerror(errno));
+        return 1;
+    }
+    if (rename(temp_name, seg->playlist)) {
+        fprint_err("### tssegment: Unable to rename %s to %s: %s\n", temp_name, seg->playlist,
+            strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Write the input from where we have got to up to `posn` into the current
+ * segment.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int write_input_to(TS_segmenter_p seg, offset_t posn)
+{
+    int err;
+    size_t length = (size_t)(posn - seg->written);
+    if (length == 0)
+        return 0;
+    if (seg->can_copy)
+        err = tswrite_copy_file_range(seg->output, seg->tsreader->file, seg->written, length);
+    else {
+        err = tswrite_write_packets(seg->output, seg->pending, length);
+        if (!err) {
+            memmove(seg->pending, seg->pending + length, seg->pending_len - length);
+            seg->pending_len -= length;
+        }
+    }
+    if (err) {
+        print_err("### tssegment: Error writing to segment\n");
+        return 1;
+    }
+    seg->written = posn;
+    return 0;
+}
+
+/*
+ * Start a new segment, whose video starts at `pts`.
+ *
+ * - `pat_cc` and `pmt_cc` are the continuity counters of the input's last
+ *   PAT and PMT packets before the segment (or -1 if not known). The PAT
+ *   and PMT we write take their place, so that the input's next PAT and
+ *   PMT packets (in the segment) follow on from them.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int start_segment(TS_segmenter_p seg, int64_t pts, int pat_cc, int pmt_cc)
+{
+    int err;
+    char* name = segment_name(seg, seg->num_segments);
+    TS_writer_p output = nullptr;
+
+    err = tswrite_open_file(name, true, &output);
+    if (err) {
+        fprint_err("### tssegment: Unable to open segment %s\n", name);
+        return 1;
+    }
+    seg->output = output;
+    // Each segment must be playable on its own
+    if (pat_cc != -1)
+        set_continuity_count(0x00, pat_cc - 1);
+    if (pmt_cc != -1)
+        set_continuity_count(seg->pmt_pid, pmt_cc - 1);
+    err = write_single_program_pat(
+        seg->output, seg->transport_stream_id, seg->program_number, seg->pmt_pid);
+    if (!err)
+        err = write_pmt(seg->output, seg->pmt_pid, seg->pmt);
+    if (err) {
+        fprint_err("### tssegment: Error writing PAT/PMT to segment %s\n", name);
+        return 1;
+    }
+    seg->start_pts = pts;
+    seg->rap_posn = -1;
+    return 0;
+}
+
+/*
+ * End the current segment, whose video ends at `pts`.
+ *
+ * - `finished` is true if this is the last segment
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int end_segment(TS_segmenter_p seg, int64_t pts, int finished)
+{
+    int err;
+    double duration = (pts - seg->start_pts) / 90000.0;
+
+    err = tswrite_close(seg->output, true);
+    seg->output = nullptr;
+    if (err) {
+        fprint_err(
+            "### tssegment: Error closing segment %s\n", segment_name(seg, seg->num_segments));
+        return 1;
+    }
+
+    if (seg->num_segments == seg->segments_size) {
+        int newsize = seg->segments_size + SEGMENT_LIST_INCREMENT;
+        double* durations = (double*)realloc(seg->durations, newsize * sizeof(double));
+        if (durations == nullptr) {
+            print_err("### tssegment: Unable to extend segment list\n");
+            return 1;
+        }
+        seg->durations = durations;
+        seg->segments_size = newsize;
+    }
+    seg->durations[seg->num_segments] = duration;
+    if (!seg->quiet)
+        fprint_msg("%s: %.3fs\n", segment_name(seg, seg->num_segments), duration);
+    seg->num_segments++;
+
+    return write_playlist(seg, finished);
+}
+
+/*
+ * We have found a random access point at `posn` in the input, with PTS `pts`.
+ *
+ * If the current segment is now long enough, end it, either here or at
+ * the previous random access point, whichever makes its duration closer
+ * to the target.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int found_random_access_point(TS_segmenter_p seg, offset_t posn, int64_t pts)
+{
+    int err;
+
+    if (seg->output == nullptr) {
+        // The first segment also has anything before its first access point,
+        // so its PAT and PMT must lead into the first ones we read
+        return start_segment(seg, pts,
+            (seg->first_pat_cc == -1 ? -1 : (seg->first_pat_cc - 1) & 0x0F),
+            (seg->first_pmt_cc == -1 ? -1 : (seg->first_pmt_cc - 1) & 0x0F));
+    }
+
+    for (;;) {
+        int64_t duration = pts - seg->start_pts;
+        if (duration < seg->target) {
+            // Not long enough yet - remember this as a possible end
+            err = write_input_to(seg, posn);
+            if (err)
+                return 1;
+            seg->rap_posn = posn;
+            seg->rap_pts = pts;
+            seg->rap_pat_cc = seg->pat_cc;
+            seg->rap_pmt_cc = seg->pmt_cc;
+            return 0;
+        }
+
+        if (seg->rap_posn != -1
+            && seg->target - (seg->rap_pts - seg->start_pts) < duration - seg->target) {
+            // The previous access point is closer to the target. We have
+            // written the input up to it, so just move on to a new segment
+            err = end_segment(seg, seg->rap_pts, false);
+            if (!err)
+                err = start_segment(seg, seg->rap_pts, seg->rap_pat_cc, seg->rap_pmt_cc);
+            if (err)
+                return 1;
+            continue; // and see if that is long enough already
+        }
+
+        err = write_input_to(seg, posn);
+        if (!err)
+            err = end_segment(seg, pts, false);
+        if (!err)
+            err = start_segment(seg, pts, seg->pat_cc, seg->pmt_cc);
+        return err;
+    }
+}
+
+static int handle_pat(void* arg, uint32_t pid, byte* section, int section_len, int new_version)
+{
+    TS_segmenter_p seg = (TS_segmenter_p)arg;
+    pidint_list_p prog_list = nullptr;
+    int err;
+    int ii;
+
+    err = extract_prog_list_from_pat(seg->verbose, section, section_len, &prog_list);
+    if (err)
+        return 0; // ignore bad PATs
+    for (ii = 0; ii < prog_list->length; ii++) {
+        if (prog_list->number[ii] == 0)
+            continue; // the network PID
+        if (seg->want_program == -1 || prog_list->number[ii] == seg->want_program)
+            break;
+    }
+    if (ii < prog_list->length) {
+        seg->transport_stream_id = (section[3] << 8) | section[4];
+        if (prog_list->pid[ii] != seg->pmt_pid) {
+            seg->program_number = prog_list->number[ii];
+            seg->pmt_pid = prog_list->pid[ii];
+            seg->pmt_pid_changed = true;
+            seg->first_pmt_cc = seg->pmt_cc = -1;
+        }
+    }
+    free_pidint_list(&prog_list);
+    return 0;
+}
+
+static int handle_pmt(void* arg, uint32_t pid, byte* section, int section_len, int new_version)
+{
+    TS_segmenter_p seg = (TS_segmenter_p)arg;
+    pmt_p pmt = nullptr;
+    int err;
+    int ii;
+
+    if (pid != seg->pmt_pid)
+        return 0; // an old PMT PID
+    err = extract_pmt(seg->verbose, section, section_len, pid, &pmt);
+    if (err)
+        return 0; // ignore bad PMTs
+    if (pmt->program_number != seg->program_number) {
+        free_pmt(&pmt);
+        return 0;
+    }
+    if (seg->pmt != nullptr)
+        free_pmt(&seg->pmt);
+    seg->pmt = pmt;
+
+    for (ii = 0; ii < pmt->num_streams; ii++) {
+        if (IS_VIDEO_STREAM_TYPE(pmt->streams[ii].stream_type)) {
+            if (seg->video_pid != 0 && seg->video_pid != pmt->streams[ii].elementary_PID)
+                fprint_err("!!! tssegment: Video PID changed from %#x to %#x\n", seg->video_pid,
+                    pmt->streams[ii].elementary_PID);
+            if (!seg->quiet && seg->video_pid != pmt->streams[ii].elementary_PID)
+                fprint_msg("Program %d, video PID %#x, stream type %#x\n", seg->program_number,
+                    pmt->streams[ii].elementary_PID, pmt->streams[ii].stream_type);
+            seg->video_pid = pmt->streams[ii].elementary_PID;
+            seg->video_stream_type = pmt->streams[ii].stream_type;
+            return 0;
+        }
+    }
+    print_err("!!! tssegment: Program has no video stream\n");
+    return 0;
+}
+
+/*
+ * Segment the input.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int segment(TS_segmenter_p seg, int max)
+{
+    int err;
+    int count = 0;
+
+    for (;;) {
+        byte* packet;
+        uint32_t pid;
+        int pusi;
+        byte *adapt, *payload;
+        int adapt_len, payload_len;
+        offset_t posn;
+
+        if (max > 0 && count >= max) {
+            if (!seg->quiet)
+                fprint_msg("Stopping after %d TS packets\n", max);
+            break;
+        }
+
+        err = read_next_TS_packet(seg->tsreader, &packet);
+        if (err == EOF)
+            break;
+        else if (err) {
+            print_err("### tssegment: Error reading TS packet\n");
+            return 1;
+        }
+        if (seg->tsreader->packet_size != TS_PACKET_SIZE) {
+            print_err("### tssegment: Can only segment 188 byte TS packets\n");
+            return 1;
+        }
+        posn = seg->tsreader->posn - TS_PACKET_SIZE;
+        count++;
+
+        if (!seg->can_copy) {
+            if (seg->pending_len == seg->pending_size) {
+                size_t newsize = seg->pending_size * 2;
+                byte* pending = (byte*)realloc(seg->pending, newsize);
+                if (pending == nullptr) {
+                    print_err("### tssegment: Unable to extend pending data\n");
+                    return 1;
+                }
+                seg->pending = pending;
+                seg->pending_size = newsize;
+            }
+            memcpy(seg->pending + seg->pending_len, packet, TS_PACKET_SIZE);
+            seg->pending_len += TS_PACKET_SIZE;
+        }
+
+        err = split_TS_packet(packet, &pid, &pusi, &adapt, &adapt_len, &payload, &payload_len);
+        if (err) {
+            fprint_err("!!! tssegment: Unable to split TS packet at " OFFSET_T_FORMAT "\n", posn);
+            continue;
+        }
+
+        // Only packets with a payload advance the continuity counter
+        if ((packet[3] & 0x10) && (pid == 0x00 || (pid == seg->pmt_pid && pid != 0))) {
+            int cc = packet[3] & 0x0F;
+            if (pid == 0x00) {
+                if (seg->first_pat_cc == -1)
+                    seg->first_pat_cc = cc;
+                seg->pat_cc = cc;
+            } else {
+                if (seg->first_pmt_cc == -1)
+                    seg->first_pmt_cc = cc;
+                seg->pmt_cc = cc;
+            }
+        }
+
+        if (section_demux_wants_pid(seg->demux, pid)) {
+            err = section_demux_packet(seg->demux, pid, pusi, payload, payload_len);
+            if (err)
+                return 1;
+            if (seg->pmt_pid_changed) {
+                // Filters can't be added whilst the demux is calling us
+                err = add_section_filter(seg->demux, seg->pmt_pid, 0x02, 0xFF, 0, 0,
+                    SECTION_FILTER_NEW_VERSIONS, handle_pmt, seg);
+                if (err)
+                    return 1;
+                seg->pmt_pid_changed = false;
+            }
+        }
+
+        if (pid != seg->video_pid || !pusi || seg->pmt == nullptr)
+            continue;
+
+        uint64_t pts;
+        int got_pts;
+        err = find_PTS_in_PES(payload, payload_len, &got_pts, &pts);
+        if (err || !got_pts)
+            continue;
+
+        int64_t this_pts = unwrap_pts(&seg->unwrap, pts);
+        if (seg->had_pts) {
+            int64_t delta = this_pts - seg->last_pts;
+            if (delta < 0)
+                delta = -delta;
+            if (delta > 0 && (seg->frame_ticks == 0 || delta < seg->frame_ticks))
+                seg->frame_ticks = delta;
+        }
+        if (!seg->had_pts || this_pts > seg->last_pts)
+            seg->last_pts = this_pts;
+        seg->had_pts = true;
+
+        if (TS_packet_starts_random_access(
+                seg->video_stream_type, adapt, adapt_len, payload, payload_len)) {
+            if (seg->verbose)
+                fprint_msg("Random access point at " OFFSET_T_FORMAT ", PTS %" PRIi64 "\n", posn,
+                    this_pts);
+            err = found_random_access_point(seg, posn, this_pts);
+            if (err)
+                return 1;
+        }
+    }
+
+    if (seg->output == nullptr) {
+        print_err("### tssegment: No random access points found in the video\n");
+        return 1;
+    }
+    // Everything else goes into the last segment
+    err = write_input_to(seg, seg->tsreader->posn);
+    if (!err)
+        err = end_segment(seg, seg->last_pts + seg->frame_ticks, true);
+    return err;
+}
+
+/*
+ * Set up a segmenter with the default settings: segments of
+ * DEFAULT_SEGMENT_DURATION, named from DEFAULT_SEGMENT_PREFIX, for the
+ * first program in the PAT.
+ *
+ * The caller may then change `prefix`, `playlist` (which must be set),
+ * `target`, `window`, `want_program`, `quiet` and `verbose`.
+ */
+void init_TS_segmenter(TS_segmenter_p seg)
+{
+    memset(seg, 0, sizeof(*seg));
+    seg->prefix = (char*)DEFAULT_SEGMENT_PREFIX;
+    seg->target = (int64_t)(DEFAULT_SEGMENT_DURATION * 90000.0);
+    seg->want_program = -1;
+    seg->first_pat_cc = seg->first_pmt_cc = -1;
+    seg->pat_cc = seg->pmt_cc = -1;
+    seg->rap_posn = -1;
+    seg->unwrap = TIMESTAMP_UNWRAP_INIT;
+}
+
+/*
+ * Free anything a segmenter has allocated.
+ */
+void clear_TS_segmenter(TS_segmenter_p seg)
+{
+    if (seg->output != nullptr) {
+        (void)tswrite_close(seg->output, true);
+        seg->output = nullptr;
+    }
+    free_section_demux(&seg->demux);
+    if (seg->pmt != nullptr)
+        free_pmt(&seg->pmt);
+    free(seg->pending);
+    seg->pending = nullptr;
+    free(seg->durations);
+    seg->durations = nullptr;
+}
+
+/*
+ * Split the TS read by `tsreader` into segments, and write the playlist.
+ *
+ * If the input is a regular file, the segments are copied from it,
+ * otherwise the packets are kept in memory until they are written out.
+ *
+ * - `seg` is the segmenter, as set up by `init_TS_segmenter`
+ * - `tsreader` is the input, which must have 188 byte TS packets
+ * - if `max` is non-zero, then stop after reading that many TS packets
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int segment_TS(TS_segmenter_p seg, TS_reader_p tsreader, int max)
+{
+    struct stat statbuf;
+    int err;
+
+    seg->tsreader = tsreader;
+
+    // If we can, we copy the segments straight from the input file (which
+    // shared memory, although fstat says it is a file, is not)
+    seg->can_copy = (fstat(tsreader->file, &statbuf) == 0 && S_ISREG(statbuf.st_mode)
+        && !is_compressed_file(tsreader->file) && !is_shm_file(tsreader->file));
+    if (!seg->can_copy) {
+        seg->pending_size = PENDING_START_SIZE;
+        seg->pending = (byte*)malloc(seg->pending_size);
+        if (seg->pending == nullptr) {
+            print_err("### tssegment: Unable to allocate pending data buffer\n");
+            return 1;
+        }
+    }
+
+    err = build_section_demux(&seg->demux);
+    if (!err)
+        err = add_section_filter(
+            seg->demux, 0x00, 0x00, 0xFF, 0, 0, SECTION_FILTER_NEW_VERSIONS, handle_pat, seg);
+    if (!err)
+        err = segment(seg, max);
+    return err;
+}
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,94 @@
+/*
+ * Datastructures for splitting a Transport Stream into segments
+ *
+ * Each segment starts at a random access point in the video, and is made
+ * by copying the original TS packets, with a PAT and PMT written at its
+ * start, so nothing is demultiplexed or remultiplexed.
+ *
+ */
+
+#ifndef _tssegment_defns
+#define _tssegment_defns
+
+#include <cstddef>
+#include <cstdint>
+
+#include "compat.h"
+#include "pidint_defns.h"
+#include "section_defns.h"
+#include "timestamp_defns.h"
+#include "ts_defns.h"
+#include "tswrite_defns.h"
+
+#define DEFAULT_SEGMENT_DURATION 6.0 // seconds
+#define DEFAULT_SEGMENT_PREFIX "segment"
+
+// When reading from a pipe, we must keep the packets we have not yet
+// decided which segment to put in (normally, those since the last random
+// access point)
+#define PENDING_START_SIZE (TS_PACKET_SIZE * 4096)
+
+#define SEGMENT_LIST_INCREMENT 100
+
+struct TS_segmenter {
+    // What we were asked to do
+    char* prefix; // segment file names are <prefix>NNNNN.ts
+    char* playlist; // the name of the playlist file
+    int64_t target; // the target segment duration, in 90KHz ticks
+    int window; // if non-zero, the playlist only lists this many segments
+    int want_program; // the program we want, or -1 for the first
+    int quiet;
+    int verbose;
+
+    // Where the data comes from
+    TS_reader_p tsreader;
+    int can_copy; // true if the input is a file we can copy from
+    offset_t written; // the input has been written to segments up to here
+    byte* pending; // if not `can_copy`, the input from `written` onwards
+    size_t pending_len;
+    size_t pending_size;
+
+    // What the data contains
+    section_demux_p demux;
+    uint32_t transport_stream_id;
+    int program_number;
+    uint32_t pmt_pid; // 0 if not yet known
+    int pmt_pid_changed; // true if we need to start looking for a new PMT
+    pmt_p pmt;
+    uint32_t video_pid; // 0 if not yet known
+    int video_stream_type;
+
+    // The continuity counters of the input's PAT and PMT packets (-1 until
+    // there has been one), so that the PAT and PMT we write at the start of
+    // each segment lead into the input's own
+    int first_pat_cc, first_pmt_cc; // of the first packets read
+    int pat_cc, pmt_cc; // of the latest packets read
+
+    // The video timeline
+    timestamp_unwrap_t unwrap;
+    int64_t last_pts; // the latest PTS seen so far
+    int64_t frame_ticks; // our best guess at the duration of a frame
+    int had_pts;
+
+    // The segment being written
+    TS_writer_p output; // nullptr before the first segment
+    int64_t start_pts;
+    offset_t rap_posn; // a random access point in it, or -1
+    int64_t rap_pts; // and its PTS
+    int rap_pat_cc, rap_pmt_cc; // and `pat_cc` and `pmt_cc` at it
+
+    // The segments written so far
+    int num_segments;
+    int segments_size;
+    double* durations; // in seconds
+};
+typedef struct TS_segmenter* TS_segmenter_p;
+
+#endif // _tssegment_defns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -0,0 +1,47 @@
+/*
+ * Functions for splitting a Transport Stream into segments
+ *
+ */
+
+#ifndef _tssegment_fns
+#define _tssegment_fns
+
+#include "compat.h"
+#include "ts_defns.h"
+#include "tssegment_defns.h"
+
+/*
+ * Set up a segmenter with the default settings: segments of
+ * DEFAULT_SEGMENT_DURATION, named from DEFAULT_SEGMENT_PREFIX, for the
+ * first program in the PAT.
+ *
+ * The caller may then change `prefix`, `playlist` (which must be set),
+ * `target`, `window`, `want_program`, `quiet` and `verbose`.
+ */
+void init_TS_segmenter(TS_segmenter_p seg);
+/*
+ * Free anything a segmenter has allocated.
+ */
+void clear_TS_segmenter(TS_segmenter_p seg);
+/*
+ * Split the TS read by `tsreader` into segments, and write the playlist.
+ *
+ * If the input is a regular file, the segments are copied from it,
+ * otherwise the packets are kept in memory until they are written out.
+ *
+ * - `seg` is the segmenter, as set up by `init_TS_segmenter`
+ * - `tsreader` is the input, which must have 188 byte TS packets
+ * - if `max` is non-zero, then stop after reading that many TS packets
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+int segment_TS(TS_segmenter_p seg, TS_reader_p tsreader, int max);
+
+#endif // _tssegment_fns
+
+// Local Variables:
+// tab-width: 8
+// indent-tabs-mode: nil
+// c-basic-offset: 2
+// End:
+// vim: set tabstop=8 shiftwidth=2 expandtab:
@@ -42,15 +42,21 @@
 #include <ctime> // Sleeping and timing
 #include <sys/types.h>
 
+#include <linux/errqueue.h> // sock_extended_err, for SO_TXTIME errors
+#include <linux/net_tstamp.h> // sock_txtime
+#include <sched.h> // SCHED_FIFO and CPU affinity
 #include <sys/mman.h> // memory mapping
+#include <sys/sendfile.h> // sendfile
 #include <sys/socket.h> // send
 #include <sys/time.h> // gettimeofday
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "compat.h"
+#include "compressed_fns.h"
 #include "misc_fns.h"
 #include "printing_fns.h"
+#include "shmring_fns.h"
 #include "ts_fns.h"
 #include "tswrite_fns.h"
 
@@ -83,6 +89,38 @@ static int global_child_debug = false;
 static unsigned global_perturb_seed;
 static unsigned global_perturb_range = 0;
 static int global_perturb_verbose = false;
+
+// Should the child hand each datagram to the kernel early, stamped with the
+// time it should leave (SO_TXTIME), and let the fq or etf qdisc release it,
+// rather than sleeping until that time itself? If so, `global_txtime_clock`
+// is the clock the qdisc expects (CLOCK_MONOTONIC for fq, CLOCK_TAI for etf),
+// and `global_txtime_lead` is how many microseconds ahead of its departure
+// time a datagram may be sent.
+//
+// If the qdisc drops datagrams because they reach it too late, the child
+// sets `global_txtime_sleep`, and goes back to sleeping until each is due.
+// The socket still has SO_TXTIME set (there is no way to unset it), and the
+// etf qdisc drops anything from such a socket without a departure time, so
+// each datagram is then stamped to leave `global_txtime_lead` after it is
+// handed over.
+#define DEFAULT_TXTIME_LEAD 2000
+static int global_txtime = false;
+static clockid_t global_txtime_clock = CLOCK_MONOTONIC;
+static int global_txtime_lead = DEFAULT_TXTIME_LEAD;
+static int global_txtime_sleep = false;
+
+// Real time tuning for the parent (which fills the circular buffer) and the
+// child (which paces the output). A priority of 0 leaves the scheduling policy
+// alone, and a CPU of -1 leaves the process free to run anywhere. If
+// `global_mlock` then all memory is locked (and the circular buffer
+// pre-faulted), and if `global_hugepages` the circular buffer is mapped
+// using huge pages (if the system has any to give us).
+static int global_parent_rtprio = 0;
+static int global_child_rtprio = 0;
+static int global_parent_cpu = -1;
+static int global_child_cpu = -1;
+static int global_mlock = false;
+static int global_hugepages = false;
 // ------------------------------------------------------------
 
 // The default number of set-of-N-packets to allow for in priming the
@@ -140,6 +178,10 @@ static int global_child_wait = DEFAULT_CHILD_WAIT;
 // fill a jumbo packet on a gigabit network.
 #define MAX_TS_PACKETS_IN_ITEM 100
 
+// The huge page size we assume when asked to use huge pages for the circular
+// buffer (the usual size on x86-64 and ARM64)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
 // ------------------------------------------------------------
 // A circular buffer, usable as a queue
 //
@@ -202,6 +244,8 @@ struct circular_buffer {
     int maxnowait; // max number consecutive packets to send with no wait
     int waitfor; // the number of microseconds to wait thereafter
 
+    size_t mapped_size; // how much memory was actually mapped for all this
+
     // The location of the packet data for the circular buffer items
     byte* item_data;
 
@@ -342,18 +386,39 @@ int map_circular_buffer(circular_buffer_p* circular, int circ_buf_size, int TS_i
     int base_size = SIZEOF_CIRCULAR_BUFFER + (circ_buf_size * SIZEOF_CIRCULAR_BUFFER_ITEM);
     int data_size = circ_buf_size * (TS_in_packet * TS_PACKET_SIZE + hdr_size);
     int total_size = base_size + data_size;
-    circular_buffer_p cb;
+    size_t mapped_size = total_size;
+    circular_buffer_p cb = (circular_buffer_p)MAP_FAILED;
 
     *circular = nullptr;
 
-    cb = (circular_buffer_p)mmap(
-        nullptr, total_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+    if (global_hugepages) {
+        // Huge page mappings must be a whole number of huge pages
+        mapped_size = (total_size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+        cb = (circular_buffer_p)mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANON | MAP_HUGETLB, -1, 0);
+        if (cb == MAP_FAILED) {
+            fprint_err("!!! Unable to map circular buffer using huge pages (%s)"
+                       " - using normal pages\n",
+                strerror(errno));
+            mapped_size = total_size;
+        }
+    }
+    if (cb == MAP_FAILED)
+        cb = (circular_buffer_p)mmap(
+            nullptr, total_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
 
     if (cb == MAP_FAILED) {
         fprint_err("### Error mapping circular buffer as shared memory: %s\n", strerror(errno));
         return 1;
     }
 
+    if (global_mlock) {
+        // Touch every page now, so neither process takes a page fault later
+        memset((void*)cb, 0, mapped_size);
+        if (mlock(cb, mapped_size))
+            fprint_err("!!! Unable to lock circular buffer into memory: %s\n", strerror(errno));
+    }
+
     cb->start = 1;
     cb->end = 0;
     cb->pending = 0;
@@ -372,6 +437,7 @@ int map_circular_buffer(circular_buffer_p* circular, int circ_buf_size, int TS_i
     }
     cb->maxnowait = maxnowait;
     cb->waitfor = waitfor;
+    cb->mapped_size = mapped_size;
     cb->item_data = (byte*)cb + base_size + hdr_size;
     *circular = cb;
     return 0;
@@ -386,10 +452,7 @@ int map_circular_buffer(circular_buffer_p* circular, int circ_buf_size, int TS_i
  */
 int unmap_circular_buffer(circular_buffer_p circular)
 {
-    int base_size = SIZEOF_CIRCULAR_BUFFER + (circular->size * SIZEOF_CIRCULAR_BUFFER_ITEM);
-    int data_size = circular->size * circular->item_size;
-    int total_size = base_size + data_size;
-    int err = munmap(circular, total_size);
+    int err = munmap(circular, circular->mapped_size);
     if (err) {
         fprint_err(
             "### Error unmapping circular buffer from shared memory: %s\n", strerror(errno));
@@ -1301,6 +1364,8 @@ void wait_microseconds(int microseconds)
 int write_file_data(TS_writer_p tswriter, byte data[], size_t data_len)
 {
     size_t written = 0;
+    if (tswriter->how == TS_W_SHM)
+        return write_shm_output(tswriter->where.shm, data, data_len);
     errno = 0;
     written = fwrite(data, 1, data_len, tswriter->where.file);
     if (written != data_len) {
@@ -1348,6 +1413,129 @@ int write_socket_data(SOCKET output, byte data[], int data_len)
     return 0;
 }
 
+/*
+ * Return the current time on the clock used for SO_TXTIME, in nanoseconds
+ */
+static uint64_t txtime_now(void)
+{
+    struct timespec now;
+    clock_gettime(global_txtime_clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * Ask the kernel to accept departure times for datagrams on our output
+ * socket.
+ *
+ * If the kernel does not support SO_TXTIME, `global_txtime` is unset, so
+ * that the child falls back to sleeping until each datagram is due.
+ *
+ * Note that if no fq or etf qdisc is configured on the output interface,
+ * the kernel will accept the departure times, but ignore them, and
+ * datagrams will leave up to `global_txtime_lead` microseconds early.
+ *
+ * - `output` is a socket for our output
+ * - if `quiet` then don't output extra messages
+ *
+ * Returns 0 if all went well, 1 if SO_TXTIME could not be enabled.
+ */
+int setup_txtime(SOCKET output, int quiet)
+{
+    struct sock_txtime txtime = { 0 };
+
+    txtime.clockid = global_txtime_clock;
+    txtime.flags = SOF_TXTIME_REPORT_ERRORS;
+    if (setsockopt(output, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) == -1) {
+        fprint_err("!!! Unable to enable SO_TXTIME (%s) - pacing by sleeping instead\n",
+            strerror(errno));
+        global_txtime = false;
+        return 1;
+    }
+    global_txtime_sleep = false;
+    if (!quiet)
+        fprint_msg("Child: datagrams sent up to %dus early, stamped for the %s qdisc\n",
+            global_txtime_lead, global_txtime_clock == CLOCK_TAI ? "etf" : "fq");
+    return 0;
+}
+
+/*
+ * Look on the socket's error queue for any datagrams that the qdisc
+ * refused to send, because they arrived too late for their departure time
+ * (or their departure time was nonsense).
+ *
+ * - `output` is a socket for our output
+ *
+ * Returns the number of datagrams reported as dropped.
+ */
+int check_txtime_errors(SOCKET output)
+{
+    int dropped = 0;
+
+    for (;;) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+        struct msghdr msg = { 0 };
+        struct cmsghdr* cmsg;
+
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(output, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+            break; // nothing (more) to report
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            struct sock_extended_err err;
+            if (cmsg->cmsg_len < CMSG_LEN(sizeof(err)))
+                continue;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_origin == SO_EE_ORIGIN_TXTIME)
+                dropped++;
+        }
+    }
+    return dropped;
+}
+
+/*
+ * Write data out to a socket, stamped with the time it should leave
+ *
+ * - `output` is a socket for our output
+ * - `data` is the data to write out
+ * - `data_len` is how much of it there is
+ * - `txtime` is the departure time, in nanoseconds on `global_txtime_clock`
+ *
+ * Returns 0 if all went well, 1 if something went wrong.
+ */
+int write_socket_data_at(SOCKET output, byte data[], int data_len, uint64_t txtime)
+{
+    char control[CMSG_SPACE(sizeof(uint64_t))] = { 0 };
+    struct msghdr msg = { 0 };
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+
+    iov.iov_base = data;
+    iov.iov_len = data_len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TXTIME;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+    memcpy(CMSG_DATA(cmsg), &txtime, sizeof(uint64_t));
+
+    errno = 0;
+    while (sendmsg(output, &msg, 0) == -1) {
+        if (errno == ENOBUFS) {
+            print_err("!!! Warning: 'no buffer space available' writing out"
+                      " TS packet data - retrying\n");
+            errno = 0;
+        } else {
+            fprint_err("### Error writing out TS packet data with departure time: %s\n",
+                strerror(errno));
+            return 1;
+        }
+    }
+    return 0;
+}
+
 /*
  * Read a command character from the command input socket
  *
@@ -1706,10 +1894,12 @@ int wait_for_command(TS_writer_p tswriter)
  *
  * - `output` is a socket for our output
  * - `circular` is our circular buffer of "packets"
+ * - if `txtime` is non-zero, it is the time (in nanoseconds, on
+ *   `global_txtime_clock`) at which the kernel should send the data
  *
  * Returns 0 if all went well, 1 if something went wrong.
  */
-int write_circular_data(const SOCKET output, const circular_buffer_p circular)
+int write_circular_data(const SOCKET output, const circular_buffer_p circular, uint64_t txtime)
 {
     int err;
     byte* buffer
@@ -1721,7 +1911,10 @@ int write_circular_data(const SOCKET output, const circular_buffer_p circular)
     int newend, newstart;
 #endif
 
-    err = write_socket_data(output, buffer, length);
+    if (txtime != 0)
+        err = write_socket_data_at(output, buffer, length, txtime);
+    else
+        err = write_socket_data(output, buffer, length);
 
     if (err) {
         // If we're writing out over UDP, it's possible our write fails for
@@ -1868,6 +2061,7 @@ int write_from_circular(SOCKET output, circular_buffer_p circular, int quiet, in
     static int32_t delta_start; // difference between our time and the parent's
     uint32_t adjusted_now; // our time, adjusted by delta_start
     int32_t waitfor; // how long we think we need to wait to adjust
+    uint64_t txtime = 0; // when the kernel should send it, if it's pacing
 
     // How many items have we sent without *any* delay?
     // (not used if maxnowait is off)
@@ -2010,22 +2204,97 @@ int write_from_circular(SOCKET output, circular_buffer_p circular, int quiet, in
     } else if (global_child_debug)
         print_msg(")\n");
 
-    // So, finally, do we need to wait before writing?
-    if (waitfor > 0) {
-        wait_microseconds(waitfor);
-        sent_without_delay = 0;
+    // So, finally, do we need to wait before writing? If the kernel is
+    // doing the pacing for us, we only need to wait until we're within
+    // `global_txtime_lead` of the right time, and can then hand it over
+    // stamped with when it should actually go.
+    if (global_txtime && !global_txtime_sleep) {
+        txtime = txtime_now() + (uint64_t)(waitfor > 0 ? waitfor : 0) * 1000;
+        if (waitfor > global_txtime_lead)
+            wait_microseconds(waitfor - global_txtime_lead);
+        if (waitfor > 0)
+            sent_without_delay = 0;
+    } else {
+        if (waitfor > 0) {
+            wait_microseconds(waitfor);
+            sent_without_delay = 0;
+        }
+        // A socket with SO_TXTIME set still needs a departure time
+        if (global_txtime)
+            txtime = txtime_now() + (uint64_t)global_txtime_lead * 1000;
     }
 
     // Write it...
-    err = write_circular_data(output, circular);
+    err = write_circular_data(output, circular, txtime);
     if (err)
         return 1;
 
+    // If the qdisc is dropping our datagrams, we're not getting them to it
+    // early enough - go back to doing the waiting ourselves
+    if (global_txtime && !global_txtime_sleep && count % 64 == 0) {
+        int dropped = check_txtime_errors(output);
+        if (dropped > 0) {
+            fprint_err("!!! [%d] %d datagram%s dropped for missing %s departure time"
+                       " - pacing by sleeping instead\n",
+                circular->start, dropped, dropped == 1 ? "" : "s", dropped == 1 ? "its" : "their");
+            global_txtime_sleep = true;
+        }
+    }
+
     // Don't forget to update our memory before we finish
     last_packet_time = this_packet_time;
     return 0;
 }
 
+/*
+ * Apply any real time tuning the user asked for to the calling process.
+ *
+ * Failures are reported as warnings, since the program can still work
+ * (just not as well) without them - typically they happen because we are
+ * not privileged enough.
+ *
+ * - `who` is "Parent" or "Child", for messages
+ * - `rtprio` is the SCHED_FIFO priority to use, or 0 to leave it alone
+ * - `cpu` is the CPU to pin ourselves to, or -1 to leave it alone
+ * - if `quiet` then don't report what was done (only what failed)
+ *
+ * Returns 0 if all went well, 1 if any of the tuning could not be applied.
+ */
+int tswrite_tune_process(const char* who, int rtprio, int cpu, int quiet)
+{
+    int result = 0;
+
+    if (rtprio > 0) {
+        struct sched_param param = { 0 };
+        param.sched_priority = rtprio;
+        if (sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
+            fprint_err("!!! %s: unable to use SCHED_FIFO priority %d: %s\n", who, rtprio,
+                strerror(errno));
+            result = 1;
+        } else if (!quiet)
+            fprint_msg("%s: running SCHED_FIFO at priority %d\n", who, rtprio);
+    }
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+            fprint_err("!!! %s: unable to pin to CPU %d: %s\n", who, cpu, strerror(errno));
+            result = 1;
+        } else if (!quiet)
+            fprint_msg("%s: pinned to CPU %d\n", who, cpu);
+    }
+    // Memory locks are not inherited over fork, so each process does its own
+    if (global_mlock) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+            fprint_err("!!! %s: unable to lock memory: %s\n", who, strerror(errno));
+            result = 1;
+        } else if (!quiet)
+            fprint_msg("%s: all memory locked\n", who);
+    }
+    return result;
+}
+
 /*
  * The child process just writes the contents of the circular buffer out,
  * as it receives it.
@@ -2051,6 +2320,9 @@ int write_from_circular(SOCKET output, circular_buffer_p circular, int quiet, in
 int tswrite_child_process(TS_writer_p tswriter)
 {
     int had_eof = false;
+    (void)tswrite_tune_process("Child", global_child_rtprio, global_child_cpu, tswriter->quiet);
+    if (global_txtime)
+        (void)setup_txtime(tswriter->where.socket, tswriter->quiet);
     for (;;) {
         int err = write_from_circular(
             tswriter->where.socket, tswriter->writer->buffer, tswriter->quiet, &had_eof);
@@ -2162,7 +2434,12 @@ int tswrite_build(TS_WRITER_TYPE how, int quiet, TS_writer_p* tswriter)
  * For TS_W_FILE, ``open(name,O_CREAT|O_WRONLY|O_TRUNC|O_BINARY,00777)``
  * is used - i.e., the file is opened so that anyone may read/write/execute
  * it. If ``O_BINARY`` is not defined (e.g., on Linux), then it is
- * omitted.
+ * omitted. If `name` ends in ".gz" or ".zst", the output is compressed
+ * accordingly (see `fopen_compressed`). If `name` starts "shm:", TS_W_SHM
+ * is used instead.
+ *
+ * For TS_W_SHM, a shared memory ring is created (see `open_shm_output`),
+ * for another program to read from by opening the same "shm:" name.
  *
  * For TS_W_TCP and TS_W_UDP, the ``connect_socket`` function is called,
  * which uses ``socket`` and ``connect``.
@@ -2180,7 +2457,11 @@ int tswrite_open(
     TS_WRITER_TYPE how, char* name, char* multicast_if, int port, int quiet, TS_writer_p* tswriter)
 {
     TS_writer_p new2;
-    int err = tswrite_build(how, quiet, tswriter);
+    int err;
+
+    if (how == TS_W_FILE && is_shm_name(name))
+        how = TS_W_SHM;
+    err = tswrite_build(how, quiet, tswriter);
     if (err)
         return 1;
 
@@ -2194,12 +2475,21 @@ int tswrite_open(
     case TS_W_FILE:
         if (!quiet)
             fprint_msg("Writing to file %s\n", name);
-        new2->where.file = fopen(name, "wb");
+        new2->where.file = fopen_compressed(name, true);
         if (new2->where.file == nullptr) {
             fprint_err("### Unable to open output file %s: %s\n", name, strerror(errno));
             return 1;
         }
         break;
+    case TS_W_SHM:
+        if (!quiet)
+            fprint_msg("Writing to shared memory %s\n", name + SHM_NAME_PREFIX_LEN);
+        err = open_shm_output(name, &new2->where.shm);
+        if (err) {
+            fprint_err("### Unable to open output %s\n", name);
+            return 1;
+        }
+        break;
     case TS_W_TCP:
         if (!quiet)
             fprint_msg("Connecting to %s via TCP/IP on port %d\n", name, port);
@@ -2366,7 +2656,10 @@ int tswrite_start_buffering(TS_writer_p tswriter, int circ_buf_size, int TS_in_p
             (tswriter->how == TS_W_TCP ? "TCP/IP"
                                        : tswriter->how == TS_W_FILE
                         ? "file"
-                        : tswriter->how == TS_W_STDOUT ? "<standard output>" : "???"));
+                        : tswriter->how == TS_W_STDOUT ? "<standard output>"
+                                                       : tswriter->how == TS_W_SHM
+                                ? "shared memory"
+                                : "???"));
         return 1;
     }
 
@@ -2380,6 +2673,9 @@ int tswrite_start_buffering(TS_writer_p tswriter, int circ_buf_size, int TS_in_p
         (void)free_buffered_TS_output(&tswriter->writer);
         return 1;
     }
+
+    // Now the child has gone its own way, we can tune ourselves
+    (void)tswrite_tune_process("Parent", global_parent_rtprio, global_parent_cpu, tswriter->quiet);
     return 0;
 }
 
@@ -2566,6 +2862,11 @@ int tswrite_close_file(TS_writer_p tswriter)
             return 1;
         }
         break;
+    case TS_W_SHM:
+        err = close_shm_output(&tswriter->where.shm);
+        if (err)
+            return 1;
+        break;
     case TS_W_TCP:
     case TS_W_UDP:
         err = disconnect_socket(tswriter->where.socket);
@@ -2677,6 +2978,7 @@ int tswrite_write(
         switch (tswriter->how) {
         case TS_W_STDOUT:
         case TS_W_FILE:
+        case TS_W_SHM:
             err = write_file_data(tswriter, packet, TS_PACKET_SIZE);
             if (err)
                 return 1;
@@ -2706,6 +3008,216 @@ int tswrite_write(
     return 0;
 }
 
+/*
+ * Write a run of whole Transport Stream packets out via a TS writer that is
+ * writing to a file (or standard output, or shared memory).
+ *
+ * - `tswriter` is the TS output context returned by `tswrite_open`
+ * - `data` is the packets, and `data_len` their total length, which
+ *   should be a multiple of TS_PACKET_SIZE
+ *
+ * Returns 0 if all goes well, 1 if something went wrong.
+ */
+int tswrite_write_packets(TS_writer_p tswriter, byte* data, size_t data_len)
+{
+    int err;
+    if (tswriter->writer != nullptr
+        || (tswriter->how != TS_W_FILE && tswriter->how != TS_W_STDOUT
+            && tswriter->how != TS_W_SHM)) {
+        print_err("### Can only write runs of TS packets directly to a file\n");
+        return 1;
+    }
+    err = write_file_data(tswriter, data, data_len);
+    if (err)
+        return 1;
+    tswriter->count += (int)(data_len / TS_PACKET_SIZE);
+    return 0;
+}
+
+/*
+ * Copy a run of whole Transport Stream packets straight from part of an
+ * input file to a TS writer that is writing to a file (or standard output,
+ * or shared memory).
+ *
+ * - `tswriter` is the TS output context returned by `tswrite_open`
+ * - `file` is the file to copy from
+ * - `posn` is where to start copying from, and `length` how many bytes to
+ *   copy (which should be a multiple of TS_PACKET_SIZE). The file's own
+ *   position is not changed.
+ *
+ * The data is copied with copy_file_range(), so it need not pass through
+ * user space (and filesystems that support it may share the blocks rather
+ * than copying them). If that is not possible (for instance, because the
+ * output is a pipe, or shared memory), we fall back to reading and writing it.
+ *
+ * Returns 0 if all goes well, 1 if something went wrong.
+ */
+int tswrite_copy_file_range(TS_writer_p tswriter, int file, offset_t posn, offset_t length)
+{
+    int output = -1;
+    off_t from = (off_t)posn;
+    offset_t left = length;
+
+    if (tswriter->writer != nullptr
+        || (tswriter->how != TS_W_FILE && tswriter->how != TS_W_STDOUT
+            && tswriter->how != TS_W_SHM)) {
+        print_err("### Can only copy TS packets directly to a file\n");
+        return 1;
+    } else if (is_compressed_file(file)) {
+        print_err("### Can only copy TS packets directly from an uncompressed file\n");
+        return 1;
+    } else if (is_shm_file(file)) {
+        print_err("### Cannot copy TS packets directly from shared memory\n");
+        return 1;
+    }
+    if (tswriter->how != TS_W_SHM) {
+        // Anything we have already written must go before the copy
+        if (fflush(tswriter->where.file)) {
+            fprint_err("### Error flushing TS output: %s\n", strerror(errno));
+            return 1;
+        }
+        output = fileno(tswriter->where.file);
+    }
+
+    while (left > 0) {
+        // (there's no file to copy to for shared memory)
+        if (output != -1) {
+            ssize_t copied = copy_file_range(file, &from, output, nullptr, (size_t)left, 0);
+            if (copied > 0) {
+                left -= copied;
+                continue;
+            } else if (copied == 0) {
+                print_err("### Input file ended whilst copying TS packets\n");
+                return 1;
+            } else if (errno == EINTR)
+                continue;
+            else if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP
+                && errno != EBADF) {
+                fprint_err("### Error copying TS packets: %s\n", strerror(errno));
+                return 1;
+            }
+        }
+
+        // The kernel can't do it for us, so do it the long way round
+        while (left > 0) {
+            byte buffer[TS_PACKET_SIZE * 348]; // 64K or so
+            size_t want = (left < (offset_t)sizeof(buffer) ? (size_t)left : sizeof(buffer));
+            ssize_t got = pread(file, buffer, want, from);
+            if (got == -1 && errno == EINTR)
+                continue;
+            else if (got <= 0) {
+                fprint_err("### Error reading TS packets to copy: %s\n",
+                    (got == 0 ? "unexpected end of file" : strerror(errno)));
+                return 1;
+            }
+            if (write_file_data(tswriter, buffer, (size_t)got))
+                return 1;
+            from += got;
+            left -= got;
+        }
+    }
+    tswriter->count += (int)(length / TS_PACKET_SIZE);
+    return 0;
+}
+
+/*
+ * Send a run of whole Transport Stream packets straight from part of an
+ * input file to a TS writer that is writing to TCP/IP (without buffering).
+ *
+ * - `tswriter` is the TS output context returned by `tswrite_open`
+ * - `file` is the (uncompressed) file to send from
+ * - `posn` is where to start sending from. It is updated to the position
+ *   after the last byte sent. The file's own position is not changed.
+ * - `length` is the most to send
+ *
+ * The data is sent with sendfile(), so it need not pass through user space.
+ *
+ * If command input is enabled, then this also reads commands whilst it is
+ * waiting to send, and if the command changes (and the current command is
+ * not atomic), it stops sending at the end of the current TS packet.
+ *
+ * Returns 0 if all `length` bytes were sent, EOF if the file ended first,
+ * COMMAND_RETURN_CODE if the command changed, and 1 if something went wrong.
+ */
+int tswrite_send_file_range(TS_writer_p tswriter, int file, offset_t* posn, offset_t length)
+{
+    int err;
+    off_t from = (off_t)*posn;
+    offset_t left = length;
+    int result = 0;
+
+    if (tswriter->writer != nullptr || tswriter->how != TS_W_TCP) {
+        print_err("### Can only send TS packets directly from a file to TCP/IP\n");
+        return 1;
+    } else if (is_compressed_file(file)) {
+        print_err("### Can only send TS packets directly from an uncompressed file\n");
+        return 1;
+    } else if (is_shm_file(file)) {
+        print_err("### Cannot send TS packets directly from shared memory\n");
+        return 1;
+    }
+
+    while (left > 0) {
+        ssize_t sent;
+        size_t want = (left < TS_SENDFILE_SIZE ? (size_t)left : TS_SENDFILE_SIZE);
+
+        // Only stop between TS packets, so that whoever writes next starts
+        // at the start of one
+        if (tswrite_command_changed(tswriter) && (from - *posn) % TS_PACKET_SIZE == 0) {
+            result = COMMAND_RETURN_CODE;
+            break;
+        }
+
+        if (tswriter->command_socket != -1) {
+            // Our output socket is non-blocking, so wait until we can write
+            // to it (or are given a new command), just as write_tcp_data does
+            fd_set read_fds, write_fds;
+            int num_to_check
+                = max((int)tswriter->command_socket, (int)tswriter->where.socket) + 1;
+
+            FD_ZERO(&read_fds);
+            FD_ZERO(&write_fds);
+            if (!tswriter->command_changed)
+                FD_SET(tswriter->command_socket, &read_fds);
+            FD_SET(tswriter->where.socket, &write_fds);
+
+            err = select(num_to_check, &read_fds, &write_fds, nullptr, nullptr);
+            if (err == -1) {
+                if (errno == EINTR)
+                    continue;
+                fprint_err("### Error in select: %s\n", strerror(errno));
+                result = 1;
+                break;
+            }
+            if (FD_ISSET(tswriter->command_socket, &read_fds)) {
+                err = read_command(
+                    tswriter->command_socket, &tswriter->command, &tswriter->command_changed);
+                if (err) {
+                    result = 1;
+                    break;
+                }
+            }
+            if (!FD_ISSET(tswriter->where.socket, &write_fds))
+                continue;
+        }
+
+        sent = sendfile(tswriter->where.socket, file, &from, want);
+        if (sent > 0) {
+            left -= sent;
+        } else if (sent == 0) {
+            result = EOF;
+            break;
+        } else if (errno != EINTR && errno != EAGAIN && errno != ENOBUFS) {
+            fprint_err("### Error sending TS packets: %s\n", strerror(errno));
+            result = 1;
+            break;
+        }
+    }
+    tswriter->count += (int)((from - *posn) / TS_PACKET_SIZE);
+    *posn = (offset_t)from;
+    return result;
+}
+
 /*
  * Discontinuity on the stream being written (e.g. file looping)
  * If we are pacing the output then this resets the timing info
@@ -2814,9 +3326,44 @@ void tswrite_help_tuning(void)
         "(the exact values may change in future releases of this software).\n"
         "It may also sometimes help to specify '-nopcr' as well (i.e., ignore\n"
         "the timing information in the video stream itself).\n"
+        "\n"
+        "Normally the child process sleeps until each UDP packet is due, and then\n"
+        "sends it, so the timing depends upon how promptly it is woken. On Linux,\n"
+        "the kernel can do the pacing instead:\n"
+        "\n"
+        "  -txtime           Stamp each UDP packet with its departure time (SO_TXTIME)\n"
+        "                    for the fq qdisc to release it on time.\n"
+        "  -txtime-tai       The same, but for the etf qdisc (which uses CLOCK_TAI).\n"
+        "  -txtime-lead <n>  Hand each UDP packet to the kernel up to <n> microseconds\n"
+        "                    before it is due. The default is %d.\n"
+        "\n"
+        "The qdisc must be set up on the output interface, for instance with\n"
+        "'tc qdisc replace dev eth0 root fq'. If the kernel does not support\n"
+        "SO_TXTIME, or the qdisc drops packets because they reached it too late,\n"
+        "the child goes back to sleeping (and, in the latter case, stamps each UDP\n"
+        "packet to leave -txtime-lead after it wakes, since the qdisc still wants\n"
+        "a departure time). If no such qdisc is configured, the\n"
+        "departure times are ignored, and packets may go up to -txtime-lead early.\n"
+        "\n"
+        "When sharing a machine with other work, it can help to give the processes\n"
+        "a real time priority, and keep them on their own CPUs (this typically needs\n"
+        "root, or CAP_SYS_NICE and CAP_IPC_LOCK). What was achieved is reported at\n"
+        "startup.\n"
+        "\n"
+        "  -cprio <n>        Run the child (output pacing) process with SCHED_FIFO\n"
+        "                    priority <n> (1..99).\n"
+        "  -pprio <n>        Run the parent (reading) process with SCHED_FIFO\n"
+        "                    priority <n> (1..99).\n"
+        "  -ccpu <n>         Pin the child process to CPU <n>.\n"
+        "  -pcpu <n>         Pin the parent process to CPU <n>.\n"
+        "  -mlock            Lock all memory (including the circular buffer and any\n"
+        "                    input read-ahead) into RAM, pre-faulting the circular\n"
+        "                    buffer, so that neither process ever waits for paging.\n"
+        "  -hugepages        Map the circular buffer using (2MB) huge pages, which\n"
+        "                    must have been reserved (vm.nr_hugepages).\n"
         "",
         DEFAULT_BYTE_RATE, DEFAULT_BYTE_RATE * 8, DEFAULT_CIRCULAR_BUFFER_SIZE,
-        DEFAULT_PRIME_SIZE);
+        DEFAULT_PRIME_SIZE, DEFAULT_TXTIME_LEAD);
 }
 
 /*
@@ -2905,6 +3452,21 @@ void tswrite_report_args(TS_context_p context)
     if (global_child_wait != DEFAULT_CHILD_WAIT)
         fprint_msg("Child will wait %dms for buffer to unempty\n", global_child_wait);
 
+    if (global_parent_rtprio || global_child_rtprio)
+        fprint_msg("SCHED_FIFO priority: parent %d, child %d (0 means not changed)\n",
+            global_parent_rtprio, global_child_rtprio);
+    if (global_parent_cpu >= 0 || global_child_cpu >= 0)
+        fprint_msg("CPU: parent %d, child %d (-1 means not pinned)\n", global_parent_cpu,
+            global_child_cpu);
+    if (global_mlock || global_hugepages)
+        fprint_msg("Memory:%s%s%s\n", global_mlock ? " locked" : "",
+            global_mlock && global_hugepages ? "," : "",
+            global_hugepages ? " huge pages for circular buffer" : "");
+
+    if (global_txtime)
+        fprint_msg("Kernel pacing (SO_TXTIME, %s qdisc), sending up to %dus early\n",
+            global_txtime_clock == CLOCK_TAI ? "etf" : "fq", global_txtime_lead);
+
     if (global_perturb_range) {
         fprint_msg("Randomly perturbing child time by -%u..%ums"
                    " with seed %u\n",
@@ -3103,6 +3665,66 @@ int tswrite_process_args(char* prefix, int argc, char* argv[], TS_context_p cont
             global_child_wait = temp;
             argv[ii] = argv[ii + 1] = TSWRITE_PROCESSED;
             ii++;
+        } else if (!strcmp("-cprio", argv[ii]) || !strcmp("-pprio", argv[ii])) {
+            int temp;
+            CHECKARG(prefix, ii);
+            err = int_value(prefix, argv[ii], argv[ii + 1], true, 10, &temp);
+            if (err)
+                return 1;
+            if (temp < sched_get_priority_min(SCHED_FIFO)
+                || temp > sched_get_priority_max(SCHED_FIFO)) {
+                fprint_err("### %s: %s %d is not a valid SCHED_FIFO priority\n", prefix,
+                    argv[ii], temp);
+                return 1;
+            }
+            if (argv[ii][1] == 'c')
+                global_child_rtprio = temp;
+            else
+                global_parent_rtprio = temp;
+            argv[ii] = argv[ii + 1] = TSWRITE_PROCESSED;
+            ii++;
+        } else if (!strcmp("-ccpu", argv[ii]) || !strcmp("-pcpu", argv[ii])) {
+            int temp;
+            CHECKARG(prefix, ii);
+            err = int_value(prefix, argv[ii], argv[ii + 1], true, 10, &temp);
+            if (err)
+                return 1;
+            if (temp >= CPU_SETSIZE) {
+                fprint_err("### %s: %s %d is not a valid CPU number\n", prefix, argv[ii], temp);
+                return 1;
+            }
+            if (argv[ii][1] == 'c')
+                global_child_cpu = temp;
+            else
+                global_parent_cpu = temp;
+            argv[ii] = argv[ii + 1] = TSWRITE_PROCESSED;
+            ii++;
+        } else if (!strcmp("-mlock", argv[ii])) {
+            global_mlock = true;
+            argv[ii] = TSWRITE_PROCESSED;
+        } else if (!strcmp("-hugepages", argv[ii])) {
+            global_hugepages = true;
+            argv[ii] = TSWRITE_PROCESSED;
+        } else if (!strcmp("-txtime", argv[ii])) {
+            global_txtime = true;
+            global_txtime_clock = CLOCK_MONOTONIC;
+            argv[ii] = TSWRITE_PROCESSED;
+        } else if (!strcmp("-txtime-tai", argv[ii])) {
+            global_txtime = true;
+            global_txtime_clock = CLOCK_TAI;
+            argv[ii] = TSWRITE_PROCESSED;
+        } else if (!strcmp("-txtime-lead", argv[ii])) {
+            CHECKARG(prefix, ii);
+            err = int_value(prefix, argv[ii], argv[ii + 1], true, 10, &global_txtime_lead);
+            if (err)
+                return 1;
+            if (global_txtime_lead > 200000) {
+                fprint_err("### %s: -txtime-lead %d (more than 0.2s) not allowed\n", prefix,
+                    global_txtime_lead);
+                return 1;
+            }
+            argv[ii] = argv[ii + 1] = TSWRITE_PROCESSED;
+            ii++;
         } else if (!strcmp("-perturb", argv[ii])) {
             int temp;
             if (ii + 3 >= argc) {
@@ -14,6 +14,7 @@
 
 #include "compat.h"
 #include "h222_defns.h"
+#include "shmring_defns.h"
 #include "ts_defns.h"
 
 typedef int SOCKET; // for compatibility with Windows
@@ -36,14 +37,16 @@ enum TS_writer_type {
     TS_W_FILE, // a file
     TS_W_TCP, // a socket, over TCP/IP
     TS_W_UDP, // a socket, over UDP
+    TS_W_SHM, // a shared memory ring, read by another local program
 };
 typedef enum TS_writer_type TS_WRITER_TYPE;
 
 // ------------------------------------------------------------
-// So, *is* it a file or a socket?
+// So, *is* it a file or a socket (or shared memory)?
 union TS_writer_output {
     FILE* file;
     SOCKET socket;
+    shm_ring_p shm;
 };
 
 // ------------------------------------------------------------
@@ -60,6 +63,9 @@ union TS_writer_output {
 // set to a buffered output context. Since the circular buffer is being
 // used, there will also be a child process.
 //
+// When writing to shared memory, "how" will be TS_W_SHM, and "where" will
+// be the ring being written to. As for a file, "writer" is not necessary.
+//
 // When writing over TCP/IP, "how" will be TS_W_TCP, and "where" will be the
 // socket that is being written to. Timing is not an issue, so "writer" will
 // not be needed, and nor will there be a child process.  However, it is
@@ -138,6 +144,10 @@ typedef struct TS_writer* TS_writer_p;
 // And a "return code" that means "the command character has changed"
 #define COMMAND_RETURN_CODE -999
 
+// The most that `tswrite_send_file_range` asks the kernel to send at once
+// (so that it notices new commands reasonably promptly)
+#define TS_SENDFILE_SIZE (TS_PACKET_SIZE * 1024)
+
 typedef enum tswrite_pcr_mode_e {
     TSWRITE_PCR_MODE_NONE,
     TSWRITE_PCR_MODE_PCR1,
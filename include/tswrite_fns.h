@@ -56,7 +56,8 @@
  * For TS_W_FILE, ``open(name,O_CREAT|O_WRONLY|O_TRUNC|O_BINARY,00777)``
  * is used - i.e., the file is opened so that anyone may read/write/execute
  * it. If ``O_BINARY`` is not defined (e.g., on Linux), then it is
- * omitted.
+ * omitted. If `name` ends in ".gz" or ".zst", the output is compressed
+ * accordingly (see `fopen_compressed`).
  *
  * For TS_W_TCP and TS_W_UDP, the ``connect_socket`` function is called,
  * which uses ``socket`` and ``connect``.
@@ -264,6 +265,58 @@ int wait_for_command(TS_writer_p tswriter);
 int tswrite_write(
     TS_writer_p tswriter, byte packet[TS_PACKET_SIZE], uint32_t pid, int got_pcr, uint64_t pcr);
 
+/*
+ * Write a run of whole Transport Stream packets out via a TS writer that is
+ * writing to a file (or standard output).
+ *
+ * - `tswriter` is the TS output context returned by `tswrite_open`
+ * - `data` is the packets, and `data_len` their total length, which
+ *   should be a multiple of TS_PACKET_SIZE
+ *
+ * Returns 0 if all goes well, 1 if something went wrong.
+ */
+int tswrite_write_packets(TS_writer_p tswriter, byte* data, size_t data_len);
+
+/*
+ * Copy a run of whole Transport Stream packets straight from part of an
+ * input file to a TS writer that is writing to a file (or standard output).
+ *
+ * - `tswriter` is the TS output context returned by `tswrite_open`
+ * - `file` is the file to copy from
+ * - `posn` is where to start copying from, and `length` how many bytes to
+ *   copy (which should be a multiple of TS_PACKET_SIZE). The file's own
+ *   position is not changed.
+ *
+ * The data is copied with copy_file_range(), so it need not pass through
+ * user space (and filesystems that support it may share the blocks rather
+ * than copying them). If that is not possible (for instance, because the
+ * output is a pipe), we fall back to reading and writing it.
+ *
+ * Returns 0 if all goes well, 1 if something went wrong.
+ */
+int tswrite_copy_file_range(TS_writer_p tswriter, int file, offset_t posn, offset_t length);
+
+/*
+ * Send a run of whole Transport Stream packets straight from part of an
+ * input file to a TS writer that is writing to TCP/IP (without buffering).
+ *
+ * - `tswriter` is the TS output context returned by `tswrite_open`
+ * - `file` is the (uncompressed) file to send from
+ * - `posn` is where to start sending from. It is updated to the position
+ *   after the last byte sent. The file's own position is not changed.
+ * - `length` is the most to send
+ *
+ * The data is sent with sendfile(), so it need not pass through user space.
+ *
+ * If command input is enabled, then this also reads commands whilst it is
+ * waiting to send, and if the command changes (and the current command is
+ * not atomic), it stops sending at the end of the current TS packet.
+ *
+ * Returns 0 if all `length` bytes were sent, EOF if the file ended first,
+ * COMMAND_RETURN_CODE if the command changed, and 1 if something went wrong.
+ */
+int tswrite_send_file_range(TS_writer_p tswriter, int file, offset_t* posn, offset_t length);
+
 int tswrite_discontinuity(const TS_writer_p tswriter);
 
 /*
@@ -42,9 +42,12 @@
 #include "audio.h"
 #include "avs.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
 #include "filter.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "l2audio.h"
@@ -53,14 +56,14 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
 
-#define M2TS_PACKET_SIZE (4 + TS_PACKET_SIZE)
-
 struct _m2ts_packet_buffer {
     struct _m2ts_packet_buffer* next;
     struct _m2ts_packet_buffer* prev;
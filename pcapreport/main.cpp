@@ -42,9 +42,12 @@
 #include "audio.h"
 #include "avs.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
 #include "filter.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "l2audio.h"
@@ -53,8 +56,10 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
@@ -222,7 +227,12 @@ typedef struct pcapreport_ctx_struct {
     uint32_t filter_dest_addr;
     uint32_t filter_dest_port;
 
+    // Set if frames for other destinations can be dropped before decoding
+    int use_flow_filter;
+    ipv4_flow_filter_t flow_filter;
+
     const char* output_name_base;
+    const char* compress_ext; // Appended to extracted file names, if not nullptr
 
     int64_t opt_skew_discontinuity_threshold;
 
@@ -378,8 +388,9 @@ static void stream_gen_names2(const pcapreport_ctx_t* const ctx, pcapreport_stre
         memcpy(name, base_name, base_len + 1);
 
         if (!fixed_extract_name)
-            snprintf(name + base_len, 100, "%s%s%s", identifier, ".",
-                (rtp_header != nullptr && rtp_header->is_rtp_raw) ? "rtp" : "ts");
+            snprintf(name + base_len, 100, "%s%s%s%s", identifier, ".",
+                (rtp_header != nullptr && rtp_header->is_rtp_raw) ? "rtp" : "ts",
+                (ctx->compress_ext != nullptr ? ctx->compress_ext : ""));
         st->output_name = name;
     }
 
@@ -482,18 +493,6 @@ static int digest_times_seek(void* handle, offset_t val)
     return 1;
 }
 
-// 33 bit comparison
-static int64_t pts_diff(const uint64_t a, const uint64_t b)
-{
-    return ((int64_t)(a - b) << 31) >> 31;
-}
-
-static int64_t pts_diff_abs(const uint64_t a, const uint64_t b)
-{
-    const int64_t t = pts_diff(a, b);
-    return t < 0 ? -t : t;
-}
-
 static int digest_times(pcapreport_ctx_t* const ctx, pcapreport_stream_t* const st,
     const pcaprec_hdr_t* const pcap_pkt_hdr, const ethernet_packet_t* const epkt,
     const ipv4_header_t* const ipv4_header, const ipv4_udp_header_t* const udp_header,
@@ -613,16 +612,17 @@ static int digest_times(pcapreport_ctx_t* const ctx, pcapreport_stream_t* const
                             // fprint_msg("pcr = %lld t_pcr = %lld diff = %lld\n",
                             //            pcr, t_pcr, t_pcr - pcr);
 
-                            pcr_time_offset = pts_diff(t_pcr, pcr);
+                            pcr_time_offset = pts_signed_diff(t_pcr, pcr);
 
                             skew = tsect->pcr_count == 0
                                 ? 0LL
-                                : pcr_time_offset - pts_diff(tsect->time_first, tsect->pcr_start);
+                                : pcr_time_offset
+                                    - pts_signed_diff(tsect->time_first, tsect->pcr_start);
 
                             // Change section if discontinuity too big
                             if (st->skew_discontinuity_threshold > 0 && tsect->pcr_count != 0) {
-                                const int64_t pcr_delta = pts_diff_abs(pcr, tsect->pcr_last);
-                                const int64_t time_delta = pts_diff_abs(t_pcr, tsect->time_last);
+                                const int64_t pcr_delta = pts_abs_diff(pcr, tsect->pcr_last);
+                                const int64_t time_delta = pts_abs_diff(t_pcr, tsect->time_last);
                                 const int64_t skew_delta = skew - tsect->skew_last;
 
                                 if (pcr_delta > st->skew_discontinuity_threshold
@@ -746,7 +746,7 @@ static int write_out_packet(pcapreport_ctx_t* const ctx, pcapreport_stream_t* co
             fprint_msg("pcapreport: Dumping %s packets for %s:%d to %s\n",
                 ctx->good_ts_only ? "good ts" : ctx->keep_bad ? "all" : "ts",
                 ipv4_addr_to_string(st->output_dest_addr), st->output_dest_port, st->output_name);
-            st->output_file = fopen(st->output_name, "wb");
+            st->output_file = fopen_compressed(st->output_name, true);
             if (!st->output_file) {
                 fprint_err("### pcapreport: Cannot open %s .\n", st->output_name);
                 return 1;
@@ -820,7 +820,7 @@ static int write_rtp_raw_packet(pcapreport_ctx_t* const ctx, pcapreport_stream_t
         if (st->output_file == nullptr) {
             fprint_msg("pcapreport: Dumping raw RTP packets for %s:%d to %s\n",
                 ipv4_addr_to_string(st->output_dest_addr), st->output_dest_port, st->output_name);
-            st->output_file = fopen(st->output_name, "wb");
+            st->output_file = fopen_compressed(st->output_name, true);
             if (!st->output_file) {
                 fprint_err("### pcapreport: Cannot open %s .\n", st->output_name);
                 return 1;
@@ -1018,6 +1018,8 @@ static void stream_analysis(const pcapreport_ctx_t* const ctx, const pcapreport_
 {
     uint32_t dest_addr = st->output_dest_addr;
     char pbuf[32];
+    TCHAR time_buf1[FMTX_TIMESTAMP_MAX], time_buf2[FMTX_TIMESTAMP_MAX];
+    TCHAR time_buf3[FMTX_TIMESTAMP_MAX];
 
     if (ctx->verbose < 1 && st->seen_good == 0)
         return;
@@ -1060,7 +1062,7 @@ static void stream_analysis(const pcapreport_ctx_t* const ctx, const pcapreport_
             uint64_t time_offset = ctx->time_start;
             int64_t time_len = tsect->time_last - tsect->time_first; // PCR duration
             int64_t time_len2 = tsect->time_final - tsect->time_start; // Stream duration
-            int64_t pcr_len = pts_diff(tsect->pcr_last, tsect->pcr_start);
+            int64_t pcr_len = pts_signed_diff(tsect->pcr_last, tsect->pcr_start);
             int64_t drift = time_len - pcr_len;
             fprint_msg("  Section %d:\n", tsect->section_no);
             fprint_msg("    Pkts: %u->%u\n", tsect->pkt_start, tsect->pkt_final);
@@ -1070,36 +1072,41 @@ static void stream_analysis(const pcapreport_ctx_t* const ctx, const pcapreport_
                     ? 0LL
                     : (tsect->ts_byte_final - tsect->ts_byte_start) * 8ULL * 90000ULL / time_len2);
             fprint_msg("    Time (Total): %s->%s (%s)\n",
-                fmtx_timestamp(tsect->time_start - time_offset, ctx->tfmt),
-                fmtx_timestamp(tsect->time_final - time_offset, ctx->tfmt),
-                fmtx_timestamp(time_len2, ctx->tfmt));
+                fmtx_timestamp_r(
+                    time_buf1, sizeof(time_buf1), tsect->time_start - time_offset, ctx->tfmt),
+                fmtx_timestamp_r(
+                    time_buf2, sizeof(time_buf2), tsect->time_final - time_offset, ctx->tfmt),
+                fmtx_timestamp_r(time_buf3, sizeof(time_buf3), time_len2, ctx->tfmt));
             if (tsect->pcr_count == 0) {
                 fprint_msg("    No PCRs seen\n");
             } else {
                 fprint_msg("    Time (PCRs): %s->%s (%s)\n",
-                    fmtx_timestamp(tsect->time_first - time_offset, ctx->tfmt),
-                    fmtx_timestamp(tsect->time_last - time_offset, ctx->tfmt),
-                    fmtx_timestamp(time_len, ctx->tfmt));
+                    fmtx_timestamp_r(
+                        time_buf1, sizeof(time_buf1), tsect->time_first - time_offset, ctx->tfmt),
+                    fmtx_timestamp_r(
+                        time_buf2, sizeof(time_buf2), tsect->time_last - time_offset, ctx->tfmt),
+                    fmtx_timestamp_r(time_buf3, sizeof(time_buf3), time_len, ctx->tfmt));
                 fprint_msg("    PCR[count=%u]: %s->%s (%s)\n", tsect->pcr_count,
-                    fmtx_timestamp(tsect->pcr_start, ctx->tfmt),
-                    fmtx_timestamp(tsect->pcr_last, ctx->tfmt),
-                    fmtx_timestamp(pcr_len, ctx->tfmt));
+                    fmtx_timestamp_r(time_buf1, sizeof(time_buf1), tsect->pcr_start, ctx->tfmt),
+                    fmtx_timestamp_r(time_buf2, sizeof(time_buf2), tsect->pcr_last, ctx->tfmt),
+                    fmtx_timestamp_r(time_buf3, sizeof(time_buf3), pcr_len, ctx->tfmt));
                 fprint_msg("    Drift: diff=%s; rate=%s/min; 1s per %llds%s\n",
-                    fmtx_timestamp(time_len - pcr_len, ctx->tfmt),
-                    fmtx_timestamp(
+                    fmtx_timestamp_r(time_buf1, sizeof(time_buf1), time_len - pcr_len, ctx->tfmt),
+                    fmtx_timestamp_r(time_buf2, sizeof(time_buf2),
                         time_len == 0 ? 0LL : drift * 60LL * 90000LL / time_len, ctx->tfmt),
                     drift == 0 ? 0LL : time_len / drift,
                     drift == 0 ? "" : drift < 0 ? " (fast)" : " (slow)");
                 fprint_msg("    Max jitter: %s; Skew min: %s, max: %s\n",
-                    fmtx_timestamp(tsect->jitter_max, ctx->tfmt),
-                    fmtx_timestamp(tsect->skew_min, ctx->tfmt),
-                    fmtx_timestamp(tsect->skew_max, ctx->tfmt));
+                    fmtx_timestamp_r(time_buf1, sizeof(time_buf1), tsect->jitter_max, ctx->tfmt),
+                    fmtx_timestamp_r(time_buf2, sizeof(time_buf2), tsect->skew_min, ctx->tfmt),
+                    fmtx_timestamp_r(time_buf3, sizeof(time_buf3), tsect->skew_max, ctx->tfmt));
             }
             if (st->rtp_info.n != 0) {
                 fprint_msg("    PCR/RTP skew: min=%s max=%s (diff=%s)\n",
-                    fmtx_timestamp(tsect->rtp_skew_min, ctx->tfmt),
-                    fmtx_timestamp(tsect->rtp_skew_max, ctx->tfmt),
-                    fmtx_timestamp(tsect->rtp_skew_max - tsect->rtp_skew_min, ctx->tfmt));
+                    fmtx_timestamp_r(time_buf1, sizeof(time_buf1), tsect->rtp_skew_min, ctx->tfmt),
+                    fmtx_timestamp_r(time_buf2, sizeof(time_buf2), tsect->rtp_skew_max, ctx->tfmt),
+                    fmtx_timestamp_r(time_buf3, sizeof(time_buf3),
+                        tsect->rtp_skew_max - tsect->rtp_skew_min, ctx->tfmt));
             }
         }
     }
@@ -1246,6 +1253,9 @@ static void print_usage()
               "  -n <file>          Set the default base name for output files; by default\n"
               "                     this will be the input name without any .pcap suffix\n"
               "  -x, --extract      Extract TS(s) to files of the default name\n"
+              "  -compress <gzip|zstd>\n"
+              "                     Compress the extracted TS(s), adding .gz or .zst to\n"
+              "                     their names\n"
               "  -c, --csvgen       Create a .csv file for each stream containing timing info\n"
               "  -output <file>\n"
               "  -o <file>,         Dump selected UDP payloads to output file(s)\n"
@@ -1277,6 +1287,8 @@ static void print_usage()
               "\n"
               "  -err stdout        Write error messages to standard output (the default)\n"
               "  -err stderr        Write error messages to standard error (Unix traditional)\n"
+              "  -async             Write output from a background thread. This makes\n"
+              "                     -verbose much faster when writing to a terminal or pipe.\n"
               "\n"
               "Specifying 0.0.0.0 for destination IP will capture all hosts, specifying 0\n"
               "as a destination port will capture all ports on the destination host.\n"
@@ -1378,6 +1390,7 @@ int main(int argc, char** argv)
 {
     int err = 0;
     int ii = 1;
+    int async_output = false;
     pcapreport_ctx_t sctx = { 0 };
     pcapreport_ctx_t* const ctx = &sctx;
 
@@ -1421,6 +1434,8 @@ int main(int argc, char** argv)
                     return 1;
                 }
                 ii++;
+            } else if (!strcmp("async", arg)) {
+                async_output = true;
             } else if (!strcmp("output", arg)) {
                 CHECKARG("pcapreport", ii);
                 ctx->output_name_base = argv[++ii];
@@ -1465,6 +1480,19 @@ int main(int argc, char** argv)
                 ctx->base_name = strdup(argv[++ii]); // So we know it is always malloced
             } else if (strcmp("extract", arg) == 0) {
                 ctx->extract = true;
+            } else if (strcmp("compress", arg) == 0) {
+                CHECKARG("pcapreport", ii);
+                if (!strcmp(argv[ii + 1], "gzip") || !strcmp(argv[ii + 1], "gz"))
+                    ctx->compress_ext = ".gz";
+                else if (!strcmp(argv[ii + 1], "zstd") || !strcmp(argv[ii + 1], "zst"))
+                    ctx->compress_ext = ".zst";
+                else {
+                    fprint_err("### pcapreport: "
+                               "Unrecognised option '%s' to -compress (not 'gzip' or 'zstd')\n",
+                        argv[ii + 1]);
+                    return 1;
+                }
+                ii++;
             } else if (strcmp("csvgen", arg) == 0) {
                 ctx->csv_gen = true;
             } else if (strcmp("good-ts-only", arg) == 0) {
@@ -1505,6 +1533,11 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    if (async_output && redirect_output_async()) {
+        print_err("### pcapreport: Unable to start background output thread\n");
+        return 1;
+    }
+
     // If the dest:port is fully specified then avoid guesswork
     if (ctx->filter_dest_addr != 0 && ctx->filter_dest_port != 0)
         ctx->keep_bad = true;
@@ -1513,6 +1546,14 @@ int main(int argc, char** argv)
     if (ctx->good_ts_only)
         ctx->keep_bad = false;
 
+    // Only drop frames early if nothing wants to report on the ones we drop
+    if ((ctx->filter_dest_addr != 0 || ctx->filter_dest_port != 0) && !ctx->verbose
+        && !ctx->dump_data && !ctx->dump_extra) {
+        ipv4_flow_filter_compile(
+            &ctx->flow_filter, ctx->filter_dest_addr, ctx->filter_dest_port);
+        ctx->use_flow_filter = true;
+    }
+
     if (ctx->base_name == nullptr) {
         // If we have no default name then use the input name as a base after
         // stripping off any likely pcap extension
@@ -1520,9 +1561,15 @@ int main(int argc, char** argv)
 
         const char* const input_name = ctx->input_name == nullptr ? "pcap" : ctx->input_name;
         char* const buf = strdup(ctx->input_name);
-        const size_t len = strlen(input_name);
+        size_t len = strlen(input_name);
         int i;
 
+        // A compressed capture is read as if it were not
+        if (compression_for_name(buf) != COMPRESSED_NONE) {
+            len = strrchr(buf, '.') - buf;
+            buf[len] = 0;
+        }
+
         for (i = 0; i != sizeof(strip_exts) / sizeof(strip_exts[0]); ++i) {
             const size_t extlen = strlen(strip_exts[i]);
             if (len > extlen && strcmp(strip_exts[i], buf + len - extlen) == 0) {
@@ -1535,7 +1582,11 @@ int main(int argc, char** argv)
 
     fprint_msg("%s\n", ctx->input_name);
 
-    err = pcap_open(&ctx->pcreader, &ctx->pcap_hdr, ctx->input_name);
+    // Compressed captures are decompressed as they are read
+    {
+        FILE* input = (ctx->input_name ? fopen_compressed(ctx->input_name, false) : stdin);
+        err = (input == nullptr ? -1 : pcap_open_file(&ctx->pcreader, &ctx->pcap_hdr, input));
+    }
     if (err) {
         fprint_err("### pcapreport: Unable to open input file %s for reading "
                    "PCAP (code %d)\n",
@@ -1587,6 +1638,13 @@ int main(int argc, char** argv)
                     ctx->time_start = pkt_time(&rec_hdr);
                 }
 
+                if (ctx->use_flow_filter
+                    && ctx->pcap_hdr.network == PCAP_NETWORK_TYPE_ETHERNET
+                    && ipv4_flow_filter_rejects(&ctx->flow_filter, data, len)) {
+                    free(allocated);
+                    break;
+                }
+
                 if (ctx->verbose) {
                     fprint_msg("pkt: Time = %d.%d orig_len = %d \n", rec_hdr.ts_sec,
                         rec_hdr.ts_usec, rec_hdr.orig_len);
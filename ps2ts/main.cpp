@@ -36,8 +36,11 @@
 
 #include "accessunit.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "misc.h"
@@ -45,8 +48,10 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
@@ -384,9 +389,13 @@ int main(int argc, char** argv)
             fprint_msg(
                 "Reading input as %s (0x%02x)\n", h222_stream_type_str(video_type), video_type);
     } else {
-        err = determine_PS_video_type(ps, &video_type);
+        struct stream_probe probe;
+        init_stream_probe(&probe);
+        err = probe_stream_file(ps->input, 0, verbose, &probe);
         if (err)
             return 1;
+        video_type = probe.video_type;
+        clear_stream_probe(&probe);
         if (!quiet)
             fprint_msg(
                 "Video appears to be %s (0x%02x)\n", h222_stream_type_str(video_type), video_type);
@@ -36,9 +36,13 @@
 #include <unistd.h>
 
 #include "accessunit.h"
+#include "batch.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "misc.h"
@@ -46,8 +50,10 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
@@ -62,243 +68,70 @@
 #define STREAM_IS_ERROR 0
 
 /*
- * Look for an initial 0x47 sync byte, and check for TS
- *
- * Returns 0 if nothing went wrong, 1 if something did.
- */
-static int check_if_TS(int input, byte cur_byte, int verbose, int* decided, int* result)
-{
-    int ii;
-
-    if (verbose)
-        print_msg("Is it Transport Stream?\n");
-
-    // It may be enough to look at the first byte of the stream
-    if (cur_byte != 0x47) {
-        if (verbose)
-            fprint_msg("  First byte in file is 0x%02X not 0x47, so it is not\n", cur_byte);
-        return 0;
-    }
-
-    // Transport Stream packets start with 0x47, so it's a good bet.
-    if (verbose)
-        print_msg("  First byte in file is 0x47, so it looks like Transport Stream\n");
-
-    // To check a bit, we can try looking at every 188th byte
-    if (verbose)
-        print_msg("  Checking next 500 packets to see if they start 0x47\n");
-    for (ii = 0; ii < 500; ii++) {
-        byte buf[TS_PACKET_SIZE];
-        int err = read_bytes(input, TS_PACKET_SIZE, buf);
-        if (err) {
-            fprint_err("### %s trying to read start of packet %d\n",
-                (err == EOF ? "EOF" : "Error"), ii + 1);
-            return 1;
-        }
-        if (buf[TS_PACKET_SIZE - 1] != 0x47) {
-            if (verbose)
-                fprint_msg("  Packet %d does not start with 0x47 (%02x instead)\n", ii + 1,
-                    buf[TS_PACKET_SIZE - 1]);
-            return 0;
-        }
-    }
-    if (verbose)
-        print_msg("The checked packets all start with 0x47 - looks like TS\n");
-    *decided = true;
-    *result = STREAM_IS_TS;
-    return 0;
-}
-
-/*
- * Try to decide if we *have* got program stream
- *
- * Returns 0 if nothing went wrong, 1 if something did.
- */
-static int check_if_PS(int input, int verbose, int* decided, int* result)
-{
-    int err;
-    byte buf[10];
-    int stuffing_length;
-
-    if (verbose) {
-        print_msg("Is it Program Stream?\n");
-        print_msg("  Trying to read pack header\n");
-    }
-
-    err = read_bytes(input, 4, buf);
-    if (err) {
-        fprint_err(
-            "### %s trying to read start of first PS packet\n", (err == EOF ? "EOF" : "Error"));
-        return 1;
-    }
-
-    if (buf[0] != 0 || buf[1] != 0 || buf[2] != 1 || buf[3] != 0xba) {
-        if (verbose)
-            fprint_msg("  File starts %02X %02X %02X %02X, not 00 00 01 BA - not PS\n", buf[0],
-                buf[1], buf[2], buf[3]);
-        return 0;
-    }
-
-    if (verbose)
-        print_msg("  File starts 00 00 01 BA - could be PS,"
-                  " reading pack header body\n");
-
-    err = read_bytes(input, 8, buf);
-    if (err) {
-        fprint_err(
-            "### %s trying to read body of PS pack header\n", (err == EOF ? "EOF" : "Error"));
-        return 1;
-    }
-
-    if ((buf[0] & 0xF0) == 0x20) {
-        if (verbose)
-            print_msg("  Looks like ISO/IEC 11171-1/MPEG-1 pack header\n");
-    } else if ((buf[0] & 0xC0) == 0x40) {
-        if (verbose)
-            print_msg("  Looks like ISO/IEC 13818-1/H.222.0 pack header\n");
-        err = read_bytes(input, 2, &(buf[8]));
-        if (err) {
-            fprint_err("### %s trying to read last 2 bytes of body of PS pack header\n",
-                (err == EOF ? "EOF" : "Error"));
-            return 1;
-        }
-
-        stuffing_length = buf[9] & 0x07;
-
-        // And ignore that many stuffing bytes...
-        if (stuffing_length > 0) {
-            err = read_bytes(input, stuffing_length, buf);
-            if (err) {
-                fprint_err("### %s trying to read PS pack header stuffing bytes\n",
-                    (err == EOF ? "EOF" : "Error"));
-                return 1;
-            }
-        }
-    }
-
-    // We could check for reserved bits - maybe at another time
-
-    if (verbose)
-        print_msg("  OK, trying to read start of next packet\n");
-
-    err = read_bytes(input, 4, buf);
-    if (err) {
-        fprint_err(
-            "### %s trying to read start of next PS packet\n", (err == EOF ? "EOF" : "Error"));
-        return 1;
-    }
-
-    if (buf[0] != 0 || buf[1] != 0 || buf[2] != 1) {
-        if (verbose)
-            fprint_msg("  Next 'packet' starts %02X %02X %02X, not 00 00 01 - not PS\n", buf[0],
-                buf[1], buf[2]);
-        return 0;
-    }
-
-    if (verbose)
-        print_msg("  Start of second packet found at right place - looks like PS\n");
-
-    *decided = true;
-    *result = STREAM_IS_PS;
-    return 0;
-}
-
-/*
- * Look at the start of our "elementary" stream, and try to determine
- * its actual type.
+ * Look at the start of our stream, and try to determine its actual type.
  *
  * - `input` is the input stream to inspect
+ * - `probe_size` is the most of it to look at
  * - if `verbose` is true, the caller wants details of how the decision
  *   is being made
  * - `decided` is returned true if the function believes it has identified
  *   the stream type, in which case:
  * - `result` will an appropriate value indicating what we've decided
  *
- * Note that this function reads into the stream, and may attempt to
- * rewind it.
- *
  * Returns 0 if nothing went wrong, 1 if an error occurred
  */
-static int determine_packet_type(int input, int verbose, int* decided, int* result)
+static int determine_packet_type(
+    int input, uint32_t probe_size, int verbose, int* decided, int* result)
 {
     int err;
-    ssize_t length;
-    byte first_byte;
-    int video_type;
+    struct stream_probe probe;
 
-    length = read(input, &first_byte, 1);
-    if (length == 0) {
-        print_err("### EOF reading first byte\n");
-        return 1;
-    } else if (length == -1) {
-        fprint_err("### Error reading first byte: %s\n", strerror(errno));
+    init_stream_probe(&probe);
+    err = probe_stream_file(input, probe_size, verbose, &probe);
+    if (err)
         return 1;
-    }
 
-    // Does it look like transport stream?
-    err = check_if_TS(input, first_byte, verbose, decided, result);
-    if (err) {
-        close_file(input);
-        return 1;
-    }
-    if (*decided) {
-        close_file(input);
-        return 0;
-    }
-
-    seek_file(input, 0);
-
-    // Does it look like program stream?
-    err = check_if_PS(input, verbose, decided, result);
-    if (err) {
-        close_file(input);
-        return 1;
-    }
-    if (*decided) {
-        close_file(input);
-        return 0;
-    }
-
-    seek_file(input, 0);
-
-    // Does it look like one of the types of ES we recognise?
     if (verbose)
-        print_msg("Is it an Elementary Stream we recognise?\n");
-
-    err = decide_ES_file_video_type(input, !verbose, verbose, &video_type);
-    if (err) {
-        close_file(input);
-        return 1;
-    }
+        report_stream_probe(true, &probe);
 
-    switch (video_type) {
-    case VIDEO_H264:
-        *result = STREAM_IS_H264;
+    switch (probe.container) {
+    case PROBE_CONTAINER_TS:
+        *result = STREAM_IS_TS;
         *decided = true;
         break;
-    case VIDEO_H262:
-        *result = STREAM_IS_H262;
+    case PROBE_CONTAINER_PS:
+        *result = STREAM_IS_PS;
         *decided = true;
         break;
-    case VIDEO_AVS:
-        *result = STREAM_IS_AVS;
-        *decided = true;
-        break;
-    case VIDEO_UNKNOWN:
-        *result = STREAM_IS_UNSURE;
-        *decided = false;
-        if (verbose)
-            print_msg("Still not sure\n");
+    case PROBE_CONTAINER_ES:
+        switch (probe.video_type) {
+        case VIDEO_H264:
+            *result = STREAM_IS_H264;
+            *decided = true;
+            break;
+        case VIDEO_H262:
+            *result = STREAM_IS_H262;
+            *decided = true;
+            break;
+        case VIDEO_AVS:
+            *result = STREAM_IS_AVS;
+            *decided = true;
+            break;
+        default:
+            *result = STREAM_IS_UNSURE;
+            *decided = false;
+            if (verbose)
+                print_msg("Still not sure\n");
+            break;
+        }
         break;
     default:
-        fprint_msg("### stream_type: Unexpected decision from"
-                   " decide_ES_file_video_type: %d\n",
-            video_type);
-        close_file(input);
-        return 1;
+        // It had start codes that are only used in PES
+        *result = STREAM_MAYBE_PES;
+        *decided = true;
+        break;
     }
-
-    close_file(input);
+    clear_stream_probe(&probe);
     return 0;
 }
 
@@ -314,14 +147,16 @@ static void print_usage()
               "\n"
               "  The mechanisms used are fairly crude, assuming that:\n"
               "  - data is byte aligned\n"
-              "  - for TS, the first byte in the file will be the start of a NAL unit,\n"
-              "    and PAT/PMT packets will be findable\n"
+              "  - for TS, the first byte in the file will be the start of a TS packet\n"
+              "    (which may be in 188, 192 or 204 byte units), and PAT/PMT packets\n"
+              "    will be findable\n"
               "  - for PS, the first packet starts immediately at the start of the\n"
               "    file, and is a pack header\n"
-              "  - if the first 1000 packets could be H.262 *or* H.264, then the data\n"
-              "    is assumed to be H.264 (the program doesn't try to determine\n"
-              "    sensible sequences of H.262/H.264 packets, so this is a reasonable\n"
-              "    way of guessing)\n"
+              "  - if the first 1000 start codes could be H.262 *or* H.264, then the\n"
+              "    program cannot decide (it doesn't try to determine sensible\n"
+              "    sequences of H.262/H.264 units)\n"
+              "  - all the decisions can be made from the first <n> bytes of the file\n"
+              "    (see -probesize), which are read once\n"
               "\n"
               "  It is quite possible that data which is not relevant will be\n"
               "  misidentified\n"
@@ -343,20 +178,109 @@ static void print_usage()
               "  -err stderr       Write error messages to standard error (Unix traditional)\n"
               "  -verbose, -v      Output more detailed information about how it is\n"
               "                    making its decision\n"
-              "  -quiet, -q        Only output error messages\n");
+              "  -quiet, -q        Only output error messages\n"
+              "  -probesize <n>    Look at (up to) the first <n> bytes of the file.\n"
+              "                    The default is 4194304 (4MB).\n"
+              "\n"
+              "Batches:\n"
+              "  -batch <list>     Look at each of the files named in <list> (one per\n"
+              "                    line, or '-' for standard input), or in the directory\n"
+              "                    <list>, instead of <infile>. The result for each file\n"
+              "                    is output as a line of JSON, whose status is the exit\n"
+              "                    value described above.\n"
+              "  -jobs <n>         Look at <n> files at once. Defaults to one per CPU.\n"
+              "  -io <n>           Read ahead <n> files at once. Defaults to 4.\n"
+              "  -unordered        Output each result as soon as it is ready, rather than\n"
+              "                    in the order of the files.\n");
+}
+
+// How to look at each file - shared by all the files in a batch
+struct stream_type_settings {
+    int verbose;
+    int quiet;
+    uint32_t probe_size;
+};
+
+/*
+ * Decide on the type of a single file.
+ *
+ * Returns one of the STREAM_IS_xxx values, as the program exit value.
+ */
+static int identify_file(char* input_name, void* arg)
+{
+    struct stream_type_settings* settings = (struct stream_type_settings*)arg;
+    int input = -1;
+    int err = 0;
+    int decided = false;
+    int result = STREAM_IS_ERROR;
+
+    input = open_binary_file(input_name, false);
+    if (input == -1) {
+        fprint_err("### stream_type: Unable to open input file %s\n", input_name);
+        return 1;
+    }
+
+    if (!settings->quiet)
+        fprint_msg("Reading from %s\n", input_name);
+
+    // Try to guess
+    err = determine_packet_type(input, settings->probe_size, settings->verbose, &decided, &result);
+    (void)close_file(input);
+    if (err) {
+        print_err("### Unable to decide on stream type due to error\n");
+        return STREAM_IS_ERROR;
+    }
+
+    if (!settings->quiet) {
+        if (!decided) {
+            print_msg("Unable to decide\n");
+            result = STREAM_IS_UNSURE;
+        } else {
+            switch (result) {
+            case STREAM_IS_TS:
+                print_msg("It appears to be Transport Stream\n");
+                break;
+            case STREAM_IS_PS:
+                print_msg("It appears to be Program Stream\n");
+                break;
+            case STREAM_IS_H262:
+                print_msg("It appears to be Elementary Stream, MPEG-2 (H.262)\n");
+                break;
+            case STREAM_IS_H264:
+                print_msg("It appears to be Elementary Stream, MPEG-4 (H.264)\n");
+                break;
+            case STREAM_IS_AVS:
+                print_msg("It appears to be Elementary Stream, AVS\n");
+                break;
+            case STREAM_MAYBE_PES:
+                print_msg("It looks likely to be PES\n");
+                break;
+            case STREAM_IS_UNSURE:
+                print_msg("It is not recognised\n");
+                break;
+            default:
+                fprint_msg("Unexpected decision value %d\n", result);
+                result = STREAM_IS_ERROR;
+                break;
+            }
+        }
+    }
+    return result;
 }
 
 int main(int argc, char** argv)
 {
     char* input_name = nullptr;
     int had_input_name = false;
-    int input = -1;
     int verbose = false;
     int quiet = false;
     int err = 0;
     int ii = 1;
-    int decided = false;
-    int result = STREAM_IS_ERROR;
+    uint32_t probe_size = DEFAULT_PROBE_SIZE;
+
+    char* batch_name = nullptr;
+    struct batch_options batch = { 0, BATCH_DEFAULT_IO_JOBS, 0, false };
+    struct stream_type_settings settings;
 
     if (argc < 2) {
         print_usage();
@@ -389,6 +313,30 @@ int main(int argc, char** argv)
             } else if (!strcmp("-quiet", argv[ii]) || !strcmp("-q", argv[ii])) {
                 verbose = false;
                 quiet = true;
+            } else if (!strcmp("-probesize", argv[ii])) {
+                CHECKARG("stream_type", ii);
+                err = unsigned_value("stream_type", argv[ii], argv[ii + 1], 0, &probe_size);
+                if (err)
+                    return STREAM_IS_ERROR;
+                ii++;
+            } else if (!strcmp("-batch", argv[ii])) {
+                CHECKARG("stream_type", ii);
+                batch_name = argv[ii + 1];
+                ii++;
+            } else if (!strcmp("-jobs", argv[ii])) {
+                CHECKARG("stream_type", ii);
+                err = int_value("stream_type", argv[ii], argv[ii + 1], true, 10, &batch.jobs);
+                if (err)
+                    return STREAM_IS_ERROR;
+                ii++;
+            } else if (!strcmp("-io", argv[ii])) {
+                CHECKARG("stream_type", ii);
+                err = int_value("stream_type", argv[ii], argv[ii + 1], true, 10, &batch.io_jobs);
+                if (err)
+                    return STREAM_IS_ERROR;
+                ii++;
+            } else if (!strcmp("-unordered", argv[ii])) {
+                batch.unordered = true;
             } else {
                 fprint_err("### stream_type: "
                            "Unrecognised command line switch '%s'\n",
@@ -407,60 +355,31 @@ int main(int argc, char** argv)
         ii++;
     }
 
-    if (!had_input_name) {
-        print_err("### stream_type: No input file specified\n");
-        return STREAM_IS_ERROR;
-    }
+    settings.verbose = verbose;
+    settings.quiet = quiet;
+    settings.probe_size = probe_size;
 
-    input = open_binary_file(input_name, false);
-    if (input == -1) {
-        fprint_err("### stream_type: Unable to open input file %s\n", input_name);
-        return 1;
+    if (batch_name != nullptr) {
+        char** files = nullptr;
+        int num_files = 0;
+        if (had_input_name) {
+            print_err("### stream_type: Cannot specify both an input file and -batch\n");
+            return STREAM_IS_ERROR;
+        }
+        err = read_batch_list(batch_name, &files, &num_files);
+        if (err)
+            return STREAM_IS_ERROR;
+        batch.prefetch = probe_size;
+        err = run_batch(files, num_files, &batch, identify_file, &settings);
+        free_batch_list(&files, num_files);
+        return (err ? STREAM_IS_ERROR : 0);
     }
 
-    if (!quiet)
-        fprint_msg("Reading from %s\n", input_name);
-
-    // Try to guess
-    err = determine_packet_type(input, verbose, &decided, &result);
-    if (err) {
-        print_err("### Unable to decide on stream type due to error\n");
+    if (!had_input_name) {
+        print_err("### stream_type: No input file specified\n");
         return STREAM_IS_ERROR;
     }
 
-    if (!quiet) {
-        if (!decided) {
-            print_msg("Unable to decide\n");
-            result = STREAM_IS_UNSURE;
-        } else {
-            switch (result) {
-            case STREAM_IS_TS:
-                print_msg("It appears to be Transport Stream\n");
-                break;
-            case STREAM_IS_PS:
-                print_msg("It appears to be Program Stream\n");
-                break;
-            case STREAM_IS_H262:
-                print_msg("It appears to be Elementary Stream, MPEG-2 (H.262)\n");
-                break;
-            case STREAM_IS_H264:
-                print_msg("It appears to be Elementary Stream, MPEG-4 (H.264)\n");
-                break;
-            case STREAM_IS_AVS:
-                print_msg("It appears to be Elementary Stream, AVS\n");
-                break;
-            case STREAM_MAYBE_PES:
-                print_msg("It looks likely to be PES\n");
-                break;
-            case STREAM_IS_UNSURE:
-                print_msg("It is not recognised\n");
-                break;
-            default:
-                fprint_msg("Unexpected decision value %d\n", result);
-                result = STREAM_IS_ERROR;
-                break;
-            }
-        }
-    }
-    return result;
+    return identify_file(input_name, &settings);
 }
+
@@ -1,3 +1,3 @@
 #!/bin/sh
-docker build --no-cache -t cxx:ubuntu_18_10 .
-docker run --rm -it --name cxx_ubuntu_interactive cxx:ubuntu_18_10 bash
+docker build --no-cache -t cxx:ubuntu_22_04 .
+docker run --rm -it --name cxx_ubuntu_interactive cxx:ubuntu_22_04 bash
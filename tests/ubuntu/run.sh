@@ -2,4 +2,4 @@
 scriptdir=$(CDPATH= cd -- "$(dirname -- "$0")" && pwd)
 cd "$scriptdir"
 
-docker build --no-cache -t cxx:ubuntu_18_10 . && docker run --rm --name cxx_ubuntu cxx:ubuntu_18_10
+docker build --no-cache -t cxx:ubuntu_22_04 . && docker run --rm --name cxx_ubuntu cxx:ubuntu_22_04
@@ -38,8 +38,11 @@
 
 #include "accessunit.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "misc.h"
@@ -47,8 +50,10 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
@@ -79,7 +84,7 @@ static int extract_av_via_pes(char* input_name, char* output_name, int want_vide
         return 1;
     }
 
-    output = fopen(output_name, "wb");
+    output = fopen_compressed(output_name, true);
     if (output == nullptr) {
         fprint_err("### Unable to open output file %s: %s\n", output_name, strerror(errno));
         return 1;
@@ -559,7 +564,7 @@ int main(int argc, char** argv)
         if (use_stdout)
             output = stdout;
         else {
-            output = fopen(output_name, "wb");
+            output = fopen_compressed(output_name, true);
             if (output == nullptr) {
                 if (!use_stdin)
                     (void)close_file(input);
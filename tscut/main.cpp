@@ -0,0 +1,220 @@
+/*
+ * Cut a time range out of a transport stream, by copying its TS packets.
+ *
+ * The cut starts at the last video random access point at or before the
+ * start time, which is found by bisecting the file on its video PTS, so
+ * only the data in (and just before) the range is ever read. The TS packets
+ * of the program's elementary streams are then copied unchanged (apart from
+ * any rebasing of their timestamps), up to the first video PES packet to be
+ * decoded at or after the end time.
+ *
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "accessunit.h"
+#include "bitdata.h"
+#include "blockcache.h"
+#include "compat.h"
+#include "compressed.h"
+#include "es.h"
+#include "fmtx.h"
+#include "gop.h"
+#include "h222.h"
+#include "h262.h"
+#include "misc.h"
+#include "nalunit.h"
+#include "pes.h"
+#include "pidint.h"
+#include "printing.h"
+#include "probe.h"
+#include "ps.h"
+#include "reverse.h"
+#include "section.h"
+#include "shmring.h"
+#include "timestamp.h"
+#include "ts.h"
+#include "tscut.h"
+#include "tswrite.h"
+#include "version.h"
+
+static void print_usage()
+{
+    print_msg("Usage: tscut [switches] <infile> <outfile>\n"
+              "\n");
+    REPORT_VERSION("tscut");
+    print_msg(
+        "\n"
+        "  Cut a time range out of a Transport Stream, by copying its TS packets.\n"
+        "  The cut starts at the last video random access point at or before the\n"
+        "  start time, and ends just before the first picture to be decoded at or\n"
+        "  after the end time. Times are in seconds from the first video PTS.\n"
+        "\n"
+        "  The access point is found by bisecting the input on its video PTS, so\n"
+        "  only the data in (and just before) the range is read. The TS packets of\n"
+        "  the program's elementary streams are copied unchanged, each stream\n"
+        "  starting with its first whole PES packet, and a PAT and PMT for the\n"
+        "  program are written at the start (and wherever the input has a PAT).\n"
+        "\n"
+        "Files:\n"
+        "  <infile>  is an H.222 Transport Stream file (which must be a file, not\n"
+        "            a pipe, as we need to seek within it)\n"
+        "  <outfile> is the TS file to write the cut to (but see -stdout)\n"
+        "\n"
+        "Switches:\n"
+        "  -err stdout       Write error messages to standard output (the default)\n"
+        "  -err stderr       Write error messages to standard error (Unix traditional)\n"
+        "  -stdout           Output to standard output, instead of a file. Implies\n"
+        "                    -quiet and -err stderr.\n"
+        "  -start <secs>     The time to start the cut at. The default is 0.\n"
+        "  -end <secs>       The time to end the cut at. The default is to cut to\n"
+        "                    the end of the input.\n"
+        "  -rebase           Alter the PCRs, PTSs and DTSs so that the first PCR in\n"
+        "                    the cut is zero.\n"
+        "  -prog <n>         Cut program <n>. The default is the first program in\n"
+        "                    the PAT.\n"
+        "  -quiet, -q        Only output error messages.\n"
+        "  -verbose, -v      Report on the search for the start of the cut.\n");
+}
+
+int main(int argc, char** argv)
+{
+    char* input_name = nullptr;
+    char* output_name = nullptr;
+    int had_input_name = false;
+    int had_output_name = false;
+    int use_stdout = false;
+    double start = 0.0;
+    double end = -1.0;
+    int err = 0;
+    int ii = 1;
+    struct TS_cutter cutter;
+    TS_cutter_p cut = &cutter;
+    TS_reader_p tsreader = nullptr;
+
+    if (argc < 2) {
+        print_usage();
+        return 0;
+    }
+
+    init_TS_cutter(cut);
+
+    while (ii < argc) {
+        if (argv[ii][0] == '-') {
+            if (!strcmp("--help", argv[ii]) || !strcmp("-h", argv[ii])
+                || !strcmp("-help", argv[ii])) {
+                print_usage();
+                return 0;
+            } else if (!strcmp("-err", argv[ii])) {
+                CHECKARG("tscut", ii);
+                if (!strcmp(argv[ii + 1], "stderr"))
+                    redirect_output_stderr();
+                else if (!strcmp(argv[ii + 1], "stdout"))
+                    redirect_output_stdout();
+                else {
+                    fprint_err("### tscut: "
+                               "Unrecognised option '%s' to -err (not 'stdout' or"
+                               " 'stderr')\n",
+                        argv[ii + 1]);
+                    return 1;
+                }
+                ii++;
+            } else if (!strcmp("-stdout", argv[ii])) {
+                use_stdout = true;
+                had_output_name = true; // so to speak
+                redirect_output_stderr();
+            } else if (!strcmp("-start", argv[ii])) {
+                CHECKARG("tscut", ii);
+                err = double_value("tscut", argv[ii], argv[ii + 1], true, &start);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-end", argv[ii])) {
+                CHECKARG("tscut", ii);
+                err = double_value("tscut", argv[ii], argv[ii + 1], true, &end);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-rebase", argv[ii])) {
+                cut->rebase = true;
+            } else if (!strcmp("-prog", argv[ii])) {
+                CHECKARG("tscut", ii);
+                err = int_value_in_range(
+                    "tscut", argv[ii], argv[ii + 1], 1, 0xFFFF, 0, &cut->want_program);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-quiet", argv[ii]) || !strcmp("-q", argv[ii])) {
+                cut->quiet = true;
+                cut->verbose = false;
+            } else if (!strcmp("-verbose", argv[ii]) || !strcmp("-v", argv[ii])) {
+                cut->verbose = true;
+                cut->quiet = false;
+            } else {
+                fprint_err("### tscut: "
+                           "Unrecognised command line switch '%s'\n",
+                    argv[ii]);
+                return 1;
+            }
+        } else {
+            if (had_input_name && had_output_name) {
+                fprint_err("### tscut: Unexpected '%s'\n", argv[ii]);
+                return 1;
+            } else if (had_input_name) {
+                output_name = argv[ii];
+                had_output_name = true;
+            } else {
+                input_name = argv[ii];
+                had_input_name = true;
+            }
+        }
+        ii++;
+    }
+
+    if (!had_input_name) {
+        print_err("### tscut: No input file specified\n");
+        return 1;
+    }
+    if (!had_output_name) {
+        print_err("### tscut: No output file specified\n");
+        return 1;
+    }
+    if (end >= 0.0 && end <= start) {
+        print_err("### tscut: -end must be after -start\n");
+        return 1;
+    }
+    cut->start = (int64_t)(start * 90000.0);
+    cut->end = (end < 0.0 ? -1 : (int64_t)(end * 90000.0));
+
+    // Try to stop extraneous data ending up in our output stream
+    if (use_stdout) {
+        cut->verbose = false;
+        cut->quiet = true;
+    }
+
+    err = open_file_for_TS_read(input_name, &tsreader);
+    if (err) {
+        fprint_err("### tscut: Unable to open input file %s for reading TS\n", input_name);
+        return 1;
+    }
+    if (!cut->quiet)
+        fprint_msg("Reading from %s\n", input_name);
+
+    err = cut_TS(cut, tsreader, (use_stdout ? nullptr : output_name));
+    if (!err && !cut->quiet)
+        fprint_msg("Wrote " OFFSET_T_FORMAT " TS packets, having read to " OFFSET_T_FORMAT "\n",
+            cut->written, tsreader->posn);
+
+    clear_TS_cutter(cut);
+    if (close_TS_reader(&tsreader)) {
+        print_err("### tscut: Error closing input file\n");
+        err = 1;
+    }
+    return err ? 1 : 0;
+}
@@ -17,9 +17,12 @@
 
 #include "accessunit.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
 #include "fmtx.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "misc.h"
@@ -27,8 +30,10 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
@@ -272,14 +277,19 @@ static const uint8_t* subtitling_segment(dvbdata_t* const dvbd, const uint8_t* p
 static void flush_dvbd(dvbdata_t* const dvbd)
 {
     const uint8_t* p = dvbd->data;
+    TCHAR pts_buf[FMTX_TIMESTAMP_MAX];
+    TCHAR dts_buf[FMTX_TIMESTAMP_MAX];
+    TCHAR diff_buf[FMTX_TIMESTAMP_MAX];
 
     if (!dvbd->found)
         return;
 
     fprint_msg("\nPTS: %s, DTS: %s, PTS - last_PTS: %s\n",
-        !dvbd->pts_valid ? "none" : fmtx_timestamp(dvbd->pts, tfmt),
-        !dvbd->dts_valid ? "none" : fmtx_timestamp(dvbd->dts, tfmt),
-        !dvbd->pts_valid ? "????" : fmtx_timestamp(dvbd->pts - dvbd->last_pts, tfmt));
+        !dvbd->pts_valid ? "none" : fmtx_timestamp_r(pts_buf, sizeof(pts_buf), dvbd->pts, tfmt),
+        !dvbd->dts_valid ? "none" : fmtx_timestamp_r(dts_buf, sizeof(dts_buf), dvbd->dts, tfmt),
+        !dvbd->pts_valid
+            ? "????"
+            : fmtx_timestamp_r(diff_buf, sizeof(diff_buf), dvbd->pts - dvbd->last_pts, tfmt));
     if (dvbd->pts_valid)
         dvbd->last_pts = dvbd->pts;
 
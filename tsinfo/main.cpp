@@ -36,9 +36,14 @@
 #include <unistd.h>
 
 #include "accessunit.h"
+#include "batch.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
+#include "dvbsi.h"
 #include "es.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "misc.h"
@@ -46,8 +51,11 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "section.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
@@ -56,9 +64,13 @@
  * Report on the program streams, by looking at the PAT and PMT packets
  * in the first `max` TS packets of the given input stream
  *
+ * If `si_tables` is non-zero, also report on those DVB SI tables (as a
+ * combination of DVB_SI_NIT, DVB_SI_SDT, DVB_SI_EIT and DVB_SI_TDT), as
+ * each new version is found.
+ *
  * Returns 0 if all went well, 1 if something went wrong.
  */
-int report_streams(TS_reader_p tsreader, int max, int verbose)
+int report_streams(TS_reader_p tsreader, int max, int verbose, int si_tables)
 {
     int err;
     int ii;
@@ -84,6 +96,17 @@ int report_streams(TS_reader_p tsreader, int max, int verbose)
     int num_pats = 0;
     int num_pmts = 0;
 
+    section_demux_p si_demux = nullptr;
+    if (si_tables) {
+        err = build_section_demux(&si_demux);
+        if (!err)
+            err = add_dvb_si_filters(si_demux, si_tables, false);
+        if (err) {
+            free_section_demux(&si_demux);
+            return 1;
+        }
+    }
+
     fprint_msg("Scanning %d TS packets\n", max);
 
     for (ii = 0; ii < max; ii++) {
@@ -99,6 +122,7 @@ int report_streams(TS_reader_p tsreader, int max, int verbose)
             break;
         } else if (err) {
             fprint_err("### Error reading TS packet %d\n", ii + 1);
+            free_section_demux(&si_demux);
             if (pat_data)
                 free(pat_data);
             free_pidint_list(&last_prog_list);
@@ -108,6 +132,25 @@ int report_streams(TS_reader_p tsreader, int max, int verbose)
             return 1;
         }
 
+        if (ii == 0)
+            report_TS_packet_layout(tsreader);
+
+        if (si_demux != nullptr && section_demux_wants_pid(si_demux, pid)) {
+            err = section_demux_packet(
+                si_demux, pid, payload_unit_start_indicator, payload, payload_len);
+            if (err) {
+                fprint_err("### Error handling SI in TS packet %d\n", ii + 1);
+                free_section_demux(&si_demux);
+                free_pidint_list(&last_prog_list);
+                free_pmt(&last_pmt);
+                if (pat_data)
+                    free(pat_data);
+                if (pmt_data)
+                    free(pmt_data);
+                return 1;
+            }
+        }
+
         if (pid == 0x0000) {
             num_pats++;
             if (verbose)
@@ -143,6 +186,7 @@ int report_streams(TS_reader_p tsreader, int max, int verbose)
                 free_pmt(&last_pmt);
                 if (pmt_data)
                     free(pmt_data);
+                free_section_demux(&si_demux);
                 return 1;
             }
 
@@ -157,6 +201,7 @@ int report_streams(TS_reader_p tsreader, int max, int verbose)
                 if (pmt_data)
                     free(pmt_data);
                 free(pat_data);
+                free_section_demux(&si_demux);
                 return err;
             }
 
@@ -171,6 +216,7 @@ int report_streams(TS_reader_p tsreader, int max, int verbose)
                 free_pmt(&last_pmt);
                 if (pmt_data)
                     free(pmt_data);
+                free_section_demux(&si_demux);
                 return err;
             }
 
@@ -225,6 +271,7 @@ int report_streams(TS_reader_p tsreader, int max, int verbose)
                 free_pmt(&last_pmt);
                 if (pmt_data)
                     free(pmt_data);
+                free_section_demux(&si_demux);
                 return 1;
             }
 
@@ -238,6 +285,7 @@ int report_streams(TS_reader_p tsreader, int max, int verbose)
                 free_pmt(&last_pmt);
                 if (pmt_data)
                     free(pmt_data);
+                free_section_demux(&si_demux);
                 return err;
             }
 
@@ -269,6 +317,10 @@ int report_streams(TS_reader_p tsreader, int max, int verbose)
 
     fprint_msg("\nFound %d PAT packet%s and %d PMT packet%s in %d TS packets\n", num_pats,
         (num_pats == 1 ? "" : "s"), num_pmts, (num_pmts == 1 ? "" : "s"), max);
+    if (si_demux != nullptr) {
+        report_section_demux(true, si_demux);
+        free_section_demux(&si_demux);
+    }
 
     free_pidint_list(&last_prog_list);
     free_pmt(&last_pmt);
@@ -294,7 +346,61 @@ void print_usage()
               "  -stdin             Input from standard input, instead of a file\n"
               "  -verbose, -v       Output extra information about packets\n"
               "  -max <n>, -m <n>   Number of TS packets to scan. Defaults to 10000.\n"
-              "  -repeat <n>        Look for <n> PMT packets, and report on each\n");
+              "  -repeat <n>        Look for <n> PMT packets, and report on each\n"
+              "\n"
+              "DVB Service Information:\n"
+              "  -si                Report on the NIT, SDT, EIT, TDT and TOT\n"
+              "  -nit, -sdt, -eit, -tdt\n"
+              "                     Report on just those tables (the TDT includes the TOT)\n"
+              "\n"
+              "Each version of each table section is reported when it is first seen.\n"
+              "\n"
+              "Batches:\n"
+              "  -batch <list>      Report on each of the files named in <list> (one per\n"
+              "                     line, or '-' for standard input), or in the directory\n"
+              "                     <list>, instead of <infile>. The report for each file\n"
+              "                     is output as a line of JSON.\n"
+              "  -jobs <n>          Report on <n> files at once. Defaults to one per CPU.\n"
+              "  -io <n>            Read ahead <n> files at once. Defaults to 4.\n"
+              "  -unordered         Output each report as soon as it is ready, rather than\n"
+              "                     in the order of the files.\n");
+}
+
+// How to report on each file - shared by all the files in a batch
+struct tsinfo_settings {
+    int max;
+    int verbose;
+    int si_tables;
+};
+
+/*
+ * Report on a single file, or standard input if `input_name` is nullptr.
+ *
+ * Returns 0 if all went well, 1 if something went wrong.
+ */
+static int report_file(char* input_name, void* arg)
+{
+    struct tsinfo_settings* settings = (struct tsinfo_settings*)arg;
+    TS_reader_p tsreader = nullptr;
+    int err;
+
+    err = open_file_for_TS_read(input_name, &tsreader);
+    if (err) {
+        fprint_err("### tsinfo: Unable to open input file %s for reading TS\n",
+            input_name == nullptr ? "<stdin>" : input_name);
+        return 1;
+    }
+    fprint_msg("Reading from %s\n", (input_name == nullptr ? "<stdin>" : input_name));
+
+    err = report_streams(tsreader, settings->max, settings->verbose, settings->si_tables);
+    if (err) {
+        print_err("### tsinfo: Error reporting on stream\n");
+        (void)close_TS_reader(&tsreader);
+        return 1;
+    }
+
+    err = close_TS_reader(&tsreader);
+    return (err ? 1 : 0);
 }
 
 int main(int argc, char** argv)
@@ -305,9 +411,12 @@ int main(int argc, char** argv)
     int max = 10000;
     int verbose = false; // True => output diagnostic/progress messages
     int lookfor = 1;
+    int si_tables = 0;
     int err = 0;
 
-    TS_reader_p tsreader = nullptr;
+    char* batch_name = nullptr;
+    struct batch_options batch = { 0, BATCH_DEFAULT_IO_JOBS, 0, false };
+    struct tsinfo_settings settings;
 
     int ii = 1;
 
@@ -350,9 +459,37 @@ int main(int argc, char** argv)
                 if (err)
                     return 1;
                 ii++;
+            } else if (!strcmp("-si", argv[ii])) {
+                si_tables |= DVB_SI_ALL;
+            } else if (!strcmp("-nit", argv[ii])) {
+                si_tables |= DVB_SI_NIT;
+            } else if (!strcmp("-sdt", argv[ii])) {
+                si_tables |= DVB_SI_SDT;
+            } else if (!strcmp("-eit", argv[ii])) {
+                si_tables |= DVB_SI_EIT;
+            } else if (!strcmp("-tdt", argv[ii])) {
+                si_tables |= DVB_SI_TDT;
             } else if (!strcmp("-stdin", argv[ii])) {
                 use_stdin = true;
                 had_input_name = true; // so to speak
+            } else if (!strcmp("-batch", argv[ii])) {
+                CHECKARG("tsinfo", ii);
+                batch_name = argv[ii + 1];
+                ii++;
+            } else if (!strcmp("-jobs", argv[ii])) {
+                CHECKARG("tsinfo", ii);
+                err = int_value("tsinfo", argv[ii], argv[ii + 1], true, 10, &batch.jobs);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-io", argv[ii])) {
+                CHECKARG("tsinfo", ii);
+                err = int_value("tsinfo", argv[ii], argv[ii + 1], true, 10, &batch.io_jobs);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-unordered", argv[ii])) {
+                batch.unordered = true;
             } else {
                 fprint_err("### tsinfo: "
                            "Unrecognised command line switch '%s'\n",
@@ -371,26 +508,31 @@ int main(int argc, char** argv)
         ii++;
     }
 
-    if (!had_input_name) {
-        print_err("### tsinfo: No input file specified\n");
-        return 1;
-    }
+    settings.max = max;
+    settings.verbose = verbose;
+    settings.si_tables = si_tables;
 
-    err = open_file_for_TS_read((use_stdin ? nullptr : input_name), &tsreader);
-    if (err) {
-        fprint_err("### tsinfo: Unable to open input file %s for reading TS\n",
-            use_stdin ? "<stdin>" : input_name);
-        return 1;
+    if (batch_name != nullptr) {
+        char** files = nullptr;
+        int num_files = 0;
+        if (had_input_name) {
+            print_err("### tsinfo: Cannot specify both an input file and -batch\n");
+            return 1;
+        }
+        err = read_batch_list(batch_name, &files, &num_files);
+        if (err)
+            return 1;
+        // We read (roughly) the first `max` TS packets of each file
+        batch.prefetch = (offset_t)max * TS_PACKET_SIZE;
+        err = run_batch(files, num_files, &batch, report_file, &settings);
+        free_batch_list(&files, num_files);
+        return (err ? 1 : 0);
     }
-    fprint_msg("Reading from %s\n", (use_stdin ? "<stdin>" : input_name));
 
-    err = report_streams(tsreader, max, verbose);
-    if (err) {
-        print_err("### tsinfo: Error reporting on stream\n");
-        (void)close_TS_reader(&tsreader);
+    if (!had_input_name) {
+        print_err("### tsinfo: No input file specified\n");
         return 1;
     }
 
-    err = close_TS_reader(&tsreader);
-    return (err ? 1 : 0);
+    return report_file(use_stdin ? nullptr : input_name, &settings);
 }
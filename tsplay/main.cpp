@@ -37,8 +37,11 @@
 
 #include "accessunit.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "misc.h"
@@ -46,8 +49,11 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
+#include "timestamp.h"
 #include "ts.h"
 #include "tsplay.h"
 #include "tswrite.h"
@@ -121,7 +127,9 @@ static void print_usage(int summary)
         print_msg("  -max <n>, -m <n>  Maximum number of TS/PS packets to read.\n"
                   "                    See -details for more information.\n"
                   "  -loop             Play the input file repeatedly. Can be combined\n"
-                  "                    with -max.\n");
+                  "                    with -max.\n"
+                  "  -loopmem          Play a TS input file repeatedly from memory, as one\n"
+                  "                    continuous stream.\n");
     else
         fprint_msg("Normal operation outputs some messages summarising the command line\n"
                    "choices, information about the circular buffer filling, and\n"
@@ -140,6 +148,14 @@ static void print_usage(int summary)
                    "verbosity flags only apply to the first time through the data, and\n"
                    "thereafter it is as if -quiet had been specified.\n"
                    "\n"
+                   "  -loopmem          Read the TS input file (or its first -max packets) into\n"
+                   "                    memory, and play it repeatedly from there. Each time\n"
+                   "                    round, PCRs, PTS/DTS and continuity counters are\n"
+                   "                    advanced so that the output is one seamless stream,\n"
+                   "                    rather than having a discontinuity at each rewind.\n"
+                   "                    The input must be a file, and must contain at least\n"
+                   "                    two PCRs (see -forcepcr in '-help ts').\n"
+                   "\n"
                    "  -max <n>, -m <n>  Maximum number of TS packets to read\n"
                    "                    (or PS packets if the input data is PS)\n"
                    "\n"
@@ -314,8 +330,10 @@ int main(int argc, char** argv)
     int err = 0;
     int ii = 1;
     int loop = false;
+    int loop_in_memory = false;
     time_t start, end;
     int is_TS; // Does it appear to be TS or PS?
+    struct stream_probe probe;
 
     // Values relevent to "opening" the output file/socket
     enum TS_writer_type how = TS_W_UNDEFINED; // how to output our TS data
@@ -478,6 +496,9 @@ int main(int argc, char** argv)
                 ii++;
             } else if (!strcmp("-loop", argv[ii])) {
                 loop = true;
+            } else if (!strcmp("-loopmem", argv[ii])) {
+                loop = true;
+                loop_in_memory = true;
             } else if (!strcmp("-avc", argv[ii]) || !strcmp("-h264", argv[ii])) {
                 force_stream_type = true;
                 want_h262 = false;
@@ -648,17 +669,26 @@ int main(int argc, char** argv)
             return 1;
         }
 
-        err = determine_if_TS_file(input, &is_TS);
+        init_stream_probe(&probe);
+        err = probe_stream_file(input, 0, false, &probe);
         if (err) {
             fprint_err("### tsplay: Cannot play file %s\n", output_name);
             (void)close_file(input);
             return 1;
         }
+        // (an empty file may as well be treated as TS)
+        is_TS = (probe.container == PROBE_CONTAINER_TS || probe.bytes_probed == 0);
+        clear_stream_probe(&probe);
     } else {
         input_name = (char*)"<stdin>";
         input = STDIN_FILENO;
         is_TS = true; // an assertion
     }
+    if (loop_in_memory && !is_TS) {
+        print_err("### tsplay: -loopmem is only supported for TS input\n");
+        (void)close_file(input);
+        return 1;
+    }
     if (!quiet)
         fprint_msg("Reading from  %s%s\n", input_name, (loop ? " (and looping)" : ""));
 
@@ -715,7 +745,10 @@ int main(int argc, char** argv)
         }
     }
 
-    if (is_TS) {
+    if (is_TS && loop_in_memory) {
+        err = play_TS_stream_from_memory(
+            input, tswriter, pace_mode, pid_to_ignore, override_pcr_pid, max, quiet, verbose);
+    } else if (is_TS) {
         err = play_TS_stream(input, tswriter, pace_mode, pid_to_ignore, override_pcr_pid, max,
             loop, quiet, verbose);
     } else
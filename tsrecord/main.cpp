@@ -0,0 +1,1015 @@
+/*
+ * Record a live transport stream, received over UDP or RTP (usually from a
+ * multicast group), to disk.
+ *
+ * One thread does nothing but receive datagrams (a batch at a time) into a
+ * large ring buffer, so that a slow disk does not make us lose packets. The
+ * main thread takes the TS packets from the ring, checks their continuity
+ * counters, and writes them to disk in large aligned blocks, starting a new
+ * file when the current one is big or old enough. As it goes, it writes an
+ * index of the random access points in the video of each file.
+ *
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+#include "accessunit.h"
+#include "bitdata.h"
+#include "blockcache.h"
+#include "compat.h"
+#include "compressed.h"
+#include "es.h"
+#include "gop.h"
+#include "h222.h"
+#include "h262.h"
+#include "misc.h"
+#include "nalunit.h"
+#include "pes.h"
+#include "pidint.h"
+#include "printing.h"
+#include "probe.h"
+#include "ps.h"
+#include "reverse.h"
+#include "section.h"
+#include "shmring.h"
+#include "ts.h"
+#include "tswrite.h"
+#include "version.h"
+
+#define DEFAULT_RING_SIZE 64 // MiB
+#define DEFAULT_RCVBUF_SIZE 8 // MiB
+#define DEFAULT_PREALLOC_SIZE 64 // MiB
+#define DEFAULT_STATS_INTERVAL 10 // seconds
+
+// How many datagrams we ask recvmmsg for at once, and how big each may be
+#define RECV_BATCH 64
+#define RECV_DATAGRAM_SIZE 2048
+
+// Data is written to disk in chunks of this size, from a buffer with this
+// alignment, so that it can be written with O_DIRECT
+#define DISK_CHUNK_SIZE (1024 * 1024)
+#define DISK_ALIGNMENT 4096
+
+// If a new file is due, we start it at the next random access point in the
+// video - but only wait this long for one
+#define ROTATE_GRACE 5.0 // seconds
+
+#define RTP_HEADER_SIZE 12
+
+// Set by our signal handler to tell us to stop
+static volatile sig_atomic_t interrupted = false;
+
+/*
+ * A file we are recording to, written with large aligned writes.
+ */
+struct record_file {
+    int fd; // -1 if there is no file open
+    int direct; // true if `fd` was opened with O_DIRECT
+    byte* buf; // DISK_CHUNK_SIZE bytes, aligned to DISK_ALIGNMENT
+    size_t buf_len; // how much of `buf` is in use
+    offset_t length; // how much has been written to the file, including `buf`
+    offset_t allocated; // how much has been preallocated
+    FILE* index; // the index of random access points, or nullptr
+    int had_pts; // true if we have indexed a PTS in this file
+    int64_t first_pts; // and the first one we indexed
+};
+
+struct recorder {
+    // What we were asked to do
+    char* name; // the output file, or prefix for rotated files
+    int rotating; // true if we start new files
+    offset_t rotate_size; // start a new file after this many bytes, or 0
+    double rotate_time; // start a new file after this many seconds, or 0
+    offset_t prealloc; // preallocate files this much at a time, or 0
+    int direct; // true if we should try to use O_DIRECT
+    int index; // true if we should write an index file
+    double stats_interval; // report this often, in seconds, or 0
+    double duration; // stop after this many seconds, or 0
+    int max; // stop after this many TS packets, or 0
+    int want_program; // the program we want, or -1 for the first
+    int quiet;
+    int verbose;
+
+    // The receiving thread
+    int socket;
+    std::thread receiver;
+    std::atomic<int> stopping;
+    std::atomic<int> receive_error;
+
+    // The ring buffer between the threads. `head` and `tail` count bytes,
+    // and are always a multiple of TS_PACKET_SIZE, as is `ring_size`, so a
+    // TS packet never wraps around the end of the ring
+    byte* ring;
+    size_t ring_size;
+    std::atomic<uint64_t> head; // the receiver has filled up to here
+    std::atomic<uint64_t> tail; // the writer has emptied up to here
+    std::mutex lock;
+    std::condition_variable filled;
+
+    // Counted by the receiver
+    std::atomic<uint64_t> datagrams;
+    std::atomic<uint64_t> rtp_lost; // RTP packets missing by sequence number
+    std::atomic<uint64_t> sync_errors; // TS packets that did not start 0x47
+    std::atomic<uint64_t> socket_drops; // datagrams the kernel dropped
+    std::atomic<uint64_t> ring_drops; // TS packets we had no room for
+    int is_rtp;
+    int had_rtp_seq;
+    uint16_t rtp_seq;
+
+    // Counted by the writer
+    uint64_t packets;
+    uint64_t cc_errors;
+    int8_t last_cc[0x2000]; // -1 if not yet known
+    byte had_dup[0x2000]; // true if the last packet was a duplicate
+
+    // What the data contains
+    section_demux_p demux;
+    uint32_t pmt_pid; // 0 if not yet known
+    int program_number;
+    int pmt_pid_changed; // true if we need to start looking for a new PMT
+    uint32_t video_pid; // 0 if not yet known
+    int video_stream_type;
+    timestamp_unwrap_t unwrap;
+
+    // The file being written
+    struct record_file file;
+    int file_number;
+    double file_start; // when it was started
+    double rotate_due; // when a new file became due, or 0
+    char file_name[1024];
+};
+
+/*
+ * Return the time now, in seconds, from an arbitrary start
+ */
+static double now_secs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void on_interrupt(int sig)
+{
+    interrupted = true;
+}
+
+// ============================================================
+// Receiving
+// ============================================================
+/*
+ * Put the TS packets in a datagram into the ring buffer.
+ *
+ * RTP headers are removed (and the sequence numbers checked), and anything
+ * that is not a TS packet is skipped.
+ *
+ * - `head` is where the next packet goes in the ring, and is updated.
+ */
+static void receive_datagram(struct recorder* rec, byte* data, int len, uint64_t* head)
+{
+    if (len >= RTP_HEADER_SIZE && data[0] != 0x47 && (data[0] & 0xC0) == 0x80) {
+        // An RTP header, and maybe CSRCs, an extension and padding
+        int header_len = RTP_HEADER_SIZE + 4 * (data[0] & 0x0F);
+        uint16_t seq = (uint16_t)((data[2] << 8) | data[3]);
+        if ((data[0] & 0x10) && len >= header_len + 4)
+            header_len += 4 + 4 * ((data[header_len + 2] << 8) | data[header_len + 3]);
+        if (data[0] & 0x20)
+            len -= data[len - 1];
+        if (header_len > len) {
+            rec->sync_errors++;
+            return;
+        }
+
+        if (rec->had_rtp_seq) {
+            uint16_t gap = (uint16_t)(seq - rec->rtp_seq - 1);
+            if (gap != 0 && gap < 0x8000) // otherwise duplicate or reordered
+                rec->rtp_lost += gap;
+        }
+        if (!rec->had_rtp_seq || (uint16_t)(seq - rec->rtp_seq) < 0x8000)
+            rec->rtp_seq = seq;
+        rec->had_rtp_seq = true;
+        rec->is_rtp = true;
+        data += header_len;
+        len -= header_len;
+    }
+
+    while (len >= TS_PACKET_SIZE) {
+        if (data[0] != 0x47) {
+            // Lost sync - look for it again
+            byte* next = (byte*)memchr(data + 1, 0x47, len - 1);
+            rec->sync_errors++;
+            if (next == nullptr)
+                return;
+            len -= (int)(next - data);
+            data = next;
+            continue;
+        }
+        if (*head - rec->tail.load(std::memory_order_acquire) + TS_PACKET_SIZE > rec->ring_size)
+            rec->ring_drops++;
+        else {
+            memcpy(rec->ring + (*head % rec->ring_size), data, TS_PACKET_SIZE);
+            *head += TS_PACKET_SIZE;
+        }
+        data += TS_PACKET_SIZE;
+        len -= TS_PACKET_SIZE;
+    }
+    if (len > 0)
+        rec->sync_errors++;
+}
+
+/*
+ * The receiving thread: read datagrams, a batch at a time, into the ring.
+ */
+static void receive_thread(struct recorder* rec)
+{
+    static byte buffers[RECV_BATCH][RECV_DATAGRAM_SIZE];
+    static char controls[RECV_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+    struct mmsghdr msgs[RECV_BATCH];
+    struct iovec iovs[RECV_BATCH];
+    uint64_t head = rec->head.load();
+
+    while (!rec->stopping && !interrupted) {
+        struct pollfd pfd = { rec->socket, POLLIN, 0 };
+        int ii, num;
+
+        // Wake up now and then, to see if we should stop
+        num = poll(&pfd, 1, 100);
+        if (num == 0 || (num < 0 && errno == EINTR))
+            continue;
+
+        memset(msgs, 0, sizeof(msgs));
+        for (ii = 0; ii < RECV_BATCH; ii++) {
+            iovs[ii].iov_base = buffers[ii];
+            iovs[ii].iov_len = RECV_DATAGRAM_SIZE;
+            msgs[ii].msg_hdr.msg_iov = &iovs[ii];
+            msgs[ii].msg_hdr.msg_iovlen = 1;
+            msgs[ii].msg_hdr.msg_control = controls[ii];
+            msgs[ii].msg_hdr.msg_controllen = sizeof(controls[ii]);
+        }
+        if (num > 0)
+            num = recvmmsg(rec->socket, msgs, RECV_BATCH, MSG_DONTWAIT, nullptr);
+        if (num < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                continue;
+            fprint_err("### tsrecord: Error receiving from socket: %s\n", strerror(errno));
+            rec->receive_error = true;
+            break;
+        }
+
+        for (ii = 0; ii < num; ii++) {
+            struct cmsghdr* cmsg;
+            for (cmsg = CMSG_FIRSTHDR(&msgs[ii].msg_hdr); cmsg != nullptr;
+                 cmsg = CMSG_NXTHDR(&msgs[ii].msg_hdr, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                    // The total the kernel has dropped on this socket
+                    uint32_t dropped;
+                    memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+                    rec->socket_drops = dropped;
+                }
+            }
+            receive_datagram(rec, buffers[ii], (int)msgs[ii].msg_len, &head);
+        }
+        rec->datagrams += num;
+
+        {
+            std::lock_guard<std::mutex> guard(rec->lock);
+            rec->head.store(head, std::memory_order_release);
+        }
+        rec->filled.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(rec->lock);
+        rec->stopping = true;
+    }
+    rec->filled.notify_one();
+}
+
+// ============================================================
+// Writing
+// ============================================================
+/*
+ * Write out the full buffer of a record file.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int write_record_chunk(struct recorder* rec, struct record_file* file)
+{
+    size_t done = 0;
+
+    if (rec->prealloc > 0 && file->length > file->allocated) {
+        // Reserve the next stretch of the file, so that it is laid out
+        // contiguously and a full disk shows up now rather than later
+        int err = fallocate(file->fd, FALLOC_FL_KEEP_SIZE, file->allocated, rec->prealloc);
+        if (err == 0)
+            file->allocated += rec->prealloc;
+        else {
+            if (errno != EOPNOTSUPP)
+                fprint_err("!!! tsrecord: Unable to preallocate %s: %s\n", rec->file_name,
+                    strerror(errno));
+            rec->prealloc = 0;
+        }
+    }
+
+    while (done < file->buf_len) {
+        ssize_t written = write(file->fd, file->buf + done, file->buf_len - done);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0 && errno == EINVAL && file->direct) {
+            // The filesystem accepted O_DIRECT at open, but not now
+            int flags = fcntl(file->fd, F_GETFL);
+            file->direct = false;
+            if (flags != -1 && fcntl(file->fd, F_SETFL, flags & ~O_DIRECT) == 0)
+                continue;
+        }
+        if (written < 0) {
+            fprint_err("### tsrecord: Error writing to %s: %s\n", rec->file_name, strerror(errno));
+            return 1;
+        }
+        done += written;
+    }
+    file->buf_len = 0;
+    return 0;
+}
+
+/*
+ * Open the next file to record to (and its index, if we want one).
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int open_record_file(struct recorder* rec)
+{
+    struct record_file* file = &rec->file;
+
+    if (rec->rotating)
+        snprintf(rec->file_name, sizeof(rec->file_name), "%s%05d.ts", rec->name, rec->file_number);
+    else
+        snprintf(rec->file_name, sizeof(rec->file_name), "%s", rec->name);
+
+    file->direct = false;
+    file->fd = -1;
+    if (rec->direct) {
+        file->fd = open(rec->file_name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if (file->fd != -1)
+            file->direct = true;
+        else if (errno == EINVAL) {
+            // This filesystem does not do O_DIRECT (tmpfs, for instance)
+            if (rec->verbose)
+                fprint_msg("O_DIRECT is not supported for %s\n", rec->file_name);
+            rec->direct = false;
+        }
+    }
+    if (file->fd == -1)
+        file->fd = open(rec->file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file->fd == -1) {
+        fprint_err("### tsrecord: Unable to open %s: %s\n", rec->file_name, strerror(errno));
+        return 1;
+    }
+    file->buf_len = 0;
+    file->length = 0;
+    file->allocated = 0;
+    file->had_pts = false;
+
+    if (rec->index) {
+        char index_name[sizeof(rec->file_name) + 4];
+        snprintf(index_name, sizeof(index_name), "%s.idx", rec->file_name);
+        file->index = fopen(index_name, "w");
+        if (file->index == nullptr) {
+            fprint_err("### tsrecord: Unable to open index %s: %s\n", index_name, strerror(errno));
+            return 1;
+        }
+        fprintf(file->index, "# offset pts seconds\n");
+        fflush(file->index);
+    }
+
+    rec->file_start = now_secs();
+    rec->rotate_due = 0;
+    rec->file_number++;
+    if (rec->verbose)
+        fprint_msg("Recording to %s\n", rec->file_name);
+    return 0;
+}
+
+/*
+ * Finish off the current record file.
+ *
+ * Its last (partial) chunk cannot be written with O_DIRECT, so is written
+ * normally, and the file is truncated to its proper length, which also
+ * releases any preallocated space we did not use.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int close_record_file(struct recorder* rec)
+{
+    struct record_file* file = &rec->file;
+    int err = 0;
+
+    if (file->fd == -1)
+        return 0;
+    if (file->buf_len > 0) {
+        if (file->direct) {
+            int flags = fcntl(file->fd, F_GETFL);
+            if (flags != -1 && fcntl(file->fd, F_SETFL, flags & ~O_DIRECT) == 0)
+                file->direct = false;
+        }
+        err = write_record_chunk(rec, file);
+    }
+    if (!err && ftruncate(file->fd, file->length)) {
+        fprint_err("### tsrecord: Error truncating %s: %s\n", rec->file_name, strerror(errno));
+        err = 1;
+    }
+    if (close(file->fd)) {
+        fprint_err("### tsrecord: Error closing %s: %s\n", rec->file_name, strerror(errno));
+        err = 1;
+    }
+    file->fd = -1;
+    if (file->index != nullptr) {
+        if (fclose(file->index)) {
+            fprint_err("### tsrecord: Error closing index for %s\n", rec->file_name);
+            err = 1;
+        }
+        file->index = nullptr;
+    }
+    if (!rec->quiet && rec->rotating)
+        fprint_msg("%s: " OFFSET_T_FORMAT " bytes, %.1fs\n", rec->file_name, file->length,
+            now_secs() - rec->file_start);
+    return err;
+}
+
+/*
+ * Append a TS packet to the current record file.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int write_record_packet(struct recorder* rec, byte* packet)
+{
+    struct record_file* file = &rec->file;
+    int len = TS_PACKET_SIZE;
+
+    while (len > 0) {
+        int count = DISK_CHUNK_SIZE - (int)file->buf_len;
+        if (count > len)
+            count = len;
+        memcpy(file->buf + file->buf_len, packet, count);
+        file->buf_len += count;
+        file->length += count;
+        packet += count;
+        len -= count;
+        if (file->buf_len == DISK_CHUNK_SIZE) {
+            int err = write_record_chunk(rec, file);
+            if (err)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Add a random access point to the current file's index.
+ */
+static void index_random_access_point(struct recorder* rec, offset_t posn, int64_t pts)
+{
+    struct record_file* file = &rec->file;
+
+    if (file->index == nullptr)
+        return;
+    if (!file->had_pts) {
+        file->first_pts = pts;
+        file->had_pts = true;
+    }
+    fprintf(file->index, OFFSET_T_FORMAT " %" PRIi64 " %.3f\n", posn, pts,
+        (pts - file->first_pts) / 90000.0);
+    // So that someone playing the file whilst we record can use it
+    fflush(file->index);
+}
+
+static int handle_pat(void* arg, uint32_t pid, byte* section, int section_len, int new_version)
+{
+    struct recorder* rec = (struct recorder*)arg;
+    pidint_list_p prog_list = nullptr;
+    int err;
+    int ii;
+
+    err = extract_prog_list_from_pat(rec->verbose, section, section_len, &prog_list);
+    if (err)
+        return 0; // ignore bad PATs
+    for (ii = 0; ii < prog_list->length; ii++) {
+        if (prog_list->number[ii] == 0)
+            continue; // the network PID
+        if (rec->want_program == -1 || prog_list->number[ii] == rec->want_program)
+            break;
+    }
+    if (ii < prog_list->length && prog_list->pid[ii] != rec->pmt_pid) {
+        rec->program_number = prog_list->number[ii];
+        rec->pmt_pid = prog_list->pid[ii];
+        rec->pmt_pid_changed = true;
+    }
+    free_pidint_list(&prog_list);
+    return 0;
+}
+
+static int handle_pmt(void* arg, uint32_t pid, byte* section, int section_len, int new_version)
+{
+    struct recorder* rec = (struct recorder*)arg;
+    pmt_p pmt = nullptr;
+    int err;
+    int ii;
+
+    if (pid != rec->pmt_pid)
+        return 0; // an old PMT PID
+    err = extract_pmt(rec->verbose, section, section_len, pid, &pmt);
+    if (err)
+        return 0; // ignore bad PMTs
+    if (pmt->program_number == rec->program_number) {
+        for (ii = 0; ii < pmt->num_streams; ii++) {
+            if (IS_VIDEO_STREAM_TYPE(pmt->streams[ii].stream_type)) {
+                if (!rec->quiet && rec->video_pid != pmt->streams[ii].elementary_PID)
+                    fprint_msg("Program %d, video PID %#x, stream type %#x\n",
+                        rec->program_number, pmt->streams[ii].elementary_PID,
+                        pmt->streams[ii].stream_type);
+                rec->video_pid = pmt->streams[ii].elementary_PID;
+                rec->video_stream_type = pmt->streams[ii].stream_type;
+                break;
+            }
+        }
+    }
+    free_pmt(&pmt);
+    return 0;
+}
+
+/*
+ * Check the continuity counter of a TS packet, and count it if it is wrong.
+ *
+ * A packet with a payload should have the next counter for its PID (once
+ * the same counter twice is allowed, as a duplicate packet), and one
+ * without should have the same counter as the last packet.
+ */
+static void check_continuity(
+    struct recorder* rec, byte* packet, uint32_t pid, byte* adapt, int adapt_len)
+{
+    int cc = packet[3] & 0x0F;
+    int has_payload = (packet[3] & 0x10) != 0;
+    int last = rec->last_cc[pid];
+
+    if (pid == 0x1FFF)
+        return; // null packets don't count
+    rec->last_cc[pid] = (int8_t)cc;
+    if (last == -1 || (adapt_len > 0 && (adapt[0] & 0x80)))
+        return; // first packet, or a discontinuity
+    if (!has_payload) {
+        if (cc != last)
+            rec->cc_errors++;
+    } else if (cc == last && !rec->had_dup[pid])
+        rec->had_dup[pid] = true;
+    else {
+        rec->had_dup[pid] = false;
+        if (cc != ((last + 1) & 0x0F))
+            rec->cc_errors++;
+    }
+}
+
+/*
+ * Record a TS packet from the ring.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int record_packet(struct recorder* rec, byte* packet, double now)
+{
+    uint32_t pid;
+    int pusi;
+    byte *adapt, *payload;
+    int adapt_len, payload_len;
+    int err;
+    int rap = false;
+    int64_t pts = 0;
+
+    err = split_TS_packet(packet, &pid, &pusi, &adapt, &adapt_len, &payload, &payload_len);
+    if (err)
+        return 0; // we've already counted it as a sync error, or similar
+    check_continuity(rec, packet, pid, adapt, adapt_len);
+
+    if (section_demux_wants_pid(rec->demux, pid)) {
+        err = section_demux_packet(rec->demux, pid, pusi, payload, payload_len);
+        if (err)
+            return 1;
+        if (rec->pmt_pid_changed) {
+            // Filters can't be added whilst the demux is calling us
+            err = add_section_filter(rec->demux, rec->pmt_pid, 0x02, 0xFF, 0, 0,
+                SECTION_FILTER_NEW_VERSIONS, handle_pmt, rec);
+            if (err)
+                return 1;
+            rec->pmt_pid_changed = false;
+        }
+    }
+
+    if (rec->video_pid != 0 && pid == rec->video_pid && pusi) {
+        uint64_t raw_pts;
+        int got_pts;
+        err = find_PTS_in_PES(payload, payload_len, &got_pts, &raw_pts);
+        if (!err && got_pts) {
+            pts = unwrap_pts(&rec->unwrap, raw_pts);
+            rap = TS_packet_starts_random_access(
+                rec->video_stream_type, adapt, adapt_len, payload, payload_len);
+        }
+    }
+
+    // A new file starts at a random access point, if we can
+    if (rec->rotate_due > 0
+        && (rap || rec->video_pid == 0 || now - rec->rotate_due > ROTATE_GRACE)) {
+        err = close_record_file(rec);
+        if (!err)
+            err = open_record_file(rec);
+        if (err)
+            return 1;
+    }
+
+    if (rap) {
+        if (rec->verbose)
+            fprint_msg("Random access point at " OFFSET_T_FORMAT " in %s, PTS %" PRIi64 "\n",
+                rec->file.length, rec->file_name, pts);
+        index_random_access_point(rec, rec->file.length, pts);
+    }
+
+    rec->packets++;
+    return write_record_packet(rec, packet);
+}
+
+/*
+ * Report how we are doing.
+ */
+static void report_stats(struct recorder* rec, double interval, uint64_t packets)
+{
+    fprint_msg("%.2f Mbit/s, %" PRIu64 " packets, %" PRIu64 " CC errors, ",
+        packets * TS_PACKET_SIZE * 8 / interval / 1e6, rec->packets, rec->cc_errors);
+    if (rec->is_rtp)
+        fprint_msg("%" PRIu64 " RTP lost, ", rec->rtp_lost.load());
+    fprint_msg("%" PRIu64 " sync errors, dropped %" PRIu64 " datagrams (socket) %" PRIu64
+               " packets (ring), %s\n",
+        rec->sync_errors.load(), rec->socket_drops.load(), rec->ring_drops.load(),
+        rec->file_name);
+}
+
+/*
+ * Record until we are told to stop.
+ *
+ * Returns 0 if all goes well, 1 if something goes wrong.
+ */
+static int record(struct recorder* rec)
+{
+    double start = now_secs();
+    double last_stats = start;
+    uint64_t last_packets = 0;
+    int err = 0;
+
+    for (;;) {
+        uint64_t head, posn;
+        int stopping;
+        double now;
+
+        {
+            std::unique_lock<std::mutex> guard(rec->lock);
+            rec->filled.wait_for(guard, std::chrono::milliseconds(100),
+                [rec] { return rec->stopping || rec->head.load() != rec->tail.load(); });
+            stopping = rec->stopping;
+        }
+        head = rec->head.load(std::memory_order_acquire);
+        now = now_secs();
+
+        for (posn = rec->tail.load(); posn < head && !err; posn += TS_PACKET_SIZE) {
+            err = record_packet(rec, rec->ring + (posn % rec->ring_size), now);
+            if (!err && rec->max > 0 && rec->packets >= (uint64_t)rec->max) {
+                if (!rec->quiet)
+                    fprint_msg("Stopping after %d TS packets\n", rec->max);
+                stopping = true;
+                posn += TS_PACKET_SIZE;
+                break;
+            }
+            // Let the receiver have the space back as we go
+            if ((posn / TS_PACKET_SIZE) % 1024 == 0)
+                rec->tail.store(posn, std::memory_order_release);
+        }
+        rec->tail.store(posn, std::memory_order_release);
+        if (err || stopping)
+            break;
+
+        if (rec->rotate_due == 0
+            && ((rec->rotate_size > 0 && rec->file.length >= rec->rotate_size)
+                || (rec->rotate_time > 0 && now - rec->file_start >= rec->rotate_time)))
+            rec->rotate_due = now;
+
+        if (rec->stats_interval > 0 && now - last_stats >= rec->stats_interval) {
+            report_stats(rec, now - last_stats, rec->packets - last_packets);
+            last_stats = now;
+            last_packets = rec->packets;
+        }
+
+        if (rec->duration > 0 && now - start >= rec->duration) {
+            if (!rec->quiet)
+                fprint_msg("Stopping after %.0f seconds\n", rec->duration);
+            break;
+        }
+    }
+
+    if (!rec->quiet) {
+        print_msg("Summary: ");
+        report_stats(rec, now_secs() - start, rec->packets);
+    }
+    return err || rec->receive_error;
+}
+
+static void print_usage()
+{
+    print_msg("Usage: tsrecord [switches] <host>:<port> <name>\n"
+              "\n");
+    REPORT_VERSION("tsrecord");
+    fprint_msg(
+        "\n"
+        "  Record a live Transport Stream, received as UDP (or RTP) datagrams,\n"
+        "  to disk. <host> is normally a multicast group, which is joined, but\n"
+        "  may be a local address to listen on for unicast.\n"
+        "\n"
+        "  The stream is checked as it is recorded, and lost RTP packets, TS\n"
+        "  continuity counter errors and dropped packets are reported.\n"
+        "\n"
+        "Files:\n"
+        "  <name>  is the file to record to. If -rotate-size or -rotate-time is\n"
+        "          given, files are called <name>NNNNN.ts instead.\n"
+        "\n"
+        "Switches:\n"
+        "  -err stdout         Write error messages to standard output (the default)\n"
+        "  -err stderr         Write error messages to standard error (Unix traditional)\n"
+        "  -mcastif <ipaddr>   Join the multicast group on the network interface\n"
+        "                      with this IP address.\n"
+        "  -rotate-size <MB>   Start a new file when the current one reaches this\n"
+        "                      many megabytes.\n"
+        "  -rotate-time <secs> Start a new file when the current one has been\n"
+        "                      recorded for this many seconds.\n"
+        "                      New files start at a random access point in the\n"
+        "                      video, if one comes within %.0f seconds.\n"
+        "  -noindex            Don't write an index. Normally, each file has an\n"
+        "                      index, <file>.idx, listing the byte offset, PTS and\n"
+        "                      time of each random access point in the video.\n"
+        "  -prog <n>           Index program <n>. The default is the first program\n"
+        "                      in the PAT. All programs are recorded regardless.\n"
+        "  -duration <secs>    Stop after this many seconds.\n"
+        "  -max <n>, -m <n>    Stop after recording <n> TS packets.\n"
+        "  -stats <secs>       Report progress this often. The default is %d\n"
+        "                      seconds, and 0 means not to report until the end.\n"
+        "  -quiet, -q          Only output error messages.\n"
+        "  -verbose, -v        Report each random access point found.\n"
+        "\n"
+        "Buffering:\n"
+        "  -rcvbuf <MB>        The socket receive buffer size. The default is %d.\n"
+        "  -ring <MB>          The buffer between receiving and writing, which lets\n"
+        "                      us ride out slow disk writes. The default is %d.\n"
+        "  -prealloc <MB>      Preallocate files on disk this much at a time, so\n"
+        "                      that they are less fragmented. 0 means don't. The\n"
+        "                      default is %d. Unused space is released at the end.\n"
+        "  -nodirect           Don't write with O_DIRECT. Normally, files are\n"
+        "                      written in large aligned blocks bypassing the page\n"
+        "                      cache, so that recording does not evict everything\n"
+        "                      else from memory.\n"
+        "\n"
+        "Recording stops on SIGINT or SIGTERM, after finishing the current file.\n",
+        ROTATE_GRACE, DEFAULT_STATS_INTERVAL, DEFAULT_RCVBUF_SIZE, DEFAULT_RING_SIZE,
+        DEFAULT_PREALLOC_SIZE);
+}
+
+int main(int argc, char** argv)
+{
+    char* hostname = nullptr;
+    int port = 0;
+    char* multicast_if = nullptr;
+    int had_host = false;
+    int rotate_size = 0;
+    int ring_size = DEFAULT_RING_SIZE;
+    int rcvbuf_size = DEFAULT_RCVBUF_SIZE;
+    int prealloc = DEFAULT_PREALLOC_SIZE;
+    int stats_interval = DEFAULT_STATS_INTERVAL;
+    int one = 1;
+    int err = 0;
+    int ii = 1;
+    struct sigaction action;
+    struct recorder* rec;
+
+    if (argc < 2) {
+        print_usage();
+        return 0;
+    }
+
+    // Far too big for the stack, and the atomics mean no memset
+    rec = new (std::nothrow) struct recorder();
+    if (rec == nullptr) {
+        print_err("### tsrecord: Unable to allocate recorder\n");
+        return 1;
+    }
+    rec->direct = true;
+    rec->index = true;
+    rec->want_program = -1;
+    rec->socket = -1;
+    rec->file.fd = -1;
+    rec->unwrap = TIMESTAMP_UNWRAP_INIT;
+    memset(rec->last_cc, -1, sizeof(rec->last_cc));
+
+    while (ii < argc) {
+        if (argv[ii][0] == '-') {
+            if (!strcmp("--help", argv[ii]) || !strcmp("-h", argv[ii])
+                || !strcmp("-help", argv[ii])) {
+                print_usage();
+                return 0;
+            } else if (!strcmp("-err", argv[ii])) {
+                CHECKARG("tsrecord", ii);
+                if (!strcmp(argv[ii + 1], "stderr"))
+                    redirect_output_stderr();
+                else if (!strcmp(argv[ii + 1], "stdout"))
+                    redirect_output_stdout();
+                else {
+                    fprint_err("### tsrecord: "
+                               "Unrecognised option '%s' to -err (not 'stdout' or"
+                               " 'stderr')\n",
+                        argv[ii + 1]);
+                    return 1;
+                }
+                ii++;
+            } else if (!strcmp("-mcastif", argv[ii])) {
+                CHECKARG("tsrecord", ii);
+                multicast_if = argv[ii + 1];
+                ii++;
+            } else if (!strcmp("-rotate-size", argv[ii])) {
+                CHECKARG("tsrecord", ii);
+                err = int_value("tsrecord", argv[ii], argv[ii + 1], true, 10, &rotate_size);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-rotate-time", argv[ii])) {
+                CHECKARG("tsrecord", ii);
+                err = double_value("tsrecord", argv[ii], argv[ii + 1], true, &rec->rotate_time);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-noindex", argv[ii])) {
+                rec->index = false;
+            } else if (!strcmp("-prog", argv[ii])) {
+                CHECKARG("tsrecord", ii);
+                err = int_value_in_range(
+                    "tsrecord", argv[ii], argv[ii + 1], 1, 0xFFFF, 0, &rec->want_program);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-duration", argv[ii])) {
+                CHECKARG("tsrecord", ii);
+                err = double_value("tsrecord", argv[ii], argv[ii + 1], true, &rec->duration);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-max", argv[ii]) || !strcmp("-m", argv[ii])) {
+                CHECKARG("tsrecord", ii);
+                err = int_value("tsrecord", argv[ii], argv[ii + 1], true, 10, &rec->max);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-stats", argv[ii])) {
+                CHECKARG("tsrecord", ii);
+                err = int_value("tsrecord", argv[ii], argv[ii + 1], true, 10, &stats_interval);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-rcvbuf", argv[ii])) {
+                CHECKARG("tsrecord", ii);
+                err = int_value_in_range(
+                    "tsrecord", argv[ii], argv[ii + 1], 0, 1024, 10, &rcvbuf_size);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-ring", argv[ii])) {
+                CHECKARG("tsrecord", ii);
+                err = int_value_in_range(
+                    "tsrecord", argv[ii], argv[ii + 1], 1, 16384, 10, &ring_size);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-prealloc", argv[ii])) {
+                CHECKARG("tsrecord", ii);
+                err = int_value_in_range(
+                    "tsrecord", argv[ii], argv[ii + 1], 0, 16384, 10, &prealloc);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-nodirect", argv[ii])) {
+                rec->direct = false;
+            } else if (!strcmp("-quiet", argv[ii]) || !strcmp("-q", argv[ii])) {
+                rec->quiet = true;
+                rec->verbose = false;
+            } else if (!strcmp("-verbose", argv[ii]) || !strcmp("-v", argv[ii])) {
+                rec->verbose = true;
+                rec->quiet = false;
+            } else {
+                fprint_err("### tsrecord: "
+                           "Unrecognised command line switch '%s'\n",
+                    argv[ii]);
+                return 1;
+            }
+        } else {
+            if (!had_host) {
+                err = host_value("tsrecord", nullptr, argv[ii], &hostname, &port);
+                if (err)
+                    return 1;
+                if (port == 0) {
+                    fprint_err("### tsrecord: No port given in '%s'\n", argv[ii]);
+                    return 1;
+                }
+                had_host = true;
+            } else if (rec->name == nullptr)
+                rec->name = argv[ii];
+            else {
+                fprint_err("### tsrecord: Unexpected '%s'\n", argv[ii]);
+                return 1;
+            }
+        }
+        ii++;
+    }
+
+    if (!had_host) {
+        print_err("### tsrecord: No host and port to receive from specified\n");
+        return 1;
+    }
+    if (rec->name == nullptr) {
+        print_err("### tsrecord: No file to record to specified\n");
+        return 1;
+    }
+    rec->rotate_size = (offset_t)rotate_size * 1024 * 1024;
+    rec->rotating = (rec->rotate_size > 0 || rec->rotate_time > 0);
+    rec->prealloc = (offset_t)prealloc * 1024 * 1024;
+    rec->stats_interval = stats_interval;
+    if (rec->quiet)
+        rec->stats_interval = 0;
+
+    rec->ring_size = ((size_t)ring_size * 1024 * 1024 / TS_PACKET_SIZE) * TS_PACKET_SIZE;
+    rec->ring = (byte*)malloc(rec->ring_size);
+    if (rec->ring == nullptr || posix_memalign((void**)&rec->file.buf, DISK_ALIGNMENT,
+                                    DISK_CHUNK_SIZE)) {
+        print_err("### tsrecord: Unable to allocate buffers\n");
+        return 1;
+    }
+
+    rec->socket = listen_socket(hostname, port, multicast_if, rcvbuf_size * 1024 * 1024);
+    if (rec->socket == -1)
+        return 1;
+    // Ask to be told how many datagrams the kernel drops
+    if (setsockopt(rec->socket, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) && rec->verbose)
+        fprint_msg("Unable to count dropped datagrams: %s\n", strerror(errno));
+
+    action.sa_handler = on_interrupt;
+    action.sa_flags = 0;
+    sigemptyset(&action.sa_mask);
+    (void)sigaction(SIGINT, &action, 0);
+    (void)sigaction(SIGTERM, &action, 0);
+
+    err = build_section_demux(&rec->demux);
+    if (!err)
+        err = add_section_filter(
+            rec->demux, 0x00, 0x00, 0xFF, 0, 0, SECTION_FILTER_NEW_VERSIONS, handle_pat, rec);
+    if (!err)
+        err = open_record_file(rec);
+    if (!err) {
+        if (!rec->quiet)
+            fprint_msg("Recording from %s:%d to %s\n", hostname, port, rec->file_name);
+        try {
+            rec->receiver = std::thread(receive_thread, rec);
+        } catch (const std::system_error& e) {
+            fprint_err("### tsrecord: Unable to start receiving thread: %s\n", e.what());
+            err = 1;
+        }
+    }
+    if (!err)
+        err = record(rec);
+
+    rec->stopping = true;
+    if (rec->receiver.joinable())
+        rec->receiver.join();
+    if (close_record_file(rec))
+        err = 1;
+
+    (void)disconnect_socket(rec->socket);
+    free_section_demux(&rec->demux);
+    free(rec->ring);
+    free(rec->file.buf);
+    delete rec;
+    return err ? 1 : 0;
+}
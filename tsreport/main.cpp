@@ -35,19 +35,28 @@
 #include <unistd.h>
 
 #include "accessunit.h"
+#include "batch.h"
 #include "bitdata.h"
+#include "blockcache.h"
 #include "compat.h"
+#include "compressed.h"
+#include "dvbsi.h"
 #include "es.h"
 #include "fmtx.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "misc.h"
 #include "nalunit.h"
+#include "packet_view_defns.h"
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "section.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
@@ -62,7 +71,7 @@ static int tfmt_abs = FMTX_TS_DISPLAY_90kHz_RAW;
 
 static uint64_t estimate_pcr(offset_t posn, uint64_t ppcr_pos, uint64_t ppcr_val, double pcr_rate)
 {
-    return (uint64_t)(ppcr_val + (27000000.0 * (double)(posn - ppcr_pos)) / pcr_rate);
+    return pcr_add(ppcr_val, (int64_t)((27000000.0 * (double)(posn - ppcr_pos)) / pcr_rate));
 }
 
 /* ============================================================================
@@ -227,6 +236,10 @@ static int report_buffering_stats(TS_reader_p tsreader, const int req_prog_no, i
     int index;
     int ii;
 
+    // For formatting timestamps (at most two at once)
+    TCHAR time_buf1[FMTX_TIMESTAMP_MAX];
+    TCHAR time_buf2[FMTX_TIMESTAMP_MAX];
+
     unsigned int pcr_count = 0;
     uint64_t max_pcr_gap = 0;
     unsigned int bad_pcr_gap_count = 0;
@@ -295,7 +308,7 @@ static int report_buffering_stats(TS_reader_p tsreader, const int req_prog_no, i
 
     // Now do the actual work...
     start_count = count = pmt_at;
-    start_posn = posn = tsreader->posn - TS_PACKET_SIZE;
+    start_posn = posn = tsreader->posn - tsreader->packet_size;
 
     if (continuity_cnt_pid != INVALID_PID) {
         file_cnt = fopen("continuity_counter.txt", "w");
@@ -350,8 +363,10 @@ static int report_buffering_stats(TS_reader_p tsreader, const int req_prog_no, i
             uint64_t adapt_pcr;
             // Do I need to check that this is the same PCR I got earlier?
             // I certainly hope not...
-            get_PCR_from_adaptation_field(adapt, adapt_len, &got_pcr, &adapt_pcr);
+            const adaptation_field_view field = { adapt, adapt_len };
+            got_pcr = field.has_PCR();
             if (got_pcr) {
+                adapt_pcr = field.PCR();
                 ++pcr_count;
 
                 if (predict.know_pcr_rate) {
@@ -368,7 +383,8 @@ static int report_buffering_stats(TS_reader_p tsreader, const int req_prog_no, i
 
                 if (verbose)
                     fprint_msg(OFFSET_T_FORMAT_8 ": read PCR %s\n", posn,
-                        fmtx_timestamp(adapt_pcr, tfmt_abs | FMTX_TS_N_27MHz));
+                        fmtx_timestamp_r(
+                            time_buf1, sizeof(time_buf1), adapt_pcr, tfmt_abs | FMTX_TS_N_27MHz));
                 if (file)
                     fprintf(file, OFFSET_T_FORMAT ",read," LLU_FORMAT ",,,,\n", posn,
                         (adapt_pcr / (uint64_t)300) & report_mask);
@@ -377,8 +393,10 @@ static int report_buffering_stats(TS_reader_p tsreader, const int req_prog_no, i
                     if (pcr_signed_diff(predict.prev_pcr, adapt_pcr) > 0) {
                         fprint_err("!!! PCR %s at TS packet " OFFSET_T_FORMAT
                                    " is not more than previous PCR %s\n",
-                            fmtx_timestamp(adapt_pcr, tfmt_abs | FMTX_TS_N_27MHz), posn,
-                            fmtx_timestamp(predict.prev_pcr, tfmt_abs | FMTX_TS_N_27MHz));
+                            fmtx_timestamp_r(time_buf1, sizeof(time_buf1),
+                                adapt_pcr, tfmt_abs | FMTX_TS_N_27MHz), posn,
+                            fmtx_timestamp_r(time_buf2, sizeof(time_buf2),
+                                predict.prev_pcr, tfmt_abs | FMTX_TS_N_27MHz));
                     } else {
                         uint64_t delta_pcr = pcr_unsigned_diff(adapt_pcr, predict.prev_pcr);
                         int delta_bytes = (int)(posn - predict.prev_pcr_posn);
@@ -392,8 +410,10 @@ static int report_buffering_stats(TS_reader_p tsreader, const int req_prog_no, i
                         if (delta_pcr > 27000000 / 10) {
                             if (bad_pcr_gap_count++ == 0)
                                 fprint_err("!!! PCR gap of %s @ PCR %s > 0.1sec...\n",
-                                    fmtx_timestamp(delta_pcr, tfmt_diff | FMTX_TS_N_27MHz),
-                                    fmtx_timestamp(adapt_pcr, tfmt_abs | FMTX_TS_N_27MHz));
+                                    fmtx_timestamp_r(time_buf1, sizeof(time_buf1),
+                                        delta_pcr, tfmt_diff | FMTX_TS_N_27MHz),
+                                    fmtx_timestamp_r(time_buf2, sizeof(time_buf2),
+                                        adapt_pcr, tfmt_abs | FMTX_TS_N_27MHz));
                         }
 
 #if 0 // XXX
@@ -571,8 +591,8 @@ static int report_buffering_stats(TS_reader_p tsreader, const int req_prog_no, i
             if (pts_signed_diff(stats[index].pts, stats[index].dts) < 0) {
                 if (stats[index].err_pts_lt_dts++ == 0)
                     fprint_msg("### PID(%d): PTS (%s) < DTS (%s)\n", stats[index].pid,
-                        fmtx_timestamp(stats[index].pts, tfmt_abs),
-                        fmtx_timestamp(stats[index].dts, tfmt_abs));
+                        fmtx_timestamp_r(time_buf1, sizeof(time_buf1), stats[index].pts, tfmt_abs),
+                        fmtx_timestamp_r(time_buf2, sizeof(time_buf2), stats[index].dts, tfmt_abs));
             }
             if (stats[index].had_a_dts) {
                 int64_t dts_dts_diff = pts_signed_diff(stats[index].dts, last_dts);
@@ -584,15 +604,17 @@ static int report_buffering_stats(TS_reader_p tsreader, const int req_prog_no, i
                 if (dts_dts_diff < 0) {
                     if (stats[index].err_dts_lt_prev_dts++ == 0)
                         fprint_msg("### PID(%d): DTS (%s) < previous DTS (%s)\n", stats[index].pid,
-                            fmtx_timestamp(stats[index].dts, tfmt_abs),
-                            fmtx_timestamp(last_dts, tfmt_abs));
+                            fmtx_timestamp_r(
+                                time_buf1, sizeof(time_buf1), stats[index].dts, tfmt_abs),
+                            fmtx_timestamp_r(time_buf2, sizeof(time_buf2), last_dts, tfmt_abs));
                 }
             }
             if (pts_signed_diff(stats[index].dts, pcr_time_now_div300) < 0) {
                 if (stats[index].err_dts_lt_pcr++ == 0)
                     fprint_msg("### PID(%d): DTS (%s) < PCR (%s)\n", stats[index].pid,
-                        fmtx_timestamp(stats[index].dts, tfmt_abs),
-                        fmtx_timestamp(acc_pcr, tfmt_abs | FMTX_TS_N_27MHz));
+                        fmtx_timestamp_r(time_buf1, sizeof(time_buf1), stats[index].dts, tfmt_abs),
+                        fmtx_timestamp_r(
+                            time_buf2, sizeof(time_buf2), acc_pcr, tfmt_abs | FMTX_TS_N_27MHz));
             }
 
             if (!stats[index].had_a_pts) {
@@ -717,10 +739,12 @@ static int report_buffering_stats(TS_reader_p tsreader, const int req_prog_no, i
     }
 
     fprint_msg("PCRs found: %u, Bad (>.1s) gaps: %u, Max gap: %s\n", pcr_count, bad_pcr_gap_count,
-        fmtx_timestamp(max_pcr_gap, tfmt_diff | FMTX_TS_N_27MHz));
+        fmtx_timestamp_r(time_buf1, sizeof(time_buf1), max_pcr_gap, tfmt_diff | FMTX_TS_N_27MHz));
     fprint_msg("Linear PCR prediction errors: min=%s, max=%s\n",
-        fmtx_timestamp(predict.min_pcr_error, tfmt_diff | FMTX_TS_N_27MHz),
-        fmtx_timestamp(predict.max_pcr_error, tfmt_diff | FMTX_TS_N_27MHz));
+        fmtx_timestamp_r(
+            time_buf1, sizeof(time_buf1), predict.min_pcr_error, tfmt_diff | FMTX_TS_N_27MHz),
+        fmtx_timestamp_r(
+            time_buf2, sizeof(time_buf2), predict.max_pcr_error, tfmt_diff | FMTX_TS_N_27MHz));
 
     for (ii = 0; ii < num_streams; ii++) {
         struct stream_data* const ss = stats + ii;
@@ -731,49 +755,58 @@ static int report_buffering_stats(TS_reader_p tsreader, const int req_prog_no, i
             fprint_msg("  PCR/%s:\n    Minimum difference was %6s at DTS %8s, TS packet "
                        "at " OFFSET_T_FORMAT_8 "\n",
                 ss->pts_ne_dts ? "PTS" : "PTS,DTS",
-                fmtx_timestamp(ss->pcr_pts_diff.min, tfmt_diff),
-                fmtx_timestamp(ss->pcr_pts_diff.min_at, tfmt_abs), ss->pcr_pts_diff.min_posn);
+                fmtx_timestamp_r(time_buf1, sizeof(time_buf1), ss->pcr_pts_diff.min, tfmt_diff),
+                fmtx_timestamp_r(time_buf2, sizeof(time_buf2),
+                    ss->pcr_pts_diff.min_at, tfmt_abs), ss->pcr_pts_diff.min_posn);
             fprint_msg("    Maximum difference was %6s at DTS %8s, TS packet at " OFFSET_T_FORMAT_8
                        "\n",
-                fmtx_timestamp(ss->pcr_pts_diff.max, tfmt_diff),
-                fmtx_timestamp(ss->pcr_pts_diff.max_at, tfmt_abs), ss->pcr_pts_diff.max_posn);
+                fmtx_timestamp_r(time_buf1, sizeof(time_buf1), ss->pcr_pts_diff.max, tfmt_diff),
+                fmtx_timestamp_r(time_buf2, sizeof(time_buf2),
+                    ss->pcr_pts_diff.max_at, tfmt_abs), ss->pcr_pts_diff.max_posn);
             fprint_msg("    i.e., a span of %s\n",
-                fmtx_timestamp(ss->pcr_pts_diff.max - ss->pcr_pts_diff.min, tfmt_diff));
+                fmtx_timestamp_r(time_buf1, sizeof(time_buf1),
+                    ss->pcr_pts_diff.max - ss->pcr_pts_diff.min, tfmt_diff));
             fprint_msg("    Mean difference (of %u) is %s\n", ss->pcr_pts_diff.num,
-                fmtx_timestamp(
+                fmtx_timestamp_r(time_buf1, sizeof(time_buf1),
                     (int64_t)(ss->pcr_pts_diff.sum / (double)ss->pcr_pts_diff.num), tfmt_diff));
         }
 
         if (ss->pcr_dts_diff.num > 0 && ss->pts_ne_dts) {
             fprint_msg("  PCR/DTS:\n    Minimum difference was %6s at DTS %8s, TS packet "
                        "at " OFFSET_T_FORMAT_8 "\n",
-                fmtx_timestamp(ss->pcr_dts_diff.min, tfmt_diff),
-                fmtx_timestamp(ss->pcr_dts_diff.min_at, tfmt_abs), ss->pcr_dts_diff.min_posn);
+                fmtx_timestamp_r(time_buf1, sizeof(time_buf1), ss->pcr_dts_diff.min, tfmt_diff),
+                fmtx_timestamp_r(time_buf2, sizeof(time_buf2),
+                    ss->pcr_dts_diff.min_at, tfmt_abs), ss->pcr_dts_diff.min_posn);
             fprint_msg("    Maximum difference was %6s at DTS %8s, TS packet at " OFFSET_T_FORMAT_8
                        "\n",
-                fmtx_timestamp(ss->pcr_dts_diff.max, tfmt_diff),
-                fmtx_timestamp(ss->pcr_dts_diff.max_at, tfmt_abs), ss->pcr_dts_diff.max_posn);
+                fmtx_timestamp_r(time_buf1, sizeof(time_buf1), ss->pcr_dts_diff.max, tfmt_diff),
+                fmtx_timestamp_r(time_buf2, sizeof(time_buf2),
+                    ss->pcr_dts_diff.max_at, tfmt_abs), ss->pcr_dts_diff.max_posn);
             fprint_msg("    i.e., a span of %s\n",
-                fmtx_timestamp(ss->pcr_dts_diff.max - ss->pcr_dts_diff.min, tfmt_diff));
+                fmtx_timestamp_r(time_buf1, sizeof(time_buf1),
+                    ss->pcr_dts_diff.max - ss->pcr_dts_diff.min, tfmt_diff));
             fprint_msg("    Mean difference (of %u) is %s\n", ss->pcr_dts_diff.num,
-                fmtx_timestamp(
+                fmtx_timestamp_r(time_buf1, sizeof(time_buf1),
                     (int64_t)(ss->pcr_dts_diff.sum / (double)ss->pcr_dts_diff.num), tfmt_diff));
         }
         if (ss->had_a_dts) {
             fprint_msg("  DTS-last DTS: min=%s, max=%s\n",
-                fmtx_timestamp(ss->dts_dts_min, tfmt_diff),
-                fmtx_timestamp(ss->dts_dts_max, tfmt_diff));
+                fmtx_timestamp_r(time_buf1, sizeof(time_buf1), ss->dts_dts_min, tfmt_diff),
+                fmtx_timestamp_r(time_buf2, sizeof(time_buf2), ss->dts_dts_max, tfmt_diff));
         }
 
         fprint_msg("  First PCR %8s, last %8s\n",
-            fmtx_timestamp(first_pcr, tfmt_abs | FMTX_TS_N_27MHz),
-            fmtx_timestamp(predict.prev_pcr, tfmt_abs | FMTX_TS_N_27MHz));
+            fmtx_timestamp_r(time_buf1, sizeof(time_buf1), first_pcr, tfmt_abs | FMTX_TS_N_27MHz),
+            fmtx_timestamp_r(
+                time_buf2, sizeof(time_buf2), predict.prev_pcr, tfmt_abs | FMTX_TS_N_27MHz));
         if (ss->pcr_pts_diff.num > 0)
-            fprint_msg("  First PTS %8s, last %8s\n", fmtx_timestamp(ss->first_pts, tfmt_abs),
-                fmtx_timestamp(ss->pts, tfmt_abs));
+            fprint_msg("  First PTS %8s, last %8s\n", fmtx_timestamp_r(
+                time_buf1, sizeof(time_buf1), ss->first_pts, tfmt_abs),
+                fmtx_timestamp_r(time_buf2, sizeof(time_buf2), ss->pts, tfmt_abs));
         if (ss->pcr_dts_diff.num > 0)
-            fprint_msg("  First DTS %8s, last %8s\n", fmtx_timestamp(ss->first_dts, tfmt_abs),
-                fmtx_timestamp(ss->dts, tfmt_abs));
+            fprint_msg("  First DTS %8s, last %8s\n", fmtx_timestamp_r(
+                time_buf1, sizeof(time_buf1), ss->first_dts, tfmt_abs),
+                fmtx_timestamp_r(time_buf2, sizeof(time_buf2), ss->dts, tfmt_abs));
 
         {
             // Calculate rate over the range of PCRs seen in this stream
@@ -807,9 +840,14 @@ static int report_buffering_stats(TS_reader_p tsreader, const int req_prog_no, i
 /*
  * Report on the given file
  *
+ * If `si_tables` is non-zero, also report on those DVB SI tables (as a
+ * combination of DVB_SI_NIT, DVB_SI_SDT, DVB_SI_EIT and DVB_SI_TDT), as
+ * each new version is found.
+ *
  * Returns 0 if all went well, 1 if something went wrong.
  */
-static int report_ts(TS_reader_p tsreader, int max, int verbose, int show_data, int report_timing)
+static int report_ts(TS_reader_p tsreader, int max, int verbose, int show_data, int report_timing,
+    int si_tables)
 {
     struct timing times = { 0 };
     pidint_list_p prog_list = nullptr;
@@ -827,9 +865,21 @@ static int report_ts(TS_reader_p tsreader, int max, int verbose, int show_data,
     int pmt_data_len = 0;
     int pmt_data_used = 0;
 
+    section_demux_p si_demux = nullptr;
+
     if (report_timing)
         time_ptr = &times;
 
+    if (si_tables) {
+        err = build_section_demux(&si_demux);
+        if (!err)
+            err = add_dvb_si_filters(si_demux, si_tables, false);
+        if (err) {
+            free_section_demux(&si_demux);
+            return 1;
+        }
+    }
+
     for (;;) {
         uint32_t pid;
         int payload_unit_start_indicator;
@@ -847,19 +897,27 @@ static int report_ts(TS_reader_p tsreader, int max, int verbose, int show_data,
             break;
         else if (err) {
             fprint_err("### Error reading TS packet %d at " OFFSET_T_FORMAT "\n", count,
-                tsreader->posn - TS_PACKET_SIZE);
+                tsreader->posn - tsreader->packet_size);
             free_pidint_list(&prog_list);
             if (pmt_data)
                 free(pmt_data);
+            free_section_demux(&si_demux);
             return 1;
         }
 
         count++;
 
-        if (verbose)
+        if (count == 1)
+            report_TS_packet_layout(tsreader);
+
+        if (verbose) {
+            uint32_t arrival_time;
             fprint_msg(OFFSET_T_FORMAT_8 ": TS Packet %2d PID %04x%s",
-                tsreader->posn - TS_PACKET_SIZE, count, pid,
+                tsreader->posn - tsreader->packet_size, count, pid,
                 (payload_unit_start_indicator ? " [pusi]" : ""));
+            if (get_TS_packet_arrival_time(tsreader, nullptr, &arrival_time))
+                fprint_msg(" ATS %u", arrival_time);
+        }
 
         // Report on what we may
         if (verbose) {
@@ -884,6 +942,7 @@ static int report_ts(TS_reader_p tsreader, int max, int verbose, int show_data,
                     free_pmt(&pmt);
                     if (pmt_data)
                         free(pmt_data);
+                    free_section_demux(&si_demux);
                     return 1;
                 }
                 fprint_msg(" stream type %02x (%s)\n", stream->stream_type,
@@ -896,6 +955,21 @@ static int report_ts(TS_reader_p tsreader, int max, int verbose, int show_data,
         if (pid == 0x1fff)
             continue;
 
+        if (si_demux != nullptr && section_demux_wants_pid(si_demux, pid)) {
+            err = section_demux_packet(
+                si_demux, pid, payload_unit_start_indicator, payload, payload_len);
+            if (err) {
+                fprint_err("### Error handling SI in TS packet at " OFFSET_T_FORMAT "\n",
+                    tsreader->posn - tsreader->packet_size);
+                free_section_demux(&si_demux);
+                free_pidint_list(&prog_list);
+                free_pmt(&pmt);
+                if (pmt_data)
+                    free(pmt_data);
+                return 1;
+            }
+        }
+
         // Conditional Access Tables *might* contain a PCR - do we want
         // to ignore them anyway? Well, since I've never seen one, do so for now
         if (pid == 0x0001)
@@ -916,7 +990,7 @@ static int report_ts(TS_reader_p tsreader, int max, int verbose, int show_data,
             } else if (!payload_unit_start_indicator && !pat_data) {
                 fprint_err("!!! Discarding partial (unstarted) PAT in TS"
                            " packet at " OFFSET_T_FORMAT "\n",
-                    tsreader->posn - TS_PACKET_SIZE);
+                    tsreader->posn - tsreader->packet_size);
                 continue;
             }
 
@@ -925,10 +999,11 @@ static int report_ts(TS_reader_p tsreader, int max, int verbose, int show_data,
             if (err) {
                 fprint_err("### Error %s PAT in TS packet at " OFFSET_T_FORMAT "\n",
                     (payload_unit_start_indicator ? "starting new" : "continuing"),
-                    tsreader->posn - TS_PACKET_SIZE);
+                    tsreader->posn - tsreader->packet_size);
                 free_pidint_list(&prog_list);
                 if (pat_data)
                     free(pat_data);
+                free_section_demux(&si_demux);
                 return 1;
             }
 
@@ -943,10 +1018,11 @@ static int report_ts(TS_reader_p tsreader, int max, int verbose, int show_data,
             if (err) {
                 fprint_err("### Error extracting program list from PAT in TS"
                            " packet at " OFFSET_T_FORMAT "\n",
-                    tsreader->posn - TS_PACKET_SIZE);
+                    tsreader->posn - tsreader->packet_size);
                 free_pidint_list(&prog_list);
                 if (pat_data)
                     free(pat_data);
+                free_section_demux(&si_demux);
                 return 1;
             }
 
@@ -972,7 +1048,7 @@ static int report_ts(TS_reader_p tsreader, int max, int verbose, int show_data,
                     fprint_err("!!! Discarding partial PMT with PID %04x in TS"
                                " packet at " OFFSET_T_FORMAT
                                ", already building PMT with PID %04x\n",
-                        unfinished_pmt_pid, tsreader->posn - TS_PACKET_SIZE, pid);
+                        unfinished_pmt_pid, tsreader->posn - tsreader->packet_size, pid);
                     continue;
                 }
             }
@@ -986,7 +1062,7 @@ static int report_ts(TS_reader_p tsreader, int max, int verbose, int show_data,
             } else if (!payload_unit_start_indicator && !pmt_data) {
                 fprint_err("!!! Discarding partial (unstarted) PMT in TS"
                            " packet at " OFFSET_T_FORMAT "\n",
-                    tsreader->posn - TS_PACKET_SIZE);
+                    tsreader->posn - tsreader->packet_size);
                 continue;
             }
 
@@ -995,11 +1071,12 @@ static int report_ts(TS_reader_p tsreader, int max, int verbose, int show_data,
             if (err) {
                 fprint_err("### Error %s PMT in TS packet at " OFFSET_T_FORMAT "\n",
                     (payload_unit_start_indicator ? "starting new" : "continuing"),
-                    tsreader->posn - TS_PACKET_SIZE);
+                    tsreader->posn - tsreader->packet_size);
                 free_pidint_list(&prog_list);
                 free_pmt(&pmt);
                 if (pmt_data)
                     free(pmt_data);
+                free_section_demux(&si_demux);
                 return 1;
             }
 
@@ -1019,11 +1096,12 @@ static int report_ts(TS_reader_p tsreader, int max, int verbose, int show_data,
             if (err) {
                 fprint_err("### Error extracting stream list from PMT in TS"
                            " packet at " OFFSET_T_FORMAT "\n",
-                    tsreader->posn - TS_PACKET_SIZE);
+                    tsreader->posn - tsreader->packet_size);
                 free_pidint_list(&prog_list);
                 free_pmt(&pmt);
                 if (pmt_data)
                     free(pmt_data);
+                free_section_demux(&si_demux);
                 return err;
             }
 
@@ -1055,6 +1133,10 @@ static int report_ts(TS_reader_p tsreader, int max, int verbose, int show_data,
         }
     }
     fprint_msg("Read %d TS packet%s\n", count, (count == 1 ? "" : "s"));
+    if (si_demux != nullptr) {
+        report_section_demux(true, si_demux);
+        free_section_demux(&si_demux);
+    }
     free_pidint_list(&prog_list);
     free_pmt(&pmt);
     if (pmt_data)
@@ -1090,7 +1172,7 @@ static int report_single_pid(TS_reader_p tsreader, int max, int quiet, uint32_t
             break;
         else if (err) {
             fprint_err("### Error reading TS packet %d at " OFFSET_T_FORMAT "\n", count,
-                tsreader->posn - TS_PACKET_SIZE);
+                tsreader->posn - tsreader->packet_size);
             return 1;
         }
 
@@ -1103,7 +1185,7 @@ static int report_single_pid(TS_reader_p tsreader, int max, int quiet, uint32_t
 
         if (!quiet) {
             fprint_msg(OFFSET_T_FORMAT_8 ": TS Packet %2d PID %04x%s\n",
-                tsreader->posn - TS_PACKET_SIZE, count, pid,
+                tsreader->posn - tsreader->packet_size, count, pid,
                 (payload_unit_start_indicator ? " [pusi]" : ""));
 
             if (adapt_len > 0)
@@ -1143,6 +1225,13 @@ static void print_usage()
               "  -verbose, -v      Also output (fairly detailed) information on each TS packet.\n"
               "  -quiet, -q        Only output summary information (this is the default)\n"
               "  -max <n>, -m <n>  Maximum number of TS packets to read\n"
+              "  -async            Write output from a background thread. This makes\n"
+              "                    -verbose much faster when writing to a terminal or pipe.\n"
+              "  -si               Also report on the DVB SI tables (NIT, SDT, EIT, TDT\n"
+              "                    and TOT), as each new version of a section is found.\n"
+              "  -nit, -sdt, -eit, -tdt\n"
+              "                    Report on just those tables (the TDT includes the TOT)\n"
+              "                    These cannot be used with -buffering, -cnt or -justpid.\n"
               "\n"
               "Buffering information:\n"
               "  -buffering, -b    Report on the differences between PCR and PTS, and\n"
@@ -1182,7 +1271,75 @@ static void print_usage()
               "      32            Show as 90KHz timestamps, but only the low 32 bits.\n"
               "      ms            Show as milliseconds.\n"
               "      hms           Show as hours/minutes/seconds (H:MM:SS.ssss, the H\n"
-              "                    can be more than one digit if necessary)\n");
+              "                    can be more than one digit if necessary)\n"
+              "\n"
+              "Batches:\n"
+              "  -batch <list>     Report on each of the files named in <list> (one per\n"
+              "                    line, or '-' for standard input), or in the directory\n"
+              "                    <list>, instead of <infile>. The report for each file\n"
+              "                    is output as a line of JSON. Cannot be used with -o or\n"
+              "                    -cnt, which write to a single file.\n"
+              "  -jobs <n>         Report on <n> files at once. Defaults to one per CPU.\n"
+              "  -io <n>           Read ahead <n> files at once. Defaults to 4.\n"
+              "  -unordered        Output each report as soon as it is ready, rather than\n"
+              "                    in the order of the files.\n");
+}
+
+// How to report on each file - shared by all the files in a batch
+struct tsreport_settings {
+    int max;
+    int verbose;
+    int quiet;
+    int report_timing;
+    int si_tables;
+    int report_buffering;
+    int show_data;
+    char* output_name;
+    uint32_t continuity_cnt_pid;
+    int req_prog_no;
+    uint64_t report_mask;
+    int select_pid;
+    uint32_t just_pid;
+};
+
+/*
+ * Report on a single file, or standard input if `input_name` is nullptr.
+ *
+ * Returns 0 if all went well, 1 if something went wrong.
+ */
+static int report_file(char* input_name, void* arg)
+{
+    struct tsreport_settings* settings = (struct tsreport_settings*)arg;
+    TS_reader_p tsreader = nullptr;
+    int err;
+
+    err = open_file_for_TS_read(input_name, &tsreader);
+    if (err) {
+        fprint_err("### tsreport: Unable to open input file %s for reading TS\n",
+            input_name == nullptr ? "<stdin>" : input_name);
+        return 1;
+    }
+    fprint_msg("Reading from %s\n", (input_name == nullptr ? "<stdin>" : input_name));
+
+    if (settings->max)
+        fprint_msg("Stopping after %d TS packets\n", settings->max);
+
+    if (settings->select_pid)
+        err = report_single_pid(tsreader, settings->max, settings->quiet, settings->just_pid);
+    else if (settings->report_buffering)
+        err = report_buffering_stats(tsreader, settings->req_prog_no, settings->max,
+            settings->verbose, settings->quiet, settings->output_name,
+            settings->continuity_cnt_pid, settings->report_mask);
+    else
+        err = report_ts(tsreader, settings->max, settings->verbose, settings->show_data,
+            settings->report_timing, settings->si_tables);
+    if (err) {
+        print_err("### tsreport: Error reporting on input stream\n");
+        (void)close_TS_reader(&tsreader);
+        return 1;
+    }
+    err = close_TS_reader(&tsreader);
+    return (err ? 1 : 0);
 }
 
 int main(int argc, char** argv)
@@ -1191,14 +1348,14 @@ int main(int argc, char** argv)
     char* input_name = nullptr;
     int had_input_name = false;
 
-    TS_reader_p tsreader = nullptr;
-
     int max = 0; // The maximum number of TS packets to read (or 0)
     int verbose = false; // True => output diagnostic/progress messages
     int quiet = false;
     int report_timing = false;
+    int si_tables = 0;
     int report_buffering = false;
     int show_data = false;
+    int async_output = false;
     char* output_name = nullptr;
     uint32_t continuity_cnt_pid = INVALID_PID;
     int req_prog_no = 1;
@@ -1208,6 +1365,10 @@ int main(int argc, char** argv)
     int select_pid = false;
     uint32_t just_pid = 0;
 
+    char* batch_name = nullptr;
+    struct batch_options batch = { 0, BATCH_DEFAULT_IO_JOBS, 0, false };
+    struct tsreport_settings settings;
+
     int err = 0;
     int ii = 1;
 
@@ -1239,6 +1400,8 @@ int main(int argc, char** argv)
                     return 1;
                 }
                 ii++;
+            } else if (!strcmp("-async", argv[ii])) {
+                async_output = true;
             } else if (!strcmp("-timing", argv[ii]) || !strcmp("-t", argv[ii])) {
                 report_timing = true;
                 quiet = false;
@@ -1259,6 +1422,16 @@ int main(int argc, char** argv)
                 report_buffering = true;
                 quiet = false;
                 ii++;
+            } else if (!strcmp("-si", argv[ii])) {
+                si_tables |= DVB_SI_ALL;
+            } else if (!strcmp("-nit", argv[ii])) {
+                si_tables |= DVB_SI_NIT;
+            } else if (!strcmp("-sdt", argv[ii])) {
+                si_tables |= DVB_SI_SDT;
+            } else if (!strcmp("-eit", argv[ii])) {
+                si_tables |= DVB_SI_EIT;
+            } else if (!strcmp("-tdt", argv[ii])) {
+                si_tables |= DVB_SI_TDT;
             } else if (!strcmp("-data", argv[ii])) {
                 show_data = true;
                 quiet = false;
@@ -1303,6 +1476,24 @@ int main(int argc, char** argv)
                 if (err)
                     return 1;
                 ii++;
+            } else if (!strcmp("-batch", argv[ii])) {
+                CHECKARG("tsreport", ii);
+                batch_name = argv[ii + 1];
+                ii++;
+            } else if (!strcmp("-jobs", argv[ii])) {
+                CHECKARG("tsreport", ii);
+                err = int_value("tsreport", argv[ii], argv[ii + 1], true, 10, &batch.jobs);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-io", argv[ii])) {
+                CHECKARG("tsreport", ii);
+                err = int_value("tsreport", argv[ii], argv[ii + 1], true, 10, &batch.io_jobs);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-unordered", argv[ii])) {
+                batch.unordered = true;
             } else {
                 fprint_err("### tsreport: "
                            "Unrecognised command line switch '%s'\n",
@@ -1321,34 +1512,60 @@ int main(int argc, char** argv)
         ii++;
     }
 
-    if (!had_input_name) {
-        print_err("### tsreport: No input file specified\n");
+    // The SI tables are only reassembled when reporting on the whole stream
+    if (si_tables != 0 && (report_buffering || select_pid)) {
+        print_err("### tsreport: Cannot use -si, -nit, -sdt, -eit or -tdt with -buffering,"
+                  " -cnt or -justpid\n");
         return 1;
     }
 
-    err = open_file_for_TS_read((use_stdin ? nullptr : input_name), &tsreader);
-    if (err) {
-        fprint_err("### tsreport: Unable to open input file %s for reading TS\n",
-            use_stdin ? "<stdin>" : input_name);
-        return 1;
+    settings.max = max;
+    settings.verbose = verbose;
+    settings.quiet = quiet;
+    settings.report_timing = report_timing;
+    settings.si_tables = si_tables;
+    settings.report_buffering = report_buffering;
+    settings.show_data = show_data;
+    settings.output_name = output_name;
+    settings.continuity_cnt_pid = continuity_cnt_pid;
+    settings.req_prog_no = req_prog_no;
+    settings.report_mask = report_mask;
+    settings.select_pid = select_pid;
+    settings.just_pid = just_pid;
+
+    if (batch_name != nullptr) {
+        char** files = nullptr;
+        int num_files = 0;
+        if (had_input_name) {
+            print_err("### tsreport: Cannot specify both an input file and -batch\n");
+            return 1;
+        }
+        if (output_name != nullptr || continuity_cnt_pid != INVALID_PID) {
+            print_err("### tsreport: Cannot use -o or -cnt with -batch\n");
+            return 1;
+        }
+        if (async_output && redirect_output_async()) {
+            print_err("### tsreport: Unable to start background output thread\n");
+            return 1;
+        }
+        err = read_batch_list(batch_name, &files, &num_files);
+        if (err)
+            return 1;
+        batch.prefetch = (offset_t)max * TS_PACKET_SIZE;
+        err = run_batch(files, num_files, &batch, report_file, &settings);
+        free_batch_list(&files, num_files);
+        return (err ? 1 : 0);
     }
-    fprint_msg("Reading from %s\n", (use_stdin ? "<stdin>" : input_name));
 
-    if (max)
-        fprint_msg("Stopping after %d TS packets\n", max);
+    if (!had_input_name) {
+        print_err("### tsreport: No input file specified\n");
+        return 1;
+    }
 
-    if (select_pid)
-        err = report_single_pid(tsreader, max, quiet, just_pid);
-    else if (report_buffering)
-        err = report_buffering_stats(tsreader, req_prog_no, max, verbose, quiet, output_name,
-            continuity_cnt_pid, report_mask);
-    else
-        err = report_ts(tsreader, max, verbose, show_data, report_timing);
-    if (err) {
-        print_err("### tsreport: Error reporting on input stream\n");
-        (void)close_TS_reader(&tsreader);
+    if (async_output && redirect_output_async()) {
+        print_err("### tsreport: Unable to start background output thread\n");
         return 1;
     }
-    err = close_TS_reader(&tsreader);
-    return (err ? 1 : 0);
+
+    return report_file(use_stdin ? nullptr : input_name, &settings);
 }
@@ -0,0 +1,221 @@
+/*
+ * Split a transport stream into segments, each starting at a random access
+ * point in its video, and write an HLS style playlist for them.
+ *
+ * The segments are made by copying the original TS packets, so nothing is
+ * demultiplexed or remultiplexed - each segment just has a PAT and PMT
+ * written at its start.
+ *
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "accessunit.h"
+#include "bitdata.h"
+#include "blockcache.h"
+#include "compat.h"
+#include "compressed.h"
+#include "es.h"
+#include "gop.h"
+#include "h222.h"
+#include "h262.h"
+#include "misc.h"
+#include "nalunit.h"
+#include "pes.h"
+#include "pidint.h"
+#include "printing.h"
+#include "probe.h"
+#include "ps.h"
+#include "reverse.h"
+#include "section.h"
+#include "shmring.h"
+#include "ts.h"
+#include "tssegment.h"
+#include "tswrite.h"
+#include "version.h"
+
+static void print_usage()
+{
+    print_msg("Usage: tssegment [switches] [<infile>]\n"
+              "\n");
+    REPORT_VERSION("tssegment");
+    fprint_msg(
+        "\n"
+        "  Split a Transport Stream into segments, each starting at a random\n"
+        "  access point in its video, and write a (HLS) playlist listing them.\n"
+        "  The segments are copied straight from the input (with a PAT and PMT\n"
+        "  added at the start of each), so the data is not re-multiplexed.\n"
+        "\n"
+        "Files:\n"
+        "  <infile>  is an H.222 Transport Stream file (but see -stdin)\n"
+        "\n"
+        "Switches:\n"
+        "  -err stdout       Write error messages to standard output (the default)\n"
+        "  -err stderr       Write error messages to standard error (Unix traditional)\n"
+        "  -stdin            Input from standard input, instead of a file. Segments\n"
+        "                    are written (and the playlist updated) as the data\n"
+        "                    arrives, so this can be used on a live stream.\n"
+        "  -prefix <name>    Segment files are called <name>NNNNN.ts. The default\n"
+        "                    is '" DEFAULT_SEGMENT_PREFIX "'.\n"
+        "  -playlist <file>  The playlist to write. The default is <name>.m3u8.\n"
+        "                    It refers to the segments without any directory, so\n"
+        "                    should be in the same directory as them.\n"
+        "  -duration <secs>  The target duration of each segment. Segments end at\n"
+        "                    the random access point that makes them closest to\n"
+        "                    this. The default is %.0f seconds.\n"
+        "  -window <n>       Only list the last <n> segments in the playlist (for\n"
+        "                    a live stream). The default is to list them all.\n"
+        "  -prog <n>         Segment program <n>. The default is the first program\n"
+        "                    in the PAT.\n"
+        "  -max <n>, -m <n>  Stop after reading <n> TS packets.\n"
+        "  -quiet, -q        Only output error messages.\n"
+        "  -verbose, -v      Report each random access point found.\n"
+        "\n"
+        "When reading from a file, the segments are copied from it using\n"
+        "copy_file_range, so that (on filesystems that support it) the data need\n"
+        "not pass through this program at all.\n",
+        DEFAULT_SEGMENT_DURATION);
+}
+
+int main(int argc, char** argv)
+{
+    char* input_name = nullptr;
+    int had_input_name = false;
+    int use_stdin = false;
+    int max = 0;
+    int err = 0;
+    int ii = 1;
+    double duration = DEFAULT_SEGMENT_DURATION;
+    struct TS_segmenter seg;
+    TS_reader_p tsreader = nullptr;
+
+    init_TS_segmenter(&seg);
+
+    if (argc < 2) {
+        print_usage();
+        return 0;
+    }
+
+    while (ii < argc) {
+        if (argv[ii][0] == '-') {
+            if (!strcmp("--help", argv[ii]) || !strcmp("-h", argv[ii])
+                || !strcmp("-help", argv[ii])) {
+                print_usage();
+                return 0;
+            } else if (!strcmp("-err", argv[ii])) {
+                CHECKARG("tssegment", ii);
+                if (!strcmp(argv[ii + 1], "stderr"))
+                    redirect_output_stderr();
+                else if (!strcmp(argv[ii + 1], "stdout"))
+                    redirect_output_stdout();
+                else {
+                    fprint_err("### tssegment: "
+                               "Unrecognised option '%s' to -err (not 'stdout' or"
+                               " 'stderr')\n",
+                        argv[ii + 1]);
+                    return 1;
+                }
+                ii++;
+            } else if (!strcmp("-stdin", argv[ii])) {
+                had_input_name = true; // more or less
+                use_stdin = true;
+            } else if (!strcmp("-prefix", argv[ii])) {
+                CHECKARG("tssegment", ii);
+                seg.prefix = argv[ii + 1];
+                ii++;
+            } else if (!strcmp("-playlist", argv[ii])) {
+                CHECKARG("tssegment", ii);
+                seg.playlist = argv[ii + 1];
+                ii++;
+            } else if (!strcmp("-duration", argv[ii])) {
+                CHECKARG("tssegment", ii);
+                err = double_value("tssegment", argv[ii], argv[ii + 1], true, &duration);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-window", argv[ii])) {
+                CHECKARG("tssegment", ii);
+                err = int_value("tssegment", argv[ii], argv[ii + 1], true, 10, &seg.window);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-prog", argv[ii])) {
+                CHECKARG("tssegment", ii);
+                err = int_value_in_range(
+                    "tssegment", argv[ii], argv[ii + 1], 1, 0xFFFF, 0, &seg.want_program);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-max", argv[ii]) || !strcmp("-m", argv[ii])) {
+                CHECKARG("tssegment", ii);
+                err = int_value("tssegment", argv[ii], argv[ii + 1], true, 10, &max);
+                if (err)
+                    return 1;
+                ii++;
+            } else if (!strcmp("-quiet", argv[ii]) || !strcmp("-q", argv[ii])) {
+                seg.quiet = true;
+                seg.verbose = false;
+            } else if (!strcmp("-verbose", argv[ii]) || !strcmp("-v", argv[ii])) {
+                seg.verbose = true;
+                seg.quiet = false;
+            } else {
+                fprint_err("### tssegment: "
+                           "Unrecognised command line switch '%s'\n",
+                    argv[ii]);
+                return 1;
+            }
+        } else {
+            if (had_input_name) {
+                fprint_err("### tssegment: Unexpected '%s'\n", argv[ii]);
+                return 1;
+            } else {
+                input_name = argv[ii];
+                had_input_name = true;
+            }
+        }
+        ii++;
+    }
+
+    if (!had_input_name) {
+        print_err("### tssegment: No input file specified\n");
+        return 1;
+    }
+    if (duration <= 0.0) {
+        print_err("### tssegment: -duration must be more than 0\n");
+        return 1;
+    }
+    seg.target = (int64_t)(duration * 90000.0);
+
+    char playlist[1024];
+    if (seg.playlist == nullptr) {
+        snprintf(playlist, sizeof(playlist), "%s.m3u8", seg.prefix);
+        seg.playlist = playlist;
+    }
+
+    err = open_file_for_TS_read((use_stdin ? nullptr : input_name), &tsreader);
+    if (err) {
+        fprint_err("### tssegment: Unable to open input file %s for reading TS\n",
+            (use_stdin ? "<stdin>" : input_name));
+        return 1;
+    }
+    if (!seg.quiet)
+        fprint_msg("Reading from %s\n", (use_stdin ? "<stdin>" : input_name));
+
+    err = segment_TS(&seg, tsreader, max);
+    if (!err && !seg.quiet)
+        fprint_msg("Wrote %d segment%s, listed in %s\n", seg.num_segments,
+            (seg.num_segments == 1 ? "" : "s"), seg.playlist);
+
+    clear_TS_segmenter(&seg);
+    if (close_TS_reader(&tsreader)) {
+        print_err("### tssegment: Error closing input file\n");
+        return 1;
+    }
+    return err ? 1 : 0;
+}
@@ -31,6 +31,7 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstdint>
 #include <cstring>
 #include <fcntl.h>
 #include <unistd.h>
@@ -39,15 +40,20 @@
 #include <netinet/in.h> // sockaddr_in
 #include <signal.h> // sigaction, etc.
 #include <sys/socket.h>
+#include <sys/stat.h> // fstat
 #include <sys/types.h>
 #include <sys/wait.h> // WNOHANG
 
 #include "accessunit.h"
 #include "bitdata.h"
+#include "blockcache.h"
+#include "codec_traits.h"
 #include "compat.h"
+#include "compressed.h"
 #include "es.h"
 #include "filter.h"
 #include "fmtx.h"
+#include "gop.h"
 #include "h222.h"
 #include "h262.h"
 #include "misc.h"
@@ -55,8 +61,10 @@
 #include "pes.h"
 #include "pidint.h"
 #include "printing.h"
+#include "probe.h"
 #include "ps.h"
 #include "reverse.h"
+#include "shmring.h"
 #include "ts.h"
 #include "tswrite.h"
 #include "version.h"
@@ -79,6 +87,13 @@
 
 static int extra_info = 0;
 
+// In -tsdirect normal play, send TS files straight to the client (with
+// sendfile), rather than reading and writing each TS packet?
+static int send_directly = true;
+// And if we get ahead of the reverse indexer, how many pictures to read (and
+// write) ourselves before seeing if it has caught up
+#define DIRECT_CATCH_UP_PICTURES 25
+
 // What we are to do
 enum ACTION {
     ACTION_SERVER, // The default action is to be a server
@@ -120,326 +135,275 @@ struct tsserve_context {
 
     // Transport Stream specific options
     int tsdirect;
+
+    int background_index; // Build the reverse data ahead of play, in another thread?
 };
 typedef struct tsserve_context* tsserve_context_p;
 
 // ============================================================
-// Unions to give us a single view of the two forms of data stream
+// A single view of the two forms of data stream
 // ============================================================
-// The form of this single view is limited solely to what is needed
-// in this program - it is not intended to be a general unification
-// of the two types of data.
+// The functions that play, filter and reverse a stream are templates over
+// the codec traits types in codec_traits.h. The choice of codec is made once,
+// when a stream is set up (or a command is obeyed for it), and each
+// instantiation then calls the codec's own functions directly, rather than
+// deciding between H.262 and H.264 for every picture.
 
 // Accessing the data stream
-union u_stream_context {
-    h262_context_p h262;
-    access_unit_context_p h264;
-};
-struct _stream_context {
-    int is_h262;
-    int program_number;
-    union u_stream_context u;
+template <typename Codec> struct codec_stream {
+    typename Codec::context_p context; // Our ES data as pictures
+    typename Codec::filter_context_p fcontext; // Filtering, for fast fast forward
+    typename Codec::filter_context_p scontext; // Stripping, for fast forward
 };
-typedef struct _stream_context stream_context;
-typedef struct _stream_context* stream_context_p;
 
-// Filtering
-union u_filter_context {
-    h262_filter_context_p h262;
-    h264_filter_context_p h264;
-};
-struct _filter_context {
+// An input file, whichever codec its video stream uses
+struct input_stream {
     int is_h262;
-    union u_filter_context u;
+    codec_stream<h262_traits> h262;
+    codec_stream<h264_traits> h264;
 };
-typedef struct _filter_context filter_context;
-typedef struct _filter_context* filter_context_p;
-
-// Pictures
-union u_picture {
-    int is_h262;
-    h262_picture_p h262;
-    access_unit_p h264;
-};
-
-struct _picture {
-    int is_h262;
-    union u_picture u;
-    int type; // For H.262, the picture coding type. 0xFF means seq hdr
-};
-typedef struct _picture picture;
-typedef struct _picture* picture_p;
-
-// ============================================================
-// Utilities to hide the difference between the two data stream types
-// ============================================================
-
-// A macro to avoid my mistyping this on the several occasions I need it
-#define EXTRACT_ES_FROM_STREAM(stream)                                                            \
-    ((stream).is_h262 ? (stream).u.h262->es : (stream).u.h264->nac->es)
-
-// A related macro for reverse data
-#define EXTRACT_REVERSE_FROM_STREAM(stream)                                                       \
-    ((stream).is_h262 ? (stream).u.h262->reverse_data : (stream).u.h264->reverse_data)
 
 /*
- * Note that `program_number` should be 1 or more.
+ * Build the picture reading and filtering contexts for a stream, and the
+ * reverse data that remembers its pictures.
+ *
+ * Returns 0 if all went well, 1 if something went wrong.
  */
-static int build_stream(ES_p es, int is_h262, int program_number, stream_context* stream)
+template <typename Codec>
+static int build_codec_stream(ES_p es, int ffrequency, int with_seq_hdrs,
+    codec_stream<Codec>* stream, reverse_data_p* reverse_data)
 {
     int err;
-    stream->is_h262 = is_h262;
-    stream->program_number = program_number;
-    if (is_h262) {
-        err = build_h262_context(es, &(stream->u.h262));
-        if (err) {
-            print_err("### Error building H.262 context\n");
-            return 1;
-        }
-    } else {
-        err = build_access_unit_context(es, &(stream->u.h264));
-        if (err) {
-            print_err("### Error building H.264 access unit context\n");
-            return 1;
-        }
-    }
-    return 0;
-}
 
-static void close_stream(stream_context stream)
-{
-    if (stream.is_h262)
-        free_h262_context(&(stream.u.h262));
-    else
-        free_access_unit_context(&(stream.u.h264));
-}
+    err = Codec::build_context(es, &stream->context);
+    if (err) {
+        fprint_err("### Error building %s context\n", Codec::name);
+        return 1;
+    }
 
-static int build_and_attach_reverse(stream_context stream, reverse_data_p* reverse_data)
-{
-    int err;
-    err = build_reverse_data(reverse_data, !stream.is_h262);
+    err = build_reverse_data(reverse_data, !Codec::has_sequence_headers);
     if (err) {
         print_err("### Unable to build reverse memory\n");
         return 1;
     }
+    Codec::add_reverse_context(stream->context, *reverse_data);
 
-    if (stream.is_h262)
-        add_h262_reverse_context(stream.u.h262, *reverse_data);
-    else
-        add_access_unit_reverse_context(stream.u.h264, *reverse_data);
-
-    return 0;
-}
+    if (!with_seq_hdrs)
+        (*reverse_data)->output_sequence_headers = false;
 
-static int build_filter_context(
-    stream_context stream, int is_strip, int frequency, filter_context* fcontext)
-{
-    int err;
-    fcontext->is_h262 = stream.is_h262;
-    if (stream.is_h262) {
-        if (is_strip)
-            err = build_h262_filter_context_strip(&(fcontext->u.h262), stream.u.h262, true);
-        else
-            err = build_h262_filter_context(&(fcontext->u.h262), stream.u.h262, frequency);
-    } else {
-        if (is_strip)
-            err = build_h264_filter_context_strip(&(fcontext->u.h264), stream.u.h264, true);
-        else
-            err = build_h264_filter_context(&(fcontext->u.h264), stream.u.h264, frequency);
+    err = Codec::build_filter_context(&stream->fcontext, stream->context, false, ffrequency);
+    if (err) {
+        print_err("### Unable to build filter context\n");
+        return 1;
     }
-    return err;
-}
 
-static void free_filter_context(filter_context fcontext)
-{
-    if (fcontext.is_h262)
-        free_h262_filter_context(&(fcontext.u.h262));
-    else
-        free_h264_filter_context(&(fcontext.u.h264));
+    err = Codec::build_filter_context(&stream->scontext, stream->context, true, 0);
+    if (err) {
+        print_err("### Unable to build strip context\n");
+        return 1;
+    }
+    return 0;
 }
 
 /*
- * "Reset" a stream, such that the picture reading contexts do not contain
- * any past memory.
+ * Free the contexts built by `build_codec_stream`. Any that were not built
+ * are expected to be nullptr.
  */
-static inline void reset_stream(stream_context stream)
+template <typename Codec> static void free_codec_stream(codec_stream<Codec>* stream)
 {
-    if (stream.is_h262) {
-        if (stream.u.h262->last_item)
-            free_h262_item(&stream.u.h262->last_item);
-    } else {
-        reset_access_unit_context(stream.u.h264);
-    }
+    Codec::free_filter_context(&stream->fcontext);
+    Codec::free_filter_context(&stream->scontext);
+    Codec::free_context(&stream->context);
 }
 
 /*
- * Retrieve the next picture. Doesn't distinguish H.262 sequence headers
- * and pictures.
+ * Write a picture (or H.262 sequence header) out as TS
  */
-static inline int get_next_picture(stream_context stream, int verbose, int quiet, picture* pic)
-{
-    int err;
-    if (stream.is_h262) {
-        h262_picture_p picture;
-        err = get_next_h262_frame(stream.u.h262, verbose, quiet, &picture);
-        if (err)
-            return err;
-        pic->is_h262 = true;
-        pic->u.h262 = picture;
-        if (picture->is_picture)
-            pic->type = picture->picture_coding_type;
-        else
-            pic->type = 0xff;
-    } else {
-        access_unit_p unit;
-        err = get_next_h264_frame(stream.u.h264, quiet, verbose, &unit);
-        if (err)
-            return err;
-        pic->is_h262 = false;
-        pic->u.h264 = unit;
-    }
-    return 0;
-}
-
-static inline void free_picture(picture* pic)
+template <typename Codec>
+static inline int write_picture_as_TS(
+    codec_stream<Codec> stream, TS_writer_p output, typename Codec::picture_p picture)
 {
-    if (pic->is_h262)
-        free_h262_picture(&pic->u.h262);
-    else
-        free_access_unit(&pic->u.h264);
-    pic->type = 0;
+    ES_p es = Codec::es(stream.context);
+    return Codec::write_picture_as_TS(
+        stream.context, output, picture, es->reader->output_video_pid);
 }
-
+// ============================================================
+// A common view of handling the two types of data stream
+// ============================================================
 /*
- * Needs to be told if the picture is H.262 or not, because this may be
- * called on an unused instance of the picture data structure.
+ * Can we play at normal speed by sending the input file straight to the
+ * client (with sendfile), rather than reading and writing each TS packet?
+ *
+ * That needs TS packets being copied to the client unchanged (-tsdirect),
+ * from a plain file of 188 byte TS packets, to TCP/IP output, and a reverse
+ * indexer to tell us where the pictures are in what we did not read.
  */
-static inline void unset_picture(int is_h262, picture* pic)
-{
-    if (is_h262)
-        pic->u.h262 = nullptr;
-    else
-        pic->u.h264 = nullptr;
-    pic->is_h262 = is_h262;
-}
-
-static inline int is_null_picture(picture pic)
+static int can_send_directly(
+    PES_reader_p reader, TS_writer_p output, int tsdirect, reverse_data_p reverse_data)
 {
-    if (pic.is_h262)
-        return pic.u.h262 == nullptr;
-    else
-        return pic.u.h264 == nullptr;
+    TS_reader_p tsreader = reader->tsreader;
+    struct stat stats;
+
+    if (!send_directly || !tsdirect || !reader->is_TS || reverse_data->indexer == nullptr)
+        return false;
+    if (output->how != TS_W_TCP || output->writer != nullptr || output->drop_packets)
+        return false;
+    if (tsreader->read_fn != nullptr || tsreader->packet_size != TS_PACKET_SIZE)
+        return false;
+    if (is_compressed_file(tsreader->file) || is_shm_file(tsreader->file))
+        return false;
+    return (fstat(tsreader->file, &stats) == 0 && S_ISREG(stats.st_mode));
 }
 
-// NB: there is already a macro called "is_seq_header"
-static inline int is_non_frame(picture pic) { return (pic.is_h262 && pic.type == 0xff); }
-
-static inline int is_reference_picture(picture pic)
-{
-    if (pic.is_h262)
-        return (pic.type == 1 || pic.type == 2);
-    else
-        return (pic.u.h264->primary_start != nullptr && pic.u.h264->primary_start->nal_ref_idc != 0);
-}
-
-static inline int is_I_or_IDR_picture(picture pic)
+/*
+ * Find the reverse data entry to catch up from, after sending the input
+ * file directly up to `posn`: the last I picture (or IDR) that we can start
+ * reading from at or before `posn`. For H.262, we start reading at the
+ * sequence header just before it, so only pictures that have one count.
+ *
+ * Returns the entry for the picture, or -1 if there is no such entry.
+ */
+template <typename Codec>
+static int32_t find_catch_up_entry(reverse_data_p reverse_data, offset_t posn)
 {
-    if (pic.is_h262)
-        return (pic.type == 1);
-    else
-        return (pic.u.h264->primary_start != nullptr && pic.u.h264->primary_start->nal_ref_idc != 0
-            && (pic.u.h264->primary_start->nal_unit_type == NAL_IDR || all_slices_I(pic.u.h264)));
+    int32_t ii;
+    for (ii = reverse_data->length - 1; ii >= 0; ii--) {
+        if constexpr (Codec::has_sequence_headers) {
+            if (reverse_data->seq_offset[ii] == 1 && reverse_data->start_file[ii - 1] <= posn)
+                return ii;
+        } else if (reverse_data->start_file[ii] <= posn)
+            return ii;
+    }
+    return -1;
 }
 
-static void print_picture(picture pic)
+/*
+ * After sending the input file directly to the client up to `posn`, go back
+ * to the last suitable I picture, and read forwards from it to `posn`
+ * (without writing out what has already been sent), so that we end up just
+ * as if we had read and written all the packets up to there.
+ *
+ * Returns 0 if all went well, EOF if the end of file is reached,
+ * otherwise 1 if an error occurred.
+ */
+template <typename Codec>
+static int catch_up_after_sending(
+    codec_stream<Codec> stream, reverse_data_p reverse_data, offset_t posn, int verbose, int quiet)
 {
-    if (pic.is_h262) {
-        if (pic.type == 0xff)
-            print_msg("sequence header");
-        else
-            fprint_msg("%s picture", H262_PICTURE_CODING_STR(pic.type));
+    int err;
+    ES_p es = Codec::es(stream.context);
+    PES_reader_p reader = es->reader;
+    int32_t which = find_catch_up_entry<Codec>(reverse_data, posn);
+    int32_t start = (Codec::has_sequence_headers && which >= 0 ? which - 1 : which);
+    int found_picture = false;
+
+    // (going back reads the first PES packet, so this must be done first)
+    resume_server_output_at(reader, posn);
+    if (which < 0) {
+        // There's nothing to go back to, so we'll have to read it all again
+        if (extra_info)
+            fprint_msg(".. catching up with " OFFSET_T_FORMAT " from the start\n", posn);
+        err = Codec::rewind(stream.context);
     } else {
-        if (pic.u.h264->primary_start == nullptr)
-            print_msg("<null>");
-        else
-            fprint_msg("idc %d/type %d (%s)", pic.u.h264->primary_start->nal_ref_idc,
-                pic.u.h264->primary_start->nal_unit_type,
-                NAL_UNIT_TYPE_STR(pic.u.h264->primary_start->nal_unit_type));
+        ES_offset where = { reverse_data->start_file[start], reverse_data->start_pkt[start] };
+        if (extra_info)
+            fprint_msg(".. catching up with " OFFSET_T_FORMAT " from reverse data entry %d at "
+                       OFFSET_T_FORMAT "/%d\n",
+                posn, start, where.infile, where.inpacket);
+        err = Codec::seek(stream.context, where);
+        // As we read forwards, we re-remember the entries from here on
+        reverse_data->last_posn_added = start - 1;
+    }
+    if (err) {
+        resume_server_output_at(reader, 0);
+        print_err("### Error going back to catch up after sending data directly\n");
+        return 1;
     }
-}
-
-static inline int write_picture_as_TS(stream_context stream, TS_writer_p output, picture pic)
-{
-    ES_p es = EXTRACT_ES_FROM_STREAM(stream);
-    if (stream.is_h262)
-        return write_h262_picture_as_TS(output, pic.u.h262, es->reader->output_video_pid);
-    else
-        return write_access_unit_as_TS(
-            pic.u.h264, stream.u.h264, output, es->reader->output_video_pid);
-}
 
-static inline void reset_filter_context(filter_context fcontext, int frequency)
-{
-    if (fcontext.is_h262) {
-        reset_h262_filter_context(fcontext.u.h262);
-        fcontext.u.h262->freq = frequency;
-    } else {
-        reset_h264_filter_context(fcontext.u.h264);
-        fcontext.u.h264->freq = frequency;
+    while (reader->tsreader->posn < posn) {
+        typename Codec::picture_p picture;
+        err = Codec::get_next_picture(stream.context, verbose, quiet, &picture);
+        if (err)
+            break;
+        // Reading a picture again doesn't change its index, so the first one
+        // (our I picture) needs to be told which it is
+        if (which >= 0 && !found_picture && Codec::is_I_or_IDR_picture(picture)) {
+            Codec::set_picture_index(stream.context, reverse_data->index[which]);
+            found_picture = true;
+        }
+        Codec::free_picture(&picture);
     }
+    resume_server_output_at(reader, 0);
+    if (err && err != EOF)
+        print_err("### Error catching up after sending data directly\n");
+    return err;
 }
 
-static inline int get_next_stripped(filter_context fcontext, int verbose, int quiet,
-    picture* seq_hdr, picture* this_picture, int* delta_pictures_seen)
+/*
+ * Play at normal speed by sending the input file straight to the client,
+ * only reading it ourselves (to find out where the pictures are) when the
+ * command changes, or when we get ahead of the reverse indexer.
+ *
+ * Returns 0 if all went well, EOF if the end of file is reached,
+ * otherwise 1 if an error occurred.
+ *
+ * If command input is enabled, then it can also return COMMAND_RETURN_CODE
+ * if the current command has changed.
+ */
+template <typename Codec>
+static int play_normal_directly(codec_stream<Codec> stream, TS_writer_p output, int verbose,
+    int quiet, reverse_data_p reverse_data)
 {
     int err;
+    ES_p es = Codec::es(stream.context);
+    PES_reader_p reader = es->reader;
 
-    unset_picture(fcontext.is_h262, seq_hdr);
-    unset_picture(fcontext.is_h262, this_picture);
+    if (extra_info)
+        print_msg(".. sending TS data directly\n");
 
-    if (fcontext.is_h262) {
-        h262_picture_p _this_picture = nullptr;
-        h262_picture_p _seq_hdr = nullptr;
-        err = get_next_stripped_h262_frame(
-            fcontext.u.h262, verbose, quiet, &_seq_hdr, &_this_picture, delta_pictures_seen);
-        seq_hdr->u.h262 = _seq_hdr;
-        this_picture->u.h262 = _this_picture;
-    } else {
-        access_unit_p this_unit = nullptr;
-        err = get_next_stripped_h264_frame(
-            fcontext.u.h264, verbose, quiet, &this_unit, delta_pictures_seen);
-        this_picture->u.h264 = this_unit;
-    }
-    return err;
-}
+    for (;;) {
+        offset_t posn = reader->tsreader->posn;
+        offset_t limit = -1; // No limit - send to the end of the file
+        int catch_err;
 
-static inline int get_next_filtered(filter_context fcontext, int verbose, int quiet,
-    picture* seq_hdr, picture* this_picture, int* delta_pictures_seen)
-{
-    int err;
+        if (tswrite_command_changed(output))
+            return COMMAND_RETURN_CODE;
 
-    unset_picture(fcontext.is_h262, seq_hdr);
-    unset_picture(fcontext.is_h262, this_picture);
+        err = update_from_reverse_indexer(reverse_data);
+        if (err)
+            return 1;
 
-    if (fcontext.is_h262) {
-        h262_picture_p _this_picture = nullptr;
-        h262_picture_p _seq_hdr = nullptr;
-        err = get_next_filtered_h262_frame(
-            fcontext.u.h262, verbose, quiet, &_seq_hdr, &_this_picture, delta_pictures_seen);
-        seq_hdr->u.h262 = _seq_hdr;
-        this_picture->u.h262 = _this_picture;
-    } else {
-        access_unit_p this_unit = nullptr;
-        err = get_next_filtered_h264_frame(
-            fcontext.u.h264, verbose, quiet, &this_unit, delta_pictures_seen);
-        this_picture->u.h264 = this_unit;
+        // We can send as far as the last picture the indexer has found
+        // (everything, if it has finished), since we can catch up from there
+        if (!reverse_data->indexer->finished.load(std::memory_order_acquire)
+            && reverse_data->length > 0)
+            limit = reverse_data->start_file[reverse_data->length - 1];
+        if (reverse_data->length == 0 || (limit != -1 && limit <= posn)) {
+            // The indexer is not ahead of us (yet), so read some pictures
+            // ourselves, writing them out as usual
+            err = Codec::collect_reverse(stream.context, DIRECT_CATCH_UP_PICTURES, verbose, quiet);
+            if (err)
+                return err;
+            continue;
+        }
+
+        err = tswrite_send_file_range(
+            output, reader->tsreader->file, &posn, (limit == -1 ? INT64_MAX : limit - posn));
+        if (err == 1) {
+            print_err("### Error sending TS data directly\n");
+            return 1;
+        }
+        if (extra_info)
+            fprint_msg(".. sent TS data directly up to " OFFSET_T_FORMAT "\n", posn);
+
+        catch_err = catch_up_after_sending(stream, reverse_data, posn, verbose, quiet);
+        if (catch_err)
+            return catch_err;
+        if (err)
+            return err;
     }
-    return err;
 }
 
-// ============================================================
-// A common view of handling the two types of data stream
-// ============================================================
 /*
  * Playing at normal speed happens as a "side effect" of gathering
  * information to allow us to reverse. Basically, each time a PES packet
@@ -452,11 +416,12 @@ static inline int get_next_filtered(filter_context fcontext, int verbose, int qu
  * If command input is enabled, then it can also return COMMAND_RETURN_CODE
  * if the current command has changed.
  */
-static int play_normal(stream_context stream, TS_writer_p output, int verbose, int quiet,
+template <typename Codec>
+static int play_normal(codec_stream<Codec> stream, TS_writer_p output, int verbose, int quiet,
     int num_normal, int tsdirect, reverse_data_p reverse_data)
 {
     int err;
-    ES_p es = EXTRACT_ES_FROM_STREAM(stream);
+    ES_p es = Codec::es(stream.context);
     PES_reader_p reader = es->reader;
 
     if (extra_info)
@@ -473,15 +438,12 @@ static int play_normal(stream_context stream, TS_writer_p output, int verbose, i
 
     start_server_output(reader);
 
-    if (stream.is_h262) {
-        err = collect_reverse_h262(stream.u.h262, num_normal, verbose, quiet);
-        if (err)
-            return err;
-    } else {
-        err = collect_reverse_access_units(stream.u.h264, num_normal, verbose, quiet);
-        if (err)
-            return err;
-    }
+    if (num_normal == 0 && can_send_directly(reader, output, tsdirect, reverse_data))
+        return play_normal_directly(stream, output, verbose, quiet, reverse_data);
+
+    err = Codec::collect_reverse(stream.context, num_normal, verbose, quiet);
+    if (err)
+        return err;
     return 0;
 }
 
@@ -496,11 +458,14 @@ static int play_normal(stream_context stream, TS_writer_p output, int verbose, i
  * If command input is enabled, then it can also return COMMAND_RETURN_CODE
  * if the current command has changed.
  */
-static int flush_after_normal(stream_context stream, TS_writer_p output, int verbose, int quiet)
+template <typename Codec>
+static int flush_after_normal(
+    codec_stream<Codec> stream, TS_writer_p output, int verbose, int quiet)
 {
     int err;
-    ES_p es = EXTRACT_ES_FROM_STREAM(stream);
+    ES_p es = Codec::es(stream.context);
     PES_reader_p reader = es->reader;
+    ES_unit_p next_unit;
     ES_offset item_start;
 
     if (extra_info)
@@ -530,25 +495,20 @@ static int flush_after_normal(stream_context stream, TS_writer_p output, int ver
     // need to output the ES data from this PES packet up to the end of the
     // current picture.
 
-    if (stream.is_h262) {
-        if (stream.u.h262->last_item == nullptr) {
+    next_unit = Codec::next_unit(stream.context);
+    if (next_unit == nullptr) {
+        if (Codec::picture_ends_at_next_item) {
             if (extra_info)
-                print_msg(".. no H.262 last item\n");
+                fprint_msg(".. no %s last item\n", Codec::name);
             return 0; // not much else we can do
         }
+        // We ended the previous access unit for some reason that didn't
+        // need to read the next NAL unit, or we've not read anything in yet
+        item_start = es->posn_of_next_byte;
+    } else {
         // The ES item that comes after (and thus marks the end of) the
         // last picture *starts* at:
-        item_start = stream.u.h262->last_item->unit.start_posn;
-    } else {
-        if (stream.u.h264->pending_nal == nullptr) {
-            // We ended the previous access unit for some reason that didn't
-            // need to read the next NAL unit, or we've not read anything in yet
-            item_start = es->posn_of_next_byte;
-        } else {
-            // The previous access unit was ended by this "pending" NAL unit,
-            // so the "next" item presumably starts with that...
-            item_start = stream.u.h264->pending_nal->unit.start_posn;
-        }
+        item_start = next_unit->start_posn;
     }
 
     if (extra_info)
@@ -561,12 +521,12 @@ static int flush_after_normal(stream_context stream, TS_writer_p output, int ver
         // The terminating item started in the previous packet, which we've
         // already output. We should read in the next picture, and output
         // that part of it which hasn't already been output.
-        picture picture;
+        typename Codec::picture_p picture;
         if (extra_info)
             print_msg(".. which is in the previous packet - "
                       "reading spanning picture into next packet\n");
 
-        err = get_next_picture(stream, verbose, quiet, &picture);
+        err = Codec::get_next_picture(stream.context, verbose, quiet, &picture);
         if (err == EOF) {
             // Clearly there is no next picture
             if (extra_info)
@@ -577,18 +537,15 @@ static int flush_after_normal(stream_context stream, TS_writer_p output, int ver
                       " flushing after normal play\n");
             return 1;
         }
-        free_picture(&picture);
+        Codec::free_picture(&picture);
         // We now know that we want to output from the current PES packet to the
         // end of this picture, which is one byte before the new terminating
         // item
-        if (stream.is_h262)
-            item_start = stream.u.h262->last_item->unit.start_posn;
-        else {
-            if (stream.u.h264->pending_nal == nullptr)
-                item_start = es->posn_of_next_byte;
-            else
-                item_start = stream.u.h264->pending_nal->unit.start_posn;
-        }
+        next_unit = Codec::next_unit(stream.context);
+        if (next_unit == nullptr)
+            item_start = es->posn_of_next_byte;
+        else
+            item_start = next_unit->start_posn;
         if (extra_info)
             fprint_msg(".. new last item starts at " OFFSET_T_FORMAT "/%d\n", item_start.infile,
                 item_start.inpacket);
@@ -625,17 +582,18 @@ static int flush_after_normal(stream_context stream, TS_writer_p output, int ver
  * Returns 0 if all went well, EOF if the end of file is reached,
  * otherwise 1 if an error occurred.
  */
+template <typename Codec>
 static int output_next_reference_picture(
-    stream_context stream, TS_writer_p output, int verbose, int quiet, int I_only)
+    codec_stream<Codec> stream, TS_writer_p output, int verbose, int quiet, int I_only)
 {
     int err;
-    picture picture;
+    typename Codec::picture_p picture;
 
     if (extra_info)
         print_msg(".. outputting next reference picture\n");
 
     for (;;) {
-        err = get_next_picture(stream, verbose, quiet, &picture);
+        err = Codec::get_next_picture(stream.context, verbose, quiet, &picture);
         if (err == EOF) {
             // Clearly there is no next picture - so we can't output it
             if (extra_info)
@@ -648,11 +606,11 @@ static int output_next_reference_picture(
 
         if (extra_info) {
             print_msg(".. read next picture: ");
-            print_picture(picture);
+            Codec::print_picture(picture);
             print_msg("\n");
         }
 
-        if (is_non_frame(picture)) {
+        if (Codec::is_non_frame(picture)) {
             // A sequence header doesn't help us directly, but we can output
             // it as it will in practise be followed by an I picture
             // A sequence end will be followed by a sequence header, so we can
@@ -662,16 +620,16 @@ static int output_next_reference_picture(
             err = write_picture_as_TS(stream, output, picture);
             if (err) {
                 print_err("### Error writing out picture list\n");
-                free_picture(&picture);
+                Codec::free_picture(&picture);
                 return 1;
             }
-        } else if ((I_only && is_I_or_IDR_picture(picture))
-            || (!I_only && is_reference_picture(picture))) {
+        } else if ((I_only && Codec::is_I_or_IDR_picture(picture))
+            || (!I_only && Codec::is_reference_picture(picture))) {
             if (extra_info)
                 print_msg(".. picture acceptable\n");
             break;
         }
-        free_picture(&picture);
+        Codec::free_picture(&picture);
     }
     // So we've got something sensible to continue with
     // - don't forget to write it out!
@@ -680,10 +638,10 @@ static int output_next_reference_picture(
     err = write_picture_as_TS(stream, output, picture);
     if (err) {
         print_err("### Error writing out picture list\n");
-        free_picture(&picture);
+        Codec::free_picture(&picture);
         return 1;
     }
-    free_picture(&picture);
+    Codec::free_picture(&picture);
     return 0;
 }
 
@@ -698,10 +656,12 @@ static int output_next_reference_picture(
  * If command input is enabled, then it can also return COMMAND_RETURN_CODE
  * if the current command has changed.
  */
-static int resync_after_reverse(stream_context stream, TS_writer_p output, int verbose, int quiet)
+template <typename Codec>
+static int resync_after_reverse(
+    codec_stream<Codec> stream, TS_writer_p output, int verbose, int quiet)
 {
     int err;
-    ES_p es = EXTRACT_ES_FROM_STREAM(stream);
+    ES_p es = Codec::es(stream.context);
 
     if (extra_info)
         print_msg("\nResynchronising PES packets after reverse\n");
@@ -714,7 +674,7 @@ static int resync_after_reverse(stream_context stream, TS_writer_p output, int v
     // (end of the) last picture output by the normal mechanisms
 
     // Undo any memory of previous pictures/context
-    reset_stream(stream);
+    Codec::reset(stream.context);
 
     if (extra_info)
         fprint_msg("   triple byte = %02x,%02x,%02x, next byte to be from " OFFSET_T_FORMAT
@@ -732,7 +692,7 @@ static int resync_after_reverse(stream_context stream, TS_writer_p output, int v
 
     // @@@ Even for H.264, it may be safer to output another reference picture,
     //     and it does help get the internal datastructures back in synch.
-    // if (!stream.is_h262)
+    // if (!Codec::has_sequence_headers)
     //  return 0;
 
     // However, if it's H.262 data, we know we've just output a reference
@@ -761,14 +721,14 @@ static int resync_after_reverse(stream_context stream, TS_writer_p output, int v
  * If command input is enabled, then it can also return COMMAND_RETURN_CODE
  * if the current command has changed.
  */
-static int rewind_stream(stream_context stream)
+static int rewind_stream(input_stream stream)
 {
     if (extra_info)
         print_msg("\nRewinding\n");
     if (stream.is_h262)
-        return rewind_h262_context(stream.u.h262);
+        return h262_traits::rewind(stream.h262.context);
     else
-        return rewind_access_unit_context(stream.u.h264);
+        return h264_traits::rewind(stream.h264.context);
 }
 
 /*
@@ -782,7 +742,9 @@ static int rewind_stream(stream_context stream)
  * If command input is enabled, then it can also return COMMAND_RETURN_CODE
  * if the current command has changed.
  */
-static int resync_after_filter(stream_context stream, TS_writer_p output, int verbose, int quiet)
+template <typename Codec>
+static int resync_after_filter(
+    codec_stream<Codec> stream, TS_writer_p output, int verbose, int quiet)
 {
     int err;
 
@@ -837,11 +799,13 @@ static int resync_after_filter(stream_context stream, TS_writer_p output, int ve
  * If command input is enabled, then it can also return COMMAND_RETURN_CODE
  * if the current command has changed.
  */
-static int back_to_normal(stream_context stream, TS_writer_p output, int tsdirect)
+template <typename Codec>
+static int back_to_normal(codec_stream<Codec> stream, TS_writer_p output, int tsdirect)
 {
     int err;
-    ES_p es = EXTRACT_ES_FROM_STREAM(stream);
+    ES_p es = Codec::es(stream.context);
     PES_reader_p reader = es->reader;
+    ES_unit_p next_unit = Codec::next_unit(stream.context);
     ES_offset item_start;
 
     if (extra_info)
@@ -880,52 +844,32 @@ static int back_to_normal(stream_context stream, TS_writer_p output, int tsdirec
     // item (since reversing just outputs uninterpreted chunks of data).  We do,
     // however, still know the first byte of the next piece of information after
     // that chunk of data, and that should be enough.
-    if (stream.is_h262) {
-        if (stream.u.h262->last_item == nullptr) {
-            if (extra_info)
-                print_msg(".. no H.262 last item, presumably been"
-                          " reversing\n");
-            item_start = es->posn_of_next_byte;
-            // In which case, we've already output the data for our "last" item
-            // and only some of the following cases can occur...
-        } else {
-            // The ES item that comes after (and thus marks the end of) the last
-            // picture *starts* at:
-            item_start = stream.u.h262->last_item->unit.start_posn;
-        }
+    if (next_unit == nullptr) {
+        // Either we've been reversing, or (for H.264) we ended the previous
+        // access unit for some reason that didn't need to read the next NAL
+        // unit (or we just started and there was no previous access unit)
+        if (extra_info && Codec::picture_ends_at_next_item)
+            fprint_msg(".. no %s last item, presumably been"
+                       " reversing\n",
+                Codec::name);
+        item_start = es->posn_of_next_byte;
+        // In which case, we've already output the data for our "last" item
+        // and only some of the following cases can occur...
     } else {
-        if (stream.u.h264->pending_nal == nullptr) {
-            // Either we ended the previous access unit for some reason that
-            // didn't need to read the next NAL unit, or we've been reversing
-            // (or we just started and there was no previous access unit)
-            item_start = es->posn_of_next_byte;
-        } else {
-            // The previous access unit was ended by this "pending" NAL unit,
-            // so the "next" item presumably starts with that...
-            item_start = stream.u.h264->pending_nal->unit.start_posn;
-        }
+        // The ES item that comes after (and thus marks the end of) the last
+        // picture (or, for H.264, the "pending" NAL unit that ended the
+        // previous access unit) *starts* at:
+        item_start = next_unit->start_posn;
     }
 
     if (extra_info) {
         fprint_msg(".. posn_of_next_byte is " OFFSET_T_FORMAT "/%d\n",
             es->posn_of_next_byte.infile, es->posn_of_next_byte.inpacket);
 
-        if (stream.is_h262) {
-            if (stream.u.h262->last_item) {
-                fprint_msg("   last item starts at " OFFSET_T_FORMAT "/%d,\n",
-                    stream.u.h262->last_item->unit.start_posn.infile,
-                    stream.u.h262->last_item->unit.start_posn.inpacket);
-                print_data(true, "   last item", stream.u.h262->last_item->unit.data,
-                    stream.u.h262->last_item->unit.data_len, 20);
-            }
-        } else {
-            if (stream.u.h264->pending_nal) {
-                fprint_msg("   last item starts at " OFFSET_T_FORMAT "/%d,\n",
-                    stream.u.h264->pending_nal->unit.start_posn.infile,
-                    stream.u.h264->pending_nal->unit.start_posn.inpacket);
-                print_data(true, "   pending NAL unit", stream.u.h264->pending_nal->unit.data,
-                    stream.u.h264->pending_nal->unit.data_len, 20);
-            }
+        if (next_unit) {
+            fprint_msg("   last item starts at " OFFSET_T_FORMAT "/%d,\n",
+                next_unit->start_posn.infile, next_unit->start_posn.inpacket);
+            print_data(true, "   last item", next_unit->data, next_unit->data_len, 20);
         }
         fprint_msg(".. i.e., last item starts at " OFFSET_T_FORMAT "/%d\n", item_start.infile,
             item_start.inpacket);
@@ -944,27 +888,15 @@ static int back_to_normal(stream_context stream, TS_writer_p output, int tsdirec
         // (sanity check - if the next byte to read was 1, then we've read one
         // byte from the current packet, and the following should indeed be right
         // - look at pes.c:read_PES_ES_byte and es.c:next_triple_byte for details)
-        int32_t length_wanted;
-
-        if (stream.is_h262) {
-            length_wanted = stream.u.h262->last_item->unit.data_len - curposn;
-            if (extra_info)
-                fprint_msg(".. next byte is %d, so length wanted is %d"
-                           " - outputting it\n",
-                    curposn, length_wanted);
-            err = write_ES_as_TS_PES_packet(output, stream.u.h262->last_item->unit.data,
-                length_wanted, reader->output_video_pid, DEFAULT_VIDEO_STREAM_ID);
-        } else {
-            // @@@ For H.264, do we know, when we get here, that we always
-            // have a pending NAL unit?
-            length_wanted = stream.u.h264->pending_nal->unit.data_len - curposn;
-            if (extra_info)
-                fprint_msg(".. next byte is %d, so length wanted is %d"
-                           " - outputting it\n",
-                    curposn, length_wanted);
-            err = write_ES_as_TS_PES_packet(output, stream.u.h264->pending_nal->unit.data,
-                length_wanted, reader->output_video_pid, DEFAULT_VIDEO_STREAM_ID);
-        }
+        // @@@ For H.264, do we know, when we get here, that we always
+        // have a pending NAL unit?
+        int32_t length_wanted = next_unit->data_len - curposn;
+        if (extra_info)
+            fprint_msg(".. next byte is %d, so length wanted is %d"
+                       " - outputting it\n",
+                curposn, length_wanted);
+        err = write_ES_as_TS_PES_packet(output, next_unit->data, length_wanted,
+            reader->output_video_pid, DEFAULT_VIDEO_STREAM_ID);
         if (err) {
             print_err("### Error flushing (start of) last item after fast forward\n");
             return 1;
@@ -1012,11 +944,12 @@ static int back_to_normal(stream_context stream, TS_writer_p output, int tsdirec
  * If command input is enabled, then it can also return COMMAND_RETURN_CODE
  * if the current command has changed.
  */
-static int play_stripped(stream_context stream, filter_context fcontext, TS_writer_p output,
-    int verbose, int quiet, int tsdirect, int num_fast, int with_seq_hdrs)
+template <typename Codec>
+static int play_stripped(codec_stream<Codec> stream, TS_writer_p output, int verbose, int quiet,
+    int tsdirect, int num_fast, int with_seq_hdrs)
 {
     int err;
-    ES_p es = EXTRACT_ES_FROM_STREAM(stream);
+    ES_p es = Codec::es(stream.context);
     PES_reader_p reader = es->reader;
     int total_pictures = 0;
 
@@ -1024,7 +957,7 @@ static int play_stripped(stream_context stream, filter_context fcontext, TS_writ
 
     // And then reset our filter context so that we start filtering without
     // remembering anything about last time we filtered
-    reset_filter_context(fcontext, 0);
+    Codec::reset_filter_context(stream.scontext, 0);
 
     if (!tsdirect) {
         // Ensure we've got program data available (probably not necessary,
@@ -1038,36 +971,36 @@ static int play_stripped(stream_context stream, filter_context fcontext, TS_writ
         print_msg("Fast forwarding (strip)\n");
 
     for (;;) {
-        picture this_picture;
-        picture seq_hdr; // H.262 only - *we* mustn't free this one
+        typename Codec::picture_p this_picture = nullptr;
+        typename Codec::picture_p seq_hdr = nullptr; // H.262 only - *we* mustn't free this one
         int delta_pictures_seen;
 
         if (tswrite_command_changed(output))
             return COMMAND_RETURN_CODE;
 
-        err = get_next_stripped(
-            fcontext, verbose, quiet, &seq_hdr, &this_picture, &delta_pictures_seen);
+        err = Codec::get_next_stripped(
+            stream.scontext, verbose, quiet, &seq_hdr, &this_picture, &delta_pictures_seen);
         if (err == EOF || err == COMMAND_RETURN_CODE) {
             return err;
         } else if (err) {
             print_err("### Error getting next stripped picture\n");
             return 1;
         }
-        if (with_seq_hdrs && !is_null_picture(seq_hdr)) {
+        if (with_seq_hdrs && seq_hdr != nullptr) {
             err = write_picture_as_TS(stream, output, seq_hdr);
             if (err) {
                 print_err("### Error writing out sequence header\n");
-                free_picture(&this_picture);
+                Codec::free_picture(&this_picture);
                 return 1;
             }
         }
         err = write_picture_as_TS(stream, output, this_picture);
         if (err) {
             print_err("### Error writing out picture list\n");
-            free_picture(&this_picture);
+            Codec::free_picture(&this_picture);
             return 1;
         }
-        free_picture(&this_picture);
+        Codec::free_picture(&this_picture);
 
         total_pictures += delta_pictures_seen;
         if (num_fast > 0 && total_pictures > num_fast)
@@ -1085,23 +1018,24 @@ static int play_stripped(stream_context stream, filter_context fcontext, TS_writ
  * If command input is enabled, then it can also return COMMAND_RETURN_CODE
  * if the current command has changed.
  */
-static int play_filtered(stream_context stream, filter_context fcontext, TS_writer_p output,
-    int verbose, int quiet, int tsdirect, int num_faster, int frequency, int with_seq_hdrs)
+template <typename Codec>
+static int play_filtered(codec_stream<Codec> stream, TS_writer_p output, int verbose, int quiet,
+    int tsdirect, int num_faster, int frequency, int with_seq_hdrs)
 {
     int err;
-    ES_p es = EXTRACT_ES_FROM_STREAM(stream);
+    ES_p es = Codec::es(stream.context);
     PES_reader_p reader = es->reader;
 
-    picture this_picture;
-    picture last_picture;
-    picture seq_hdr; // H.262 only - *we* mustn't free this one
+    typename Codec::picture_p this_picture = nullptr;
+    typename Codec::picture_p last_picture = nullptr;
+    typename Codec::picture_p seq_hdr = nullptr; // H.262 only - *we* mustn't free this one
 
     int total_pictures = 0;
 
     //  stop_server_output(reader);
     // Reset our filter context so that we start filtering without remembering
     // anything about last time we filtered
-    reset_filter_context(fcontext, frequency);
+    Codec::reset_filter_context(stream.fcontext, frequency);
 
     if (!tsdirect) {
         // Ensure we've got program data available (probably not necessary,
@@ -1114,50 +1048,48 @@ static int play_filtered(stream_context stream, filter_context fcontext, TS_writ
     if (extra_info)
         print_msg("Fast forwarding (filter)\n");
 
-    unset_picture(stream.is_h262, &this_picture);
-    unset_picture(stream.is_h262, &last_picture);
     for (;;) {
         int delta_pictures_seen;
         if (tswrite_command_changed(output)) {
-            free_picture(&last_picture);
+            Codec::free_picture(&last_picture);
             err = COMMAND_RETURN_CODE;
             break;
         }
 
-        err = get_next_filtered(
-            fcontext, verbose, quiet, &seq_hdr, &this_picture, &delta_pictures_seen);
+        err = Codec::get_next_filtered(
+            stream.fcontext, verbose, quiet, &seq_hdr, &this_picture, &delta_pictures_seen);
         if (err == EOF || err == COMMAND_RETURN_CODE) {
-            free_picture(&last_picture);
+            Codec::free_picture(&last_picture);
             break;
         } else if (err) {
             print_err("### Error getting next filtered picture\n");
-            free_picture(&last_picture);
+            Codec::free_picture(&last_picture);
             return 1;
         }
-        if (is_null_picture(this_picture)) {
+        if (this_picture == nullptr) {
             // We need to repeat the last picture
             this_picture = last_picture;
-            unset_picture(stream.is_h262, &last_picture);
+            last_picture = nullptr;
         }
-        if (!is_null_picture(this_picture)) {
-            if (with_seq_hdrs && !is_null_picture(seq_hdr)) {
+        if (this_picture != nullptr) {
+            if (with_seq_hdrs && seq_hdr != nullptr) {
                 err = write_picture_as_TS(stream, output, seq_hdr);
                 if (err) {
                     print_err("### Error writing out sequence header\n");
-                    free_picture(&this_picture);
-                    free_picture(&last_picture);
+                    Codec::free_picture(&this_picture);
+                    Codec::free_picture(&last_picture);
                     return 1;
                 }
             }
             err = write_picture_as_TS(stream, output, this_picture);
             if (err) {
                 print_err("### Error writing out picture\n");
-                free_picture(&this_picture);
-                free_picture(&last_picture);
+                Codec::free_picture(&this_picture);
+                Codec::free_picture(&last_picture);
                 return 1;
             }
         }
-        free_picture(&last_picture);
+        Codec::free_picture(&last_picture);
         last_picture = this_picture;
 
         total_pictures += delta_pictures_seen;
@@ -1166,7 +1098,7 @@ static int play_filtered(stream_context stream, filter_context fcontext, TS_writ
     }
 
     // We *do* end up here if we run out of for loop...
-    free_picture(&last_picture);
+    Codec::free_picture(&last_picture);
 
     if (err == EOF) {
         // If we reached the end of the file, then back up to the final
@@ -1178,7 +1110,7 @@ static int play_filtered(stream_context stream, filter_context fcontext, TS_writ
         // know that this would also be the last frame we'd have considered
         // outputting. It's possible we've already output it, but on the whole
         // that shouldn't be terribly obvious to the user, I think.)
-        reverse_data_p reverse_data = EXTRACT_REVERSE_FROM_STREAM(stream);
+        reverse_data_p reverse_data = Codec::reverse_data(stream.context);
         // Try going back 2 I/IDR pictures...
         err = output_from_reverse_data_as_TS(es, output, verbose, quiet, 2, reverse_data);
         if (err && err != COMMAND_RETURN_CODE) {
@@ -1209,14 +1141,15 @@ static int play_filtered(stream_context stream, filter_context fcontext, TS_writ
  * If command input is enabled, then it can also return COMMAND_RETURN_CODE
  * if the current command has changed.
  */
-static int skip_forwards(stream_context stream, TS_writer_p output, filter_context fcontext,
-    int with_seq_hdrs, int num_to_skip, int verbose, int quiet, int tsdirect)
+template <typename Codec>
+static int skip_forwards(codec_stream<Codec> stream, TS_writer_p output, int with_seq_hdrs,
+    int num_to_skip, int verbose, int quiet, int tsdirect)
 {
     int err;
-    ES_p es = EXTRACT_ES_FROM_STREAM(stream);
+    ES_p es = Codec::es(stream.context);
     PES_reader_p reader = es->reader;
-    picture this_picture;
-    picture seq_hdr; // H.262 only - *we* mustn't free this one
+    typename Codec::picture_p this_picture = nullptr;
+    typename Codec::picture_p seq_hdr = nullptr; // H.262 only - *we* mustn't free this one
     int delta_pictures_seen;
 
 #if TIME_SKIPPING
@@ -1228,7 +1161,7 @@ static int skip_forwards(stream_context stream, TS_writer_p output, filter_conte
 
     // Reset our filter context so that we start filtering without remembering
     // anything about last time we filtered
-    reset_filter_context(fcontext, num_to_skip);
+    Codec::reset_filter_context(stream.fcontext, num_to_skip);
 
     if (!tsdirect) {
         // Ensure we've got program data available (probably not necessary,
@@ -1241,13 +1174,33 @@ static int skip_forwards(stream_context stream, TS_writer_p output, filter_conte
     if (extra_info)
         fprint_msg("Skipping forwards (%d frames)\n", num_to_skip);
 
-    unset_picture(stream.is_h262, &this_picture);
-
     // Say that we don't want our skipping to be interrupted by the next command
     tswrite_set_command_atomic(output, true);
 
-    err = get_next_filtered(
-        fcontext, verbose, quiet, &seq_hdr, &this_picture, &delta_pictures_seen);
+    // If the reverse indexer has already found a suitable picture, we can go
+    // straight to it, rather than reading through all the pictures between
+    reverse_data_p reverse_data = Codec::reverse_data(stream.context);
+    if (reverse_data->indexer != nullptr) {
+        int32_t target = find_reverse_data_picture(
+            reverse_data, Codec::picture_index(stream.context) + num_to_skip);
+        if (target >= 0) {
+            if (extra_info)
+                fprint_msg("Skipping to reverse data entry %d (picture %d)\n", target,
+                    reverse_data->index[target]);
+            err = output_in_reverse_as_TS(es, output, 0, verbose, quiet, target, 1, reverse_data);
+            if (err) {
+                print_err("### Error skipping forwards via the reverse data\n");
+                tswrite_set_command_atomic(output, false);
+                return err;
+            }
+            err = resync_after_reverse(stream, output, verbose, quiet);
+            tswrite_set_command_atomic(output, false);
+            return err;
+        }
+    }
+
+    err = Codec::get_next_filtered(
+        stream.fcontext, verbose, quiet, &seq_hdr, &this_picture, &delta_pictures_seen);
     if (err && err != EOF) {
         tswrite_set_command_atomic(output, false);
         if (err == COMMAND_RETURN_CODE)
@@ -1262,7 +1215,6 @@ static int skip_forwards(stream_context stream, TS_writer_p output, filter_conte
         // We hit the end of file before finding anything - so we should make
         // sure to display the "last" picture (actually, the last I/IDR picture)
         // Luckily, we can do that by "reversing" to it...
-        reverse_data_p reverse_data = EXTRACT_REVERSE_FROM_STREAM(stream);
         // Try going back 2 I/IDR pictures...
         err = output_from_reverse_data_as_TS(es, output, verbose, quiet, 2, reverse_data);
         if (err) {
@@ -1281,17 +1233,16 @@ static int skip_forwards(stream_context stream, TS_writer_p output, filter_conte
     } else {
         // Since we're only skipping once, we shouldn't get a nullptr (repeat)
         // picture back
-        if (is_null_picture(this_picture)) {
+        if (this_picture == nullptr) {
             print_err("### Skipping returned a nullptr picture\n");
-            free_picture(&this_picture);
             tswrite_set_command_atomic(output, false);
             return 1;
         }
-        if (with_seq_hdrs && !is_null_picture(seq_hdr)) {
+        if (with_seq_hdrs && seq_hdr != nullptr) {
             err = write_picture_as_TS(stream, output, seq_hdr);
             if (err) {
                 print_err("### Error writing out sequence header\n");
-                free_picture(&this_picture);
+                Codec::free_picture(&this_picture);
                 tswrite_set_command_atomic(output, false);
                 return 1;
             }
@@ -1299,11 +1250,11 @@ static int skip_forwards(stream_context stream, TS_writer_p output, filter_conte
         err = write_picture_as_TS(stream, output, this_picture);
         if (err) {
             print_err("### Error writing out picture\n");
-            free_picture(&this_picture);
+            Codec::free_picture(&this_picture);
             tswrite_set_command_atomic(output, false);
             return 1;
         }
-        free_picture(&this_picture);
+        Codec::free_picture(&this_picture);
 
         // And remember to adjust back to normal playing
         err = resync_after_filter(stream, output, verbose, quiet);
@@ -1336,11 +1287,12 @@ static int skip_forwards(stream_context stream, TS_writer_p output, filter_conte
  * If command input is enabled, then it can also return COMMAND_RETURN_CODE
  * if the current command has changed.
  */
-static int skip_backwards(stream_context stream, TS_writer_p output, int num_to_skip, int verbose,
-    int quiet, int tsdirect, reverse_data_p reverse_data)
+template <typename Codec>
+static int skip_backwards(codec_stream<Codec> stream, TS_writer_p output, int num_to_skip,
+    int verbose, int quiet, int tsdirect, reverse_data_p reverse_data)
 {
     int err;
-    ES_p es = EXTRACT_ES_FROM_STREAM(stream);
+    ES_p es = Codec::es(stream.context);
     PES_reader_p reader = es->reader;
 
     if (!tsdirect) {
@@ -1385,11 +1337,12 @@ static int skip_backwards(stream_context stream, TS_writer_p output, int num_to_
  * If command input is enabled, then it can also return COMMAND_RETURN_CODE
  * if the current command has changed.
  */
-static int play_reverse(stream_context stream, TS_writer_p output, int verbose, int quiet,
+template <typename Codec>
+static int play_reverse(codec_stream<Codec> stream, TS_writer_p output, int verbose, int quiet,
     int tsdirect, int frequency, int num_reverse, reverse_data_p reverse_data)
 {
     int err;
-    ES_p es = EXTRACT_ES_FROM_STREAM(stream);
+    ES_p es = Codec::es(stream.context);
     PES_reader_p reader = es->reader;
 
     if (extra_info)
@@ -1407,7 +1360,7 @@ static int play_reverse(stream_context stream, TS_writer_p output, int verbose,
     if (extra_info) {
         int ii;
         for (ii = 0; ii < reverse_data->length; ii++)
-            if (stream.is_h262 && reverse_data->seq_offset[ii] == 0)
+            if (Codec::has_sequence_headers && reverse_data->seq_offset[ii] == 0)
                 fprint_msg("%3d: seqh at " OFFSET_T_FORMAT "/%d for %d\n", ii,
                     reverse_data->start_file[ii], reverse_data->start_pkt[ii],
                     reverse_data->data_len[ii]);
@@ -1432,6 +1385,201 @@ static int play_reverse(stream_context stream, TS_writer_p output, int verbose,
     return err;
 }
 
+/*
+ * Obey a command that plays the current stream - that is, any command
+ * other than selecting a file or quitting.
+ *
+ * `this_command` is updated if a different command should be obeyed next.
+ *
+ * Returns 0 if all went well, EOF if the end of file is reached,
+ * otherwise 1 if an error occurred.
+ *
+ * If command input is enabled, then it can also return COMMAND_RETURN_CODE
+ * if the current command has changed.
+ */
+template <typename Codec>
+static int obey_stream_command(char* this_command, char last_command, int which, int* started,
+    PES_reader_p reader, codec_stream<Codec> stream, reverse_data_p reverse_data,
+    TS_writer_p tswriter, int video_only, int verbose, int quiet, int tsdirect, int with_seq_hdrs,
+    int ffrequency, int rfrequency)
+{
+    int err = 0;
+
+    // Catch up with whatever the reverse indexer (if any) has found since the
+    // last command
+    err = update_from_reverse_indexer(reverse_data);
+    if (err)
+        return 1;
+
+    switch (*this_command) {
+    case COMMAND_NORMAL:
+        if (!quiet)
+            fprint_msg("****************************************\n"
+                       "** [%3d] File %d: Forwards, normal speed\n",
+                tswriter->where.socket, which);
+        if (last_command != COMMAND_NORMAL && *started) {
+            err = back_to_normal(stream, tswriter, tsdirect);
+            if (err)
+                return 1;
+        }
+        *started = true;
+        set_PES_reader_video_only(reader, video_only);
+        err = play_normal(stream, tswriter, verbose, quiet, 0, tsdirect, reverse_data);
+        // If we've had a new command, and it's not 'n' again...
+        if (err == COMMAND_RETURN_CODE && tswriter->command != COMMAND_NORMAL)
+            err = flush_after_normal(stream, tswriter, verbose, quiet);
+        break;
+
+    case COMMAND_PAUSE:
+        if (!quiet)
+            fprint_msg("****************************************\n"
+                       "** [%3d] File %d: Pause\n",
+                tswriter->where.socket, which);
+        stop_server_output(reader);
+        err = wait_for_command(tswriter);
+        break;
+
+    case COMMAND_FAST:
+        if (!quiet)
+            fprint_msg("****************************************\n"
+                       "** [%3d] File %d: Fast forwards\n",
+                tswriter->where.socket, which);
+        stop_server_output(reader);
+        set_PES_reader_video_only(reader, true);
+        err = play_stripped(stream, tswriter, verbose, quiet, tsdirect, 0, with_seq_hdrs);
+        break;
+
+    case COMMAND_FAST_FAST:
+        if (!quiet)
+            fprint_msg("****************************************\n"
+                       "** [%3d] File %d: Fast fast forwards\n",
+                tswriter->where.socket, which);
+        stop_server_output(reader);
+        set_PES_reader_video_only(reader, true);
+        err = play_filtered(
+            stream, tswriter, verbose, quiet, tsdirect, 0, ffrequency, with_seq_hdrs);
+        break;
+
+    case COMMAND_REVERSE:
+        if (!quiet)
+            fprint_msg("****************************************\n"
+                       "** [%3d] File %d: Reverse\n",
+                tswriter->where.socket, which);
+        stop_server_output(reader);
+        set_PES_reader_video_only(reader, true);
+        err = play_reverse(
+            stream, tswriter, verbose, quiet, tsdirect, rfrequency, 0, reverse_data);
+        if (err == 0) {
+            if (!quiet)
+                fprint_msg("Start of file %d\n", which);
+            *this_command = COMMAND_PAUSE;
+            break;
+        }
+        break;
+
+    case COMMAND_FAST_REVERSE:
+        if (!quiet)
+            fprint_msg("****************************************\n"
+                       "** [%3d] File %d: Reverse (faster)\n",
+                tswriter->where.socket, which);
+        stop_server_output(reader);
+        set_PES_reader_video_only(reader, true);
+        err = play_reverse(
+            stream, tswriter, verbose, quiet, tsdirect, 2 * rfrequency, 0, reverse_data);
+        if (err == 0) {
+            if (!quiet)
+                fprint_msg("Start of file %d\n", which);
+            *this_command = COMMAND_PAUSE;
+            break;
+        }
+        break;
+
+    case COMMAND_SKIP_FORWARD:
+        if (!quiet)
+            fprint_msg("****************************************\n"
+                       "** [%3d] File %d: Skip forwards 10 seconds\n",
+                tswriter->where.socket, which);
+        stop_server_output(reader);
+        set_PES_reader_video_only(reader, true);
+        err = skip_forwards(
+            stream, tswriter, with_seq_hdrs, SMALL_SKIP_DISTANCE, verbose, quiet, tsdirect);
+        *this_command = COMMAND_NORMAL; // aim to continue with normal play
+        break;
+
+    case COMMAND_SKIP_BACKWARD:
+        if (!quiet)
+            fprint_msg("****************************************\n"
+                       "** [%3d] File %d: Skip backwards 10 seconds\n",
+                tswriter->where.socket, which);
+        stop_server_output(reader);
+        set_PES_reader_video_only(reader, true);
+        err = skip_backwards(
+            stream, tswriter, SMALL_SKIP_DISTANCE, verbose, quiet, tsdirect, reverse_data);
+        *this_command = COMMAND_NORMAL; // aim to continue with normal play
+        break;
+
+    case COMMAND_SKIP_FORWARD_LOTS:
+        if (!quiet)
+            fprint_msg("****************************************\n"
+                       "** [%3d] File %d: Skip forwards 3 minutes\n",
+                tswriter->where.socket, which);
+        stop_server_output(reader);
+        set_PES_reader_video_only(reader, true);
+        err = skip_forwards(
+            stream, tswriter, with_seq_hdrs, BIG_SKIP_DISTANCE, verbose, quiet, tsdirect);
+        *this_command = COMMAND_NORMAL; // aim to continue with normal play
+        break;
+
+    case COMMAND_SKIP_BACKWARD_LOTS:
+        if (!quiet)
+            fprint_msg("****************************************\n"
+                       "** [%3d] File %d: Skip backwards 3 minutes\n",
+                tswriter->where.socket, which);
+        stop_server_output(reader);
+        set_PES_reader_video_only(reader, true);
+        err = skip_backwards(
+            stream, tswriter, BIG_SKIP_DISTANCE, verbose, quiet, tsdirect, reverse_data);
+        *this_command = COMMAND_NORMAL; // aim to continue with normal play
+        break;
+    }
+    return err;
+}
+
+/*
+ * Open input file `which` again, and start a reverse indexer reading it, so
+ * that `reverse_data` can be filled in ahead of where `reader` has got to.
+ *
+ * Failing to do so is not an error - we just carry on without it.
+ */
+static void start_background_index(tsserve_context_p context, int which, PES_reader_p reader,
+    reverse_data_p reverse_data, PES_reader_p* index_reader, ES_p* index_es, int quiet)
+{
+    int err = open_PES_reader(context->input_names[which], false, false, index_reader);
+    if (err) {
+        *index_reader = nullptr;
+        goto give_up;
+    }
+    // It must see the same video stream, in the same way, as `reader`
+    set_PES_reader_video_type(*index_reader, reader->video_type);
+    set_PES_reader_video_only(*index_reader, true);
+
+    err = build_elementary_stream_PES(*index_reader, index_es);
+    if (err)
+        goto give_up;
+    err = start_reverse_indexer(reverse_data, *index_es);
+    if (err)
+        goto give_up;
+    if (!quiet)
+        fprint_msg("Indexing stream %d in the background\n", which);
+    return;
+
+give_up:
+    fprint_err("!!! Unable to index stream %d in the background - continuing without\n", which);
+    close_elementary_stream(index_es);
+    if (*index_reader != nullptr)
+        (void)close_PES_reader(index_reader);
+}
+
 /*
  * Read PES packets and write them out to the target, obeying user
  * commands as to what to do.
@@ -1441,8 +1589,7 @@ static int play_reverse(stream_context stream, TS_writer_p output, int verbose,
  */
 static int obey_command(char this_command, char last_command, int* index,
     int started[MAX_INPUT_FILES], PES_reader_p reader[MAX_INPUT_FILES],
-    stream_context stream[MAX_INPUT_FILES], filter_context fcontext[MAX_INPUT_FILES],
-    filter_context scontext[MAX_INPUT_FILES], reverse_data_p reverse_data[MAX_INPUT_FILES],
+    input_stream stream[MAX_INPUT_FILES], reverse_data_p reverse_data[MAX_INPUT_FILES],
     TS_writer_p tswriter, int video_only, int verbose, int quiet, int tsdirect, int with_seq_hdrs,
     int ffrequency, int rfrequency)
 {
@@ -1458,135 +1605,23 @@ static int obey_command(char this_command, char last_command, int* index,
 #endif
         switch (this_command) {
         case COMMAND_NORMAL:
-            if (!quiet)
-                fprint_msg("****************************************\n"
-                           "** [%3d] File %d: Forwards, normal speed\n",
-                    tswriter->where.socket, which);
-            if (last_command != COMMAND_NORMAL && started[which]) {
-                err = back_to_normal(stream[which], tswriter, tsdirect);
-                if (err)
-                    return 1;
-            }
-            started[which] = true;
-            set_PES_reader_video_only(reader[which], video_only);
-            err = play_normal(
-                stream[which], tswriter, verbose, quiet, 0, tsdirect, reverse_data[which]);
-            // If we've had a new command, and it's not 'n' again...
-            if (err == COMMAND_RETURN_CODE && tswriter->command != COMMAND_NORMAL)
-                err = flush_after_normal(stream[which], tswriter, verbose, quiet);
-            break;
-
         case COMMAND_PAUSE:
-            if (!quiet)
-                fprint_msg("****************************************\n"
-                           "** [%3d] File %d: Pause\n",
-                    tswriter->where.socket, which);
-            stop_server_output(reader[which]);
-            err = wait_for_command(tswriter);
-            break;
-
         case COMMAND_FAST:
-            if (!quiet)
-                fprint_msg("****************************************\n"
-                           "** [%3d] File %d: Fast forwards\n",
-                    tswriter->where.socket, which);
-            stop_server_output(reader[which]);
-            set_PES_reader_video_only(reader[which], true);
-            err = play_stripped(stream[which], scontext[which], tswriter, verbose, quiet, tsdirect,
-                0, with_seq_hdrs);
-            break;
-
         case COMMAND_FAST_FAST:
-            if (!quiet)
-                fprint_msg("****************************************\n"
-                           "** [%3d] File %d: Fast fast forwards\n",
-                    tswriter->where.socket, which);
-            stop_server_output(reader[which]);
-            set_PES_reader_video_only(reader[which], true);
-            err = play_filtered(stream[which], fcontext[which], tswriter, verbose, quiet, tsdirect,
-                0, ffrequency, with_seq_hdrs);
-            break;
-
         case COMMAND_REVERSE:
-            if (!quiet)
-                fprint_msg("****************************************\n"
-                           "** [%3d] File %d: Reverse\n",
-                    tswriter->where.socket, which);
-            stop_server_output(reader[which]);
-            set_PES_reader_video_only(reader[which], true);
-            err = play_reverse(stream[which], tswriter, verbose, quiet, tsdirect, rfrequency, 0,
-                reverse_data[which]);
-            if (err == 0) {
-                if (!quiet)
-                    fprint_msg("Start of file %d\n", which);
-                this_command = COMMAND_PAUSE;
-                break;
-            }
-            break;
-
         case COMMAND_FAST_REVERSE:
-            if (!quiet)
-                fprint_msg("****************************************\n"
-                           "** [%3d] File %d: Reverse (faster)\n",
-                    tswriter->where.socket, which);
-            stop_server_output(reader[which]);
-            set_PES_reader_video_only(reader[which], true);
-            err = play_reverse(stream[which], tswriter, verbose, quiet, tsdirect, 2 * rfrequency,
-                0, reverse_data[which]);
-            if (err == 0) {
-                if (!quiet)
-                    fprint_msg("Start of file %d\n", which);
-                this_command = COMMAND_PAUSE;
-                break;
-            }
-            break;
-
         case COMMAND_SKIP_FORWARD:
-            if (!quiet)
-                fprint_msg("****************************************\n"
-                           "** [%3d] File %d: Skip forwards 10 seconds\n",
-                    tswriter->where.socket, which);
-            stop_server_output(reader[which]);
-            set_PES_reader_video_only(reader[which], true);
-            err = skip_forwards(stream[which], tswriter, fcontext[which], with_seq_hdrs,
-                SMALL_SKIP_DISTANCE, verbose, quiet, tsdirect);
-            this_command = COMMAND_NORMAL; // aim to continue with normal play
-            break;
-
         case COMMAND_SKIP_BACKWARD:
-            if (!quiet)
-                fprint_msg("****************************************\n"
-                           "** [%3d] File %d: Skip backwards 10 seconds\n",
-                    tswriter->where.socket, which);
-            stop_server_output(reader[which]);
-            set_PES_reader_video_only(reader[which], true);
-            err = skip_backwards(stream[which], tswriter, SMALL_SKIP_DISTANCE, verbose, quiet,
-                tsdirect, reverse_data[which]);
-            this_command = COMMAND_NORMAL; // aim to continue with normal play
-            break;
-
         case COMMAND_SKIP_FORWARD_LOTS:
-            if (!quiet)
-                fprint_msg("****************************************\n"
-                           "** [%3d] File %d: Skip forwards 3 minutes\n",
-                    tswriter->where.socket, which);
-            stop_server_output(reader[which]);
-            set_PES_reader_video_only(reader[which], true);
-            err = skip_forwards(stream[which], tswriter, fcontext[which], with_seq_hdrs,
-                BIG_SKIP_DISTANCE, verbose, quiet, tsdirect);
-            this_command = COMMAND_NORMAL; // aim to continue with normal play
-            break;
-
         case COMMAND_SKIP_BACKWARD_LOTS:
-            if (!quiet)
-                fprint_msg("****************************************\n"
-                           "** [%3d] File %d: Skip backwards 3 minutes\n",
-                    tswriter->where.socket, which);
-            stop_server_output(reader[which]);
-            set_PES_reader_video_only(reader[which], true);
-            err = skip_backwards(stream[which], tswriter, BIG_SKIP_DISTANCE, verbose, quiet,
-                tsdirect, reverse_data[which]);
-            this_command = COMMAND_NORMAL; // aim to continue with normal play
+            if (stream[which].is_h262)
+                err = obey_stream_command(&this_command, last_command, which, &started[which],
+                    reader[which], stream[which].h262, reverse_data[which], tswriter, video_only,
+                    verbose, quiet, tsdirect, with_seq_hdrs, ffrequency, rfrequency);
+            else
+                err = obey_stream_command(&this_command, last_command, which, &started[which],
+                    reader[which], stream[which].h264, reverse_data[which], tswriter, video_only,
+                    verbose, quiet, tsdirect, with_seq_hdrs, ffrequency, rfrequency);
             break;
 
         case COMMAND_SELECT_FILE_0:
@@ -1704,8 +1739,7 @@ static int obey_command(char this_command, char last_command, int* index,
  * Returns 0 if all went well, 1 if an error occurred.
  */
 static int play(int default_index, PES_reader_p reader[MAX_INPUT_FILES],
-    stream_context stream[MAX_INPUT_FILES], filter_context fcontext[MAX_INPUT_FILES],
-    filter_context scontext[MAX_INPUT_FILES], reverse_data_p reverse_data[MAX_INPUT_FILES],
+    input_stream stream[MAX_INPUT_FILES], reverse_data_p reverse_data[MAX_INPUT_FILES],
     TS_writer_p tswriter, int video_only, int verbose, int quiet, int tsdirect, int with_seq_hdrs,
     int ffrequency, int rfrequency)
 {
@@ -1754,9 +1788,9 @@ static int play(int default_index, PES_reader_p reader[MAX_INPUT_FILES],
         fprint_msg("xx Command is '%c', last command '%c'\n", this_command, last_command);
 #endif
 
-        err = obey_command(this_command, last_command, &which, started, reader, stream, fcontext,
-            scontext, reverse_data, tswriter, video_only, verbose, quiet, tsdirect, with_seq_hdrs,
-            ffrequency, rfrequency);
+        err = obey_command(this_command, last_command, &which, started, reader, stream,
+            reverse_data, tswriter, video_only, verbose, quiet, tsdirect, with_seq_hdrs, ffrequency,
+            rfrequency);
         if (err == EOF)
             return 0; // The user gave the 'q'uit command
         else if (err) {
@@ -1780,9 +1814,9 @@ static int play_pes_packets(PES_reader_p reader[MAX_INPUT_FILES], TS_writer_p ts
     int ii;
     ES_p es[MAX_INPUT_FILES]; // A view of our PES packets as ES units
     reverse_data_p reverse_data[MAX_INPUT_FILES];
-    stream_context stream[MAX_INPUT_FILES];
-    filter_context fcontext[MAX_INPUT_FILES];
-    filter_context scontext[MAX_INPUT_FILES];
+    input_stream stream[MAX_INPUT_FILES];
+    PES_reader_p index_reader[MAX_INPUT_FILES]; // The same files, for the reverse indexers
+    ES_p index_es[MAX_INPUT_FILES];
 
     if (!quiet)
         print_msg("\nSetting up environment\n");
@@ -1802,15 +1836,15 @@ static int play_pes_packets(PES_reader_p reader[MAX_INPUT_FILES], TS_writer_p ts
     for (ii = 0; ii < MAX_INPUT_FILES; ii++) {
         es[ii] = nullptr;
         reverse_data[ii] = nullptr;
+        index_reader[ii] = nullptr;
+        index_es[ii] = nullptr;
 
-        // Closing uninitialised things is a bit dodgy if we don't indicate
-        // what *type* of unset value is being used. However, in practice
-        // it doesn't matter much, as both the H.262 and H.264 "destroy"
-        // functions for streams and filter contexts sensibly do nothing
-        // with a nullptr value - so we might as well just say the same for all...
-        stream[ii].is_h262 = fcontext[ii].is_h262 = scontext[ii].is_h262 = false;
-        stream[ii].u.h262 = nullptr;
-        fcontext[ii].u.h262 = scontext[ii].u.h262 = nullptr;
+        // Both the H.262 and H.264 "destroy" functions for streams and filter
+        // contexts sensibly do nothing with a nullptr value, so we can tidy up
+        // whichever type of stream has been (partly) built
+        stream[ii].is_h262 = false;
+        stream[ii].h262 = {};
+        stream[ii].h264 = {};
     }
 
     // Start off our output with some null packets - this is in case the
@@ -1843,52 +1877,43 @@ static int play_pes_packets(PES_reader_p reader[MAX_INPUT_FILES], TS_writer_p ts
             goto tidy_up;
         }
 
-        // Put an access unit or H.262 unit context around that
-        err = build_stream(es[ii], !(reader[ii]->is_h264), ii + 1, &stream[ii]);
+        // Put an access unit or H.262 unit context around that, with our
+        // reverse memory datastructure and fast forwards filter contexts
+        stream[ii].is_h262 = !(reader[ii]->is_h264);
+        if (stream[ii].is_h262)
+            err = build_codec_stream(es[ii], context->ffrequency, context->with_seq_hdrs,
+                &stream[ii].h262, &reverse_data[ii]);
+        else
+            err = build_codec_stream(es[ii], context->ffrequency, context->with_seq_hdrs,
+                &stream[ii].h264, &reverse_data[ii]);
         if (err) {
             fprint_err("### Unable to build input stream %d\n", ii);
             goto tidy_up;
         }
 
-        // Build our reverse memory datastructure
-        err = build_and_attach_reverse(stream[ii], &reverse_data[ii]);
-        if (err) {
-            fprint_err("### Unable to build reverse memory for stream %d\n", ii);
-            goto tidy_up;
-        }
-
         // Tell it what PID and stream id to use when outputting reversed data
         set_reverse_pid(reverse_data[ii], reader[ii]->output_video_pid, DEFAULT_VIDEO_STREAM_ID);
 
-        if (!context->with_seq_hdrs)
-            reverse_data[ii]->output_sequence_headers = false;
-
-        // Build our fast forwards filter contexts
-        err = build_filter_context(stream[ii], false, context->ffrequency, &fcontext[ii]);
-        if (err) {
-            fprint_err("### Unable to build filter context for stream %d\n", ii);
-            goto tidy_up;
-        }
-
-        err = build_filter_context(stream[ii], true, 0, &scontext[ii]);
-        if (err) {
-            fprint_err("### Unable to build strip context for stream %d\n", ii);
-            goto tidy_up;
-        }
+        if (context->background_index)
+            start_background_index(context, ii, reader[ii], reverse_data[ii], &index_reader[ii],
+                &index_es[ii], quiet);
     }
 
     // And, at last, do what we came for
-    err = play(context->default_file_index, reader, stream, fcontext, scontext, reverse_data,
-        tswriter, context->video_only, verbose, quiet, context->tsdirect, context->with_seq_hdrs,
+    err = play(context->default_file_index, reader, stream, reverse_data, tswriter,
+        context->video_only, verbose, quiet, context->tsdirect, context->with_seq_hdrs,
         context->ffrequency, context->rfrequency);
 
 tidy_up:
     for (ii = 0; ii < MAX_INPUT_FILES; ii++) {
         close_elementary_stream(&es[ii]);
+        // Which also stops any reverse indexer, so we can then close its input
         free_reverse_data(&reverse_data[ii]);
-        close_stream(stream[ii]);
-        free_filter_context(fcontext[ii]);
-        free_filter_context(scontext[ii]);
+        free_codec_stream(&stream[ii].h262);
+        free_codec_stream(&stream[ii].h264);
+        close_elementary_stream(&index_es[ii]);
+        if (index_reader[ii] != nullptr)
+            (void)close_PES_reader(&index_reader[ii]);
     }
 
     return err;
@@ -1900,10 +1925,11 @@ tidy_up:
  *
  * Returns 0 if all went well, 1 if an error occurred.
  */
-static int test_play(PES_reader_p reader, stream_context stream, filter_context fcontext,
-    filter_context scontext, reverse_data_p reverse_data, TS_writer_p tswriter, int video_only,
-    int verbose, int quiet, int tsdirect, int num_normal, int num_fast, int num_faster,
-    int num_reverse, int ffrequency, int rfrequency, int with_seq_hdrs)
+template <typename Codec>
+static int test_play(PES_reader_p reader, codec_stream<Codec> stream, reverse_data_p reverse_data,
+    TS_writer_p tswriter, int video_only, int verbose, int quiet, int tsdirect, int num_normal,
+    int num_fast, int num_faster, int num_reverse, int ffrequency, int rfrequency,
+    int with_seq_hdrs)
 {
     int err = 0;
     int started = false;
@@ -1954,8 +1980,7 @@ static int test_play(PES_reader_p reader, stream_context stream, filter_context
             print_msg("\n\n");
         fprint_msg("** Fast forward for %d\n", num_fast);
         set_PES_reader_video_only(reader, true);
-        err = play_stripped(
-            stream, scontext, tswriter, verbose, quiet, tsdirect, num_fast, with_seq_hdrs);
+        err = play_stripped(stream, tswriter, verbose, quiet, tsdirect, num_fast, with_seq_hdrs);
         if (err == EOF)
             break;
         else if (err)
@@ -1990,8 +2015,8 @@ static int test_play(PES_reader_p reader, stream_context stream, filter_context
             print_msg("\n\n");
         fprint_msg("** Faster forward for %d\n", num_faster);
         set_PES_reader_video_only(reader, true);
-        err = play_filtered(stream, fcontext, tswriter, verbose, quiet, tsdirect, num_faster,
-            ffrequency, with_seq_hdrs);
+        err = play_filtered(
+            stream, tswriter, verbose, quiet, tsdirect, num_faster, ffrequency, with_seq_hdrs);
         if (err == EOF)
             break;
         else if (err)
@@ -2049,9 +2074,9 @@ static int test_play(PES_reader_p reader, stream_context stream, filter_context
  *
  * Returns 0 if all went well, 1 if an error occurred.
  */
-static int test_skip(PES_reader_p reader, stream_context stream, filter_context fcontext,
-    filter_context scontext, reverse_data_p reverse_data, TS_writer_p tswriter, int video_only,
-    int verbose, int quiet, int tsdirect, int with_seq_hdrs)
+template <typename Codec>
+static int test_skip(PES_reader_p reader, codec_stream<Codec> stream, reverse_data_p reverse_data,
+    TS_writer_p tswriter, int video_only, int verbose, int quiet, int tsdirect, int with_seq_hdrs)
 {
     int err = 0;
     int num_normal = 100;
@@ -2093,8 +2118,8 @@ static int test_skip(PES_reader_p reader, stream_context stream, filter_context
         print_msg("** Skip forwards\n");
         stop_server_output(reader);
         set_PES_reader_video_only(reader, true);
-        err = skip_forwards(stream, tswriter, fcontext, with_seq_hdrs, SMALL_SKIP_DISTANCE,
-            verbose, quiet, tsdirect);
+        err = skip_forwards(
+            stream, tswriter, with_seq_hdrs, SMALL_SKIP_DISTANCE, verbose, quiet, tsdirect);
         if (err == EOF)
             break;
         else if (err)
@@ -2106,8 +2131,8 @@ static int test_skip(PES_reader_p reader, stream_context stream, filter_context
         print_msg("** Skip forwards\n");
         stop_server_output(reader);
         set_PES_reader_video_only(reader, true);
-        err = skip_forwards(stream, tswriter, fcontext, with_seq_hdrs, SMALL_SKIP_DISTANCE,
-            verbose, quiet, tsdirect);
+        err = skip_forwards(
+            stream, tswriter, with_seq_hdrs, SMALL_SKIP_DISTANCE, verbose, quiet, tsdirect);
         if (err == EOF)
             break;
         else if (err)
@@ -2187,8 +2212,8 @@ static int test_skip(PES_reader_p reader, stream_context stream, filter_context
         print_msg("** Skip forwards\n");
         stop_server_output(reader);
         set_PES_reader_video_only(reader, true);
-        err = skip_forwards(stream, tswriter, fcontext, with_seq_hdrs, SMALL_SKIP_DISTANCE,
-            verbose, quiet, tsdirect);
+        err = skip_forwards(
+            stream, tswriter, with_seq_hdrs, SMALL_SKIP_DISTANCE, verbose, quiet, tsdirect);
         if (err == EOF)
             break;
         else if (err)
@@ -2242,6 +2267,45 @@ static int test_skip(PES_reader_p reader, stream_context stream, filter_context
     return 0;
 }
 
+/*
+ * Build the contexts for a stream of the given codec, and then alternate
+ * normal speed, fast forward and reverse (in some sequence), or test
+ * skipping if `skiptest`.
+ *
+ * `reverse_data` is set to the reverse data built, which our caller frees.
+ *
+ * Returns 0 if all went well, 1 if an error occurred.
+ */
+template <typename Codec>
+static int test_play_stream(PES_reader_p reader, ES_p es, TS_writer_p tswriter, int video_only,
+    int verbose, int quiet, int tsdirect, int num_normal, int num_fast, int num_faster,
+    int num_reverse, int ffrequency, int rfrequency, int skiptest, int with_seq_hdrs,
+    reverse_data_p* reverse_data)
+{
+    int err;
+    codec_stream<Codec> stream = {};
+
+    // There are only sequence headers to output if the codec has them
+    with_seq_hdrs = with_seq_hdrs && Codec::has_sequence_headers;
+
+    err = build_codec_stream(es, ffrequency, with_seq_hdrs, &stream, reverse_data);
+    if (err) {
+        free_codec_stream(&stream);
+        return 1;
+    }
+
+    if (skiptest)
+        err = test_skip(reader, stream, *reverse_data, tswriter, video_only, verbose, quiet,
+            tsdirect, with_seq_hdrs);
+    else
+        err = test_play(reader, stream, *reverse_data, tswriter, video_only, verbose, quiet,
+            tsdirect, num_normal, num_fast, num_faster, num_reverse, ffrequency, rfrequency,
+            with_seq_hdrs);
+
+    free_codec_stream(&stream);
+    return err;
+}
+
 /*
  * Read PES packets and write them out to the target. Alternate normal
  * speed, fast forward and reverse (in some sequence).
@@ -2257,9 +2321,6 @@ static int test_play_pes_packets(PES_reader_p reader, TS_writer_p tswriter,
     int ii;
     ES_p es; // A view of our PES packets as ES units
     reverse_data_p reverse_data = nullptr;
-    stream_context stream;
-    filter_context fcontext;
-    filter_context scontext;
 
     // Start off our output with some null packets - this is in case the
     // reader needs some time to work out its byte alignment before it starts
@@ -2289,116 +2350,14 @@ static int test_play_pes_packets(PES_reader_p reader, TS_writer_p tswriter,
         return 1;
     }
 
-    // Build our reverse memory datastructure
-    err = build_reverse_data(&reverse_data, reader->is_h264);
-    if (err) {
-        print_err("### Unable to build reverse memory\n");
-        close_elementary_stream(&es);
-        return 1;
-    }
-
-    stream.is_h262 = fcontext.is_h262 = scontext.is_h262 = !(reader->is_h264);
-
-    if (reader->is_h264) {
-        access_unit_context_p acontext; // Our ES data as access units
-        h264_filter_context_p fcontext4 = nullptr; // And a filter over that
-        h264_filter_context_p scontext4 = nullptr; // And another
-
-        err = build_access_unit_context(es, &acontext);
-        if (err) {
-            print_err("### Error trying to build access unit reader from ES reader\n");
-            close_elementary_stream(&es);
-            free_reverse_data(&reverse_data);
-            return 1;
-        }
-        add_access_unit_reverse_context(acontext, reverse_data);
-
-        err = build_h264_filter_context(&fcontext4, acontext, ffrequency);
-        if (err) {
-            print_err("### Unable to build filter context\n");
-            close_elementary_stream(&es);
-            free_reverse_data(&reverse_data);
-            free_access_unit_context(&acontext);
-            return 1;
-        }
-
-        err = build_h264_filter_context_strip(&scontext4, acontext, true);
-        if (err) {
-            print_err("### Unable to build strip context\n");
-            close_elementary_stream(&es);
-            free_reverse_data(&reverse_data);
-            free_access_unit_context(&acontext);
-            free_h264_filter_context(&fcontext4);
-            return 1;
-        }
-
-        stream.u.h264 = acontext;
-        fcontext.u.h264 = fcontext4;
-        scontext.u.h264 = scontext4;
-
-        if (skiptest)
-            err = test_skip(reader, stream, fcontext, scontext, reverse_data, tswriter, video_only,
-                verbose, quiet, tsdirect, false);
-        else
-            err = test_play(reader, stream, fcontext, scontext, reverse_data, tswriter, video_only,
-                verbose, quiet, tsdirect, num_normal, num_fast, num_faster, num_reverse,
-                ffrequency, rfrequency, false);
-
-        free_access_unit_context(&acontext);
-        free_h264_filter_context(&fcontext4);
-        free_h264_filter_context(&scontext4);
-    } else {
-        h262_context_p h262; // Our ES data as H.262 items
-        h262_filter_context_p fcontext2 = nullptr; // And a filter over that
-        h262_filter_context_p scontext2 = nullptr; // And another
-
-        if (!with_seq_hdrs)
-            reverse_data->output_sequence_headers = false;
-
-        err = build_h262_context(es, &h262);
-        if (err) {
-            print_err("### Error trying to build H.262 reader from ES reader\n");
-            close_elementary_stream(&es);
-            free_reverse_data(&reverse_data);
-            return 1;
-        }
-        add_h262_reverse_context(h262, reverse_data);
-
-        err = build_h262_filter_context(&fcontext2, h262, ffrequency);
-        if (err) {
-            print_err("### Unable to build filter context\n");
-            close_elementary_stream(&es);
-            free_reverse_data(&reverse_data);
-            free_h262_context(&h262);
-            return 1;
-        }
-
-        err = build_h262_filter_context_strip(&scontext2, h262, true);
-        if (err) {
-            print_err("### Unable to build strip context\n");
-            close_elementary_stream(&es);
-            free_reverse_data(&reverse_data);
-            free_h262_context(&h262);
-            free_h262_filter_context(&fcontext2);
-            return 1;
-        }
-
-        stream.u.h262 = h262;
-        fcontext.u.h262 = fcontext2;
-        scontext.u.h262 = scontext2;
-
-        if (skiptest)
-            err = test_skip(reader, stream, fcontext, scontext, reverse_data, tswriter, video_only,
-                verbose, quiet, tsdirect, with_seq_hdrs);
-        else
-            err = test_play(reader, stream, fcontext, scontext, reverse_data, tswriter, video_only,
-                verbose, quiet, tsdirect, num_normal, num_fast, num_faster, num_reverse,
-                ffrequency, rfrequency, with_seq_hdrs);
-
-        free_h262_context(&h262);
-        free_h262_filter_context(&fcontext2);
-        free_h262_filter_context(&scontext2);
-    }
+    if (reader->is_h264)
+        err = test_play_stream<h264_traits>(reader, es, tswriter, video_only, verbose, quiet,
+            tsdirect, num_normal, num_fast, num_faster, num_reverse, ffrequency, rfrequency,
+            skiptest, with_seq_hdrs, &reverse_data);
+    else
+        err = test_play_stream<h262_traits>(reader, es, tswriter, video_only, verbose, quiet,
+            tsdirect, num_normal, num_fast, num_faster, num_reverse, ffrequency, rfrequency,
+            skiptest, with_seq_hdrs, &reverse_data);
 
     close_elementary_stream(&es);
     free_reverse_data(&reverse_data);
@@ -2550,6 +2509,11 @@ static int tsserve_child_process(struct server_args* args)
 
     if (!quiet)
         print_msg("Finished talking to client\n");
+    if (verbose) {
+        for (ii = 0; ii < MAX_INPUT_FILES; ii++)
+            if (reader[ii] != nullptr)
+                report_PES_reader_seeks(true, reader[ii]);
+    }
     err = tswrite_close(tswriter, quiet);
     if (err) {
         for (ii = 0; ii < MAX_INPUT_FILES; ii++)
@@ -2735,6 +2699,8 @@ static int test_reader(tsserve_context_p context, int output_to_file, char* outp
         (void)close_PES_reader(&reader);
         return 1;
     }
+    if (verbose)
+        report_PES_reader_seeks(true, reader);
 
     err = tswrite_close(tswriter, quiet);
     if (err) {
@@ -2876,6 +2842,8 @@ static void print_usage()
               "\n"
               "  -noseqhdr         Do not output sequence headers for fast forward/reverse\n"
               "                    data. Only relevant to H.262 data.\n"
+              "  -noindex          Do not index each file in the background while playing\n"
+              "                    it. The index lets skipping forwards jump ahead.\n"
               "\n"
               "Program Stream Switches:\n"
               "\n"
@@ -2964,6 +2932,8 @@ static void print_detailed_usage()
         "\n"
         "  -noseqhdr         Do not output sequence headers for fast forward/reverse\n"
         "                    data. Only relevant to H.262 data.\n"
+        "  -noindex          Do not index each file in the background while playing\n"
+        "                    it. The index lets skipping forwards jump ahead.\n"
         "\n"
         "Program Stream Switches:\n"
         "\n"
@@ -2996,6 +2966,12 @@ static void print_detailed_usage()
         "  to allow building up the fast forward/reverse indices.\n"
         "  Also, -prepeat, -pes_padding and -drop will have no effect with this switch.\n"
         "\n"
+        "  With -tsdirect, normal play sends the input file straight to the client\n"
+        "  (using sendfile), and only reads it when the command changes, so long\n"
+        "  as the file is being indexed in the background (see -noindex).\n"
+        "\n"
+        "  -nosendfile       Read and write each TS packet in normal play, instead.\n"
+        "\n"
         "Other stuff:\n"
         "\n"
         "  -prepeat <n>      Output the program data (PAT/PMT) after every <n>\n"
@@ -3126,6 +3102,8 @@ int main(int argc, char** argv)
     // Transport Stream specific options
     context.tsdirect = false; // Write to server as a side effect of PES reading
 
+    context.background_index = true;
+
     context.force_stream_type = false;
     context.want_h262 = true; // shouldn't matter
     context.dolby_is_dvb = true;
@@ -3160,6 +3138,8 @@ int main(int argc, char** argv)
                 return 0;
             } else if (!strcmp("-noseqhdr", argv[argno]) || !strcmp("-noseqhdrs", argv[argno])) {
                 context.with_seq_hdrs = false;
+            } else if (!strcmp("-noindex", argv[argno])) {
+                context.background_index = false;
             } else if (!strcmp("-skiptest", argv[argno])) {
                 action = ACTION_TEST;
                 skiptest = true;
@@ -3168,6 +3148,8 @@ int main(int argc, char** argv)
                 skiptest = false;
             } else if (!strcmp("-tsdirect", argv[argno])) {
                 context.tsdirect = true; // Write to server as a side effect of TS reading
+            } else if (!strcmp("-nosendfile", argv[argno])) {
+                send_directly = false;
             } else if (!strcmp("-n", argv[argno])) {
                 CHECKARG("tsserve", argno);
                 err = int_value("tsserve", argv[argno], argv[argno + 1], true, 10, &num_normal);